@@ -55,7 +55,6 @@ def run_fwd_bwd(
     batch_size = ffconfig.batch_size
     dataloaders = list(input_dls) + [label_dl]
     num_samples = label_dl.num_samples
-    ffmodel._tracing_id += 1
     for d in dataloaders:
         d.reset()
     ffmodel.reset_metrics()
@@ -63,12 +62,10 @@ def run_fwd_bwd(
     assert num_iters == 1, "Internal error: batch size mismatch"
     for d in dataloaders:
         d.next_batch(ffmodel)
-    ffmodel._ffconfig.begin_trace(ffmodel._tracing_id)
     ffmodel.forward()
     if run_bwd:
         ffmodel.zero_gradients()
         ffmodel.backward()
-    ffmodel._ffconfig.end_trace(ffmodel._tracing_id)
     ffmodel_barrier(ffmodel)
 
 
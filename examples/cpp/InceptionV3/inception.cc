@@ -204,16 +204,10 @@ void FlexFlow::top_level_task(Task const *task,
       /* } else { */
       /*   data_loader.next_batch(ff); */
       /* } */
-      if (epoch > 0) {
-        runtime->begin_trace(ctx, 111 /*trace_id*/);
-      }
       ff.forward();
       ff.zero_gradients();
       ff.backward();
       ff.update();
-      if (epoch > 0) {
-        runtime->end_trace(ctx, 111 /*trace_id*/);
-      }
     }
   }
   // End timer
@@ -31,72 +31,6 @@ void parse_input_args(char **argv, int argc, MoeConfig &config) {
   }
 }
 
-#ifdef DEADCODE
-// =============================================================================
-//  User-defined functions on using cached expert assignments
-// =============================================================================
-
-// Score: Running average over sample ratio of which experts are corr. cached
-float moe_score(float *cached_score,
-                void const *input,
-                void const *cached,
-                int vol) {
-  float gamma = 0.99f;
-  *cached_score *= gamma;
-  int *cast_input = (int *)input;
-  int *cast_cached = (int *)cached;
-  int batch_size = vol / num_select;
-  float frac = (1.0f - gamma) / batch_size;
-  for (int i = 0; i < batch_size; i++) {
-    std::set<int, std::greater<int>> cached;
-    std::set<int, std::greater<int>> input;
-    for (int j = 0; j < num_select; j++) {
-      cached.insert(cast_input[i * num_select + j]);
-      input.insert(cast_cached[i * num_select + j]);
-    }
-    if (cached == input) {
-      *cached_score += frac;
-    }
-  }
-  return *cached_score;
-}
-
-// Trigger: If average score of all cache layers is above thresh
-bool moe_trigger(FFModel *ff) {
-  float thresh = 0.9f;
-
-  int num_futures = 0;
-  float score = 0.0f;
-  for (size_t i = 0; i < ff->layers.size(); i++) {
-    if (ff->layers[i]->op_type == OP_CACHE) {
-      int num_futures_i = ((Cache *)ff->layers[i])->score_futures.size();
-      num_futures += num_futures_i;
-      for (int j = 0; j < num_futures_i; j++) {
-        score += ((Cache *)ff->layers[i])->score_futures[j].get_result<float>();
-      }
-    }
-  }
-  return score >= thresh;
-}
-
-// Alter: GroupBy, Aggregate, AggregateSpec use cached values for expert assign.
-void moe_alter(FFModel *ff) {
-  ((Cache *)ff->layers[3])->use_cached(true);
-  // Group by input
-  ff->layers[4]->inputs[1] = ff->layers[3]->outputs[0];
-  ff->layers[4]->input_lps[1] = ff->layers[3]->outputs[0].part;
-  ff->layers[4]->input_grad_lps[1] = ff->layers[3]->outputs[0].part_grad;
-  // Aggregate input
-  ff->layers[16]->inputs[1] = ff->layers[3]->outputs[0];
-  ff->layers[16]->input_lps[1] = ff->layers[3]->outputs[0].part;
-  ff->layers[16]->input_grad_lps[1] = ff->layers[3]->outputs[0].part_grad;
-  // AggregateSpec input
-  ff->layers[17]->inputs[1] = ff->layers[3]->outputs[0];
-  ff->layers[17]->input_lps[1] = ff->layers[3]->outputs[0].part;
-  ff->layers[17]->input_grad_lps[1] = ff->layers[3]->outputs[0].part_grad;
-}
-#endif // DEADCODE
-
 Tensor create_moe_encoder(FFModel *model,
                           MoeConfig const *moeConfig,
                           Tensor const &input) {
@@ -177,7 +111,9 @@ void FlexFlow::top_level_task(Task const *task,
   ff.get_parallel_tensor_from_tensor(input, input_pt);
   ff.get_parallel_tensor_from_tensor(ff.label_tensor, label_pt);
   DataLoader data_loader(ff, moeConfig, input_pt, label_pt);
-  //  RecompileState r(&moe_trigger, &moe_alter, &ff);
+  // Re-plans the expert capacities and the placement of the operators from
+  // the loads measured during training
+  RecompileState r(&ff, ReplanConfig());
   ff.init_operators();
   // Start timer
   {
@@ -194,17 +130,11 @@ void FlexFlow::top_level_task(Task const *task,
 
     for (int iter = 0; iter < iterations; iter++) {
       data_loader.next_batch(ff);
-      if (epoch > 0) {
-        runtime->begin_trace(ctx, 111 /*trace_id*/);
-      }
       ff.forward();
       ff.zero_gradients();
       ff.backward();
       ff.update();
-      // ff.recompile_on_condition(r);
-      if (epoch > 0) {
-        runtime->end_trace(ctx, 111 /*trace_id*/);
-      }
+      ff.recompile_on_condition(r);
     }
 
     // TODO: Do properly
@@ -58,12 +58,10 @@ void FlexFlow::top_level_task(Task const *task,
     int iterations = 128; // data_loader.num_samples / ffConfig.batchSize;
 
     for (int iter = 0; iter < iterations; iter++) {
-      runtime->begin_trace(ctx, 111 /*trace_id*/);
       ff.forward();
       ff.zero_gradients();
       ff.backward();
       ff.update();
-      runtime->end_trace(ctx, 111 /*trace_id*/);
     }
   }
   // End timer
@@ -112,9 +112,7 @@ def top_level_task():
     iterations = args.iterations
     for it in range(iterations):
 #        print(f" ITERATION: {it}")
-        ffconfig.begin_trace(111)
         ffmodel.forward(seq_length=it)
-        ffconfig.end_trace(111)
     ts_end = ffconfig.get_current_time()
     print(f" Time taken to run forward pass: {(ts_end - ts_start)/iterations}")
 
@@ -59,12 +59,10 @@ def attention():
     ffmodel.reset_metrics()
     iterations = num_samples // batch_size
     for iter in range(0, iterations):
-      ffconfig.begin_trace(111)
       ffmodel.forward()
       ffmodel.zero_gradients()
       ffmodel.backward()
       ffmodel.update()
-      ffconfig.end_trace(111)
   ts_end = ffconfig.get_current_time()
   run_time = 1e-6 * (ts_end - ts_start)
   print("EPOCHS %d, ELAPSED TIME = %.4fs, THROUGHPUT = %.2f samples/s\n" %(epochs, run_time, num_samples * epochs / run_time));
@@ -9,6 +9,12 @@
 #include <cuda_fp16.h>
 #elif defined(FF_USE_HIP_ROCM)
 #include <hip/hip_fp16.h>
+#elif defined(FF_USE_CPU_ONLY)
+#include <cstdint>
+// Storage of a 16-bit float, which is only computed on by device kernels
+struct half {
+  uint16_t x;
+};
 #endif
 
 // using namespace Legion;
@@ -0,0 +1,85 @@
+#ifndef _FLEXFLOW_ALLREDUCE_SCHEDULE_H
+#define _FLEXFLOW_ALLREDUCE_SCHEDULE_H
+
+#include "flexflow/ffconst.h"
+#include <string>
+#include <vector>
+
+namespace FlexFlow {
+
+/**
+ * A point-to-point transfer between two participants of an allreduce, given
+ * by their positions in the group
+ */
+struct AllreduceTransfer {
+  int src, dst;
+  double bytes;
+};
+
+/**
+ * Transfers that run concurrently. A step starts once the previous one has
+ * completed. latency_hops is the number of link latencies a step pays: the
+ * number of sequential sub-steps of a ring phase, or of tree levels crossed
+ * by a pipelined tree phase.
+ */
+struct AllreduceStep {
+  std::vector<AllreduceTransfer> transfers;
+  int latency_hops = 1;
+};
+
+/**
+ * Bandwidths in bytes/ms and latencies in ms, as reported by MachineModel
+ */
+struct AllreduceLinkModel {
+  float intra_node_bandwidth, inter_node_bandwidth;
+  float intra_node_latency, inter_node_latency;
+};
+
+/**
+ * @brief Builds the communication schedule of an allreduce of message_size
+ * bytes with the given algorithm.
+ *
+ * @param node_ids the node each participant lives on
+ * @param ring_dir direction of the flat ring (1 or -1)
+ * @return an empty schedule if the algorithm does not apply to this group
+ * (e.g. the hierarchical algorithms on a single node)
+ */
+std::vector<AllreduceStep>
+    get_allreduce_schedule(AllreduceAlgorithm algorithm,
+                           std::vector<int> const &node_ids,
+                           double message_size,
+                           int ring_dir = 1);
+
+/**
+ * @brief Builds the single step of an all-to-all among num_participants, in
+ * which each participant holds message_size bytes and sends an equal share of
+ * them to every other participant. estimate_allreduce_time applies to it as
+ * to the allreduce schedules.
+ */
+std::vector<AllreduceStep> get_all_to_all_schedule(int num_participants,
+                                                   double message_size);
+
+/**
+ * Alpha-beta estimate of the run time of a schedule. Within a step, the
+ * transfers sent by the same GPU share its intra-node bandwidth and those
+ * leaving the same node share its network bandwidth.
+ */
+float estimate_allreduce_time(std::vector<AllreduceStep> const &schedule,
+                              std::vector<int> const &node_ids,
+                              AllreduceLinkModel const &links);
+
+/**
+ * @return the applicable algorithm with the lowest estimated run time for
+ * this group and message size, preferring the flat ring on ties
+ */
+AllreduceAlgorithm
+    select_allreduce_algorithm(std::vector<int> const &node_ids,
+                               double message_size,
+                               AllreduceLinkModel const &links);
+
+bool parse_allreduce_algorithm(std::string const &name,
+                               AllreduceAlgorithm &algorithm);
+
+}; // namespace FlexFlow
+
+#endif // _FLEXFLOW_ALLREDUCE_SCHEDULE_H
@@ -24,6 +24,8 @@
 #elif defined(FF_USE_HIP_ROCM)
 #include <hipblas.h>
 #include <miopen/miopen.h>
+#elif defined(FF_USE_CPU_ONLY)
+// no device libraries
 #else
 #error "Unknown device"
 #endif
@@ -42,7 +44,11 @@ namespace FlexFlow {
 #define MAX_NUM_OUTPUTS 256
 #define MAX_NUM_FUSED_OPERATORS 64
 #define MAX_NUM_FUSED_TENSORS 64
+#define MAX_NUM_BUCKET_PARAMETERS 32
+#define MAX_NUM_EXPERTS 256
 #define MAX_NUM_WORKERS 1024
+// The most dimensions of the machine views that the search considers
+#define MAX_NUM_MACHINE_VIEW_DIMS 3
 #define MAX_FILENAME 200
 #define MAX_OPNAME 128
 // DataLoader
@@ -64,7 +70,7 @@ struct FFHandler {
 #if defined(FF_USE_CUDA) || defined(FF_USE_HIP_CUDA)
   cudnnHandle_t dnn;
   cublasHandle_t blas;
-#else
+#elif defined(FF_USE_HIP_ROCM)
   miopenHandle_t dnn;
   hipblasHandle_t blas;
 #endif
@@ -139,8 +145,17 @@ public:
   std::string dataset_path;
   std::string import_strategy_file;
   std::string export_strategy_file;
+  // Where compile writes the unoptimized PCG for tools/ff_search
+  std::string export_pcg_file;
   std::string export_strategy_task_graph_file;
   std::string export_strategy_computation_graph_file;
+  std::string search_cache_dir;
+  std::string cost_db_path;
+  bool cost_db_import_only;
+  // Estimate operator costs analytically instead of profiling kernels
+  bool analytical_cost_model;
+  float device_peak_tflops, device_memory_bandwidth,
+      device_kernel_launch_overhead;
   bool include_costs_dot_graph;
   tl::optional<std::string> substitution_json_path = tl::nullopt;
   // We use MappingTagID as the key since we will pass the tag to the mapper
@@ -149,10 +164,29 @@ public:
   std::string machine_model_file;
   int simulator_segment_size;
   int simulator_max_num_segments;
+  AllreduceAlgorithm allreduce_algorithm;
   bool enable_propagation;
   tl::optional<int> search_num_nodes = tl::nullopt;
   tl::optional<int> search_num_workers = tl::nullopt;
   int base_optimize_threshold;
+  int search_num_threads;
+  // Reject machine views whose per-device memory exceeds the GPU capacity
+  bool memory_search;
+  // Run time (in ms) charged per MB of device memory during the search
+  float memory_lambda;
+  // Maximum size (in bytes) of the gradient buckets synchronized with one
+  // allreduce, which disables bucketing if it is 0
+  size_t gradient_bucket_size;
+  // Whether the data-parallel embedding tables are synchronized and updated
+  // by the rows looked up in each iteration rather than densely
+  bool sparse_embedding_gradients;
+  // Whether the embedding tables and their gradients and optimizer states are
+  // kept in zero-copy system memory instead of the GPU framebuffer
+  bool host_embedding_tables;
+  // Whether FFModel traces forward, backward, update and zero_gradients, so
+  // that Legion replays their dependence analysis instead of redoing it in
+  // every iteration
+  bool enable_auto_tracing;
   bool enable_control_replication;
   int python_data_loader_type;
 };
@@ -0,0 +1,66 @@
+#ifndef _FLEXFLOW_CONNECTION_MATRIX_H
+#define _FLEXFLOW_CONNECTION_MATRIX_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace FlexFlow {
+
+/**
+ * @brief Adjacency of a network topology in compressed sparse row (CSR) form.
+ *
+ * @details Entry (src, dst) holds the number of links from device src to
+ * device dst, and only the non-zero entries are stored. Devices are numbered
+ * as in NetworkedMachineModel: servers first, then switches. The neighbors of
+ * each device are sorted, so a single entry is found by binary search.
+ */
+class SparseConnectionMatrix {
+public:
+  struct Edge {
+    int src, dst, weight;
+  };
+
+  SparseConnectionMatrix();
+  /**
+   * Builds the matrix from a list of edges in any order. The weights of
+   * duplicated edges are summed and edges with a zero weight are dropped.
+   */
+  SparseConnectionMatrix(int num_devs, std::vector<Edge> const &edges);
+  /**
+   * Converts a dense row-major num_devs x num_devs matrix.
+   */
+  static SparseConnectionMatrix from_dense(std::vector<int> const &conn,
+                                           int num_devs);
+  /**
+   * Reads a topology from a text file holding the number of devices followed
+   * by one "src dst weight" triple per edge, without ever building the dense
+   * matrix.
+   *
+   * @return false if the file cannot be opened or is malformed
+   */
+  static bool load(std::string const &fname, SparseConnectionMatrix &result);
+
+  int get(int src, int dst) const;
+  std::vector<int> to_dense() const;
+
+  int num_devs() const;
+  size_t num_edges() const;
+  /**
+   * Edges leaving src are stored at positions [row_begin(src), row_end(src))
+   */
+  size_t row_begin(int src) const;
+  size_t row_end(int src) const;
+  int neighbor(size_t pos) const;
+  int weight(size_t pos) const;
+
+private:
+  int ndevs;
+  std::vector<size_t> row_offsets;
+  std::vector<int> cols;
+  std::vector<int> weights;
+};
+
+}; // namespace FlexFlow
+
+#endif // _FLEXFLOW_CONNECTION_MATRIX_H
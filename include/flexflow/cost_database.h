@@ -0,0 +1,51 @@
+#ifndef _FLEXFLOW_COST_DATABASE_H
+#define _FLEXFLOW_COST_DATABASE_H
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+namespace FlexFlow {
+
+/**
+ * @brief Persistent store of measured operator costs, shared across processes
+ * through a single append-only file (see --cost-db).
+ *
+ * @details The file starts with a versioned header followed by fixed-size
+ * records. It is memory-mapped and indexed when the database is opened, and
+ * every new measurement is appended with a single write so that concurrent
+ * processes can share the same file. Keys are computed by the Simulator from
+ * the operator parameters (without the layer guid), the input shapes, the
+ * machine view (without its first device) and a fingerprint of the device
+ * the costs were measured on, so that any model can reuse them.
+ */
+class CostDatabase {
+public:
+  struct Entry {
+    float forward_time, backward_time, sync_time;
+    uint64_t inputs_memory, outputs_memory, weights_memory;
+  };
+
+  CostDatabase(std::string const &path, bool import_only);
+  ~CostDatabase();
+  CostDatabase(CostDatabase const &) = delete;
+  CostDatabase &operator=(CostDatabase const &) = delete;
+
+  bool find(uint64_t key, Entry &entry) const;
+  void insert(uint64_t key, Entry const &entry);
+  size_t size() const;
+  bool is_import_only() const;
+
+private:
+  bool load();
+
+private:
+  std::string path;
+  bool import_only;
+  int fd;
+  std::unordered_map<uint64_t, Entry> entries;
+};
+
+}; // namespace FlexFlow
+
+#endif // _FLEXFLOW_COST_DATABASE_H
@@ -7,6 +7,8 @@
 #elif defined(FF_USE_HIP_ROCM)
 #include <hip/hip_runtime.h>
 #include <miopen/miopen.h>
+#elif defined(FF_USE_CPU_ONLY)
+// No device runtime; the device types below are only placeholders
 #else
 #error "Unknown device"
 #endif
@@ -24,6 +26,11 @@ hipError_t get_legion_stream(hipStream_t *stream);
 typedef miopenTensorDescriptor_t ffTensorDescriptor_t;
 typedef miopenActivationDescriptor_t ffActivationDescriptor_t;
 typedef miopenPoolingDescriptor_t ffPoolingDescriptor_t;
+#elif defined(FF_USE_CPU_ONLY)
+typedef void *ffStream_t;
+typedef void *ffTensorDescriptor_t;
+typedef void *ffActivationDescriptor_t;
+typedef void *ffPoolingDescriptor_t;
 #else
 #error "Unknown device"
 #endif
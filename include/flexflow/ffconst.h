@@ -48,6 +48,20 @@ enum ParameterSyncType {
   NCCL = 82,
 };
 
+enum AllreduceAlgorithm {
+  ALLREDUCE_AUTO = 90,
+  ALLREDUCE_RING = 91,
+  ALLREDUCE_HIERARCHICAL_RING = 92,
+  ALLREDUCE_DOUBLE_BINARY_TREE = 93,
+  ALLREDUCE_HALVING_DOUBLING = 94,
+  ALLREDUCE_2D_TORUS = 95,
+};
+
+enum PipelineScheduleType {
+  PIPELINE_1F1B = 60,
+  PIPELINE_INTERLEAVED_1F1B = 61,
+};
+
 enum MetricsType {
   METRICS_ACCURACY = 1001,
   METRICS_CATEGORICAL_CROSSENTROPY = 1002,
@@ -88,6 +102,7 @@ enum OperatorType {
   OP_CACHE,
   OP_AGGREGATE,
   OP_AGG_SPEC,
+  OP_EXPERTS,
   // OP_ELEMENTWISE,
   OP_RESHAPE,
   OP_REVERSE,
@@ -181,6 +196,8 @@ enum PMParameter {
   PM_COMBINE_DEGREE,     // Combine
   PM_REDUCTION_DIM,      // Reduction
   PM_REDUCTION_DEGREE,   // Reduction
+  PM_PIPELINE_DIM,       // Pipeline
+  PM_PIPELINE_DEGREE,    // Pipeline
   PM_SOFTMAX_DIM,        // Softmax
   PM_NUM_HEADS,          // MultiHeadAttention
   PM_INVALID,
@@ -0,0 +1,32 @@
+#ifndef _FLEXFLOW_GRADIENT_BUCKETS_H
+#define _FLEXFLOW_GRADIENT_BUCKETS_H
+
+#include <cstddef>
+#include <vector>
+
+namespace FlexFlow {
+
+/**
+ * @brief Groups parameters into gradient buckets that are synchronized and
+ * updated together.
+ *
+ * @details Only parameters with the same key (i.e. placed on the same
+ * devices) share a bucket. Parameters are visited from the last to the
+ * first, which is the order in which the backward pass produces their
+ * gradients, and a bucket is closed once adding the next parameter would
+ * exceed bucket_bytes or max_params. A parameter larger than bucket_bytes
+ * gets a bucket of its own.
+ *
+ * @return the buckets as lists of parameter indices, ordered by the time all
+ * their gradients are ready, i.e. by the position of their last parameter in
+ * the backward pass
+ */
+std::vector<std::vector<int>>
+    assign_gradient_buckets(std::vector<size_t> const &keys,
+                            std::vector<size_t> const &bytes,
+                            size_t bucket_bytes,
+                            int max_params);
+
+}; // namespace FlexFlow
+
+#endif // _FLEXFLOW_GRADIENT_BUCKETS_H
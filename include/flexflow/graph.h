@@ -18,9 +18,13 @@
 #include "flexflow/basic_graph.h"
 #include "flexflow/graph_structures.h"
 #include "flexflow/model.h"
+#include "flexflow/search_cache.h"
 #include "flexflow/utils/dot/dot_file.h"
 #include "flexflow/utils/recursive_logger.h"
 #include "legion/legion_utilities.h"
+#include <atomic>
+#include <memory>
+#include <mutex>
 #include <unordered_set>
 
 extern LegionRuntime::Logger::Category log_dp;
@@ -106,6 +110,8 @@ struct NodeAssignment {
 struct GraphCostResult {
   float cost;
   std::unordered_map<Node, MachineView> views;
+  // Bytes of memory used by the operators assigned to each GPU
+  std::unordered_map<int, size_t> device_memory;
 
   static GraphCostResult invalid();
 
@@ -141,6 +147,16 @@ struct NonsequenceSplit {
 
 using SequenceSplit = NodeAssignment;
 
+/**
+ * A sequence split at a pipeline op that gives the part of the resources
+ * selected by split to the graph before the op and the rest to the op and
+ * the graph after it (the other way around if split.flip_graphs is set)
+ */
+struct PipelineSplit {
+  NonsequenceSplit split;
+  MachineView view;
+};
+
 class SearchHelper {
 public:
   SearchHelper(FFModel *model);
@@ -200,12 +216,24 @@ public:
   template <typename T>
   void add_operator_cost(NodeAssignment const &, float, T *) const;
 
+  template <typename T>
+  void add_operator_memory(NodeAssignment const &, size_t, T *) const;
+
+  float memory_cost(MachineView const &view, size_t memory) const;
+
+  bool fits_device_memory(GraphCostResult const &result) const;
+
+  float min_operator_cost(Node const &node) const;
+
   template <typename T>
   float get_cost(T const &) const;
 
   template <typename T>
   void check_matches_graph(Graph const *, T const &, Node const &) const;
 
+  void load_cached_costs(SearchCache const &cache);
+  void save_cached_costs(SearchCache const &cache) const;
+
 public:
   mutable std::unique_ptr<RecursiveLogger> logger;
 
@@ -226,13 +254,33 @@ private:
                            MachineResource const &resources,
                            SequenceSplit const &split) const;
 
+  template <typename T>
+  T execute_pipeline_split(std::unique_ptr<Graph> const &first_graph,
+                           std::unique_ptr<Graph> const &second_graph,
+                           NodeAssignment const &source,
+                           NodeAssignment const &sink,
+                           MachineResource const &resources,
+                           Node const &pipeline_node,
+                           PipelineSplit const &split) const;
+
+  std::vector<PipelineSplit>
+      get_pipeline_splits(Node const &pipeline_node,
+                          MachineResource const &resources) const;
+
 private:
   FFModel *model;
 
+  // The candidate views and splits of a DP state are evaluated in parallel
+  // (see --search-num-threads), so the shared state below is guarded by
+  // mutexes and the number of extra threads is bounded by available_threads
+  mutable std::atomic<int> available_threads;
+  mutable std::mutex cache_mutex;
+  mutable std::mutex simulator_mutex;
   mutable std::unordered_map<size_t, float> cached_graph_costs;
   mutable std::unordered_map<size_t,
                              std::unique_ptr<const std::vector<MachineView>>>
       cached_operator_valid_views;
+  mutable std::unordered_map<size_t, float> cached_min_operator_costs;
 };
 
 struct SimplificationSettings {
@@ -242,6 +290,39 @@ struct SimplificationSettings {
   bool remove_noops = false;
 };
 
+/**
+ * @brief The nodes of a graph grouped by operator type and, for the parallel
+ * ops, by parallel degree, which is what most generated substitutions differ
+ * in.
+ *
+ * @details Graph updates the index as nodes are added and removed, so a
+ * graph derived from a copy of its parent does not rebuild it.
+ */
+class NodeIndex {
+public:
+  void add(Node const &);
+  void remove(Node const &);
+  size_t count(OperatorType type) const;
+  size_t count(OperatorType type, int key) const;
+  /**
+   * Appends the nodes of the given type to nodes, restricted to those whose
+   * key parameter equals key if it is set
+   */
+  void get(OperatorType type,
+           tl::optional<int> const &key,
+           std::vector<Node> &nodes) const;
+
+  /**
+   * @return the parameter the nodes of type are grouped by, or PM_INVALID
+   */
+  static PMParameter key_parameter(OperatorType type);
+
+private:
+  std::unordered_map<OperatorType,
+                     std::unordered_map<int, std::unordered_set<Node>>>
+      nodes;
+};
+
 class Graph {
 public:
   Graph(FFModel *model);
@@ -260,7 +341,9 @@ public:
   Graph subgraph(std::unordered_set<Node> const &nodes) const;
   void contract_out_node(Node const &);
   float optimal_cost() const;
+  float cost_lower_bound() const;
   std::unordered_map<Node, MachineView> optimal_views() const;
+  GraphCostResult optimal_cost_result() const;
   void remove_input_nodes();
   void duplicate_input_node(Node const &);
   void duplicate_input_nodes();
@@ -271,6 +354,7 @@ public:
   Node declone_node(Node const &);
 
   size_t hash(void) const;
+  std::unordered_map<Node, size_t> const &canonical_node_hashes() const;
   void print(void) const;
   void print_dot() const;
   void print_dot(std::ostream &) const;
@@ -320,11 +404,57 @@ public:
   FFModel *model;
   SearchHelper *search;
   std::unordered_map<Node, std::unordered_set<Edge>> inEdges, outEdges;
+  NodeIndex node_index;
 
 private:
   void remove_inverse_parallel_ops();
   void replace_subgraph_with_nonempty(
       std::unordered_set<Node> const &currentNodes, Graph const &replaceWith);
+
+  struct CanonicalHashes {
+    std::unordered_map<Node, size_t> nodes;
+    size_t graph;
+  };
+  CanonicalHashes const &get_canonical_hashes() const;
+  void invalidate_canonical_hashes();
+
+private:
+  // The DP looks up the hashes of the same graph for every state, so they are
+  // computed on first use and dropped whenever an edge or node changes.
+  // Copies of the graph share them.
+  mutable std::shared_ptr<CanonicalHashes const> canonical_hashes;
+};
+
+/**
+ * @brief A graph stored as its difference from the graph it was derived
+ * from.
+ *
+ * @details A candidate of the substitution search only differs from its
+ * parent in the few nodes an xfer rewrote. Storing it as a delta lets it
+ * share the rest of the graph with its ancestors, instead of holding its own
+ * copy of the edge maps while it waits in the queue. The full graph is only
+ * rebuilt when the candidate is expanded. Every max_depth generations a full
+ * snapshot is stored instead of a delta, which bounds the cost of flattening.
+ */
+class GraphDelta {
+public:
+  static std::shared_ptr<GraphDelta const> snapshot(Graph const &graph);
+  /**
+   * @param parent_graph the flattened version of parent
+   */
+  static std::shared_ptr<GraphDelta const>
+      derive(std::shared_ptr<GraphDelta const> const &parent,
+             Graph const &parent_graph,
+             Graph const &graph);
+  std::unique_ptr<Graph> flatten(FFModel *model) const;
+
+  static int const max_depth = 16;
+
+private:
+  std::shared_ptr<GraphDelta const> parent;
+  int depth = 0;
+  std::vector<Node> added_nodes, removed_nodes;
+  std::vector<Edge> added_edges, removed_edges;
 };
 
 struct GraphOptimizeResult {
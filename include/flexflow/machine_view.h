@@ -48,6 +48,44 @@ struct MachineViewDimCompare {
   }
 };
 
+/**
+ * @brief The views of up to max_ndims dimensions over the devices of a machine
+ * with num_nodes nodes of devices_per_node devices each, all starting at
+ * device 0, for the search to choose from.
+ *
+ * @details Besides the contiguous 1-D views, a dimension may stride over the
+ * devices of a node by a divisor of devices_per_node (e.g. to keep a group
+ * within an NVLink island) or over the nodes by a divisor of num_nodes, and
+ * the parts of a view divide the devices evenly. Views whose devices collide
+ * or fall outside of the machine are dropped. Since the nodes are
+ * interchangeable, two views with the same dimensions that a permutation of
+ * the nodes maps onto each other (e.g. one device on each of nodes 0 and 1,
+ * or of nodes 0 and 2) are equivalent, and only the view of each class whose
+ * last device is the lowest is kept. Devices within a node are not assumed to
+ * be interchangeable. The offset of a view comes from the MachineResource
+ * that the search places it on.
+ */
+std::vector<MachineView>
+    enumerate_machine_views(int num_nodes,
+                            int devices_per_node,
+                            MachineView::DeviceType device_type,
+                            int max_ndims);
+
+/**
+ * @brief The start devices at which the search can place view on a machine
+ * with num_nodes nodes of devices_per_node devices each.
+ *
+ * @details These are the starts of the MachineResources that splitting the
+ * machine yields and that hold the view: a resource either starts at the first
+ * device of a node, or at device g of a node and then has at most
+ * devices_per_node - g devices on each node (see
+ * MachineResource::is_valid_machine_view). The mapper only registers views at
+ * these starts.
+ */
+std::vector<int> get_machine_view_starts(MachineView const &view,
+                                         int num_nodes,
+                                         int devices_per_node);
+
 struct MachineResource {
   MachineResource(FFConfig const &);
 
@@ -32,7 +32,9 @@
 #include "simulator.h"
 #include "tensor.h"
 #include "tl/optional.hpp"
+#include <atomic>
 #include <functional>
+#include <mutex>
 #include <unistd.h>
 #include <utility>
 
@@ -80,6 +82,14 @@ enum TaskIDs {
   AGG_SPEC_INIT_TASK_ID,
   AGG_SPEC_FWD_TASK_ID,
   AGG_SPEC_BWD_TASK_ID,
+  EXPERTS_INIT_TASK_ID,
+  EXPERTS_DISPATCH_TASK_ID,
+  EXPERTS_FWD_TASK_ID,
+  EXPERTS_COMBINE_TASK_ID,
+  EXPERTS_COMBINE_BWD_TASK_ID,
+  EXPERTS_BWD_TASK_ID,
+  EXPERTS_DISPATCH_BWD_TASK_ID,
+  EXPERTS_LOAD_TASK_ID,
   POOL2D_INIT_TASK_ID,
   POOL2D_FWD_TASK_ID,
   POOL2D_BWD_TASK_ID,
@@ -144,9 +154,17 @@ enum TaskIDs {
   // Optimizer with PS
   SGD_UPD_PS_TASK_ID,
   ADAM_UPD_PS_TASK_ID,
+  ADAGRAD_UPD_PS_TASK_ID,
   // Optimizer with NCCL
   SGD_UPD_NCCL_TASK_ID,
   ADAM_UPD_NCCL_TASK_ID,
+  SGD_UPD_NCCL_BUCKET_TASK_ID,
+  ADAM_UPD_NCCL_BUCKET_TASK_ID,
+  ADAGRAD_UPD_NCCL_TASK_ID,
+  ADAGRAD_UPD_NCCL_BUCKET_TASK_ID,
+  SGD_UPD_SPARSE_TASK_ID,
+  ADAM_UPD_SPARSE_TASK_ID,
+  ADAGRAD_UPD_SPARSE_TASK_ID,
   // Initializer
   GLOROT_INIT_TASK_ID,
   ZERO_INIT_TASK_ID,
@@ -156,6 +174,7 @@ enum TaskIDs {
   // NCCL tasks
   NCCL_GETUNIQUEID_TASK_ID,
   NCCL_INIT_COMMS_TASK_ID,
+  OP_FREE_METAS_TASK_ID,
   // Search
   STRATEGY_SEARCH_TASK_ID,
   // Graph
@@ -170,6 +189,8 @@ enum TaskIDs {
   PY_DL_FLOAT_LOAD_BATCH_GPU_TASK_ID,
   PY_DL_INT32_LOAD_BATCH_GPU_TASK_ID,
   PY_DL_INT64_LOAD_BATCH_GPU_TASK_ID,
+  PY_DL_PREFETCH_BATCH_CPU_TASK_ID,
+  PY_DL_LOAD_STAGED_BATCH_GPU_TASK_ID,
   // Parallel Ops
   REPARTITION_INIT_TASK_ID,
   REPARTITION_FWD_TASK_ID,
@@ -255,6 +276,7 @@ class Dropout;
 class ElementBinary;
 class ElementUnary;
 class Embedding;
+class Experts;
 class Flat;
 class Group_by;
 class LayerNorm;
@@ -271,6 +293,7 @@ class Combine;
 class Repartition;
 class Reduction;
 class Replicate;
+class Pipeline;
 class FusedParallelOp;
 class ParallelOpInfo;
 
@@ -307,6 +330,16 @@ std::tuple<ParallelTensorShape, ParallelTensorShape, ParallelTensorShape>
     get_input_shape(
         std::tuple<ParallelTensor, ParallelTensor, ParallelTensor> const &);
 
+template <>
+std::tuple<ParallelTensorShape,
+           ParallelTensorShape,
+           ParallelTensorShape,
+           ParallelTensorShape>
+    get_input_shape(std::tuple<ParallelTensor,
+                               ParallelTensor,
+                               ParallelTensor,
+                               ParallelTensor> const &);
+
 template <>
 ParallelTensorShape get_input_shape(ParallelTensor const &input);
 
@@ -320,7 +353,9 @@ std::vector<ParallelTensorShape>
 
 class FFModel {
 public:
-  FFModel(FFConfig &config);
+  // A cpu_only model does not initialize the GPUs, so it can only describe
+  // and search PCGs (see tools/ff_search), not run them
+  FFModel(FFConfig &config, bool cpu_only = false);
 
   static constexpr float PROPAGATION_CHANCE = 0.25;
   static constexpr float CONTINUE_PROPAGATION_CHANCE = 0.75;
@@ -437,6 +472,21 @@ public:
                         int n,
                         float lambda_bal,
                         char const *name = NULL);
+  // Add an experts layer, which evaluates softmax(act(dense)) of the experts
+  // that indices chooses for each token of input and sums their outputs
+  // weighted by gate_preds; full_gate_preds, the gate values of all the
+  // experts, receives the gate gradients and the load balancing term
+  Tensor experts(const Tensor input,
+                 const Tensor indices,
+                 const Tensor gate_preds,
+                 const Tensor full_gate_preds,
+                 int num_experts,
+                 int out_dim,
+                 float alpha,
+                 float lambda_bal,
+                 ActiMode activation = AC_MODE_NONE,
+                 bool use_bias = true,
+                 char const *name = NULL);
   // Add a 2D pooling layer
   Tensor pool2d(const Tensor input,
                 int kernelH,
@@ -483,7 +533,7 @@ public:
               std::vector<int> const &dims,
               bool keepdims,
               char const *name);
-  // Add a moe layer (wrapping topk, group_by and aggregate operators)
+  // Add a moe layer (wrapping topk and experts operators)
   Tensor moe(const Tensor input,
              int num_exp,
              int num_select,
@@ -639,6 +689,12 @@ public:
       bool include_sink_compute_time,
       float optimal_cost,
       std::unordered_map<PCG::Node, MachineView> &optimal_views);
+  // Serializes the nodes of graph in topological order, then optimal_views,
+  // which is empty for an unoptimized PCG (see --export-pcg)
+  void serialize_graph_optimal_view(
+      Legion::Serializer &sez,
+      PCG::Graph const *graph,
+      std::unordered_map<PCG::Node, MachineView> const &optimal_views) const;
   void deserialize_graph_optimal_view(
       Legion::Deserializer &dez,
       PCG::Graph *graph,
@@ -646,6 +702,9 @@ public:
   bool convert_graph_to_operators(
       const PCG::Graph *graph,
       std::unordered_map<PCG::Node, MachineView> const &optimal_views);
+  // The guids that a serialized PCG binds the inputs and weights of this
+  // model by (see PCG::binding_signature)
+  uint64_t get_binding_signature() const;
   static void register_all_machine_views(int num_nodes,
                                          int gpus_per_node,
                                          int cpus_per_node,
@@ -668,6 +727,7 @@ public:
 
     std::pair<typename ToShape<typename T::Input>::type, Params> key{
         input_shapes, params};
+    std::lock_guard<std::mutex> lock(this->op_cache_mutex);
     auto &cache = get<std::unordered_map<
         std::pair<typename ToShape<typename T::Input>::type, Params>,
         T *>>(this->cached_ops);
@@ -717,6 +777,25 @@ public:
       Legion::IndexSpaceT<TDIM> const &part_is,
       Legion::LogicalRegion const &region,
       Legion::LogicalPartition &part);
+  // Restricts the disjoint partition of region described by dims to the
+  // micro_batch-th of num_micro_batches slices along micro_batch_dim
+  void create_micro_batch_partition(int num_dims,
+                                    const ParallelDim dims[],
+                                    int micro_batch_dim,
+                                    int num_micro_batches,
+                                    int micro_batch,
+                                    Legion::IndexSpace const &part_is,
+                                    Legion::LogicalRegion const &region,
+                                    Legion::LogicalPartition &part);
+  template <int NDIM, int TDIM>
+  void create_micro_batch_partition_with_dim2(
+      const ParallelDim dims[],
+      int micro_batch_dim,
+      int num_micro_batches,
+      int micro_batch,
+      Legion::IndexSpaceT<TDIM> const &part_is,
+      Legion::LogicalRegion const &region,
+      Legion::LogicalPartition &part);
 
   template <int NDIM>
   void create_disjoint_partition(const ParallelTensor tensor,
@@ -751,7 +830,7 @@ public:
   void get_metrics();
   void backward(int seq_length = -1);
   void update();
-  bool apply_fusion(std::vector<Op *> const &operators,
+  void apply_fusion(std::vector<Op *> const &operators,
                     std::vector<Op *> &new_operators);
   Op *get_final_operator() const;
   void compile(LossType loss_type,
@@ -772,6 +851,8 @@ public:
                      bool use_propagation) const;
 #ifdef FF_USE_NCCL
   ncclComm_t *find_nccl_comms(MachineView const &view) const;
+  // Creates the communicators of the devices of view, unless they exist
+  void create_nccl_comms(MachineView const &view);
 #endif
 #ifdef FF_USE_PROPAGATE
   void propagate(std::map<Op *, ParallelConfig> const &current,
@@ -781,6 +862,16 @@ public:
                std::map<Op const *, ParallelConfig> &next,
                bool use_propagation) const;
   void recompile_on_condition(RecompileState &r);
+  // Makes forward, backward, update and zero_gradients capture new traces,
+  // which is required after altering the operators outside of compile and
+  // recompile_on_condition
+  void invalidate_traces();
+  // Moves op, its outputs and its weights to view, which must have the same
+  // shape as their current view so that they keep their partitions. Their
+  // data follows them on its next use; call create_gradient_buckets of the
+  // optimizer once all the operators have moved. The metas of op are freed
+  // and created anew on view, so op may not keep state in them.
+  void migrate_operator(Op *op, MachineView const &view);
   void zero_gradients();
   void print_layers(int id);
 
@@ -803,8 +894,10 @@ public:
   void set_iteration_config_sequence_length(int seq_length);
 
 public:
-  size_t op_global_guid, layer_global_guid;
-  size_t tensor_global_guid, parallel_tensor_global_guid, node_global_guid;
+  // Atomic since the search threads create ops, tensors and nodes at once
+  std::atomic<size_t> op_global_guid, layer_global_guid;
+  std::atomic<size_t> tensor_global_guid, parallel_tensor_global_guid,
+      node_global_guid;
   FFConfig config;
   FFIterationConfig iter_config;
   Optimizer *optimizer;
@@ -816,6 +909,11 @@ public:
   int metrics_input;
   ParallelTensor parallel_label_tensor;
   Tensor label_tensor;
+  // When set, forward measures the time of each operator (in microseconds,
+  // keyed by op_guid) and the operators collect their runtime statistics,
+  // e.g. Experts::load_futures; see RecompileState
+  bool collect_runtime_stats;
+  std::unordered_map<size_t, double> measured_forward_times;
 
   std::vector<Layer *> layers;
   std::vector<Op *> operators;
@@ -849,6 +947,12 @@ public:
                          ElementUnary *>,
       std::unordered_map<std::pair<ParallelTensorShape, EmbeddingParams>,
                          Embedding *>,
+      std::unordered_map<std::pair<std::tuple<ParallelTensorShape,
+                                              ParallelTensorShape,
+                                              ParallelTensorShape,
+                                              ParallelTensorShape>,
+                                   ExpertsParams>,
+                         Experts *>,
       std::unordered_map<std::pair<ParallelTensorShape, FlatParams>, Flat *>,
 
       std::unordered_map<
@@ -880,6 +984,8 @@ public:
                          Repartition *>,
       std::unordered_map<std::pair<ParallelTensorShape, ReplicateParams>,
                          Replicate *>,
+      std::unordered_map<std::pair<ParallelTensorShape, PipelineParams>,
+                         Pipeline *>,
       std::unordered_map<std::pair<ParallelTensorShape, ReductionParams>,
                          Reduction *>,
       std::unordered_map<std::pair<ParallelTensorShape, CombineParams>,
@@ -889,6 +995,9 @@ public:
       cached_ops;
   std::unordered_map<size_t, NoOp *> cached_noop_ops;
   std::unordered_map<size_t, NoOp *> cached_input_ops;
+  // Guards cached_ops, cached_noop_ops and cached_input_ops, which the search
+  // threads look up and fill concurrently
+  std::mutex op_cache_mutex;
   std::vector<MachineView> all_valid_views;
 #ifdef FF_USE_NCCL
   std::unordered_map<size_t, ncclComm_t *> view_hash_to_nccl_comms;
@@ -896,6 +1005,20 @@ public:
 private:
   bool debug;
   std::map<MachineView, Legion::IndexSpace, MachineViewDimCompare> all_task_is;
+  // The phases of an iteration that are traced (see --disable-auto-tracing)
+  enum TracedPhase {
+    TRACE_FORWARD,
+    TRACE_BACKWARD,
+    TRACE_UPDATE,
+    TRACE_ZERO_GRADIENTS,
+    NUM_TRACED_PHASES,
+  };
+  // Incremented by invalidate_traces, so that the operators of each
+  // compilation are traced under their own trace IDs
+  int trace_generation;
+
+  void begin_phase_trace(TracedPhase phase);
+  void end_phase_trace(TracedPhase phase);
 
   template <int NDIM>
   void map_tensor_with_dim(ParallelTensor tensor, Op const *parallel_op);
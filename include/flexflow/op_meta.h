@@ -11,6 +11,8 @@ class OpMeta {
 public:
   OpMeta(FFHandler _handle);
   OpMeta(FFHandler _handle, Op const *op);
+  // Op::free_metas_task deletes the metas of any operator through OpMeta
+  virtual ~OpMeta() = default;
 
 public:
   FFHandler handle;
@@ -228,6 +228,14 @@ public:
   virtual tl::optional<RecordFormatter> as_dot() const;
 
   int get_dimension() const;
+  // Deletes the metas of the operator on the devices of its current view,
+  // e.g. before it is initialized again with new ones
+  void free_metas(FFModel const &ff);
+  static void
+      free_metas_task(Legion::Task const *task,
+                      std::vector<Legion::PhysicalRegion> const &regions,
+                      Legion::Context ctx,
+                      Legion::Runtime *runtime);
 #ifdef FF_USE_NCCL
   static ncclUniqueId get_nccl_unique_id_task(
       Legion::Task const *task,
@@ -12,6 +12,7 @@
 #include "flexflow/ops/element_binary_params.h"
 #include "flexflow/ops/element_unary_params.h"
 #include "flexflow/ops/embedding_params.h"
+#include "flexflow/ops/experts_params.h"
 #include "flexflow/ops/flat_params.h"
 #include "flexflow/ops/groupby_params.h"
 #include "flexflow/ops/layer_norm_params.h"
@@ -26,6 +27,7 @@
 #include "flexflow/parallel_ops/combine_params.h"
 #include "flexflow/parallel_ops/fused_parallel_op_params.h"
 #include "flexflow/parallel_ops/partition_params.h"
+#include "flexflow/parallel_ops/pipeline_params.h"
 #include "flexflow/parallel_ops/reduction_params.h"
 #include "flexflow/parallel_ops/replicate_params.h"
 #include "mpark/variant.hpp"
@@ -44,6 +46,7 @@ using OperatorParameters = mp::variant<AggregateParams,
                                        ElementUnaryParams,
                                        DropoutParams,
                                        EmbeddingParams,
+                                       ExpertsParams,
                                        FlatParams,
                                        Group_byParams,
                                        LayerNormParams,
@@ -58,12 +61,20 @@ using OperatorParameters = mp::variant<AggregateParams,
                                        TransposeParams,
                                        RepartitionParams,
                                        ReplicateParams,
+                                       PipelineParams,
                                        ReductionParams,
                                        CombineParams,
                                        FusedParallelOpParams>;
 
 tl::optional<OperatorParameters> get_op_parameters(Op const *op);
 
+/**
+ * @brief Hash of params that ignores the guid of the layer the operator was
+ * created from, so that it is the same for operators of different models
+ * that compute the same thing.
+ */
+size_t get_guid_free_params_hash(OperatorParameters const &params);
+
 }; // namespace FlexFlow
 
 #endif // _OPERATOR_PARAMS_H
@@ -6,10 +6,6 @@
 
 namespace FlexFlow {
 
-#define AGGREGATE_SPEC_MAX_K 4
-#define AGGREGATE_SPEC_MAX_BATCH_SIZE 32
-#define AGGREGATE_SPEC_MAX_N 12
-
 class AggregateSpecMeta : public OpMeta {
 public:
   AggregateSpecMeta(FFHandler handle, int n);
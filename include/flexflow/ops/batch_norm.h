@@ -73,7 +73,7 @@ public:
   cudnnTensorDescriptor_t inputTensor, outputTensor, biasTensor;
   cudnnActivationDescriptor_t actiDesc;
   cudnnBatchNormMode_t mode;
-#else
+#elif defined(FF_USE_HIP_ROCM)
   miopenTensorDescriptor_t inputTensor, outputTensor, biasTensor;
   miopenActivationDescriptor_t actiDesc;
   miopenBatchNormMode_t mode;
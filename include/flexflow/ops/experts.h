@@ -0,0 +1,250 @@
+#ifndef _FLEXFLOW_EXPERTS_H_
+#define _FLEXFLOW_EXPERTS_H_
+
+#include "flexflow/model.h"
+#include "flexflow/node.h"
+#include "flexflow/ops/experts_params.h"
+
+namespace FlexFlow {
+
+class Experts;
+
+/**
+ * @brief The assignments per expert of a forward pass on one device, which
+ * Experts::forward collects while FFModel::collect_runtime_stats is set.
+ */
+struct ExpertsLoad {
+  int num_experts;
+  int num_assignments;
+  int capacity;
+  int dropped;
+  // The largest capacity that the work space of the device holds
+  int max_capacity;
+  int counts[MAX_NUM_EXPERTS];
+};
+
+class ExpertsMeta : public OpMeta {
+public:
+  ExpertsMeta(FFHandler handle, Experts const *experts);
+  int num_experts;
+  int out_dim;
+  float alpha;
+  float lambda_bal;
+  ActiMode activation;
+  bool use_bias;
+};
+
+/**
+ * @brief Evaluates num_experts dense layers, each followed by a softmax, on
+ * the tokens that a top-k gate assigns to them, and combines their outputs
+ * weighted by the gate.
+ *
+ * @details The inputs are the data (data_dim, batch_size), the indices of the
+ * chosen experts (k, batch_size), their gate values (k, batch_size) and the
+ * gate values of all the experts (num_experts, batch_size). As in Aggregate,
+ * the gate gradients and the load balancing term go to the latter. Up to
+ * expert_capacity(alpha, k, num_experts, batch_size) tokens of each batch
+ * shard are dispatched per expert into expert_inputs, all local experts run
+ * as a single batched GEMM into expert_outputs, and each shard combines the
+ * rows of its own tokens. The experts dimension of the kernel is parallelized
+ * along the batch dimension of the inputs: the dispatch and combine tasks use
+ * the partitions of the expert tensors by batch shard and the GEMM uses their
+ * partitions by expert, so Legion exchanges only the dispatched rows between
+ * the devices (an all-to-all) and neither the tokens nor the weights are
+ * replicated.
+ */
+class Experts : public Op {
+public:
+  using Params = ExpertsParams;
+  using Input = std::
+      tuple<ParallelTensor, ParallelTensor, ParallelTensor, ParallelTensor>;
+  Experts(FFModel &model,
+          LayerID const &layer_guid,
+          const ParallelTensor input,
+          const ParallelTensor indices,
+          const ParallelTensor gate_preds,
+          const ParallelTensor full_gate_preds,
+          int num_experts,
+          int out_dim,
+          float alpha,
+          float lambda_bal,
+          ActiMode activation,
+          bool use_bias,
+          bool allocate_weights,
+          char const *name);
+  Experts(FFModel &model,
+          Params const &params,
+          Input const &inputs,
+          bool allocate_weights = false,
+          char const *name = nullptr);
+  void init(FFModel const &) override;
+  void forward(FFModel const &) override;
+  void backward(FFModel const &) override;
+  void map_output_tensors(FFModel &ff) override;
+  void print_layer(FFModel const &model) override {
+    assert(0);
+  }
+  static Op *
+      create_operator_from_layer(FFModel &model,
+                                 Layer const *layer,
+                                 std::vector<ParallelTensor> const &inputs);
+  static OpMeta *init_task(Legion::Task const *task,
+                           std::vector<Legion::PhysicalRegion> const &regions,
+                           Legion::Context ctx,
+                           Legion::Runtime *runtime);
+  static void dispatch_task(Legion::Task const *task,
+                            std::vector<Legion::PhysicalRegion> const &regions,
+                            Legion::Context ctx,
+                            Legion::Runtime *runtime);
+  static void forward_task(Legion::Task const *task,
+                           std::vector<Legion::PhysicalRegion> const &regions,
+                           Legion::Context ctx,
+                           Legion::Runtime *runtime);
+  static void combine_task(Legion::Task const *task,
+                           std::vector<Legion::PhysicalRegion> const &regions,
+                           Legion::Context ctx,
+                           Legion::Runtime *runtime);
+  static void
+      combine_backward_task(Legion::Task const *task,
+                            std::vector<Legion::PhysicalRegion> const &regions,
+                            Legion::Context ctx,
+                            Legion::Runtime *runtime);
+  static void backward_task(Legion::Task const *task,
+                            std::vector<Legion::PhysicalRegion> const &regions,
+                            Legion::Context ctx,
+                            Legion::Runtime *runtime);
+  static void
+      dispatch_backward_task(Legion::Task const *task,
+                             std::vector<Legion::PhysicalRegion> const &regions,
+                             Legion::Context ctx,
+                             Legion::Runtime *runtime);
+  // Launches load_task on the indices of the last forward pass
+  void forward_load(FFModel const &ff);
+  static ExpertsLoad
+      load_task(Legion::Task const *task,
+                std::vector<Legion::PhysicalRegion> const &regions,
+                Legion::Context ctx,
+                Legion::Runtime *runtime);
+  // Changes the capacity factor of the experts, which takes effect through
+  // new expert tensors and a new ExpertsMeta
+  void set_alpha(FFModel &ff, float alpha);
+  void serialize(Legion::Serializer &s) const override;
+  static PCG::Node deserialize(FFModel &ff,
+                               Legion::Deserializer &d,
+                               ParallelTensor inputs[],
+                               int num_inputs);
+  Op *materialize(FFModel &ff,
+                  ParallelTensor inputs[],
+                  int num_inputs) const override;
+  // Copies the tokens of a batch shard to the capacity rows per expert of x
+  static void dispatch_kernel_wrapper(ExpertsMeta const *m,
+                                      float const *input,
+                                      int const *indices,
+                                      float *x,
+                                      int k,
+                                      int capacity,
+                                      int batch_size,
+                                      int data_dim);
+  static void dispatch_backward_kernel_wrapper(ExpertsMeta const *m,
+                                               float const *x_grad,
+                                               int const *indices,
+                                               float *input_grad,
+                                               int k,
+                                               int capacity,
+                                               int batch_size,
+                                               int data_dim);
+  // Computes y = softmax(act(W^T x + b)) for the num_rows rows of each of
+  // the num_local experts of this device
+  static void forward_kernel_wrapper(ExpertsMeta const *m,
+                                     float const *x,
+                                     float const *kernel,
+                                     float const *bias,
+                                     float *y,
+                                     int num_local,
+                                     int num_rows,
+                                     int data_dim);
+  static void backward_kernel_wrapper(ExpertsMeta const *m,
+                                      float const *x,
+                                      float const *y,
+                                      float const *y_grad,
+                                      float *x_grad,
+                                      float const *kernel,
+                                      float const *bias,
+                                      float *kernel_grad,
+                                      float *bias_grad,
+                                      int num_local,
+                                      int num_rows,
+                                      int data_dim);
+  // Adds up the gated expert rows of the tokens of a batch shard
+  static void combine_kernel_wrapper(ExpertsMeta const *m,
+                                     float const *y,
+                                     int const *indices,
+                                     float const *gate_preds,
+                                     float *output,
+                                     int k,
+                                     int capacity,
+                                     int batch_size);
+  // Adds the gate gradients and the load balancing term to full_gate_grads,
+  // see cpu_experts_combine_backward
+  static void combine_backward_kernel_wrapper(ExpertsMeta const *m,
+                                              float const *y,
+                                              int const *indices,
+                                              float const *gate_preds,
+                                              float const *output_grad,
+                                              float *y_grad,
+                                              float *full_gate_grads,
+                                              int k,
+                                              int capacity,
+                                              int batch_size);
+  // Counts the assignments per expert of a dispatch into load
+  static void load_kernel_wrapper(ExpertsMeta const *m,
+                                  int const *indices,
+                                  int k,
+                                  int batch_size,
+                                  ExpertsLoad &load);
+  // The number of bytes of the work space of the FFHandler that the kernels
+  // use for the dispatch and for the gradients of the expert outputs
+  static size_t workspace_size(int num_experts,
+                               int k,
+                               int batch_size,
+                               int num_local,
+                               int num_rows,
+                               int out_dim);
+  // Assigns the tokens round robin to the experts, so that the simulator
+  // measures a balanced dispatch
+  static void init_measure_indices(int *indices,
+                                   int k,
+                                   int batch_size,
+                                   int num_experts);
+  bool measure_operator_cost(Simulator *sim,
+                             MachineView const &pc,
+                             CostMetrics &cost_metrics) const override;
+  Params get_params() const;
+
+private:
+  // Creates expert_inputs and expert_outputs for the capacity of alpha, and
+  // their partitions by expert
+  void create_expert_tensors(FFModel &ff);
+  void destroy_expert_tensors(FFModel &ff);
+
+public:
+  int num_experts;
+  int out_dim;
+  float alpha;
+  float lambda_bal;
+  ActiMode activation;
+  bool use_bias;
+  // The dispatched rows (data_dim, rows, num_experts) and the expert outputs
+  // (out_dim, rows, num_experts), where each batch shard owns capacity of the
+  // rows of every expert
+  ParallelTensor expert_inputs, expert_outputs;
+  Legion::LogicalPartition expert_inputs_lp, expert_inputs_grad_lp;
+  Legion::LogicalPartition expert_outputs_lp, expert_outputs_grad_lp;
+  // The loads of the last forward pass run with collect_runtime_stats set,
+  // one per device
+  std::vector<Legion::Future> load_futures;
+};
+
+}; // namespace FlexFlow
+
+#endif // _FLEXFLOW_EXPERTS_H_
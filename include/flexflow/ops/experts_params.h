@@ -0,0 +1,36 @@
+#ifndef _FLEXFLOW_EXPERTS_PARAMS_H
+#define _FLEXFLOW_EXPERTS_PARAMS_H
+
+#include "flexflow/ffconst.h"
+#include "flexflow/fftype.h"
+#include "flexflow/parallel_tensor.h"
+
+namespace FlexFlow {
+
+struct ExpertsParams {
+  LayerID layer_guid;
+  int num_experts;
+  int out_dim;
+  float alpha;
+  float lambda_bal;
+  ActiMode activation;
+  bool use_bias;
+
+  bool is_valid(std::tuple<ParallelTensorShape,
+                           ParallelTensorShape,
+                           ParallelTensorShape,
+                           ParallelTensorShape> const &) const;
+};
+
+bool operator==(ExpertsParams const &, ExpertsParams const &);
+
+} // namespace FlexFlow
+
+namespace std {
+template <>
+struct hash<FlexFlow::ExpertsParams> {
+  size_t operator()(FlexFlow::ExpertsParams const &) const;
+};
+} // namespace std
+
+#endif // _FLEXFLOW_EXPERTS_PARAMS_H
@@ -18,7 +18,7 @@ public:
   cudnnConvolutionFwdAlgo_t fwdAlgo;
   cudnnConvolutionBwdFilterAlgo_t bwdFilterAlgo;
   cudnnConvolutionBwdDataAlgo_t bwdDataAlgo;
-#else
+#elif defined(FF_USE_HIP_ROCM)
   miopenTensorDescriptor_t inputTensor, biasTensor, outputTensor;
   miopenTensorDescriptor_t filterDesc;
   miopenActivationDescriptor_t actiDesc;
@@ -129,7 +129,7 @@ cudnnConvolutionBwdFilterAlgo_t selectConvolutionBackwardFilterAlgorithm(
     const cudnnFilterDescriptor_t dwDesc,
     void *dw,
     float *time);
-#else
+#elif defined(FF_USE_HIP_ROCM)
 miopenConvFwdAlgorithm_t selectConvolutionForwardAlgorithm(
     miopenHandle_t handle,
     const miopenTensorDescriptor_t xDesc,
@@ -14,7 +14,7 @@ public:
   cudnnTensorDescriptor_t input1Tensor, input2Tensor, outputTensor;
   cudnnOpTensorDescriptor_t opDesc;
   cudnnReduceTensorDescriptor_t reduceAddDesc;
-#else
+#elif defined(FF_USE_HIP_ROCM)
   miopenTensorDescriptor_t input1Tensor, input2Tensor, outputTensor;
   miopenTensorOp_t opDesc;
   miopenReduceTensorDescriptor_t reduceAddDesc;
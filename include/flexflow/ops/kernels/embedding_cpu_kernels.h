@@ -0,0 +1,55 @@
+#ifndef _FLEXFLOW_OPS_KERNELS_EMBEDDING_CPU_KERNELS_H
+#define _FLEXFLOW_OPS_KERNELS_EMBEDDING_CPU_KERNELS_H
+
+#include "flexflow/ffconst.h"
+#include <cstdint>
+
+namespace FlexFlow {
+namespace Kernels {
+namespace Embedding {
+
+/**
+ * @brief Looks up and pools the rows of an embedding table on the CPU.
+ *
+ * @details Bag b of the batch consists of the ids
+ * input[b * in_dim], ..., input[(b + 1) * in_dim - 1], and row b of the output
+ * is the sum (AGGR_MODE_SUM) or the mean (AGGR_MODE_AVG) of their rows in the
+ * table weight of num_entries rows of out_dim channels. With AGGR_MODE_NONE
+ * in_dim must be 1. The bags are split among up to num_threads threads, and
+ * the rows are accumulated with AVX2 (AVX-512 where available) when built
+ * with FF_USE_AVX2.
+ */
+template <typename TI>
+void cpu_forward_kernel(TI const *input,
+                        float *output,
+                        float const *weight,
+                        int in_dim,
+                        int out_dim,
+                        int batch_size,
+                        AggrMode aggr,
+                        int64_t num_entries,
+                        int num_threads);
+
+/**
+ * @brief Accumulates the gradient of cpu_forward_kernel into weight_grad.
+ *
+ * @details Each thread owns the rows of the table that are congruent to its
+ * index modulo the number of threads, so ids shared by several bags are
+ * accumulated without atomics and the result does not depend on num_threads.
+ */
+template <typename TI>
+void cpu_backward_kernel(TI const *input,
+                         float const *output_grad,
+                         float *weight_grad,
+                         int in_dim,
+                         int out_dim,
+                         int batch_size,
+                         AggrMode aggr,
+                         int64_t num_entries,
+                         int num_threads);
+
+} // namespace Embedding
+} // namespace Kernels
+} // namespace FlexFlow
+
+#endif // _FLEXFLOW_OPS_KERNELS_EMBEDDING_CPU_KERNELS_H
@@ -0,0 +1,281 @@
+#ifndef _FLEXFLOW_OPS_KERNELS_MOE_DISPATCH_CPU_KERNELS_H
+#define _FLEXFLOW_OPS_KERNELS_MOE_DISPATCH_CPU_KERNELS_H
+
+#include "flexflow/ffconst.h"
+
+namespace FlexFlow {
+namespace Kernels {
+namespace MoeDispatch {
+
+/**
+ * @brief The number of rows of each expert's input, i.e. the number of token
+ * assignments an expert accepts per batch (see Group_by).
+ *
+ * @details Each of the batch_size tokens is assigned to k of the n experts,
+ * and alpha is the factor of additional memory given to each expert over a
+ * perfectly balanced assignment.
+ */
+int expert_capacity(float alpha, int k, int n, int batch_size);
+
+/**
+ * @brief Reference for the dispatch that Group_by, Aggregate and AggregateSpec
+ * perform on the GPU.
+ *
+ * @details Assignment i of exp_assign (token i / k) gets row slots[i] of its
+ * expert, i.e. the number of earlier assignments to the same expert, or -1 if
+ * that row would be beyond the capacity of the expert and the assignment is
+ * dropped. expert_counts[e] is the number of assignments to expert e,
+ * including the dropped ones.
+ */
+void cpu_compute_expert_slots(int const *exp_assign,
+                              int num_assignments,
+                              int n,
+                              int capacity,
+                              int *slots,
+                              int *expert_counts);
+
+// The number of assignments dropped by cpu_compute_expert_slots
+int num_dropped(int const *expert_counts, int n, int capacity);
+
+/**
+ * @brief Copies each token of input to the rows of the experts it is assigned
+ * to (see Group_by::forward_kernel_wrapper).
+ */
+void cpu_group_by_forward(float const *input,
+                          int const *exp_assign,
+                          float *const *outputs,
+                          int n,
+                          int k,
+                          int capacity,
+                          int batch_size,
+                          int data_dim);
+
+/**
+ * @brief Writes the sum of the gradients of the expert rows of each token to
+ * input_grad; tokens whose assignments were all dropped get a zero gradient.
+ */
+void cpu_group_by_backward(float *input_grad,
+                           int const *exp_assign,
+                           float *const *output_grads,
+                           int n,
+                           int k,
+                           int capacity,
+                           int batch_size,
+                           int data_dim);
+
+/**
+ * @brief Combines the expert predictions of each token, weighted by the
+ * predictions of the gating net (see Aggregate::forward_kernel_wrapper).
+ */
+void cpu_aggregate_forward(float *const *exp_preds,
+                           int const *exp_assign,
+                           float const *gate_preds,
+                           float *output,
+                           int n,
+                           int k,
+                           int capacity,
+                           int batch_size,
+                           int out_dim);
+
+/**
+ * @brief Accumulates the gradients of cpu_aggregate_forward into exp_grads
+ * and full_gate_grads.
+ *
+ * @details The expert rows are those of true_exp_assign. The gradient of the
+ * gating net is only computed for tokens whose assignments match
+ * true_exp_assign, and every token also gets a load balancing term of
+ * lambda_bal * n / batch_size times the number of assignments to each
+ * expert. Each row of full_gate_grads is then shifted to zero mean.
+ */
+void cpu_aggregate_backward(float *const *exp_preds,
+                            float *const *exp_grads,
+                            int const *exp_assign,
+                            int const *true_exp_assign,
+                            float const *gate_preds,
+                            float *full_gate_grads,
+                            float const *output_grad,
+                            int n,
+                            int k,
+                            int capacity,
+                            float lambda_bal,
+                            int batch_size,
+                            int out_dim);
+
+/**
+ * @brief Gathers the expert predictions of each assignment, leaving the rows
+ * of dropped assignments zero (see AggregateSpec::forward_kernel_wrapper).
+ */
+void cpu_aggregate_spec_forward(float *const *exp_preds,
+                                int const *exp_assign,
+                                float *output,
+                                int n,
+                                int k,
+                                int capacity,
+                                int batch_size,
+                                int out_dim);
+
+/**
+ * @brief Accumulates the gradients of cpu_aggregate_spec_forward into
+ * exp_grads and full_gate_grads.
+ *
+ * @details The gating net is trained to predict the share of each expert in
+ * the squared error of the token; the balancing and zero mean terms are those
+ * of cpu_aggregate_backward.
+ */
+void cpu_aggregate_spec_backward(float *const *exp_grads,
+                                 int const *exp_assign,
+                                 int const *true_exp_assign,
+                                 float const *gate_preds,
+                                 float *full_gate_grads,
+                                 float const *output_grad,
+                                 int n,
+                                 int k,
+                                 int capacity,
+                                 float lambda_bal,
+                                 int batch_size,
+                                 int out_dim);
+
+/**
+ * @brief Reference for the dispatch of Experts::dispatch_kernel_wrapper.
+ *
+ * @details rows holds capacity rows of data_dim for each of the n experts,
+ * expert e first; each token is copied to the rows of the experts it is
+ * assigned to and the rows left over are zero. When the batch of Experts is
+ * split, each shard fills the rows of its own tokens and the all-to-all of
+ * Legion hands each expert the rows of all the shards.
+ */
+void cpu_experts_dispatch(float const *input,
+                          int const *exp_assign,
+                          float *rows,
+                          int n,
+                          int k,
+                          int capacity,
+                          int batch_size,
+                          int data_dim);
+
+// Accumulates the gradients of the rows of each token into input_grad
+void cpu_experts_dispatch_backward(float const *rows_grad,
+                                   int const *exp_assign,
+                                   float *input_grad,
+                                   int n,
+                                   int k,
+                                   int capacity,
+                                   int batch_size,
+                                   int data_dim);
+
+/**
+ * @brief Reference for the grouped GEMM of Experts::forward_kernel_wrapper.
+ *
+ * @details Local expert e computes softmax(act(W_e^T x + b_e)) for its
+ * num_rows rows, where W_e is the (data_dim, out_dim) matrix at kernel + e *
+ * data_dim * out_dim, laid out as the kernel of Linear, and b_e = bias + e *
+ * out_dim (bias may be null).
+ */
+void cpu_experts_compute(float const *rows,
+                         float const *kernel,
+                         float const *bias,
+                         float *outputs,
+                         ActiMode activation,
+                         int num_local,
+                         int num_rows,
+                         int data_dim,
+                         int out_dim);
+
+/**
+ * @brief Writes the gradients of cpu_experts_compute to rows_grad and
+ * accumulates them into kernel_grad and bias_grad (which may be null).
+ */
+void cpu_experts_compute_backward(float const *rows,
+                                  float const *kernel,
+                                  float const *bias,
+                                  float const *outputs_grad,
+                                  float *rows_grad,
+                                  float *kernel_grad,
+                                  float *bias_grad,
+                                  ActiMode activation,
+                                  int num_local,
+                                  int num_rows,
+                                  int data_dim,
+                                  int out_dim);
+
+/**
+ * @brief Reference for Experts::combine_kernel_wrapper: output gets the sum of
+ * the expert rows of each token, weighted by gate_preds.
+ */
+void cpu_experts_combine(float const *outputs,
+                         int const *exp_assign,
+                         float const *gate_preds,
+                         float *output,
+                         int n,
+                         int k,
+                         int capacity,
+                         int batch_size,
+                         int out_dim);
+
+/**
+ * @brief Writes the gradients of cpu_experts_combine to outputs_grad and
+ * accumulates the gate gradients into full_gate_grads (batch_size, n), the
+ * gradients of the gate values of all the experts, as cpu_aggregate_backward
+ * does.
+ *
+ * @details Every expert column of full_gate_grads also gets the load
+ * balancing term lambda_bal * n / batch_size times the number of assignments
+ * to the expert, and each row is then shifted to zero mean.
+ */
+void cpu_experts_combine_backward(float const *outputs,
+                                  int const *exp_assign,
+                                  float const *gate_preds,
+                                  float const *output_grad,
+                                  float *outputs_grad,
+                                  float *full_gate_grads,
+                                  float lambda_bal,
+                                  int n,
+                                  int k,
+                                  int capacity,
+                                  int batch_size,
+                                  int out_dim);
+
+// Reference for Experts on a single device: dispatch, compute and combine
+void cpu_experts_forward(float const *input,
+                         int const *exp_assign,
+                         float const *gate_preds,
+                         float const *kernel,
+                         float const *bias,
+                         float *output,
+                         ActiMode activation,
+                         int n,
+                         int k,
+                         int capacity,
+                         int batch_size,
+                         int data_dim,
+                         int out_dim);
+
+/**
+ * @brief Accumulates the gradients of cpu_experts_forward into input_grad,
+ * full_gate_grads (see cpu_experts_combine_backward), kernel_grad and
+ * bias_grad (which may be null).
+ */
+void cpu_experts_backward(float const *input,
+                          float *input_grad,
+                          int const *exp_assign,
+                          float const *gate_preds,
+                          float *full_gate_grads,
+                          float const *kernel,
+                          float *kernel_grad,
+                          float const *bias,
+                          float *bias_grad,
+                          float const *output_grad,
+                          ActiMode activation,
+                          float lambda_bal,
+                          int n,
+                          int k,
+                          int capacity,
+                          int batch_size,
+                          int data_dim,
+                          int out_dim);
+
+} // namespace MoeDispatch
+} // namespace Kernels
+} // namespace FlexFlow
+
+#endif // _FLEXFLOW_OPS_KERNELS_MOE_DISPATCH_CPU_KERNELS_H
@@ -0,0 +1,74 @@
+#ifndef _FLEXFLOW_OPS_KERNELS_MOE_DISPATCH_KERNELS_H
+#define _FLEXFLOW_OPS_KERNELS_MOE_DISPATCH_KERNELS_H
+
+#include "flexflow/device.h"
+#include "flexflow/op_meta.h"
+#include "flexflow/ops/kernels/moe_dispatch_cpu_kernels.h"
+
+namespace FlexFlow {
+namespace Kernels {
+namespace MoeDispatch {
+
+// The number of assignments that a block of compute_expert_slots ranks
+int const DISPATCH_BLOCK_SIZE = 256;
+
+/**
+ * @brief Device buffers of a dispatch, carved out of the work space of the
+ * FFHandler of an operator.
+ */
+struct DispatchBuffers {
+  int *slots;         // num_assignments, see cpu_compute_expert_slots
+  int *expert_counts; // n
+  int *block_offsets; // n per block of DISPATCH_BLOCK_SIZE assignments
+};
+
+// The number of bytes of device memory that the buffers of a dispatch take
+size_t dispatch_buffers_size(int num_assignments, int n);
+DispatchBuffers
+    get_dispatch_buffers(void *workspace, int num_assignments, int n);
+DispatchBuffers
+    get_dispatch_buffers(OpMeta const *m, int num_assignments, int n);
+
+/**
+ * @brief Computes the slots and counts of cpu_compute_expert_slots on the
+ * device, in three passes over the assignments: a histogram of the experts of
+ * each block, an exclusive scan of the histograms over the blocks, and the
+ * rank of each assignment among the earlier ones of its block with the same
+ * expert. Slots therefore follow the order of the tokens, as on the CPU, and
+ * neither the batch size nor the number of experts is bounded.
+ */
+void compute_expert_slots(int const *exp_assign,
+                          int num_assignments,
+                          int n,
+                          int capacity,
+                          DispatchBuffers const &buffers,
+                          ffStream_t stream);
+
+/**
+ * @brief Adds the load balancing term of cpu_aggregate_backward to the gate
+ * gradients, given the expert counts of a dispatch, and shifts each row of
+ * full_gate_grads to zero mean.
+ */
+void balance_gate_grads(float *full_gate_grads,
+                        int const *expert_counts,
+                        int n,
+                        float lambda_bal,
+                        int batch_size,
+                        ffStream_t stream);
+
+/**
+ * @brief Prints how many of the assignments of a dispatch the experts
+ * dropped; synchronizes the stream, so only call it when profiling.
+ */
+void report_dropped(char const *op_name,
+                    DispatchBuffers const &buffers,
+                    int num_assignments,
+                    int n,
+                    int capacity,
+                    ffStream_t stream);
+
+} // namespace MoeDispatch
+} // namespace Kernels
+} // namespace FlexFlow
+
+#endif // _FLEXFLOW_OPS_KERNELS_MOE_DISPATCH_KERNELS_H
@@ -24,13 +24,77 @@ namespace FlexFlow {
 class FFModel;
 class OpMeta;
 
+/**
+ * Parameters placed on the same devices whose gradients are synchronized by
+ * a single allreduce and updated by a single kernel. buffer_part maps each
+ * point of the launch to the bucket buffer of its GPU, into which the
+ * gradients are packed for the allreduce. Since all buckets share the buffer,
+ * it also keeps their NCCL calls in the same order on every GPU.
+ */
+struct GradientBucket {
+  std::vector<ParallelTensor> parameters;
+  Legion::LogicalPartition buffer_part;
+};
+
+/**
+ * The per-GPU shards of the tensors of a gradient bucket, passed by value to
+ * the multi-tensor update kernels
+ */
+struct MultiTensorTable {
+  int num_tensors;
+  size_t sizes[MAX_NUM_BUCKET_PARAMETERS];
+  float const *w_grad[MAX_NUM_BUCKET_PARAMETERS];
+  float *w[MAX_NUM_BUCKET_PARAMETERS];
+  float *v[MAX_NUM_BUCKET_PARAMETERS];
+  float *m[MAX_NUM_BUCKET_PARAMETERS];
+};
+
+/**
+ * The gradient of an embedding table given by the rows the embedding looked
+ * up rather than by a dense tensor. ids is the input of the embedding and
+ * grad the gradient of its output, each row of which applies to the ids of
+ * its bag (divided by the bag size with AGGR_MODE_AVG).
+ */
+struct SparseGradient {
+  ParallelTensor ids, grad;
+  AggrMode aggr;
+};
+
+/**
+ * The shard of a sparse gradient seen by one GPU. Row i of grad applies to
+ * ids [i * bag_size, (i + 1) * bag_size), and the local shard of the table
+ * holds the rows [row_lo, row_hi].
+ */
+struct SparseGradientShard {
+  DataType ids_type;
+  void const *ids;
+  size_t num_ids;
+  int bag_size;
+  float scale;
+  float const *grad;
+  int num_channels;
+  Legion::coord_t row_lo, row_hi;
+};
+
 class Optimizer {
 public:
   Optimizer(FFModel const *_model);
   virtual void init(void) = 0;
   virtual void next(void) = 0;
   virtual void update(const ParallelTensor p) = 0;
+  virtual void update(GradientBucket const &bucket) = 0;
+  // Groups the parameters synchronized with NCCL into gradient buckets of at
+  // most config.gradient_bucket_size bytes
+  void create_gradient_buckets(void);
   FFModel const *model;
+  // Ordered by when their gradients are ready in the backward pass
+  std::vector<GradientBucket> gradient_buckets;
+  std::vector<ParallelTensor> unbucketed_parameters;
+  // config.gradient_bucket_size bytes per GPU, see GradientBucket
+  Legion::LogicalRegion bucket_buffers;
+  // Embedding tables updated only at the rows looked up in the iteration,
+  // indexed by the region of the table
+  std::map<Legion::LogicalRegion, SparseGradient> sparse_gradients;
 };
 
 class SGDOptimizer : public Optimizer {
@@ -43,6 +107,8 @@ public:
   void init(void);
   void next(void);
   void update(const ParallelTensor p);
+  void update(GradientBucket const &bucket);
+  void sparse_update(const ParallelTensor p);
   void set_weight_decay(double _weight_decay);
   static void ps_update_task(Legion::Task const *task,
                              std::vector<Legion::PhysicalRegion> const &regions,
@@ -66,6 +132,25 @@ public:
                                    size_t size,
                                    float *w_ptr,
                                    float *v_ptr);
+  static void nccl_bucket_update_task(
+      Legion::Task const *task,
+      std::vector<Legion::PhysicalRegion> const &regions,
+      Legion::Context ctx,
+      Legion::Runtime *runtime);
+  static void nccl_bucket_update_task_gpu(SGDOptimizer const *op,
+                                          OpMeta const *meta,
+                                          MultiTensorTable table,
+                                          float *buffer);
+  static void
+      sparse_update_task(Legion::Task const *task,
+                         std::vector<Legion::PhysicalRegion> const &regions,
+                         Legion::Context ctx,
+                         Legion::Runtime *runtime);
+  static void sparse_update_task_gpu(SGDOptimizer const *op,
+                                     OpMeta const *meta,
+                                     SparseGradientShard const &grad,
+                                     float *w_ptr,
+                                     float *v_ptr);
 #endif
   double lr, momentum;
   bool nesterov;
@@ -85,6 +170,8 @@ public:
   void init(void);
   void next(void);
   void update(const ParallelTensor p);
+  void update(GradientBucket const &bucket);
+  void sparse_update(const ParallelTensor p);
   void set_weight_decay(double _weight_decay);
   static void ps_update_task(Legion::Task const *task,
                              std::vector<Legion::PhysicalRegion> const &regions,
@@ -110,11 +197,90 @@ public:
                                    float *w_ptr,
                                    float *v_ptr,
                                    float *m_ptr);
+  static void nccl_bucket_update_task(
+      Legion::Task const *task,
+      std::vector<Legion::PhysicalRegion> const &regions,
+      Legion::Context ctx,
+      Legion::Runtime *runtime);
+  static void nccl_bucket_update_task_gpu(AdamOptimizer const *op,
+                                          OpMeta const *meta,
+                                          MultiTensorTable table,
+                                          float *buffer);
+  static void
+      sparse_update_task(Legion::Task const *task,
+                         std::vector<Legion::PhysicalRegion> const &regions,
+                         Legion::Context ctx,
+                         Legion::Runtime *runtime);
+  static void sparse_update_task_gpu(AdamOptimizer const *op,
+                                     OpMeta const *meta,
+                                     SparseGradientShard const &grad,
+                                     float *w_ptr,
+                                     float *v_ptr,
+                                     float *m_ptr);
 #endif
   double alpha, beta1, beta2, weight_decay, epsilon;
   double alpha_t, beta1_t, beta2_t;
   std::map<Legion::LogicalRegion, ParallelTensor> v_values, m_values;
 };
 
+class AdagradOptimizer : public Optimizer {
+public:
+  AdagradOptimizer(FFModel const *_model,
+                   double lr = 0.01f,
+                   double weight_decay = 0.0f,
+                   double epsilon = 1e-10);
+  void init(void);
+  void next(void);
+  void update(const ParallelTensor p);
+  void update(GradientBucket const &bucket);
+  void sparse_update(const ParallelTensor p);
+  void set_weight_decay(double _weight_decay);
+  static void ps_update_task(Legion::Task const *task,
+                             std::vector<Legion::PhysicalRegion> const &regions,
+                             Legion::Context ctx,
+                             Legion::Runtime *runtime);
+  static void ps_update_task_gpu(AdagradOptimizer const *op,
+                                 float const *w_grad_ptr,
+                                 size_t size,
+                                 int num_replicas,
+                                 float *w_ptr,
+                                 float *v_ptr);
+#ifdef FF_USE_NCCL
+  static void
+      nccl_update_task(Legion::Task const *task,
+                       std::vector<Legion::PhysicalRegion> const &regions,
+                       Legion::Context ctx,
+                       Legion::Runtime *runtime);
+  static void nccl_update_task_gpu(AdagradOptimizer const *op,
+                                   OpMeta const *meta,
+                                   float const *w_grad_ptr,
+                                   size_t size,
+                                   float *w_ptr,
+                                   float *v_ptr);
+  static void nccl_bucket_update_task(
+      Legion::Task const *task,
+      std::vector<Legion::PhysicalRegion> const &regions,
+      Legion::Context ctx,
+      Legion::Runtime *runtime);
+  static void nccl_bucket_update_task_gpu(AdagradOptimizer const *op,
+                                          OpMeta const *meta,
+                                          MultiTensorTable table,
+                                          float *buffer);
+  static void
+      sparse_update_task(Legion::Task const *task,
+                         std::vector<Legion::PhysicalRegion> const &regions,
+                         Legion::Context ctx,
+                         Legion::Runtime *runtime);
+  static void sparse_update_task_gpu(AdagradOptimizer const *op,
+                                     OpMeta const *meta,
+                                     SparseGradientShard const &grad,
+                                     float *w_ptr,
+                                     float *v_ptr);
+#endif
+  double lr, weight_decay, epsilon;
+  // Sums of the squared gradients
+  std::map<Legion::LogicalRegion, ParallelTensor> v_values;
+};
+
 }; // namespace FlexFlow
 #endif
@@ -0,0 +1,67 @@
+#ifndef _FLEXFLOW_PIPELINE_H
+#define _FLEXFLOW_PIPELINE_H
+
+#include "flexflow/layer.h"
+#include "flexflow/node.h"
+#include "flexflow/op_meta.h"
+#include "flexflow/operator.h"
+#include "flexflow/parallel_ops/pipeline_params.h"
+#include "parallel_op.h"
+
+namespace FlexFlow {
+
+/**
+ * @brief Boundary between two pipeline stages.
+ *
+ * @details The output has the same shape as the input but may be mapped to
+ * other devices. The tensor is split into pipeline_degree micro-batches along
+ * pipeline_dim, which are moved to the next stage (and their gradients back)
+ * by separate launches so that both stages can work on different
+ * micro-batches at the same time.
+ */
+class Pipeline : public ParallelOp {
+public:
+  using Params = PipelineParams;
+  using Input = ParallelTensor;
+
+  Pipeline(FFModel &model,
+           const ParallelTensor input,
+           int pipeline_legion_dim,
+           int pipeline_degree,
+           char const *name = NULL);
+  Pipeline(FFModel &model,
+           Params const &params,
+           Input const input,
+           char const *name = nullptr);
+  void create_input_partition(FFModel &model) override;
+  void init(FFModel const &) override;
+  void forward(FFModel const &) override;
+  void backward(FFModel const &) override;
+  bool get_int_parameter(PMParameter, int *) const override;
+  bool append_parallel_op_info(
+      std::vector<ParallelOpInfo> &parallel_ops) const override;
+  static void forward_task(Legion::Task const *task,
+                           std::vector<Legion::PhysicalRegion> const &regions,
+                           Legion::Context ctx,
+                           Legion::Runtime *runtime);
+  static void backward_task(Legion::Task const *task,
+                            std::vector<Legion::PhysicalRegion> const &regions,
+                            Legion::Context ctx,
+                            Legion::Runtime *runtime);
+  bool measure_operator_cost(Simulator *sim,
+                             MachineView const &pc,
+                             CostMetrics &cost_metrics) const override;
+
+  Params get_params() const;
+
+public:
+  int pipeline_dim, pipeline_degree;
+  // One partition per micro-batch, all indexed by the output's parallel_is
+  std::vector<Legion::LogicalPartition> micro_batch_input_lps,
+      micro_batch_output_lps, micro_batch_input_grad_lps,
+      micro_batch_output_grad_lps;
+};
+
+}; // namespace FlexFlow
+
+#endif // _FLEXFLOW_PIPELINE_H
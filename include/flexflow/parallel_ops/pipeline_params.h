@@ -0,0 +1,22 @@
+#ifndef _FLEXFLOW_PIPELINE_PARAMS_H
+#define _FLEXFLOW_PIPELINE_PARAMS_H
+
+namespace FlexFlow {
+
+struct PipelineParams {
+  int pipeline_legion_dim;
+  int pipeline_degree;
+  bool is_valid(ParallelTensorShape const &) const;
+};
+bool operator==(PipelineParams const &, PipelineParams const &);
+
+} // namespace FlexFlow
+
+namespace std {
+template <>
+struct hash<FlexFlow::PipelineParams> {
+  size_t operator()(FlexFlow::PipelineParams const &) const;
+};
+} // namespace std
+
+#endif // _FLEXFLOW_PIPELINE_PARAMS_H
@@ -185,6 +185,9 @@ public:
   Op const *owner_op = nullptr;
   int owner_idx = 0;
   bool create_gradients = false;
+  // Tag of the region requirements on region and region_grad, e.g.
+  // MAP_TO_ZC_MEMORY for weights kept in zero-copy memory
+  Legion::MappingTagID region_tag = 0;
 
   // The following fields are initialized after model.compile
   MachineView machine_view = MachineView::NO_VIEW;
@@ -0,0 +1,63 @@
+#ifndef _FLEXFLOW_PIPELINE_SCHEDULE_H
+#define _FLEXFLOW_PIPELINE_SCHEDULE_H
+
+#include "flexflow/ffconst.h"
+#include <vector>
+
+namespace FlexFlow {
+
+/**
+ * The forward or backward pass of one micro-batch through one model chunk of
+ * a pipeline stage. Stage s holds the chunks s, s + num_stages, ..., so its
+ * chunk c is the virtual stage c * num_stages + s.
+ */
+struct PipelineStep {
+  int chunk;
+  int micro_batch;
+  bool forward;
+};
+
+/**
+ * The steps run by each stage, in order
+ */
+using PipelineSchedule = std::vector<std::vector<PipelineStep>>;
+
+/**
+ * @brief Builds a one-forward-one-backward schedule of num_micro_batches
+ * micro-batches over num_stages stages.
+ *
+ * @details With PIPELINE_1F1B every stage holds a single chunk. It runs
+ * forward passes until the micro-batches in flight fill the stages after it,
+ * then alternates forward and backward passes, which bounds the activations
+ * kept by the first stage to num_stages micro-batches. With
+ * PIPELINE_INTERLEAVED_1F1B every stage holds num_chunks chunks and
+ * micro-batches advance through them in groups of num_stages, which divides
+ * the pipeline bubble by num_chunks at the cost of more transfers.
+ *
+ * @return an empty schedule if the type does not apply, i.e. PIPELINE_1F1B
+ * with several chunks or PIPELINE_INTERLEAVED_1F1B with a number of
+ * micro-batches that is not a multiple of num_stages
+ */
+PipelineSchedule get_pipeline_schedule(PipelineScheduleType type,
+                                       int num_stages,
+                                       int num_micro_batches,
+                                       int num_chunks = 1);
+
+/**
+ * @brief Simulates a schedule.
+ *
+ * @details forward_times[v] and backward_times[v] are the times of one
+ * micro-batch through virtual stage v. transfer_time is paid whenever an
+ * activation or a gradient moves to another stage, and transfers do not
+ * occupy the stages.
+ *
+ * @return the time at which the last stage becomes idle
+ */
+float estimate_pipeline_time(PipelineSchedule const &schedule,
+                             std::vector<float> const &forward_times,
+                             std::vector<float> const &backward_times,
+                             float transfer_time);
+
+}; // namespace FlexFlow
+
+#endif // _FLEXFLOW_PIPELINE_SCHEDULE_H
@@ -16,18 +16,50 @@
 #ifndef _FLEXFLOW_RECOMPILE_H_
 #define _FLEXFLOW_RECOMPILE_H_
 
+#include "flexflow/machine_view.h"
+#include "flexflow/replan.h"
 #include "legion.h"
 #include <functional>
 
 namespace FlexFlow {
 
 class FFModel;
+class Op;
+
+/**
+ * @brief The thresholds of the load-aware mode of RecompileState.
+ */
+struct ReplanConfig {
+  // The number of iterations between two measured iterations
+  int measure_interval = 100;
+  // The load_imbalance of the assignments over the experts of an Experts
+  // operator above which its capacity factor is re-planned
+  float expert_imbalance_threshold = 1.5f;
+  // The load_imbalance of the measured busy time over the devices above
+  // which the operators are re-placed
+  float device_imbalance_threshold = 1.25f;
+  // The number of operators that a re-placement may move
+  int search_budget = 8;
+  // See replan_expert_alpha
+  float expert_headroom = 1.25f;
+  float max_expert_alpha = 4.0f;
+  int max_recompilations = 4;
+};
 
 class RecompileState {
 public:
+  // Alters the model with _alter_func the first time that _trigger_func
+  // holds
   RecompileState(std::function<bool(FFModel *)> _trigger_func,
                  std::function<void(FFModel *)> _alter_func,
                  FFModel *_ff);
+  // Re-plans the model from the loads measured at runtime every
+  // measure_interval iterations: Experts operators whose assignments are
+  // imbalanced get the capacity factor that keeps their most loaded expert
+  // whole, and when the busy time of the devices is imbalanced up to
+  // search_budget operators move to machine views of the same shape on other
+  // devices (see rebalance_placements)
+  RecompileState(FFModel *_ff, ReplanConfig const &_config);
   bool trigger();
   void alter();
 
@@ -35,9 +67,20 @@ public:
   int recompilations;
 
 private:
+  bool replan_trigger();
+  void replan_alter();
+  void plan_expert_capacities();
+  void plan_placements();
+
   std::function<bool(FFModel *)> trigger_func;
   std::function<void(FFModel *)> alter_func;
   FFModel *ff;
+  bool load_aware;
+  ReplanConfig config;
+  int iterations;
+  // The plan of the last measured iteration, applied by alter
+  std::vector<std::pair<Op *, float>> new_alphas;
+  std::vector<std::pair<Op *, MachineView>> new_views;
 };
 
 }; // namespace FlexFlow
@@ -0,0 +1,65 @@
+#ifndef _FLEXFLOW_REPLAN_H
+#define _FLEXFLOW_REPLAN_H
+
+#include <vector>
+
+namespace FlexFlow {
+
+/**
+ * @brief The ratio of the largest to the mean entry of load, e.g. of the
+ * assignments per expert or of the busy time per device; 1 for a perfectly
+ * balanced (or empty) load.
+ */
+double load_imbalance(std::vector<double> const &load);
+
+/**
+ * @brief The capacity factor of an Experts operator (see expert_capacity)
+ * under which its most loaded expert keeps all of its assignments.
+ *
+ * @details max_share is the largest fraction of the assignments of a device
+ * that a single expert received. The factor leaves headroom over it for the
+ * load to fluctuate, and is clamped to [1, max_alpha], since a factor below 1
+ * drops tokens even under a perfectly balanced assignment.
+ */
+float replan_expert_alpha(double max_share,
+                          int num_experts,
+                          float headroom,
+                          float max_alpha);
+
+/**
+ * @brief The devices an operator may run on, for a bounded re-placement of
+ * the operators of a compiled model.
+ *
+ * @details Each candidate lists the devices of a machine view with the same
+ * shape as the current one (so that the operator keeps its partitions); the
+ * operator keeps every device of the candidate busy for time.
+ */
+struct PlacementChoice {
+  double time;
+  int current;
+  std::vector<std::vector<int>> candidates;
+};
+
+// The busy time of each device when operator i runs on candidate choice[i]
+std::vector<double> device_loads(std::vector<PlacementChoice> const &ops,
+                                 std::vector<int> const &choice,
+                                 int num_devices);
+
+/**
+ * @brief Moves the operators to the candidates that minimize the busiest
+ * device, and returns the chosen candidate of each operator.
+ *
+ * @details Greedy: the budget longest-running operators with more than one
+ * candidate are taken off their devices in turn and put back on the candidate
+ * whose busiest device ends up least loaded, keeping the current one on ties.
+ * No step increases the load of the busiest device, so the result is never
+ * worse than the current placement. Transfers between operators are not
+ * modeled, which is why the operators move at most budget at a time.
+ */
+std::vector<int> rebalance_placements(std::vector<PlacementChoice> const &ops,
+                                      int num_devices,
+                                      int budget);
+
+}; // namespace FlexFlow
+
+#endif // _FLEXFLOW_REPLAN_H
@@ -0,0 +1,60 @@
+#ifndef _FLEXFLOW_ROOFLINE_H
+#define _FLEXFLOW_ROOFLINE_H
+
+namespace FlexFlow {
+
+/**
+ * The throughput of a device, as assumed by the analytical cost model
+ */
+struct RooflineSpec {
+  float peak_tflops;            // peak arithmetic throughput, in TFLOP/s
+  float memory_bandwidth_gbps;  // device memory bandwidth, in GB/s
+  float kernel_launch_overhead; // fixed cost of a kernel launch, in ms
+};
+
+/**
+ * The work of an operator on one device: the FLOPs of its forward pass, the
+ * bytes of its inputs, outputs and weights, and the time in ms spent moving
+ * data between its devices in each pass
+ */
+struct RooflineWork {
+  double flops = 0, bytes = 0;
+  bool has_weights = false;
+  float xfer_time = 0.0f;
+};
+
+// Time in ms of a kernel that performs flops and moves bytes
+float roofline_time(RooflineSpec const &spec, double flops, double bytes);
+
+/**
+ * Forward and backward times in ms of work. The backward pass computes the
+ * gradients w.r.t. both the inputs and the weights, which doubles the work of
+ * operators with weights, and takes no time in inference.
+ */
+void roofline_pass_times(RooflineSpec const &spec,
+                         RooflineWork const &work,
+                         bool training,
+                         float &forward_time,
+                         float &backward_time);
+
+// Each output element of a Linear is a dot product over the input channels
+double linear_flops(double output_volume, double in_channels);
+
+// Each output element of a Conv2D is a dot product over the kernel window of
+// the input channels of its group
+double conv2d_flops(double output_volume,
+                    double in_channels,
+                    int groups,
+                    int kernel_h,
+                    int kernel_w);
+
+// Every local expert runs a dense layer over num_rows rows, including the ones
+// that the dispatch leaves empty
+double experts_flops(double num_local,
+                     double num_rows,
+                     double data_dim,
+                     double out_dim);
+
+}; // namespace FlexFlow
+
+#endif // _FLEXFLOW_ROOFLINE_H
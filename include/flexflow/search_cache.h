@@ -0,0 +1,47 @@
+#ifndef _FLEXFLOW_SEARCH_CACHE_H
+#define _FLEXFLOW_SEARCH_CACHE_H
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace FlexFlow::PCG {
+
+/**
+ * @brief On-disk memo of search results, shared by every compile pointed at
+ * the same directory (see --search-cache-dir).
+ *
+ * @details Entries are keyed by structural hashes (see Graph::hash), which do
+ * not depend on node addresses or guids and are therefore stable across
+ * processes. Each file also records a context key that covers the machine and
+ * the search settings; files written under a different context are ignored.
+ * Files are written to a temporary path and renamed into place, so concurrent
+ * compiles sharing a directory never read a partially written entry.
+ */
+class SearchCache {
+public:
+  SearchCache(std::string const &directory, size_t context_key);
+
+  bool load_costs(std::string const &table,
+                  std::unordered_map<size_t, float> &costs) const;
+  bool save_costs(std::string const &table,
+                  std::unordered_map<size_t, float> const &costs) const;
+
+  bool load_blob(size_t key, std::vector<char> &data) const;
+  bool save_blob(size_t key, char const *data, size_t num_bytes) const;
+
+private:
+  std::string costs_path(std::string const &table) const;
+  std::string blob_path(size_t key) const;
+  bool write_file(std::string const &path,
+                  std::vector<char> const &payload) const;
+  bool read_file(std::string const &path, std::vector<char> &payload) const;
+
+private:
+  std::string directory;
+  size_t context_key;
+};
+
+}; // namespace FlexFlow::PCG
+
+#endif // _FLEXFLOW_SEARCH_CACHE_H
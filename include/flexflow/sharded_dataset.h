@@ -0,0 +1,122 @@
+#ifndef _FLEXFLOW_SHARDED_DATASET_H
+#define _FLEXFLOW_SHARDED_DATASET_H
+
+#include "flexflow/ffconst.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace FlexFlow {
+
+/**
+ * @brief Read-only view of a dataset stored as a sequence of shard files,
+ * which are memory-mapped rather than read into memory.
+ *
+ * @details A shard is either a .npy file in C order whose leading dimension
+ * indexes the samples, or a raw file of back-to-back samples of
+ * raw_sample_bytes bytes. Sample i of the dataset is sample i - first of the
+ * shard whose samples start at first, so the shards behave as one array that
+ * may be much larger than host memory: only the pages that are touched get
+ * loaded, and the kernel may evict them again under memory pressure. All the
+ * shards must have the same sample size (and data type, for .npy files).
+ */
+class ShardedDataset {
+public:
+  ShardedDataset(std::vector<std::string> const &paths,
+                 size_t raw_sample_bytes = 0);
+  ~ShardedDataset();
+  ShardedDataset(ShardedDataset const &) = delete;
+  ShardedDataset &operator=(ShardedDataset const &) = delete;
+
+  /**
+   * @brief The shards of a dataset: the .npy and .bin files of a directory
+   * in lexicographic order, the files listed (one per line) in a .txt file,
+   * or the single file at path.
+   */
+  static std::vector<std::string> list_shards(std::string const &path);
+
+  size_t num_samples() const;
+  size_t sample_bytes() const;
+  // DT_NONE for raw shards
+  DataType data_type() const;
+  // The shape of a sample, e.g. {13} for .npy shards of shape (N, 13), and
+  // {sample_bytes()} for raw shards
+  std::vector<size_t> const &sample_shape() const;
+
+  void const *sample(size_t idx) const;
+  // Copies samples idxs[0], ..., idxs[num - 1] back to back into dst
+  void gather(size_t const *idxs, size_t num, void *dst) const;
+  // Asks the kernel to start reading the pages of these samples
+  void will_need(size_t const *idxs, size_t num) const;
+
+private:
+  struct Shard {
+    std::string path;
+    char const *base = nullptr;
+    size_t map_bytes = 0;
+    size_t data_offset = 0;
+    size_t num_samples = 0;
+  };
+  void open_shard(Shard &shard, size_t raw_sample_bytes);
+  std::pair<Shard const *, size_t> locate(size_t idx) const;
+
+private:
+  std::vector<Shard> shards;
+  // first_sample[i] is the index of the first sample of shards[i], and
+  // first_sample.back() the number of samples
+  std::vector<size_t> first_sample;
+  size_t bytes_per_sample = 0;
+  DataType dtype = DT_NONE;
+  std::vector<size_t> shape;
+};
+
+/**
+ * @brief Samples [begin, end) of a dataset of num_samples samples that
+ * data-parallel partition part of num_parts reads.
+ *
+ * @details The partitions read contiguous ranges of (almost) the same size,
+ * which touch as few shards as possible.
+ */
+std::pair<size_t, size_t>
+    partition_samples(size_t num_samples, int part, int num_parts);
+
+/**
+ * @brief Streams the samples [begin, end) in an order shuffled through a
+ * bounded buffer.
+ *
+ * @details The buffer initially holds the first buffer_size samples of the
+ * range; each sample drawn from a random slot of the buffer is replaced by the
+ * next sample of the range. Samples are therefore read from disk in order,
+ * and each one is drawn less than buffer_size positions before its position in
+ * the range (but possibly much later). A buffer of at least end - begin
+ * samples yields a uniform shuffle, and a buffer of one sample keeps the
+ * order. The order is a function of seed and of the epoch passed to reset.
+ */
+class ShuffleBufferSampler {
+public:
+  ShuffleBufferSampler(size_t begin,
+                       size_t end,
+                       size_t buffer_size,
+                       uint64_t seed);
+
+  void reset(int epoch);
+  // Writes the indices of the next (up to) batch_size samples into idxs and
+  // returns their number, which is 0 once the epoch is over
+  size_t next_batch(size_t *idxs, size_t batch_size);
+  size_t remaining() const;
+
+private:
+  uint64_t next_random();
+
+private:
+  size_t begin, end, buffer_size;
+  uint64_t seed, state;
+  size_t next_sample;
+  std::vector<size_t> buffer;
+};
+
+}; // namespace FlexFlow
+
+#endif // _FLEXFLOW_SHARDED_DATASET_H
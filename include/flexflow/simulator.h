@@ -17,7 +17,11 @@
 
 #include "config.h"
 #include "ffconst.h"
+#include "flexflow/allreduce_schedule.h"
+#include "flexflow/connection_matrix.h"
+#include "flexflow/cost_database.h"
 #include "flexflow/operator_params.h"
+#include "flexflow/roofline.h"
 #include "flexflow/utils/hash_utils.h"
 #include "mpark/variant.hpp"
 #include "parallel_tensor.h"
@@ -198,6 +202,13 @@ public:
    */
   virtual EcmpRoutes get_routes(int src_node, int dst_node) = 0;
   virtual std::vector<EcmpRoutes> get_routes_from_src(int src_node) = 0;
+  /**
+   * Computes and caches the routes from src_node ahead of time. Calls for
+   * different sources may run concurrently.
+   */
+  virtual void precompute_routes(int src_node) {}
+  /* drop the cached routes, e.g. after the topology changed */
+  virtual void clear() {}
 };
 
 class MachineModel {
@@ -372,37 +383,57 @@ private:
 class WeightedShortestPathRoutingStrategy : public NetworkRoutingStrategy {
 public:
   WeightedShortestPathRoutingStrategy(
-      ConnectionMatrix const &c,
+      SparseConnectionMatrix const &c,
       std::map<size_t, CommDevice *> const &devmap,
       int total_devs);
   virtual EcmpRoutes get_routes(int src_node, int dst_node);
   virtual std::vector<EcmpRoutes> get_routes_from_src(int src_node);
+  virtual void precompute_routes(int src_node);
   void hop_count(int src_node, int dst_node, int &hop, int &narrowest);
   std::vector<std::pair<int, int>> hop_count(int src_node);
-  void clear();
+  virtual void clear();
+
+private:
+  std::vector<int> const &get_shortest_path_tree(int src_node);
+  std::vector<int> compute_shortest_path_tree(int src_node) const;
 
 public:
-  ConnectionMatrix const &conn;
+  SparseConnectionMatrix const &conn;
   std::map<size_t, CommDevice *> const &devmap;
   int total_devs;
+
+private:
+  /* predecessor of every device on the shortest path from each source,
+   * empty until the routes from that source are first needed */
+  std::vector<std::vector<int>> shortest_path_trees;
 };
 
 class ShortestPathNetworkRoutingStrategy : public NetworkRoutingStrategy {
 public:
   ShortestPathNetworkRoutingStrategy(
-      ConnectionMatrix const &c,
+      SparseConnectionMatrix const &c,
       std::map<size_t, CommDevice *> const &devmap,
       int total_devs);
   virtual EcmpRoutes get_routes(int src_node, int dst_node);
   virtual std::vector<EcmpRoutes> get_routes_from_src(int src_node);
+  virtual void precompute_routes(int src_node);
   void hop_count(int src_node, int dst_node, int &hop, int &narrowest);
   std::vector<std::pair<int, int>> hop_count(int src_node);
-  void clear();
+  virtual void clear();
+
+private:
+  std::vector<int> const &get_shortest_path_tree(int src_node);
+  std::vector<int> compute_shortest_path_tree(int src_node) const;
 
 public:
-  ConnectionMatrix const &conn;
+  SparseConnectionMatrix const &conn;
   std::map<size_t, CommDevice *> const &devmap;
   int total_devs;
+
+private:
+  /* predecessor of every device on the shortest path from each source,
+   * empty until the routes from that source are first needed */
+  std::vector<std::vector<int>> shortest_path_trees;
 };
 
 /**
@@ -411,9 +442,10 @@ public:
  */
 class NetworkTopologyGenerator {
 public:
-  virtual ConnectionMatrix generate_topology() const = 0;
-  static void
-      print_conn_matrix(ConnectionMatrix const &conn, int nnode, int nswitch) {
+  virtual SparseConnectionMatrix generate_topology() const = 0;
+  static void print_conn_matrix(SparseConnectionMatrix const &conn,
+                                int nnode,
+                                int nswitch) {
     int nnwdevs = nnode + nswitch;
     for (int i = 0; i < nnwdevs; i++) {
       if (i == nnode) {
@@ -423,7 +455,7 @@ public:
         if (j == nnode) {
           std::cout << "\t";
         }
-        std::cout << conn[i * nnwdevs + j] << "\t";
+        std::cout << conn.get(i, j) << "\t";
       }
       std::cout << std::endl;
     }
@@ -438,11 +470,10 @@ class FlatDegConstraintNetworkTopologyGenerator
     : public NetworkTopologyGenerator {
 public:
   FlatDegConstraintNetworkTopologyGenerator(int num_nodes, int degree);
-  virtual ConnectionMatrix generate_topology() const;
+  virtual SparseConnectionMatrix generate_topology() const;
 
 public:
   inline int get_id(int i, int j) const;
-  inline int get_if_in_use(int node, ConnectionMatrix const &conn) const;
   int num_nodes;
   int degree;
 };
@@ -454,7 +485,7 @@ public:
 class BigSwitchNetworkTopologyGenerator : public NetworkTopologyGenerator {
 public:
   BigSwitchNetworkTopologyGenerator(int num_nodes);
-  virtual ConnectionMatrix generate_topology() const;
+  virtual SparseConnectionMatrix generate_topology() const;
 
 public:
   int num_nodes;
@@ -466,8 +497,8 @@ public:
 class FlatEmptyNetworkTopologyGenerator : public NetworkTopologyGenerator {
 public:
   FlatEmptyNetworkTopologyGenerator(int num_nodes) : num_nodes(num_nodes) {}
-  virtual ConnectionMatrix generate_topology() const {
-    return ConnectionMatrix(num_nodes * num_nodes, 0);
+  virtual SparseConnectionMatrix generate_topology() const {
+    return SparseConnectionMatrix(num_nodes, {});
   }
 
 public:
@@ -477,12 +508,17 @@ public:
 class FCTopologyGenerator : public NetworkTopologyGenerator {
 public:
   FCTopologyGenerator(int num_nodes) : num_nodes(num_nodes) {}
-  virtual ConnectionMatrix generate_topology() const {
-    ConnectionMatrix result = ConnectionMatrix(num_nodes * num_nodes, 1);
+  virtual SparseConnectionMatrix generate_topology() const {
+    std::vector<SparseConnectionMatrix::Edge> edges;
+    edges.reserve((size_t)num_nodes * (num_nodes - 1));
     for (int i = 0; i < num_nodes; i++) {
-      result[i + i * num_nodes] = 0;
+      for (int j = 0; j < num_nodes; j++) {
+        if (i != j) {
+          edges.push_back({i, j, 1});
+        }
+      }
     }
-    return result;
+    return SparseConnectionMatrix(num_nodes, edges);
   }
 
 public:
@@ -492,6 +528,7 @@ public:
  * A model that is network topology-aware.
  * The network topology is represented as follows:
  *      An adjacency matrix is used to represnt the network connection
+ *      (stored in CSR form, see SparseConnectionMatrix)
  *      The matrix has dimension (n+s)*(n+s) where n is the number of servers
  *      in the cluster, and s is the number of switches in the cluster.
  *      This implies that for a flat topology the matrix is n*n,
@@ -516,6 +553,13 @@ public:
                         std::vector<int> const &topology,
                         size_t capacity,
                         float link_bandwidth);
+  NetworkedMachineModel(int num_nodes,
+                        int num_gpus_per_node,
+                        int num_switches,
+                        float network_latency,
+                        SparseConnectionMatrix const &topology,
+                        size_t capacity,
+                        float link_bandwidth);
   ~NetworkedMachineModel();
   int get_version() const;
   CompDevice *get_gpu(int device_id) const;
@@ -549,9 +593,14 @@ public:
   /* stores the network topology as a json */
   void save_topology_json(std::string const &fname) const;
   void update_route();
+  /* create and resize the physical links to match conn_matrix */
+  void update_links();
 
   void set_topology(std::vector<int> const &topology);
-  ConnectionMatrix const &get_conn_matrix();
+  void set_topology(SparseConnectionMatrix const &topology);
+  SparseConnectionMatrix const &get_conn_matrix();
+  /* the nominal devices are created on first use */
+  NominalCommDevice *get_nominal_device(int src_node, int dst_node) const;
   std::map<size_t, NominalCommDevice *> const &get_nomm_comm_devs();
 
   void set_pcie(bool state);
@@ -573,7 +622,7 @@ public:
   // float gpu_dram_bandwidth;
   /* Note that every non-zero entry corrsepond to a device in
    * in_to_nw_comm_device */
-  ConnectionMatrix conn_matrix;
+  SparseConnectionMatrix conn_matrix;
   NetworkRoutingStrategy *routing_strategy;
   std::map<int, CompDevice *> id_to_gpu;
   std::map<int, MemDevice *> id_to_gpu_fb_mem;
@@ -582,13 +631,14 @@ public:
   std::map<int, CommDevice *> id_to_dramtogpu_comm_device;
   std::map<size_t, CommDevice *> ids_to_inter_gpu_comm_device;
 
-  /* this refers to the actual links in the system */
+  /* this refers to the actual links in the system. Only the links present in
+   * the topology are created */
   std::map<size_t, CommDevice *> ids_to_nw_comm_device;
   /* on the other hand, this represents the "nomical" communication device
    * or the "logical connection" in side the system. Note that this is
    * keyed on GPUs only
    */
-  std::map<size_t, NominalCommDevice *> ids_to_nw_nominal_device;
+  mutable std::map<size_t, NominalCommDevice *> ids_to_nw_nominal_device;
 
 public:
   std::map<size_t, uint64_t> logical_traffic_demand;
@@ -679,6 +729,62 @@ size_t data_type_size(DataType);
 
 using ProfilingRecordKey = std::tuple<OperatorParameters, MachineView>;
 
+class Simulator;
+
+/**
+ * @brief Source of the per-operator costs used by the Simulator.
+ */
+class CostModel {
+public:
+  virtual ~CostModel() = default;
+  /**
+   * @brief Fill in the forward/backward time and memory usage of running one
+   * partition of op under the given machine view.
+   *
+   * @return false if the cost of op cannot be estimated by this model
+   */
+  virtual bool measure_operator_cost(Simulator *sim,
+                                     Op const *op,
+                                     MachineView const &mv,
+                                     CostMetrics &cost_metrics) const = 0;
+  /**
+   * @brief Whether costs come from running kernels on the local device (and
+   * are therefore worth persisting in a CostDatabase).
+   */
+  virtual bool is_device_dependent() const = 0;
+};
+
+/**
+ * @brief Measure costs by running each operator's kernels on the local GPU.
+ */
+class ProfilingCostModel : public CostModel {
+public:
+  bool measure_operator_cost(Simulator *sim,
+                             Op const *op,
+                             MachineView const &mv,
+                             CostMetrics &cost_metrics) const override;
+  bool is_device_dependent() const override;
+};
+
+/**
+ * @brief Estimate costs with a roofline model from the FLOPs and the bytes
+ * moved by each operator, so that no kernel needs to be launched.
+ */
+class AnalyticalCostModel : public CostModel {
+public:
+  using DeviceSpec = RooflineSpec;
+
+  AnalyticalCostModel(DeviceSpec const &spec);
+  bool measure_operator_cost(Simulator *sim,
+                             Op const *op,
+                             MachineView const &mv,
+                             CostMetrics &cost_metrics) const override;
+  bool is_device_dependent() const override;
+
+private:
+  DeviceSpec spec;
+};
+
 class Simulator {
 public:
   static constexpr float MAXIMUM_TASK_RUN_TIME = 1e7;
@@ -686,6 +792,9 @@ public:
             FFHandler handler,
             Legion::Memory memory,
             MachineModel *machine);
+  // A simulator that never runs kernels, for searching on machines without
+  // GPUs (see tools/ff_search); requires the analytical cost model
+  Simulator(FFModel const *model, MachineModel *machine);
   ~Simulator(void);
   void free_all();
   void *allocate(size_t num_elements, DataType type);
@@ -709,6 +818,10 @@ public:
   float default_estimate_sync_cost(const ParallelTensor tensor,
                                    MachineView const &view,
                                    int num_replicate_dims);
+  // The time of an all-to-all among the devices of view, in which each device
+  // holds piece_size bytes and sends an equal share to every other device
+  float estimate_all_to_all_xfer_cost(MachineView const &view,
+                                      size_t piece_size);
   float simulate_runtime(FFModel const *model,
                          std::map<Op const *, ParallelConfig> const &global,
                          CompMode comp_mode);
@@ -721,6 +834,9 @@ public:
                            std::vector<Legion::PhysicalRegion> const &regions,
                            Legion::Context ctx,
                            Legion::Runtime *runtime);
+  // Identifies the current device (and library versions) that costs are
+  // measured on
+  static size_t get_device_fingerprint();
 
 public:
   Realm::RegionInstance simulatorInst;
@@ -735,12 +851,18 @@ public:
   CompMode computationMode;
 #if defined(FF_USE_CUDA) || defined(FF_USE_HIP_CUDA)
   cudaEvent_t start_event, end_event;
-#else
+#elif defined(FF_USE_HIP_ROCM)
   hipEvent_t start_event, end_event;
 #endif
   std::unordered_map<size_t, CostMetrics> hash_to_operator_cost;
   std::unordered_map<ProfilingRecordKey, CostMetrics>
       strict_hash_to_operator_cost;
+  // identifies the device (and library versions) costs are measured on
+  size_t device_fingerprint;
+  std::unique_ptr<CostDatabase> cost_db;
+  std::unique_ptr<CostModel> cost_model;
+  // estimates the costs that an import-only cost_db lacks, if any
+  std::unique_ptr<CostModel> missing_cost_model;
 
 public:
   Conv2DMeta *conv2d_meta;
@@ -758,7 +880,23 @@ public:
   int segment_size;
   int max_num_segments; // simulation could be slow if the number of segments
                         // are too large
+  // collective used to model weight synchronization (see expand_allreduce)
+  AllreduceAlgorithm allreduce_algorithm;
+
 private:
+  void create_cost_model(FFConfig const &config);
+  void open_cost_database(FFConfig const &config);
+  size_t get_cost_database_key(Op const *op,
+                               OperatorParameters const &params,
+                               MachineView const &mv) const;
+  bool find_cost_in_database(size_t key, CostMetrics &cost_metrics) const;
+  void record_cost_in_database(size_t key, CostMetrics const &cost_metrics);
+  // Fills in the costs of op with the cost model, or with the analytical one
+  // if costs can only be imported from the database. Returns whether the
+  // cost model measured them, in which case they may be recorded.
+  bool estimate_operator_cost(Op const *op,
+                              MachineView const &mv,
+                              CostMetrics &cost_metrics);
   float estimate_repartition_xfer_cost(
       int repartition_dim,
       int repartition_degree,
@@ -766,6 +904,11 @@ private:
       ParallelTensorShape const &output_tensor_shape,
       MachineView const &source_view,
       MachineView const &target_view) const;
+  // Each part of tensor moves from its device in source_view to the device
+  // of the same part in sink_view
+  float estimate_point_to_point_xfer_cost(const ParallelTensor tensor,
+                                          MachineView const &source_view,
+                                          MachineView const &sink_view) const;
 };
 
 /**
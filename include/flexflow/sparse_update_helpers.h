@@ -0,0 +1,146 @@
+#ifndef _FLEXFLOW_SPARSE_UPDATE_HELPERS_H
+#define _FLEXFLOW_SPARSE_UPDATE_HELPERS_H
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+// The math of the sparse optimizer updates, shared by the kernels of
+// optimizer_kernel.cu and optimizer_kernel.cpp and by the unit tests
+#if defined(__CUDACC__) || defined(__HIPCC__)
+#define SPARSE_UPDATE_FUNC __host__ __device__ inline
+#else
+#define SPARSE_UPDATE_FUNC inline
+#endif
+
+namespace FlexFlow {
+namespace SparseUpdate {
+
+/**
+ * @brief Value i of a coalesced sparse gradient: the sum over the j-th
+ * sorted row of segment u = i / num_channels of the channel i % num_channels
+ * of the row perm[j] / divisor of src, multiplied by scale.
+ *
+ * @details The segment u spans the sorted rows [segment_starts[u],
+ * segment_starts[u + 1]), the last one ending at count.
+ */
+SPARSE_UPDATE_FUNC float segment_sum(size_t i,
+                                     size_t num_segments,
+                                     size_t count,
+                                     int num_channels,
+                                     int64_t const *segment_starts,
+                                     int64_t const *perm,
+                                     int divisor,
+                                     float scale,
+                                     float const *src) {
+  size_t u = i / num_channels;
+  int c = i % num_channels;
+  int64_t end = u + 1 < num_segments ? segment_starts[u + 1] : count;
+  float sum = 0.0f;
+  for (int64_t j = segment_starts[u]; j < end; j++) {
+    sum += src[(perm[j] / divisor) * num_channels + c];
+  }
+  return sum * scale;
+}
+
+/**
+ * @brief The index in the local shard [row_lo, row_hi] of the table of
+ * value i of a coalesced sparse gradient, or -1 if its row (including the
+ * padding row -1) is not in the shard.
+ */
+SPARSE_UPDATE_FUNC int64_t shard_index(size_t i,
+                                       int num_channels,
+                                       int64_t const *rows,
+                                       int64_t row_lo,
+                                       int64_t row_hi) {
+  int64_t row = rows[i / num_channels];
+  if (row < row_lo || row > row_hi) {
+    return -1;
+  }
+  return (row - row_lo) * num_channels + i % num_channels;
+}
+
+// The SGD step of SGDOptimizer on value i of a coalesced sparse gradient;
+// the rows that are not in the shard are left untouched
+SPARSE_UPDATE_FUNC void sgd_step(size_t i,
+                                 int num_channels,
+                                 int64_t const *rows,
+                                 float const *values,
+                                 int64_t row_lo,
+                                 int64_t row_hi,
+                                 float lr,
+                                 float weight_decay,
+                                 float momentum,
+                                 bool nesterov,
+                                 float *V,
+                                 float *W) {
+  int64_t w = shard_index(i, num_channels, rows, row_lo, row_hi);
+  if (w < 0) {
+    return;
+  }
+  float gt = values[i] + weight_decay * W[w];
+  if (momentum > 0.0f) {
+    V[w] = V[w] * momentum + gt;
+    if (nesterov) {
+      gt = gt + momentum * V[w];
+    } else {
+      gt = V[w];
+    }
+  }
+  W[w] -= lr * gt;
+}
+
+// The Adam step of AdamOptimizer, see sgd_step
+SPARSE_UPDATE_FUNC void adam_step(size_t i,
+                                  int num_channels,
+                                  int64_t const *rows,
+                                  float const *values,
+                                  int64_t row_lo,
+                                  int64_t row_hi,
+                                  float alpha_t,
+                                  float beta1,
+                                  float beta2,
+                                  float weight_decay,
+                                  float epsilon,
+                                  float *M,
+                                  float *V,
+                                  float *W) {
+  int64_t w = shard_index(i, num_channels, rows, row_lo, row_hi);
+  if (w < 0) {
+    return;
+  }
+  float gt = values[i] + weight_decay * W[w];
+  float mt = beta1 * M[w] + (1 - beta1) * gt;
+  float vt = beta2 * V[w] + (1 - beta2) * gt * gt;
+  M[w] = mt;
+  V[w] = vt;
+  W[w] -= alpha_t * mt / (sqrtf(vt) + epsilon);
+}
+
+// The Adagrad step of AdagradOptimizer, see sgd_step
+SPARSE_UPDATE_FUNC void adagrad_step(size_t i,
+                                     int num_channels,
+                                     int64_t const *rows,
+                                     float const *values,
+                                     int64_t row_lo,
+                                     int64_t row_hi,
+                                     float lr,
+                                     float weight_decay,
+                                     float epsilon,
+                                     float *V,
+                                     float *W) {
+  int64_t w = shard_index(i, num_channels, rows, row_lo, row_hi);
+  if (w < 0) {
+    return;
+  }
+  float gt = values[i] + weight_decay * W[w];
+  V[w] += gt * gt;
+  W[w] -= lr * gt / (sqrtf(V[w]) + epsilon);
+}
+
+} // namespace SparseUpdate
+}; // namespace FlexFlow
+
+#undef SPARSE_UPDATE_FUNC
+
+#endif // _FLEXFLOW_SPARSE_UPDATE_HELPERS_H
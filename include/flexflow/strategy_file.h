@@ -0,0 +1,95 @@
+#ifndef _FLEXFLOW_STRATEGY_FILE_H
+#define _FLEXFLOW_STRATEGY_FILE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace FlexFlow::PCG {
+
+/**
+ * @brief What a strategy file was searched for: the model, identified by the
+ * structural hash of its unoptimized PCG (see Graph::hash), and the machine
+ * the strategy targets.
+ */
+struct StrategyFileKey {
+  uint64_t model_signature;
+  // The guids that the inputs and weights of the model are bound by (see
+  // binding_signature)
+  uint64_t binding_signature;
+  int32_t num_nodes, workers_per_node, cpus_per_node;
+
+  bool operator==(StrategyFileKey const &other) const;
+  bool operator!=(StrategyFileKey const &other) const;
+};
+
+/**
+ * @brief Hash of the guids by which compile binds the inputs and weights of a
+ * model to the operators of a strategy, in the order of the layers.
+ *
+ * @details model_signature ignores guids, so a structurally identical model
+ * whose tensors and layers are numbered differently shares it, but cannot
+ * bind its inputs and weights to the operators of the other's strategy.
+ */
+uint64_t binding_signature(std::vector<size_t> const &input_tensor_guids,
+                           std::vector<size_t> const &weight_layer_guids);
+
+/**
+ * @brief Reads a strategy written by save_strategy_file (see --import).
+ *
+ * @details Returns false and sets reason if the file does not exist, was
+ * written by an incompatible version of FlexFlow, or for a different model or
+ * machine, in which case the strategy has to be searched for again. Throws a
+ * std::runtime_error if the file is not a strategy file or is truncated.
+ */
+bool load_strategy_file(std::string const &path,
+                        StrategyFileKey const &key,
+                        std::vector<char> &strategy,
+                        std::string &reason);
+
+/**
+ * @brief Writes the serialized result of the search, i.e. the best graph and
+ * its machine views (see --export).
+ *
+ * @details The file is written to a temporary path and renamed into place, so
+ * a job importing it never reads a partially written strategy. Throws a
+ * std::runtime_error if the file cannot be written.
+ */
+void save_strategy_file(std::string const &path,
+                        StrategyFileKey const &key,
+                        char const *strategy,
+                        size_t num_bytes);
+
+/**
+ * @brief What the search needs to know about an exported PCG besides the
+ * graph itself (see --export-pcg and tools/ff_search).
+ */
+struct PCGFileInfo {
+  // The key of the strategies searched for the PCG
+  uint64_t model_signature, binding_signature;
+  int32_t cpus_per_node;
+  // The CompMode the model is compiled for
+  int32_t computation_mode;
+};
+
+/**
+ * @brief Reads a PCG written by save_pcg_file, i.e. an unoptimized graph
+ * serialized without machine views.
+ *
+ * @details Throws a std::runtime_error if the file does not exist, is not a
+ * PCG file, was written by an incompatible version of FlexFlow or is
+ * truncated, since unlike a strategy a PCG cannot be recomputed by the search.
+ */
+void load_pcg_file(std::string const &path,
+                   PCGFileInfo &info,
+                   std::vector<char> &pcg);
+
+// Writes a PCG file, atomically like save_strategy_file
+void save_pcg_file(std::string const &path,
+                   PCGFileInfo const &info,
+                   char const *pcg,
+                   size_t num_bytes);
+
+}; // namespace FlexFlow::PCG
+
+#endif // _FLEXFLOW_STRATEGY_FILE_H
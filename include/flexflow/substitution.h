@@ -19,8 +19,10 @@
 #include "flexflow/graph.h"
 #include "flexflow/parallel_tensor.h"
 #include "flexflow/substitution_loader.h"
+#include "flexflow/utils/concurrent_hash_set.h"
 #include "flexflow/utils/recursive_logger.h"
 #include "tl/optional.hpp"
+#include <atomic>
 #include <queue>
 
 namespace FlexFlow::PCG {
@@ -121,13 +123,24 @@ std::vector<GraphXfer *> create_xfers(FFModel *model,
                                       sl::RuleCollection const &rules,
                                       int parallel_degree);
 
-class GraphCompare {
+// A graph waiting in the candidate queue of base_optimize
+struct SearchCandidate {
+  float cost;
+  std::shared_ptr<GraphDelta const> graph;
+};
+
+class SearchCandidateCompare {
 public:
-  bool operator()(Graph *lhs, Graph *rhs) {
-    return lhs->optimal_cost() > rhs->optimal_cost();
+  bool operator()(SearchCandidate const &lhs,
+                  SearchCandidate const &rhs) const {
+    return lhs.cost > rhs.cost;
   }
 };
 
+using SearchCandidateQueue = std::priority_queue<SearchCandidate,
+                                                 std::vector<SearchCandidate>,
+                                                 SearchCandidateCompare>;
+
 class GraphXferMatch {
 public:
   GraphXferMatch(GraphXfer const *);
@@ -187,6 +200,11 @@ public:
                         TensorX const &value,
                         OpX const *match_opx,
                         int num_heads);
+  OpX *create_experts(TensorX const &input,
+                      TensorX const &indices,
+                      TensorX const &gate_preds,
+                      TensorX const &full_gate_preds,
+                      OpX const *match_opx);
   OpX *create_softmax(TensorX const &input, int softmax_dim);
   // Parallel Ops
   OpX *create_repartition(TensorX const &input,
@@ -203,10 +221,13 @@ public:
 
   std::string get_name() const;
 
+  // Thread-safe: new graphs are appended to new_graphs in match order along
+  // with their cost; the model's op caches and guid counters and the search
+  // helper's caches and simulator are each guarded by their own lock
   void run(int depth,
-           Graph *graph,
-           std::priority_queue<Graph *, std::vector<Graph *>, GraphCompare> &,
-           std::unordered_set<size_t> &,
+           Graph const *graph,
+           std::vector<std::pair<Graph *, float>> &new_graphs,
+           concurrent_hash_set<size_t> const &hashmap,
            float threshold,
            int maxNumOps,
            SimplificationSettings const &simplification_settings,
@@ -221,6 +242,20 @@ private:
                     Graph const *graph,
                     std::vector<GraphXferMatch> &matches);
 
+  // A source op and how the nodes it may match are enumerated: the consumers
+  // of the node matched by one of its producers, the producers of the nodes
+  // of a rarer consumer (the anchor), or all nodes of its type
+  struct MatchStep {
+    OpX *op;
+    OpX *anchor = NULL;
+    int anchor_input = 0;
+  };
+  bool prepare_match_order(Graph const *graph);
+  void get_candidates(MatchStep const &step,
+                      Graph const *graph,
+                      std::vector<Node> &candidates) const;
+  std::vector<MatchStep> match_order;
+
 public:
   FFModel *model;
   tl::optional<std::string> name = tl::nullopt;
@@ -239,11 +274,19 @@ public:
                       bool only_data_parallel,
                       std::unique_ptr<Graph> &best_graph,
                       std::unordered_map<Node, MachineView> &optimal_views);
+  // Optimizes graph instead of the graph of the operators of the model, e.g.
+  // a PCG loaded by tools/ff_search
+  void graph_optimize(Graph *graph,
+                      std::unique_ptr<Graph> &best_graph,
+                      std::unordered_map<Node, MachineView> &optimal_views);
   void graph_optimize_no_split(
       size_t budget,
       bool only_data_parallel,
       std::unique_ptr<Graph> &best_graph,
       std::unordered_map<Node, MachineView> &optimal_views);
+  Graph *construct_graph();
+  void load_cached_costs(SearchCache const &cache);
+  void save_cached_costs(SearchCache const &cache) const;
 
 private:
   template <typename T>
@@ -269,12 +312,21 @@ private:
       ParallelTensorShape const &bottleneck_output_shape);
   void generate_all_pcg_xfers();
   void load_graph_substitutions(std::vector<GraphXfer *> &xfers) const;
-  Graph *construct_graph();
   void subgraph_optimize(Graph *subgraph);
+  void check_device_memory(GraphCostResult const &result) const;
 
   std::unique_ptr<Graph>
       base_optimize(Graph const *,
                     SimplificationSettings const &simplification_settings);
+  void run_xfers_in_parallel(
+      Graph const *graph,
+      std::shared_ptr<GraphDelta const> const &graph_delta,
+      std::vector<GraphXfer *> const &xfers,
+      SearchCandidateQueue &candidates,
+      concurrent_hash_set<size_t> &hashmap,
+      float threshold,
+      SimplificationSettings const &simplification_settings,
+      std::atomic<int> &available_threads);
 
   std::vector<ParallelTensorShape>
       possible_split_output_tensor_shapes(Node const &) const;
@@ -35,6 +35,8 @@ NLOHMANN_JSON_SERIALIZE_ENUM(PMParameter,
                               {PM_COMBINE_DEGREE, "PM_COMBINE_DEGREE"},
                               {PM_REDUCTION_DIM, "PM_REDUCTION_DIM"},
                               {PM_REDUCTION_DEGREE, "PM_REDUCTION_DEGREE"},
+                              {PM_PIPELINE_DIM, "PM_PIPELINE_DIM"},
+                              {PM_PIPELINE_DEGREE, "PM_PIPELINE_DEGREE"},
                               {PM_SOFTMAX_DIM, "PM_SOFTMAX_DIM"},
                               {PM_NUM_HEADS, "PM_NUM_HEADS"},
                               {PM_PARALLEL_DIM, "PM_PARALLEL_DIM"},
@@ -69,6 +71,7 @@ NLOHMANN_JSON_SERIALIZE_ENUM(OperatorType,
                               {OP_CACHE, "OP_CACHE"},
                               {OP_AGGREGATE, "OP_AGGREGATE"},
                               {OP_AGG_SPEC, "OP_AGG_SPEC"},
+                              {OP_EXPERTS, "OP_EXPERTS"},
                               {OP_RESHAPE, "OP_RESHAPE"},
                               {OP_REVERSE, "OP_REVERSE"},
                               {OP_TRANSPOSE, "OP_TRANSPOSE"},
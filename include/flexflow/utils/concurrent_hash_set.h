@@ -0,0 +1,61 @@
+#ifndef _FLEXFLOW_CONCURRENT_HASH_SET_H
+#define _FLEXFLOW_CONCURRENT_HASH_SET_H
+
+#include <cassert>
+#include <functional>
+#include <mutex>
+#include <unordered_set>
+#include <vector>
+
+/**
+ * @brief A hash set that can be queried and updated from multiple threads.
+ *
+ * @details Elements are spread over a fixed number of shards, each guarded by
+ * its own mutex, so that threads touching different shards do not contend.
+ */
+template <typename T, typename Hash = std::hash<T>>
+class concurrent_hash_set {
+public:
+  explicit concurrent_hash_set(size_t num_shards = 64)
+      : shards(num_shards), locks(num_shards) {
+    assert(num_shards > 0);
+  }
+
+  /**
+   * @return true if the element was not present before this call
+   */
+  bool insert(T const &t) {
+    size_t idx = this->shard_index(t);
+    std::lock_guard<std::mutex> guard(this->locks[idx]);
+    return this->shards[idx].insert(t).second;
+  }
+
+  bool contains(T const &t) const {
+    size_t idx = this->shard_index(t);
+    std::lock_guard<std::mutex> guard(this->locks[idx]);
+    return this->shards[idx].find(t) != this->shards[idx].end();
+  }
+
+  size_t size() const {
+    size_t total = 0;
+    for (size_t i = 0; i < this->shards.size(); i++) {
+      std::lock_guard<std::mutex> guard(this->locks[i]);
+      total += this->shards[i].size();
+    }
+    return total;
+  }
+
+private:
+  size_t shard_index(T const &t) const {
+    // mix the hash so that shard selection does not reuse the low bits the
+    // per-shard unordered_set buckets on
+    size_t h = Hash()(t);
+    h ^= (h >> 29) ^ (h >> 47);
+    return h % this->shards.size();
+  }
+
+  std::vector<std::unordered_set<T, Hash>> shards;
+  mutable std::vector<std::mutex> locks;
+};
+
+#endif // _FLEXFLOW_CONCURRENT_HASH_SET_H
@@ -0,0 +1,77 @@
+#ifndef _FLEXFLOW_PARALLEL_FOR_H
+#define _FLEXFLOW_PARALLEL_FOR_H
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace FlexFlow {
+
+/**
+ * @brief Calls f(0), ..., f(n - 1) on the calling thread plus as many threads
+ * as can be borrowed from budget.
+ *
+ * @details budget counts the threads that are still free to be spawned. It
+ * is shared by nested calls: the borrowed threads are only returned once the
+ * whole loop has finished, so a nested loop that finds the budget exhausted
+ * simply runs on its calling thread. This bounds the total number of threads
+ * by the initial budget and never blocks waiting for a free thread. Each f(i)
+ * is called exactly once, in no particular order.
+ */
+template <typename F>
+void parallel_for(size_t n, std::atomic<int> &budget, F const &f) {
+  int borrowed = 0;
+  if (n > 1) {
+    int available = budget.load();
+    while (available > 0) {
+      int take = (int)std::min<size_t>(n - 1, available);
+      if (budget.compare_exchange_weak(available, available - take)) {
+        borrowed = take;
+        break;
+      }
+    }
+  }
+  if (borrowed == 0) {
+    for (size_t i = 0; i < n; i++) {
+      f(i);
+    }
+    return;
+  }
+
+  std::atomic<size_t> next(0);
+  std::exception_ptr error;
+  std::mutex error_mutex;
+  auto worker = [&]() {
+    for (size_t i = next++; i < n; i = next++) {
+      try {
+        f(i);
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(error_mutex);
+        if (!error) {
+          error = std::current_exception();
+        }
+      }
+    }
+  };
+
+  std::vector<std::thread> workers;
+  for (int i = 0; i < borrowed; i++) {
+    workers.emplace_back(worker);
+  }
+  worker();
+  for (std::thread &t : workers) {
+    t.join();
+  }
+  budget += borrowed;
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
+
+}; // namespace FlexFlow
+
+#endif // _FLEXFLOW_PARALLEL_FOR_H
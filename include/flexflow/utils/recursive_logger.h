@@ -2,6 +2,7 @@
 #define _FLEXFLOW_RECURSIVE_LOGGER_H
 
 #include "legion/legion_utilities.h"
+#include <atomic>
 #include <memory>
 
 #define CONCAT(a, b) CONCAT_INNER(a, b)
@@ -38,7 +39,9 @@ public:
   std::unique_ptr<DepthTag> enter_tag();
 
 private:
-  int depth = 0;
+  // shared by the threads of a parallel search, which only makes the
+  // indentation approximate
+  std::atomic<int> depth{0};
 
   void print_prefix(Realm::LoggerMessage &) const;
 
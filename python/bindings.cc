@@ -360,6 +360,15 @@ PYBIND11_MODULE(flexflow_pybind11_internal, m) {
       .def("set_learning_rate",
            [](AdamOptimizer &optimizer, double lr) { optimizer.alpha = lr; });
 
+  py::class_<AdagradOptimizer, Optimizer>(m, "AdagradOptimizer")
+      .def(py::init<FFModel const *, double, double, double>(),
+           "model"_a,
+           "lr"_a = 0.01f,
+           "weight_decay"_a = 0.0f,
+           "epsilon"_a = 1e-10)
+      .def("set_learning_rate",
+           [](AdagradOptimizer &optimizer, double lr) { optimizer.lr = lr; });
+
   py::class_<NetConfig>(m, "NetConfig")
       .def(py::init())
       .def_readonly("dataset_path", &NetConfig::dataset_path);
@@ -1941,21 +1941,18 @@ class FFModel(object):
 
     num_samples = y.num_samples
     batch_size = self._ffconfig.batch_size
-    self._tracing_id += 1 # get a new tracing id
     for epoch in range(0,epochs):
       for d in dataloaders:
         d.reset()
       self.reset_metrics()
       iterations = num_samples / batch_size
       for iter in range(0, int(iterations)):
-        self._ffconfig.begin_trace(self._tracing_id)
         for d in dataloaders:
           d.next_batch(self)
         self.forward()
         self.zero_gradients()
         self.backward()
         self.update()
-        self._ffconfig.end_trace(self._tracing_id)
           
   def eval(self, x=None, y=None, batch_size=None):
     """Returns the loss value & metrics values for the model in test mode. 
@@ -1989,14 +1986,11 @@ class FFModel(object):
       d.reset()
     self.reset_metrics()
     iterations = num_samples / batch_size
-    self._tracing_id += 1 # get a new tracing id
     for iter in range(0, int(iterations)):
       for d in dataloaders:
         d.next_batch(self)
-      self._ffconfig.begin_trace(self._tracing_id)
       self.forward()
       self.compute_metrics()
-      self._ffconfig.end_trace(self._tracing_id)
 
   def zero_gradients(self):
     """Empty the gradients of all layers.
@@ -2321,6 +2315,43 @@ class SingleDataLoader(object):
     """
     ffc.flexflow_single_dataloader_reset(self.handle)
 
+class StreamingDataLoader(object):
+  __slots__ = ['handle', '_handle']
+  def __init__(self, ffmodel, input, dataset_path, data_type, shuffle_buffer_size=1, seed=0):
+    """Stream batches from a dataset stored as shard files, which are
+    memory-mapped and read one batch ahead instead of loaded into memory.
+
+    :param dataset_path: a directory of .npy or .bin shards, a .txt file listing the shards, or a single shard.
+    :type dataset_path: str
+
+    :param shuffle_buffer_size: the number of samples each partition shuffles at a time; 1 keeps the order of the shards.
+    :type shuffle_buffer_size: int
+    """
+    assert type(ffmodel) is FFModel, "StreamingDataLoader ffmodel is wrong"
+    assert type(input) is Tensor, "StreamingDataLoader input is wrong"
+    c_data_type = enum_to_int(DataType, data_type)
+    c_dataset_path = ffi.new("char[]", dataset_path.encode('utf-8'))
+    self.handle = ffc.flexflow_streaming_dataloader_create(ffmodel.handle, input.handle, c_dataset_path, c_data_type, shuffle_buffer_size, seed)
+    self._handle = ffi.gc(self.handle, ffc.flexflow_streaming_dataloader_destroy)
+
+  @property
+  def num_samples(self):
+    return ffc.flexflow_streaming_dataloader_get_num_samples(self.handle)
+
+  def next_batch(self, ffmodel):
+    """Ask the dataloder to load the next batch to the :attr:`batch_tensor`.
+
+    :returns:  None -- no returns.
+    """
+    ffc.flexflow_streaming_dataloader_next_batch(self.handle, ffmodel.handle)
+
+  def reset(self):
+    """Start a new epoch, in a new shuffled order.
+
+    :returns:  None -- no returns.
+    """
+    ffc.flexflow_streaming_dataloader_reset(self.handle)
+
 class RegionNdarray(object):
   __slots__ = ['__array_interface__']
   def __init__(self, shape, data_type, base_ptr, strides, read_only):
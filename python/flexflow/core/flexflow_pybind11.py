@@ -105,7 +105,6 @@ class FFModel(_FFModel):
 
     num_samples = y.num_samples
     batch_size = self._ffconfig.batch_size
-    self._tracing_id += 1 # get a new tracing id
     for epoch in range(0,epochs):
       for d in dataloaders:
         d.reset()
@@ -114,12 +113,10 @@ class FFModel(_FFModel):
       for iter in range(0, int(iterations)):
         for d in dataloaders:
           d.next_batch(self)
-        self._ffconfig.begin_trace(self._tracing_id)
         self.forward()
         self.zero_gradients()
         self.backward()
         self.update()
-        self._ffconfig.end_trace(self._tracing_id)
         
   def eval(self, x=None, y=None, batch_size=None):
     if (isinstance(x, list) == False):
@@ -134,14 +131,11 @@ class FFModel(_FFModel):
       d.reset()
     self.reset_metrics()
     iterations = num_samples / batch_size
-    self._tracing_id += 1 # get a new tracing id
     for iter in range(0, int(iterations)):
       for d in dataloaders:
         d.next_batch(self)
-      self._ffconfig.begin_trace(self._tracing_id)
       self.forward()
       self.compute_metrics()
-      self._ffconfig.end_trace(self._tracing_id)
       
   def create_data_loader_test(self, batch_tensor, full_array):
       full_array_shape = full_array.shape
@@ -383,7 +383,6 @@ class BaseModel(object):
     ts_start = self._ffconfig.get_current_time()
     epoch = 0
     epoch_flag = True
-    self.__tracing_id += 1
     while (epoch < epochs) and (epoch_flag == True):
       if callbacks != None:
         for callback in callbacks:
@@ -400,7 +399,6 @@ class BaseModel(object):
           for callback in callbacks:
             callback.on_batch_begin(iter)
 
-        self._ffconfig.begin_trace(self.__tracing_id)
         for dataloader in self._input_dataloaders:
           dataloader.next_batch(self._ffmodel)
         self._label_dataloader.next_batch(self._ffmodel)
@@ -414,7 +412,6 @@ class BaseModel(object):
           self._ffmodel.update()
         else:
           self._ffmodel.compute_metrics()
-        self._ffconfig.end_trace(self.__tracing_id)
 
         if callbacks != None:
           for callback in callbacks:
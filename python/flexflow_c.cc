@@ -55,6 +55,8 @@ public:
   FF_NEW_OPAQUE_WRAPPER(flexflow_net_config_t, NetConfig *);
   FF_NEW_OPAQUE_WRAPPER(flexflow_dlrm_config_t, DLRMConfig *);
   FF_NEW_OPAQUE_WRAPPER(flexflow_single_dataloader_t, SingleDataLoader *);
+  FF_NEW_OPAQUE_WRAPPER(flexflow_streaming_dataloader_t,
+                        StreamingDataLoader *);
 };
 
 Logger ffc_log("flexflow_c");
@@ -1668,6 +1670,60 @@ void flowflow_single_dataloader_next_batch(flexflow_single_dataloader_t handle_,
   handle->next_batch(*ffmodel);
 }
 
+// -----------------------------------------------------------------------
+// Streaming Dataloader
+// -----------------------------------------------------------------------
+
+flexflow_streaming_dataloader_t
+    flexflow_streaming_dataloader_create(flexflow_model_t ffmodel_,
+                                         flexflow_tensor_t input_,
+                                         char const *dataset_path,
+                                         enum DataType data_type,
+                                         size_t shuffle_buffer_size,
+                                         uint64_t seed) {
+  FFModel *ffmodel = FFCObjectWrapper::unwrap(ffmodel_);
+  Tensor input = FFCObjectWrapper::unwrap(input_);
+  assert(input->parallel_tensor != nullptr);
+  StreamingDataLoader *dataloader =
+      new StreamingDataLoader(*ffmodel,
+                              input->parallel_tensor,
+                              dataset_path,
+                              data_type,
+                              shuffle_buffer_size,
+                              seed);
+  DEBUG_PRINT("[StreamingDataLoader] new %p, path %s, samples %d",
+              dataloader,
+              dataset_path,
+              dataloader->num_samples);
+  return FFCObjectWrapper::wrap(dataloader);
+}
+
+void flexflow_streaming_dataloader_destroy(
+    flexflow_streaming_dataloader_t handle_) {
+  StreamingDataLoader *handle = FFCObjectWrapper::unwrap(handle_);
+  DEBUG_PRINT("[StreamingDataLoader] delete %p", handle);
+  delete handle;
+}
+
+int flexflow_streaming_dataloader_get_num_samples(
+    flexflow_streaming_dataloader_t handle_) {
+  StreamingDataLoader *handle = FFCObjectWrapper::unwrap(handle_);
+  return handle->num_samples;
+}
+
+void flexflow_streaming_dataloader_reset(
+    flexflow_streaming_dataloader_t handle_) {
+  StreamingDataLoader *handle = FFCObjectWrapper::unwrap(handle_);
+  handle->reset();
+}
+
+void flexflow_streaming_dataloader_next_batch(
+    flexflow_streaming_dataloader_t handle_, flexflow_model_t ffmodel_) {
+  StreamingDataLoader *handle = FFCObjectWrapper::unwrap(handle_);
+  FFModel *ffmodel = FFCObjectWrapper::unwrap(ffmodel_);
+  handle->next_batch(*ffmodel);
+}
+
 // -----------------------------------------------------------------------
 // Timer
 // -----------------------------------------------------------------------
@@ -1840,6 +1896,10 @@ void register_c_custom_tasks() {
   SingleDataLoader::register_cpu_tasks();
 
   SingleDataLoader::register_gpu_tasks();
+
+  StreamingDataLoader::register_cpu_tasks();
+
+  StreamingDataLoader::register_gpu_tasks();
 }
 
 static Context ctx;
@@ -47,6 +47,7 @@ FF_NEW_OPAQUE_TYPE(flexflow_dlrm_config_t);
 FF_NEW_OPAQUE_TYPE(flexflow_dataloader_4d_t);
 FF_NEW_OPAQUE_TYPE(flexflow_dataloader_2d_t);
 FF_NEW_OPAQUE_TYPE(flexflow_single_dataloader_t);
+FF_NEW_OPAQUE_TYPE(flexflow_streaming_dataloader_t);
 
 // -----------------------------------------------------------------------
 // FFConfig
@@ -634,6 +635,30 @@ void flexflow_single_dataloader_reset(flexflow_single_dataloader_t handle);
 void flowflow_single_dataloader_next_batch(flexflow_single_dataloader_t handle,
                                            flexflow_model_t ffmodel);
 
+// -----------------------------------------------------------------------
+// Streaming Dataloader
+// -----------------------------------------------------------------------
+
+flexflow_streaming_dataloader_t
+    flexflow_streaming_dataloader_create(flexflow_model_t ffmodel,
+                                         flexflow_tensor_t input,
+                                         char const *dataset_path,
+                                         enum DataType data_type,
+                                         size_t shuffle_buffer_size,
+                                         uint64_t seed);
+
+void flexflow_streaming_dataloader_destroy(
+    flexflow_streaming_dataloader_t handle);
+
+int flexflow_streaming_dataloader_get_num_samples(
+    flexflow_streaming_dataloader_t handle);
+
+void flexflow_streaming_dataloader_reset(
+    flexflow_streaming_dataloader_t handle);
+
+void flexflow_streaming_dataloader_next_batch(
+    flexflow_streaming_dataloader_t handle, flexflow_model_t ffmodel);
+
 // -----------------------------------------------------------------------
 // Timer
 // -----------------------------------------------------------------------
@@ -14,7 +14,11 @@
  */
 
 #include "flexflow_dataloader.h"
+#include <climits>
 #include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <sstream>
 #include <string>
 
@@ -534,6 +538,217 @@ void SingleDataLoader::register_gpu_tasks(void) {
   }
 }
 
+StreamingDataLoader::StreamingDataLoader(FFModel &ff,
+                                         ParallelTensor input,
+                                         std::string const &dataset_path_,
+                                         DataType datatype_,
+                                         size_t shuffle_buffer_size,
+                                         uint64_t seed)
+    : datatype(datatype_), batch_input(input), dataset_path(dataset_path_),
+      epoch(0), consumed_batches(0), restart(true), cur(0) {
+  Context ctx = ff.config.lg_ctx;
+  Runtime *runtime = ff.config.lg_hlr;
+  assert(dataset_path.size() <= MAX_DATASET_PATH_LEN);
+  assert(datatype == DT_FLOAT || datatype == DT_INT32 ||
+         datatype == DT_INT64);
+  assert(input->data_type == datatype);
+  // Currently assume that the leading dim of input is a replica dim of degree
+  // 1 and that only the sample dim is partitioned
+  int num_dims = input->num_dims;
+  assert(input->dims[num_dims - 1].is_replica_dim);
+  assert(input->dims[num_dims - 1].size == 1);
+  for (int i = 0; i < num_dims - 2; i++) {
+    assert(input->dims[i].degree == 1);
+  }
+  ParallelDim const &sample_dim = input->dims[num_dims - 2];
+  assert(sample_dim.size == ff.config.batchSize);
+  assert(sample_dim.size % sample_dim.degree == 0);
+  samples_per_part = sample_dim.size / sample_dim.degree;
+  assert(samples_per_part <= MAX_NUM_SAMPLES);
+  sample_bytes =
+      input->get_volume() / sample_dim.size * data_type_size(datatype);
+
+  // Only the shard headers are read here; the samples are read by the
+  // prefetch tasks
+  ShardedDataset dataset(ShardedDataset::list_shards(dataset_path),
+                         sample_bytes);
+  assert(dataset.sample_bytes() == sample_bytes);
+  assert(dataset.data_type() == DT_NONE || dataset.data_type() == datatype);
+  size_t min_batches = dataset.num_samples();
+  for (int part = 0; part < sample_dim.degree; part++) {
+    std::pair<size_t, size_t> range =
+        partition_samples(dataset.num_samples(), part, sample_dim.degree);
+    samplers.emplace_back(range.first, range.second, shuffle_buffer_size, seed);
+    size_t part_batches = (range.second - range.first) / samples_per_part;
+    min_batches = std::min(min_batches, part_batches);
+  }
+  assert(min_batches <= INT_MAX / sample_dim.size);
+  num_batches = min_batches;
+  assert(num_batches > 0);
+  num_samples = num_batches * sample_dim.size;
+
+  // The staging regions share the index space and partition of input
+  for (int i = 0; i < 2; i++) {
+    staging[i] = new ParallelTensorBase(*input);
+    staging[i]->region = runtime->create_logical_region(
+        ctx, input->region.get_index_space(), input->region.get_field_space());
+    staging[i]->part = runtime->get_logical_partition(
+        ctx, staging[i]->region, input->part.get_index_partition());
+    staging[i]->region_grad = LogicalRegion::NO_REGION;
+    staging[i]->part_grad = LogicalPartition::NO_PART;
+  }
+  reset();
+  next_batch(ff);
+}
+
+void StreamingDataLoader::reset() {
+  // The first batch of the next epoch is already being prefetched if the
+  // current epoch is over
+  if (consumed_batches > 0) {
+    restart = true;
+  }
+}
+
+void StreamingDataLoader::start_epoch() {
+  for (ShuffleBufferSampler &sampler : samplers) {
+    sampler.reset(epoch);
+  }
+  epoch++;
+  consumed_batches = 0;
+}
+
+void StreamingDataLoader::next_batch(FFModel &ff) {
+  Context ctx = ff.config.lg_ctx;
+  Runtime *runtime = ff.config.lg_hlr;
+  if (restart) {
+    // Overwrite the batch prefetched for the current epoch
+    start_epoch();
+    restart = false;
+    prefetch(ff, staging[cur]);
+  }
+  IndexLauncher launcher(PY_DL_LOAD_STAGED_BATCH_GPU_TASK_ID,
+                         batch_input->parallel_is,
+                         TaskArgument(&datatype, sizeof(DataType)),
+                         ArgumentMap(),
+                         Predicate::TRUE_PRED,
+                         false /*must*/,
+                         0 /*mapper_id*/,
+                         batch_input->machine_view.hash());
+  launcher.add_region_requirement(RegionRequirement(staging[cur]->part,
+                                                    0 /*projection id*/,
+                                                    READ_ONLY,
+                                                    EXCLUSIVE,
+                                                    staging[cur]->region,
+                                                    MAP_TO_ZC_MEMORY));
+  launcher.add_field(0, FID_DATA);
+  launcher.add_region_requirement(RegionRequirement(batch_input->part,
+                                                    0 /*projection id*/,
+                                                    WRITE_ONLY,
+                                                    EXCLUSIVE,
+                                                    batch_input->region));
+  launcher.add_field(1, FID_DATA);
+  runtime->execute_index_space(ctx, launcher);
+  consumed_batches++;
+  if (consumed_batches == num_batches) {
+    start_epoch();
+  }
+  // Only the staging region that is not read by the launch above is written,
+  // so reading the next batch overlaps with the current iteration
+  cur = 1 - cur;
+  prefetch(ff, staging[cur]);
+}
+
+void StreamingDataLoader::prefetch(FFModel &ff, ParallelTensor target) {
+  Context ctx = ff.config.lg_ctx;
+  Runtime *runtime = ff.config.lg_hlr;
+  StreamingLoadArgs args;
+  strcpy(args.dataset_path, dataset_path.c_str());
+  args.sample_bytes = sample_bytes;
+  args.data_type = datatype;
+  Domain domain = runtime->get_index_space_domain(ctx, target->parallel_is);
+  ArgumentMap argmap;
+  // The points of the index space enumerate the partitions of the sample dim
+  size_t part = 0;
+  for (Domain::DomainPointIterator it(domain); it; it++, part++) {
+    StreamingSampleIdxs meta;
+    meta.num_samples = samplers[part].next_batch(meta.idxs, samples_per_part);
+    assert(meta.num_samples == samples_per_part);
+    argmap.set_point(*it, TaskArgument(&meta, sizeof(StreamingSampleIdxs)));
+  }
+  assert(part == samplers.size());
+  IndexLauncher launcher(PY_DL_PREFETCH_BATCH_CPU_TASK_ID,
+                         target->parallel_is,
+                         TaskArgument(&args, sizeof(StreamingLoadArgs)),
+                         argmap,
+                         Predicate::TRUE_PRED,
+                         false /*must*/,
+                         0 /*mapper_id*/,
+                         target->machine_view.hash());
+  launcher.add_region_requirement(RegionRequirement(target->part,
+                                                    0 /*projection id*/,
+                                                    WRITE_ONLY,
+                                                    EXCLUSIVE,
+                                                    target->region,
+                                                    MAP_TO_ZC_MEMORY));
+  launcher.add_field(0, FID_DATA);
+  runtime->execute_index_space(ctx, launcher);
+}
+
+// Task body
+void StreamingDataLoader::prefetch_batch(
+    Task const *task,
+    std::vector<PhysicalRegion> const &regions,
+    Context ctx,
+    Runtime *runtime) {
+  assert(regions.size() == 1);
+  assert(task->regions.size() == regions.size());
+  StreamingLoadArgs const *args = (StreamingLoadArgs const *)task->args;
+  StreamingSampleIdxs const *meta =
+      (StreamingSampleIdxs const *)task->local_args;
+  // Each process maps the shards of a dataset once and keeps them mapped
+  static std::mutex mutex;
+  static std::map<std::string, std::unique_ptr<ShardedDataset>> datasets;
+  ShardedDataset const *dataset;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::unique_ptr<ShardedDataset> &it = datasets[args->dataset_path];
+    if (it == nullptr) {
+      it.reset(new ShardedDataset(
+          ShardedDataset::list_shards(args->dataset_path), args->sample_bytes));
+    }
+    dataset = it.get();
+  }
+  assert(dataset->sample_bytes() == args->sample_bytes);
+  GenericTensorAccessorW staged = helperGetGenericTensorAccessorWO(
+      args->data_type, regions[0], task->regions[0], FID_DATA, ctx, runtime);
+  assert(staged.domain.get_volume() * data_type_size(args->data_type) ==
+         meta->num_samples * args->sample_bytes);
+  dataset->will_need(meta->idxs, meta->num_samples);
+  dataset->gather(meta->idxs, meta->num_samples, staged.ptr);
+}
+
+void StreamingDataLoader::register_cpu_tasks(void) {
+  {
+    TaskVariantRegistrar registrar(PY_DL_PREFETCH_BATCH_CPU_TASK_ID,
+                                   "Prefetch Streamed Batch");
+    registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
+    registrar.set_leaf();
+    Runtime::preregister_task_variant<StreamingDataLoader::prefetch_batch>(
+        registrar, "Prefetch Streamed Batch Task");
+  }
+}
+
+void StreamingDataLoader::register_gpu_tasks(void) {
+  {
+    TaskVariantRegistrar registrar(PY_DL_LOAD_STAGED_BATCH_GPU_TASK_ID,
+                                   "Load Staged Batch");
+    registrar.add_constraint(ProcessorConstraint(Processor::TOC_PROC));
+    registrar.set_leaf();
+    Runtime::preregister_task_variant<StreamingDataLoader::load_staged_batch>(
+        registrar, "Load Staged Batch Task");
+  }
+}
+
 template void SingleDataLoader::next_batch_xd_launcher<2>(FFModel &ff,
                                                           int task_id);
 template void SingleDataLoader::next_batch_xd_launcher<4>(FFModel &ff,
@@ -83,3 +83,24 @@ template void SingleDataLoader::load_input<int64_t>(
     std::vector<PhysicalRegion> const &regions,
     Context ctx,
     Runtime *runtime);
+
+void StreamingDataLoader::load_staged_batch(
+    Task const *task,
+    std::vector<PhysicalRegion> const &regions,
+    Context ctx,
+    Runtime *runtime) {
+  assert(regions.size() == 2);
+  assert(task->regions.size() == 2);
+  DataType data_type = *((DataType const *)task->args);
+  GenericTensorAccessorR staged = helperGetGenericTensorAccessorRO(
+      data_type, regions[0], task->regions[0], FID_DATA, ctx, runtime);
+  GenericTensorAccessorW batch = helperGetGenericTensorAccessorWO(
+      data_type, regions[1], task->regions[1], FID_DATA, ctx, runtime);
+  assert(staged.domain.get_volume() == batch.domain.get_volume());
+  // The staged batch is in zero-copy memory
+  size_t bytes = batch.domain.get_volume() * data_type_size(data_type);
+  cudaStream_t stream;
+  checkCUDA(get_legion_stream(&stream));
+  checkCUDA(cudaMemcpyAsync(
+      batch.ptr, staged.ptr, bytes, cudaMemcpyHostToDevice, stream));
+}
@@ -17,6 +17,7 @@
 #define __FLEXFLOW_DATALOADER_H__
 
 #include "flexflow/model.h"
+#include "flexflow/sharded_dataset.h"
 
 struct NetConfig {
   NetConfig(void);
@@ -105,12 +106,83 @@ public:
   FlexFlow::ParallelTensor full_input, batch_input;
 };
 
+/**
+ * @brief Streams the batches of a dataset that may not fit in host memory from
+ * memory-mapped shard files (see FlexFlow::ShardedDataset).
+ *
+ * @details Each data-parallel partition of input reads its own contiguous
+ * range of samples, shuffled through a bounded buffer of shuffle_buffer_size
+ * samples. The batches are gathered by CPU tasks on the node of the GPU that
+ * consumes them into one of two zero-copy staging regions: while the GPUs
+ * train on one batch, the next one is being read into the other region.
+ * num_samples covers the full batches of an epoch; reset starts a new epoch,
+ * which reshuffles the samples.
+ */
+class StreamingDataLoader {
+public:
+  StreamingDataLoader(FlexFlow::FFModel &ff,
+                      FlexFlow::ParallelTensor input,
+                      std::string const &dataset_path,
+                      DataType datatype_,
+                      size_t shuffle_buffer_size,
+                      uint64_t seed);
+
+  void next_batch(FlexFlow::FFModel &);
+
+  void reset(void);
+
+  static void register_cpu_tasks(void);
+
+  static void register_gpu_tasks(void);
+
+  static void prefetch_batch(Legion::Task const *task,
+                             std::vector<Legion::PhysicalRegion> const &regions,
+                             Legion::Context ctx,
+                             Legion::Runtime *runtime);
+  static void
+      load_staged_batch(Legion::Task const *task,
+                        std::vector<Legion::PhysicalRegion> const &regions,
+                        Legion::Context ctx,
+                        Legion::Runtime *runtime);
+
+private:
+  void start_epoch(void);
+  void prefetch(FlexFlow::FFModel &ff, FlexFlow::ParallelTensor target);
+
+public:
+  int num_samples;
+  DataType datatype;
+  FlexFlow::ParallelTensor batch_input;
+
+private:
+  std::string dataset_path;
+  size_t sample_bytes, samples_per_part;
+  std::vector<FlexFlow::ShuffleBufferSampler> samplers;
+  int epoch, num_batches, consumed_batches;
+  bool restart;
+  // staging[cur] receives the next batch while staging[1 - cur] is read
+  FlexFlow::ParallelTensor staging[2];
+  int cur;
+};
+
 #define MAX_NUM_SAMPLES 4196
 struct SampleIdxs {
   int num_samples;
   int idxs[MAX_NUM_SAMPLES];
 };
 
+#define MAX_DATASET_PATH_LEN 1023
+struct StreamingLoadArgs {
+  char dataset_path[MAX_DATASET_PATH_LEN + 1];
+  size_t sample_bytes;
+  DataType data_type;
+};
+
+struct StreamingSampleIdxs {
+  size_t num_samples;
+  size_t idxs[MAX_NUM_SAMPLES];
+};
+
 struct IndexLoadArg {
   int num_samples;
   size_t size_per_sample;
@@ -153,8 +153,9 @@ FFMapper::FFMapper(MapperRuntime *rt,
   for (auto const &it : all_valid_views) {
     MachineView view = it;
     if (view.device_type == MachineView::GPU) {
-      // Registering views with different start_device_id;
-      for (int i = 0; i < total_nodes * gpus_per_node; i++) {
+      // Registering views at the start_device_ids that the search can
+      // place them on;
+      for (int i : get_machine_view_starts(view, total_nodes, gpus_per_node)) {
         view.start_device_id = i;
         machine_views[view.hash()] = view;
       }
@@ -214,8 +215,9 @@ void FFMapper::register_sharding_functor(Runtime *runtime,
   for (auto const &it : all_valid_views) {
     MachineView view = it;
     if (view.device_type == MachineView::GPU) {
-      // Registering views with different start_device_id;
-      for (int i = 0; i < num_nodes * gpus_per_node; i++) {
+      // Registering views at the start_device_ids that the search can
+      // place them on;
+      for (int i : get_machine_view_starts(view, num_nodes, gpus_per_node)) {
         view.start_device_id = i;
         FFShardingFunctor *functor = new FFShardingFunctor(
             gpus_per_node, cpus_per_node, num_nodes, view);
@@ -237,6 +239,7 @@ bool FFMapper::is_parameter_server_update_task(TaskID tid) {
   switch (tid) {
     case SGD_UPD_PS_TASK_ID:
     case ADAM_UPD_PS_TASK_ID:
+    case ADAGRAD_UPD_PS_TASK_ID:
       return true;
     default:
       return false;
@@ -380,6 +383,7 @@ void FFMapper::slice_task(const MapperContext ctx,
                           SliceTaskOutput &output) {
   output.slices.resize(input.domain.get_volume());
   std::vector<Processor> const *devices;
+  std::vector<Processor> gpu_cpus;
   MachineView view;
   if ((task.task_id == TOP_LEVEL_TASK_ID) ||
       ((task.task_id >= CUSTOM_CPU_TASK_ID_FIRST) &&
@@ -405,6 +409,24 @@ void FFMapper::slice_task(const MapperContext ctx,
            machine_views.end());
     view = machine_views[FFConfig::DataParallelism_GPU];
     devices = &all_cpus;
+  } else if (task.task_id == PY_DL_PREFETCH_BATCH_CPU_TASK_ID) {
+    // Use the GPU view of the batch, and run the prefetch for each GPU on a
+    // CPU of the same node, so that it fills zero-copy memory the GPU can read
+    assert(machine_views.find(task.tag) != machine_views.end());
+    view = machine_views[task.tag];
+    assert(view.device_type == MachineView::GPU);
+    std::map<AddressSpace, std::vector<Processor>> node_cpus;
+    for (Processor const &cpu : all_cpus) {
+      node_cpus[cpu.address_space()].push_back(cpu);
+    }
+    std::map<AddressSpace, size_t> num_node_gpus;
+    for (Processor const &gpu : all_gpus) {
+      std::vector<Processor> const &cpus = node_cpus[gpu.address_space()];
+      assert(cpus.size() > 0);
+      size_t idx = num_node_gpus[gpu.address_space()]++;
+      gpu_cpus.push_back(cpus[idx % cpus.size()]);
+    }
+    devices = &gpu_cpus;
   } else {
     MappingTagID hash = task.tag;
     // Make sure the task has a non-zero tag
@@ -14,188 +14,93 @@
  */
 
 #include "flexflow/ops/aggregate.h"
+#include "flexflow/ops/kernels/moe_dispatch_kernels.h"
 #include "flexflow/utils/cuda_helper.h"
 
 namespace FlexFlow {
 
+using namespace Kernels::MoeDispatch;
+
 __global__ void agg_forward_kernel(float **exp_preds,
                                    int const *exp_assign,
+                                   int const *slots,
                                    float const *gate_net_preds,
                                    float *output,
-                                   int n,
-                                   int const k,     // num chosen experts
-                                   int exp_samples, // max samples per expert
+                                   int const k, // num chosen experts
                                    int const batch_size,
                                    int out_dim) {
-  __shared__ float
-      *chosen_exp_preds[AGGREGATE_MAX_K * AGGREGATE_MAX_BATCH_SIZE];
-
-  // Get pred pointers, single thread pre block
-  if (threadIdx.x == 0) {
-    int expert_idx[AGGREGATE_MAX_N] = {0};
-    for (int i = 0; i < batch_size; i++) {
-      for (int j = 0; j < k; j++) {
-        // Get pointer to chosen expert predictions
-        int expert = exp_assign[i * k + j];
-        if (expert_idx[expert] >= exp_samples) {
-          // dropped sample
-          chosen_exp_preds[i * k + j] = 0;
-          continue;
-        }
-        chosen_exp_preds[i * k + j] =
-            exp_preds[expert] + expert_idx[expert] * out_dim;
-        expert_idx[expert]++;
-      }
-    }
-  }
-
-  // set output tensor to 0
+  // one thread per output element, which sums the weighted predictions of
+  // the experts of its token
   CUDA_KERNEL_LOOP(i, batch_size * out_dim) {
-    output[i] = 0.0f;
-  }
-
-  __syncthreads();
-
-  // compute output
-  CUDA_KERNEL_LOOP(i, k * out_dim * batch_size) {
-    if (chosen_exp_preds[i / out_dim] != 0) {
-      float res = gate_net_preds[i / out_dim] *
-                  chosen_exp_preds[i / out_dim][i % (out_dim)];
-      int out_id = (i / (k * out_dim)) * out_dim + (i % out_dim);
-      atomicAdd(output + out_id, res);
+    int token = i / out_dim, col = i % out_dim;
+    float res = 0.0f;
+    for (int j = 0; j < k; j++) {
+      int slot = slots[token * k + j];
+      if (slot >= 0) {
+        res += gate_net_preds[token * k + j] *
+               exp_preds[exp_assign[token * k + j]][slot * out_dim + col];
+      }
     }
+    output[i] = res;
   }
 }
 
-__device__ void agg_backward_kernel_gate(float const *output_grad,
-                                         float *full_gate_grads,
-                                         float **exp_preds,
-                                         int const *expert_assign,
-                                         bool const *cache_corr,
-                                         int *expert_bal,
-                                         float lambda_bal,
-                                         int batch_size,
-                                         int k,
-                                         int n,
-                                         int out_dim) {
-  // gate gradient
-  CUDA_KERNEL_LOOP(i, batch_size * k * out_dim) {
-    if (exp_preds[i / out_dim] != 0 && cache_corr[i / (k * out_dim)]) {
-      int out_id = (i / (k * out_dim)) * out_dim + (i % out_dim);
-      float res = output_grad[out_id] * exp_preds[i / out_dim][i % out_dim];
-
-      float *gate_grad_idx =
-          full_gate_grads + (i / (out_dim * k)) * n +
-          expert_assign[(i / (out_dim * k)) * k + (i / out_dim) % k];
-      atomicAdd(gate_grad_idx, res);
-    }
-  }
-
-  // balance term
-  CUDA_KERNEL_LOOP(i, n * batch_size) {
-    atomicAdd(full_gate_grads + i, lambda_bal * expert_bal[i % n]);
-  }
-
-  __syncthreads();
-
-  // make 0 mean
-  CUDA_KERNEL_LOOP(i, batch_size * n) {
-    int start = (i / n) * n;
-    float sub = -full_gate_grads[i] / n;
-    for (int j = 0; j < n; j++) {
-      atomicAdd(full_gate_grads + start + j, sub);
+// Whether the assignments of token match those of the forward pass
+__device__ bool agg_cache_correct(int const *exp_assign,
+                                  int const *true_exp_assign,
+                                  int k,
+                                  int token) {
+  for (int j = 0; j < k; j++) {
+    if (exp_assign[token * k + j] != true_exp_assign[token * k + j]) {
+      return false;
     }
   }
+  return true;
 }
 
-__device__ void agg_backward_kernel_exp(float const *output_grad,
+__global__ void agg_backward_kernel_exp(float const *output_grad,
                                         float const *gate_preds,
+                                        int const *true_exp_assign,
+                                        int const *slots,
                                         float **exp_grads,
                                         int batch_size,
                                         int k,
                                         int out_dim) {
-  // compute expert gradients
+  // compute expert gradients, every (expert, slot) row has a single writer
   CUDA_KERNEL_LOOP(i, k * out_dim * batch_size) {
-    if (exp_grads[i / out_dim] != 0) {
-      int out_id = (i / (k * out_dim)) * out_dim + (i % out_dim);
-      exp_grads[i / out_dim][i % out_dim] +=
-          gate_preds[i / out_dim] * output_grad[out_id];
+    int assignment = i / out_dim, col = i % out_dim;
+    int slot = slots[assignment];
+    if (slot >= 0) {
+      exp_grads[true_exp_assign[assignment]][slot * out_dim + col] +=
+          gate_preds[assignment] *
+          output_grad[(assignment / k) * out_dim + col];
     }
   }
 }
 
-__global__ void agg_backward_kernel(float **exp_preds,
-                                    float **exp_grads,
-                                    int const *exp_assign,
-                                    int const *true_exp_assign,
-                                    float const *gating_net_preds,
-                                    float *full_gating_grads,
-                                    float const *output_grads,
-                                    int n,           // num experts
-                                    int k,           // num chosen experts
-                                    int exp_samples, // max samples per expert
-                                    float lambda_bal,
-                                    int batch_size,
-                                    int out_dim) {
-  __shared__ float
-      *chosen_exp_preds[AGGREGATE_MAX_K * AGGREGATE_MAX_BATCH_SIZE];
-  __shared__ float
-      *chosen_exp_grads[AGGREGATE_MAX_K * AGGREGATE_MAX_BATCH_SIZE];
-  __shared__ int expert_bal[AGGREGATE_MAX_N];
-  __shared__ bool cache_corr[AGGREGATE_MAX_BATCH_SIZE];
-
-  // Get pred pointers, single thread per block
-  if (threadIdx.x == 0) {
-    // init arrays
-    for (int i = 0; i < n; i++) {
-      expert_bal[i] = 0;
-    }
-    for (int i = 0; i < batch_size; i++) {
-      cache_corr[i] = true;
-    }
-
-    // Get pointer to chosen expert predictions and expert counts
-    for (int i = 0; i < batch_size; i++) {
-      for (int j = 0; j < k; j++) {
-        int expert = true_exp_assign[k * i + j];
-        if (expert != exp_assign[k * i + j]) {
-          cache_corr[i] = false;
-        }
-        if (expert_bal[expert] >= exp_samples) {
-          // dropped sample
-          chosen_exp_preds[i * k + j] = 0;
-          chosen_exp_grads[i * k + j] = 0;
-          expert_bal[expert]++;
-          continue;
-        }
-        chosen_exp_preds[i * k + j] =
-            exp_preds[expert] + expert_bal[expert] * out_dim;
-        chosen_exp_grads[i * k + j] =
-            exp_grads[expert] + expert_bal[expert] * out_dim;
-        expert_bal[expert]++;
+__global__ void agg_backward_kernel_gate(float const *output_grad,
+                                         float *full_gate_grads,
+                                         float **exp_preds,
+                                         int const *exp_assign,
+                                         int const *true_exp_assign,
+                                         int const *slots,
+                                         int batch_size,
+                                         int k,
+                                         int n,
+                                         int out_dim) {
+  // gate gradient, one thread per assignment
+  CUDA_KERNEL_LOOP(i, batch_size * k) {
+    int token = i / k, slot = slots[i];
+    if (slot >= 0 &&
+        agg_cache_correct(exp_assign, true_exp_assign, k, token)) {
+      float const *pred = exp_preds[true_exp_assign[i]] + slot * out_dim;
+      float res = 0.0f;
+      for (int c = 0; c < out_dim; c++) {
+        res += output_grad[token * out_dim + c] * pred[c];
       }
+      atomicAdd(full_gate_grads + token * n + exp_assign[i], res);
     }
   }
-
-  __syncthreads();
-
-  // FIXME: These 2 functions could execute independently in parallel
-  // get expert gradients
-  agg_backward_kernel_exp(
-      output_grads, gating_net_preds, chosen_exp_grads, batch_size, k, out_dim);
-
-  // get gating net gradients
-  agg_backward_kernel_gate(output_grads,
-                           full_gating_grads,
-                           chosen_exp_preds,
-                           exp_assign,
-                           cache_corr,
-                           expert_bal,
-                           (lambda_bal * n) / batch_size,
-                           batch_size,
-                           k,
-                           n,
-                           out_dim);
 }
 
 /*static*/
@@ -225,16 +130,18 @@ void Aggregate::forward_kernel_wrapper(AggregateMeta const *m,
   cudaMemcpy(
       m->dev_exp_preds, exp_preds, n * sizeof(float *), cudaMemcpyHostToDevice);
 
-  agg_forward_kernel<<<GET_BLOCKS(batch_size * k * out_dim),
-                       min(CUDA_NUM_THREADS, (int)(batch_size * k * out_dim)),
+  DispatchBuffers buffers = get_dispatch_buffers(m, k * batch_size, n);
+  compute_expert_slots(
+      acc_gate_assign_ptr, k * batch_size, n, rows, buffers, stream);
+  agg_forward_kernel<<<GET_BLOCKS(batch_size * out_dim),
+                       min(CUDA_NUM_THREADS, (int)(batch_size * out_dim)),
                        0,
                        stream>>>(m->dev_exp_preds,
                                  acc_gate_assign_ptr,
+                                 buffers.slots,
                                  acc_gate_pred_ptr,
                                  acc_output_ptr,
-                                 n,
                                  k,
-                                 rows,
                                  batch_size,
                                  out_dim);
   if (m->profiling) {
@@ -245,6 +152,7 @@ void Aggregate::forward_kernel_wrapper(AggregateMeta const *m,
     cudaEventDestroy(t_start);
     cudaEventDestroy(t_end);
     printf("[Aggregate] forward time = %.2lfms\n", elapsed);
+    report_dropped("Aggregate", buffers, k * batch_size, n, rows, stream);
   }
 }
 
@@ -280,22 +188,41 @@ void Aggregate::backward_kernel_wrapper(AggregateMeta const *m,
   cudaMemcpy(
       m->dev_exp_grads, exp_grads, n * sizeof(float *), cudaMemcpyHostToDevice);
 
-  agg_backward_kernel<<<GET_BLOCKS(batch_size * k * out_dim),
-                        min(CUDA_NUM_THREADS, (int)(batch_size * k * out_dim)),
-                        0,
-                        stream>>>(m->dev_exp_preds,
-                                  m->dev_exp_grads,
-                                  acc_gate_assign_ptr,
-                                  acc_true_gate_assign_ptr,
-                                  acc_gate_pred_ptr,
-                                  full_acc_gate_grad_ptr,
-                                  acc_output_grad_ptr,
-                                  n,
-                                  k,
-                                  rows,
-                                  lambda_bal,
-                                  batch_size,
-                                  out_dim);
+  // the expert rows and counts are those of the true assignments
+  DispatchBuffers buffers = get_dispatch_buffers(m, k * batch_size, n);
+  compute_expert_slots(
+      acc_true_gate_assign_ptr, k * batch_size, n, rows, buffers, stream);
+  agg_backward_kernel_exp<<<GET_BLOCKS(batch_size * k * out_dim),
+                            min(CUDA_NUM_THREADS,
+                                (int)(batch_size * k * out_dim)),
+                            0,
+                            stream>>>(acc_output_grad_ptr,
+                                      acc_gate_pred_ptr,
+                                      acc_true_gate_assign_ptr,
+                                      buffers.slots,
+                                      m->dev_exp_grads,
+                                      batch_size,
+                                      k,
+                                      out_dim);
+  agg_backward_kernel_gate<<<GET_BLOCKS(batch_size * k),
+                             min(CUDA_NUM_THREADS, (int)(batch_size * k)),
+                             0,
+                             stream>>>(acc_output_grad_ptr,
+                                       full_acc_gate_grad_ptr,
+                                       m->dev_exp_preds,
+                                       acc_gate_assign_ptr,
+                                       acc_true_gate_assign_ptr,
+                                       buffers.slots,
+                                       batch_size,
+                                       k,
+                                       n,
+                                       out_dim);
+  balance_gate_grads(full_acc_gate_grad_ptr,
+                     buffers.expert_counts,
+                     n,
+                     lambda_bal,
+                     batch_size,
+                     stream);
   if (m->profiling) {
     cudaEventRecord(t_end, stream);
     checkCUDA(cudaEventSynchronize(t_end));
@@ -14,199 +14,97 @@
  */
 
 #include "flexflow/ops/aggregate_spec.h"
+#include "flexflow/ops/kernels/moe_dispatch_kernels.h"
 #include "flexflow/utils/cuda_helper.h"
 
 namespace FlexFlow {
 
-__global__ void
-    aggspec_forward_kernel(float **exp_preds,
-                           int const *exp_assign,
-                           float *output,
-                           int n,           // num experts
-                           int const k,     // num chosen experts
-                           int exp_samples, // max samples per expert
-                           int const batch_size,
-                           int out_dim) {
-  __shared__ float
-      *chosen_exp_preds[AGGREGATE_SPEC_MAX_K * AGGREGATE_SPEC_MAX_BATCH_SIZE];
+using namespace Kernels::MoeDispatch;
 
-  // Get pred pointers, single thread per block
-  if (threadIdx.x == 0) {
-    int expert_idx[AGGREGATE_SPEC_MAX_N] = {0};
-    for (int i = 0; i < batch_size; i++) {
-      for (int j = 0; j < k; j++) {
-        // Get pointer to chosen expert predictions
-        int expert = exp_assign[i * k + j];
-        if (expert_idx[expert] >= exp_samples) {
-          // dropped sample
-          chosen_exp_preds[i * k + j] = 0;
-          continue;
-        }
-        chosen_exp_preds[i * k + j] =
-            exp_preds[expert] + expert_idx[expert] * out_dim;
-        expert_idx[expert]++;
-      }
-    }
-  }
-
-  __syncthreads();
-
-  // compute output
+__global__ void aggspec_forward_kernel(float **exp_preds,
+                                       int const *exp_assign,
+                                       int const *slots,
+                                       float *output,
+                                       int const k, // num chosen experts
+                                       int const batch_size,
+                                       int out_dim) {
   CUDA_KERNEL_LOOP(i, k * batch_size * out_dim) {
-    if (chosen_exp_preds[i / out_dim] != 0) {
-      output[i] = chosen_exp_preds[i / out_dim][i % out_dim];
+    int assignment = i / out_dim;
+    int slot = slots[assignment];
+    if (slot >= 0) {
+      output[i] = exp_preds[exp_assign[assignment]][slot * out_dim +
+                                                    i % out_dim];
     } else {
       output[i] = 0.0f;
     }
   }
 }
 
-__device__ void aggspec_backward_kernel_gate(float const *output_grad,
-                                             float *full_gate_grads,
-                                             int const *expert_assign,
-                                             bool const *cache_corr,
-                                             float const *gate_pred,
-                                             int *expert_bal,
-                                             float lambda_bal,
-                                             int batch_size,
-                                             int k,
-                                             int n,
-                                             int out_dim) {
-
-  __shared__ float gate_grad_sum[AGGREGATE_SPEC_MAX_BATCH_SIZE];
-
-  // init gate_grad_sum to 0
-  CUDA_KERNEL_LOOP(i, batch_size) {
-    gate_grad_sum[i] = 0.0f;
-  }
-
-  __syncthreads();
-
-  // get sum of expert errors
-  /* NOTE: Errors just squared L2 norm of gradients. * batch_size because the
-  expert gradients are /= batch_size and then it would be /= batch_size^2 here
-*/
-  CUDA_KERNEL_LOOP(i, batch_size * k * out_dim) {
-    if (cache_corr[i / (k * out_dim)]) {
-      float res = output_grad[i] * output_grad[i] * batch_size;
-      float *gate_grad_idx =
-          full_gate_grads + (i / (out_dim * k)) * n +
-          expert_assign[(i / (out_dim * k)) * k + (i / out_dim) % k];
-      atomicAdd(gate_grad_idx, res);
-      atomicAdd(gate_grad_sum + i / (k * out_dim), res);
-    }
-  }
-
-  // Compute gate gradients:
-  // Assigned expert i, sample j: pred(i,j) - err_(i,j)/sum_l err(l,j)
-  __syncthreads();
-  CUDA_KERNEL_LOOP(i, k * batch_size) {
-    if (cache_corr[i / k]) {
-      full_gate_grads[i / k * n + expert_assign[i]] /= gate_grad_sum[i / k];
-      full_gate_grads[i / k * n + expert_assign[i]] -= (1.0f - gate_pred[i]);
-    }
-  }
-
-  // balance term
-  __syncthreads();
-  CUDA_KERNEL_LOOP(i, n * batch_size) {
-    full_gate_grads[i] += lambda_bal * expert_bal[i % n];
-  }
-
-  __syncthreads();
-
-  // make 0 mean
-  CUDA_KERNEL_LOOP(i, n * batch_size) {
-    int start = (i / n) * n;
-    float sub = -full_gate_grads[i] / n;
-    for (int j = 0; j < n; j++) {
-      atomicAdd(full_gate_grads + start + j, sub);
-    }
-  }
-}
-
-__device__ void aggspec_backward_kernel_exp(float const *output_grad,
+__global__ void aggspec_backward_kernel_exp(float const *output_grad,
                                             float const *gate_preds,
+                                            int const *true_exp_assign,
+                                            int const *slots,
                                             float **exp_grads,
                                             int batch_size,
                                             int k,
                                             int out_dim) {
-  // compute expert gradients
+  // compute expert gradients, every (expert, slot) row has a single writer
   CUDA_KERNEL_LOOP(i, k * out_dim * batch_size) {
-    if (exp_grads[i / out_dim] != 0) {
-      exp_grads[i / out_dim][i % out_dim] +=
-          gate_preds[i / out_dim] * output_grad[i];
+    int assignment = i / out_dim;
+    int slot = slots[assignment];
+    if (slot >= 0) {
+      exp_grads[true_exp_assign[assignment]][slot * out_dim + i % out_dim] +=
+          gate_preds[assignment] * output_grad[i];
     }
   }
 }
 
-__global__ void
-    aggspec_backward_kernel(float **exp_grads,
-                            int const *exp_assign,
-                            int const *true_exp_assign,
-                            float const *gating_net_preds,
-                            float *full_gating_grads,
-                            float const *output_grads,
-                            int n,           // num experts
-                            int k,           // num chosen experts
-                            int exp_samples, // max samples per expert
-                            float lambda_bal,
-                            int batch_size,
-                            int out_dim) {
-  __shared__ float
-      *chosen_exp_grads[AGGREGATE_SPEC_MAX_K * AGGREGATE_SPEC_MAX_BATCH_SIZE];
-  __shared__ int expert_bal[AGGREGATE_SPEC_MAX_N];
-  __shared__ bool cache_corr[AGGREGATE_SPEC_MAX_BATCH_SIZE];
+// The squared L2 norm of the output gradient of an assignment
+__device__ float aggspec_error(float const *output_grad,
+                               int assignment,
+                               int out_dim) {
+  float err = 0.0f;
+  for (int c = 0; c < out_dim; c++) {
+    float grad = output_grad[assignment * out_dim + c];
+    err += grad * grad;
+  }
+  return err;
+}
 
-  // Get pred pointers, single thread per block
-  if (threadIdx.x == 0) {
-    // init arrays
-    for (int i = 0; i < n; i++) {
-      expert_bal[i] = 0;
-    }
-    for (int i = 0; i < batch_size; i++) {
-      cache_corr[i] = true;
+__global__ void aggspec_backward_kernel_gate(float const *output_grad,
+                                             float *full_gate_grads,
+                                             int const *expert_assign,
+                                             int const *true_exp_assign,
+                                             float const *gate_pred,
+                                             int batch_size,
+                                             int k,
+                                             int n,
+                                             int out_dim) {
+  // one thread per token
+  CUDA_KERNEL_LOOP(b, batch_size) {
+    bool cache_corr = true;
+    for (int j = 0; j < k; j++) {
+      if (expert_assign[b * k + j] != true_exp_assign[b * k + j]) {
+        cache_corr = false;
+      }
     }
-
-    // Get pointer to chosen expert grads and expert counts
-    for (int i = 0; i < batch_size; i++) {
-      for (int j = 0; j < k; j++) {
-        int expert = true_exp_assign[k * i + j];
-        if (expert != exp_assign[k * i + j]) {
-          cache_corr[i] = false;
-        }
-        if (expert_bal[expert] >= exp_samples) {
-          // dropped sample
-          chosen_exp_grads[i * k + j] = 0;
-          expert_bal[expert]++;
-          continue;
-        }
-        chosen_exp_grads[i * k + j] =
-            exp_grads[expert] + expert_bal[expert] * out_dim;
-        expert_bal[expert]++;
+    if (cache_corr) {
+      /* NOTE: Errors just squared L2 norm of gradients. * batch_size because
+      the expert gradients are /= batch_size and then it would be /=
+      batch_size^2 here */
+      float err_sum = 0.0f;
+      for (int i = b * k; i < (b + 1) * k; i++) {
+        err_sum += aggspec_error(output_grad, i, out_dim) * batch_size;
+      }
+      // Compute gate gradients:
+      // Assigned expert i, sample j: pred(i,j) - err_(i,j)/sum_l err(l,j)
+      for (int i = b * k; i < (b + 1) * k; i++) {
+        float *grad = full_gate_grads + b * n + expert_assign[i];
+        float err = aggspec_error(output_grad, i, out_dim) * batch_size;
+        *grad = (*grad + err) / err_sum - (1.0f - gate_pred[i]);
       }
     }
   }
-
-  __syncthreads();
-
-  // NOTE: These 2 functions could execute independently in parallel
-  // get expert gradients
-  aggspec_backward_kernel_exp(
-      output_grads, gating_net_preds, chosen_exp_grads, batch_size, k, out_dim);
-
-  // get gating net gradients
-  aggspec_backward_kernel_gate(output_grads,
-                               full_gating_grads,
-                               exp_assign,
-                               cache_corr,
-                               gating_net_preds,
-                               expert_bal,
-                               (lambda_bal * n) / batch_size,
-                               batch_size,
-                               k,
-                               n,
-                               out_dim);
 }
 
 /*static*/
@@ -230,18 +128,23 @@ void AggregateSpec::forward_kernel_wrapper(AggregateSpecMeta const *m,
              n * sizeof(float *),
              cudaMemcpyHostToDevice);
 
+  DispatchBuffers buffers = get_dispatch_buffers(m, k * batch_size, n);
+  compute_expert_slots(
+      acc_gate_assign_ptr, k * batch_size, n, rows, buffers, stream);
   aggspec_forward_kernel<<<GET_BLOCKS(batch_size * k * out_dim),
                            min(CUDA_NUM_THREADS,
                                (int)(batch_size * k * out_dim)),
                            0,
                            stream>>>(m->dev_region_ptrs,
                                      acc_gate_assign_ptr,
+                                     buffers.slots,
                                      acc_output_ptr,
-                                     n,
                                      k,
-                                     rows,
                                      batch_size,
                                      out_dim);
+  if (m->profiling) {
+    report_dropped("AggregateSpec", buffers, k * batch_size, n, rows, stream);
+  }
 }
 
 /*static*/
@@ -269,22 +172,40 @@ void AggregateSpec::backward_kernel_wrapper(AggregateSpecMeta const *m,
              n * sizeof(float *),
              cudaMemcpyHostToDevice);
 
-  aggspec_backward_kernel<<<GET_BLOCKS(batch_size * k * out_dim),
-                            min(CUDA_NUM_THREADS,
-                                (int)(batch_size * k * out_dim)),
-                            0,
-                            stream>>>(m->dev_region_ptrs,
-                                      acc_gate_assign_ptr,
-                                      acc_true_gate_assign_ptr,
-                                      acc_gate_pred_ptr,
-                                      acc_full_gate_grad_ptr,
-                                      acc_output_grad_ptr,
-                                      n,
-                                      k,
-                                      rows,
-                                      lambda_bal,
-                                      batch_size,
-                                      out_dim);
+  // the expert rows and counts are those of the true assignments
+  DispatchBuffers buffers = get_dispatch_buffers(m, k * batch_size, n);
+  compute_expert_slots(
+      acc_true_gate_assign_ptr, k * batch_size, n, rows, buffers, stream);
+  aggspec_backward_kernel_exp<<<GET_BLOCKS(batch_size * k * out_dim),
+                                min(CUDA_NUM_THREADS,
+                                    (int)(batch_size * k * out_dim)),
+                                0,
+                                stream>>>(acc_output_grad_ptr,
+                                          acc_gate_pred_ptr,
+                                          acc_true_gate_assign_ptr,
+                                          buffers.slots,
+                                          m->dev_region_ptrs,
+                                          batch_size,
+                                          k,
+                                          out_dim);
+  aggspec_backward_kernel_gate<<<GET_BLOCKS(batch_size),
+                                 min(CUDA_NUM_THREADS, (int)batch_size),
+                                 0,
+                                 stream>>>(acc_output_grad_ptr,
+                                           acc_full_gate_grad_ptr,
+                                           acc_gate_assign_ptr,
+                                           acc_true_gate_assign_ptr,
+                                           acc_gate_pred_ptr,
+                                           batch_size,
+                                           k,
+                                           n,
+                                           out_dim);
+  balance_gate_grads(acc_full_gate_grad_ptr,
+                     buffers.expert_counts,
+                     n,
+                     lambda_bal,
+                     batch_size,
+                     stream);
 }
 
 AggregateSpecMeta::AggregateSpecMeta(FFHandler handler, int n)
@@ -15,8 +15,10 @@
 
 #include "flexflow/ops/embedding.h"
 #include "flexflow/model.h"
+#include "flexflow/ops/kernels/embedding_cpu_kernels.h"
 #include "flexflow/ops/kernels/embedding_kernels.h"
 #include "flexflow/utils/hash_utils.h"
+#include <thread>
 
 namespace FlexFlow {
 
@@ -28,8 +30,10 @@ using Legion::Domain;
 using Legion::FutureMap;
 using Legion::IndexLauncher;
 using Legion::InlineLauncher;
+using Legion::Machine;
 using Legion::PhysicalRegion;
 using Legion::Predicate;
+using Legion::Processor;
 using Legion::Rect;
 using Legion::RegionRequirement;
 using Legion::Runtime;
@@ -315,6 +319,9 @@ Embedding::Embedding(FFModel &model,
                                                      true /*create_grad*/,
                                                      weight_initializer,
                                                      CHOSEN_SYNC_TYPE);
+    if (model.config.host_embedding_tables) {
+      weights[0]->region_tag = MAP_TO_ZC_MEMORY;
+    }
   }
 
   outputs[0] = model.create_parallel_tensor_legion_ordering(
@@ -355,7 +362,8 @@ void Embedding::init(FFModel const &ff) {
                                                     0 /*projection*/,
                                                     READ_ONLY,
                                                     EXCLUSIVE,
-                                                    weights[0]->region));
+                                                    weights[0]->region,
+                                                    weights[0]->region_tag));
   launcher.add_field(1, FID_DATA);
   // regions[3]: input_grad
   launcher.add_region_requirement(RegionRequirement(inputs[0]->part_grad,
@@ -414,7 +422,8 @@ void Embedding::forward(FFModel const &ff) {
                                                     0 /*projection*/,
                                                     READ_ONLY,
                                                     EXCLUSIVE,
-                                                    weights[0]->region));
+                                                    weights[0]->region,
+                                                    weights[0]->region_tag));
   launcher.add_field(2, FID_DATA);
   runtime->execute_index_space(ctx, launcher);
 }
@@ -546,6 +555,10 @@ void Embedding::forward_task_with_type(
 #endif
 
 void Embedding::backward(FFModel const &ff) {
+  // The optimizer updates the table from the ids and the output gradient
+  if (ff.optimizer->sparse_gradients.count(weights[0]->region) > 0) {
+    return;
+  }
   ArgumentMap argmap;
   Context ctx = ff.config.lg_ctx;
   Runtime *runtime = ff.config.lg_hlr;
@@ -577,7 +590,8 @@ void Embedding::backward(FFModel const &ff) {
                                                     0 /*projection*/,
                                                     READ_WRITE,
                                                     EXCLUSIVE,
-                                                    weights[0]->region_grad));
+                                                    weights[0]->region_grad,
+                                                    weights[0]->region_tag));
   launcher.add_field(2, FID_DATA);
   runtime->execute_index_space(ctx, launcher);
 }
@@ -835,355 +849,119 @@ bool Embedding::measure_operator_cost(Simulator *sim,
   return true;
 }
 
-void EmbeddingLookup_int64_t_float_float__avx2_fma(int const block_size,
-                                                   int const output_size,
-                                                   int const index_size,
-                                                   int const data_size,
-                                                   float const *input,
-                                                   int64_t const *indices,
-                                                   int const *lengths,
-                                                   float const *weight,
-                                                   bool normalize_by_lengths,
-                                                   float *out) {
-#ifdef FF_USE_AVX2
-  const int64_t prefdist_T0 = 16;
-  if (block_size == 128) {
-    // unrolling 16 times
-    int64_t dataInd = 0;
-    for (int64_t rangeIndex = 0; rangeIndex < output_size; ++rangeIndex) {
-      float *op = &out[rangeIndex * block_size];
-      __m256 vop0 = _mm256_setzero_ps();
-      __m256 vop8 = _mm256_setzero_ps();
-      __m256 vop16 = _mm256_setzero_ps();
-      __m256 vop24 = _mm256_setzero_ps();
-      __m256 vop32 = _mm256_setzero_ps();
-      __m256 vop40 = _mm256_setzero_ps();
-      __m256 vop48 = _mm256_setzero_ps();
-      __m256 vop56 = _mm256_setzero_ps();
-      __m256 vop64 = _mm256_setzero_ps();
-      __m256 vop72 = _mm256_setzero_ps();
-      __m256 vop80 = _mm256_setzero_ps();
-      __m256 vop88 = _mm256_setzero_ps();
-      __m256 vop96 = _mm256_setzero_ps();
-      __m256 vop104 = _mm256_setzero_ps();
-      __m256 vop112 = _mm256_setzero_ps();
-      __m256 vop120 = _mm256_setzero_ps();
-      for (int64_t start = dataInd; dataInd < start + lengths[rangeIndex];
-           ++dataInd) {
-        const int64_t idx = indices[dataInd];
-        float wgt = 1.f;
-        if (weight) {
-          wgt = weight[dataInd];
-        }
-        __m256 vwgt = _mm256_set1_ps(wgt);
-        float const *ip = &input[idx * block_size];
-        const int64_t next_T0 = (dataInd < index_size - prefdist_T0)
-                                    ? (dataInd + prefdist_T0)
-                                    : dataInd;
-        const int64_t idx_pref_T0 = indices[next_T0];
-        assert(idx >= 0 && idx_pref_T0 >= 0 && idx < data_size &&
-               idx_pref_T0 < data_size);
-        float const *ip_next_T0 = &input[idx_pref_T0 * block_size];
-        vop0 = _mm256_fmadd_ps(vwgt, _mm256_loadu_ps(ip + (0)), vop0);
-        _mm_prefetch((&ip_next_T0[0]), _MM_HINT_T0);
-        vop8 = _mm256_fmadd_ps(vwgt, _mm256_loadu_ps(ip + (8)), vop8);
-        _mm_prefetch((&ip_next_T0[8]), _MM_HINT_T0);
-        vop16 = _mm256_fmadd_ps(vwgt, _mm256_loadu_ps(ip + (16)), vop16);
-        _mm_prefetch((&ip_next_T0[16]), _MM_HINT_T0);
-        vop24 = _mm256_fmadd_ps(vwgt, _mm256_loadu_ps(ip + (24)), vop24);
-        _mm_prefetch((&ip_next_T0[24]), _MM_HINT_T0);
-        vop32 = _mm256_fmadd_ps(vwgt, _mm256_loadu_ps(ip + (32)), vop32);
-        _mm_prefetch((&ip_next_T0[32]), _MM_HINT_T0);
-        vop40 = _mm256_fmadd_ps(vwgt, _mm256_loadu_ps(ip + (40)), vop40);
-        _mm_prefetch((&ip_next_T0[40]), _MM_HINT_T0);
-        vop48 = _mm256_fmadd_ps(vwgt, _mm256_loadu_ps(ip + (48)), vop48);
-        _mm_prefetch((&ip_next_T0[48]), _MM_HINT_T0);
-        vop56 = _mm256_fmadd_ps(vwgt, _mm256_loadu_ps(ip + (56)), vop56);
-        _mm_prefetch((&ip_next_T0[56]), _MM_HINT_T0);
-        vop64 = _mm256_fmadd_ps(vwgt, _mm256_loadu_ps(ip + (64)), vop64);
-        _mm_prefetch((&ip_next_T0[64]), _MM_HINT_T0);
-        vop72 = _mm256_fmadd_ps(vwgt, _mm256_loadu_ps(ip + (72)), vop72);
-        _mm_prefetch((&ip_next_T0[72]), _MM_HINT_T0);
-        vop80 = _mm256_fmadd_ps(vwgt, _mm256_loadu_ps(ip + (80)), vop80);
-        _mm_prefetch((&ip_next_T0[80]), _MM_HINT_T0);
-        vop88 = _mm256_fmadd_ps(vwgt, _mm256_loadu_ps(ip + (88)), vop88);
-        _mm_prefetch((&ip_next_T0[88]), _MM_HINT_T0);
-        vop96 = _mm256_fmadd_ps(vwgt, _mm256_loadu_ps(ip + (96)), vop96);
-        _mm_prefetch((&ip_next_T0[96]), _MM_HINT_T0);
-        vop104 = _mm256_fmadd_ps(vwgt, _mm256_loadu_ps(ip + (104)), vop104);
-        _mm_prefetch((&ip_next_T0[104]), _MM_HINT_T0);
-        vop112 = _mm256_fmadd_ps(vwgt, _mm256_loadu_ps(ip + (112)), vop112);
-        _mm_prefetch((&ip_next_T0[112]), _MM_HINT_T0);
-        vop120 = _mm256_fmadd_ps(vwgt, _mm256_loadu_ps(ip + (120)), vop120);
-        _mm_prefetch((&ip_next_T0[120]), _MM_HINT_T0);
-      }
-      if (normalize_by_lengths == false) {
-        _mm256_storeu_ps(&op[0], vop0);
-        _mm256_storeu_ps(&op[8], vop8);
-        _mm256_storeu_ps(&op[16], vop16);
-        _mm256_storeu_ps(&op[24], vop24);
-        _mm256_storeu_ps(&op[32], vop32);
-        _mm256_storeu_ps(&op[40], vop40);
-        _mm256_storeu_ps(&op[48], vop48);
-        _mm256_storeu_ps(&op[56], vop56);
-        _mm256_storeu_ps(&op[64], vop64);
-        _mm256_storeu_ps(&op[72], vop72);
-        _mm256_storeu_ps(&op[80], vop80);
-        _mm256_storeu_ps(&op[88], vop88);
-        _mm256_storeu_ps(&op[96], vop96);
-        _mm256_storeu_ps(&op[104], vop104);
-        _mm256_storeu_ps(&op[112], vop112);
-        _mm256_storeu_ps(&op[120], vop120);
-      } else if (lengths[rangeIndex]) {
-        __m256 vlen_inv = _mm256_set1_ps(1.0f / lengths[rangeIndex]);
-        _mm256_storeu_ps(&op[0], _mm256_mul_ps(vop0, vlen_inv));
-        _mm256_storeu_ps(&op[8], _mm256_mul_ps(vop8, vlen_inv));
-        _mm256_storeu_ps(&op[16], _mm256_mul_ps(vop16, vlen_inv));
-        _mm256_storeu_ps(&op[24], _mm256_mul_ps(vop24, vlen_inv));
-        _mm256_storeu_ps(&op[32], _mm256_mul_ps(vop32, vlen_inv));
-        _mm256_storeu_ps(&op[40], _mm256_mul_ps(vop40, vlen_inv));
-        _mm256_storeu_ps(&op[48], _mm256_mul_ps(vop48, vlen_inv));
-        _mm256_storeu_ps(&op[56], _mm256_mul_ps(vop56, vlen_inv));
-        _mm256_storeu_ps(&op[64], _mm256_mul_ps(vop64, vlen_inv));
-        _mm256_storeu_ps(&op[72], _mm256_mul_ps(vop72, vlen_inv));
-        _mm256_storeu_ps(&op[80], _mm256_mul_ps(vop80, vlen_inv));
-        _mm256_storeu_ps(&op[88], _mm256_mul_ps(vop88, vlen_inv));
-        _mm256_storeu_ps(&op[96], _mm256_mul_ps(vop96, vlen_inv));
-        _mm256_storeu_ps(&op[104], _mm256_mul_ps(vop104, vlen_inv));
-        _mm256_storeu_ps(&op[112], _mm256_mul_ps(vop112, vlen_inv));
-        _mm256_storeu_ps(&op[120], _mm256_mul_ps(vop120, vlen_inv));
-      }
-    }
-    __m256 vwgt = _mm256_set1_ps(wgt);
-    float const *ip = &input[idx * block_size];
-    const int64_t next_T0 = (dataInd < index_size - prefdist_T0)
-                                ? (dataInd + prefdist_T0)
-                                : dataInd;
-    const int64_t idx_pref_T0 = indices[next_T0];
-    assert(idx >= 0 && idx_pref_T0 >= 0 && idx < data_size &&
-           idx_pref_T0 < data_size);
-    float const *ip_next_T0 = &input[idx_pref_T0 * block_size];
-    vop0 = _mm256_fmadd_ps(vwgt, _mm256_loadu_ps(ip + (0)), vop0);
-    _mm_prefetch((&ip_next_T0[0]), _MM_HINT_T0);
-    vop8 = _mm256_fmadd_ps(vwgt, _mm256_loadu_ps(ip + (8)), vop8);
-    _mm_prefetch((&ip_next_T0[8]), _MM_HINT_T0);
-    vop16 = _mm256_fmadd_ps(vwgt, _mm256_loadu_ps(ip + (16)), vop16);
-    _mm_prefetch((&ip_next_T0[16]), _MM_HINT_T0);
-    vop24 = _mm256_fmadd_ps(vwgt, _mm256_loadu_ps(ip + (24)), vop24);
-    _mm_prefetch((&ip_next_T0[24]), _MM_HINT_T0);
-  }
-  if (normalize_by_lengths == false) {
-    _mm256_storeu_ps(&op[0], vop0);
-    _mm256_storeu_ps(&op[8], vop8);
-    _mm256_storeu_ps(&op[16], vop16);
-    _mm256_storeu_ps(&op[24], vop24);
-  } else if (lengths[rangeIndex]) {
-    __m256 vlen_inv = _mm256_set1_ps(1.0f / lengths[rangeIndex]);
-    _mm256_storeu_ps(&op[0], _mm256_mul_ps(vop0, vlen_inv));
-    _mm256_storeu_ps(&op[8], _mm256_mul_ps(vop8, vlen_inv));
-    _mm256_storeu_ps(&op[16], _mm256_mul_ps(vop16, vlen_inv));
-    _mm256_storeu_ps(&op[24], _mm256_mul_ps(vop24, vlen_inv));
-  }
-}
-}
-else {
-  // generic code
-  int64_t dataInd = 0;
-  for (int64_t rangeIndex = 0; rangeIndex < output_size; ++rangeIndex) {
-    float *op = &out[rangeIndex * block_size];
-    int j = 0;
-    for (; j + 8 <= block_size; j += 8) {
-      _mm256_storeu_ps(op + j, _mm256_setzero_ps());
-    }
-    for (; j < block_size; j++) {
-      op[j] = 0.0f;
-    }
-    for (int64_t start = dataInd; dataInd < start + lengths[rangeIndex];
-         ++dataInd) {
-      const int64_t idx = indices[dataInd];
-      float wgt = 1.f;
-      if (weight) {
-        wgt = weight[dataInd];
-      }
-      __m256 vwgt = _mm256_set1_ps(wgt);
-      float const *ip = &input[idx * block_size];
-      const int64_t next_T0 = (dataInd < index_size - prefdist_T0)
-                                  ? (dataInd + prefdist_T0)
-                                  : dataInd;
-      const int64_t idx_pref_T0 = indices[next_T0];
-      assert(idx >= 0 && idx_pref_T0 >= 0 && idx < data_size &&
-             idx_pref_T0 < data_size);
-      float const *ip_next_T0 = &input[idx_pref_T0 * block_size];
-      j = 0;
-      for (; j + 8 <= block_size; j += 8) {
-        _mm256_storeu_ps(&op[j],
-                         _mm256_fmadd_ps(vwgt,
-                                         _mm256_loadu_ps(&ip[j]),
-                                         _mm256_loadu_ps(&op[j])));
-        _mm_prefetch((&ip_next_T0[j]), _MM_HINT_T0);
-      }
-      for (; j < block_size; j++) {
-        op[j] += wgt * ip[j];
-      }
-    }
-    if (normalize_by_lengths && lengths[rangeIndex]) {
-      float len_inv = 1.0f / lengths[rangeIndex];
-      __m256 vlen_inv = _mm256_set1_ps(len_inv);
-      j = 0;
-      for (; j + 8 <= block_size; j += 8) {
-        _mm256_storeu_ps(&op[j],
-                         _mm256_mul_ps(_mm256_loadu_ps(&op[j]), vlen_inv));
-      }
-      for (; j < block_size; j++) {
-        op[j] = len_inv * op[j];
-      }
-    }
-  }
-}
-#else
-  assert(0);
-#endif
-}
-
-void embed_forward(int64_t const *input,
-                   int const *lengths,
-                   float *output,
-                   float const *embed,
-                   int block_size,
-                   int output_size,
-                   int index_size,
-                   int data_size) {
-  EmbeddingLookup_int64_t_float_float__avx2_fma(block_size,
-                                                output_size,
-                                                index_size,
-                                                data_size,
-                                                embed,
-                                                input,
-                                                lengths,
-                                                nullptr,
-                                                false,
-                                                output);
-}
-
-void embed_backward_generic(int64_t const *input,
-                            int const *lengths,
-                            float const *output,
-                            float *embed,
-                            int block_size,
-                            int output_size,
-                            int index_size,
-                            int data_size) {
-  // FIXME: Not functionaly correct.
-  for (int i = 0; i < output_size * block_size; i++) {
-    int idx = i / block_size;
-    int off = i % block_size;
-    int64_t wordIdx = input[idx];
-    // FIXME: Need to be atomic depending on the strategy
-    embed[wordIdx * block_size + off] += output[i];
-    ;
-  }
-}
-
-void embed_backward(int64_t const *input,
-                    int const *lengths,
-                    float const *output,
-                    float *embed,
-                    int block_size,
-                    int output_size,
-                    int index_size,
-                    int data_size) {
-  embed_backward_generic(input,
-                         lengths,
-                         output,
-                         embed,
-                         block_size,
-                         output_size,
-                         index_size,
-                         data_size);
+// Legion runs one task per CPU processor, so the threads of a node are
+// shared among its CPU processors
+static int get_num_cpu_threads() {
+  Machine machine = Machine::get_machine();
+  size_t num_procs = Machine::ProcessorQuery(machine)
+                         .only_kind(Processor::LOC_PROC)
+                         .local_address_space()
+                         .count();
+  size_t num_threads = std::thread::hardware_concurrency();
+  return std::max<size_t>(num_threads / std::max<size_t>(num_procs, 1), 1);
 }
 
+/*
+  regions[0](I): input
+  regions[1](O): output
+  regions[2](I): kernel
+*/
 void Embedding::forward_task_cpu(Task const *task,
                                  std::vector<PhysicalRegion> const &regions,
                                  Context ctx,
                                  Runtime *runtime) {
+  EmbeddingMeta const *m = *((EmbeddingMeta **)task->local_args);
   assert(regions.size() == 3);
   assert(task->regions.size() == 3);
-  // const Embedding* embed = (Embedding*) task->args;
-  AccessorRO<int64_t, 2> const acc_input(regions[0], FID_DATA);
-  AccessorWO<float, 2> const acc_output(regions[1], FID_DATA);
-  AccessorRO<float, 2> const acc_weight(regions[2], FID_DATA);
-  Rect<2> rect_input = runtime->get_index_space_domain(
-      ctx, task->regions[0].region.get_index_space());
-  Rect<2> rect_output = runtime->get_index_space_domain(
-      ctx, task->regions[1].region.get_index_space());
-  Rect<2> rect_weight = runtime->get_index_space_domain(
-      ctx, task->regions[2].region.get_index_space());
-  coord_t batch_size = rect_input.hi[1] - rect_input.lo[1] + 1;
-  // Input and output have same batch size
-  assert(batch_size == rect_output.hi[1] - rect_output.lo[1] + 1);
-  coord_t out_dim = rect_output.hi[0] - rect_output.lo[0] + 1;
-  // Weight and output have same out dim
-  assert(out_dim == rect_weight.hi[1] - rect_weight.lo[1] + 1);
-  // const int64_t* input = acc_input.ptr(rect_input);
-  // float* output = acc_output.ptr(rect_output);
-  // const float* weight = acc_weight.ptr(rect_weight);
-  int block_size = out_dim;
-  int output_size = batch_size;
-  int data_size = 1000000; // FIXME
-  // For now we are assuming the length is always 1
-  int index_size = rect_input.hi[1] - rect_input.lo[1] + 1;
-  coord_t in_dim = rect_input.hi[0] - rect_input.lo[0] + 1;
-  assert(in_dim == 1);
-  std::vector<int> lengths(output_size, 1);
-  embed_forward(acc_input.ptr(rect_input),
-                lengths.data(),
-                acc_output.ptr(rect_output),
-                acc_weight.ptr(rect_weight),
-                block_size,
-                output_size,
-                index_size,
-                data_size);
+  assert(m->weight_type[0] == DT_FLOAT && m->output_type[0] == DT_FLOAT);
+  assert(m->input_type[0] == DT_INT32 || m->input_type[0] == DT_INT64);
+  GenericTensorAccessorR input = helperGetGenericTensorAccessorRO(
+      m->input_type[0], regions[0], task->regions[0], FID_DATA, ctx, runtime);
+  GenericTensorAccessorW output = helperGetGenericTensorAccessorWO(
+      m->output_type[0], regions[1], task->regions[1], FID_DATA, ctx, runtime);
+  GenericTensorAccessorR kernel = helperGetGenericTensorAccessorRO(
+      m->weight_type[0], regions[2], task->regions[2], FID_DATA, ctx, runtime);
+  int in_dim = m->aggr == AGGR_MODE_NONE
+                   ? 1
+                   : input.domain.hi()[0] - input.domain.lo()[0] + 1;
+  int out_dim = output.domain.hi()[0] - output.domain.lo()[0] + 1;
+  int effective_batch_size = output.domain.get_volume() / out_dim;
+  assert(effective_batch_size * in_dim == input.domain.get_volume());
+  assert(kernel.domain.hi()[0] - kernel.domain.lo()[0] + 1 == out_dim);
+  int64_t num_entries = kernel.domain.get_volume() / out_dim;
+  if (m->input_type[0] == DT_INT32) {
+    cpu_forward_kernel(input.get_int32_ptr(),
+                       output.get_float_ptr(),
+                       kernel.get_float_ptr(),
+                       in_dim,
+                       out_dim,
+                       effective_batch_size,
+                       m->aggr,
+                       num_entries,
+                       get_num_cpu_threads());
+  } else {
+    cpu_forward_kernel(input.get_int64_ptr(),
+                       output.get_float_ptr(),
+                       kernel.get_float_ptr(),
+                       in_dim,
+                       out_dim,
+                       effective_batch_size,
+                       m->aggr,
+                       num_entries,
+                       get_num_cpu_threads());
+  }
 }
 
+/*
+  regions[0](I): input
+  regions[1](I): output_grad
+  regions[2](I/O): kernel_grad
+*/
 void Embedding::backward_task_cpu(Task const *task,
                                   std::vector<PhysicalRegion> const &regions,
                                   Context ctx,
                                   Runtime *runtime) {
+  EmbeddingMeta const *m = *((EmbeddingMeta **)task->local_args);
   assert(regions.size() == 3);
   assert(task->regions.size() == 3);
-  // const Embedding* embed = (Embedding*) task->args;
-  AccessorRO<int64_t, 2> const acc_input(regions[0], FID_DATA);
-  AccessorRO<float, 2> const acc_output(regions[1], FID_DATA);
-  AccessorRW<float, 2> const acc_weight(regions[2], FID_DATA);
-  Rect<2> rect_input = runtime->get_index_space_domain(
-      ctx, task->regions[0].region.get_index_space());
-  Rect<2> rect_output = runtime->get_index_space_domain(
-      ctx, task->regions[1].region.get_index_space());
-  Rect<2> rect_weight = runtime->get_index_space_domain(
-      ctx, task->regions[2].region.get_index_space());
-  coord_t batch_size = rect_input.hi[1] - rect_input.lo[1] + 1;
-  // Input and output have same batch size
-  assert(batch_size == rect_output.hi[1] - rect_output.lo[1] + 1);
-  // coord_t in_dim = rect_input.hi[0] - rect_input.lo[0] + 1;
-  coord_t out_dim = rect_output.hi[0] - rect_output.lo[0] + 1;
-  // Weight and output have same out dim
-  assert(out_dim == rect_weight.hi[1] - rect_weight.lo[1] + 1);
-  // const int64_t* input = acc_input.ptr(rect_input);
-  // const float* output = acc_output.ptr(rect_output);
-  // float* weight = acc_weight.ptr(rect_weight);
-  int block_size = out_dim;
-  int output_size = batch_size;
-  int index_size = rect_input.hi[1] - rect_input.lo[0] + 1;
-  int data_size = 1000000; // FIXME
-  std::vector<int> lengths(output_size, 1);
-  embed_backward(acc_input.ptr(rect_input),
-                 lengths.data(),
-                 acc_output.ptr(rect_output),
-                 acc_weight.ptr(rect_weight),
-                 block_size,
-                 output_size,
-                 index_size,
-                 data_size);
+  assert(m->weight_type[0] == DT_FLOAT && m->output_type[0] == DT_FLOAT);
+  assert(m->input_type[0] == DT_INT32 || m->input_type[0] == DT_INT64);
+  GenericTensorAccessorR input = helperGetGenericTensorAccessorRO(
+      m->input_type[0], regions[0], task->regions[0], FID_DATA, ctx, runtime);
+  GenericTensorAccessorR output_grad = helperGetGenericTensorAccessorRO(
+      m->output_type[0], regions[1], task->regions[1], FID_DATA, ctx, runtime);
+  GenericTensorAccessorW kernel_grad = helperGetGenericTensorAccessorRW(
+      m->weight_type[0], regions[2], task->regions[2], FID_DATA, ctx, runtime);
+  int in_dim = m->aggr == AGGR_MODE_NONE
+                   ? 1
+                   : input.domain.hi()[0] - input.domain.lo()[0] + 1;
+  int out_dim = output_grad.domain.hi()[0] - output_grad.domain.lo()[0] + 1;
+  int effective_batch_size = output_grad.domain.get_volume() / out_dim;
+  assert(effective_batch_size * in_dim == input.domain.get_volume());
+  assert(kernel_grad.domain.hi()[0] - kernel_grad.domain.lo()[0] + 1 ==
+         out_dim);
+  int64_t num_entries = kernel_grad.domain.get_volume() / out_dim;
+  if (m->input_type[0] == DT_INT32) {
+    cpu_backward_kernel(input.get_int32_ptr(),
+                        output_grad.get_float_ptr(),
+                        kernel_grad.get_float_ptr(),
+                        in_dim,
+                        out_dim,
+                        effective_batch_size,
+                        m->aggr,
+                        num_entries,
+                        get_num_cpu_threads());
+  } else {
+    cpu_backward_kernel(input.get_int64_ptr(),
+                        output_grad.get_float_ptr(),
+                        kernel_grad.get_float_ptr(),
+                        in_dim,
+                        out_dim,
+                        effective_batch_size,
+                        m->aggr,
+                        num_entries,
+                        get_num_cpu_threads());
+  }
 }
 
 EmbeddingMeta::EmbeddingMeta(FFHandler _handle, Op const *op)
@@ -0,0 +1,1333 @@
+/* Copyright 2023 CMU, Facebook, LANL, MIT, NVIDIA, and Stanford (alphabetical)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "flexflow/ops/experts.h"
+#include "flexflow/model.h"
+#include "flexflow/ops/kernels/moe_dispatch_kernels.h"
+#include "flexflow/utils/hash_utils.h"
+#include "legion/legion_utilities.h"
+
+namespace FlexFlow {
+
+// declare Legion names
+using Legion::ArgumentMap;
+using Legion::Context;
+using Legion::coord_t;
+using Legion::Domain;
+using Legion::FutureMap;
+using Legion::IndexLauncher;
+using Legion::LogicalRegion;
+using Legion::PhysicalRegion;
+using Legion::PointInRectIterator;
+using Legion::Predicate;
+using Legion::Rect;
+using Legion::RegionRequirement;
+using Legion::Runtime;
+using Legion::Task;
+using Legion::TaskArgument;
+using Legion::TaskLauncher;
+using PCG::Node;
+
+using namespace Kernels::MoeDispatch;
+
+static constexpr int KERNEL_IDX = 0;
+static constexpr int BIAS_IDX = 1;
+
+Tensor FFModel::experts(const Tensor input,
+                        const Tensor indices,
+                        const Tensor gate_preds,
+                        const Tensor full_gate_preds,
+                        int num_experts,
+                        int out_dim,
+                        float alpha,
+                        float lambda_bal,
+                        ActiMode activation,
+                        bool use_bias,
+                        char const *name) {
+  assert(indices->data_type == DT_INT32);
+  assert(indices->num_dims == gate_preds->num_dims);
+  assert(indices->dims[0] == gate_preds->dims[0]);
+  assert(full_gate_preds->num_dims == gate_preds->num_dims);
+  assert(full_gate_preds->dims[0] == num_experts);
+  Layer *li = new Layer(this,
+                        OP_EXPERTS,
+                        DT_FLOAT,
+                        name,
+                        4 /*inputs*/,
+                        use_bias ? 2 : 1 /*weights*/,
+                        1 /*outputs*/,
+                        input,
+                        indices,
+                        gate_preds,
+                        full_gate_preds);
+  {
+    int numdims = input->num_dims;
+    int dims[MAX_TENSOR_DIM];
+    for (int i = 0; i < numdims; i++) {
+      dims[i] = input->dims[i];
+    }
+    dims[0] = out_dim;
+    li->outputs[0] = create_tensor_legion_ordering(
+        numdims, dims, DT_FLOAT, li, 0, true /*create_grad*/);
+  }
+  {
+    int dims[2] = {input->dims[0] * out_dim, num_experts};
+    li->weights[KERNEL_IDX] =
+        create_weight_legion_ordering(2,
+                                      dims,
+                                      DT_FLOAT,
+                                      li,
+                                      true /*create_grad*/,
+                                      nullptr /*initializer*/,
+                                      CHOSEN_SYNC_TYPE);
+  }
+  if (use_bias) {
+    int dims[2] = {out_dim, num_experts};
+    li->weights[BIAS_IDX] =
+        create_weight_legion_ordering(2,
+                                      dims,
+                                      DT_FLOAT,
+                                      li,
+                                      true /*create_grad*/,
+                                      nullptr /*initializer*/,
+                                      CHOSEN_SYNC_TYPE);
+  }
+  li->add_int_property("num_experts", num_experts);
+  li->add_int_property("out_dim", out_dim);
+  li->add_float_property("alpha", alpha);
+  li->add_float_property("lambda_bal", lambda_bal);
+  li->add_int_property("activation", activation);
+  li->add_int_property("use_bias", use_bias);
+  layers.push_back(li);
+  return li->outputs[0];
+}
+
+Op *Experts::create_operator_from_layer(
+    FFModel &model,
+    Layer const *layer,
+    std::vector<ParallelTensor> const &inputs) {
+  long long value;
+  layer->get_int_property("num_experts", value);
+  int num_experts = value;
+  layer->get_int_property("out_dim", value);
+  int out_dim = value;
+  float alpha, lambda_bal;
+  layer->get_float_property("alpha", alpha);
+  layer->get_float_property("lambda_bal", lambda_bal);
+  layer->get_int_property("activation", value);
+  ActiMode activation = (ActiMode)value;
+  layer->get_int_property("use_bias", value);
+  bool use_bias = (bool)value;
+  return new Experts(model,
+                     layer->layer_guid,
+                     inputs[0],
+                     inputs[1],
+                     inputs[2],
+                     inputs[3],
+                     num_experts,
+                     out_dim,
+                     alpha,
+                     lambda_bal,
+                     activation,
+                     use_bias,
+                     false /*allocate_weights*/,
+                     layer->name);
+}
+
+ExpertsParams Experts::get_params() const {
+  ExpertsParams params;
+  params.layer_guid = this->layer_guid;
+  params.num_experts = this->num_experts;
+  params.out_dim = this->out_dim;
+  params.alpha = this->alpha;
+  params.lambda_bal = this->lambda_bal;
+  params.activation = this->activation;
+  params.use_bias = this->use_bias;
+  return params;
+}
+
+bool ExpertsParams::is_valid(std::tuple<ParallelTensorShape,
+                                        ParallelTensorShape,
+                                        ParallelTensorShape,
+                                        ParallelTensorShape> const &input)
+    const {
+  ParallelTensorShape const &data = std::get<0>(input);
+  ParallelTensorShape const &indices = std::get<1>(input);
+  ParallelTensorShape const &gate_preds = std::get<2>(input);
+  ParallelTensorShape const &full_gate_preds = std::get<3>(input);
+  if (!data.is_valid() || !indices.is_valid() || !gate_preds.is_valid() ||
+      !full_gate_preds.is_valid()) {
+    return false;
+  }
+  if (indices.data_type != DT_INT32) {
+    return false;
+  }
+  int num_dims = data.num_dims;
+  if (indices.num_dims != num_dims || gate_preds.num_dims != num_dims ||
+      full_gate_preds.num_dims != num_dims) {
+    return false;
+  }
+  // Every device needs all the channels of its tokens, all of their chosen
+  // experts and the gate values of all the experts
+  if (indices.dims[0].degree != 1 || !(indices.dims[0] == gate_preds.dims[0])) {
+    return false;
+  }
+  if (full_gate_preds.dims[0].size != this->num_experts ||
+      full_gate_preds.dims[0].degree != 1) {
+    return false;
+  }
+  for (int i = 1; i < num_dims; i++) {
+    if (!(indices.dims[i] == data.dims[i]) ||
+        !(gate_preds.dims[i] == data.dims[i]) ||
+        !(full_gate_preds.dims[i] == data.dims[i])) {
+      return false;
+    }
+  }
+  // Only the batch is split, and the experts are split evenly over its shards
+  for (int i = 0; i < num_dims; i++) {
+    if (i != num_dims - 2 && data.dims[i].degree != 1) {
+      return false;
+    }
+  }
+  return this->num_experts % data.dims[num_dims - 2].degree == 0;
+}
+
+bool operator==(ExpertsParams const &lhs, ExpertsParams const &rhs) {
+  return lhs.layer_guid == rhs.layer_guid &&
+         lhs.num_experts == rhs.num_experts && lhs.out_dim == rhs.out_dim &&
+         lhs.alpha == rhs.alpha && lhs.lambda_bal == rhs.lambda_bal &&
+         lhs.activation == rhs.activation && lhs.use_bias == rhs.use_bias;
+}
+
+Experts::Experts(FFModel &model,
+                 LayerID const &_layer_guid,
+                 const ParallelTensor _input,
+                 const ParallelTensor _indices,
+                 const ParallelTensor _gate_preds,
+                 const ParallelTensor _full_gate_preds,
+                 int _num_experts,
+                 int _out_dim,
+                 float _alpha,
+                 float _lambda_bal,
+                 ActiMode _activation,
+                 bool _use_bias,
+                 bool allocate_weights,
+                 char const *name)
+    : Op(model,
+         OP_EXPERTS,
+         DT_FLOAT,
+         name,
+         4 /*inputs*/,
+         _use_bias ? 2 : 1 /*weights*/,
+         allocate_weights,
+         1 /*outputs*/,
+         _input,
+         _indices,
+         _gate_preds,
+         _full_gate_preds),
+      num_experts(_num_experts), out_dim(_out_dim), alpha(_alpha),
+      lambda_bal(_lambda_bal), activation(_activation), use_bias(_use_bias),
+      expert_inputs(nullptr), expert_outputs(nullptr) {
+  // overwrite layer_guid
+  layer_guid = _layer_guid;
+  assert(num_experts > 0);
+  assert(activation != AC_MODE_GELU);
+  int num_dims = _input->num_dims;
+  int const BATCH = num_dims - 2;
+  int const REPLICA = num_dims - 1;
+  assert(_indices->num_dims == num_dims);
+  assert(_gate_preds->num_dims == num_dims);
+  assert(_full_gate_preds->num_dims == num_dims);
+  // Currently require no parallelism along the channels and experts, and
+  // only split the batch
+  assert(_indices->dims[0].degree == 1);
+  assert(_indices->dims[0] == _gate_preds->dims[0]);
+  assert(_full_gate_preds->dims[0].size == num_experts);
+  assert(_full_gate_preds->dims[0].degree == 1);
+  for (int i = 0; i < num_dims; i++) {
+    assert(i == BATCH || _input->dims[i].degree == 1);
+  }
+  for (int i = 1; i < num_dims; i++) {
+    assert(_indices->dims[i] == _input->dims[i]);
+    assert(_gate_preds->dims[i] == _input->dims[i]);
+    assert(_full_gate_preds->dims[i] == _input->dims[i]);
+  }
+  assert(num_experts % _input->dims[BATCH].degree == 0);
+  assert(num_experts <= MAX_NUM_EXPERTS);
+
+  ParallelDim output_dims[MAX_TENSOR_DIM];
+  for (int i = 0; i < num_dims; i++) {
+    output_dims[i] = _input->dims[i];
+  }
+  output_dims[0].size = out_dim;
+  output_dims[REPLICA].is_replica_dim = true;
+
+  // The experts of the kernel and bias are split along the batch dimension of
+  // the input, so that each device evaluates its own experts on the rows that
+  // every batch shard dispatched to them; the other dimensions of the input
+  // are not split, so the weights are not replicated
+  ParallelDim kernel_dims[MAX_TENSOR_DIM], bias_dims[MAX_TENSOR_DIM];
+  kernel_dims[0].size = _input->dims[0].size * out_dim;
+  kernel_dims[0].degree = 1;
+  kernel_dims[0].parallel_idx = -1;
+  bias_dims[0].size = out_dim;
+  bias_dims[0].degree = 1;
+  bias_dims[0].parallel_idx = -1;
+  for (ParallelDim *dims : {kernel_dims, bias_dims}) {
+    dims[1].size = num_experts;
+    for (int i = 2; i < num_dims; i++) {
+      dims[i].is_replica_dim = true;
+    }
+  }
+
+  for (int i = 1; i < num_dims; i++) {
+    this->register_output_parallel_dims(i, i);
+  }
+  for (int weight_idx : {KERNEL_IDX, BIAS_IDX}) {
+    this->register_weight_parallel_dims(BATCH, 1, 0, weight_idx);
+    for (int i = 1; i < BATCH; i++) {
+      this->register_weight_parallel_dims(i, i + 1, 0, weight_idx);
+    }
+    this->register_weight_parallel_dims(REPLICA, REPLICA, 0, weight_idx);
+  }
+  this->solve_parallel_dim_mappings(
+      {_input->dims}, {kernel_dims, bias_dims}, {output_dims});
+
+  if (allocate_weights) {
+    Initializer *kernel_initializer = new GlorotUniform(std::rand() /*seed*/);
+    weights[KERNEL_IDX] =
+        model.create_parallel_weight_legion_ordering(num_dims,
+                                                     kernel_dims,
+                                                     DT_FLOAT,
+                                                     NULL /*owner_op*/,
+                                                     true /*create_grad*/,
+                                                     kernel_initializer,
+                                                     CHOSEN_SYNC_TYPE);
+    if (use_bias) {
+      Initializer *bias_initializer = new ZeroInitializer();
+      weights[BIAS_IDX] =
+          model.create_parallel_weight_legion_ordering(num_dims,
+                                                       bias_dims,
+                                                       DT_FLOAT,
+                                                       NULL /*owner_op*/,
+                                                       true /*create_grad*/,
+                                                       bias_initializer,
+                                                       CHOSEN_SYNC_TYPE);
+    }
+  }
+
+  outputs[0] = model.create_parallel_tensor_legion_ordering(
+      num_dims, output_dims, DT_FLOAT, this);
+
+  assert(check_output_input_weight_parallel_dims(allocate_weights));
+}
+
+Experts::Experts(FFModel &model,
+                 ExpertsParams const &params,
+                 Input const &inputs,
+                 bool allocate_weights,
+                 char const *name)
+    : Experts(model,
+              params.layer_guid,
+              std::get<0>(inputs),
+              std::get<1>(inputs),
+              std::get<2>(inputs),
+              std::get<3>(inputs),
+              params.num_experts,
+              params.out_dim,
+              params.alpha,
+              params.lambda_bal,
+              params.activation,
+              params.use_bias,
+              allocate_weights,
+              name) {}
+
+void Experts::map_output_tensors(FFModel &ff) {
+  Op::map_output_tensors(ff);
+  destroy_expert_tensors(ff);
+  create_expert_tensors(ff);
+}
+
+void Experts::create_expert_tensors(FFModel &ff) {
+  ParallelTensor output = outputs[0];
+  int num_dims = output->num_dims;
+  ParallelDim const &batch = output->dims[num_dims - 2];
+  int num_shards = batch.degree;
+  int batch_size = 1;
+  for (int i = 1; i < num_dims - 1; i++) {
+    batch_size *= output->dims[i].size;
+  }
+  batch_size /= num_shards;
+  int k = inputs[1]->dims[0].size;
+  int capacity = expert_capacity(alpha, k, num_experts, batch_size);
+  // Each batch shard owns capacity rows of every expert
+  ParallelDim dims[3];
+  for (int i = 0; i < 3; i++) {
+    dims[i].degree = 1;
+    dims[i].parallel_idx = -1;
+  }
+  dims[0].size = inputs[0]->dims[0].size;
+  dims[1].size = capacity * num_shards;
+  dims[1].degree = num_shards;
+  dims[1].parallel_idx = batch.parallel_idx;
+  dims[2].size = num_experts;
+  // while the experts are split over the devices in the same order
+  ParallelDim expert_dims[3];
+  for (int i = 0; i < 3; i++) {
+    expert_dims[i] = dims[i];
+  }
+  expert_dims[1].degree = 1;
+  expert_dims[1].parallel_idx = -1;
+  expert_dims[2].degree = num_shards;
+  expert_dims[2].parallel_idx = batch.parallel_idx;
+
+  bool training = ff.config.computationMode == COMP_MODE_TRAINING;
+  expert_inputs = ff.create_parallel_tensor_legion_ordering(
+      3, dims, DT_FLOAT, this, -1 /*owner_idx*/, true /*create_grad*/);
+  expert_inputs->machine_view = output->machine_view;
+  ff.map_tensor(expert_inputs, this);
+  ff.create_disjoint_partition(3,
+                               expert_dims,
+                               output->parallel_is,
+                               expert_inputs->region,
+                               expert_inputs_lp);
+  if (training) {
+    ff.create_disjoint_partition(3,
+                                 expert_dims,
+                                 output->parallel_is,
+                                 expert_inputs->region_grad,
+                                 expert_inputs_grad_lp);
+  }
+
+  dims[0].size = out_dim;
+  expert_dims[0].size = out_dim;
+  expert_outputs = ff.create_parallel_tensor_legion_ordering(
+      3, dims, DT_FLOAT, this, -1 /*owner_idx*/, true /*create_grad*/);
+  expert_outputs->machine_view = output->machine_view;
+  ff.map_tensor(expert_outputs, this);
+  ff.create_disjoint_partition(3,
+                               expert_dims,
+                               output->parallel_is,
+                               expert_outputs->region,
+                               expert_outputs_lp);
+  if (training) {
+    ff.create_disjoint_partition(3,
+                                 expert_dims,
+                                 output->parallel_is,
+                                 expert_outputs->region_grad,
+                                 expert_outputs_grad_lp);
+  }
+  assert(expert_inputs->parallel_is == output->parallel_is);
+}
+
+void Experts::destroy_expert_tensors(FFModel &ff) {
+  Context ctx = ff.config.lg_ctx;
+  Runtime *runtime = ff.config.lg_hlr;
+  for (ParallelTensor tensor : {expert_inputs, expert_outputs}) {
+    if (tensor == nullptr) {
+      continue;
+    }
+    // Legion destroys them once the tasks still using them are done
+    runtime->destroy_logical_region(ctx, tensor->region);
+    if (tensor->region_grad != LogicalRegion::NO_REGION) {
+      runtime->destroy_logical_region(ctx, tensor->region_grad);
+    }
+    runtime->destroy_field_space(ctx, tensor->region.get_field_space());
+    runtime->destroy_index_space(ctx, tensor->region.get_index_space());
+    delete tensor;
+  }
+  expert_inputs = nullptr;
+  expert_outputs = nullptr;
+}
+
+void Experts::init(FFModel const &ff) {
+  assert(check_output_input_weight_same_parallel_is());
+  parallel_is = outputs[0]->parallel_is;
+  ArgumentMap argmap;
+  Context ctx = ff.config.lg_ctx;
+  Runtime *runtime = ff.config.lg_hlr;
+  set_argumentmap_for_init(ff, argmap);
+  IndexLauncher launcher(EXPERTS_INIT_TASK_ID,
+                         parallel_is,
+                         TaskArgument(this, sizeof(Experts)),
+                         argmap,
+                         Predicate::TRUE_PRED,
+                         false /*must*/,
+                         0 /*mapper_id*/,
+                         outputs[0]->machine_view.hash());
+  launcher.add_region_requirement(RegionRequirement(outputs[0]->part,
+                                                    0 /*projection id*/,
+                                                    WRITE_ONLY,
+                                                    EXCLUSIVE,
+                                                    outputs[0]->region));
+  launcher.add_field(0, FID_DATA);
+  FutureMap fm = runtime->execute_index_space(ctx, launcher);
+  fm.wait_all_results();
+  set_opmeta_from_futuremap(ff, fm);
+}
+
+OpMeta *Experts::init_task(Task const *task,
+                           std::vector<PhysicalRegion> const &regions,
+                           Context ctx,
+                           Runtime *runtime) {
+  Experts const *experts = (Experts *)task->args;
+  FFHandler handle = *((FFHandler const *)task->local_args);
+  ExpertsMeta *m = new ExpertsMeta(handle, experts);
+  m->profiling = experts->profiling;
+  return m;
+}
+
+void Experts::forward(FFModel const &ff) {
+  ArgumentMap argmap;
+  Context ctx = ff.config.lg_ctx;
+  Runtime *runtime = ff.config.lg_hlr;
+  set_argumentmap_for_forward(ff, argmap);
+  // Each batch shard dispatches its tokens to its rows of every expert
+  {
+    IndexLauncher launcher(EXPERTS_DISPATCH_TASK_ID,
+                           parallel_is,
+                           TaskArgument(NULL, 0),
+                           argmap,
+                           Predicate::TRUE_PRED,
+                           false /*must*/,
+                           0 /*mapper_id*/,
+                           outputs[0]->machine_view.hash());
+    for (int i = 0; i < 2; i++) {
+      launcher.add_region_requirement(RegionRequirement(inputs[i]->part,
+                                                        0 /*projection id*/,
+                                                        READ_ONLY,
+                                                        EXCLUSIVE,
+                                                        inputs[i]->region));
+      launcher.add_field(i, FID_DATA);
+    }
+    launcher.add_region_requirement(RegionRequirement(expert_inputs->part,
+                                                      0 /*projection id*/,
+                                                      WRITE_ONLY,
+                                                      EXCLUSIVE,
+                                                      expert_inputs->region));
+    launcher.add_field(2, FID_DATA);
+    runtime->execute_index_space(ctx, launcher);
+  }
+  // Each device evaluates its experts on the rows of all the shards, which
+  // Legion gathers from the dispatches (the all-to-all)
+  {
+    IndexLauncher launcher(EXPERTS_FWD_TASK_ID,
+                           parallel_is,
+                           TaskArgument(NULL, 0),
+                           argmap,
+                           Predicate::TRUE_PRED,
+                           false /*must*/,
+                           0 /*mapper_id*/,
+                           outputs[0]->machine_view.hash());
+    launcher.add_region_requirement(RegionRequirement(expert_inputs_lp,
+                                                      0 /*projection id*/,
+                                                      READ_ONLY,
+                                                      EXCLUSIVE,
+                                                      expert_inputs->region));
+    launcher.add_field(0, FID_DATA);
+    launcher.add_region_requirement(RegionRequirement(expert_outputs_lp,
+                                                      0 /*projection id*/,
+                                                      WRITE_ONLY,
+                                                      EXCLUSIVE,
+                                                      expert_outputs->region));
+    launcher.add_field(1, FID_DATA);
+    for (int i = 0; i < numWeights; i++) {
+      launcher.add_region_requirement(RegionRequirement(weights[i]->part,
+                                                        0 /*projection id*/,
+                                                        READ_ONLY,
+                                                        EXCLUSIVE,
+                                                        weights[i]->region));
+      launcher.add_field(2 + i, FID_DATA);
+    }
+    runtime->execute_index_space(ctx, launcher);
+  }
+  // Each batch shard combines the expert rows of its tokens
+  {
+    IndexLauncher launcher(EXPERTS_COMBINE_TASK_ID,
+                           parallel_is,
+                           TaskArgument(NULL, 0),
+                           argmap,
+                           Predicate::TRUE_PRED,
+                           false /*must*/,
+                           0 /*mapper_id*/,
+                           outputs[0]->machine_view.hash());
+    launcher.add_region_requirement(RegionRequirement(expert_outputs->part,
+                                                      0 /*projection id*/,
+                                                      READ_ONLY,
+                                                      EXCLUSIVE,
+                                                      expert_outputs->region));
+    launcher.add_field(0, FID_DATA);
+    for (int i = 1; i < 3; i++) {
+      launcher.add_region_requirement(RegionRequirement(inputs[i]->part,
+                                                        0 /*projection id*/,
+                                                        READ_ONLY,
+                                                        EXCLUSIVE,
+                                                        inputs[i]->region));
+      launcher.add_field(i, FID_DATA);
+    }
+    launcher.add_region_requirement(RegionRequirement(outputs[0]->part,
+                                                      0 /*projection id*/,
+                                                      WRITE_ONLY,
+                                                      EXCLUSIVE,
+                                                      outputs[0]->region));
+    launcher.add_field(3, FID_DATA);
+    runtime->execute_index_space(ctx, launcher);
+  }
+  if (ff.collect_runtime_stats) {
+    forward_load(ff);
+  }
+}
+
+void Experts::forward_load(FFModel const &ff) {
+  ArgumentMap argmap;
+  Context ctx = ff.config.lg_ctx;
+  Runtime *runtime = ff.config.lg_hlr;
+  set_argumentmap_for_forward(ff, argmap);
+  IndexLauncher launcher(EXPERTS_LOAD_TASK_ID,
+                         parallel_is,
+                         TaskArgument(NULL, 0),
+                         argmap,
+                         Predicate::TRUE_PRED,
+                         false /*must*/,
+                         0 /*mapper_id*/,
+                         outputs[0]->machine_view.hash());
+  launcher.add_region_requirement(RegionRequirement(inputs[1]->part,
+                                                    0 /*projection id*/,
+                                                    READ_ONLY,
+                                                    EXCLUSIVE,
+                                                    inputs[1]->region));
+  launcher.add_field(0, FID_DATA);
+  ParallelTensor kernel = weights[KERNEL_IDX];
+  launcher.add_region_requirement(RegionRequirement(
+      kernel->part, 0 /*projection id*/, READ_ONLY, EXCLUSIVE, kernel->region));
+  launcher.add_field(1, FID_DATA);
+  FutureMap fm = runtime->execute_index_space(ctx, launcher);
+  load_futures.clear();
+  Domain domain = runtime->get_index_space_domain(ctx, parallel_is);
+  switch (domain.get_dim()) {
+#define DIMFUNC(DIM)                                                           \
+  case DIM: {                                                                  \
+    Rect<DIM> rect = domain;                                                   \
+    for (PointInRectIterator<DIM> it(rect); it(); it++)                        \
+      load_futures.push_back(fm[*it]);                                         \
+    break;                                                                     \
+  }
+    LEGION_FOREACH_N(DIMFUNC)
+#undef DIMFUNC
+    default:
+      assert(false);
+  }
+}
+
+/*
+  regions[0](I): indices
+  regions[1](I): kernel
+*/
+ExpertsLoad Experts::load_task(Task const *task,
+                               std::vector<PhysicalRegion> const &regions,
+                               Context ctx,
+                               Runtime *runtime) {
+  ExpertsMeta const *m = *((ExpertsMeta **)task->local_args);
+  assert(regions.size() == 2);
+  assert(task->regions.size() == regions.size());
+  Domain indices_domain = runtime->get_index_space_domain(
+      ctx, task->regions[0].region.get_index_space());
+  Domain kernel_domain = runtime->get_index_space_domain(
+      ctx, task->regions[1].region.get_index_space());
+  int k = indices_domain.hi()[0] - indices_domain.lo()[0] + 1;
+  int batch_size = indices_domain.get_volume() / k;
+  int num_local = kernel_domain.hi()[1] - kernel_domain.lo()[1] + 1;
+  int num_shards = m->num_experts / num_local;
+  int const *indices_ptr = helperGetTensorPointerRO<int>(
+      regions[0], task->regions[0], FID_DATA, ctx, runtime);
+  ExpertsLoad load;
+  Experts::load_kernel_wrapper(m, indices_ptr, k, batch_size, load);
+  // The gradients of the outputs of the local experts, which take the work
+  // space besides the dispatch, grow linearly with the capacity
+  size_t per_slot = (size_t)num_local * num_shards * m->out_dim * sizeof(float);
+  load.max_capacity =
+      m->handle.workSpaceSize >=
+              dispatch_buffers_size(k * batch_size, m->num_experts)
+          ? (int)(m->handle.workSpaceSize / per_slot)
+          : 0;
+  return load;
+}
+
+void Experts::set_alpha(FFModel &ff, float _alpha) {
+  alpha = _alpha;
+  destroy_expert_tensors(ff);
+  create_expert_tensors(ff);
+  free_metas(ff);
+  init(ff);
+}
+
+/*
+  regions[0](I): input
+  regions[1](I): indices
+  regions[2](O): expert_inputs of this batch shard
+*/
+void Experts::dispatch_task(Task const *task,
+                            std::vector<PhysicalRegion> const &regions,
+                            Context ctx,
+                            Runtime *runtime) {
+  ExpertsMeta const *m = *((ExpertsMeta **)task->local_args);
+  assert(regions.size() == 3);
+  assert(task->regions.size() == regions.size());
+  Domain input_domain = runtime->get_index_space_domain(
+      ctx, task->regions[0].region.get_index_space());
+  Domain indices_domain = runtime->get_index_space_domain(
+      ctx, task->regions[1].region.get_index_space());
+  Domain x_domain = runtime->get_index_space_domain(
+      ctx, task->regions[2].region.get_index_space());
+  int data_dim = input_domain.hi()[0] - input_domain.lo()[0] + 1;
+  int batch_size = input_domain.get_volume() / data_dim;
+  int k = indices_domain.hi()[0] - indices_domain.lo()[0] + 1;
+  assert((int)indices_domain.get_volume() == k * batch_size);
+  int capacity = x_domain.hi()[1] - x_domain.lo()[1] + 1;
+  assert(x_domain.hi()[2] - x_domain.lo()[2] + 1 == m->num_experts);
+
+  float const *input_ptr = helperGetTensorPointerRO<float>(
+      regions[0], task->regions[0], FID_DATA, ctx, runtime);
+  int const *indices_ptr = helperGetTensorPointerRO<int>(
+      regions[1], task->regions[1], FID_DATA, ctx, runtime);
+  float *x_ptr = helperGetTensorPointerWO<float>(
+      regions[2], task->regions[2], FID_DATA, ctx, runtime);
+  Experts::dispatch_kernel_wrapper(
+      m, input_ptr, indices_ptr, x_ptr, k, capacity, batch_size, data_dim);
+}
+
+/*
+  regions[0](I): expert_inputs of the local experts
+  regions[1](O): expert_outputs of the local experts
+  regions[2](I): kernel
+  regions[3](I): bias (if use_bias)
+*/
+void Experts::forward_task(Task const *task,
+                           std::vector<PhysicalRegion> const &regions,
+                           Context ctx,
+                           Runtime *runtime) {
+  ExpertsMeta const *m = *((ExpertsMeta **)task->local_args);
+  assert(regions.size() == (m->use_bias ? 4 : 3));
+  assert(task->regions.size() == regions.size());
+  Domain x_domain = runtime->get_index_space_domain(
+      ctx, task->regions[0].region.get_index_space());
+  Domain kernel_domain = runtime->get_index_space_domain(
+      ctx, task->regions[2].region.get_index_space());
+  int data_dim = x_domain.hi()[0] - x_domain.lo()[0] + 1;
+  int num_rows = x_domain.hi()[1] - x_domain.lo()[1] + 1;
+  int num_local = x_domain.hi()[2] - x_domain.lo()[2] + 1;
+  assert(kernel_domain.hi()[0] - kernel_domain.lo()[0] + 1 ==
+         data_dim * m->out_dim);
+  assert(kernel_domain.hi()[1] - kernel_domain.lo()[1] + 1 == num_local);
+
+  float const *x_ptr = helperGetTensorPointerRO<float>(
+      regions[0], task->regions[0], FID_DATA, ctx, runtime);
+  float *y_ptr = helperGetTensorPointerWO<float>(
+      regions[1], task->regions[1], FID_DATA, ctx, runtime);
+  float const *kernel_ptr = helperGetTensorPointerRO<float>(
+      regions[2], task->regions[2], FID_DATA, ctx, runtime);
+  float const *bias_ptr = nullptr;
+  if (m->use_bias) {
+    bias_ptr = helperGetTensorPointerRO<float>(
+        regions[3], task->regions[3], FID_DATA, ctx, runtime);
+  }
+  Experts::forward_kernel_wrapper(
+      m, x_ptr, kernel_ptr, bias_ptr, y_ptr, num_local, num_rows, data_dim);
+}
+
+/*
+  regions[0](I): expert_outputs of this batch shard
+  regions[1](I): indices
+  regions[2](I): gate_preds
+  regions[3](O): output
+*/
+void Experts::combine_task(Task const *task,
+                           std::vector<PhysicalRegion> const &regions,
+                           Context ctx,
+                           Runtime *runtime) {
+  ExpertsMeta const *m = *((ExpertsMeta **)task->local_args);
+  assert(regions.size() == 4);
+  assert(task->regions.size() == regions.size());
+  Domain y_domain = runtime->get_index_space_domain(
+      ctx, task->regions[0].region.get_index_space());
+  Domain indices_domain = runtime->get_index_space_domain(
+      ctx, task->regions[1].region.get_index_space());
+  Domain output_domain = runtime->get_index_space_domain(
+      ctx, task->regions[3].region.get_index_space());
+  int batch_size = output_domain.get_volume() / m->out_dim;
+  int k = indices_domain.hi()[0] - indices_domain.lo()[0] + 1;
+  assert((int)indices_domain.get_volume() == k * batch_size);
+  int capacity = y_domain.hi()[1] - y_domain.lo()[1] + 1;
+
+  float const *y_ptr = helperGetTensorPointerRO<float>(
+      regions[0], task->regions[0], FID_DATA, ctx, runtime);
+  int const *indices_ptr = helperGetTensorPointerRO<int>(
+      regions[1], task->regions[1], FID_DATA, ctx, runtime);
+  float const *gate_ptr = helperGetTensorPointerRO<float>(
+      regions[2], task->regions[2], FID_DATA, ctx, runtime);
+  float *output_ptr = helperGetTensorPointerWO<float>(
+      regions[3], task->regions[3], FID_DATA, ctx, runtime);
+  Experts::combine_kernel_wrapper(
+      m, y_ptr, indices_ptr, gate_ptr, output_ptr, k, capacity, batch_size);
+}
+
+void Experts::backward(FFModel const &ff) {
+  ArgumentMap argmap;
+  Context ctx = ff.config.lg_ctx;
+  Runtime *runtime = ff.config.lg_hlr;
+  set_argumentmap_for_backward(ff, argmap);
+  // Each batch shard computes the gradients of its expert rows and gates
+  {
+    IndexLauncher launcher(EXPERTS_COMBINE_BWD_TASK_ID,
+                           parallel_is,
+                           TaskArgument(NULL, 0),
+                           argmap,
+                           Predicate::TRUE_PRED,
+                           false /*must*/,
+                           0 /*mapper_id*/,
+                           outputs[0]->machine_view.hash());
+    launcher.add_region_requirement(RegionRequirement(expert_outputs->part,
+                                                      0 /*projection id*/,
+                                                      READ_ONLY,
+                                                      EXCLUSIVE,
+                                                      expert_outputs->region));
+    launcher.add_field(0, FID_DATA);
+    for (int i = 1; i < 3; i++) {
+      launcher.add_region_requirement(RegionRequirement(inputs[i]->part,
+                                                        0 /*projection id*/,
+                                                        READ_ONLY,
+                                                        EXCLUSIVE,
+                                                        inputs[i]->region));
+      launcher.add_field(i, FID_DATA);
+    }
+    launcher.add_region_requirement(
+        RegionRequirement(outputs[0]->part_grad,
+                          0 /*projection id*/,
+                          READ_ONLY,
+                          EXCLUSIVE,
+                          outputs[0]->region_grad));
+    launcher.add_field(3, FID_DATA);
+    launcher.add_region_requirement(
+        RegionRequirement(expert_outputs->part_grad,
+                          0 /*projection id*/,
+                          WRITE_ONLY,
+                          EXCLUSIVE,
+                          expert_outputs->region_grad));
+    launcher.add_field(4, FID_DATA);
+    // As in Aggregate, the gate gradients go to the full gate values
+    launcher.add_region_requirement(
+        RegionRequirement(inputs[3]->part_grad,
+                          0 /*projection id*/,
+                          READ_WRITE,
+                          EXCLUSIVE,
+                          inputs[3]->region_grad));
+    launcher.add_field(5, FID_DATA);
+    runtime->execute_index_space(ctx, launcher);
+  }
+  // Each device back-propagates through its experts
+  {
+    IndexLauncher launcher(EXPERTS_BWD_TASK_ID,
+                           parallel_is,
+                           TaskArgument(NULL, 0),
+                           argmap,
+                           Predicate::TRUE_PRED,
+                           false /*must*/,
+                           0 /*mapper_id*/,
+                           outputs[0]->machine_view.hash());
+    launcher.add_region_requirement(RegionRequirement(expert_inputs_lp,
+                                                      0 /*projection id*/,
+                                                      READ_ONLY,
+                                                      EXCLUSIVE,
+                                                      expert_inputs->region));
+    launcher.add_field(0, FID_DATA);
+    launcher.add_region_requirement(RegionRequirement(expert_outputs_lp,
+                                                      0 /*projection id*/,
+                                                      READ_ONLY,
+                                                      EXCLUSIVE,
+                                                      expert_outputs->region));
+    launcher.add_field(1, FID_DATA);
+    launcher.add_region_requirement(
+        RegionRequirement(expert_outputs_grad_lp,
+                          0 /*projection id*/,
+                          READ_ONLY,
+                          EXCLUSIVE,
+                          expert_outputs->region_grad));
+    launcher.add_field(2, FID_DATA);
+    launcher.add_region_requirement(
+        RegionRequirement(expert_inputs_grad_lp,
+                          0 /*projection id*/,
+                          WRITE_ONLY,
+                          EXCLUSIVE,
+                          expert_inputs->region_grad));
+    launcher.add_field(3, FID_DATA);
+    // The weights to recompute the activations, then their gradients
+    for (int i = 0; i < numWeights; i++) {
+      launcher.add_region_requirement(RegionRequirement(weights[i]->part,
+                                                        0 /*projection id*/,
+                                                        READ_ONLY,
+                                                        EXCLUSIVE,
+                                                        weights[i]->region));
+      launcher.add_field(4 + i, FID_DATA);
+    }
+    for (int i = 0; i < numWeights; i++) {
+      launcher.add_region_requirement(
+          RegionRequirement(weights[i]->part_grad,
+                            0 /*projection id*/,
+                            READ_WRITE,
+                            EXCLUSIVE,
+                            weights[i]->region_grad));
+      launcher.add_field(4 + numWeights + i, FID_DATA);
+    }
+    runtime->execute_index_space(ctx, launcher);
+  }
+  // Each batch shard adds up the gradients of the rows of its tokens
+  {
+    IndexLauncher launcher(EXPERTS_DISPATCH_BWD_TASK_ID,
+                           parallel_is,
+                           TaskArgument(NULL, 0),
+                           argmap,
+                           Predicate::TRUE_PRED,
+                           false /*must*/,
+                           0 /*mapper_id*/,
+                           outputs[0]->machine_view.hash());
+    launcher.add_region_requirement(
+        RegionRequirement(expert_inputs->part_grad,
+                          0 /*projection id*/,
+                          READ_ONLY,
+                          EXCLUSIVE,
+                          expert_inputs->region_grad));
+    launcher.add_field(0, FID_DATA);
+    launcher.add_region_requirement(RegionRequirement(inputs[1]->part,
+                                                      0 /*projection id*/,
+                                                      READ_ONLY,
+                                                      EXCLUSIVE,
+                                                      inputs[1]->region));
+    launcher.add_field(1, FID_DATA);
+    launcher.add_region_requirement(
+        RegionRequirement(inputs[0]->part_grad,
+                          0 /*projection id*/,
+                          READ_WRITE,
+                          EXCLUSIVE,
+                          inputs[0]->region_grad));
+    launcher.add_field(2, FID_DATA);
+    runtime->execute_index_space(ctx, launcher);
+  }
+}
+
+/*
+  regions[0](I): expert_outputs of this batch shard
+  regions[1](I): indices
+  regions[2](I): gate_preds
+  regions[3](I): output_grad
+  regions[4](O): expert_outputs_grad of this batch shard
+  regions[5](I/O): full_gate_preds_grad
+*/
+void Experts::combine_backward_task(Task const *task,
+                                    std::vector<PhysicalRegion> const &regions,
+                                    Context ctx,
+                                    Runtime *runtime) {
+  ExpertsMeta const *m = *((ExpertsMeta **)task->local_args);
+  assert(regions.size() == 6);
+  assert(task->regions.size() == regions.size());
+  Domain y_domain = runtime->get_index_space_domain(
+      ctx, task->regions[0].region.get_index_space());
+  Domain indices_domain = runtime->get_index_space_domain(
+      ctx, task->regions[1].region.get_index_space());
+  Domain output_grad_domain = runtime->get_index_space_domain(
+      ctx, task->regions[3].region.get_index_space());
+  int batch_size = output_grad_domain.get_volume() / m->out_dim;
+  int k = indices_domain.hi()[0] - indices_domain.lo()[0] + 1;
+  assert((int)indices_domain.get_volume() == k * batch_size);
+  int capacity = y_domain.hi()[1] - y_domain.lo()[1] + 1;
+
+  float const *y_ptr = helperGetTensorPointerRO<float>(
+      regions[0], task->regions[0], FID_DATA, ctx, runtime);
+  int const *indices_ptr = helperGetTensorPointerRO<int>(
+      regions[1], task->regions[1], FID_DATA, ctx, runtime);
+  float const *gate_ptr = helperGetTensorPointerRO<float>(
+      regions[2], task->regions[2], FID_DATA, ctx, runtime);
+  float const *output_grad_ptr = helperGetTensorPointerRO<float>(
+      regions[3], task->regions[3], FID_DATA, ctx, runtime);
+  float *y_grad_ptr = helperGetTensorPointerWO<float>(
+      regions[4], task->regions[4], FID_DATA, ctx, runtime);
+  float *full_gate_grad_ptr = helperGetTensorPointerRW<float>(
+      regions[5], task->regions[5], FID_DATA, ctx, runtime);
+  Experts::combine_backward_kernel_wrapper(m,
+                                           y_ptr,
+                                           indices_ptr,
+                                           gate_ptr,
+                                           output_grad_ptr,
+                                           y_grad_ptr,
+                                           full_gate_grad_ptr,
+                                           k,
+                                           capacity,
+                                           batch_size);
+}
+
+/*
+  regions[0](I): expert_inputs of the local experts
+  regions[1](I): expert_outputs of the local experts
+  regions[2](I): expert_outputs_grad of the local experts
+  regions[3](O): expert_inputs_grad of the local experts
+  regions[4](I): kernel
+  regions[5](I): bias (if use_bias)
+  regions[5/6](I/O): kernel_grad
+  regions[7](I/O): bias_grad (if use_bias)
+*/
+void Experts::backward_task(Task const *task,
+                            std::vector<PhysicalRegion> const &regions,
+                            Context ctx,
+                            Runtime *runtime) {
+  ExpertsMeta const *m = *((ExpertsMeta **)task->local_args);
+  assert(regions.size() == (m->use_bias ? 8 : 6));
+  assert(task->regions.size() == regions.size());
+  Domain x_domain = runtime->get_index_space_domain(
+      ctx, task->regions[0].region.get_index_space());
+  int data_dim = x_domain.hi()[0] - x_domain.lo()[0] + 1;
+  int num_rows = x_domain.hi()[1] - x_domain.lo()[1] + 1;
+  int num_local = x_domain.hi()[2] - x_domain.lo()[2] + 1;
+
+  float const *x_ptr = helperGetTensorPointerRO<float>(
+      regions[0], task->regions[0], FID_DATA, ctx, runtime);
+  float const *y_ptr = helperGetTensorPointerRO<float>(
+      regions[1], task->regions[1], FID_DATA, ctx, runtime);
+  float const *y_grad_ptr = helperGetTensorPointerRO<float>(
+      regions[2], task->regions[2], FID_DATA, ctx, runtime);
+  float *x_grad_ptr = helperGetTensorPointerWO<float>(
+      regions[3], task->regions[3], FID_DATA, ctx, runtime);
+  float const *kernel_ptr = helperGetTensorPointerRO<float>(
+      regions[4], task->regions[4], FID_DATA, ctx, runtime);
+  float const *bias_ptr = nullptr;
+  float *kernel_grad_ptr = nullptr, *bias_grad_ptr = nullptr;
+  if (m->use_bias) {
+    bias_ptr = helperGetTensorPointerRO<float>(
+        regions[5], task->regions[5], FID_DATA, ctx, runtime);
+    kernel_grad_ptr = helperGetTensorPointerRW<float>(
+        regions[6], task->regions[6], FID_DATA, ctx, runtime);
+    bias_grad_ptr = helperGetTensorPointerRW<float>(
+        regions[7], task->regions[7], FID_DATA, ctx, runtime);
+  } else {
+    kernel_grad_ptr = helperGetTensorPointerRW<float>(
+        regions[5], task->regions[5], FID_DATA, ctx, runtime);
+  }
+  Experts::backward_kernel_wrapper(m,
+                                   x_ptr,
+                                   y_ptr,
+                                   y_grad_ptr,
+                                   x_grad_ptr,
+                                   kernel_ptr,
+                                   bias_ptr,
+                                   kernel_grad_ptr,
+                                   bias_grad_ptr,
+                                   num_local,
+                                   num_rows,
+                                   data_dim);
+}
+
+/*
+  regions[0](I): expert_inputs_grad of this batch shard
+  regions[1](I): indices
+  regions[2](I/O): input_grad
+*/
+void Experts::dispatch_backward_task(Task const *task,
+                                     std::vector<PhysicalRegion> const &regions,
+                                     Context ctx,
+                                     Runtime *runtime) {
+  ExpertsMeta const *m = *((ExpertsMeta **)task->local_args);
+  assert(regions.size() == 3);
+  assert(task->regions.size() == regions.size());
+  Domain x_grad_domain = runtime->get_index_space_domain(
+      ctx, task->regions[0].region.get_index_space());
+  Domain indices_domain = runtime->get_index_space_domain(
+      ctx, task->regions[1].region.get_index_space());
+  Domain input_grad_domain = runtime->get_index_space_domain(
+      ctx, task->regions[2].region.get_index_space());
+  int data_dim = input_grad_domain.hi()[0] - input_grad_domain.lo()[0] + 1;
+  int batch_size = input_grad_domain.get_volume() / data_dim;
+  int k = indices_domain.hi()[0] - indices_domain.lo()[0] + 1;
+  assert((int)indices_domain.get_volume() == k * batch_size);
+  int capacity = x_grad_domain.hi()[1] - x_grad_domain.lo()[1] + 1;
+
+  float const *x_grad_ptr = helperGetTensorPointerRO<float>(
+      regions[0], task->regions[0], FID_DATA, ctx, runtime);
+  int const *indices_ptr = helperGetTensorPointerRO<int>(
+      regions[1], task->regions[1], FID_DATA, ctx, runtime);
+  float *input_grad_ptr = helperGetTensorPointerRW<float>(
+      regions[2], task->regions[2], FID_DATA, ctx, runtime);
+  Experts::dispatch_backward_kernel_wrapper(m,
+                                            x_grad_ptr,
+                                            indices_ptr,
+                                            input_grad_ptr,
+                                            k,
+                                            capacity,
+                                            batch_size,
+                                            data_dim);
+}
+
+size_t Experts::workspace_size(int num_experts,
+                               int k,
+                               int batch_size,
+                               int num_local,
+                               int num_rows,
+                               int out_dim) {
+  // the dispatch of the batch shard, or the gradients of the outputs of the
+  // local experts before their activation, which are never needed together
+  return std::max(dispatch_buffers_size(k * batch_size, num_experts),
+                  (size_t)num_local * num_rows * out_dim * sizeof(float));
+}
+
+void Experts::serialize(Legion::Serializer &sez) const {
+  sez.serialize(this->layer_guid.id);
+  sez.serialize(this->num_experts);
+  sez.serialize(this->out_dim);
+  sez.serialize(this->alpha);
+  sez.serialize(this->lambda_bal);
+  sez.serialize(this->activation);
+  sez.serialize(this->use_bias);
+}
+
+Node Experts::deserialize(FFModel &ff,
+                          Legion::Deserializer &dez,
+                          ParallelTensor inputs[],
+                          int num_inputs) {
+  assert(num_inputs == 4);
+  size_t id;
+  int num_experts, out_dim;
+  float alpha, lambda_bal;
+  ActiMode activation;
+  bool use_bias;
+  dez.deserialize(id);
+  LayerID layer_guid(id);
+  dez.deserialize(num_experts);
+  dez.deserialize(out_dim);
+  dez.deserialize(alpha);
+  dez.deserialize(lambda_bal);
+  dez.deserialize(activation);
+  dez.deserialize(use_bias);
+
+  ExpertsParams params;
+  params.layer_guid = layer_guid;
+  params.num_experts = num_experts;
+  params.out_dim = out_dim;
+  params.alpha = alpha;
+  params.lambda_bal = lambda_bal;
+  params.activation = activation;
+  params.use_bias = use_bias;
+  return ff.get_or_create_node<Experts>(
+      {inputs[0], inputs[1], inputs[2], inputs[3]}, params);
+}
+
+Op *Experts::materialize(FFModel &ff,
+                         ParallelTensor inputs[],
+                         int num_inputs) const {
+  assert(num_inputs == 4);
+  return new Experts(ff,
+                     this->get_params(),
+                     {inputs[0], inputs[1], inputs[2], inputs[3]},
+                     true /*allocate_weights*/,
+                     this->name);
+}
+
+bool Experts::measure_operator_cost(Simulator *sim,
+                                    MachineView const &mv,
+                                    CostMetrics &cost_metrics) const {
+  ParallelTensorBase sub_input, sub_indices, sub_gate, sub_full_gate,
+      sub_output;
+  if (!inputs[0]->get_sub_tensor(mv, sub_input)) {
+    return false;
+  }
+  if (!inputs[1]->get_sub_tensor(mv, sub_indices)) {
+    return false;
+  }
+  if (!inputs[2]->get_sub_tensor(mv, sub_gate)) {
+    return false;
+  }
+  if (!inputs[3]->get_sub_tensor(mv, sub_full_gate)) {
+    return false;
+  }
+  if (!outputs[0]->get_sub_tensor(mv, sub_output)) {
+    return false;
+  }
+  int data_dim = sub_input.dims[0].size;
+  int batch_size = sub_input.get_volume() / data_dim;
+  int k = sub_indices.dims[0].size;
+  int num_shards = inputs[0]->dims[inputs[0]->num_dims - 2].degree;
+  int num_local = num_experts / num_shards;
+  int capacity = expert_capacity(alpha, k, num_experts, batch_size);
+  int num_rows = capacity * num_shards;
+  // The rows of a batch shard and those of the local experts have the same
+  // size, so one buffer stands for both
+  size_t x_volume = (size_t)num_local * num_rows * data_dim;
+  size_t y_volume = (size_t)num_local * num_rows * out_dim;
+  size_t kernel_volume = (size_t)num_local * data_dim * out_dim;
+  size_t bias_volume = use_bias ? (size_t)num_local * out_dim : 0;
+
+  if (workspace_size(num_experts, k, batch_size, num_local, num_rows, out_dim) >
+      sim->handler.workSpaceSize) {
+    cost_metrics.forward_time = Simulator::MAXIMUM_TASK_RUN_TIME;
+    cost_metrics.backward_time = Simulator::MAXIMUM_TASK_RUN_TIME;
+    return true;
+  }
+
+  ExpertsMeta *m = new ExpertsMeta(sim->handler, this);
+
+  // allocate tensors in simulator
+  sim->free_all();
+  float *input_ptr = (float *)sim->allocate(sub_input.get_volume(), DT_FLOAT);
+  int *indices_ptr =
+      (int *)sim->allocate(sub_indices.get_volume(), DT_INT32);
+  float *gate_ptr = (float *)sim->allocate(sub_gate.get_volume(), DT_FLOAT);
+  cost_metrics.inputs_memory += cost_metrics.total_mem_diff_from(sim->offset);
+
+  float *output_ptr = (float *)sim->allocate(sub_output.get_volume(), DT_FLOAT);
+  float *x_ptr = (float *)sim->allocate(x_volume, DT_FLOAT);
+  float *y_ptr = (float *)sim->allocate(y_volume, DT_FLOAT);
+  cost_metrics.outputs_memory += cost_metrics.total_mem_diff_from(sim->offset);
+
+  float *kernel_ptr = (float *)sim->allocate(kernel_volume, DT_FLOAT);
+  float *bias_ptr =
+      use_bias ? (float *)sim->allocate(bias_volume, DT_FLOAT) : nullptr;
+  cost_metrics.weights_memory += cost_metrics.total_mem_diff_from(sim->offset);
+
+  bool out_of_memory = !input_ptr || !indices_ptr || !gate_ptr ||
+                       !output_ptr || !x_ptr || !y_ptr || !kernel_ptr ||
+                       (use_bias && !bias_ptr);
+  if (out_of_memory) {
+    cost_metrics.forward_time = Simulator::MAXIMUM_TASK_RUN_TIME;
+    cost_metrics.backward_time = Simulator::MAXIMUM_TASK_RUN_TIME;
+    delete m;
+    return true;
+  }
+  // The experts receive their share of a balanced assignment
+  init_measure_indices(indices_ptr, k, batch_size, num_experts);
+
+  assert(m->profiling == false);
+
+  std::function<void()> forward, backward;
+  forward = [&] {
+    dispatch_kernel_wrapper(
+        m, input_ptr, indices_ptr, x_ptr, k, capacity, batch_size, data_dim);
+    forward_kernel_wrapper(
+        m, x_ptr, kernel_ptr, bias_ptr, y_ptr, num_local, num_rows, data_dim);
+    combine_kernel_wrapper(
+        m, y_ptr, indices_ptr, gate_ptr, output_ptr, k, capacity, batch_size);
+  };
+  if (sim->computationMode == COMP_MODE_TRAINING) {
+    float *input_grad_ptr =
+        (float *)sim->allocate(sub_input.get_volume(), DT_FLOAT);
+    float *full_gate_grad_ptr =
+        (float *)sim->allocate(sub_full_gate.get_volume(), DT_FLOAT);
+    cost_metrics.inputs_memory += cost_metrics.total_mem_diff_from(sim->offset);
+
+    float *output_grad_ptr =
+        (float *)sim->allocate(sub_output.get_volume(), DT_FLOAT);
+    float *x_grad_ptr = (float *)sim->allocate(x_volume, DT_FLOAT);
+    float *y_grad_ptr = (float *)sim->allocate(y_volume, DT_FLOAT);
+    cost_metrics.outputs_memory +=
+        cost_metrics.total_mem_diff_from(sim->offset);
+
+    float *kernel_grad_ptr = (float *)sim->allocate(kernel_volume, DT_FLOAT);
+    float *bias_grad_ptr =
+        use_bias ? (float *)sim->allocate(bias_volume, DT_FLOAT) : nullptr;
+    cost_metrics.weights_memory +=
+        cost_metrics.total_mem_diff_from(sim->offset);
+
+    if (!input_grad_ptr || !full_gate_grad_ptr || !output_grad_ptr ||
+        !x_grad_ptr || !y_grad_ptr || !kernel_grad_ptr ||
+        (use_bias && !bias_grad_ptr)) {
+      cost_metrics.forward_time = Simulator::MAXIMUM_TASK_RUN_TIME;
+      cost_metrics.backward_time = Simulator::MAXIMUM_TASK_RUN_TIME;
+      delete m;
+      return true;
+    }
+    backward = [&] {
+      combine_backward_kernel_wrapper(m,
+                                      y_ptr,
+                                      indices_ptr,
+                                      gate_ptr,
+                                      output_grad_ptr,
+                                      y_grad_ptr,
+                                      full_gate_grad_ptr,
+                                      k,
+                                      capacity,
+                                      batch_size);
+      backward_kernel_wrapper(m,
+                              x_ptr,
+                              y_ptr,
+                              y_grad_ptr,
+                              x_grad_ptr,
+                              kernel_ptr,
+                              bias_ptr,
+                              kernel_grad_ptr,
+                              bias_grad_ptr,
+                              num_local,
+                              num_rows,
+                              data_dim);
+      dispatch_backward_kernel_wrapper(m,
+                                       x_grad_ptr,
+                                       indices_ptr,
+                                       input_grad_ptr,
+                                       k,
+                                       capacity,
+                                       batch_size,
+                                       data_dim);
+    };
+  }
+
+  inner_measure_operator_cost(sim, forward, backward, cost_metrics);
+
+  // The all-to-all that moves the rows of each batch shard to the devices of
+  // their experts and the expert outputs back, in both passes
+  if (num_shards > 1) {
+    float xfer_time =
+        sim->estimate_all_to_all_xfer_cost(mv, x_volume * sizeof(float)) +
+        sim->estimate_all_to_all_xfer_cost(mv, y_volume * sizeof(float));
+    cost_metrics.forward_time += xfer_time;
+    if (sim->computationMode == COMP_MODE_TRAINING) {
+      cost_metrics.backward_time += xfer_time;
+    }
+  }
+
+  log_measure.debug("[Measure Experts] name(%s) batch(%d) k(%d) experts(%d "
+                    "of %d) capacity(%d) forward_time(%.4lf) "
+                    "backward_time(%.4lf)\n",
+                    name,
+                    batch_size,
+                    k,
+                    num_local,
+                    num_experts,
+                    capacity,
+                    cost_metrics.forward_time,
+                    cost_metrics.backward_time);
+  delete m;
+  return true;
+}
+
+}; // namespace FlexFlow
+
+namespace std {
+size_t hash<FlexFlow::ExpertsParams>::operator()(
+    FlexFlow::ExpertsParams const &params) const {
+  size_t key = 0;
+  hash_combine(key, params.layer_guid.id);
+  hash_combine(key, params.num_experts);
+  hash_combine(key, params.out_dim);
+  hash_combine(key, params.alpha);
+  hash_combine(key, params.lambda_bal);
+  hash_combine(key, params.activation);
+  hash_combine(key, params.use_bias);
+  return key;
+}
+}; // namespace std
@@ -0,0 +1,651 @@
+/* Copyright 2023 CMU, Facebook, LANL, MIT, NVIDIA, and Stanford (alphabetical)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "flexflow/ops/experts.h"
+#include "flexflow/ops/kernels/moe_dispatch_kernels.h"
+#include "flexflow/utils/cuda_helper.h"
+
+namespace FlexFlow {
+
+using namespace Kernels::MoeDispatch;
+
+__device__ float experts_activate(ActiMode activation, float x) {
+  switch (activation) {
+    case AC_MODE_RELU:
+      return x > 0.0f ? x : 0.0f;
+    case AC_MODE_SIGMOID:
+      return 1.0f / (1.0f + expf(-x));
+    case AC_MODE_TANH:
+      return tanhf(x);
+    default:
+      return x;
+  }
+}
+
+// The derivative of the activation, given its output y
+__device__ float experts_activation_grad(ActiMode activation, float y) {
+  switch (activation) {
+    case AC_MODE_RELU:
+      return y > 0.0f ? 1.0f : 0.0f;
+    case AC_MODE_SIGMOID:
+      return y * (1.0f - y);
+    case AC_MODE_TANH:
+      return 1.0f - y * y;
+    default:
+      return 1.0f;
+  }
+}
+
+// One thread per element of the kept assignments; x was zeroed before
+__global__ void experts_dispatch_kernel(float const *input,
+                                        int const *exp_assign,
+                                        int const *slots,
+                                        float *x,
+                                        int k,
+                                        int batch_size,
+                                        int capacity,
+                                        int data_dim) {
+  CUDA_KERNEL_LOOP(i, k * batch_size * data_dim) {
+    int assignment = i / data_dim, col = i % data_dim;
+    int slot = slots[assignment];
+    if (slot >= 0) {
+      x[(exp_assign[assignment] * capacity + slot) * data_dim + col] =
+          input[(assignment / k) * data_dim + col];
+    }
+  }
+}
+
+// One thread per input element, which adds up the gradients of the expert
+// rows its token was copied to
+__global__ void experts_dispatch_backward_kernel(float const *x_grad,
+                                                 int const *exp_assign,
+                                                 int const *slots,
+                                                 float *input_grad,
+                                                 int k,
+                                                 int batch_size,
+                                                 int capacity,
+                                                 int data_dim) {
+  CUDA_KERNEL_LOOP(i, batch_size * data_dim) {
+    int token = i / data_dim, col = i % data_dim;
+    float sum = 0.0f;
+    for (int j = 0; j < k; j++) {
+      int assignment = token * k + j;
+      int slot = slots[assignment];
+      if (slot >= 0) {
+        sum += x_grad[(exp_assign[assignment] * capacity + slot) * data_dim +
+                      col];
+      }
+    }
+    input_grad[i] += sum;
+  }
+}
+
+__global__ void experts_activation_kernel(float *y,
+                                          float const *bias,
+                                          ActiMode activation,
+                                          int num_rows,
+                                          int num_elements,
+                                          int out_dim) {
+  CUDA_KERNEL_LOOP(i, num_elements) {
+    float value = y[i];
+    if (bias != nullptr) {
+      int e = i / (num_rows * out_dim);
+      value += bias[e * out_dim + i % out_dim];
+    }
+    y[i] = experts_activate(activation, value);
+  }
+}
+
+// One thread per expert row, which normalizes the activations a of the row
+// into y = softmax(a)
+__global__ void experts_softmax_kernel(float *y, int num_rows, int out_dim) {
+  CUDA_KERNEL_LOOP(i, num_rows) {
+    float *row = y + (size_t)i * out_dim;
+    float max_value = row[0];
+    for (int c = 1; c < out_dim; c++) {
+      max_value = max(max_value, row[c]);
+    }
+    float sum = 0.0f;
+    for (int c = 0; c < out_dim; c++) {
+      row[c] = expf(row[c] - max_value);
+      sum += row[c];
+    }
+    for (int c = 0; c < out_dim; c++) {
+      row[c] /= sum;
+    }
+  }
+}
+
+// One thread per expert row, which overwrites the activations a of the row
+// with dZ = act'(a) * y * (dY - dot(dY, y)) for y = softmax(a)
+__global__ void experts_softmax_grad_kernel(float *a,
+                                            float const *y,
+                                            float const *y_grad,
+                                            ActiMode activation,
+                                            int num_rows,
+                                            int out_dim) {
+  CUDA_KERNEL_LOOP(i, num_rows) {
+    size_t offset = (size_t)i * out_dim;
+    float dot = 0.0f;
+    for (int c = 0; c < out_dim; c++) {
+      dot += y_grad[offset + c] * y[offset + c];
+    }
+    for (int c = 0; c < out_dim; c++) {
+      float a_grad = y[offset + c] * (y_grad[offset + c] - dot);
+      a[offset + c] =
+          a_grad * experts_activation_grad(activation, a[offset + c]);
+    }
+  }
+}
+
+// One thread per element of the bias gradients of the local experts
+__global__ void experts_bias_grad_kernel(float const *z_grad,
+                                         float *bias_grad,
+                                         int num_local,
+                                         int num_rows,
+                                         int out_dim) {
+  CUDA_KERNEL_LOOP(i, num_local * out_dim) {
+    int e = i / out_dim, col = i % out_dim;
+    float sum = 0.0f;
+    for (int r = 0; r < num_rows; r++) {
+      sum += z_grad[(e * num_rows + r) * out_dim + col];
+    }
+    bias_grad[i] += sum;
+  }
+}
+
+// One thread per output element, which adds up the gated outputs of the
+// experts its token was assigned to
+__global__ void experts_combine_kernel(float const *y,
+                                       int const *exp_assign,
+                                       int const *slots,
+                                       float const *gate_preds,
+                                       float *output,
+                                       int k,
+                                       int batch_size,
+                                       int capacity,
+                                       int out_dim) {
+  CUDA_KERNEL_LOOP(i, batch_size * out_dim) {
+    int token = i / out_dim, col = i % out_dim;
+    float sum = 0.0f;
+    for (int j = 0; j < k; j++) {
+      int assignment = token * k + j;
+      int slot = slots[assignment];
+      if (slot >= 0) {
+        sum += gate_preds[assignment] *
+               y[(exp_assign[assignment] * capacity + slot) * out_dim + col];
+      }
+    }
+    output[i] = sum;
+  }
+}
+
+// One thread per element of the kept assignments; y_grad was zeroed before
+__global__ void experts_combine_backward_kernel(int const *exp_assign,
+                                                int const *slots,
+                                                float const *gate_preds,
+                                                float const *output_grad,
+                                                float *y_grad,
+                                                int k,
+                                                int batch_size,
+                                                int capacity,
+                                                int out_dim) {
+  CUDA_KERNEL_LOOP(i, k * batch_size * out_dim) {
+    int assignment = i / out_dim, col = i % out_dim;
+    int slot = slots[assignment];
+    if (slot >= 0) {
+      y_grad[(exp_assign[assignment] * capacity + slot) * out_dim + col] =
+          gate_preds[assignment] *
+          output_grad[(assignment / k) * out_dim + col];
+    }
+  }
+}
+
+// One thread per assignment, see cpu_experts_combine_backward
+__global__ void experts_gate_grad_kernel(float const *y,
+                                         int const *exp_assign,
+                                         int const *slots,
+                                         float const *output_grad,
+                                         float *full_gate_grads,
+                                         int k,
+                                         int n,
+                                         int batch_size,
+                                         int capacity,
+                                         int out_dim) {
+  CUDA_KERNEL_LOOP(i, k * batch_size) {
+    if (slots[i] >= 0) {
+      float const *row = y + (exp_assign[i] * capacity + slots[i]) * out_dim;
+      float const *token_grad = output_grad + (i / k) * out_dim;
+      float grad = 0.0f;
+      for (int c = 0; c < out_dim; c++) {
+        grad += token_grad[c] * row[c];
+      }
+      atomicAdd(full_gate_grads + (i / k) * n + exp_assign[i], grad);
+    }
+  }
+}
+
+__global__ void experts_measure_indices_kernel(int *indices,
+                                               int num_assignments,
+                                               int num_experts) {
+  CUDA_KERNEL_LOOP(i, num_assignments) {
+    indices[i] = i % num_experts;
+  }
+}
+
+static void start_profiling(ExpertsMeta const *m,
+                            cudaEvent_t &t_start,
+                            cudaEvent_t &t_end,
+                            cudaStream_t stream) {
+  if (m->profiling) {
+    cudaEventCreate(&t_start);
+    cudaEventCreate(&t_end);
+    cudaEventRecord(t_start, stream);
+  }
+}
+
+static void stop_profiling(ExpertsMeta const *m,
+                           char const *phase,
+                           cudaEvent_t t_start,
+                           cudaEvent_t t_end,
+                           cudaStream_t stream) {
+  if (m->profiling) {
+    cudaEventRecord(t_end, stream);
+    checkCUDA(cudaEventSynchronize(t_end));
+    float elapsed = 0;
+    checkCUDA(cudaEventElapsedTime(&elapsed, t_start, t_end));
+    cudaEventDestroy(t_start);
+    cudaEventDestroy(t_end);
+    printf("[Experts] %s time = %.2lfms\n", phase, elapsed);
+  }
+}
+
+/*static*/
+void Experts::dispatch_kernel_wrapper(ExpertsMeta const *m,
+                                      float const *input,
+                                      int const *indices,
+                                      float *x,
+                                      int k,
+                                      int capacity,
+                                      int batch_size,
+                                      int data_dim) {
+  cudaStream_t stream;
+  checkCUDA(get_legion_stream(&stream));
+  cudaEvent_t t_start, t_end;
+  start_profiling(m, t_start, t_end, stream);
+  int num_assignments = k * batch_size;
+  DispatchBuffers buffers =
+      get_dispatch_buffers(m, num_assignments, m->num_experts);
+  compute_expert_slots(
+      indices, num_assignments, m->num_experts, capacity, buffers, stream);
+  checkCUDA(cudaMemsetAsync(x,
+                            0,
+                            (size_t)m->num_experts * capacity * data_dim *
+                                sizeof(float),
+                            stream));
+  int num_elements = num_assignments * data_dim;
+  experts_dispatch_kernel<<<GET_BLOCKS(num_elements),
+                            min(CUDA_NUM_THREADS, num_elements),
+                            0,
+                            stream>>>(
+      input, indices, buffers.slots, x, k, batch_size, capacity, data_dim);
+  stop_profiling(m, "dispatch", t_start, t_end, stream);
+  if (m->profiling) {
+    report_dropped("Experts",
+                   buffers,
+                   num_assignments,
+                   m->num_experts,
+                   capacity,
+                   stream);
+  }
+}
+
+/*static*/
+void Experts::dispatch_backward_kernel_wrapper(ExpertsMeta const *m,
+                                               float const *x_grad,
+                                               int const *indices,
+                                               float *input_grad,
+                                               int k,
+                                               int capacity,
+                                               int batch_size,
+                                               int data_dim) {
+  cudaStream_t stream;
+  checkCUDA(get_legion_stream(&stream));
+  cudaEvent_t t_start, t_end;
+  start_profiling(m, t_start, t_end, stream);
+  int num_assignments = k * batch_size;
+  DispatchBuffers buffers =
+      get_dispatch_buffers(m, num_assignments, m->num_experts);
+  compute_expert_slots(
+      indices, num_assignments, m->num_experts, capacity, buffers, stream);
+  experts_dispatch_backward_kernel<<<GET_BLOCKS(batch_size * data_dim),
+                                     min(CUDA_NUM_THREADS,
+                                         batch_size * data_dim),
+                                     0,
+                                     stream>>>(x_grad,
+                                               indices,
+                                               buffers.slots,
+                                               input_grad,
+                                               k,
+                                               batch_size,
+                                               capacity,
+                                               data_dim);
+  stop_profiling(m, "dispatch backward", t_start, t_end, stream);
+}
+
+/*static*/
+void Experts::forward_kernel_wrapper(ExpertsMeta const *m,
+                                     float const *x,
+                                     float const *kernel,
+                                     float const *bias,
+                                     float *y,
+                                     int num_local,
+                                     int num_rows,
+                                     int data_dim) {
+  cudaStream_t stream;
+  checkCUDA(get_legion_stream(&stream));
+  checkCUDA(cublasSetStream(m->handle.blas, stream));
+  cudaEvent_t t_start, t_end;
+  start_profiling(m, t_start, t_end, stream);
+  int out_dim = m->out_dim;
+  float alpha = 1.0f, beta = 0.0f;
+  // Y = W^T X for all the local experts in a single batched GEMM
+  checkCUDA(cublasSgemmStridedBatched(m->handle.blas,
+                                      CUBLAS_OP_T,
+                                      CUBLAS_OP_N,
+                                      out_dim,
+                                      num_rows,
+                                      data_dim,
+                                      &alpha,
+                                      kernel,
+                                      data_dim,
+                                      (long long)data_dim * out_dim,
+                                      x,
+                                      data_dim,
+                                      (long long)data_dim * num_rows,
+                                      &beta,
+                                      y,
+                                      out_dim,
+                                      (long long)out_dim * num_rows,
+                                      num_local));
+  int num_elements = num_local * num_rows * out_dim;
+  experts_activation_kernel<<<GET_BLOCKS(num_elements),
+                              min(CUDA_NUM_THREADS, num_elements),
+                              0,
+                              stream>>>(y,
+                                        m->use_bias ? bias : nullptr,
+                                        m->activation,
+                                        num_rows,
+                                        num_elements,
+                                        out_dim);
+  int total_rows = num_local * num_rows;
+  experts_softmax_kernel<<<GET_BLOCKS(total_rows),
+                           min(CUDA_NUM_THREADS, total_rows),
+                           0,
+                           stream>>>(y, total_rows, out_dim);
+  stop_profiling(m, "forward", t_start, t_end, stream);
+}
+
+/*static*/
+void Experts::backward_kernel_wrapper(ExpertsMeta const *m,
+                                      float const *x,
+                                      float const *y,
+                                      float const *y_grad,
+                                      float *x_grad,
+                                      float const *kernel,
+                                      float const *bias,
+                                      float *kernel_grad,
+                                      float *bias_grad,
+                                      int num_local,
+                                      int num_rows,
+                                      int data_dim) {
+  cudaStream_t stream;
+  checkCUDA(get_legion_stream(&stream));
+  checkCUDA(cublasSetStream(m->handle.blas, stream));
+  cudaEvent_t t_start, t_end;
+  start_profiling(m, t_start, t_end, stream);
+  int out_dim = m->out_dim;
+  int num_elements = num_local * num_rows * out_dim;
+  assert(num_elements * sizeof(float) <= m->handle.workSpaceSize);
+  // The softmax only keeps y, so recompute the activations in the work space
+  // and overwrite them with dZ, the gradients before the activation
+  float *z_grad = (float *)m->handle.workSpace;
+  float alpha = 1.0f, beta = 0.0f;
+  checkCUDA(cublasSgemmStridedBatched(m->handle.blas,
+                                      CUBLAS_OP_T,
+                                      CUBLAS_OP_N,
+                                      out_dim,
+                                      num_rows,
+                                      data_dim,
+                                      &alpha,
+                                      kernel,
+                                      data_dim,
+                                      (long long)data_dim * out_dim,
+                                      x,
+                                      data_dim,
+                                      (long long)data_dim * num_rows,
+                                      &beta,
+                                      z_grad,
+                                      out_dim,
+                                      (long long)out_dim * num_rows,
+                                      num_local));
+  experts_activation_kernel<<<GET_BLOCKS(num_elements),
+                              min(CUDA_NUM_THREADS, num_elements),
+                              0,
+                              stream>>>(z_grad,
+                                        m->use_bias ? bias : nullptr,
+                                        m->activation,
+                                        num_rows,
+                                        num_elements,
+                                        out_dim);
+  int total_rows = num_local * num_rows;
+  experts_softmax_grad_kernel<<<GET_BLOCKS(total_rows),
+                                min(CUDA_NUM_THREADS, total_rows),
+                                0,
+                                stream>>>(
+      z_grad, y, y_grad, m->activation, total_rows, out_dim);
+  beta = 1.0f;
+  // dW += X dZ^T
+  checkCUDA(cublasSgemmStridedBatched(m->handle.blas,
+                                      CUBLAS_OP_N,
+                                      CUBLAS_OP_T,
+                                      data_dim,
+                                      out_dim,
+                                      num_rows,
+                                      &alpha,
+                                      x,
+                                      data_dim,
+                                      (long long)data_dim * num_rows,
+                                      z_grad,
+                                      out_dim,
+                                      (long long)out_dim * num_rows,
+                                      &beta,
+                                      kernel_grad,
+                                      data_dim,
+                                      (long long)data_dim * out_dim,
+                                      num_local));
+  if (m->use_bias) {
+    experts_bias_grad_kernel<<<GET_BLOCKS(num_local * out_dim),
+                               min(CUDA_NUM_THREADS, num_local * out_dim),
+                               0,
+                               stream>>>(
+        z_grad, bias_grad, num_local, num_rows, out_dim);
+  }
+  // dX = W dZ
+  beta = 0.0f;
+  checkCUDA(cublasSgemmStridedBatched(m->handle.blas,
+                                      CUBLAS_OP_N,
+                                      CUBLAS_OP_N,
+                                      data_dim,
+                                      num_rows,
+                                      out_dim,
+                                      &alpha,
+                                      kernel,
+                                      data_dim,
+                                      (long long)data_dim * out_dim,
+                                      z_grad,
+                                      out_dim,
+                                      (long long)out_dim * num_rows,
+                                      &beta,
+                                      x_grad,
+                                      data_dim,
+                                      (long long)data_dim * num_rows,
+                                      num_local));
+  stop_profiling(m, "backward", t_start, t_end, stream);
+}
+
+/*static*/
+void Experts::combine_kernel_wrapper(ExpertsMeta const *m,
+                                     float const *y,
+                                     int const *indices,
+                                     float const *gate_preds,
+                                     float *output,
+                                     int k,
+                                     int capacity,
+                                     int batch_size) {
+  cudaStream_t stream;
+  checkCUDA(get_legion_stream(&stream));
+  cudaEvent_t t_start, t_end;
+  start_profiling(m, t_start, t_end, stream);
+  int num_assignments = k * batch_size;
+  DispatchBuffers buffers =
+      get_dispatch_buffers(m, num_assignments, m->num_experts);
+  compute_expert_slots(
+      indices, num_assignments, m->num_experts, capacity, buffers, stream);
+  int num_elements = batch_size * m->out_dim;
+  experts_combine_kernel<<<GET_BLOCKS(num_elements),
+                           min(CUDA_NUM_THREADS, num_elements),
+                           0,
+                           stream>>>(y,
+                                     indices,
+                                     buffers.slots,
+                                     gate_preds,
+                                     output,
+                                     k,
+                                     batch_size,
+                                     capacity,
+                                     m->out_dim);
+  stop_profiling(m, "combine", t_start, t_end, stream);
+}
+
+/*static*/
+void Experts::combine_backward_kernel_wrapper(ExpertsMeta const *m,
+                                              float const *y,
+                                              int const *indices,
+                                              float const *gate_preds,
+                                              float const *output_grad,
+                                              float *y_grad,
+                                              float *full_gate_grads,
+                                              int k,
+                                              int capacity,
+                                              int batch_size) {
+  cudaStream_t stream;
+  checkCUDA(get_legion_stream(&stream));
+  cudaEvent_t t_start, t_end;
+  start_profiling(m, t_start, t_end, stream);
+  int out_dim = m->out_dim;
+  int num_assignments = k * batch_size;
+  DispatchBuffers buffers =
+      get_dispatch_buffers(m, num_assignments, m->num_experts);
+  compute_expert_slots(
+      indices, num_assignments, m->num_experts, capacity, buffers, stream);
+  checkCUDA(cudaMemsetAsync(
+      y_grad,
+      0,
+      (size_t)m->num_experts * capacity * out_dim * sizeof(float),
+      stream));
+  int num_elements = num_assignments * out_dim;
+  experts_combine_backward_kernel<<<GET_BLOCKS(num_elements),
+                                    min(CUDA_NUM_THREADS, num_elements),
+                                    0,
+                                    stream>>>(indices,
+                                              buffers.slots,
+                                              gate_preds,
+                                              output_grad,
+                                              y_grad,
+                                              k,
+                                              batch_size,
+                                              capacity,
+                                              out_dim);
+  experts_gate_grad_kernel<<<GET_BLOCKS(num_assignments),
+                             min(CUDA_NUM_THREADS, num_assignments),
+                             0,
+                             stream>>>(
+      y,
+      indices,
+      buffers.slots,
+      output_grad,
+      full_gate_grads,
+      k,
+      m->num_experts,
+      batch_size,
+      capacity,
+      out_dim);
+  balance_gate_grads(full_gate_grads,
+                     buffers.expert_counts,
+                     m->num_experts,
+                     m->lambda_bal,
+                     batch_size,
+                     stream);
+  stop_profiling(m, "combine backward", t_start, t_end, stream);
+}
+
+/*static*/
+void Experts::init_measure_indices(int *indices,
+                                   int k,
+                                   int batch_size,
+                                   int num_experts) {
+  cudaStream_t stream;
+  checkCUDA(get_legion_stream(&stream));
+  experts_measure_indices_kernel<<<GET_BLOCKS(k * batch_size),
+                                   min(CUDA_NUM_THREADS, k * batch_size),
+                                   0,
+                                   stream>>>(
+      indices, k * batch_size, num_experts);
+}
+
+/*static*/
+void Experts::load_kernel_wrapper(ExpertsMeta const *m,
+                                  int const *indices,
+                                  int k,
+                                  int batch_size,
+                                  ExpertsLoad &load) {
+  cudaStream_t stream;
+  checkCUDA(get_legion_stream(&stream));
+  int num_assignments = k * batch_size;
+  int capacity = expert_capacity(m->alpha, k, m->num_experts, batch_size);
+  DispatchBuffers buffers =
+      get_dispatch_buffers(m, num_assignments, m->num_experts);
+  compute_expert_slots(
+      indices, num_assignments, m->num_experts, capacity, buffers, stream);
+  checkCUDA(cudaMemcpyAsync(load.counts,
+                            buffers.expert_counts,
+                            m->num_experts * sizeof(int),
+                            cudaMemcpyDeviceToHost,
+                            stream));
+  checkCUDA(cudaStreamSynchronize(stream));
+  load.num_experts = m->num_experts;
+  load.num_assignments = num_assignments;
+  load.capacity = capacity;
+  load.dropped = num_dropped(load.counts, m->num_experts, capacity);
+}
+
+ExpertsMeta::ExpertsMeta(FFHandler handler, Experts const *experts)
+    : OpMeta(handler), num_experts(experts->num_experts),
+      out_dim(experts->out_dim), alpha(experts->alpha),
+      lambda_bal(experts->lambda_bal), activation(experts->activation),
+      use_bias(experts->use_bias) {}
+
+}; // namespace FlexFlow
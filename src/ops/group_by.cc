@@ -15,6 +15,7 @@
 
 #include "flexflow/model.h"
 #include "flexflow/ops/groupby.h"
+#include "flexflow/ops/kernels/moe_dispatch_cpu_kernels.h"
 #include "flexflow/utils/hash_utils.h"
 #include "legion/legion_utilities.h"
 #include <math.h>
@@ -64,7 +65,8 @@ void FFModel::group_by(const Tensor input,
       dims[i] = input->dims[i];
     }
     // Batch dimension is replaced by max expert capacity
-    dims[num_dims - 1] = (int)ceil(alpha * k / n * input->dims[num_dims - 1]);
+    dims[num_dims - 1] = Kernels::MoeDispatch::expert_capacity(
+        alpha, k, n, input->dims[num_dims - 1]);
     for (int i = 0; i < n; i++) {
       // Creating one tensor per expert, each with size (DATA_DIMS,
       // max_expert_capacity)
@@ -140,7 +142,8 @@ Group_by::Group_by(FFModel &model,
     dims[i] = inputs[0]->dims[i];
   }
   // replace batch size with max expert size
-  dims[num_dims - 2].size = (int)ceil(alpha * k / n * inputs[0]->dims[1].size);
+  dims[num_dims - 2].size = Kernels::MoeDispatch::expert_capacity(
+      alpha, k, n, inputs[0]->dims[1].size);
 
   for (int i = 0; i < n; i++) {
     outputs[i] = model.create_parallel_tensor_legion_ordering(
@@ -297,7 +300,8 @@ void Group_by::forward_task(Task const *task,
   // Each entry in the "outputs" vector points to the Legion tensor that will
   // contain the tockens dispatched to the corresponding expert
   float *outputs[n];
-  int exp_output_rows = (int)ceil(alpha * k / n * batch_size);
+  int exp_output_rows =
+      Kernels::MoeDispatch::expert_capacity(alpha, k, n, batch_size);
   for (int i = 0; i < n; i++) {
     Domain out_domain = runtime->get_index_space_domain(
         ctx, task->regions[i + 2].region.get_index_space());
@@ -396,7 +400,8 @@ void Group_by::backward_task(Task const *task,
 
   // get output
   float *output_grads[n];
-  int exp_output_rows = (int)ceil(alpha * k / n * batch_size);
+  int exp_output_rows =
+      Kernels::MoeDispatch::expert_capacity(alpha, k, n, batch_size);
   for (int i = 0; i < n; i++) {
     Domain out_domain = runtime->get_index_space_domain(
         ctx, task->regions[i + 2].region.get_index_space());
@@ -457,7 +462,7 @@ bool Group_by::measure_operator_cost(Simulator *sim,
   if (!inputs[0]->get_sub_tensor(mv, sub_input)) {
     return false;
   }
-  if (!inputs[0]->get_sub_tensor(mv, sub_assign)) {
+  if (!inputs[1]->get_sub_tensor(mv, sub_assign)) {
     return false;
   }
   for (int i = 0; i < numOutputs; ++i) {
@@ -14,106 +14,53 @@
  */
 
 #include "flexflow/ops/groupby.h"
+#include "flexflow/ops/kernels/moe_dispatch_kernels.h"
 #include "flexflow/utils/hip_helper.h"
 #include <hip/hip_runtime.h>
 #include <math.h>
 #include <stdio.h>
 
-#define MAX_K 4
-#define MAX_BATCH_SIZE 64
-#define MAX_N 12
-
 namespace FlexFlow {
 
-__global__ void
-    gb_forward_kernel(float const *input,
-                      int const *exp_assign,
-                      float **outputs,
-                      int n,       // num experts
-                      int k,       // chosen experts
-                      float alpha, // factor additional memory assigned
-                      int batch_size,
-                      int data_dim) {
-  __shared__ float
-      *chosen_exp_preds[MAX_K *
-                        MAX_BATCH_SIZE]; // one pointer for each exp_assign
-                                         // (TopK_output[1]) element
-
-  // Get pred pointers, single thread per block
-  if (threadIdx.x == 0) {
-    int exp_tensor_rows =
-        ceil(alpha * k / n * batch_size); // This is the max expert capacity
-    int expert_idx[MAX_N] = {
-        0}; // This is the number of tokens assigned to each expert
-    // Iterate through flattened assign tensor, which has shape (k, batch_size)
-    for (int i = 0; i < k * batch_size; i++) {
-      // Get pointer to chosen expert predictions
-      int expert =
-          exp_assign[i]; // index of the expert that is to receive the token i
-      if (expert_idx[expert] >=
-          exp_tensor_rows) { // check if the expert is already at capacity
-        // dropped sample
-        chosen_exp_preds[i] = 0;
-        continue;
-      }
-      // chosen_exp_preds[i] is the pointer to the location in the outputs
-      // tensor's memory where we should copy the i-th tensor. outputs[expert]
-      // points us to the assigned expert's (DATA_DIM, expert capacity) tensor
-      // block expert_idx[expert] * data_dim is the offset within the block
-      chosen_exp_preds[i] = outputs[expert] + expert_idx[expert] * data_dim;
-      expert_idx[expert]++;
-    }
-  }
-
-  __syncthreads();
+using namespace Kernels::MoeDispatch;
 
-  // By this point we know exactly where to copy each tensor, so we can execute
-  // in parallel.
+__global__ void gb_forward_kernel(float const *input,
+                                  int const *exp_assign,
+                                  int const *slots,
+                                  float **outputs,
+                                  int k, // chosen experts
+                                  int batch_size,
+                                  int data_dim) {
   CUDA_KERNEL_LOOP(i, k * batch_size * data_dim) {
-    if (chosen_exp_preds[i / data_dim] != 0) {
-      float a = input[(i / (k * data_dim)) * data_dim + i % data_dim];
-      chosen_exp_preds[i / data_dim][i % data_dim] = a;
+    int assignment = i / data_dim;
+    int slot = slots[assignment];
+    if (slot >= 0) {
+      int col = i % data_dim;
+      outputs[exp_assign[assignment]][slot * data_dim + col] =
+          input[(assignment / k) * data_dim + col];
     }
   }
 }
 
-__global__ void
-    gb_backward_kernel(float *input_grad,
-                       int const *exp_assign,
-                       float **output_grads,
-                       int n,       // num experts
-                       int k,       // chosen experts
-                       float alpha, // factor additional memory assigned
-                       int batch_size,
-                       int data_dim) {
-  __shared__ float *chosen_exp_grads[MAX_K * MAX_BATCH_SIZE];
-
-  // Get pred pointers, single thread
-  if (blockIdx.x * blockDim.x + threadIdx.x == 0) {
-    int exp_tensor_rows = ceil(alpha * k / n * batch_size);
-    int expert_idx[MAX_N] = {0};
-    for (int i = 0; i < k * batch_size; i++) {
-      // Get pointer to chosen expert predictions
-      int expert = exp_assign[i];
-      if (expert_idx[expert] >= exp_tensor_rows) {
-        // dropped sample
-        chosen_exp_grads[i] = 0;
-        continue;
+__global__ void gb_backward_kernel(float *input_grad,
+                                   int const *exp_assign,
+                                   int const *slots,
+                                   float **output_grads,
+                                   int k, // chosen experts
+                                   int batch_size,
+                                   int data_dim) {
+  // one thread per input element, which sums the gradients of the rows its
+  // token was copied to
+  CUDA_KERNEL_LOOP(i, batch_size * data_dim) {
+    int token = i / data_dim, col = i % data_dim;
+    float sum = 0.0f;
+    for (int j = 0; j < k; j++) {
+      int slot = slots[token * k + j];
+      if (slot >= 0) {
+        sum += output_grads[exp_assign[token * k + j]][slot * data_dim + col];
       }
-      chosen_exp_grads[i] =
-          output_grads[expert] + expert_idx[expert] * data_dim;
-      expert_idx[expert]++;
-    }
-  }
-
-  __syncthreads();
-
-  // compute output
-  CUDA_KERNEL_LOOP(i, k * batch_size * data_dim) {
-    if (chosen_exp_grads[i / data_dim] != 0) {
-      input_grad[(i / (k * data_dim)) * data_dim + i % data_dim] =
-          chosen_exp_grads[i / data_dim][i % data_dim];
     }
+    input_grad[i] = sum;
   }
 }
 
@@ -136,6 +83,10 @@ void Group_by::forward_kernel_wrapper(
   hipMemcpy(
       m->dev_region_ptrs, outputs, n * sizeof(float *), hipMemcpyHostToDevice);
 
+  int capacity = expert_capacity(alpha, k, n, batch_size);
+  DispatchBuffers buffers = get_dispatch_buffers(m, k * batch_size, n);
+  compute_expert_slots(
+      exp_assign, k * batch_size, n, capacity, buffers, stream);
   hipLaunchKernelGGL(gb_forward_kernel,
                      GET_BLOCKS(batch_size * k * data_dim),
                      min(CUDA_NUM_THREADS, (int)(batch_size * k * data_dim)),
@@ -143,12 +94,14 @@ void Group_by::forward_kernel_wrapper(
                      stream,
                      input,
                      exp_assign,
+                     buffers.slots,
                      m->dev_region_ptrs,
-                     n,
                      k,
-                     alpha,
                      batch_size,
                      data_dim);
+  if (m->profiling) {
+    report_dropped("GroupBy", buffers, k * batch_size, n, capacity, stream);
+  }
 }
 
 void Group_by::backward_kernel_wrapper(
@@ -171,17 +124,20 @@ void Group_by::backward_kernel_wrapper(
             n * sizeof(float *),
             hipMemcpyHostToDevice);
 
+  int capacity = expert_capacity(alpha, k, n, batch_size);
+  DispatchBuffers buffers = get_dispatch_buffers(m, k * batch_size, n);
+  compute_expert_slots(
+      exp_assign, k * batch_size, n, capacity, buffers, stream);
   hipLaunchKernelGGL(gb_backward_kernel,
-                     GET_BLOCKS(batch_size * k * data_dim),
-                     min(CUDA_NUM_THREADS, (int)(batch_size * k * data_dim)),
+                     GET_BLOCKS(batch_size * data_dim),
+                     min(CUDA_NUM_THREADS, (int)(batch_size * data_dim)),
                      0,
                      stream,
                      input_grad,
                      exp_assign,
+                     buffers.slots,
                      m->dev_region_ptrs,
-                     n,
                      k,
-                     alpha,
                      batch_size,
                      data_dim);
 }
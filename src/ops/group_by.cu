@@ -14,94 +14,52 @@
  */
 
 #include "flexflow/ops/groupby.h"
+#include "flexflow/ops/kernels/moe_dispatch_kernels.h"
 #include "flexflow/utils/cuda_helper.h"
 #include <math.h>
 #include <stdio.h>
 
-#define MAX_K 4
-#define MAX_BATCH_SIZE 64
-#define MAX_N 12
-
 namespace FlexFlow {
 
-__global__ void
-    gb_forward_kernel(float const *input,
-                      int const *exp_assign,
-                      float **outputs,
-                      int n,       // num experts
-                      int k,       // chosen experts
-                      float alpha, // factor additional memory assigned
-                      int batch_size,
-                      int data_dim) {
-  __shared__ float *chosen_exp_preds[MAX_K * MAX_BATCH_SIZE];
-
-  // Get pred pointers, single thread per block
-  if (threadIdx.x == 0) {
-    int exp_tensor_rows = ceil(alpha * k / n * batch_size);
-    int expert_idx[MAX_N] = {0};
-    for (int i = 0; i < k * batch_size; i++) {
-      // Get pointer to chosen expert predictions
-      int expert = exp_assign[i];
-      if (expert_idx[expert] >= exp_tensor_rows) {
-        // dropped sample
-        chosen_exp_preds[i] = 0;
-        continue;
-      }
-      chosen_exp_preds[i] = outputs[expert] + expert_idx[expert] * data_dim;
-      expert_idx[expert]++;
-    }
-  }
-
-  __syncthreads();
+using namespace Kernels::MoeDispatch;
 
-  // compute output
+__global__ void gb_forward_kernel(float const *input,
+                                  int const *exp_assign,
+                                  int const *slots,
+                                  float **outputs,
+                                  int k, // chosen experts
+                                  int batch_size,
+                                  int data_dim) {
   CUDA_KERNEL_LOOP(i, k * batch_size * data_dim) {
-    if (chosen_exp_preds[i / data_dim] != 0) {
-      float a = input[(i / (k * data_dim)) * data_dim + i % data_dim];
-      chosen_exp_preds[i / data_dim][i % data_dim] = a;
+    int assignment = i / data_dim;
+    int slot = slots[assignment];
+    if (slot >= 0) {
+      int col = i % data_dim;
+      outputs[exp_assign[assignment]][slot * data_dim + col] =
+          input[(assignment / k) * data_dim + col];
     }
   }
 }
 
-__global__ void
-    gb_backward_kernel(float *input_grad,
-                       int const *exp_assign,
-                       float **output_grads,
-                       int n,       // num experts
-                       int k,       // chosen experts
-                       float alpha, // factor additional memory assigned
-                       int batch_size,
-                       int data_dim) {
-  __shared__ float *chosen_exp_grads[MAX_K * MAX_BATCH_SIZE];
-  assert(k <= MAX_K);
-  assert(batch_size <= MAX_BATCH_SIZE);
-  assert(n <= MAX_N);
-
-  // Get pred pointers, single thread
-  if (threadIdx.x == 0) {
-    int exp_tensor_rows = ceil(alpha * k / n * batch_size);
-    int expert_idx[MAX_N] = {0};
-    for (int i = 0; i < k * batch_size; i++) {
-      // Get pointer to chosen expert predictions
-      int expert = exp_assign[i];
-      if (expert_idx[expert] >= exp_tensor_rows) {
-        // dropped sample
-        chosen_exp_grads[i] = nullptr;
-        continue;
+__global__ void gb_backward_kernel(float *input_grad,
+                                   int const *exp_assign,
+                                   int const *slots,
+                                   float **output_grads,
+                                   int k, // chosen experts
+                                   int batch_size,
+                                   int data_dim) {
+  // one thread per input element, which sums the gradients of the rows its
+  // token was copied to
+  CUDA_KERNEL_LOOP(i, batch_size * data_dim) {
+    int token = i / data_dim, col = i % data_dim;
+    float sum = 0.0f;
+    for (int j = 0; j < k; j++) {
+      int slot = slots[token * k + j];
+      if (slot >= 0) {
+        sum += output_grads[exp_assign[token * k + j]][slot * data_dim + col];
       }
-      chosen_exp_grads[i] =
-          output_grads[expert] + expert_idx[expert] * data_dim;
-      expert_idx[expert]++;
-    }
-  }
-
-  __syncthreads();
-  // compute output
-  CUDA_KERNEL_LOOP(i, k * batch_size * data_dim) {
-    if (chosen_exp_grads[i / data_dim] != nullptr) {
-      input_grad[(i / (k * data_dim)) * data_dim + i % data_dim] =
-          chosen_exp_grads[i / data_dim][i % data_dim];
     }
+    input_grad[i] = sum;
   }
 }
 
@@ -132,11 +90,20 @@ void Group_by::forward_kernel_wrapper(
                   cudaMemcpyHostToDevice,
                   stream);
 
+  int capacity = expert_capacity(alpha, k, n, batch_size);
+  DispatchBuffers buffers = get_dispatch_buffers(m, k * batch_size, n);
+  compute_expert_slots(
+      exp_assign, k * batch_size, n, capacity, buffers, stream);
   gb_forward_kernel<<<GET_BLOCKS(batch_size * k * data_dim),
                       min(CUDA_NUM_THREADS, (int)(batch_size * k * data_dim)),
                       0,
-                      stream>>>(
-      input, exp_assign, m->dev_region_ptrs, n, k, alpha, batch_size, data_dim);
+                      stream>>>(input,
+                                exp_assign,
+                                buffers.slots,
+                                m->dev_region_ptrs,
+                                k,
+                                batch_size,
+                                data_dim);
   if (m->profiling) {
     cudaEventRecord(t_end, stream);
     checkCUDA(cudaEventSynchronize(t_end));
@@ -145,6 +112,7 @@ void Group_by::forward_kernel_wrapper(
     cudaEventDestroy(t_start);
     cudaEventDestroy(t_end);
     printf("[GroupBy] forward time = %.2lfms\n", elapsed);
+    report_dropped("GroupBy", buffers, k * batch_size, n, capacity, stream);
   }
 }
 
@@ -174,15 +142,18 @@ void Group_by::backward_kernel_wrapper(
                   n * sizeof(float *),
                   cudaMemcpyHostToDevice,
                   stream);
-  gb_backward_kernel<<<GET_BLOCKS(batch_size * k * data_dim),
-                       min(CUDA_NUM_THREADS, (int)(batch_size * k * data_dim)),
+  int capacity = expert_capacity(alpha, k, n, batch_size);
+  DispatchBuffers buffers = get_dispatch_buffers(m, k * batch_size, n);
+  compute_expert_slots(
+      exp_assign, k * batch_size, n, capacity, buffers, stream);
+  gb_backward_kernel<<<GET_BLOCKS(batch_size * data_dim),
+                       min(CUDA_NUM_THREADS, (int)(batch_size * data_dim)),
                        0,
                        stream>>>(input_grad,
                                  exp_assign,
+                                 buffers.slots,
                                  m->dev_region_ptrs,
-                                 n,
                                  k,
-                                 alpha,
                                  batch_size,
                                  data_dim);
   if (m->profiling) {
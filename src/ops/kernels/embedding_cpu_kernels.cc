@@ -0,0 +1,184 @@
+/* Copyright 2023 CMU, Facebook, LANL, MIT, NVIDIA, and Stanford (alphabetical)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "flexflow/ops/kernels/embedding_cpu_kernels.h"
+#include "flexflow/utils/parallel_for.h"
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#ifdef FF_USE_AVX2
+#include <immintrin.h>
+#endif
+
+namespace FlexFlow {
+namespace Kernels {
+namespace Embedding {
+
+// y[0, n) += a * x[0, n)
+static inline void axpy(int n, float a, float const *x, float *y) {
+  int i = 0;
+#ifdef FF_USE_AVX2
+#ifdef __AVX512F__
+  __m512 va16 = _mm512_set1_ps(a);
+  for (; i + 16 <= n; i += 16) {
+    _mm512_storeu_ps(
+        y + i,
+        _mm512_fmadd_ps(va16, _mm512_loadu_ps(x + i), _mm512_loadu_ps(y + i)));
+  }
+#endif
+  __m256 va8 = _mm256_set1_ps(a);
+  for (; i + 8 <= n; i += 8) {
+    _mm256_storeu_ps(
+        y + i,
+        _mm256_fmadd_ps(va8, _mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i)));
+  }
+#endif
+  for (; i < n; i++) {
+    y[i] += a * x[i];
+  }
+}
+
+// y[0, n) *= a
+static inline void scale(int n, float a, float *y) {
+  int i = 0;
+#ifdef FF_USE_AVX2
+  __m256 va8 = _mm256_set1_ps(a);
+  for (; i + 8 <= n; i += 8) {
+    _mm256_storeu_ps(y + i, _mm256_mul_ps(va8, _mm256_loadu_ps(y + i)));
+  }
+#endif
+  for (; i < n; i++) {
+    y[i] *= a;
+  }
+}
+
+// Brings the row that is accumulated next into the cache
+static inline void prefetch_row(float const *row, int n) {
+#ifdef FF_USE_AVX2
+  for (int i = 0; i < n; i += 64 / sizeof(float)) {
+    _mm_prefetch((char const *)(row + i), _MM_HINT_T0);
+  }
+#endif
+}
+
+template <typename TI>
+void cpu_forward_kernel(TI const *input,
+                        float *output,
+                        float const *weight,
+                        int in_dim,
+                        int out_dim,
+                        int batch_size,
+                        AggrMode aggr,
+                        int64_t num_entries,
+                        int num_threads) {
+  assert(aggr != AGGR_MODE_NONE || in_dim == 1);
+  assert(num_threads > 0);
+  float bag_scale = aggr == AGGR_MODE_AVG ? 1.0f / in_dim : 1.0f;
+  size_t num_chunks = std::min(num_threads, std::max(batch_size, 1));
+  std::atomic<int> budget(num_threads - 1);
+  parallel_for(num_chunks, budget, [&](size_t chunk) {
+    int lo = batch_size * chunk / num_chunks;
+    int hi = batch_size * (chunk + 1) / num_chunks;
+    for (int b = lo; b < hi; b++) {
+      float *out = output + (size_t)b * out_dim;
+      TI const *ids = input + (size_t)b * in_dim;
+      memset(out, 0, out_dim * sizeof(float));
+      for (int j = 0; j < in_dim; j++) {
+        int64_t id = ids[j];
+        assert(id >= 0 && id < num_entries);
+        if (j + 1 < in_dim) {
+          prefetch_row(weight + ids[j + 1] * out_dim, out_dim);
+        }
+        axpy(out_dim, 1.0f, weight + id * out_dim, out);
+      }
+      if (bag_scale != 1.0f) {
+        scale(out_dim, bag_scale, out);
+      }
+    }
+  });
+}
+
+template <typename TI>
+void cpu_backward_kernel(TI const *input,
+                         float const *output_grad,
+                         float *weight_grad,
+                         int in_dim,
+                         int out_dim,
+                         int batch_size,
+                         AggrMode aggr,
+                         int64_t num_entries,
+                         int num_threads) {
+  assert(aggr != AGGR_MODE_NONE || in_dim == 1);
+  assert(num_threads > 0);
+  float bag_scale = aggr == AGGR_MODE_AVG ? 1.0f / in_dim : 1.0f;
+  size_t num_ids = (size_t)batch_size * in_dim;
+  size_t num_parts =
+      std::min<size_t>(num_threads, std::max<size_t>(num_ids, 1));
+  std::atomic<int> budget(num_threads - 1);
+  parallel_for(num_parts, budget, [&](size_t part) {
+    for (size_t i = 0; i < num_ids; i++) {
+      int64_t id = input[i];
+      assert(id >= 0 && id < num_entries);
+      if ((size_t)id % num_parts != part) {
+        continue;
+      }
+      axpy(out_dim,
+           bag_scale,
+           output_grad + (i / in_dim) * out_dim,
+           weight_grad + id * out_dim);
+    }
+  });
+}
+
+template void cpu_forward_kernel<int32_t>(int32_t const *input,
+                                          float *output,
+                                          float const *weight,
+                                          int in_dim,
+                                          int out_dim,
+                                          int batch_size,
+                                          AggrMode aggr,
+                                          int64_t num_entries,
+                                          int num_threads);
+template void cpu_forward_kernel<int64_t>(int64_t const *input,
+                                          float *output,
+                                          float const *weight,
+                                          int in_dim,
+                                          int out_dim,
+                                          int batch_size,
+                                          AggrMode aggr,
+                                          int64_t num_entries,
+                                          int num_threads);
+template void cpu_backward_kernel<int32_t>(int32_t const *input,
+                                           float const *output_grad,
+                                           float *weight_grad,
+                                           int in_dim,
+                                           int out_dim,
+                                           int batch_size,
+                                           AggrMode aggr,
+                                           int64_t num_entries,
+                                           int num_threads);
+template void cpu_backward_kernel<int64_t>(int64_t const *input,
+                                           float const *output_grad,
+                                           float *weight_grad,
+                                           int in_dim,
+                                           int out_dim,
+                                           int batch_size,
+                                           AggrMode aggr,
+                                           int64_t num_entries,
+                                           int num_threads);
+
+} // namespace Embedding
+} // namespace Kernels
+} // namespace FlexFlow
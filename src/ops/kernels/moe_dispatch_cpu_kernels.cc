@@ -0,0 +1,618 @@
+/* Copyright 2023 CMU, Facebook, LANL, MIT, NVIDIA, and Stanford (alphabetical)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "flexflow/ops/kernels/moe_dispatch_cpu_kernels.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+namespace FlexFlow {
+namespace Kernels {
+namespace MoeDispatch {
+
+int expert_capacity(float alpha, int k, int n, int batch_size) {
+  return (int)ceil(alpha * k / n * batch_size);
+}
+
+void cpu_compute_expert_slots(int const *exp_assign,
+                              int num_assignments,
+                              int n,
+                              int capacity,
+                              int *slots,
+                              int *expert_counts) {
+  memset(expert_counts, 0, n * sizeof(int));
+  for (int i = 0; i < num_assignments; i++) {
+    int expert = exp_assign[i];
+    assert(expert >= 0 && expert < n);
+    slots[i] = expert_counts[expert] < capacity ? expert_counts[expert] : -1;
+    expert_counts[expert]++;
+  }
+}
+
+int num_dropped(int const *expert_counts, int n, int capacity) {
+  int dropped = 0;
+  for (int e = 0; e < n; e++) {
+    if (expert_counts[e] > capacity) {
+      dropped += expert_counts[e] - capacity;
+    }
+  }
+  return dropped;
+}
+
+void cpu_group_by_forward(float const *input,
+                          int const *exp_assign,
+                          float *const *outputs,
+                          int n,
+                          int k,
+                          int capacity,
+                          int batch_size,
+                          int data_dim) {
+  std::vector<int> slots(k * batch_size), counts(n);
+  cpu_compute_expert_slots(
+      exp_assign, k * batch_size, n, capacity, slots.data(), counts.data());
+  for (int i = 0; i < k * batch_size; i++) {
+    if (slots[i] >= 0) {
+      memcpy(outputs[exp_assign[i]] + slots[i] * data_dim,
+             input + (i / k) * data_dim,
+             data_dim * sizeof(float));
+    }
+  }
+}
+
+void cpu_group_by_backward(float *input_grad,
+                           int const *exp_assign,
+                           float *const *output_grads,
+                           int n,
+                           int k,
+                           int capacity,
+                           int batch_size,
+                           int data_dim) {
+  std::vector<int> slots(k * batch_size), counts(n);
+  cpu_compute_expert_slots(
+      exp_assign, k * batch_size, n, capacity, slots.data(), counts.data());
+  memset(input_grad, 0, batch_size * data_dim * sizeof(float));
+  for (int i = 0; i < k * batch_size; i++) {
+    if (slots[i] >= 0) {
+      float const *grad = output_grads[exp_assign[i]] + slots[i] * data_dim;
+      for (int c = 0; c < data_dim; c++) {
+        input_grad[(i / k) * data_dim + c] += grad[c];
+      }
+    }
+  }
+}
+
+void cpu_aggregate_forward(float *const *exp_preds,
+                           int const *exp_assign,
+                           float const *gate_preds,
+                           float *output,
+                           int n,
+                           int k,
+                           int capacity,
+                           int batch_size,
+                           int out_dim) {
+  std::vector<int> slots(k * batch_size), counts(n);
+  cpu_compute_expert_slots(
+      exp_assign, k * batch_size, n, capacity, slots.data(), counts.data());
+  memset(output, 0, batch_size * out_dim * sizeof(float));
+  for (int i = 0; i < k * batch_size; i++) {
+    if (slots[i] >= 0) {
+      float const *pred = exp_preds[exp_assign[i]] + slots[i] * out_dim;
+      for (int c = 0; c < out_dim; c++) {
+        output[(i / k) * out_dim + c] += gate_preds[i] * pred[c];
+      }
+    }
+  }
+}
+
+// Adds the load balancing term to the gate gradients and shifts each row to
+// zero mean
+static void cpu_balance_gate_grads(float *full_gate_grads,
+                                   int const *expert_counts,
+                                   int n,
+                                   float lambda_bal,
+                                   int batch_size) {
+  float scale = (lambda_bal * n) / batch_size;
+  for (int b = 0; b < batch_size; b++) {
+    float *row = full_gate_grads + b * n;
+    float mean = 0.0f;
+    for (int e = 0; e < n; e++) {
+      row[e] += scale * expert_counts[e];
+      mean += row[e];
+    }
+    mean /= n;
+    for (int e = 0; e < n; e++) {
+      row[e] -= mean;
+    }
+  }
+}
+
+static bool cache_correct(int const *exp_assign,
+                          int const *true_exp_assign,
+                          int k,
+                          int token) {
+  for (int j = 0; j < k; j++) {
+    if (exp_assign[token * k + j] != true_exp_assign[token * k + j]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void cpu_aggregate_backward(float *const *exp_preds,
+                            float *const *exp_grads,
+                            int const *exp_assign,
+                            int const *true_exp_assign,
+                            float const *gate_preds,
+                            float *full_gate_grads,
+                            float const *output_grad,
+                            int n,
+                            int k,
+                            int capacity,
+                            float lambda_bal,
+                            int batch_size,
+                            int out_dim) {
+  std::vector<int> slots(k * batch_size), counts(n);
+  cpu_compute_expert_slots(true_exp_assign,
+                           k * batch_size,
+                           n,
+                           capacity,
+                           slots.data(),
+                           counts.data());
+  for (int i = 0; i < k * batch_size; i++) {
+    if (slots[i] < 0) {
+      continue;
+    }
+    int b = i / k;
+    int expert = true_exp_assign[i];
+    float const *grad = output_grad + b * out_dim;
+    float *exp_grad = exp_grads[expert] + slots[i] * out_dim;
+    for (int c = 0; c < out_dim; c++) {
+      exp_grad[c] += gate_preds[i] * grad[c];
+    }
+    if (cache_correct(exp_assign, true_exp_assign, k, b)) {
+      float const *pred = exp_preds[expert] + slots[i] * out_dim;
+      float dot = 0.0f;
+      for (int c = 0; c < out_dim; c++) {
+        dot += grad[c] * pred[c];
+      }
+      full_gate_grads[b * n + exp_assign[i]] += dot;
+    }
+  }
+  cpu_balance_gate_grads(
+      full_gate_grads, counts.data(), n, lambda_bal, batch_size);
+}
+
+void cpu_aggregate_spec_forward(float *const *exp_preds,
+                                int const *exp_assign,
+                                float *output,
+                                int n,
+                                int k,
+                                int capacity,
+                                int batch_size,
+                                int out_dim) {
+  std::vector<int> slots(k * batch_size), counts(n);
+  cpu_compute_expert_slots(
+      exp_assign, k * batch_size, n, capacity, slots.data(), counts.data());
+  for (int i = 0; i < k * batch_size; i++) {
+    if (slots[i] >= 0) {
+      memcpy(output + i * out_dim,
+             exp_preds[exp_assign[i]] + slots[i] * out_dim,
+             out_dim * sizeof(float));
+    } else {
+      memset(output + i * out_dim, 0, out_dim * sizeof(float));
+    }
+  }
+}
+
+void cpu_aggregate_spec_backward(float *const *exp_grads,
+                                 int const *exp_assign,
+                                 int const *true_exp_assign,
+                                 float const *gate_preds,
+                                 float *full_gate_grads,
+                                 float const *output_grad,
+                                 int n,
+                                 int k,
+                                 int capacity,
+                                 float lambda_bal,
+                                 int batch_size,
+                                 int out_dim) {
+  std::vector<int> slots(k * batch_size), counts(n);
+  cpu_compute_expert_slots(true_exp_assign,
+                           k * batch_size,
+                           n,
+                           capacity,
+                           slots.data(),
+                           counts.data());
+  for (int i = 0; i < k * batch_size; i++) {
+    if (slots[i] >= 0) {
+      float *exp_grad = exp_grads[true_exp_assign[i]] + slots[i] * out_dim;
+      for (int c = 0; c < out_dim; c++) {
+        exp_grad[c] += gate_preds[i] * output_grad[i * out_dim + c];
+      }
+    }
+  }
+  for (int b = 0; b < batch_size; b++) {
+    if (!cache_correct(exp_assign, true_exp_assign, k, b)) {
+      continue;
+    }
+    // The errors are the squared L2 norms of the output gradients, times
+    // batch_size since the expert gradients are divided by batch_size
+    float err_sum = 0.0f;
+    for (int i = b * k; i < (b + 1) * k; i++) {
+      float err = 0.0f;
+      for (int c = 0; c < out_dim; c++) {
+        err += output_grad[i * out_dim + c] * output_grad[i * out_dim + c];
+      }
+      full_gate_grads[b * n + exp_assign[i]] += err * batch_size;
+      err_sum += err * batch_size;
+    }
+    for (int i = b * k; i < (b + 1) * k; i++) {
+      float &grad = full_gate_grads[b * n + exp_assign[i]];
+      grad = grad / err_sum - (1.0f - gate_preds[i]);
+    }
+  }
+  cpu_balance_gate_grads(
+      full_gate_grads, counts.data(), n, lambda_bal, batch_size);
+}
+
+static float activate(ActiMode activation, float x) {
+  switch (activation) {
+    case AC_MODE_NONE:
+      return x;
+    case AC_MODE_RELU:
+      return x > 0.0f ? x : 0.0f;
+    case AC_MODE_SIGMOID:
+      return 1.0f / (1.0f + expf(-x));
+    case AC_MODE_TANH:
+      return tanhf(x);
+    default:
+      assert(false && "Unsupported activation for experts");
+      return x;
+  }
+}
+
+// The derivative of the activation, given its output y
+static float activation_grad(ActiMode activation, float y) {
+  switch (activation) {
+    case AC_MODE_NONE:
+      return 1.0f;
+    case AC_MODE_RELU:
+      return y > 0.0f ? 1.0f : 0.0f;
+    case AC_MODE_SIGMOID:
+      return y * (1.0f - y);
+    case AC_MODE_TANH:
+      return 1.0f - y * y;
+    default:
+      assert(false && "Unsupported activation for experts");
+      return 1.0f;
+  }
+}
+
+void cpu_experts_dispatch(float const *input,
+                          int const *exp_assign,
+                          float *rows,
+                          int n,
+                          int k,
+                          int capacity,
+                          int batch_size,
+                          int data_dim) {
+  std::vector<int> slots(k * batch_size), counts(n);
+  cpu_compute_expert_slots(
+      exp_assign, k * batch_size, n, capacity, slots.data(), counts.data());
+  memset(rows, 0, (size_t)n * capacity * data_dim * sizeof(float));
+  for (int i = 0; i < k * batch_size; i++) {
+    if (slots[i] < 0) {
+      continue;
+    }
+    float *row =
+        rows + ((size_t)exp_assign[i] * capacity + slots[i]) * data_dim;
+    memcpy(row, input + (i / k) * data_dim, data_dim * sizeof(float));
+  }
+}
+
+void cpu_experts_dispatch_backward(float const *rows_grad,
+                                   int const *exp_assign,
+                                   float *input_grad,
+                                   int n,
+                                   int k,
+                                   int capacity,
+                                   int batch_size,
+                                   int data_dim) {
+  std::vector<int> slots(k * batch_size), counts(n);
+  cpu_compute_expert_slots(
+      exp_assign, k * batch_size, n, capacity, slots.data(), counts.data());
+  for (int i = 0; i < k * batch_size; i++) {
+    if (slots[i] < 0) {
+      continue;
+    }
+    float const *row_grad =
+        rows_grad + ((size_t)exp_assign[i] * capacity + slots[i]) * data_dim;
+    for (int d = 0; d < data_dim; d++) {
+      input_grad[(i / k) * data_dim + d] += row_grad[d];
+    }
+  }
+}
+
+// Writes act(W_e^T x + b_e) of local expert e to y
+static void cpu_expert_row(float const *x,
+                           float const *kernel,
+                           float const *bias,
+                           ActiMode activation,
+                           int e,
+                           int data_dim,
+                           int out_dim,
+                           float *y) {
+  float const *w = kernel + (size_t)e * data_dim * out_dim;
+  for (int c = 0; c < out_dim; c++) {
+    float sum = bias != nullptr ? bias[e * out_dim + c] : 0.0f;
+    for (int d = 0; d < data_dim; d++) {
+      sum += w[c * data_dim + d] * x[d];
+    }
+    y[c] = activate(activation, sum);
+  }
+}
+
+// Writes the softmax of the out_dim activations a to y
+static void cpu_softmax_row(float const *a, int out_dim, float *y) {
+  float max_value = *std::max_element(a, a + out_dim);
+  float sum = 0.0f;
+  for (int c = 0; c < out_dim; c++) {
+    y[c] = expf(a[c] - max_value);
+    sum += y[c];
+  }
+  for (int c = 0; c < out_dim; c++) {
+    y[c] /= sum;
+  }
+}
+
+void cpu_experts_compute(float const *rows,
+                         float const *kernel,
+                         float const *bias,
+                         float *outputs,
+                         ActiMode activation,
+                         int num_local,
+                         int num_rows,
+                         int data_dim,
+                         int out_dim) {
+  std::vector<float> a(out_dim);
+  for (int e = 0; e < num_local; e++) {
+    for (int r = 0; r < num_rows; r++) {
+      size_t row = (size_t)e * num_rows + r;
+      cpu_expert_row(rows + row * data_dim,
+                     kernel,
+                     bias,
+                     activation,
+                     e,
+                     data_dim,
+                     out_dim,
+                     a.data());
+      cpu_softmax_row(a.data(), out_dim, outputs + row * out_dim);
+    }
+  }
+}
+
+void cpu_experts_compute_backward(float const *rows,
+                                  float const *kernel,
+                                  float const *bias,
+                                  float const *outputs_grad,
+                                  float *rows_grad,
+                                  float *kernel_grad,
+                                  float *bias_grad,
+                                  ActiMode activation,
+                                  int num_local,
+                                  int num_rows,
+                                  int data_dim,
+                                  int out_dim) {
+  std::vector<float> a(out_dim), y(out_dim), dy(out_dim);
+  for (int e = 0; e < num_local; e++) {
+    float const *w = kernel + (size_t)e * data_dim * out_dim;
+    float *w_grad = kernel_grad + (size_t)e * data_dim * out_dim;
+    for (int r = 0; r < num_rows; r++) {
+      size_t row = (size_t)e * num_rows + r;
+      float const *x = rows + row * data_dim;
+      float *x_grad = rows_grad + row * data_dim;
+      float const *y_grad = outputs_grad + row * out_dim;
+      cpu_expert_row(
+          x, kernel, bias, activation, e, data_dim, out_dim, a.data());
+      cpu_softmax_row(a.data(), out_dim, y.data());
+      // Through the softmax, then the activation
+      float dot = 0.0f;
+      for (int c = 0; c < out_dim; c++) {
+        dot += y_grad[c] * y[c];
+      }
+      for (int c = 0; c < out_dim; c++) {
+        dy[c] = y[c] * (y_grad[c] - dot) * activation_grad(activation, a[c]);
+      }
+      memset(x_grad, 0, data_dim * sizeof(float));
+      for (int c = 0; c < out_dim; c++) {
+        for (int d = 0; d < data_dim; d++) {
+          w_grad[c * data_dim + d] += dy[c] * x[d];
+          x_grad[d] += w[c * data_dim + d] * dy[c];
+        }
+        if (bias_grad != nullptr) {
+          bias_grad[e * out_dim + c] += dy[c];
+        }
+      }
+    }
+  }
+}
+
+void cpu_experts_combine(float const *outputs,
+                         int const *exp_assign,
+                         float const *gate_preds,
+                         float *output,
+                         int n,
+                         int k,
+                         int capacity,
+                         int batch_size,
+                         int out_dim) {
+  std::vector<int> slots(k * batch_size), counts(n);
+  cpu_compute_expert_slots(
+      exp_assign, k * batch_size, n, capacity, slots.data(), counts.data());
+  memset(output, 0, batch_size * out_dim * sizeof(float));
+  for (int i = 0; i < k * batch_size; i++) {
+    if (slots[i] < 0) {
+      continue;
+    }
+    float const *y =
+        outputs + ((size_t)exp_assign[i] * capacity + slots[i]) * out_dim;
+    for (int c = 0; c < out_dim; c++) {
+      output[(i / k) * out_dim + c] += gate_preds[i] * y[c];
+    }
+  }
+}
+
+void cpu_experts_combine_backward(float const *outputs,
+                                  int const *exp_assign,
+                                  float const *gate_preds,
+                                  float const *output_grad,
+                                  float *outputs_grad,
+                                  float *full_gate_grads,
+                                  float lambda_bal,
+                                  int n,
+                                  int k,
+                                  int capacity,
+                                  int batch_size,
+                                  int out_dim) {
+  std::vector<int> slots(k * batch_size), counts(n);
+  cpu_compute_expert_slots(
+      exp_assign, k * batch_size, n, capacity, slots.data(), counts.data());
+  memset(outputs_grad, 0, (size_t)n * capacity * out_dim * sizeof(float));
+  for (int i = 0; i < k * batch_size; i++) {
+    if (slots[i] < 0) {
+      continue;
+    }
+    size_t row = (size_t)exp_assign[i] * capacity + slots[i];
+    float const *grad = output_grad + (i / k) * out_dim;
+    float dot = 0.0f;
+    for (int c = 0; c < out_dim; c++) {
+      dot += grad[c] * outputs[row * out_dim + c];
+      outputs_grad[row * out_dim + c] = gate_preds[i] * grad[c];
+    }
+    full_gate_grads[(i / k) * n + exp_assign[i]] += dot;
+  }
+  cpu_balance_gate_grads(
+      full_gate_grads, counts.data(), n, lambda_bal, batch_size);
+}
+
+void cpu_experts_forward(float const *input,
+                         int const *exp_assign,
+                         float const *gate_preds,
+                         float const *kernel,
+                         float const *bias,
+                         float *output,
+                         ActiMode activation,
+                         int n,
+                         int k,
+                         int capacity,
+                         int batch_size,
+                         int data_dim,
+                         int out_dim) {
+  std::vector<float> rows((size_t)n * capacity * data_dim);
+  std::vector<float> outputs((size_t)n * capacity * out_dim);
+  cpu_experts_dispatch(
+      input, exp_assign, rows.data(), n, k, capacity, batch_size, data_dim);
+  cpu_experts_compute(rows.data(),
+                      kernel,
+                      bias,
+                      outputs.data(),
+                      activation,
+                      n,
+                      capacity,
+                      data_dim,
+                      out_dim);
+  cpu_experts_combine(outputs.data(),
+                      exp_assign,
+                      gate_preds,
+                      output,
+                      n,
+                      k,
+                      capacity,
+                      batch_size,
+                      out_dim);
+}
+
+void cpu_experts_backward(float const *input,
+                          float *input_grad,
+                          int const *exp_assign,
+                          float const *gate_preds,
+                          float *full_gate_grads,
+                          float const *kernel,
+                          float *kernel_grad,
+                          float const *bias,
+                          float *bias_grad,
+                          float const *output_grad,
+                          ActiMode activation,
+                          float lambda_bal,
+                          int n,
+                          int k,
+                          int capacity,
+                          int batch_size,
+                          int data_dim,
+                          int out_dim) {
+  std::vector<float> rows((size_t)n * capacity * data_dim);
+  std::vector<float> rows_grad(rows.size());
+  std::vector<float> outputs((size_t)n * capacity * out_dim);
+  std::vector<float> outputs_grad(outputs.size());
+  cpu_experts_dispatch(
+      input, exp_assign, rows.data(), n, k, capacity, batch_size, data_dim);
+  cpu_experts_compute(rows.data(),
+                      kernel,
+                      bias,
+                      outputs.data(),
+                      activation,
+                      n,
+                      capacity,
+                      data_dim,
+                      out_dim);
+  cpu_experts_combine_backward(outputs.data(),
+                               exp_assign,
+                               gate_preds,
+                               output_grad,
+                               outputs_grad.data(),
+                               full_gate_grads,
+                               lambda_bal,
+                               n,
+                               k,
+                               capacity,
+                               batch_size,
+                               out_dim);
+  cpu_experts_compute_backward(rows.data(),
+                               kernel,
+                               bias,
+                               outputs_grad.data(),
+                               rows_grad.data(),
+                               kernel_grad,
+                               bias_grad,
+                               activation,
+                               n,
+                               capacity,
+                               data_dim,
+                               out_dim);
+  cpu_experts_dispatch_backward(rows_grad.data(),
+                                exp_assign,
+                                input_grad,
+                                n,
+                                k,
+                                capacity,
+                                batch_size,
+                                data_dim);
+}
+
+} // namespace MoeDispatch
+} // namespace Kernels
+} // namespace FlexFlow
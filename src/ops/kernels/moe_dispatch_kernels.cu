@@ -0,0 +1,189 @@
+/* Copyright 2023 CMU, Facebook, LANL, MIT, NVIDIA, and Stanford (alphabetical)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "flexflow/ops/kernels/moe_dispatch_kernels.h"
+#include "flexflow/utils/cuda_helper.h"
+#include <vector>
+
+namespace FlexFlow {
+namespace Kernels {
+namespace MoeDispatch {
+
+static int num_dispatch_blocks(int num_assignments) {
+  return (num_assignments + DISPATCH_BLOCK_SIZE - 1) / DISPATCH_BLOCK_SIZE;
+}
+
+size_t dispatch_buffers_size(int num_assignments, int n) {
+  size_t num_ints =
+      num_assignments + n + (size_t)n * num_dispatch_blocks(num_assignments);
+  return num_ints * sizeof(int);
+}
+
+DispatchBuffers
+    get_dispatch_buffers(void *workspace, int num_assignments, int n) {
+  DispatchBuffers buffers;
+  buffers.slots = (int *)workspace;
+  buffers.expert_counts = buffers.slots + num_assignments;
+  buffers.block_offsets = buffers.expert_counts + n;
+  return buffers;
+}
+
+DispatchBuffers
+    get_dispatch_buffers(OpMeta const *m, int num_assignments, int n) {
+  assert(dispatch_buffers_size(num_assignments, n) <=
+         m->handle.workSpaceSize);
+  return get_dispatch_buffers(m->handle.workSpace, num_assignments, n);
+}
+
+// block_offsets[b * n + e] = the number of assignments to expert e in block b
+__global__ void dispatch_histogram_kernel(int const *exp_assign,
+                                          int num_assignments,
+                                          int n,
+                                          int *block_offsets) {
+  extern __shared__ int histogram[];
+  for (int e = threadIdx.x; e < n; e += blockDim.x) {
+    histogram[e] = 0;
+  }
+  __syncthreads();
+  int i = blockIdx.x * DISPATCH_BLOCK_SIZE + threadIdx.x;
+  if (i < num_assignments) {
+    atomicAdd(histogram + exp_assign[i], 1);
+  }
+  __syncthreads();
+  for (int e = threadIdx.x; e < n; e += blockDim.x) {
+    block_offsets[blockIdx.x * n + e] = histogram[e];
+  }
+}
+
+// Turns the histograms into exclusive prefix sums over the blocks, one thread
+// per expert
+__global__ void dispatch_scan_kernel(int num_blocks,
+                                     int n,
+                                     int *block_offsets,
+                                     int *expert_counts) {
+  CUDA_KERNEL_LOOP(e, n) {
+    int sum = 0;
+    for (int b = 0; b < num_blocks; b++) {
+      int count = block_offsets[b * n + e];
+      block_offsets[b * n + e] = sum;
+      sum += count;
+    }
+    expert_counts[e] = sum;
+  }
+}
+
+__global__ void dispatch_rank_kernel(int const *exp_assign,
+                                     int num_assignments,
+                                     int n,
+                                     int capacity,
+                                     int const *block_offsets,
+                                     int *slots) {
+  __shared__ int block_assign[DISPATCH_BLOCK_SIZE];
+  int i = blockIdx.x * DISPATCH_BLOCK_SIZE + threadIdx.x;
+  int expert = i < num_assignments ? exp_assign[i] : -1;
+  block_assign[threadIdx.x] = expert;
+  __syncthreads();
+  if (i < num_assignments) {
+    int rank = 0;
+    for (int j = 0; j < threadIdx.x; j++) {
+      rank += (block_assign[j] == expert);
+    }
+    int slot = block_offsets[blockIdx.x * n + expert] + rank;
+    slots[i] = slot < capacity ? slot : -1;
+  }
+}
+
+void compute_expert_slots(int const *exp_assign,
+                          int num_assignments,
+                          int n,
+                          int capacity,
+                          DispatchBuffers const &buffers,
+                          cudaStream_t stream) {
+  int num_blocks = num_dispatch_blocks(num_assignments);
+  dispatch_histogram_kernel<<<num_blocks,
+                              DISPATCH_BLOCK_SIZE,
+                              n * sizeof(int),
+                              stream>>>(
+      exp_assign, num_assignments, n, buffers.block_offsets);
+  dispatch_scan_kernel<<<GET_BLOCKS(n), min(CUDA_NUM_THREADS, n), 0, stream>>>(
+      num_blocks, n, buffers.block_offsets, buffers.expert_counts);
+  dispatch_rank_kernel<<<num_blocks, DISPATCH_BLOCK_SIZE, 0, stream>>>(
+      exp_assign,
+      num_assignments,
+      n,
+      capacity,
+      buffers.block_offsets,
+      buffers.slots);
+}
+
+// One thread per token
+__global__ void balance_gate_grads_kernel(float *full_gate_grads,
+                                          int const *expert_counts,
+                                          int n,
+                                          float scale,
+                                          int batch_size) {
+  CUDA_KERNEL_LOOP(b, batch_size) {
+    float *row = full_gate_grads + b * n;
+    float mean = 0.0f;
+    for (int e = 0; e < n; e++) {
+      row[e] += scale * expert_counts[e];
+      mean += row[e];
+    }
+    mean /= n;
+    for (int e = 0; e < n; e++) {
+      row[e] -= mean;
+    }
+  }
+}
+
+void balance_gate_grads(float *full_gate_grads,
+                        int const *expert_counts,
+                        int n,
+                        float lambda_bal,
+                        int batch_size,
+                        cudaStream_t stream) {
+  balance_gate_grads_kernel<<<GET_BLOCKS(batch_size),
+                              min(CUDA_NUM_THREADS, batch_size),
+                              0,
+                              stream>>>(full_gate_grads,
+                                        expert_counts,
+                                        n,
+                                        (lambda_bal * n) / batch_size,
+                                        batch_size);
+}
+
+void report_dropped(char const *op_name,
+                    DispatchBuffers const &buffers,
+                    int num_assignments,
+                    int n,
+                    int capacity,
+                    cudaStream_t stream) {
+  std::vector<int> expert_counts(n);
+  checkCUDA(cudaMemcpyAsync(expert_counts.data(),
+                            buffers.expert_counts,
+                            n * sizeof(int),
+                            cudaMemcpyDeviceToHost,
+                            stream));
+  checkCUDA(cudaStreamSynchronize(stream));
+  printf("[%s] dropped %d of %d assignments (capacity %d per expert)\n",
+         op_name,
+         num_dropped(expert_counts.data(), n, capacity),
+         num_assignments,
+         capacity);
+}
+
+} // namespace MoeDispatch
+} // namespace Kernels
+} // namespace FlexFlow
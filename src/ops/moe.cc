@@ -27,18 +27,17 @@ Tensor FFModel::moe(const Tensor input,
   Tensor gate_preds = dense(input, num_exp, AC_MODE_RELU);
   Tensor topK_output[2];
   top_k(gate_preds, topK_output, num_select, false);
-  Tensor exp_tensors[num_exp];
-  group_by(input, topK_output[1], exp_tensors, num_exp, alpha);
-  Tensor agg_inputs[num_exp + 4];
-  agg_inputs[0] = softmax(topK_output[0]); // gate preds
-  agg_inputs[1] = topK_output[1];          // gate assign
-  agg_inputs[2] = topK_output[1];          // gate assign TopK (for cache)
-  agg_inputs[3] = gate_preds;              // full gate preds
-  for (int i = 0; i < num_exp; i++) {
-    Tensor exp_pred = dense(exp_tensors[i], expert_hidden_size, AC_MODE_RELU);
-    agg_inputs[i + 4] = softmax(exp_pred);
-  }
-  Tensor coop_output = aggregate(agg_inputs, num_exp, lambda);
+  // All experts run as a single operator, whose experts the search can
+  // distribute over the batch shards (see create_partition_experts_combine)
+  Tensor exp_output = experts(input,
+                              topK_output[1],          // gate assign
+                              softmax(topK_output[0]), // gate preds
+                              gate_preds,              // full gate preds
+                              num_exp,
+                              expert_hidden_size,
+                              alpha,
+                              lambda,
+                              AC_MODE_RELU);
   // get_metrics();
-  return coop_output;
+  return exp_output;
 }
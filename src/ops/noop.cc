@@ -199,6 +199,7 @@ using PCG::Node;
 Node FFModel::get_or_create_noop_node(const ParallelTensor input) {
   size_t hash = input->get_owner_independent_hash();
   NoOp *noop = NULL;
+  std::lock_guard<std::mutex> lock(op_cache_mutex);
   auto const &it = cached_noop_ops.find(hash);
   if (it != cached_noop_ops.end()) {
     noop = it->second;
@@ -216,6 +217,7 @@ Node FFModel::get_or_create_input_node(
     ParallelTensorShape const &output_shape) {
   size_t hash = std::hash<ParallelTensorShape>{}(output_shape);
   NoOp *input = NULL;
+  std::lock_guard<std::mutex> lock(op_cache_mutex);
   auto const &it = cached_input_ops.find(hash);
   if (it != cached_input_ops.end()) {
     input = it->second;
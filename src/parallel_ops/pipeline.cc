@@ -0,0 +1,295 @@
+/* Copyright 2023 CMU, Facebook, LANL, MIT, NVIDIA, and Stanford (alphabetical)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "flexflow/parallel_ops/pipeline.h"
+#include "flexflow/model.h"
+#include "flexflow/parallel_ops/kernels/pipeline_kernels.h"
+#include "flexflow/utils/hash_utils.h"
+
+namespace FlexFlow {
+// declare Legion names
+using Legion::ArgumentMap;
+using Legion::Context;
+using Legion::coord_t;
+using Legion::Domain;
+using Legion::FutureMap;
+using Legion::IndexLauncher;
+using Legion::LogicalPartition;
+using Legion::LogicalRegion;
+using Legion::Machine;
+using Legion::Memory;
+using Legion::PhysicalRegion;
+using Legion::Predicate;
+using Legion::Rect;
+using Legion::RegionRequirement;
+using Legion::Runtime;
+using Legion::Task;
+using Legion::TaskArgument;
+using Legion::TaskLauncher;
+
+using namespace FlexFlow::Kernels::Pipeline;
+
+/* Params */
+bool operator==(PipelineParams const &lhs, PipelineParams const &rhs) {
+  return lhs.pipeline_legion_dim == rhs.pipeline_legion_dim &&
+         lhs.pipeline_degree == rhs.pipeline_degree;
+}
+
+bool PipelineParams::is_valid(ParallelTensorShape const &input) const {
+  if (!input.is_valid()) {
+    return false;
+  }
+  // every part must split evenly into micro-batches
+  ParallelDim const &dim = input.dims[pipeline_legion_dim];
+  return pipeline_degree > 0 && (dim.size / dim.degree) % pipeline_degree == 0;
+}
+
+PipelineParams Pipeline::get_params() const {
+  PipelineParams params;
+  params.pipeline_legion_dim = this->pipeline_dim;
+  params.pipeline_degree = this->pipeline_degree;
+  return params;
+}
+
+Pipeline::Pipeline(FFModel &model,
+                   const ParallelTensor _input,
+                   int _pipeline_legion_dim,
+                   int _pipeline_degree,
+                   char const *name)
+    : ParallelOp(model, OP_PIPELINE, name, _input),
+      pipeline_dim(_pipeline_legion_dim), pipeline_degree(_pipeline_degree) {
+  int numdim = _input->num_dims;
+  ParallelDim dims[MAX_TENSOR_DIM];
+  for (int i = 0; i < numdim; i++) {
+    dims[i] = _input->dims[i];
+  }
+  // the output only differs from the input in its machine view
+  ParallelDim const &dim = dims[pipeline_dim];
+  assert((dim.size / dim.degree) % pipeline_degree == 0);
+  outputs[0] = model.create_parallel_tensor_legion_ordering(
+      numdim, dims, _input->data_type, this);
+}
+
+Pipeline::Pipeline(FFModel &model,
+                   PipelineParams const &params,
+                   ParallelTensor const input,
+                   char const *name)
+    : Pipeline(model,
+               input,
+               params.pipeline_legion_dim,
+               params.pipeline_degree,
+               name) {}
+
+void Pipeline::create_input_partition(FFModel &ff) {
+  assert(outputs[0]->part != LogicalPartition::NO_PART);
+  assert(inputs[0]->part != LogicalPartition::NO_PART);
+  micro_batch_input_lps.resize(pipeline_degree);
+  micro_batch_output_lps.resize(pipeline_degree);
+  micro_batch_input_grad_lps.resize(pipeline_degree);
+  micro_batch_output_grad_lps.resize(pipeline_degree);
+  for (int i = 0; i < pipeline_degree; i++) {
+    ff.create_micro_batch_partition(outputs[0]->num_dims,
+                                    outputs[0]->dims,
+                                    pipeline_dim,
+                                    pipeline_degree,
+                                    i,
+                                    outputs[0]->parallel_is,
+                                    inputs[0]->region,
+                                    micro_batch_input_lps[i]);
+    ff.create_micro_batch_partition(outputs[0]->num_dims,
+                                    outputs[0]->dims,
+                                    pipeline_dim,
+                                    pipeline_degree,
+                                    i,
+                                    outputs[0]->parallel_is,
+                                    outputs[0]->region,
+                                    micro_batch_output_lps[i]);
+    ff.create_micro_batch_partition(outputs[0]->num_dims,
+                                    outputs[0]->dims,
+                                    pipeline_dim,
+                                    pipeline_degree,
+                                    i,
+                                    outputs[0]->parallel_is,
+                                    inputs[0]->region_grad,
+                                    micro_batch_input_grad_lps[i]);
+    ff.create_micro_batch_partition(outputs[0]->num_dims,
+                                    outputs[0]->dims,
+                                    pipeline_dim,
+                                    pipeline_degree,
+                                    i,
+                                    outputs[0]->parallel_is,
+                                    outputs[0]->region_grad,
+                                    micro_batch_output_grad_lps[i]);
+  }
+}
+
+void Pipeline::init(FFModel const &ff) {
+  // Do nothing
+}
+
+void Pipeline::forward(FFModel const &ff) {
+  ArgumentMap argmap;
+  Context ctx = ff.config.lg_ctx;
+  Runtime *runtime = ff.config.lg_hlr;
+  assert(numOutputs == 1);
+  assert(numInputs == 1);
+  // The launches are mapped to the next stage, which can start on a
+  // micro-batch as soon as it has been copied
+  for (int i = 0; i < pipeline_degree; i++) {
+    IndexLauncher launcher(PIPELINE_FWD_TASK_ID,
+                           outputs[0]->parallel_is,
+                           TaskArgument(NULL, 0),
+                           argmap,
+                           Predicate::TRUE_PRED,
+                           false /*must*/,
+                           0 /*mapper_id*/,
+                           outputs[0]->machine_view.hash());
+    launcher.add_region_requirement(
+        RegionRequirement(micro_batch_input_lps[i],
+                          0 /*projection id*/,
+                          READ_ONLY,
+                          EXCLUSIVE,
+                          inputs[0]->region));
+    launcher.add_field(0, FID_DATA);
+    launcher.add_region_requirement(
+        RegionRequirement(micro_batch_output_lps[i],
+                          0 /*projection id*/,
+                          WRITE_ONLY,
+                          EXCLUSIVE,
+                          outputs[0]->region));
+    launcher.add_field(1, FID_DATA);
+    runtime->execute_index_space(ctx, launcher);
+  }
+}
+
+void Pipeline::backward(FFModel const &ff) {
+  ArgumentMap argmap;
+  Context ctx = ff.config.lg_ctx;
+  Runtime *runtime = ff.config.lg_hlr;
+  assert(numOutputs == 1);
+  assert(numInputs == 1);
+  // The micro-batches go back in the order they came, as in a 1F1B
+  // schedule, and the launches are mapped to the previous stage
+  for (int i = 0; i < pipeline_degree; i++) {
+    IndexLauncher launcher(PIPELINE_BWD_TASK_ID,
+                           outputs[0]->parallel_is,
+                           TaskArgument(NULL, 0),
+                           argmap,
+                           Predicate::TRUE_PRED,
+                           false /*must*/,
+                           0 /*mapper_id*/,
+                           inputs[0]->machine_view.hash());
+    launcher.add_region_requirement(
+        RegionRequirement(micro_batch_output_grad_lps[i],
+                          0 /*projection id*/,
+                          READ_ONLY,
+                          EXCLUSIVE,
+                          outputs[0]->region_grad));
+    launcher.add_field(0, FID_DATA);
+    launcher.add_region_requirement(
+        RegionRequirement(micro_batch_input_grad_lps[i],
+                          0 /*projection id*/,
+                          READ_WRITE,
+                          EXCLUSIVE,
+                          inputs[0]->region_grad));
+    launcher.add_field(1, FID_DATA);
+    runtime->execute_index_space(ctx, launcher);
+  }
+}
+
+bool Pipeline::measure_operator_cost(Simulator *sim,
+                                     MachineView const &pc,
+                                     CostMetrics &cost_metrics) const {
+  // The transfer between the stages is costed by
+  // Simulator::estimate_xfer_cost
+  cost_metrics = CostMetrics();
+  cost_metrics.forward_time = 0.0f;
+  cost_metrics.backward_time = 0.0f;
+  return true;
+}
+
+bool Pipeline::get_int_parameter(PMParameter para, int *value) const {
+  switch (para) {
+    case PM_PIPELINE_DIM:
+      *value = pipeline_dim;
+      return true;
+    case PM_PIPELINE_DEGREE:
+      *value = pipeline_degree;
+      return true;
+    default:
+      return Op::get_int_parameter(para, value);
+  }
+}
+
+bool Pipeline::append_parallel_op_info(
+    std::vector<ParallelOpInfo> &parallel_ops) const {
+  ParallelOpInfo ret;
+  ret.op_type = op_type;
+  ret.parallel_dim = pipeline_dim;
+  ret.parallel_degree = pipeline_degree;
+  parallel_ops.push_back(ret);
+  return true;
+}
+
+void Pipeline::forward_task(Task const *task,
+                            std::vector<PhysicalRegion> const &regions,
+                            Context ctx,
+                            Runtime *runtime) {
+  assert(regions.size() == 2);
+  assert(task->regions.size() == 2);
+  Domain input_domain = runtime->get_index_space_domain(
+      ctx, task->regions[0].region.get_index_space());
+  Domain output_domain = runtime->get_index_space_domain(
+      ctx, task->regions[1].region.get_index_space());
+  assert(input_domain == output_domain);
+  float const *input_ptr = helperGetTensorPointerRO<float>(
+      regions[0], task->regions[0], FID_DATA, ctx, runtime);
+  float *output_ptr = helperGetTensorPointerWO<float>(
+      regions[1], task->regions[1], FID_DATA, ctx, runtime);
+
+  forward_kernel<float>(input_ptr, output_ptr, input_domain.get_volume());
+}
+
+void Pipeline::backward_task(Task const *task,
+                             std::vector<PhysicalRegion> const &regions,
+                             Context ctx,
+                             Runtime *runtime) {
+  assert(regions.size() == 2);
+  assert(task->regions.size() == 2);
+  Domain output_grad_domain = runtime->get_index_space_domain(
+      ctx, task->regions[0].region.get_index_space());
+  Domain input_grad_domain = runtime->get_index_space_domain(
+      ctx, task->regions[1].region.get_index_space());
+  assert(output_grad_domain == input_grad_domain);
+  float const *output_grad_ptr = helperGetTensorPointerRO<float>(
+      regions[0], task->regions[0], FID_DATA, ctx, runtime);
+  float *input_grad_ptr = helperGetTensorPointerRW<float>(
+      regions[1], task->regions[1], FID_DATA, ctx, runtime);
+
+  backward_kernel<float>(
+      output_grad_ptr, input_grad_ptr, input_grad_domain.get_volume());
+}
+
+}; // namespace FlexFlow
+
+namespace std {
+size_t hash<FlexFlow::PipelineParams>::operator()(
+    FlexFlow::PipelineParams const &params) const {
+  size_t key = 0;
+  hash_combine(key, params.pipeline_legion_dim);
+  hash_combine(key, params.pipeline_degree);
+  return key;
+}
+}; // namespace std
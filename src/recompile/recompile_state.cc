@@ -14,27 +14,204 @@
  */
 
 #include "flexflow/model.h"
+#include "flexflow/ops/experts.h"
 #include "flexflow/recompile.h"
 #include "legion.h"
+#include <algorithm>
 
 namespace FlexFlow {
 
+using Legion::Future;
+
+LegionRuntime::Logger::Category log_replan("replan");
+
 RecompileState::RecompileState(std::function<bool(FFModel *)> _trigger_func,
                                std::function<void(FFModel *)> _alter_func,
                                FFModel *_ff)
-    : trigger_func(_trigger_func), alter_func(_alter_func), ff(_ff) {
+    : trigger_func(_trigger_func), alter_func(_alter_func), ff(_ff),
+      load_aware(false), iterations(0) {
+  recompilations = 0;
+}
+
+RecompileState::RecompileState(FFModel *_ff, ReplanConfig const &_config)
+    : ff(_ff), load_aware(true), config(_config), iterations(0) {
+  assert(config.measure_interval > 0);
   recompilations = 0;
 }
 
 bool RecompileState::trigger() {
+  if (load_aware) {
+    return replan_trigger();
+  }
   return trigger_func(ff);
 }
 
 void RecompileState::alter() {
-  if (recompilations == 0) {
+  if (load_aware) {
+    replan_alter();
+  } else if (recompilations == 0) {
     alter_func(ff);
   }
   recompilations++;
 }
 
+bool RecompileState::replan_trigger() {
+  if (!ff->collect_runtime_stats) {
+    iterations++;
+    if (iterations % config.measure_interval == 0 &&
+        recompilations < config.max_recompilations) {
+      // Measure the next iteration
+      ff->measured_forward_times.clear();
+      ff->collect_runtime_stats = true;
+    }
+    return false;
+  }
+  ff->collect_runtime_stats = false;
+  new_alphas.clear();
+  new_views.clear();
+  plan_expert_capacities();
+  plan_placements();
+  return !new_alphas.empty() || !new_views.empty();
+}
+
+void RecompileState::plan_expert_capacities() {
+  for (Op *op : ff->operators) {
+    if (op->op_type != OP_EXPERTS) {
+      continue;
+    }
+    Experts *experts = (Experts *)op;
+    if (experts->load_futures.empty()) {
+      continue;
+    }
+    int n = experts->num_experts;
+    std::vector<double> counts(n, 0.0);
+    double max_share = 0.0;
+    int dropped = 0;
+    float max_alpha = config.max_expert_alpha;
+    for (Future const &future : experts->load_futures) {
+      ExpertsLoad load = future.get_result<ExpertsLoad>();
+      assert(load.num_experts == n);
+      if (load.num_assignments == 0) {
+        continue;
+      }
+      for (int e = 0; e < n; e++) {
+        counts[e] += load.counts[e];
+        max_share =
+            std::max(max_share, (double)load.counts[e] / load.num_assignments);
+      }
+      dropped += load.dropped;
+      // The capacity may not outgrow the work space of any device
+      max_alpha = std::min(
+          max_alpha, (float)load.max_capacity * n / load.num_assignments);
+    }
+    experts->load_futures.clear();
+    if (max_alpha < 1.0f) {
+      continue;
+    }
+    double imbalance = load_imbalance(counts);
+    float alpha =
+        replan_expert_alpha(max_share, n, config.expert_headroom, max_alpha);
+    // Grow the capacity when an imbalanced load drops tokens, and shrink it
+    // once the load has balanced out, since every expert computes on its
+    // whole capacity
+    bool grow = dropped > 0 && imbalance > config.expert_imbalance_threshold &&
+                alpha > experts->alpha;
+    bool shrink = dropped == 0 &&
+                  alpha * config.expert_imbalance_threshold < experts->alpha;
+    if (grow || shrink) {
+      log_replan.print("%s: imbalance %.2lf, %d dropped, alpha %.2f -> %.2f",
+                       experts->name,
+                       imbalance,
+                       dropped,
+                       experts->alpha,
+                       alpha);
+      new_alphas.push_back(std::make_pair(op, alpha));
+    }
+  }
+}
+
+void RecompileState::plan_placements() {
+  int num_devices = ff->config.numNodes * ff->config.workersPerNode;
+  std::vector<Op *> ops;
+  std::vector<PlacementChoice> choices;
+  std::vector<std::vector<MachineView>> views;
+  for (Op *op : ff->operators) {
+    auto const &it = ff->measured_forward_times.find(op->op_guid);
+    if (it == ff->measured_forward_times.end()) {
+      continue;
+    }
+    PlacementChoice choice;
+    choice.time = it->second;
+    choice.current = -1;
+    std::vector<MachineView> op_views;
+    MachineView current = op->outputs[0]->machine_view;
+    // Input, weight, parallel and fused operators stay where they are, as do
+    // those that keep state in their metas (e.g. the running statistics of a
+    // batch norm), but their time still counts on their devices
+    bool movable = op->op_type != OP_INPUT && op->op_type != OP_WEIGHT &&
+                   op->op_type != OP_FUSED && op->op_type != OP_BATCHNORM &&
+                   op->op_type != OP_CACHE && !op->is_parallel_op() &&
+                   current.device_type == MachineView::GPU;
+    // The mapper only knows the views at the starts the search can produce
+    std::vector<int> starts = get_machine_view_starts(
+        current, ff->config.numNodes, ff->config.workersPerNode);
+    for (int start : starts) {
+      MachineView view = current;
+      view.start_device_id = start;
+      if (!movable && start != current.start_device_id) {
+        continue;
+      }
+      if (start == current.start_device_id) {
+        choice.current = op_views.size();
+      }
+      choice.candidates.push_back(view.device_ids());
+      op_views.push_back(view);
+    }
+    if (choice.current < 0) {
+      continue;
+    }
+    ops.push_back(op);
+    choices.push_back(choice);
+    views.push_back(op_views);
+  }
+  std::vector<int> current(choices.size());
+  for (size_t i = 0; i < choices.size(); i++) {
+    current[i] = choices[i].current;
+  }
+  double imbalance =
+      load_imbalance(device_loads(choices, current, num_devices));
+  if (imbalance <= config.device_imbalance_threshold) {
+    return;
+  }
+  std::vector<int> choice =
+      rebalance_placements(choices, num_devices, config.search_budget);
+  double new_imbalance =
+      load_imbalance(device_loads(choices, choice, num_devices));
+  for (size_t i = 0; i < choices.size(); i++) {
+    if (choice[i] != choices[i].current) {
+      new_views.push_back(std::make_pair(ops[i], views[i][choice[i]]));
+    }
+  }
+  if (!new_views.empty()) {
+    log_replan.print("moving %zu operators, device imbalance %.2lf -> %.2lf",
+                     new_views.size(),
+                     imbalance,
+                     new_imbalance);
+  }
+}
+
+void RecompileState::replan_alter() {
+  for (auto const &it : new_views) {
+    ff->migrate_operator(it.first, it.second);
+  }
+  for (auto const &it : new_alphas) {
+    ((Experts *)it.first)->set_alpha(*ff, it.second);
+  }
+  if (!new_views.empty() && ff->config.computationMode == COMP_MODE_TRAINING) {
+    ff->optimizer->create_gradient_buckets();
+  }
+  new_alphas.clear();
+  new_views.clear();
+}
+
 }; // namespace FlexFlow
@@ -0,0 +1,109 @@
+/* Copyright 2023 CMU, Facebook, LANL, MIT, NVIDIA, and Stanford (alphabetical)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "flexflow/replan.h"
+#include <algorithm>
+#include <cassert>
+#include <numeric>
+
+namespace FlexFlow {
+
+double load_imbalance(std::vector<double> const &load) {
+  if (load.empty()) {
+    return 1.0;
+  }
+  double total = std::accumulate(load.begin(), load.end(), 0.0);
+  if (total <= 0.0) {
+    return 1.0;
+  }
+  double max_load = *std::max_element(load.begin(), load.end());
+  return max_load * load.size() / total;
+}
+
+float replan_expert_alpha(double max_share,
+                          int num_experts,
+                          float headroom,
+                          float max_alpha) {
+  assert(num_experts > 0);
+  assert(max_alpha >= 1.0f);
+  float alpha = max_share * num_experts * headroom;
+  return std::min(std::max(alpha, 1.0f), max_alpha);
+}
+
+std::vector<double> device_loads(std::vector<PlacementChoice> const &ops,
+                                 std::vector<int> const &choice,
+                                 int num_devices) {
+  assert(ops.size() == choice.size());
+  std::vector<double> loads(num_devices, 0.0);
+  for (size_t i = 0; i < ops.size(); i++) {
+    for (int device : ops[i].candidates[choice[i]]) {
+      assert(device >= 0 && device < num_devices);
+      loads[device] += ops[i].time;
+    }
+  }
+  return loads;
+}
+
+std::vector<int> rebalance_placements(std::vector<PlacementChoice> const &ops,
+                                      int num_devices,
+                                      int budget) {
+  std::vector<int> choice(ops.size());
+  std::vector<size_t> order;
+  for (size_t i = 0; i < ops.size(); i++) {
+    assert(ops[i].current >= 0 &&
+           ops[i].current < (int)ops[i].candidates.size());
+    choice[i] = ops[i].current;
+    if (ops[i].candidates.size() > 1) {
+      order.push_back(i);
+    }
+  }
+  std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    return ops[a].time > ops[b].time;
+  });
+  if ((int)order.size() > budget) {
+    order.resize(std::max(budget, 0));
+  }
+  std::vector<double> loads = device_loads(ops, choice, num_devices);
+  for (size_t i : order) {
+    PlacementChoice const &op = ops[i];
+    for (int device : op.candidates[choice[i]]) {
+      loads[device] -= op.time;
+    }
+    // The busiest device of each candidate once the operator runs on it
+    auto busiest = [&](int c) {
+      double max_load = 0.0;
+      for (int device : op.candidates[c]) {
+        max_load = std::max(max_load, loads[device] + op.time);
+      }
+      return max_load;
+    };
+    int best = choice[i];
+    double best_load = busiest(best);
+    for (int c = 0; c < (int)op.candidates.size(); c++) {
+      double load = busiest(c);
+      if (load < best_load) {
+        best = c;
+        best_load = load;
+      }
+    }
+    choice[i] = best;
+    for (int device : op.candidates[best]) {
+      loads[device] += op.time;
+    }
+  }
+  return choice;
+}
+
+}; // namespace FlexFlow
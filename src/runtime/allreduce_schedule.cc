@@ -0,0 +1,323 @@
+#include "flexflow/allreduce_schedule.h"
+#include <algorithm>
+#include <cassert>
+#include <map>
+
+namespace FlexFlow {
+
+// Participants grouped by node, in order of first appearance
+static std::vector<std::vector<int>>
+    group_by_node(std::vector<int> const &node_ids) {
+  std::vector<std::vector<int>> groups;
+  std::map<int, size_t> group_of_node;
+  for (size_t i = 0; i < node_ids.size(); i++) {
+    auto const &it = group_of_node.find(node_ids[i]);
+    if (it == group_of_node.end()) {
+      group_of_node[node_ids[i]] = groups.size();
+      groups.push_back({(int)i});
+    } else {
+      groups[it->second].push_back((int)i);
+    }
+  }
+  return groups;
+}
+
+// Each member of ring sends bytes to its successor
+static void add_ring(std::vector<int> const &ring,
+                     double bytes,
+                     int dir,
+                     AllreduceStep &step) {
+  int n = ring.size();
+  if (n < 2) {
+    return;
+  }
+  for (int i = 0; i < n; i++) {
+    int next = ((i + dir) % n + n) % n;
+    step.transfers.push_back({ring[i], ring[next], bytes});
+  }
+}
+
+static void add_step(std::vector<AllreduceStep> &schedule,
+                     AllreduceStep const &step) {
+  if (!step.transfers.empty()) {
+    schedule.push_back(step);
+  }
+}
+
+static std::vector<AllreduceStep> ring_schedule(int n, double size, int dir) {
+  std::vector<int> ring(n);
+  for (int i = 0; i < n; i++) {
+    ring[i] = i;
+  }
+  // The reduce-scatter and all-gather are modeled as one step in which every
+  // link is busy, but their 2 (n - 1) sub-steps each pay a link latency
+  AllreduceStep step;
+  step.latency_hops = 2 * (n - 1);
+  add_ring(ring, 2.0 * (n - 1) * size / n, dir, step);
+  std::vector<AllreduceStep> schedule;
+  add_step(schedule, step);
+  return schedule;
+}
+
+// Intra-node reduce-scatter, reduction to a leader per node, a ring among
+// the leaders, then the same intra-node steps in reverse
+static std::vector<AllreduceStep>
+    hierarchical_ring_schedule(std::vector<std::vector<int>> const &nodes,
+                               double size) {
+  int m = nodes.size();
+  AllreduceStep reduce_scatter, gather, scatter, all_gather, inter;
+  std::vector<int> leaders;
+  for (std::vector<int> const &local : nodes) {
+    int k = local.size();
+    // the intra-node rings run side by side, the largest one finishing last
+    reduce_scatter.latency_hops = std::max(reduce_scatter.latency_hops, k - 1);
+    all_gather.latency_hops = std::max(all_gather.latency_hops, k - 1);
+    add_ring(local, (k - 1) * size / k, 1, reduce_scatter);
+    add_ring(local, (k - 1) * size / k, 1, all_gather);
+    for (int i = 1; i < k; i++) {
+      gather.transfers.push_back({local[i], local[0], size / k});
+      scatter.transfers.push_back({local[0], local[i], size / k});
+    }
+    leaders.push_back(local[0]);
+  }
+  inter.latency_hops = 2 * (m - 1);
+  add_ring(leaders, 2.0 * (m - 1) * size / m, 1, inter);
+  std::vector<AllreduceStep> schedule;
+  add_step(schedule, reduce_scatter);
+  add_step(schedule, gather);
+  add_step(schedule, inter);
+  add_step(schedule, scatter);
+  add_step(schedule, all_gather);
+  return schedule;
+}
+
+// Intra-node reduce-scatter, one inter-node ring per local rank on its shard
+// of the message, then an intra-node all-gather
+static std::vector<AllreduceStep>
+    torus_2d_schedule(std::vector<std::vector<int>> const &nodes,
+                      double size) {
+  int m = nodes.size();
+  int k = nodes[0].size();
+  AllreduceStep reduce_scatter, all_gather, inter;
+  reduce_scatter.latency_hops = all_gather.latency_hops = std::max(k - 1, 1);
+  inter.latency_hops = 2 * (m - 1);
+  for (std::vector<int> const &local : nodes) {
+    add_ring(local, (k - 1) * size / k, 1, reduce_scatter);
+    add_ring(local, (k - 1) * size / k, 1, all_gather);
+  }
+  for (int j = 0; j < k; j++) {
+    std::vector<int> column;
+    for (std::vector<int> const &local : nodes) {
+      column.push_back(local[j]);
+    }
+    add_ring(column, 2.0 * (m - 1) * size / m / k, 1, inter);
+  }
+  std::vector<AllreduceStep> schedule;
+  add_step(schedule, reduce_scatter);
+  add_step(schedule, inter);
+  add_step(schedule, all_gather);
+  return schedule;
+}
+
+// Two complementary binary trees each reduce and then broadcast half of the
+// message. Chunks are pipelined through the trees, so each phase is modeled
+// as one step in which every tree edge is busy, paying one latency per level.
+static std::vector<AllreduceStep> double_binary_tree_schedule(int n,
+                                                              double size) {
+  int depth = 0;
+  while ((2 << depth) <= n) {
+    depth++;
+  }
+  AllreduceStep reduce, broadcast;
+  reduce.latency_hops = broadcast.latency_hops = std::max(depth, 1);
+  for (int tree = 0; tree < 2; tree++) {
+    // the second tree uses the reversed order, so that most leaves of the
+    // first tree are interior nodes of the second one
+    auto rank = [&](int pos) { return tree == 0 ? pos : n - 1 - pos; };
+    for (int pos = 1; pos < n; pos++) {
+      int parent = (pos - 1) / 2;
+      reduce.transfers.push_back({rank(pos), rank(parent), size / 2});
+      broadcast.transfers.push_back({rank(parent), rank(pos), size / 2});
+    }
+  }
+  std::vector<AllreduceStep> schedule;
+  add_step(schedule, reduce);
+  add_step(schedule, broadcast);
+  return schedule;
+}
+
+// Rabenseifner's algorithm: recursive-halving reduce-scatter followed by a
+// recursive-doubling all-gather. Participants beyond the largest power of
+// two first fold their data into a partner and get the result back at the
+// end.
+static std::vector<AllreduceStep> halving_doubling_schedule(int n,
+                                                            double size) {
+  int p = 1;
+  while (p * 2 <= n) {
+    p *= 2;
+  }
+  std::vector<AllreduceStep> schedule;
+  AllreduceStep fold, unfold;
+  for (int r = p; r < n; r++) {
+    fold.transfers.push_back({r, r - p, size});
+    unfold.transfers.push_back({r - p, r, size});
+  }
+  add_step(schedule, fold);
+  std::vector<AllreduceStep> halving;
+  double bytes = size;
+  for (int distance = p / 2; distance >= 1; distance /= 2) {
+    bytes /= 2;
+    AllreduceStep step;
+    for (int r = 0; r < p; r++) {
+      step.transfers.push_back({r, r ^ distance, bytes});
+    }
+    halving.push_back(step);
+  }
+  for (AllreduceStep const &step : halving) {
+    add_step(schedule, step);
+  }
+  // the all-gather mirrors the reduce-scatter
+  for (auto it = halving.rbegin(); it != halving.rend(); it++) {
+    add_step(schedule, *it);
+  }
+  add_step(schedule, unfold);
+  return schedule;
+}
+
+std::vector<AllreduceStep>
+    get_allreduce_schedule(AllreduceAlgorithm algorithm,
+                           std::vector<int> const &node_ids,
+                           double message_size,
+                           int ring_dir) {
+  int n = node_ids.size();
+  if (n < 2) {
+    return {};
+  }
+  std::vector<std::vector<int>> nodes = group_by_node(node_ids);
+  switch (algorithm) {
+    case ALLREDUCE_RING:
+      return ring_schedule(n, message_size, ring_dir);
+    case ALLREDUCE_HIERARCHICAL_RING:
+      // with a single node, or a single participant per node, this is a
+      // flat ring
+      if (nodes.size() < 2 || (int)nodes.size() == n) {
+        return {};
+      }
+      return hierarchical_ring_schedule(nodes, message_size);
+    case ALLREDUCE_2D_TORUS: {
+      if (nodes.size() < 2 || (int)nodes.size() == n) {
+        return {};
+      }
+      for (std::vector<int> const &local : nodes) {
+        if (local.size() != nodes[0].size()) {
+          return {};
+        }
+      }
+      return torus_2d_schedule(nodes, message_size);
+    }
+    case ALLREDUCE_DOUBLE_BINARY_TREE:
+      return double_binary_tree_schedule(n, message_size);
+    case ALLREDUCE_HALVING_DOUBLING:
+      return halving_doubling_schedule(n, message_size);
+    default:
+      assert(false && "unknown allreduce algorithm");
+  }
+  return {};
+}
+
+std::vector<AllreduceStep> get_all_to_all_schedule(int num_participants,
+                                                   double message_size) {
+  AllreduceStep step;
+  for (int src = 0; src < num_participants; src++) {
+    for (int dst = 0; dst < num_participants; dst++) {
+      if (src != dst) {
+        step.transfers.push_back(
+            {src, dst, message_size / num_participants});
+      }
+    }
+  }
+  std::vector<AllreduceStep> schedule;
+  add_step(schedule, step);
+  return schedule;
+}
+
+float estimate_allreduce_time(std::vector<AllreduceStep> const &schedule,
+                              std::vector<int> const &node_ids,
+                              AllreduceLinkModel const &links) {
+  float total = 0.0f;
+  for (AllreduceStep const &step : schedule) {
+    // intra-node transfers are limited by the sending GPU and inter-node
+    // transfers by the network bandwidth of the sending node
+    std::map<int, double> intra_node_sends, inter_node_sends;
+    for (AllreduceTransfer const &t : step.transfers) {
+      if (node_ids[t.src] == node_ids[t.dst]) {
+        intra_node_sends[t.src] += t.bytes;
+      } else {
+        inter_node_sends[node_ids[t.src]] += t.bytes;
+      }
+    }
+    float step_time = 0.0f;
+    for (auto const &it : intra_node_sends) {
+      float time = step.latency_hops * links.intra_node_latency +
+                   it.second / links.intra_node_bandwidth;
+      step_time = std::max(step_time, time);
+    }
+    for (auto const &it : inter_node_sends) {
+      float time = step.latency_hops * links.inter_node_latency +
+                   it.second / links.inter_node_bandwidth;
+      step_time = std::max(step_time, time);
+    }
+    total += step_time;
+  }
+  return total;
+}
+
+AllreduceAlgorithm
+    select_allreduce_algorithm(std::vector<int> const &node_ids,
+                               double message_size,
+                               AllreduceLinkModel const &links) {
+  AllreduceAlgorithm const candidates[] = {ALLREDUCE_RING,
+                                           ALLREDUCE_HIERARCHICAL_RING,
+                                           ALLREDUCE_2D_TORUS,
+                                           ALLREDUCE_DOUBLE_BINARY_TREE,
+                                           ALLREDUCE_HALVING_DOUBLING};
+  AllreduceAlgorithm best = ALLREDUCE_RING;
+  float best_time = 0.0f;
+  bool found = false;
+  for (AllreduceAlgorithm algorithm : candidates) {
+    std::vector<AllreduceStep> schedule =
+        get_allreduce_schedule(algorithm, node_ids, message_size);
+    if (schedule.empty()) {
+      continue;
+    }
+    float time = estimate_allreduce_time(schedule, node_ids, links);
+    if (!found || time < best_time) {
+      best = algorithm;
+      best_time = time;
+      found = true;
+    }
+  }
+  return best;
+}
+
+bool parse_allreduce_algorithm(std::string const &name,
+                               AllreduceAlgorithm &algorithm) {
+  if (name == "auto") {
+    algorithm = ALLREDUCE_AUTO;
+  } else if (name == "ring") {
+    algorithm = ALLREDUCE_RING;
+  } else if (name == "hierarchical") {
+    algorithm = ALLREDUCE_HIERARCHICAL_RING;
+  } else if (name == "tree") {
+    algorithm = ALLREDUCE_DOUBLE_BINARY_TREE;
+  } else if (name == "halving-doubling") {
+    algorithm = ALLREDUCE_HALVING_DOUBLING;
+  } else if (name == "2d-torus") {
+    algorithm = ALLREDUCE_2D_TORUS;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+}; // namespace FlexFlow
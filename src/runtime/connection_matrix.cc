@@ -0,0 +1,125 @@
+#include "flexflow/connection_matrix.h"
+#include <algorithm>
+#include <cassert>
+#include <fstream>
+
+namespace FlexFlow {
+
+SparseConnectionMatrix::SparseConnectionMatrix()
+    : ndevs(0), row_offsets(1, 0) {}
+
+SparseConnectionMatrix::SparseConnectionMatrix(int num_devs,
+                                               std::vector<Edge> const &edges)
+    : ndevs(num_devs) {
+  assert(num_devs >= 0);
+  std::vector<Edge> sorted = edges;
+  std::sort(sorted.begin(), sorted.end(), [](Edge const &a, Edge const &b) {
+    return a.src < b.src || (a.src == b.src && a.dst < b.dst);
+  });
+  row_offsets.assign(num_devs + 1, 0);
+  for (size_t i = 0; i < sorted.size();) {
+    Edge const &e = sorted[i];
+    assert(e.src >= 0 && e.src < num_devs);
+    assert(e.dst >= 0 && e.dst < num_devs);
+    int weight = 0;
+    for (; i < sorted.size() && sorted[i].src == e.src &&
+           sorted[i].dst == e.dst;
+         i++) {
+      weight += sorted[i].weight;
+    }
+    if (weight != 0) {
+      cols.push_back(e.dst);
+      weights.push_back(weight);
+      row_offsets[e.src + 1]++;
+    }
+  }
+  for (int src = 0; src < num_devs; src++) {
+    row_offsets[src + 1] += row_offsets[src];
+  }
+}
+
+/*static*/
+SparseConnectionMatrix
+    SparseConnectionMatrix::from_dense(std::vector<int> const &conn,
+                                       int num_devs) {
+  assert(conn.size() == (size_t)num_devs * num_devs);
+  std::vector<Edge> edges;
+  for (int i = 0; i < num_devs; i++) {
+    for (int j = 0; j < num_devs; j++) {
+      if (conn[(size_t)i * num_devs + j] != 0) {
+        edges.push_back({i, j, conn[(size_t)i * num_devs + j]});
+      }
+    }
+  }
+  return SparseConnectionMatrix(num_devs, edges);
+}
+
+/*static*/
+bool SparseConnectionMatrix::load(std::string const &fname,
+                                  SparseConnectionMatrix &result) {
+  std::ifstream in(fname);
+  int num_devs;
+  if (!(in >> num_devs) || num_devs < 0) {
+    return false;
+  }
+  std::vector<Edge> edges;
+  Edge e;
+  while (in >> e.src >> e.dst >> e.weight) {
+    if (e.src < 0 || e.src >= num_devs || e.dst < 0 || e.dst >= num_devs) {
+      return false;
+    }
+    edges.push_back(e);
+  }
+  if (!in.eof()) {
+    return false;
+  }
+  result = SparseConnectionMatrix(num_devs, edges);
+  return true;
+}
+
+int SparseConnectionMatrix::get(int src, int dst) const {
+  assert(src >= 0 && src < ndevs);
+  auto const begin = cols.begin() + row_offsets[src];
+  auto const end = cols.begin() + row_offsets[src + 1];
+  auto const it = std::lower_bound(begin, end, dst);
+  if (it == end || *it != dst) {
+    return 0;
+  }
+  return weights[it - cols.begin()];
+}
+
+std::vector<int> SparseConnectionMatrix::to_dense() const {
+  std::vector<int> conn((size_t)ndevs * ndevs, 0);
+  for (int src = 0; src < ndevs; src++) {
+    for (size_t pos = row_offsets[src]; pos < row_offsets[src + 1]; pos++) {
+      conn[(size_t)src * ndevs + cols[pos]] = weights[pos];
+    }
+  }
+  return conn;
+}
+
+int SparseConnectionMatrix::num_devs() const {
+  return ndevs;
+}
+
+size_t SparseConnectionMatrix::num_edges() const {
+  return cols.size();
+}
+
+size_t SparseConnectionMatrix::row_begin(int src) const {
+  return row_offsets[src];
+}
+
+size_t SparseConnectionMatrix::row_end(int src) const {
+  return row_offsets[src + 1];
+}
+
+int SparseConnectionMatrix::neighbor(size_t pos) const {
+  return cols[pos];
+}
+
+int SparseConnectionMatrix::weight(size_t pos) const {
+  return weights[pos];
+}
+
+}; // namespace FlexFlow
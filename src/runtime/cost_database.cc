@@ -0,0 +1,164 @@
+#include "flexflow/cost_database.h"
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace FlexFlow {
+
+// Bump this whenever the way operators are profiled or keyed changes, so
+// that costs recorded by older builds are ignored
+static uint32_t const COST_DATABASE_MAGIC = 0x44434646; // "FFCD"
+static uint32_t const COST_DATABASE_VERSION = 1;
+
+struct CostDatabaseHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t record_size;
+  uint32_t reserved;
+};
+
+struct CostDatabaseRecord {
+  uint64_t key;
+  CostDatabase::Entry entry;
+};
+
+CostDatabase::CostDatabase(std::string const &_path, bool _import_only)
+    : path(_path), import_only(_import_only), fd(-1) {
+  assert(!path.empty());
+  // do not append records in the current format to an incompatible file
+  bool compatible = this->load();
+  if (import_only || !compatible) {
+    return;
+  }
+  fd = open(path.c_str(), O_WRONLY | O_APPEND | O_CREAT, 0644);
+  if (fd < 0) {
+    std::cerr << "cost database: cannot open " << path
+              << " for writing: " << strerror(errno) << std::endl;
+    return;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    fd = -1;
+    return;
+  }
+  if (st.st_size == 0) {
+    CostDatabaseHeader header;
+    header.magic = COST_DATABASE_MAGIC;
+    header.version = COST_DATABASE_VERSION;
+    header.record_size = sizeof(CostDatabaseRecord);
+    header.reserved = 0;
+    if (write(fd, &header, sizeof(header)) != sizeof(header)) {
+      close(fd);
+      fd = -1;
+    }
+  } else if ((size_t)st.st_size < sizeof(CostDatabaseHeader)) {
+    // a truncated header cannot be appended to safely
+    close(fd);
+    fd = -1;
+  } else {
+    // drop a partially written trailing record so that new records stay
+    // aligned
+    size_t const body_size = st.st_size - sizeof(CostDatabaseHeader);
+    if (body_size % sizeof(CostDatabaseRecord) != 0) {
+      off_t aligned = sizeof(CostDatabaseHeader) +
+                      body_size / sizeof(CostDatabaseRecord) *
+                          sizeof(CostDatabaseRecord);
+      if (ftruncate(fd, aligned) != 0) {
+        close(fd);
+        fd = -1;
+      }
+    }
+  }
+}
+
+CostDatabase::~CostDatabase() {
+  if (fd >= 0) {
+    close(fd);
+  }
+}
+
+bool CostDatabase::load() {
+  int rfd = open(path.c_str(), O_RDONLY);
+  if (rfd < 0) {
+    // a missing database is created on the first insert
+    return true;
+  }
+  struct stat st;
+  if (fstat(rfd, &st) != 0 ||
+      (size_t)st.st_size < sizeof(CostDatabaseHeader)) {
+    close(rfd);
+    return true;
+  }
+  size_t const file_size = st.st_size;
+  void *base = mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, rfd, 0);
+  close(rfd);
+  if (base == MAP_FAILED) {
+    std::cerr << "cost database: cannot map " << path << ": "
+              << strerror(errno) << std::endl;
+    return false;
+  }
+  CostDatabaseHeader header;
+  memcpy(&header, base, sizeof(header));
+  if (header.magic != COST_DATABASE_MAGIC ||
+      header.version != COST_DATABASE_VERSION ||
+      header.record_size != sizeof(CostDatabaseRecord)) {
+    std::cerr << "cost database: ignoring " << path
+              << " written by an incompatible version" << std::endl;
+    munmap(base, file_size);
+    return false;
+  }
+  char const *records = static_cast<char const *>(base) + sizeof(header);
+  // a partially written trailing record is ignored
+  size_t const num_records =
+      (file_size - sizeof(header)) / sizeof(CostDatabaseRecord);
+  for (size_t i = 0; i < num_records; i++) {
+    CostDatabaseRecord record;
+    memcpy(&record, records + i * sizeof(CostDatabaseRecord), sizeof(record));
+    entries[record.key] = record.entry;
+  }
+  munmap(base, file_size);
+  return true;
+}
+
+bool CostDatabase::find(uint64_t key, Entry &entry) const {
+  auto const &it = entries.find(key);
+  if (it == entries.end()) {
+    return false;
+  }
+  entry = it->second;
+  return true;
+}
+
+void CostDatabase::insert(uint64_t key, Entry const &entry) {
+  entries[key] = entry;
+  if (import_only || fd < 0) {
+    return;
+  }
+  CostDatabaseRecord record;
+  memset(&record, 0, sizeof(record));
+  record.key = key;
+  record.entry = entry;
+  // a single O_APPEND write keeps records from concurrent processes intact
+  if (write(fd, &record, sizeof(record)) != sizeof(record)) {
+    std::cerr << "cost database: cannot append to " << path << ": "
+              << strerror(errno) << std::endl;
+    close(fd);
+    fd = -1;
+  }
+}
+
+size_t CostDatabase::size() const {
+  return entries.size();
+}
+
+bool CostDatabase::is_import_only() const {
+  return import_only;
+}
+
+}; // namespace FlexFlow
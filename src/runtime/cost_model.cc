@@ -0,0 +1,200 @@
+/* Copyright 2023 CMU, Facebook, LANL, MIT, NVIDIA, and Stanford (alphabetical)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "flexflow/model.h"
+#include "flexflow/ops/attention.h"
+#include "flexflow/ops/conv_2d.h"
+#include "flexflow/ops/experts.h"
+#include "flexflow/ops/kernels/moe_dispatch_cpu_kernels.h"
+#include "flexflow/simulator.h"
+
+namespace FlexFlow {
+
+bool ProfilingCostModel::measure_operator_cost(
+    Simulator *sim,
+    Op const *op,
+    MachineView const &mv,
+    CostMetrics &cost_metrics) const {
+  return op->measure_operator_cost(sim, mv, cost_metrics);
+}
+
+bool ProfilingCostModel::is_device_dependent() const {
+  return true;
+}
+
+AnalyticalCostModel::AnalyticalCostModel(DeviceSpec const &_spec)
+    : spec(_spec) {
+  assert(spec.peak_tflops > 0);
+  assert(spec.memory_bandwidth_gbps > 0);
+}
+
+bool AnalyticalCostModel::is_device_dependent() const {
+  return false;
+}
+
+// Number of elements in the partition of shape held by a single device
+static double piece_volume(ParallelTensorShape const &shape) {
+  double volume = 1;
+  for (int i = 0; i < shape.num_dims; i++) {
+    volume *= shape.dims[i].size / shape.dims[i].degree;
+  }
+  return volume;
+}
+
+// Size of the i-th dimension of the partition held by a single device
+static double piece_dim(ParallelTensor const &tensor, int i) {
+  return tensor->dims[i].size / tensor->dims[i].degree;
+}
+
+bool AnalyticalCostModel::measure_operator_cost(
+    Simulator *sim,
+    Op const *op,
+    MachineView const &mv,
+    CostMetrics &cost_metrics) const {
+  cost_metrics = CostMetrics();
+  if (op->is_parallel_op() || op->op_type == OP_INPUT ||
+      op->op_type == OP_WEIGHT || op->op_type == OP_NOOP) {
+    // these operators only move data, which the simulator accounts for
+    // through xfer tasks
+    return true;
+  }
+
+  double input_bytes = 0, output_bytes = 0, weight_bytes = 0;
+  for (int i = 0; i < op->numInputs; i++) {
+    input_bytes += op->inputs[i]->get_shape().get_piece_size();
+  }
+  for (int i = 0; i < op->numOutputs; i++) {
+    output_bytes += op->outputs[i]->get_shape().get_piece_size();
+  }
+  for (int i = 0; i < op->numWeights; i++) {
+    if (op->weights[i] != nullptr) {
+      weight_bytes += op->weights[i]->get_shape().get_piece_size();
+    }
+  }
+  double const output_volume = piece_volume(op->outputs[0]->get_shape());
+
+  // Every operator reads its inputs and weights and writes its outputs once;
+  // compute-bound operators additionally perform the FLOPs below
+  double flops = output_volume;
+  // time spent moving data between the devices of the operator
+  float xfer_time = 0.0f;
+  switch (op->op_type) {
+    case OP_LINEAR: {
+      flops = linear_flops(output_volume, piece_dim(op->inputs[0], 0));
+      break;
+    }
+    case OP_CONV2D: {
+      Conv2D const *conv = (Conv2D const *)op;
+      flops = conv2d_flops(output_volume,
+                           piece_dim(op->inputs[0], 2),
+                           conv->groups,
+                           conv->kernel_h,
+                           conv->kernel_w);
+      break;
+    }
+    case OP_BATCHMATMUL: {
+      // the reduction dimension is the innermost dimension of the first input
+      flops = 2.0 * output_volume * piece_dim(op->inputs[0], 0);
+      break;
+    }
+    case OP_MULTIHEAD_ATTENTION: {
+      MultiHeadAttention const *attn = (MultiHeadAttention const *)op;
+      double batch = piece_dim(op->inputs[0], 2);
+      double q_len = piece_dim(op->inputs[0], 1);
+      double kv_len = piece_dim(op->inputs[1], 1);
+      double heads = attn->num_heads;
+      double projections = q_len * attn->qSize * attn->qProjSize +
+                           kv_len * attn->kSize * attn->kProjSize +
+                           kv_len * attn->vSize * attn->vProjSize +
+                           q_len * attn->vProjSize * attn->oProjSize;
+      double scores = q_len * kv_len * (attn->kProjSize + attn->vProjSize);
+      flops = 2.0 * batch * heads * (projections + scores);
+      break;
+    }
+    case OP_SOFTMAX:
+    case OP_LAYERNORM: {
+      // a few passes over the data for the reductions and normalization
+      flops = 5.0 * output_volume;
+      break;
+    }
+    case OP_EMBEDDING: {
+      // a gather of output-sized rows indexed by the input
+      flops = 0;
+      break;
+    }
+    case OP_EXPERTS: {
+      // every local expert runs a dense layer over the rows of all the batch
+      // shards, which are exchanged between the devices by an all-to-all
+      Experts const *experts = (Experts const *)op;
+      ParallelTensor const &input = op->inputs[0];
+      double data_dim = piece_dim(input, 0);
+      int batch_size = piece_volume(input->get_shape()) / data_dim;
+      int k = piece_dim(op->inputs[1], 0);
+      int num_shards = input->dims[input->num_dims - 2].degree;
+      double num_local = experts->num_experts / (double)num_shards;
+      int capacity = Kernels::MoeDispatch::expert_capacity(
+          experts->alpha, k, experts->num_experts, batch_size);
+      double num_rows = (double)capacity * num_shards;
+      flops = experts_flops(num_local, num_rows, data_dim, experts->out_dim);
+      double rows_bytes = num_local * num_rows * sizeof(float);
+      output_bytes += rows_bytes * (data_dim + experts->out_dim);
+      if (num_shards > 1) {
+        xfer_time =
+            sim->estimate_all_to_all_xfer_cost(mv, rows_bytes * data_dim) +
+            sim->estimate_all_to_all_xfer_cost(mv,
+                                               rows_bytes * experts->out_dim);
+      }
+      break;
+    }
+    default: {
+      break;
+    }
+  }
+
+  RooflineWork work;
+  work.flops = flops;
+  work.bytes = input_bytes + output_bytes + weight_bytes;
+  work.has_weights = op->numWeights > 0;
+  work.xfer_time = xfer_time;
+  roofline_pass_times(spec,
+                      work,
+                      sim->computationMode == COMP_MODE_TRAINING,
+                      cost_metrics.forward_time,
+                      cost_metrics.backward_time);
+  cost_metrics.inputs_memory = (size_t)input_bytes;
+  cost_metrics.outputs_memory = (size_t)output_bytes;
+  cost_metrics.weights_memory = (size_t)weight_bytes;
+  return true;
+}
+
+void Simulator::create_cost_model(FFConfig const &config) {
+  AnalyticalCostModel::DeviceSpec spec;
+  spec.peak_tflops = config.device_peak_tflops;
+  spec.memory_bandwidth_gbps = config.device_memory_bandwidth;
+  spec.kernel_launch_overhead = config.device_kernel_launch_overhead;
+  if (config.analytical_cost_model) {
+    cost_model = std::unique_ptr<CostModel>(new AnalyticalCostModel(spec));
+  } else {
+    cost_model = std::unique_ptr<CostModel>(new ProfilingCostModel());
+    if (config.cost_db_import_only) {
+      // the costs missing from an import-only database are estimated rather
+      // than profiled
+      missing_cost_model =
+          std::unique_ptr<CostModel>(new AnalyticalCostModel(spec));
+    }
+  }
+}
+
+}; // namespace FlexFlow
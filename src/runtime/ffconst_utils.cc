@@ -53,6 +53,8 @@ std::string get_operator_type_name(OperatorType type) {
       return "Aggregate cooperation";
     case OP_AGG_SPEC:
       return "Aggregate specification";
+    case OP_EXPERTS:
+      return "Experts";
     case OP_RESHAPE:
       return "Reshape";
     case OP_REVERSE:
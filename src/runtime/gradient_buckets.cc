@@ -0,0 +1,49 @@
+#include "flexflow/gradient_buckets.h"
+#include <algorithm>
+#include <cassert>
+#include <unordered_map>
+
+namespace FlexFlow {
+
+std::vector<std::vector<int>>
+    assign_gradient_buckets(std::vector<size_t> const &keys,
+                            std::vector<size_t> const &bytes,
+                            size_t bucket_bytes,
+                            int max_params) {
+  assert(keys.size() == bytes.size());
+  assert(max_params > 0);
+  struct Bucket {
+    std::vector<int> params;
+    size_t bytes = 0;
+    // position of the last parameter in the backward order
+    int ready = 0;
+  };
+  std::vector<Bucket> closed;
+  std::unordered_map<size_t, Bucket> open;
+  int position = 0;
+  for (int i = (int)keys.size() - 1; i >= 0; i--, position++) {
+    Bucket &bucket = open[keys[i]];
+    if (!bucket.params.empty() &&
+        (bucket.bytes + bytes[i] > bucket_bytes ||
+         (int)bucket.params.size() >= max_params)) {
+      closed.push_back(bucket);
+      bucket = Bucket();
+    }
+    bucket.params.push_back(i);
+    bucket.bytes += bytes[i];
+    bucket.ready = position;
+  }
+  for (auto const &it : open) {
+    closed.push_back(it.second);
+  }
+  std::sort(closed.begin(), closed.end(), [](Bucket const &a, Bucket const &b) {
+    return a.ready < b.ready;
+  });
+  std::vector<std::vector<int>> buckets;
+  for (Bucket const &bucket : closed) {
+    buckets.push_back(bucket.params);
+  }
+  return buckets;
+}
+
+}; // namespace FlexFlow
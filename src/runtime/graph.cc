@@ -25,6 +25,7 @@
 #include "flexflow/ops/element_binary.h"
 #include "flexflow/ops/element_unary.h"
 #include "flexflow/ops/embedding.h"
+#include "flexflow/ops/experts.h"
 #include "flexflow/ops/flat.h"
 #include "flexflow/ops/groupby.h"
 #include "flexflow/ops/layer_norm.h"
@@ -40,9 +41,12 @@
 #include "flexflow/parallel_ops/combine.h"
 #include "flexflow/parallel_ops/fused_parallel_op.h"
 #include "flexflow/parallel_ops/partition.h"
+#include "flexflow/parallel_ops/pipeline.h"
 #include "flexflow/parallel_ops/reduction.h"
 #include "flexflow/parallel_ops/replicate.h"
+#include "flexflow/substitution.h"
 #include "flexflow/utils/disjoint_set.h"
+#include "flexflow/utils/parallel_for.h"
 #include "legion.h"
 #include "legion/legion_utilities.h"
 
@@ -85,7 +89,9 @@ bool Edge::operator==(Edge const &rhs) const {
   return true;
 }
 
-SearchHelper::SearchHelper(FFModel *model) : model(model) {
+SearchHelper::SearchHelper(FFModel *model)
+    : model(model),
+      available_threads(std::max(model->config.search_num_threads, 1) - 1) {
   this->logger = std::unique_ptr<RecursiveLogger>(new RecursiveLogger("DP"));
 }
 
@@ -101,6 +107,86 @@ T SearchHelper::execute_sequence_split(std::unique_ptr<Graph> const &pre_graph,
       this->graph_cost<T>(post_graph.get(), bn, sink, resources, false));
 }
 
+// The two parts of resources given by a vertical or horizontal split
+static std::pair<MachineResource, MachineResource>
+    split_resources(MachineResource const &resources,
+                    NonsequenceSplit const &split) {
+  MachineResource first = resources, second = resources;
+  switch (split.type) {
+    case SplitType::VERTICAL:
+      first.num_nodes = split.param;
+      second.num_nodes = resources.num_nodes - split.param;
+      second.start_gpu_id =
+          resources.start_gpu_id + resources.all_gpus_per_node * split.param;
+      break;
+    case SplitType::HORIZONTAL:
+      first.available_gpus_per_node = split.param;
+      second.available_gpus_per_node =
+          resources.available_gpus_per_node - split.param;
+      second.start_gpu_id = resources.start_gpu_id + split.param;
+      break;
+    default:
+      assert(false);
+  }
+  return {first, second};
+}
+
+template <typename T>
+T SearchHelper::execute_pipeline_split(
+    std::unique_ptr<Graph> const &pre_graph,
+    std::unique_ptr<Graph> const &post_graph,
+    NodeAssignment const &source,
+    NodeAssignment const &sink,
+    MachineResource const &resources,
+    Node const &pipeline_node,
+    PipelineSplit const &split) const {
+  this->logger->debug() << "Exploring pipeline split (" << split.split.param
+                        << ", " << split.split.flip_graphs << ")";
+  std::pair<MachineResource, MachineResource> stages =
+      split_resources(resources, split.split);
+  if (split.split.flip_graphs) {
+    std::swap(stages.first, stages.second);
+  }
+  NodeAssignment boundary = {pipeline_node, split.view};
+  T pre = this->graph_cost<T>(
+      pre_graph.get(), source, boundary, stages.first, true);
+  T post = this->graph_cost<T>(
+      post_graph.get(), boundary, sink, stages.second, false);
+  if (this->is_invalid<T>(pre) || this->is_invalid<T>(post)) {
+    return this->infinity<T>();
+  }
+  // Only the copy of the pipeline op is micro-batched, and every other
+  // operator runs on the whole batch, so the stages run one after the other.
+  // The transfer between the stages is part of the first stage.
+  return sequence_cost<T>(pre, post);
+}
+
+std::vector<PipelineSplit>
+    SearchHelper::get_pipeline_splits(Node const &pipeline_node,
+                                      MachineResource const &resources) const {
+  std::vector<NonsequenceSplit> splits;
+  for (int i = 1; i < resources.num_nodes; i++) {
+    splits.push_back(NonsequenceSplit::vertical(i, false));
+    splits.push_back(NonsequenceSplit::vertical(i, true));
+  }
+  for (int i = 1; i < resources.available_gpus_per_node; i++) {
+    splits.push_back(NonsequenceSplit::horizontal(i, false));
+    splits.push_back(NonsequenceSplit::horizontal(i, true));
+  }
+  std::vector<PipelineSplit> pipeline_splits;
+  for (NonsequenceSplit const &split : splits) {
+    std::pair<MachineResource, MachineResource> stages =
+        split_resources(resources, split);
+    MachineResource const &second_stage =
+        split.flip_graphs ? stages.first : stages.second;
+    for (MachineView const &view :
+         this->get_valid_machine_views(pipeline_node, second_stage)) {
+      pipeline_splits.push_back({split, view});
+    }
+  }
+  return pipeline_splits;
+}
+
 template <typename T>
 T SearchHelper::find_optimal_sequence_graph_time(
     Graph const *g,
@@ -142,26 +228,64 @@ T SearchHelper::find_optimal_sequence_graph_time(
     }
   }
 
-  if (valid_views.empty()) {
+  // A pipeline op may also be a stage boundary, with the graphs before and
+  // after it on disjoint resources
+  std::vector<PipelineSplit> pipeline_splits;
+  if (bn_node.ptr->op_type == OP_PIPELINE) {
+    pipeline_splits = this->get_pipeline_splits(bn_node, resources);
+  }
+
+  if (valid_views.empty() && pipeline_splits.empty()) {
     return optimal;
   }
 
-  float optimal_cost = std::numeric_limits<float>::infinity();
-  MachineView best_view;
+  // The views are evaluated in parallel, but the best one is picked in view
+  // order so that ties are broken exactly as in a sequential search. The
+  // pipeline splits come last.
+  size_t num_views = valid_views.size();
+  std::vector<float> costs(num_views + pipeline_splits.size());
+  parallel_for(costs.size(), this->available_threads, [&](size_t i) {
+    if (i < num_views) {
+      costs[i] = this->execute_sequence_split<float>(pre_graph,
+                                                     post_graph,
+                                                     source,
+                                                     sink,
+                                                     resources,
+                                                     {bn_node, valid_views[i]});
+    } else {
+      costs[i] =
+          this->execute_pipeline_split<float>(pre_graph,
+                                              post_graph,
+                                              source,
+                                              sink,
+                                              resources,
+                                              bn_node,
+                                              pipeline_splits[i - num_views]);
+    }
+  });
 
-  for (MachineView const &bn_view : valid_views) {
-    float cost = this->execute_sequence_split<float>(
-        pre_graph, post_graph, source, sink, resources, {bn_node, bn_view});
+  float optimal_cost = std::numeric_limits<float>::infinity();
+  size_t best = costs.size();
 
-    if (cost < optimal_cost) {
-      best_view = bn_view;
-      optimal_cost = cost;
+  for (size_t i = 0; i < costs.size(); i++) {
+    if (costs[i] < optimal_cost) {
+      best = i;
+      optimal_cost = costs[i];
     }
   }
 
-  if (optimal_cost != std::numeric_limits<float>::infinity()) {
-    optimal = this->execute_sequence_split<T>(
-        pre_graph, post_graph, source, sink, resources, {bn_node, best_view});
+  if (best < num_views) {
+    optimal = this->execute_sequence_split<T>(pre_graph,
+                                              post_graph,
+                                              source,
+                                              sink,
+                                              resources,
+                                              {bn_node, valid_views[best]});
+  } else if (best < costs.size()) {
+    this->logger->debug() << "Best split: PIPELINE";
+    PipelineSplit const &split = pipeline_splits[best - num_views];
+    optimal = this->execute_pipeline_split<T>(
+        pre_graph, post_graph, source, sink, resources, bn_node, split);
   }
 
   check_matches_graph<T>(g, optimal, sink.node);
@@ -191,28 +315,22 @@ T SearchHelper::execute_nonsequence_split(
     case SplitType::VERTICAL: {
       this->logger->debug() << "Exploring vertical nonsequence split ("
                             << split.param << ", " << split.flip_graphs << ")";
-      MachineResource firstRes = resources, secondRes = resources;
-      firstRes.num_nodes = split.param;
-      secondRes.num_nodes = resources.num_nodes - split.param;
-      secondRes.start_gpu_id =
-          resources.start_gpu_id + resources.all_gpus_per_node * split.param;
+      std::pair<MachineResource, MachineResource> res =
+          split_resources(resources, split);
 
       return parallel_cost<T>(
-          this->graph_cost<T>(first, source, sink, firstRes, false),
-          this->graph_cost<T>(second, source, sink, secondRes, false));
+          this->graph_cost<T>(first, source, sink, res.first, false),
+          this->graph_cost<T>(second, source, sink, res.second, false));
     }
     case SplitType::HORIZONTAL: {
       this->logger->debug() << "Exploring horizontal nonsequence split ("
                             << split.param << ", " << split.flip_graphs << ")";
-      MachineResource firstRes = resources, secondRes = resources;
-      firstRes.available_gpus_per_node = split.param;
-      secondRes.available_gpus_per_node =
-          resources.available_gpus_per_node - split.param;
-      secondRes.start_gpu_id = resources.start_gpu_id + split.param;
+      std::pair<MachineResource, MachineResource> res =
+          split_resources(resources, split);
 
       return parallel_cost<T>(
-          this->graph_cost<T>(first, source, sink, firstRes, false),
-          this->graph_cost<T>(second, source, sink, secondRes, false));
+          this->graph_cost<T>(first, source, sink, res.first, false),
+          this->graph_cost<T>(second, source, sink, res.second, false));
     }
     default:
       assert(false);
@@ -270,17 +388,24 @@ T SearchHelper::find_optimal_nonsequence_graph_time(
     potential_splits.push_back(NonsequenceSplit::horizontal(i, true));
   }
 
-  NonsequenceSplit best_split = NonsequenceSplit::sequential();
-  float best_cost = this->execute_nonsequence_split<float>(
-      first_graph, second_graph, source, sink, resources, best_split);
-  for (NonsequenceSplit const &split : potential_splits) {
-    float cost = this->execute_nonsequence_split<float>(
+  // Splits are evaluated in parallel and then compared in order, starting
+  // from the sequential split, so that ties are broken deterministically
+  std::vector<float> costs(potential_splits.size() + 1);
+  parallel_for(costs.size(), this->available_threads, [&](size_t i) {
+    NonsequenceSplit const &split =
+        i == 0 ? NonsequenceSplit::sequential() : potential_splits[i - 1];
+    costs[i] = this->execute_nonsequence_split<float>(
         first_graph, second_graph, source, sink, resources, split);
-    this->logger->debug() << "Found cost: " << cost;
+  });
 
-    if (cost < best_cost) {
-      best_cost = cost;
-      best_split = split;
+  NonsequenceSplit best_split = NonsequenceSplit::sequential();
+  float best_cost = costs[0];
+  for (size_t i = 0; i < potential_splits.size(); i++) {
+    this->logger->debug() << "Found cost: " << costs[i + 1];
+
+    if (costs[i + 1] < best_cost) {
+      best_cost = costs[i + 1];
+      best_split = potential_splits[i];
     }
   }
 
@@ -305,8 +430,175 @@ T SearchHelper::find_optimal_nonsequence_graph_time(
   return optimal;
 }
 
+/*static*/
+PMParameter NodeIndex::key_parameter(OperatorType type) {
+  switch (type) {
+    case OP_REPARTITION:
+      return PM_REPARTITION_DEGREE;
+    case OP_COMBINE:
+      return PM_COMBINE_DEGREE;
+    case OP_REPLICATE:
+      return PM_REPLICATE_DEGREE;
+    case OP_REDUCTION:
+      return PM_REDUCTION_DEGREE;
+    case OP_PIPELINE:
+      return PM_PIPELINE_DEGREE;
+    default:
+      return PM_INVALID;
+  }
+}
+
+static int node_index_key(Node const &node) {
+  PMParameter para = NodeIndex::key_parameter(node.ptr->op_type);
+  int key = 0;
+  if (para != PM_INVALID) {
+    bool found = node.ptr->get_int_parameter(para, &key);
+    assert(found);
+  }
+  return key;
+}
+
+void NodeIndex::add(Node const &node) {
+  assert(node.ptr != NULL);
+  this->nodes[node.ptr->op_type][node_index_key(node)].insert(node);
+}
+
+void NodeIndex::remove(Node const &node) {
+  auto by_type = this->nodes.find(node.ptr->op_type);
+  if (by_type == this->nodes.end()) {
+    return;
+  }
+  auto by_key = by_type->second.find(node_index_key(node));
+  if (by_key == by_type->second.end()) {
+    return;
+  }
+  by_key->second.erase(node);
+  if (by_key->second.empty()) {
+    by_type->second.erase(by_key);
+  }
+}
+
+size_t NodeIndex::count(OperatorType type) const {
+  auto by_type = this->nodes.find(type);
+  if (by_type == this->nodes.end()) {
+    return 0;
+  }
+  size_t result = 0;
+  for (auto const &kv : by_type->second) {
+    result += kv.second.size();
+  }
+  return result;
+}
+
+size_t NodeIndex::count(OperatorType type, int key) const {
+  auto by_type = this->nodes.find(type);
+  if (by_type == this->nodes.end()) {
+    return 0;
+  }
+  auto by_key = by_type->second.find(key);
+  if (by_key == by_type->second.end()) {
+    return 0;
+  }
+  return by_key->second.size();
+}
+
+void NodeIndex::get(OperatorType type,
+                    tl::optional<int> const &key,
+                    std::vector<Node> &result) const {
+  auto by_type = this->nodes.find(type);
+  if (by_type == this->nodes.end()) {
+    return;
+  }
+  for (auto const &kv : by_type->second) {
+    if (!key.has_value() || kv.first == key.value()) {
+      result.insert(result.end(), kv.second.cbegin(), kv.second.cend());
+    }
+  }
+}
+
 Graph::Graph(FFModel *_model) : model(_model), search(_model->search) {}
 
+/*static*/
+std::shared_ptr<GraphDelta const> GraphDelta::snapshot(Graph const &graph) {
+  std::shared_ptr<GraphDelta> delta = std::make_shared<GraphDelta>();
+  for (auto const &kv : graph.inEdges) {
+    delta->added_nodes.push_back(kv.first);
+    delta->added_edges.insert(
+        delta->added_edges.end(), kv.second.cbegin(), kv.second.cend());
+  }
+  return delta;
+}
+
+/*static*/
+std::shared_ptr<GraphDelta const>
+    GraphDelta::derive(std::shared_ptr<GraphDelta const> const &parent,
+                       Graph const &parent_graph,
+                       Graph const &graph) {
+  if (parent == nullptr || parent->depth + 1 >= max_depth) {
+    return snapshot(graph);
+  }
+  std::shared_ptr<GraphDelta> delta = std::make_shared<GraphDelta>();
+  delta->parent = parent;
+  delta->depth = parent->depth + 1;
+  for (auto const &kv : graph.inEdges) {
+    auto const &old_edges = parent_graph.inEdges.find(kv.first);
+    if (old_edges == parent_graph.inEdges.end()) {
+      delta->added_nodes.push_back(kv.first);
+      delta->added_edges.insert(
+          delta->added_edges.end(), kv.second.cbegin(), kv.second.cend());
+      continue;
+    }
+    for (Edge const &e : kv.second) {
+      if (old_edges->second.find(e) == old_edges->second.end()) {
+        delta->added_edges.push_back(e);
+      }
+    }
+  }
+  for (auto const &kv : parent_graph.inEdges) {
+    auto const &new_edges = graph.inEdges.find(kv.first);
+    if (new_edges == graph.inEdges.end()) {
+      delta->removed_nodes.push_back(kv.first);
+      delta->removed_edges.insert(
+          delta->removed_edges.end(), kv.second.cbegin(), kv.second.cend());
+      continue;
+    }
+    for (Edge const &e : kv.second) {
+      if (new_edges->second.find(e) == new_edges->second.end()) {
+        delta->removed_edges.push_back(e);
+      }
+    }
+  }
+  return delta;
+}
+
+std::unique_ptr<Graph> GraphDelta::flatten(FFModel *model) const {
+  std::vector<GraphDelta const *> chain;
+  for (GraphDelta const *d = this; d != nullptr; d = d->parent.get()) {
+    chain.push_back(d);
+  }
+  std::unordered_set<Node> nodes;
+  std::unordered_set<Edge> edges;
+  for (auto it = chain.rbegin(); it != chain.rend(); it++) {
+    GraphDelta const *d = *it;
+    for (Node const &node : d->removed_nodes) {
+      nodes.erase(node);
+    }
+    for (Edge const &e : d->removed_edges) {
+      edges.erase(e);
+    }
+    nodes.insert(d->added_nodes.cbegin(), d->added_nodes.cend());
+    edges.insert(d->added_edges.cbegin(), d->added_edges.cend());
+  }
+  std::unique_ptr<Graph> graph(new Graph(model));
+  for (Node const &node : nodes) {
+    graph->add_node(node);
+  }
+  for (Edge const &e : edges) {
+    graph->add_edge(e);
+  }
+  return graph;
+}
+
 void Graph::add_edge(Node const &srcOp,
                      Node const &dstOp,
                      int srcIdx,
@@ -317,27 +609,36 @@ void Graph::add_edge(Node const &srcOp,
   if (outEdges.find(srcOp) == outEdges.end()) {
     outEdges[srcOp];
   }
+  invalidate_canonical_hashes();
   Edge e(srcOp, dstOp, srcIdx, dstIdx);
   inEdges[srcOp];
   outEdges[dstOp];
   inEdges[dstOp].insert(e);
   outEdges[srcOp].insert(e);
+  node_index.add(srcOp);
+  node_index.add(dstOp);
 }
 
 void Graph::add_node(Node const &node) {
+  invalidate_canonical_hashes();
   inEdges[node];
   outEdges[node];
+  node_index.add(node);
 }
 
 void Graph::add_edge(Edge const &e) {
+  invalidate_canonical_hashes();
   inEdges[e.srcOp];
   outEdges[e.dstOp];
 
   inEdges[e.dstOp].insert(e);
   outEdges[e.srcOp].insert(e);
+  node_index.add(e.srcOp);
+  node_index.add(e.dstOp);
 }
 
 void Graph::remove_edge(Edge const &e, bool remove_node_if_unused) {
+  invalidate_canonical_hashes();
   assert(outEdges[e.srcOp].find(e) != outEdges[e.srcOp].end());
   assert(inEdges[e.dstOp].find(e) != inEdges[e.dstOp].end());
   assert(outEdges[e.srcOp].erase(e) == 1);
@@ -346,10 +647,12 @@ void Graph::remove_edge(Edge const &e, bool remove_node_if_unused) {
     if ((outEdges[e.srcOp].size() == 0) && (inEdges[e.srcOp].size() == 0)) {
       outEdges.erase(e.srcOp);
       inEdges.erase(e.srcOp);
+      node_index.remove(e.srcOp);
     }
     if ((outEdges[e.dstOp].size() == 0) && (inEdges[e.dstOp].size() == 0)) {
       outEdges.erase(e.dstOp);
       inEdges.erase(e.dstOp);
+      node_index.remove(e.dstOp);
     }
   }
 }
@@ -512,6 +815,7 @@ std::vector<MachineView> SearchHelper::get_valid_machine_views(
   std::vector<MachineView> const *cached_op_views = NULL;
   std::vector<MachineView> valid_views;
 
+  std::lock_guard<std::mutex> lock(this->cache_mutex);
   auto const &iter = cached_operator_valid_views.find(op->op_guid);
   if (iter != cached_operator_valid_views.end()) {
     cached_op_views = iter->second.get();
@@ -662,8 +966,10 @@ void Graph::remove_node(Node const &node, bool purge_edges) {
     assert(this->inEdges.at(node).empty());
     assert(this->outEdges.at(node).empty());
   }
+  invalidate_canonical_hashes();
   this->inEdges.erase(node);
   this->outEdges.erase(node);
+  this->node_index.remove(node);
 }
 
 /*static*/
@@ -852,8 +1158,11 @@ void Graph::simplify(SimplificationSettings const &settings) {
           Node n1 = e2.srcOp;
           // Check that n1 is a parallel op
           // Check that n1 must have a single out edge
+          // Stage boundaries are kept as separate ops
           if (n1.ptr->is_parallel_op() &&
-              this->outEdges.find(n1)->second.size() == 1) {
+              this->outEdges.find(n1)->second.size() == 1 &&
+              n1.ptr->op_type != OP_PIPELINE &&
+              n2.ptr->op_type != OP_PIPELINE) {
             // merge n1 and n2
             std::vector<ParallelOpInfo> parallel_ops;
             ((ParallelOp *)n1.ptr)->append_parallel_op_info(parallel_ops);
@@ -1153,6 +1462,9 @@ GraphCostResult sequence_cost<GraphCostResult>(GraphCostResult const &first,
   GraphCostResult result(first);
   result.cost += second.cost;
   result.views.insert(second.views.cbegin(), second.views.cend());
+  for (auto const &kv : second.device_memory) {
+    result.device_memory[kv.first] += kv.second;
+  }
   return result;
 }
 
@@ -1183,6 +1495,11 @@ GraphCostResult parallel_cost<GraphCostResult>(GraphCostResult const &first,
   result.cost = std::max(first.cost, second.cost);
   result.views.insert(first.views.cbegin(), first.views.cend());
   result.views.insert(second.views.cbegin(), second.views.cend());
+  // both branches stay resident until the end of the iteration
+  result.device_memory = first.device_memory;
+  for (auto const &kv : second.device_memory) {
+    result.device_memory[kv.first] += kv.second;
+  }
 
   return result;
 }
@@ -1239,6 +1556,7 @@ void SearchHelper::check_matches_graph<float>(Graph const *g,
 template <>
 std::pair<bool, float>
     SearchHelper::try_get_cost_from_cache<float>(size_t hash) const {
+  std::lock_guard<std::mutex> lock(this->cache_mutex);
   if (this->cached_graph_costs.find(hash) == this->cached_graph_costs.end()) {
     return {false, std::numeric_limits<float>::infinity()};
   } else {
@@ -1256,6 +1574,7 @@ template <>
 void SearchHelper::try_cache_result<float>(size_t hash,
                                            float const &value) const {
   this->logger->debug() << "cached_graph_costs[" << hash << "] = " << value;
+  std::lock_guard<std::mutex> lock(this->cache_mutex);
   this->cached_graph_costs[hash] = value;
 }
 
@@ -1264,9 +1583,23 @@ void SearchHelper::try_cache_result<GraphCostResult>(
     size_t hash, GraphCostResult const &value) const {
   this->logger->debug() << "cached_graph_costs[" << hash << "=" << value.cost
                         << "]";
+  std::lock_guard<std::mutex> lock(this->cache_mutex);
   this->cached_graph_costs[hash] = value.cost;
 }
 
+void SearchHelper::load_cached_costs(SearchCache const &cache) {
+  std::lock_guard<std::mutex> lock(this->cache_mutex);
+  if (cache.load_costs("graph_costs", this->cached_graph_costs)) {
+    log_graph.print("Loaded %zu cached graph costs",
+                    this->cached_graph_costs.size());
+  }
+}
+
+void SearchHelper::save_cached_costs(SearchCache const &cache) const {
+  std::lock_guard<std::mutex> lock(this->cache_mutex);
+  cache.save_costs("graph_costs", this->cached_graph_costs);
+}
+
 template <>
 float SearchHelper::infinity<float>() const {
   return std::numeric_limits<float>::infinity();
@@ -1301,8 +1634,12 @@ T SearchHelper::estimate_xfer_cost(Graph const *graph,
       assert(sink.node.ptr->inputs[it2.dstIdx]->is_valid_machine_view(
           source.view));
 
-      float estimated_xfer_cost = this->model->simulator->estimate_xfer_cost(
-          sink.node.ptr, it2.dstIdx, source.view, sink.view);
+      float estimated_xfer_cost;
+      {
+        std::lock_guard<std::mutex> lock(this->simulator_mutex);
+        estimated_xfer_cost = this->model->simulator->estimate_xfer_cost(
+            sink.node.ptr, it2.dstIdx, source.view, sink.view);
+      }
       // printf("Estimated xfer cost from %s to %s: %fms\n",
       // source.node.ptr->name, sink.node.ptr->name, estimated_xfer_cost);
       op_cost += estimated_xfer_cost;
@@ -1331,6 +1668,96 @@ void SearchHelper::add_operator_cost<GraphCostResult>(
   cost->views[node.node] = node.view;
 }
 
+template <>
+void SearchHelper::add_operator_memory<float>(NodeAssignment const &node,
+                                              size_t memory,
+                                              float *cost) const {}
+
+template <>
+void SearchHelper::add_operator_memory<GraphCostResult>(
+    NodeAssignment const &node, size_t memory, GraphCostResult *cost) const {
+  if (node.view.device_type != MachineView::GPU) {
+    return;
+  }
+  for (int device_id : node.view.device_ids()) {
+    cost->device_memory[device_id] += memory;
+  }
+}
+
+/**
+ * @brief Run time charged to an operator that uses memory bytes on each
+ * device of view.
+ *
+ * @details With --memory-search, views under which the operator does not fit
+ * in the memory of one of its GPUs get an infinite cost, which prunes them
+ * from the search. Whether the operators of a whole strategy fit together is
+ * checked per graph by Graph::optimal_cost, since the peak usage of a device
+ * does not decompose over the splits of the dynamic program. Otherwise the
+ * operator is charged --memory-lambda ms per MB.
+ */
+float SearchHelper::memory_cost(MachineView const &view, size_t memory) const {
+  FFConfig const &config = this->model->config;
+  if (view.device_type != MachineView::GPU) {
+    return 0.0f;
+  }
+  if (config.memory_search) {
+    MachineModel const *machine = this->model->simulator->machine;
+    for (int device_id : view.device_ids()) {
+      if (memory > machine->get_gpu_fb_mem(device_id)->capacity) {
+        return std::numeric_limits<float>::infinity();
+      }
+    }
+  }
+  return config.memory_lambda * memory * 1e-6f;
+}
+
+// Whether the operators of result fit in the memory of each of their GPUs
+bool SearchHelper::fits_device_memory(GraphCostResult const &result) const {
+  MachineModel const *machine = this->model->simulator->machine;
+  for (auto const &kv : result.device_memory) {
+    if (kv.second > machine->get_gpu_fb_mem(kv.first)->capacity) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * @brief The lowest cost graph_cost charges for computing node as a sink,
+ * over all of its valid machine views.
+ */
+float SearchHelper::min_operator_cost(Node const &node) const {
+  {
+    std::lock_guard<std::mutex> lock(this->cache_mutex);
+    auto const &iter = this->cached_min_operator_costs.find(node.ptr->op_guid);
+    if (iter != this->cached_min_operator_costs.end()) {
+      return iter->second;
+    }
+  }
+  float result = 0.0f;
+  // the source of the graph is never charged
+  if (node.ptr->op_type != OP_INPUT) {
+    MachineResource resource(this->model->config);
+    std::vector<MachineView> views =
+        this->get_valid_machine_views(node, resource);
+    for (size_t i = 0; i < views.size(); i++) {
+      CostMetrics metrics;
+      {
+        std::lock_guard<std::mutex> lock(this->simulator_mutex);
+        metrics =
+            this->model->simulator->measure_operator_cost(node.ptr, views[i]);
+      }
+      float cost = metrics.forward_time + metrics.backward_time +
+                   metrics.sync_time +
+                   this->memory_cost(views[i], metrics.total_memory());
+      result = (i == 0) ? cost : std::min(result, cost);
+    }
+  }
+  std::lock_guard<std::mutex> lock(this->cache_mutex);
+  this->cached_min_operator_costs[node.ptr->op_guid] = result;
+  return result;
+}
+
 template <>
 float SearchHelper::get_cost<float>(float const &f) const {
   return f;
@@ -1415,27 +1842,84 @@ T SearchHelper::graph_cost(Graph const *graph,
   check_matches_graph<T>(graph, result, sink.node);
 
   if (include_sink_compute_time) {
-    CostMetrics metrics =
-        this->model->simulator->measure_operator_cost(sink.node.ptr, sink.view);
+    CostMetrics metrics;
+    {
+      // profiling must not overlap with other kernels to be accurate
+      std::lock_guard<std::mutex> lock(this->simulator_mutex);
+      metrics = this->model->simulator->measure_operator_cost(sink.node.ptr,
+                                                              sink.view);
+    }
     this->logger->debug() << "Sink node cost: "
                           << "forward(" << metrics.forward_time << ") "
                           << "backward(" << metrics.backward_time << ") "
                           << "sync(" << metrics.sync_time << ")";
+    size_t memory = metrics.total_memory();
     this->add_operator_cost<T>(sink,
                                metrics.forward_time + metrics.backward_time +
-                                   metrics.sync_time,
+                                   metrics.sync_time +
+                                   this->memory_cost(sink.view, memory),
                                &result);
+    this->add_operator_memory<T>(sink, memory, &result);
   }
 
   return result;
 }
 
+/**
+ * @brief The cost of the best strategy for the graph.
+ *
+ * @details With --memory-search, the graph is rejected (its cost is infinite)
+ * when the operators that its best strategy places on a GPU do not fit in its
+ * memory together, so that the substitution search moves on to graphs that
+ * fit.
+ */
 float Graph::optimal_cost() const {
-  return this->generic_optimal_cost<float>();
+  if (!this->model->config.memory_search) {
+    return this->generic_optimal_cost<float>();
+  }
+  GraphCostResult result = this->optimal_cost_result();
+  if (!this->search->fits_device_memory(result)) {
+    return std::numeric_limits<float>::infinity();
+  }
+  return result.cost;
+}
+
+/**
+ * @brief A lower bound on optimal_cost() that does not run the DP.
+ *
+ * @details The DP adds up the costs of the two sides of a sequence split and
+ * takes the larger of two branches run in parallel, so the cost of a graph is
+ * at least that of its most expensive path, with every operator on its
+ * fastest machine view and free transfers. The stages on either side of a
+ * pipeline op overlap, so paths restart after them.
+ */
+float Graph::cost_lower_bound() const {
+  using FlexFlow::PCG::Utils::topo_sort;
+
+  std::vector<Node> topo_sorted;
+  topo_sort(*this, &topo_sorted);
+  std::unordered_map<Node, float> path_cost;
+  float result = 0.0f;
+  for (Node const &node : topo_sorted) {
+    float cost = 0.0f;
+    if (node.ptr->op_type != OP_PIPELINE) {
+      for (Edge const &e : this->inEdges.at(node)) {
+        cost = std::max(cost, path_cost.at(e.srcOp));
+      }
+    }
+    cost += this->search->min_operator_cost(node);
+    path_cost[node] = cost;
+    result = std::max(result, cost);
+  }
+  return result;
 }
 
 std::unordered_map<Node, MachineView> Graph::optimal_views() const {
-  return this->generic_optimal_cost<GraphCostResult>().views;
+  return this->optimal_cost_result().views;
+}
+
+GraphCostResult Graph::optimal_cost_result() const {
+  return this->generic_optimal_cost<GraphCostResult>();
 }
 
 Graph Graph::reduced() const {
@@ -1510,22 +1994,149 @@ T Graph::generic_optimal_cost() const {
   return optimal;
 }
 
-size_t Graph::hash(void) const {
-  // Graph hash should be additive and independent to the ordering of the nodes
-  size_t total_hash = 0;
+/**
+ * @brief Hash of a node that only depends on what the node computes (its
+ * operator type, parameters, and output shapes), not on where it lives in
+ * memory or on its guid.
+ */
+static size_t node_local_hash(Node const &node) {
+  Op const *op = node.ptr;
+  assert(op != NULL);
+  size_t key = 0;
+  hash_combine(key, op->op_type);
+  hash_combine(key, op->numOutputs);
+  for (int i = 0; i < op->numOutputs; i++) {
+    hash_combine(key, op->outputs[i]->get_shape());
+    hash_combine(key, op->outputs[i]->data_type);
+  }
+  tl::optional<OperatorParameters> params = get_op_parameters(op);
+  if (params.has_value()) {
+    hash_combine(key, params.value());
+  }
+  return key;
+}
+
+static size_t combine_sorted(std::vector<size_t> &hashes) {
+  // sort so that the result is independent of the iteration order of the
+  // unordered containers the hashes were gathered from
+  std::sort(hashes.begin(), hashes.end());
+  size_t key = 0;
+  hash_combine(key, hashes.size());
+  for (size_t h : hashes) {
+    hash_combine(key, h);
+  }
+  return key;
+}
+
+static std::unordered_map<Node, size_t> compute_canonical_node_hashes(
+    std::unordered_map<Node, std::unordered_set<Edge>> const &inEdges,
+    std::unordered_map<Node, std::unordered_set<Edge>> const &outEdges) {
+  // Kahn's algorithm to get a topological order of the nodes
+  std::unordered_map<Node, int> todos;
+  std::vector<Node> order;
   for (auto const &it : inEdges) {
-    auto const &inList = it.second;
-    size_t node_hash = std::hash<size_t>()((size_t)it.first.ptr);
-    for (auto const &e : inList) {
-      size_t edge_hash = 17;
-      edge_hash = edge_hash * 31 + std::hash<size_t>()((size_t)e.srcOp.ptr);
-      edge_hash = edge_hash * 31 + std::hash<int>()(e.srcIdx);
-      edge_hash = edge_hash * 31 + std::hash<int>()(e.dstIdx);
-      node_hash *= edge_hash;
+    todos[it.first] = (int)it.second.size();
+    if (it.second.empty()) {
+      order.push_back(it.first);
     }
-    total_hash += node_hash;
   }
-  return total_hash;
+  for (size_t i = 0; i < order.size(); i++) {
+    auto const &outList = outEdges.find(order[i]);
+    if (outList == outEdges.end()) {
+      continue;
+    }
+    for (auto const &e : outList->second) {
+      if (--todos[e.dstOp] == 0) {
+        order.push_back(e.dstOp);
+      }
+    }
+  }
+  assert(order.size() == inEdges.size());
+
+  // A node's forward hash covers all of its ancestors and its backward hash
+  // covers all of its descendants, so that together they identify the node's
+  // position in the graph up to isomorphism
+  std::unordered_map<Node, size_t> forward, backward;
+  std::vector<size_t> edge_hashes;
+  for (Node const &node : order) {
+    edge_hashes.clear();
+    for (auto const &e : inEdges.at(node)) {
+      size_t edge_hash = forward.at(e.srcOp);
+      hash_combine(edge_hash, e.srcIdx);
+      hash_combine(edge_hash, e.dstIdx);
+      edge_hashes.push_back(edge_hash);
+    }
+    size_t key = node_local_hash(node);
+    hash_combine(key, combine_sorted(edge_hashes));
+    forward[node] = key;
+  }
+  for (auto it = order.rbegin(); it != order.rend(); it++) {
+    edge_hashes.clear();
+    auto const &outList = outEdges.find(*it);
+    if (outList != outEdges.end()) {
+      for (auto const &e : outList->second) {
+        size_t edge_hash = backward.at(e.dstOp);
+        hash_combine(edge_hash, e.srcIdx);
+        hash_combine(edge_hash, e.dstIdx);
+        edge_hashes.push_back(edge_hash);
+      }
+    }
+    size_t key = node_local_hash(*it);
+    hash_combine(key, combine_sorted(edge_hashes));
+    backward[*it] = key;
+  }
+
+  std::unordered_map<Node, size_t> result;
+  for (Node const &node : order) {
+    size_t key = forward.at(node);
+    hash_combine(key, backward.at(node));
+    result[node] = key;
+  }
+  return result;
+}
+
+static size_t
+    graph_hash_from_node_hashes(std::unordered_map<Node, size_t> const &nodes) {
+  std::vector<size_t> hashes;
+  hashes.reserve(nodes.size());
+  for (auto const &kv : nodes) {
+    hashes.push_back(kv.second);
+  }
+  return combine_sorted(hashes);
+}
+
+Graph::CanonicalHashes const &Graph::get_canonical_hashes() const {
+  std::shared_ptr<CanonicalHashes const> cached =
+      std::atomic_load(&this->canonical_hashes);
+  if (cached == nullptr) {
+    std::shared_ptr<CanonicalHashes> computed(new CanonicalHashes());
+    computed->nodes =
+        compute_canonical_node_hashes(this->inEdges, this->outEdges);
+    computed->graph = graph_hash_from_node_hashes(computed->nodes);
+    // Another thread may have cached them first, and the hashes it returned
+    // must stay alive
+    std::shared_ptr<CanonicalHashes const> desired = computed;
+    if (std::atomic_compare_exchange_strong(
+            &this->canonical_hashes, &cached, desired)) {
+      cached = desired;
+    }
+  }
+  return *cached;
+}
+
+void Graph::invalidate_canonical_hashes() {
+  std::atomic_store(&this->canonical_hashes,
+                    std::shared_ptr<CanonicalHashes const>());
+}
+
+std::unordered_map<Node, size_t> const &Graph::canonical_node_hashes() const {
+  return this->get_canonical_hashes().nodes;
+}
+
+size_t Graph::hash(void) const {
+  // Graph hash is structural: it is independent of the ordering of the nodes
+  // as well as of their guids and addresses, so it is stable across runs
+  return this->get_canonical_hashes().graph;
 }
 
 size_t dp_state_hash(Graph const *graph,
@@ -1534,14 +2145,64 @@ size_t dp_state_hash(Graph const *graph,
                      Node const &source_node,
                      MachineView const &source_view,
                      MachineResource const &resource) {
+  std::unordered_map<Node, size_t> const &node_hashes =
+      graph->canonical_node_hashes();
   size_t key = graph->hash();
-  hash_combine(key, sink_node.ptr);
+  hash_combine(key, node_hashes.at(sink_node));
   hash_combine(key, sink_view.hash());
-  hash_combine(key, source_node.ptr);
+  if (source_node == Node::INVALID_NODE) {
+    hash_combine(key, (size_t)0);
+  } else {
+    hash_combine(key, node_hashes.at(source_node));
+  }
+  hash_combine(key, source_view.hash());
   hash_combine(key, resource.hash());
   return key;
 }
 
+/**
+ * @brief Hash of everything besides the input graph that the result of
+ * graph_optimize_task depends on.
+ */
+static size_t search_context_hash(FFConfig const &config,
+                                  size_t gpu_mem_capacity,
+                                  size_t device_fingerprint) {
+  size_t key = 0;
+  hash_combine(key, config.numNodes);
+  hash_combine(key, config.workersPerNode);
+  hash_combine(key, config.cpusPerNode);
+  hash_combine(key, gpu_mem_capacity);
+  hash_combine(key, device_fingerprint);
+  // Operator costs
+  hash_combine(key, config.analytical_cost_model);
+  hash_combine(key, config.device_peak_tflops);
+  hash_combine(key, config.device_memory_bandwidth);
+  hash_combine(key, config.device_kernel_launch_overhead);
+  hash_combine(key, config.cost_db_path);
+  hash_combine(key, config.cost_db_import_only);
+  hash_combine(key, config.simulator_work_space_size);
+  // Synchronization costs
+  hash_combine(key, config.allreduce_algorithm);
+  hash_combine(key, config.machine_model_version);
+  hash_combine(key, config.machine_model_file);
+  hash_combine(key, config.simulator_segment_size);
+  hash_combine(key, config.simulator_max_num_segments);
+  hash_combine(key, config.search_budget);
+  hash_combine(key, config.search_alpha);
+  hash_combine(key, config.search_overlap_backward_update);
+  hash_combine(key, config.base_optimize_threshold);
+  hash_combine(key, config.computationMode);
+  hash_combine(key, config.only_data_parallel);
+  hash_combine(key, config.enable_sample_parallel);
+  hash_combine(key, config.enable_parameter_parallel);
+  hash_combine(key, config.enable_attribute_parallel);
+  hash_combine(key, config.enable_inplace_optimizations);
+  hash_combine(key, config.memory_search);
+  hash_combine(key, config.memory_lambda);
+  hash_combine(key, config.substitution_json_path.value_or(""));
+  return key;
+}
+
 GraphOptimalViewSerialized
     Graph::graph_optimize_task(Task const *task,
                                std::vector<PhysicalRegion> const &regions,
@@ -1563,6 +2224,31 @@ GraphOptimalViewSerialized
                        .only_kind(Memory::GPU_FB_MEM)
                        .best_affinity_to(task->target_proc)
                        .first();
+  // Reuse the result of an earlier search over the same graph, if any
+  std::unique_ptr<SearchCache> search_cache;
+  size_t cache_key = 0;
+  if (!model->config.search_cache_dir.empty()) {
+    search_cache = std::unique_ptr<SearchCache>(new SearchCache(
+        model->config.search_cache_dir,
+        search_context_hash(model->config,
+                            gpu_mem.capacity(),
+                            Simulator::get_device_fingerprint())));
+    std::unique_ptr<Graph> input_graph(model->graph_search->construct_graph());
+    // The structural hash ignores the guids that the cached graph binds the
+    // inputs and weights of the model by
+    cache_key = input_graph->hash();
+    hash_combine(cache_key, model->get_binding_signature());
+    std::vector<char> cached;
+    if (search_cache->load_blob(cache_key, cached) &&
+        cached.size() < GraphOptimalViewSerialized::buffer_size) {
+      log_graph.print("Reusing cached search result for graph %zx",
+                      cache_key);
+      GraphOptimalViewSerialized ret;
+      ret.total_bytes = cached.size();
+      memcpy(ret.data, cached.data(), ret.total_bytes);
+      return ret;
+    }
+  }
   MachineModel *machine;
   if (model->config.machine_model_version == 0) {
     machine =
@@ -1583,6 +2269,10 @@ GraphOptimalViewSerialized
   std::shared_ptr<Simulator> simulator(
       new Simulator(model, model->handlers[0], gpu_mem, machine));
   model->simulator = simulator.get();
+  if (search_cache != nullptr) {
+    model->search->load_cached_costs(*search_cache);
+    model->graph_search->load_cached_costs(*search_cache);
+  }
   std::unique_ptr<Graph> best_graph;
   std::unordered_map<Node, MachineView> optimal_views;
   if (model->config.only_data_parallel) {
@@ -1618,11 +2308,88 @@ GraphOptimalViewSerialized
                           optimal_views);
   }
   Serializer sez;
+  model->serialize_graph_optimal_view(sez, best_graph.get(), optimal_views);
+  assert(sez.get_used_bytes() < GraphOptimalViewSerialized::buffer_size);
+  GraphOptimalViewSerialized ret;
+  ret.total_bytes = sez.get_used_bytes();
+  memcpy(ret.data, sez.get_buffer(), ret.total_bytes);
+  if (search_cache != nullptr) {
+    model->search->save_cached_costs(*search_cache);
+    model->graph_search->save_cached_costs(*search_cache);
+    search_cache->save_blob(cache_key, ret.data, ret.total_bytes);
+  }
+  // Deallocate best_graph
+  // delete best_graph;
+  return ret;
+}
+
+}; // namespace FlexFlow::PCG
+
+namespace FlexFlow {
+
+using PCG::Edge;
+using PCG::Graph;
+using PCG::GraphCostResult;
+using PCG::Node;
+
+void FFModel::register_all_machine_views(
+    int num_nodes,
+    int gpus_per_node,
+    int cpus_per_node,
+    std::vector<MachineView> &valid_views) {
+  // Multi-dimensional, strided views over the GPUs, one per class of views
+  // that are equivalent up to a permutation of the nodes
+  std::vector<MachineView> views = enumerate_machine_views(
+      num_nodes, gpus_per_node, MachineView::GPU, MAX_NUM_MACHINE_VIEW_DIMS);
+  valid_views.insert(valid_views.end(), views.begin(), views.end());
+}
+
+float FFModel::graph_cost(Graph const *graph,
+                          Node const &sink_node,
+                          MachineView const &sink_view,
+                          Node const &source_node,
+                          MachineView const &source_view,
+                          MachineResource const &resources,
+                          bool include_sink_compute_time,
+                          bool constructing_optimal_view) {
+  assert(!graph->inEdges.empty());
+
+  return this->search->graph_cost<float>(graph,
+                                         {source_node, source_view},
+                                         {sink_node, sink_view},
+                                         resources,
+                                         include_sink_compute_time);
+}
+
+void FFModel::construct_optimal_view(
+    Graph const *graph,
+    Node const &sink_node,
+    MachineView const &sink_view,
+    Node const &source_node,
+    MachineView const &source_view,
+    MachineResource const &resources,
+    bool include_sink_compute_time,
+    float optimal_cost,
+    std::unordered_map<Node, MachineView> &optimal_views) {
+  GraphCostResult result =
+      this->search->graph_cost<GraphCostResult>(graph,
+                                                {source_node, source_view},
+                                                {sink_node, sink_view},
+                                                resources,
+                                                include_sink_compute_time);
+
+  optimal_views.insert(result.views.begin(), result.views.end());
+}
+
+void FFModel::serialize_graph_optimal_view(
+    Legion::Serializer &sez,
+    Graph const *graph,
+    std::unordered_map<Node, MachineView> const &optimal_views) const {
   // First serialize graph
-  sez.serialize(best_graph->inEdges.size());
+  sez.serialize(graph->inEdges.size());
   std::unordered_map<Node, int> todos;
   std::vector<Node> opList;
-  for (auto const &it : best_graph->inEdges) {
+  for (auto const &it : graph->inEdges) {
     auto const &inList = it.second;
     todos[it.first] = (int)inList.size();
     if (todos[it.first] == 0) {
@@ -1632,14 +2399,16 @@ GraphOptimalViewSerialized
   size_t node_idx = 0;
   while (node_idx < opList.size()) {
     Node cur_node = opList[node_idx++];
-    auto const &outList = best_graph->outEdges[cur_node];
-    for (auto const &e : outList) {
-      todos[e.dstOp]--;
-      if (todos[e.dstOp] == 0) {
-        opList.push_back(e.dstOp);
+    auto const &out_it = graph->outEdges.find(cur_node);
+    if (out_it != graph->outEdges.end()) {
+      for (auto const &e : out_it->second) {
+        todos[e.dstOp]--;
+        if (todos[e.dstOp] == 0) {
+          opList.push_back(e.dstOp);
+        }
       }
     }
-    auto const &inList = best_graph->inEdges[cur_node];
+    auto const &inList = graph->inEdges.at(cur_node);
     sez.serialize(inList.size());
     for (auto const &e : inList) {
       sez.serialize(e.srcOp.guid);
@@ -1733,6 +2502,12 @@ GraphOptimalViewSerialized
         sez.serialize(reduction->reduction_degree);
         break;
       }
+      case OP_PIPELINE: {
+        Pipeline *pipeline = (Pipeline *)op;
+        sez.serialize(pipeline->pipeline_dim);
+        sez.serialize(pipeline->pipeline_degree);
+        break;
+      }
       case OP_COMBINE: {
         Combine *combine = (Combine *)op;
         sez.serialize(combine->combine_dim);
@@ -1753,101 +2528,14 @@ GraphOptimalViewSerialized
     }
     sez.serialize((size_t)12345678); // safe guard for the end of an op
   }
-  assert(node_idx == best_graph->inEdges.size());
+  assert(node_idx == graph->inEdges.size());
   // Second, serialize optimal machine view
-  printf("opotimal_views.size = %zu\n", optimal_views.size());
   sez.serialize(optimal_views.size());
   for (auto const &it : optimal_views) {
     sez.serialize((size_t)98765432); // safe guard
     sez.serialize(it.first.guid);
     sez.serialize(it.second);
   }
-  assert(sez.get_used_bytes() < GraphOptimalViewSerialized::buffer_size);
-  GraphOptimalViewSerialized ret;
-  ret.total_bytes = sez.get_used_bytes();
-  memcpy(ret.data, sez.get_buffer(), ret.total_bytes);
-  // Deallocate best_graph
-  // delete best_graph;
-  return ret;
-}
-
-}; // namespace FlexFlow::PCG
-
-namespace FlexFlow {
-
-using PCG::Edge;
-using PCG::Graph;
-using PCG::GraphCostResult;
-using PCG::Node;
-
-void FFModel::register_all_machine_views(
-    int num_nodes,
-    int gpus_per_node,
-    int cpus_per_node,
-    std::vector<MachineView> &valid_views) {
-  // Single-parallelism-dimension views
-  for (int i = 1; i <= num_nodes * gpus_per_node; i++) {
-    if (num_nodes * gpus_per_node % i == 0) {
-      MachineView view;
-      view.device_type = MachineView::GPU;
-      view.ndims = 1;
-      view.dim[0] = i;
-      view.stride[0] = 1;
-      view.start_device_id = 0;
-      valid_views.push_back(view);
-    }
-  }
-  // Two-dimensional views
-  /* for (int i = 1; i <= num_nodes; i++) { */
-  /*   for (int j = 1; j <= gpus_per_node; j++) { */
-  /*     MachineView view; */
-  /*     view.device_type = MachineView::GPU; */
-  /*     view.ndims = 2; */
-  /*     view.dim[0] = i; */
-  /*     view.stride[0] = 1; */
-  /*     view.dim[1] = j; */
-  /*     view.stride[1] = 1; */
-  /*     view.start_device_id = 0; */
-  /*     valid_views.push_back(view); */
-  /*   } */
-  /* } */
-}
-
-float FFModel::graph_cost(Graph const *graph,
-                          Node const &sink_node,
-                          MachineView const &sink_view,
-                          Node const &source_node,
-                          MachineView const &source_view,
-                          MachineResource const &resources,
-                          bool include_sink_compute_time,
-                          bool constructing_optimal_view) {
-  assert(!graph->inEdges.empty());
-
-  return this->search->graph_cost<float>(graph,
-                                         {source_node, source_view},
-                                         {sink_node, sink_view},
-                                         resources,
-                                         include_sink_compute_time);
-}
-
-void FFModel::construct_optimal_view(
-    Graph const *graph,
-    Node const &sink_node,
-    MachineView const &sink_view,
-    Node const &source_node,
-    MachineView const &source_view,
-    MachineResource const &resources,
-    bool include_sink_compute_time,
-    float optimal_cost,
-    std::unordered_map<Node, MachineView> &optimal_views) {
-  GraphCostResult result =
-      this->search->graph_cost<GraphCostResult>(graph,
-                                                {source_node, source_view},
-                                                {sink_node, sink_view},
-                                                resources,
-                                                include_sink_compute_time);
-
-  optimal_views.insert(result.views.begin(), result.views.end());
 }
 
 void FFModel::deserialize_graph_optimal_view(
@@ -2058,6 +2746,10 @@ void FFModel::deserialize_graph_optimal_view(
         node = Group_by::deserialize(*this, dez, inputs, num_inputs);
         break;
       }
+      case OP_EXPERTS: {
+        node = Experts::deserialize(*this, dez, inputs, num_inputs);
+        break;
+      }
       case OP_AGGREGATE: {
         // node = Aggregate::deserialize(*this, dez, inputs, num_inputs);
         int n;
@@ -2131,6 +2823,15 @@ void FFModel::deserialize_graph_optimal_view(
                                              {reduction_dim, reduction_degree});
         break;
       }
+      case OP_PIPELINE: {
+        assert(num_inputs == 1);
+        int pipeline_dim, pipeline_degree;
+        dez.deserialize(pipeline_dim);
+        dez.deserialize(pipeline_degree);
+        node = get_or_create_node<Pipeline>(inputs[0],
+                                            {pipeline_dim, pipeline_degree});
+        break;
+      }
       case OP_FUSED_PARALLEL: {
         assert(num_inputs == 1);
         std::vector<ParallelOpInfo> parallel_ops;
@@ -54,7 +54,11 @@ void GlorotUniform::init(FFModel const *ff, const ParallelTensor p) {
                           TaskArgument(this, sizeof(GlorotUniform)));
     // regions[0]: p->region
     launcher.add_region_requirement(
-        RegionRequirement(p->region, WRITE_ONLY, EXCLUSIVE, p->region));
+        RegionRequirement(p->region,
+                          WRITE_ONLY,
+                          EXCLUSIVE,
+                          p->region,
+                          p->region_tag));
     launcher.add_field(0, FID_DATA);
     runtime->execute_task(ctx, launcher);
   } else if (p->sync_type == ParameterSyncType::NCCL) {
@@ -70,8 +74,12 @@ void GlorotUniform::init(FFModel const *ff, const ParallelTensor p) {
                            false,
                            0,
                            p->machine_view.hash());
-    launcher.add_region_requirement(RegionRequirement(
-        p->part, 0 /*projection id*/, WRITE_ONLY, EXCLUSIVE, p->region));
+    launcher.add_region_requirement(RegionRequirement(p->part,
+                                                      0 /*projection id*/,
+                                                      WRITE_ONLY,
+                                                      EXCLUSIVE,
+                                                      p->region,
+                                                      p->region_tag));
     launcher.add_field(0, FID_DATA);
     runtime->execute_index_space(ctx, launcher);
   } else {
@@ -94,7 +102,11 @@ void ZeroInitializer::init(FFModel const *ff, const ParallelTensor p) {
                           TaskArgument(&meta, sizeof(ZeroInitMeta)));
     // regions[0]: p->region
     launcher.add_region_requirement(
-        RegionRequirement(p->region, WRITE_ONLY, EXCLUSIVE, p->region));
+        RegionRequirement(p->region,
+                          WRITE_ONLY,
+                          EXCLUSIVE,
+                          p->region,
+                          p->region_tag));
     launcher.add_field(0, FID_DATA);
     runtime->execute_task(ctx, launcher);
   } else if (p->sync_type == ParameterSyncType::NCCL) {
@@ -112,8 +124,12 @@ void ZeroInitializer::init(FFModel const *ff, const ParallelTensor p) {
                            false,
                            0,
                            p->machine_view.hash());
-    launcher.add_region_requirement(RegionRequirement(
-        p->part, 0 /*projection id*/, WRITE_ONLY, EXCLUSIVE, p->region));
+    launcher.add_region_requirement(RegionRequirement(p->part,
+                                                      0 /*projection id*/,
+                                                      WRITE_ONLY,
+                                                      EXCLUSIVE,
+                                                      p->region,
+                                                      p->region_tag));
     launcher.add_field(0, FID_DATA);
     runtime->execute_index_space(ctx, launcher);
   } else {
@@ -185,7 +201,11 @@ void UniformInitializer::init(FFModel const *ff, const ParallelTensor p) {
                           TaskArgument(this, sizeof(UniformInitializer)));
     // regions[0]: p->region
     launcher.add_region_requirement(
-        RegionRequirement(p->region, WRITE_ONLY, EXCLUSIVE, p->region));
+        RegionRequirement(p->region,
+                          WRITE_ONLY,
+                          EXCLUSIVE,
+                          p->region,
+                          p->region_tag));
     launcher.add_field(0, FID_DATA);
     runtime->execute_task(ctx, launcher);
   } else if (p->sync_type == ParameterSyncType::NCCL) {
@@ -200,8 +220,12 @@ void UniformInitializer::init(FFModel const *ff, const ParallelTensor p) {
                            false,
                            0,
                            p->machine_view.hash());
-    launcher.add_region_requirement(RegionRequirement(
-        p->part, 0 /*projection id*/, WRITE_ONLY, EXCLUSIVE, p->region));
+    launcher.add_region_requirement(RegionRequirement(p->part,
+                                                      0 /*projection id*/,
+                                                      WRITE_ONLY,
+                                                      EXCLUSIVE,
+                                                      p->region,
+                                                      p->region_tag));
     launcher.add_field(0, FID_DATA);
     runtime->execute_index_space(ctx, launcher);
   } else {
@@ -223,7 +247,11 @@ void NormInitializer::init(FFModel const *ff, const ParallelTensor p) {
                           TaskArgument(this, sizeof(NormInitializer)));
     // regions[0]: p->region
     launcher.add_region_requirement(
-        RegionRequirement(p->region, WRITE_ONLY, EXCLUSIVE, p->region));
+        RegionRequirement(p->region,
+                          WRITE_ONLY,
+                          EXCLUSIVE,
+                          p->region,
+                          p->region_tag));
     launcher.add_field(0, FID_DATA);
     runtime->execute_task(ctx, launcher);
   } else if (p->sync_type == ParameterSyncType::NCCL) {
@@ -238,8 +266,12 @@ void NormInitializer::init(FFModel const *ff, const ParallelTensor p) {
                            false,
                            0,
                            p->machine_view.hash());
-    launcher.add_region_requirement(RegionRequirement(
-        p->part, 0 /*projection id*/, WRITE_ONLY, EXCLUSIVE, p->region));
+    launcher.add_region_requirement(RegionRequirement(p->part,
+                                                      0 /*projection id*/,
+                                                      WRITE_ONLY,
+                                                      EXCLUSIVE,
+                                                      p->region,
+                                                      p->region_tag));
     launcher.add_field(0, FID_DATA);
     runtime->execute_index_space(ctx, launcher);
   } else {
@@ -268,7 +300,11 @@ void ConstantInitializer::init(FFModel const *ff, const ParallelTensor p) {
                           TaskArgument(this, sizeof(ConstantInitializer)));
     // regions[0]: p->region
     launcher.add_region_requirement(
-        RegionRequirement(p->region, WRITE_ONLY, EXCLUSIVE, p->region));
+        RegionRequirement(p->region,
+                          WRITE_ONLY,
+                          EXCLUSIVE,
+                          p->region,
+                          p->region_tag));
     launcher.add_field(0, FID_DATA);
     runtime->execute_task(ctx, launcher);
   } else if (p->sync_type == ParameterSyncType::NCCL) {
@@ -283,8 +319,12 @@ void ConstantInitializer::init(FFModel const *ff, const ParallelTensor p) {
                            false,
                            0,
                            p->machine_view.hash());
-    launcher.add_region_requirement(RegionRequirement(
-        p->part, 0 /*projection id*/, WRITE_ONLY, EXCLUSIVE, p->region));
+    launcher.add_region_requirement(RegionRequirement(p->part,
+                                                      0 /*projection id*/,
+                                                      WRITE_ONLY,
+                                                      EXCLUSIVE,
+                                                      p->region,
+                                                      p->region_tag));
     launcher.add_field(0, FID_DATA);
     runtime->execute_index_space(ctx, launcher);
   } else {
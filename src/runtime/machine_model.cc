@@ -970,10 +970,29 @@ NetworkedMachineModel::NetworkedMachineModel(int num_nodes,
                                              std::vector<int> const &topology,
                                              size_t capacity,
                                              float link_bandwidth)
+    : NetworkedMachineModel(
+          num_nodes,
+          num_gpus_per_node,
+          num_switches,
+          network_latency,
+          SparseConnectionMatrix::from_dense(topology,
+                                             num_nodes + num_switches),
+          capacity,
+          link_bandwidth) {}
+
+NetworkedMachineModel::NetworkedMachineModel(
+    int num_nodes,
+    int num_gpus_per_node,
+    int num_switches,
+    float network_latency,
+    SparseConnectionMatrix const &topology,
+    size_t capacity,
+    float link_bandwidth)
     : num_nodes(num_nodes), num_gpus_per_node(num_gpus_per_node),
       num_switches(num_switches), link_bandwidth(link_bandwidth),
       network_latency(network_latency), conn_matrix(topology) {
   version = 0;
+  assert(conn_matrix.num_devs() == num_nodes + num_switches);
 
   num_gpus = num_nodes * num_gpus_per_node;
   inter_gpu_bandwidth = 20 * 1024 * 1024.0f; /* B/ms*/
@@ -1038,23 +1057,7 @@ NetworkedMachineModel::NetworkedMachineModel(int num_nodes,
 
   // network links
   total_devs = num_nodes + num_switches;
-  for (int i = 0; i < total_devs; i++) {
-    for (int j = 0; j < total_devs; j++) {
-      // if (conn_matrix[i * total_devs + j] > 0) {
-      int device_id = i * total_devs + j;
-      std::string link_name =
-          "LINK " + std::to_string(i) + "-" + std::to_string(j);
-      ids_to_nw_comm_device[device_id] =
-          new CommDevice(link_name,
-                         CommDevice::NW_COMM,
-                         -1,
-                         -1,
-                         device_id,
-                         0,
-                         conn_matrix[i * total_devs + j] * link_bandwidth);
-    }
-    // }
-  }
+  update_links();
 
   routing_strategy = new ShortestPathNetworkRoutingStrategy(
       conn_matrix, ids_to_nw_comm_device, total_devs);
@@ -1069,41 +1072,62 @@ int NetworkedMachineModel::get_version() const {
   return version;
 }
 
-void NetworkedMachineModel::update_route() {
-  // nominal network links
-  int total_devs = num_nodes + num_switches;
-  for (int i = 0; i < num_nodes; i++) {
-    for (int j = 0; j < num_nodes; j++) {
-      int device_id = i * total_devs + j;
-      std::string link_name =
-          "NOMINAL " + std::to_string(i) + "-" + std::to_string(j);
-      if (ids_to_nw_nominal_device.find(device_id) ==
-          ids_to_nw_nominal_device.end()) {
-        ids_to_nw_nominal_device[device_id] = new NominalCommDevice(
-            link_name, device_id, total_devs, routing_strategy);
+void NetworkedMachineModel::update_links() {
+  // links that are no longer in the topology are kept with no bandwidth,
+  // since routes computed earlier may still refer to them
+  for (auto const &it : ids_to_nw_comm_device) {
+    it.second->bandwidth = 0;
+  }
+  for (int i = 0; i < total_devs; i++) {
+    for (size_t k = conn_matrix.row_begin(i); k < conn_matrix.row_end(i);
+         k++) {
+      int j = conn_matrix.neighbor(k);
+      size_t device_id = (size_t)i * total_devs + j;
+      if (ids_to_nw_comm_device.find(device_id) ==
+          ids_to_nw_comm_device.end()) {
+        std::string link_name =
+            "LINK " + std::to_string(i) + "-" + std::to_string(j);
+        ids_to_nw_comm_device[device_id] = new CommDevice(
+            link_name, CommDevice::NW_COMM, -1, -1, device_id, 0, 0);
       }
-      ids_to_nw_nominal_device[device_id]->reset();
-      // ids_to_nw_nominal_device[device_id]->set_physical_paths(routing_strategy->get_routes(i,
-      // j));
+      ids_to_nw_comm_device[device_id]->bandwidth =
+          conn_matrix.weight(k) * link_bandwidth;
     }
   }
+}
 
-  // std::vector<int> indicies(num_nodes);
-  // std::iota(ivec.begin(), ivec.end(), 0);
-
-  // for (int i = 0; i < num_nodes; i++) {
+void NetworkedMachineModel::update_route() {
+  // Routes between a pair of nodes are only expanded when a nominal link is
+  // first used, but the shortest-path trees they are read from are computed
+  // for all sources at once
+  for (auto const &it : ids_to_nw_nominal_device) {
+    it.second->routing_strategy = routing_strategy;
+    it.second->reset();
+  }
+  routing_strategy->clear();
   parallel_for(num_nodes, [&](int start, int end) {
     for (int i = start; i < end; i++) {
-      // std::cerr << "node i " << i << std::endl;
-      auto all_routes = routing_strategy->get_routes_from_src(i);
-      for (int j = 0; j < num_nodes; j++) {
-        ids_to_nw_nominal_device[i * total_devs + j]->set_physical_paths(
-            all_routes[j]);
-      }
+      routing_strategy->precompute_routes(i);
     }
   });
 }
 
+NominalCommDevice *
+    NetworkedMachineModel::get_nominal_device(int src_node,
+                                              int dst_node) const {
+  size_t device_id = (size_t)src_node * total_devs + dst_node;
+  auto const &it = ids_to_nw_nominal_device.find(device_id);
+  if (it != ids_to_nw_nominal_device.end()) {
+    return it->second;
+  }
+  std::string link_name =
+      "NOMINAL " + std::to_string(src_node) + "-" + std::to_string(dst_node);
+  NominalCommDevice *device = new NominalCommDevice(
+      link_name, device_id, total_devs, routing_strategy);
+  ids_to_nw_nominal_device[device_id] = device;
+  return device;
+}
+
 CompDevice *NetworkedMachineModel::get_gpu(int device_id) const {
   assert(id_to_gpu.find(device_id) != id_to_gpu.end());
   return id_to_gpu.at(device_id);
@@ -1127,7 +1151,7 @@ float NetworkedMachineModel::get_link_bandwidth() const {
 }
 
 float NetworkedMachineModel::get_link_bandwidth(int src, int dst) const {
-  return link_bandwidth * conn_matrix[src * total_devs + dst];
+  return link_bandwidth * conn_matrix.get(src, dst);
 }
 
 float NetworkedMachineModel::get_inter_node_gpu_bandwidth() const {
@@ -1156,12 +1180,12 @@ std::vector<CommDevice *>
     if (src_mem->node_id == tar_mem->node_id) {
       return ret;
     } else {
-      int device_id = src_mem->node_id * total_devs + tar_mem->node_id;
+      NominalCommDevice *nominal =
+          get_nominal_device(src_mem->node_id, tar_mem->node_id);
       if (pipelined) {
-        ret.emplace_back(ids_to_nw_nominal_device.at(device_id));
+        ret.emplace_back(nominal);
       } else {
-        std::vector<CommDevice *> physical_path =
-            ids_to_nw_nominal_device.at(device_id)->expand_to_physical();
+        std::vector<CommDevice *> physical_path = nominal->expand_to_physical();
         ret.insert(ret.end(), physical_path.cbegin(), physical_path.cend());
       }
     }
@@ -1174,12 +1198,12 @@ std::vector<CommDevice *>
       if (pcie_on) {
         ret.emplace_back(id_to_gputodram_comm_device.at(src_mem->device_id));
       }
-      int device_id = src_mem->node_id * total_devs + tar_mem->node_id;
+      NominalCommDevice *nominal =
+          get_nominal_device(src_mem->node_id, tar_mem->node_id);
       if (pipelined) {
-        ret.emplace_back(ids_to_nw_nominal_device.at(device_id));
+        ret.emplace_back(nominal);
       } else {
-        std::vector<CommDevice *> physical_path =
-            ids_to_nw_nominal_device.at(device_id)->expand_to_physical();
+        std::vector<CommDevice *> physical_path = nominal->expand_to_physical();
         ret.insert(ret.end(), physical_path.cbegin(), physical_path.cend());
       }
       if (pcie_on) {
@@ -1193,12 +1217,12 @@ std::vector<CommDevice *>
         ret.emplace_back(id_to_dramtogpu_comm_device.at(tar_mem->device_id));
       }
     } else {
-      int device_id = src_mem->node_id * total_devs + tar_mem->node_id;
+      NominalCommDevice *nominal =
+          get_nominal_device(src_mem->node_id, tar_mem->node_id);
       if (pipelined) {
-        ret.emplace_back(ids_to_nw_nominal_device.at(device_id));
+        ret.emplace_back(nominal);
       } else {
-        std::vector<CommDevice *> physical_path =
-            ids_to_nw_nominal_device.at(device_id)->expand_to_physical();
+        std::vector<CommDevice *> physical_path = nominal->expand_to_physical();
         ret.insert(ret.end(), physical_path.cbegin(), physical_path.cend());
       }
       if (pcie_on) {
@@ -1215,12 +1239,12 @@ std::vector<CommDevice *>
       if (pcie_on) {
         ret.emplace_back(id_to_gputodram_comm_device.at(src_mem->device_id));
       }
-      int device_id = src_mem->node_id * total_devs + tar_mem->node_id;
+      NominalCommDevice *nominal =
+          get_nominal_device(src_mem->node_id, tar_mem->node_id);
       if (pipelined) {
-        ret.emplace_back(ids_to_nw_nominal_device.at(device_id));
+        ret.emplace_back(nominal);
       } else {
-        std::vector<CommDevice *> physical_path =
-            ids_to_nw_nominal_device.at(device_id)->expand_to_physical();
+        std::vector<CommDevice *> physical_path = nominal->expand_to_physical();
         ret.insert(ret.end(), physical_path.cbegin(), physical_path.cend());
       }
     }
@@ -1243,8 +1267,7 @@ CommDevice *NetworkedMachineModel::get_nominal_path(MemDevice *src_mem,
   if (src_mem->node_id == tar_mem->node_id) {
     return nullptr;
   }
-  int device_id = src_mem->node_id * num_nodes + tar_mem->node_id;
-  return ids_to_nw_nominal_device.at(device_id);
+  return get_nominal_device(src_mem->node_id, tar_mem->node_id);
 }
 
 // TODO
@@ -1261,21 +1284,17 @@ void NetworkedMachineModel::set_pipeline(bool state) {
 }
 
 void NetworkedMachineModel::set_topology(ConnectionMatrix const &conn) {
+  set_topology(SparseConnectionMatrix::from_dense(conn, total_devs));
+}
+
+void NetworkedMachineModel::set_topology(SparseConnectionMatrix const &conn) {
+  assert(conn.num_devs() == total_devs);
   conn_matrix = conn;
-  int total_devs = num_nodes + num_switches;
-  for (int i = 0; i < total_devs; i++) {
-    for (int j = 0; j < total_devs; j++) {
-      // if (conn_matrix[i * total_devs + j] > 0) {
-      int device_id = i * total_devs + j;
-      ids_to_nw_comm_device[device_id]->bandwidth =
-          conn[i * total_devs + j] * link_bandwidth;
-    }
-    // }
-  }
+  update_links();
   update_route();
 }
 
-ConnectionMatrix const &NetworkedMachineModel::get_conn_matrix() {
+SparseConnectionMatrix const &NetworkedMachineModel::get_conn_matrix() {
   return conn_matrix;
 }
 
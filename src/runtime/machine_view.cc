@@ -1,4 +1,7 @@
 #include "flexflow/machine_view.h"
+#include <algorithm>
+#include <functional>
+#include <map>
 
 namespace FlexFlow {
 
@@ -109,6 +112,141 @@ std::ostream &operator<<(std::ostream &s, MachineView const &view) {
   return s;
 }
 
+// The devices of the points of view, with the first dimension varying the
+// fastest, or nothing if two points share a device or one falls outside of
+// the num_devices devices
+static std::vector<int> view_devices(MachineView const &view,
+                                     int num_devices) {
+  std::vector<int> devices(1, view.start_device_id);
+  for (int i = 0; i < view.ndims; i++) {
+    size_t num_points = devices.size();
+    for (int p = 1; p < view.dim[i]; p++) {
+      for (size_t j = 0; j < num_points; j++) {
+        devices.push_back(devices[j] + p * view.stride[i]);
+      }
+    }
+  }
+  std::vector<bool> used(num_devices, false);
+  for (int device : devices) {
+    if (device < 0 || device >= num_devices || used[device]) {
+      return {};
+    }
+    used[device] = true;
+  }
+  return devices;
+}
+
+// Identifies the class of views that a permutation of the nodes maps onto
+// view: its dimensions, and for each point the device within its node and
+// the order in which its node first appears
+static std::vector<int> node_symmetry_key(MachineView const &view,
+                                          std::vector<int> const &devices,
+                                          int devices_per_node) {
+  std::vector<int> key(view.dim, view.dim + view.ndims);
+  std::map<int, int> node_order;
+  for (int device : devices) {
+    int order = node_order.size();
+    auto it = node_order.emplace(device / devices_per_node, order).first;
+    key.push_back(it->second);
+    key.push_back(device % devices_per_node);
+  }
+  return key;
+}
+
+std::vector<MachineView>
+    enumerate_machine_views(int num_nodes,
+                            int devices_per_node,
+                            MachineView::DeviceType device_type,
+                            int max_ndims) {
+  assert(num_nodes > 0 && devices_per_node > 0);
+  int num_devices = num_nodes * devices_per_node;
+  // Strides within a node, then across the nodes, in increasing order
+  std::vector<int> strides;
+  for (int s = 1; s < devices_per_node; s++) {
+    if (devices_per_node % s == 0) {
+      strides.push_back(s);
+    }
+  }
+  for (int s = 1; s < num_nodes; s++) {
+    if (num_nodes % s == 0) {
+      strides.push_back(s * devices_per_node);
+    }
+  }
+  std::vector<MachineView> views;
+  // The index in views and the last device of the view kept for each class
+  std::map<std::vector<int>, std::pair<size_t, int>> classes;
+  MachineView view;
+  view.device_type = device_type;
+  view.start_device_id = 0;
+  // The single-device view
+  view.ndims = 1;
+  view.dim[0] = 1;
+  view.stride[0] = 1;
+  views.push_back(view);
+  std::function<void(int, int)> extend = [&](int i, int num_parts) {
+    if (i == view.ndims) {
+      std::vector<int> devices = view_devices(view, num_devices);
+      if (devices.empty()) {
+        return;
+      }
+      int last_device = *std::max_element(devices.begin(), devices.end());
+      std::vector<int> key =
+          node_symmetry_key(view, devices, devices_per_node);
+      auto it = classes.find(key);
+      if (it == classes.end()) {
+        classes[key] = std::make_pair(views.size(), last_device);
+        views.push_back(view);
+      } else if (last_device < it->second.second) {
+        views[it->second.first] = view;
+        it->second.second = last_device;
+      }
+      return;
+    }
+    int max_degree = num_devices / num_parts;
+    for (int degree = 2; degree <= max_degree; degree++) {
+      if (max_degree % degree != 0) {
+        continue;
+      }
+      for (int stride : strides) {
+        if ((degree - 1) * stride >= num_devices) {
+          break;
+        }
+        view.dim[i] = degree;
+        view.stride[i] = stride;
+        extend(i + 1, num_parts * degree);
+      }
+    }
+  };
+  for (int ndims = 1; ndims <= std::min(max_ndims, MAX_TENSOR_DIM); ndims++) {
+    view.ndims = ndims;
+    extend(0, 1);
+  }
+  return views;
+}
+
+std::vector<int> get_machine_view_starts(MachineView const &view,
+                                         int num_nodes,
+                                         int devices_per_node) {
+  // The offset of the last device of the view, and the devices it uses on
+  // each node
+  int last_offset = 0, used_per_node = 1;
+  for (int i = 0; i < view.ndims; i++) {
+    last_offset += (view.dim[i] - 1) * view.stride[i];
+    if (view.stride[i] < devices_per_node) {
+      used_per_node += (view.dim[i] - 1) * view.stride[i];
+    }
+  }
+  std::vector<int> starts;
+  for (int start = 0; start + last_offset < num_nodes * devices_per_node;
+       start++) {
+    int device = start % devices_per_node;
+    if (device == 0 || device + used_per_node <= devices_per_node) {
+      starts.push_back(start);
+    }
+  }
+  return starts;
+}
+
 MachineResource::MachineResource(FFConfig const &config)
     : num_nodes(config.numNodes), all_cpus_per_node(config.cpusPerNode),
       available_cpus_per_node(config.cpusPerNode),
@@ -16,9 +16,10 @@
 #include "flexflow/model.h"
 #if defined(FF_USE_CUDA) || defined(FF_USE_HIP_CUDA)
 #include "flexflow/utils/cuda_helper.h"
-#else
+#elif defined(FF_USE_HIP_ROCM)
 #include "flexflow/utils/hip_helper.h"
 #endif
+#include "flexflow/allreduce_schedule.h"
 #include "flexflow/ffconst_utils.h"
 #include "flexflow/graph.h"
 #include "flexflow/mapper.h"
@@ -35,6 +36,7 @@
 #include "flexflow/ops/element_binary.h"
 #include "flexflow/ops/element_unary.h"
 #include "flexflow/ops/embedding.h"
+#include "flexflow/ops/experts.h"
 #include "flexflow/ops/flat.h"
 #include "flexflow/ops/fused.h"
 #include "flexflow/ops/groupby.h"
@@ -52,8 +54,10 @@
 #include "flexflow/parallel_ops/combine.h"
 #include "flexflow/parallel_ops/fused_parallel_op.h"
 #include "flexflow/parallel_ops/partition.h"
+#include "flexflow/parallel_ops/pipeline.h"
 #include "flexflow/parallel_ops/reduction.h"
 #include "flexflow/parallel_ops/replicate.h"
+#include "flexflow/strategy_file.h"
 #include "flexflow/substitution.h"
 #include "flexflow/utils/random_utils.h"
 #include "flexflow/utils/test_utils.h"
@@ -248,26 +252,30 @@ void Op::zero_grad(FFModel const &ff) {
   }
   Runtime *runtime = ff.config.lg_hlr;
   Context ctx = ff.config.lg_ctx;
+  std::vector<ParallelTensor> grads;
+  for (int i = 0; i < numWeights; i++) {
+    // The dense gradients of the tables with sparse gradients are never used
+    if (ff.optimizer != NULL &&
+        ff.optimizer->sparse_gradients.count(weights[i]->region) > 0) {
+      continue;
+    }
+    grads.push_back(weights[i]);
+  }
+  for (int i = 0; i < numOutputs; i++) {
+    grads.push_back(outputs[i]);
+  }
   ArgumentMap argmap;
   ZeroInitMeta meta;
   meta.op_ptr = this;
-  meta.num_regions = numWeights + numOutputs;
+  meta.num_regions = grads.size();
   assert(meta.num_regions <= ZeroInitMeta::MAX_NUM_REGIONS);
   IndexSpace parallel_is = IndexSpace::NO_SPACE;
-  for (int i = 0; i < numWeights; i++) {
-    meta.data_types[i] = weights[i]->data_type;
+  for (size_t i = 0; i < grads.size(); i++) {
+    meta.data_types[i] = grads[i]->data_type;
     if (parallel_is == IndexSpace::NO_SPACE) {
-      parallel_is = weights[i]->parallel_is;
+      parallel_is = grads[i]->parallel_is;
     } else {
-      assert(parallel_is == weights[i]->parallel_is);
-    }
-  }
-  for (int i = 0; i < numOutputs; i++) {
-    meta.data_types[i + numWeights] = outputs[i]->data_type;
-    if (parallel_is == IndexSpace::NO_SPACE) {
-      parallel_is = outputs[i]->parallel_is;
-    } else {
-      assert(parallel_is == outputs[i]->parallel_is);
+      assert(parallel_is == grads[i]->parallel_is);
     }
   }
   IndexLauncher launcher(ZERO_INIT_TASK_ID,
@@ -278,26 +286,15 @@ void Op::zero_grad(FFModel const &ff) {
                          false /*must*/,
                          0 /*mapper_id*/,
                          outputs[0]->machine_view.hash());
-  for (int i = 0; i < numWeights; i++) {
-    launcher.add_region_requirement(RegionRequirement(weights[i]->part_grad,
+  for (size_t i = 0; i < grads.size(); i++) {
+    launcher.add_region_requirement(RegionRequirement(grads[i]->part_grad,
                                                       0 /*projection id*/,
                                                       WRITE_ONLY,
                                                       EXCLUSIVE,
-                                                      weights[i]->region_grad));
+                                                      grads[i]->region_grad,
+                                                      grads[i]->region_tag));
     launcher.add_field(i, FID_DATA);
   }
-  for (int i = 0; i < numOutputs; i++) {
-    launcher.add_region_requirement(RegionRequirement(outputs[i]->part_grad,
-                                                      0 /*projection id*/,
-                                                      WRITE_ONLY,
-                                                      EXCLUSIVE,
-                                                      outputs[i]->region_grad));
-    // LogicalRegion lr = outputs[i]->region_grad;
-    // printf("zero_grad:output[%d]: region(%d,%d,%d)\n", i,
-    // lr.get_index_space().get_id(), lr.get_field_space().get_id(),
-    // lr.get_tree_id());
-    launcher.add_field(i + numWeights, FID_DATA);
-  }
   runtime->execute_index_space(ctx, launcher);
 }
 
@@ -1017,6 +1014,36 @@ void Op::set_argumentmap_for_forward(FFModel const &ff, ArgumentMap &argmap) {
   }
 }
 
+void Op::free_metas(FFModel const &ff) {
+  Context ctx = ff.config.lg_ctx;
+  Runtime *runtime = ff.config.lg_hlr;
+  // The metas are not tied to any region, so the tasks still using them must
+  // finish before they are deleted
+  runtime->issue_execution_fence(ctx);
+  ArgumentMap argmap;
+  set_argumentmap_for_forward(ff, argmap);
+  IndexLauncher launcher(OP_FREE_METAS_TASK_ID,
+                         parallel_is,
+                         TaskArgument(NULL, 0),
+                         argmap,
+                         Predicate::TRUE_PRED,
+                         false /*must*/,
+                         0 /*mapper_id*/,
+                         outputs[0]->machine_view.hash());
+  runtime->execute_index_space(ctx, launcher);
+  for (int i = 0; i < MAX_NUM_WORKERS; i++) {
+    meta[i] = NULL;
+  }
+}
+
+void Op::free_metas_task(Task const *task,
+                         std::vector<PhysicalRegion> const &regions,
+                         Context ctx,
+                         Runtime *runtime) {
+  OpMeta *m = *((OpMeta **)task->local_args);
+  delete m;
+}
+
 void Op::set_argumentmap_for_backward(FFModel const &ff, ArgumentMap &argmap) {
   Context ctx = ff.config.lg_ctx;
   Runtime *runtime = ff.config.lg_hlr;
@@ -1156,13 +1183,14 @@ OpMeta::OpMeta(FFHandler _handle, Op const *op) : OpMeta(_handle) {
   }
 }
 
-FFModel::FFModel(FFConfig &_config)
+FFModel::FFModel(FFConfig &_config, bool cpu_only)
     : op_global_guid(OP_GUID_FIRST_VALID),
       layer_global_guid(LAYER_GUID_FIRST_VALID),
       tensor_global_guid(TENSOR_GUID_FIRST_VALID),
       parallel_tensor_global_guid(PARALLEL_TENSOR_GUID_FIRST_VALID),
       node_global_guid(NODE_GUID_FIRST_VALID), config(_config), optimizer(NULL),
-      loss_op(NULL), metrics_op(NULL), simulator(NULL) {
+      loss_op(NULL), metrics_op(NULL), simulator(NULL),
+      collect_runtime_stats(false), trace_generation(0) {
   this->search = new PCG::SearchHelper(this);
   this->graph_search = new PCG::GraphSearchHelper(this);
 
@@ -1187,6 +1215,9 @@ FFModel::FFModel(FFConfig &_config)
   //} else {
   //  dataLoader = new DataLoader(config.datasetPath);
   //}
+  if (cpu_only) {
+    return;
+  }
 
   ArgumentMap argmap;
   Rect<1> task_rect(Point<1>(0),
@@ -1230,6 +1261,38 @@ ncclComm_t *FFModel::find_nccl_comms(MachineView const &view) const {
     return it->second;
   }
 }
+
+void FFModel::create_nccl_comms(MachineView const &view) {
+  if (view_hash_to_nccl_comms.find(view.hash()) !=
+      view_hash_to_nccl_comms.end()) {
+    return;
+  }
+  Context ctx = config.lg_ctx;
+  Runtime *runtime = config.lg_hlr;
+  TaskLauncher launcher(NCCL_GETUNIQUEID_TASK_ID, TaskArgument(NULL, 0));
+  Future future = runtime->execute_task(ctx, launcher);
+  ncclUniqueId ncclId = future.get_result<ncclUniqueId>();
+  IndexSpace task_is = get_or_create_task_is(view);
+  ArgumentMap argmap;
+  IndexLauncher index_launcher(NCCL_INIT_COMMS_TASK_ID,
+                               task_is,
+                               TaskArgument(&ncclId, sizeof(ncclUniqueId)),
+                               argmap,
+                               Predicate::TRUE_PRED,
+                               false /*must*/,
+                               0 /*mapper_id*/,
+                               view.hash() /*MappingTagID*/);
+  FutureMap fm = runtime->execute_index_space(ctx, index_launcher);
+  fm.wait_all_results();
+  int idx = 0;
+  Domain task_domain = runtime->get_index_space_domain(ctx, task_is);
+  ncclComm_t *nccl_comms =
+      (ncclComm_t *)malloc(sizeof(ncclComm_t) * task_domain.get_volume());
+  for (Domain::DomainPointIterator it(task_domain); it; it++, idx++) {
+    nccl_comms[idx] = fm.get_result<ncclComm_t>(*it);
+  }
+  view_hash_to_nccl_comms[view.hash()] = nccl_comms;
+}
 #endif
 
 template <int NDIM>
@@ -1865,6 +1928,78 @@ void FFModel::create_aliased_partition_with_dim2(
   part = runtime->get_logical_partition(ctx, region, ip);
 }
 
+void FFModel::create_micro_batch_partition(int num_dims,
+                                           const ParallelDim dims[],
+                                           int micro_batch_dim,
+                                           int num_micro_batches,
+                                           int micro_batch,
+                                           IndexSpace const &part_is,
+                                           LogicalRegion const &region,
+                                           LogicalPartition &part) {
+  Context ctx = config.lg_ctx;
+  Runtime *runtime = config.lg_hlr;
+  Domain task_domain = runtime->get_index_space_domain(ctx, part_is);
+  switch ((num_dims - 1) * MAX_TENSOR_DIM + task_domain.get_dim() - 1) {
+#define DIMFUNC(NDIM, TDIM)                                                    \
+  case (NDIM - 1) * MAX_TENSOR_DIM + (TDIM - 1): {                             \
+    IndexSpaceT<TDIM> part_is_t(part_is);                                      \
+    return create_micro_batch_partition_with_dim2<NDIM, TDIM>(                 \
+        dims,                                                                  \
+        micro_batch_dim,                                                       \
+        num_micro_batches,                                                     \
+        micro_batch,                                                           \
+        part_is_t,                                                             \
+        region,                                                                \
+        part);                                                                 \
+  }
+    LEGION_FOREACH_NN(DIMFUNC)
+#undef DIMFUNC
+    default:
+      assert(false && "Unsupported NDIM/TDIM");
+  }
+}
+
+template <int NDIM, int TDIM>
+void FFModel::create_micro_batch_partition_with_dim2(
+    const ParallelDim dims[],
+    int micro_batch_dim,
+    int num_micro_batches,
+    int micro_batch,
+    IndexSpaceT<TDIM> const &part_is,
+    LogicalRegion const &region,
+    LogicalPartition &part) {
+  Context ctx = config.lg_ctx;
+  Runtime *runtime = config.lg_hlr;
+  Transform<NDIM, TDIM> transform;
+  Point<NDIM> ext_lo, ext_hi;
+  Rect<NDIM> rect =
+      runtime->get_index_space_domain(ctx, region.get_index_space());
+  for (int i = 0; i < NDIM; i++) {
+    int nparts = dims[i].degree;
+    ext_lo[i] = 0;
+    ext_hi[i] = (rect.hi[i] - rect.lo[i] + nparts) / nparts - 1;
+  }
+  for (int i = 0; i < NDIM; i++) {
+    for (int j = 0; j < TDIM; j++) {
+      if (dims[i].parallel_idx == j) {
+        transform[i][j] = ext_hi[i] + 1;
+      } else {
+        transform[i][j] = 0;
+      }
+    }
+  }
+  // each part keeps its own slice of the micro-batch dimension
+  coord_t slice = (ext_hi[micro_batch_dim] + 1) / num_micro_batches;
+  assert(slice * num_micro_batches == ext_hi[micro_batch_dim] + 1);
+  ext_lo[micro_batch_dim] = slice * micro_batch;
+  ext_hi[micro_batch_dim] = ext_lo[micro_batch_dim] + slice - 1;
+  Rect<NDIM> extent(ext_lo, ext_hi);
+  IndexPartition ip = runtime->create_partition_by_restriction(
+      ctx, region.get_index_space(), part_is, transform, extent);
+  assert(runtime->is_index_partition_disjoint(ctx, ip));
+  part = runtime->get_logical_partition(ctx, region, ip);
+}
+
 template <int NDIM>
 void FFModel::create_disjoint_partition(const ParallelTensor tensor,
                                         IndexSpaceT<NDIM> const &part_is,
@@ -2406,17 +2541,103 @@ void FFModel::init_operators() {
   }
 }
 
+// Trace IDs of the automatic traces, above the IDs the examples pass to
+// begin_trace themselves
+static TraceID const AUTO_TRACE_ID_FIRST = 1 << 20;
+
+void FFModel::begin_phase_trace(TracedPhase phase) {
+  if (config.enable_auto_tracing) {
+    config.lg_hlr->begin_trace(config.lg_ctx,
+                               AUTO_TRACE_ID_FIRST +
+                                   trace_generation * NUM_TRACED_PHASES + phase);
+  }
+}
+
+void FFModel::end_phase_trace(TracedPhase phase) {
+  if (config.enable_auto_tracing) {
+    config.lg_hlr->end_trace(config.lg_ctx,
+                             AUTO_TRACE_ID_FIRST +
+                                 trace_generation * NUM_TRACED_PHASES + phase);
+  }
+}
+
+void FFModel::invalidate_traces() {
+  // Replaying a trace whose operations have changed is an error, so the new
+  // operators are captured under fresh trace IDs
+  trace_generation++;
+}
+
+// Waits for the tasks launched so far and returns the time in microseconds
+static double fenced_time(Context ctx, Runtime *runtime) {
+  runtime->issue_execution_fence(ctx);
+  TimingLauncher timer(MEASURE_MICRO_SECONDS);
+  Future future = runtime->issue_timing_measurement(ctx, timer);
+  return future.get_result<long long>();
+}
+
 void FFModel::forward(int seq_length) {
   iter_config.seq_length = seq_length;
+  if (collect_runtime_stats) {
+    // The fences between the operators serialize them, so this iteration is
+    // neither traced nor overlapped
+    Context ctx = config.lg_ctx;
+    Runtime *runtime = config.lg_hlr;
+    double start = fenced_time(ctx, runtime);
+    for (size_t i = 0; i < operators.size(); i++) {
+      operators[i]->forward(*this);
+      double end = fenced_time(ctx, runtime);
+      measured_forward_times[operators[i]->op_guid] = end - start;
+      start = end;
+    }
+    return;
+  }
+  begin_phase_trace(TRACE_FORWARD);
   for (size_t i = 0; i < operators.size(); i++) {
     operators[i]->forward(*this);
   }
+  end_phase_trace(TRACE_FORWARD);
 }
 
 void FFModel::recompile_on_condition(RecompileState &r) {
   if (r.trigger()) {
     r.alter();
+    invalidate_traces();
+  }
+}
+
+void FFModel::migrate_operator(Op *op, MachineView const &view) {
+  assert(!op->is_parallel_op());
+  assert(op->op_type != OP_INPUT && op->op_type != OP_WEIGHT);
+  // New metas would lose the state these operators keep in theirs
+  assert(op->op_type != OP_BATCHNORM && op->op_type != OP_CACHE);
+  MachineView current = op->outputs[0]->machine_view;
+  assert(view.device_type == current.device_type);
+  assert(view.ndims == current.ndims);
+  for (int i = 0; i < view.ndims; i++) {
+    assert(view.dim[i] == current.dim[i]);
+  }
+  assert(get_or_create_task_is(view) == op->parallel_is);
+  // The current metas live on the devices of the current view
+  op->free_metas(*this);
+  for (int i = 0; i < op->numOutputs; i++) {
+    op->outputs[i]->machine_view = view;
+  }
+  for (int i = 0; i < op->numWeights; i++) {
+    op->weights[i]->machine_view = view;
+#ifdef FF_USE_NCCL
+    // Weight operators hold the communicators of their weights
+    Op *owner = op->weights[i]->owner_op;
+    if (owner != NULL && owner->op_type == OP_WEIGHT) {
+      owner->free_metas(*this);
+      owner->outputs[0]->machine_view = view;
+      if (config.computationMode == COMP_MODE_TRAINING) {
+        create_nccl_comms(view);
+      }
+      owner->init(*this);
+    }
+#endif
   }
+  op->init(*this);
 }
 
 void FFModel::compute_metrics() {
@@ -2432,6 +2653,7 @@ void FFModel::get_metrics() {
 void FFModel::backward(int seq_length) {
   iter_config.seq_length = seq_length;
   assert(config.computationMode == COMP_MODE_TRAINING);
+  begin_phase_trace(TRACE_BACKWARD);
   // Compute metrics
   compute_metrics();
   // Compute the gradients of the final operator wrt loss
@@ -2458,13 +2680,28 @@ void FFModel::backward(int seq_length) {
     //  continue;
     operators[l]->backward(*this);
   }
+  end_phase_trace(TRACE_BACKWARD);
 }
 
 void FFModel::update() {
   optimizer->next();
-  for (size_t i = 0; i < parameters.size(); i++) {
-    optimizer->update(parameters[i]);
+  begin_phase_trace(TRACE_UPDATE);
+  if (optimizer->gradient_buckets.empty()) {
+    for (size_t i = 0; i < parameters.size(); i++) {
+      optimizer->update(parameters[i]);
+    }
+  } else {
+    // Buckets are launched in the order their gradients become ready, and
+    // Legion runs each of them as soon as the backward tasks producing its
+    // gradients are done, overlapping with the rest of the backward pass
+    for (GradientBucket const &bucket : optimizer->gradient_buckets) {
+      optimizer->update(bucket);
+    }
+    for (ParallelTensor p : optimizer->unbucketed_parameters) {
+      optimizer->update(p);
+    }
   }
+  end_phase_trace(TRACE_UPDATE);
 }
 
 Op *FFModel::get_final_operator() const {
@@ -2486,114 +2723,135 @@ void FFModel::compile(Optimizer *_optimizer,
   compile(loss_type, metrics, comp_mode);
 }
 
-bool FFModel::apply_fusion(std::vector<Op *> const &operators,
+void FFModel::apply_fusion(std::vector<Op *> const &operators,
                            std::vector<Op *> &new_operators) {
-  // Context ctx = config.lg_ctx;
-  // Runtime* runtime = config.lg_hlr;
-  for (size_t l = 1; l < operators.size() - 1; l++) {
+  // Fusing operators[l] into an earlier operators[i] replaces operators[i]
+  // with the fused op and removes operators[l], which cannot make any
+  // operator before l fusible. A single sweep over l therefore fuses the same
+  // (i, l) pairs, in the same order, as restarting the scan from the first
+  // operator after every fusion. Fused-away operators leave an empty slot so
+  // that the remaining operators keep their indices.
+  std::vector<Op *> slots = operators;
+  std::unordered_map<Op const *, size_t> slot_of;
+  std::unordered_map<Op const *, FusedOp *> fused_into;
+  for (size_t i = 0; i < slots.size(); i++) {
+    slot_of[slots[i]] = i;
+  }
+  // Update input tensors that belong to an operator that has been fused
+  auto remap_inputs = [&](Op *op) {
+    for (int idx = 0; idx < op->numInputs; idx++) {
+      auto const &it = fused_into.find(op->inputs[idx]->owner_op);
+      if (it == fused_into.end()) {
+        continue;
+      }
+      FusedOp *fused_op = it->second;
+      int found = -1;
+      for (int k = 0; k < fused_op->numOutputs; k++) {
+        if (fused_op->outputs[k]->region == op->inputs[idx]->region) {
+          assert(found == -1);
+          found = k;
+        }
+      }
+      assert(found >= 0);
+      op->inputs[idx] = fused_op->outputs[found];
+    }
+  };
+  for (size_t l = 1; l + 1 < slots.size(); l++) {
+    Op *opl = slots[l];
+    assert(opl != nullptr);
+    remap_inputs(opl);
     // don't fuse input and weight operator since they don't involve any
     // forward/backward task launches
-    if (operators[l]->op_type == OP_INPUT ||
-        operators[l]->op_type == OP_WEIGHT) {
+    if (opl->op_type == OP_INPUT || opl->op_type == OP_WEIGHT) {
       continue;
     }
     // don't fuse parallel op since they have different parallel_is in
     // forward/backward
-    if (operators[l]->is_parallel_op()) {
+    if (opl->is_parallel_op()) {
+      continue;
+    }
+    // don't fuse operators placed on CPUs, since fused ops only have GPU
+    // variants, or operators whose weights are kept in zero-copy memory
+    if (opl->outputs[0]->machine_view.device_type == MachineView::CPU) {
+      continue;
+    }
+    bool host_weights = false;
+    for (int i = 0; i < opl->numWeights; i++) {
+      if (opl->weights[i]->region_tag != 0) {
+        host_weights = true;
+      }
+    }
+    if (host_weights) {
       continue;
     }
     size_t start = 0;
-    {
-      Op *opl = operators[l];
-      for (int idx = 0; idx < opl->numInputs; idx++) {
-        bool found = false;
-        for (size_t i = 0; i < l; i++) {
-          if (opl->inputs[idx]->owner_op == operators[i]) {
-            assert(!found);
-            found = true;
-            if (i > start) {
-              start = i;
-            }
-          }
-        }
-        assert(found || (opl->inputs[idx]->owner_op == NULL));
+    for (int idx = 0; idx < opl->numInputs; idx++) {
+      Op const *owner = opl->inputs[idx]->owner_op;
+      if (owner == NULL) {
+        continue;
       }
+      auto const &it = slot_of.find(owner);
+      assert(it != slot_of.end() && it->second < l);
+      start = std::max(start, it->second);
     }
+    MachineView view1 = opl->outputs[0]->machine_view;
     for (size_t i = start; i < l; i++) {
-      // Domain d1 =
-      // runtime->get_index_space_domain(operators[l]->outputs[0]->parallel_is);
-      // Domain d2 =
-      // runtime->get_index_space_domain(operators[i]->outputs[0]->parallel_is);
-      MachineView view1 = operators[l]->outputs[0]->machine_view;
-      MachineView view2 = operators[i]->outputs[0]->machine_view;
-      if (view1 == view2) {
-        FusedOp *fused_op = nullptr;
-        bool allocate_new_fused_op = false;
-        if (operators[i]->op_type == OP_FUSED) {
-          fused_op = (FusedOp *)operators[i];
-        } else {
-          //  cannot be an in-place operator
-          if (operators[i]->has_inplace_output()) {
-            continue;
-          }
-          // don't fuse input and weight operator since they don't involve any
-          // forward/backward kernels
-          if (operators[i]->op_type == OP_INPUT ||
-              operators[i]->op_type == OP_WEIGHT) {
-            continue;
-          }
-          // don't fuse parallel op since they have different parallel_is in
-          // forward/backward
-          if (operators[i]->is_parallel_op()) {
-            continue;
-          }
-          fused_op = new FusedOp(*this, operators[i]);
-          allocate_new_fused_op = true;
+      Op *opi = slots[i];
+      if (opi == nullptr) {
+        continue;
+      }
+      MachineView view2 = opi->outputs[0]->machine_view;
+      if (!(view1 == view2)) {
+        continue;
+      }
+      FusedOp *fused_op = nullptr;
+      bool allocate_new_fused_op = false;
+      if (opi->op_type == OP_FUSED) {
+        fused_op = (FusedOp *)opi;
+      } else {
+        //  cannot be an in-place operator
+        if (opi->has_inplace_output()) {
+          continue;
         }
-        if (fused_op->add_operator(*this, operators[l])) {
-          // Construct new operators
-          new_operators.clear();
-          for (size_t j = 0; j < i; j++) {
-            new_operators.push_back(operators[j]);
-          }
-          new_operators.push_back(fused_op);
-          for (size_t j = i + 1; j < operators.size(); j++) {
-            if (j == l) {
-              continue; // l and i are fused
-            }
-            Op *op = operators[j];
-            // Update input tensors that belong to operator[l] or operator[i]
-            for (int idx = 0; idx < op->numInputs; idx++) {
-              if ((op->inputs[idx]->owner_op == operators[l]) ||
-                  (op->inputs[idx]->owner_op == operators[i])) {
-                int found = -1;
-                for (int k = 0; k < fused_op->numOutputs; k++) {
-                  if (fused_op->outputs[k]->region == op->inputs[idx]->region) {
-                    assert(found == -1);
-                    found = k;
-                  }
-                }
-                assert(found >= 0);
-                op->inputs[idx] = fused_op->outputs[found];
-              }
-            }
-            // Insert op
-            new_operators.push_back(op);
-          }
-          // We are exact one operator fewer than the original
-          assert(new_operators.size() + 1 == operators.size());
-          return true;
-        } else {
-          // TODO: delete fused_op to avoid memory leakage
-          if (allocate_new_fused_op) {
-            delete fused_op;
-          }
+        // don't fuse input and weight operator since they don't involve any
+        // forward/backward kernels
+        if (opi->op_type == OP_INPUT || opi->op_type == OP_WEIGHT) {
           continue;
         }
+        // don't fuse parallel op since they have different parallel_is in
+        // forward/backward
+        if (opi->is_parallel_op()) {
+          continue;
+        }
+        fused_op = new FusedOp(*this, opi);
+        allocate_new_fused_op = true;
+      }
+      if (fused_op->add_operator(*this, opl)) {
+        slots[i] = fused_op;
+        slots[l] = nullptr;
+        slot_of[fused_op] = i;
+        if (allocate_new_fused_op) {
+          fused_into[opi] = fused_op;
+        }
+        fused_into[opl] = fused_op;
+        break;
+      } else if (allocate_new_fused_op) {
+        // FusedOp's constructor took ownership of opi's outputs
+        for (int k = 0; k < opi->numOutputs; k++) {
+          opi->outputs[k]->owner_op = opi;
+          opi->outputs[k]->owner_idx = k;
+        }
+        delete fused_op;
       }
     }
   }
-  return false;
+  new_operators.clear();
+  for (Op *op : slots) {
+    if (op != nullptr) {
+      remap_inputs(op);
+      new_operators.push_back(op);
+    }
+  }
 }
 
 Op *FFModel::create_operator_from_layer(
@@ -2763,6 +3021,11 @@ Op *FFModel::create_operator_from_layer(
       operators.push_back(op);
       return op;
     }
+    case OP_EXPERTS: {
+      Op *op = Experts::create_operator_from_layer(*this, layer, inputs);
+      operators.push_back(op);
+      return op;
+    }
     default:
       assert(false);
   }
@@ -2786,6 +3049,21 @@ void FFModel::create_operators_from_layers() {
   }
 }
 
+uint64_t FFModel::get_binding_signature() const {
+  // The guids that the inputs and weights are bound by in
+  // convert_graph_to_operators
+  std::vector<size_t> input_tensor_guids, weight_layer_guids;
+  for (auto const &layer : layers) {
+    if (layer->op_type == OP_INPUT) {
+      input_tensor_guids.push_back(layer->outputs[0]->tensor_guid);
+    }
+    if (layer->numWeights > 0) {
+      weight_layer_guids.push_back(layer->layer_guid.id);
+    }
+  }
+  return PCG::binding_signature(input_tensor_guids, weight_layer_guids);
+}
+
 void FFModel::compile(LossType loss_type,
                       std::vector<MetricsType> const &metrics,
                       CompMode comp_mode) {
@@ -2795,10 +3073,6 @@ void FFModel::compile(LossType loss_type,
   Context ctx = config.lg_ctx;
   Runtime *runtime = config.lg_hlr;
   config.computationMode = comp_mode;
-  // if (config.import_strategy_file.length() > 0) {
-  //   load_strategies_from_file(config.import_strategy_file,
-  //   config.strategies);
-  // }
   //  Construct operators from layers
   if (config.only_data_parallel) {
     fprintf(stderr,
@@ -2806,22 +3080,79 @@ void FFModel::compile(LossType loss_type,
             "data-parallel PCG.\n");
   }
   create_operators_from_layers();
-  // Launch the graph optimize task
   {
-    FFModel *model = this;
-    TaskLauncher launcher(GRAPH_OPTIMIZE_TASK_ID,
-                          TaskArgument(&model, sizeof(FFModel *)));
-    Future future = runtime->execute_task(ctx, launcher);
+    // A strategy file is keyed by the unoptimized PCG and by the machine the
+    // search targets, which --search-num-nodes and --search-num-workers
+    // override so that the search can run on a separate planning job
+    PCG::StrategyFileKey strategy_key;
+    strategy_key.binding_signature = get_binding_signature();
+    {
+      std::unique_ptr<PCG::Graph> input_graph(graph_search->construct_graph());
+      strategy_key.model_signature = input_graph->hash();
+      if (!config.export_pcg_file.empty()) {
+        Serializer sez;
+        std::unordered_map<PCG::Node, MachineView> no_views;
+        serialize_graph_optimal_view(sez, input_graph.get(), no_views);
+        PCG::PCGFileInfo info;
+        info.model_signature = strategy_key.model_signature;
+        info.binding_signature = strategy_key.binding_signature;
+        info.cpus_per_node = config.cpusPerNode;
+        info.computation_mode = config.computationMode;
+        PCG::save_pcg_file(config.export_pcg_file,
+                           info,
+                           (char const *)sez.get_buffer(),
+                           sez.get_used_bytes());
+        fprintf(stderr,
+                "Exported the PCG to %s.\n",
+                config.export_pcg_file.c_str());
+      }
+    }
+    strategy_key.num_nodes = config.search_num_nodes.value_or(config.numNodes);
+    strategy_key.workers_per_node =
+        config.search_num_workers.value_or(config.workersPerNode);
+    strategy_key.cpus_per_node = config.cpusPerNode;
+    std::vector<char> strategy;
+    if (!config.import_strategy_file.empty()) {
+      std::string reason;
+      if (PCG::load_strategy_file(
+              config.import_strategy_file, strategy_key, strategy, reason)) {
+        fprintf(stderr,
+                "Imported the strategy from %s, skipping the search.\n",
+                config.import_strategy_file.c_str());
+      } else {
+        fprintf(stderr,
+                "Cannot import the strategy from %s (%s), searching for a "
+                "new one.\n",
+                config.import_strategy_file.c_str(),
+                reason.c_str());
+      }
+    }
+    if (strategy.empty()) {
+      // Launch the graph optimize task
+      FFModel *model = this;
+      TaskLauncher launcher(GRAPH_OPTIMIZE_TASK_ID,
+                            TaskArgument(&model, sizeof(FFModel *)));
+      Future future = runtime->execute_task(ctx, launcher);
 
-    PCG::GraphOptimalViewSerialized ret =
-        future.get_result<PCG::GraphOptimalViewSerialized>();
-    Deserializer dez(ret.data, ret.total_bytes);
+      PCG::GraphOptimalViewSerialized ret =
+          future.get_result<PCG::GraphOptimalViewSerialized>();
+      strategy.assign(ret.data, ret.data + ret.total_bytes);
+    }
+    if (!config.export_strategy_file.empty()) {
+      PCG::save_strategy_file(config.export_strategy_file,
+                              strategy_key,
+                              strategy.data(),
+                              strategy.size());
+    }
+    Deserializer dez(strategy.data(), strategy.size());
     // Reconstruct operators
     PCG::Graph *best_graph = new PCG::Graph(this);
     std::unordered_map<PCG::Node, MachineView> optimal_views;
     deserialize_graph_optimal_view(dez, best_graph, optimal_views);
     operators.clear();
     convert_graph_to_operators(best_graph, optimal_views);
+    // A recompilation may have changed the operators and their views
+    invalidate_traces();
     best_graph->print_dot();
     delete best_graph;
     for (auto const &layer : layers) {
@@ -2953,18 +3284,22 @@ void FFModel::compile(LossType loss_type,
     fprintf(stderr, "%zu operators before fusion...\n", operators.size());
     std::vector<Op *> new_operators;
     std::vector<Op *> old_operators = operators;
-    while (apply_fusion(operators, new_operators)) {
+    apply_fusion(operators, new_operators);
+    {
+      // Operators must still be in topological order
+      std::unordered_map<Op const *, size_t> position;
+      for (size_t i = 0; i < new_operators.size(); i++) {
+        position[new_operators[i]] = i;
+      }
       for (size_t i = 0; i < new_operators.size(); i++) {
         for (int idx = 0; idx < new_operators[i]->numInputs; idx++) {
-          for (size_t j = i + 1; j < new_operators.size(); j++) {
-            if (new_operators[i]->inputs[idx]->owner_op == new_operators[j]) {
-              assert(false);
-            }
-          }
+          auto const &it =
+              position.find(new_operators[i]->inputs[idx]->owner_op);
+          assert(it == position.end() || it->second < i);
         }
       }
-      operators = new_operators;
     }
+    operators = new_operators;
     // Check integrity
     for (size_t l = 0; l < operators.size(); l++) {
       if (operators[l]->op_type == OP_FUSED) {
@@ -3120,37 +3455,41 @@ void FFModel::compile(LossType loss_type,
       if (operators[l]->op_type != OP_WEIGHT) {
         continue;
       }
-      MachineView view = operators[l]->outputs[0]->machine_view;
-      if (view_hash_to_nccl_comms.find(view.hash()) ==
-          view_hash_to_nccl_comms.end()) {
-        TaskLauncher launcher(NCCL_GETUNIQUEID_TASK_ID, TaskArgument(NULL, 0));
-        Future future = runtime->execute_task(ctx, launcher);
-        ncclUniqueId ncclId = future.get_result<ncclUniqueId>();
-        IndexSpace task_is = get_or_create_task_is(view);
-        ArgumentMap argmap;
-        IndexLauncher index_launcher(
-            NCCL_INIT_COMMS_TASK_ID,
-            task_is,
-            TaskArgument(&ncclId, sizeof(ncclUniqueId)),
-            argmap,
-            Predicate::TRUE_PRED,
-            false /*must*/,
-            0 /*mapper_id*/,
-            view.hash() /*MappingTagID*/);
-        FutureMap fm = runtime->execute_index_space(ctx, index_launcher);
-        fm.wait_all_results();
-        int idx = 0;
-        Domain task_domain = runtime->get_index_space_domain(ctx, task_is);
-        ncclComm_t *nccl_comms =
-            (ncclComm_t *)malloc(sizeof(ncclComm_t) * task_domain.get_volume());
-        for (Domain::DomainPointIterator it(task_domain); it; it++, idx++) {
-          nccl_comms[idx] = fm.get_result<ncclComm_t>(*it);
+      create_nccl_comms(operators[l]->outputs[0]->machine_view);
+    }
+  }
+  if (config.computationMode == COMP_MODE_TRAINING &&
+      config.sparse_embedding_gradients) {
+    for (Op *op : operators) {
+      // Fused embeddings keep their dense gradients
+      if (op->op_type != OP_EMBEDDING) {
+        continue;
+      }
+      ParallelTensor weight = op->weights[0];
+      if (weight->sync_type != ParameterSyncType::NCCL) {
+        continue;
+      }
+      // Only replicated tables, whose replicas see all the rows looked up
+      bool replicated = true;
+      for (int i = 0; i < weight->num_dims; i++) {
+        if (!weight->dims[i].is_replica_dim && weight->dims[i].degree > 1) {
+          replicated = false;
         }
-        view_hash_to_nccl_comms[view.hash()] = nccl_comms;
       }
+      if (!replicated) {
+        continue;
+      }
+      SparseGradient grad;
+      grad.ids = op->inputs[0];
+      grad.grad = op->outputs[0];
+      grad.aggr = ((Embedding *)op)->aggr;
+      optimizer->sparse_gradients[weight->region] = grad;
     }
   }
 #endif
+  if (config.computationMode == COMP_MODE_TRAINING) {
+    optimizer->create_gradient_buckets();
+  }
 }
 
 struct PropagationEdgeInfo {
@@ -3342,9 +3681,11 @@ void FFModel::mcmc_optimize(std::map<Op const *, ParallelConfig> &best,
 }
 
 void FFModel::zero_gradients(void) {
+  begin_phase_trace(TRACE_ZERO_GRADIENTS);
   for (int l = operators.size() - 1; l >= 0; l--) {
     operators[l]->zero_grad(*this);
   }
+  end_phase_trace(TRACE_ZERO_GRADIENTS);
 }
 
 void FFModel::print_layers(int id) {
@@ -3411,6 +3752,21 @@ std::tuple<ParallelTensorShape, ParallelTensorShape, ParallelTensorShape>
                          std::get<2>(inputs)->get_shape());
 }
 
+template <>
+std::tuple<ParallelTensorShape,
+           ParallelTensorShape,
+           ParallelTensorShape,
+           ParallelTensorShape>
+    get_input_shape(std::tuple<ParallelTensor,
+                               ParallelTensor,
+                               ParallelTensor,
+                               ParallelTensor> const &inputs) {
+  return std::make_tuple(std::get<0>(inputs)->get_shape(),
+                         std::get<1>(inputs)->get_shape(),
+                         std::get<2>(inputs)->get_shape(),
+                         std::get<3>(inputs)->get_shape());
+}
+
 template <>
 ParallelTensorShape get_input_shape(ParallelTensor const &input) {
   return input->get_shape();
@@ -3478,6 +3834,17 @@ struct DefaultConfig {
   const static int simulator_segment_size = 16777216; // 16 MB
   const static int simulator_max_num_segments = 1;
   const static int base_optimize_threshold = 10;
+  const static int search_num_threads = 1;
+  const static bool memorySearch = false;
+  constexpr static float memoryLambda = 0.0f; // ms per MB
+  const static size_t gradientBucketSize = 0;
+  const static bool sparseEmbeddingGradients = false;
+  const static bool hostEmbeddingTables = false;
+  const static bool enableAutoTracing = true;
+  // Defaults of the analytical cost model (roughly a V100)
+  constexpr static float devicePeakTFLOPs = 15.7f;
+  constexpr static float deviceMemoryBandwidth = 900.0f;      // GB/s
+  constexpr static float deviceKernelLaunchOverhead = 0.005f; // ms
   const static bool enable_control_replication = true;
   // The default python data loader type is 2 to enable control replication
   const static int python_data_loader_type = 2;
@@ -3508,19 +3875,35 @@ FFConfig::FFConfig() {
   machine_model_version = DefaultConfig::machine_model_version;
   simulator_segment_size = DefaultConfig::simulator_segment_size;
   simulator_max_num_segments = DefaultConfig::simulator_max_num_segments;
+  allreduce_algorithm = ALLREDUCE_AUTO;
   enable_control_replication = DefaultConfig::enable_control_replication;
   python_data_loader_type = DefaultConfig::python_data_loader_type;
   machine_model_file = "";
   import_strategy_file = "";
   export_strategy_file = "";
+  export_pcg_file = "";
   export_strategy_task_graph_file = "";
   include_costs_dot_graph = false;
   export_strategy_computation_graph_file = "";
+  search_cache_dir = "";
+  cost_db_path = "";
+  cost_db_import_only = false;
+  analytical_cost_model = false;
+  device_peak_tflops = DefaultConfig::devicePeakTFLOPs;
+  device_memory_bandwidth = DefaultConfig::deviceMemoryBandwidth;
+  device_kernel_launch_overhead = DefaultConfig::deviceKernelLaunchOverhead;
   dataset_path = "";
   substitution_json_path = tl::nullopt;
   syntheticInput = false;
   perform_fusion = false;
   base_optimize_threshold = DefaultConfig::base_optimize_threshold;
+  search_num_threads = DefaultConfig::search_num_threads;
+  memory_search = DefaultConfig::memorySearch;
+  memory_lambda = DefaultConfig::memoryLambda;
+  gradient_bucket_size = DefaultConfig::gradientBucketSize;
+  sparse_embedding_gradients = DefaultConfig::sparseEmbeddingGradients;
+  host_embedding_tables = DefaultConfig::hostEmbeddingTables;
+  enable_auto_tracing = DefaultConfig::enableAutoTracing;
 
   // Parse input arguments
   {
@@ -3591,6 +3974,10 @@ void FFConfig::parse_args(char **argv, int argc) {
       export_strategy_file = std::string(argv[++i]);
       continue;
     }
+    if (!strcmp(argv[i], "--export-pcg")) {
+      export_pcg_file = std::string(argv[++i]);
+      continue;
+    }
     if ((!strcmp(argv[i], "--only-data-parallel"))) {
       only_data_parallel = true;
       continue;
@@ -3662,6 +4049,16 @@ void FFConfig::parse_args(char **argv, int argc) {
       simulator_max_num_segments = atoi(argv[++i]);
       continue;
     }
+    if (!strcmp(argv[i], "--allreduce-algorithm")) {
+      if (!parse_allreduce_algorithm(argv[++i], allreduce_algorithm)) {
+        fprintf(stderr,
+                "[Warning] unknown allreduce algorithm %s, "
+                "the best one will be picked automatically.\n",
+                argv[i]);
+        allreduce_algorithm = ALLREDUCE_AUTO;
+      }
+      continue;
+    }
     if (!strcmp(argv[i], "--enable-propagation")) {
       enable_propagation = true;
       continue;
@@ -3681,6 +4078,63 @@ void FFConfig::parse_args(char **argv, int argc) {
     if (!strcmp(argv[i], "--base-optimize-threshold")) {
       base_optimize_threshold = atoi(argv[++i]);
     }
+    if (!strcmp(argv[i], "--search-num-threads")) {
+      search_num_threads = atoi(argv[++i]);
+      continue;
+    }
+    if (!strcmp(argv[i], "--memory-search")) {
+      memory_search = true;
+      continue;
+    }
+    if (!strcmp(argv[i], "--memory-lambda")) {
+      memory_lambda = atof(argv[++i]);
+      continue;
+    }
+    if (!strcmp(argv[i], "--gradient-bucket-size")) {
+      // in MB
+      gradient_bucket_size = (size_t)atoll(argv[++i]) * 1024 * 1024;
+      continue;
+    }
+    if (!strcmp(argv[i], "--sparse-embedding-gradients")) {
+      sparse_embedding_gradients = true;
+      continue;
+    }
+    if (!strcmp(argv[i], "--host-embedding-tables")) {
+      host_embedding_tables = true;
+      continue;
+    }
+    if (!strcmp(argv[i], "--disable-auto-tracing")) {
+      enable_auto_tracing = false;
+      continue;
+    }
+    if (!strcmp(argv[i], "--search-cache-dir")) {
+      search_cache_dir = std::string(argv[++i]);
+      continue;
+    }
+    if (!strcmp(argv[i], "--cost-db")) {
+      cost_db_path = std::string(argv[++i]);
+      continue;
+    }
+    if (!strcmp(argv[i], "--cost-db-import-only")) {
+      cost_db_import_only = true;
+      continue;
+    }
+    if (!strcmp(argv[i], "--analytical-cost-model")) {
+      analytical_cost_model = true;
+      continue;
+    }
+    if (!strcmp(argv[i], "--device-peak-tflops")) {
+      device_peak_tflops = atof(argv[++i]);
+      continue;
+    }
+    if (!strcmp(argv[i], "--device-memory-bandwidth")) {
+      device_memory_bandwidth = atof(argv[++i]);
+      continue;
+    }
+    if (!strcmp(argv[i], "--device-kernel-launch-overhead")) {
+      device_kernel_launch_overhead = atof(argv[++i]);
+      continue;
+    }
     if (!strcmp(argv[i], "--disable-control-replication")) {
       enable_control_replication = false;
       continue;
@@ -3851,7 +4305,14 @@ void register_flexflow_internal_tasks() {
         registrar, "Embedding Backward Task");
   }
   // Embedding task CPU
-  /* {
+  {
+    TaskVariantRegistrar registrar(EMBED_INIT_TASK_ID, "Embedding Init");
+    registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
+    registrar.set_leaf();
+    Runtime::preregister_task_variant<OpMeta *, Embedding::init_task>(
+        registrar, "Embedding Init Task");
+  }
+  {
     TaskVariantRegistrar registrar(EMBED_FWD_TASK_ID, "Embedding Forward");
     registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
     registrar.set_leaf();
@@ -3864,7 +4325,7 @@ void register_flexflow_internal_tasks() {
     registrar.set_leaf();
     Runtime::preregister_task_variant<Embedding::backward_task_cpu>(
         registrar, "Embedding Backward Task");
-  }*/
+  }
 
   // Cache task CPU
   {
@@ -3960,6 +4421,67 @@ void register_flexflow_internal_tasks() {
         registrar, "Aggregate specification Backward Task");
   }
 
+  // Experts task
+  {
+    TaskVariantRegistrar registrar(EXPERTS_INIT_TASK_ID, "Experts Init");
+    registrar.add_constraint(ProcessorConstraint(Processor::TOC_PROC));
+    registrar.set_leaf();
+    Runtime::preregister_task_variant<OpMeta *, Experts::init_task>(
+        registrar, "Experts Init Task");
+  }
+  {
+    TaskVariantRegistrar registrar(EXPERTS_DISPATCH_TASK_ID,
+                                   "Experts Dispatch");
+    registrar.add_constraint(ProcessorConstraint(Processor::TOC_PROC));
+    registrar.set_leaf();
+    Runtime::preregister_task_variant<Experts::dispatch_task>(
+        registrar, "Experts Dispatch Task");
+  }
+  {
+    TaskVariantRegistrar registrar(EXPERTS_FWD_TASK_ID, "Experts Forward");
+    registrar.add_constraint(ProcessorConstraint(Processor::TOC_PROC));
+    registrar.set_leaf();
+    Runtime::preregister_task_variant<Experts::forward_task>(
+        registrar, "Experts Forward Task");
+  }
+  {
+    TaskVariantRegistrar registrar(EXPERTS_COMBINE_TASK_ID, "Experts Combine");
+    registrar.add_constraint(ProcessorConstraint(Processor::TOC_PROC));
+    registrar.set_leaf();
+    Runtime::preregister_task_variant<Experts::combine_task>(
+        registrar, "Experts Combine Task");
+  }
+  {
+    TaskVariantRegistrar registrar(EXPERTS_COMBINE_BWD_TASK_ID,
+                                   "Experts Combine Backward");
+    registrar.add_constraint(ProcessorConstraint(Processor::TOC_PROC));
+    registrar.set_leaf();
+    Runtime::preregister_task_variant<Experts::combine_backward_task>(
+        registrar, "Experts Combine Backward Task");
+  }
+  {
+    TaskVariantRegistrar registrar(EXPERTS_BWD_TASK_ID, "Experts Backward");
+    registrar.add_constraint(ProcessorConstraint(Processor::TOC_PROC));
+    registrar.set_leaf();
+    Runtime::preregister_task_variant<Experts::backward_task>(
+        registrar, "Experts Backward Task");
+  }
+  {
+    TaskVariantRegistrar registrar(EXPERTS_DISPATCH_BWD_TASK_ID,
+                                   "Experts Dispatch Backward");
+    registrar.add_constraint(ProcessorConstraint(Processor::TOC_PROC));
+    registrar.set_leaf();
+    Runtime::preregister_task_variant<Experts::dispatch_backward_task>(
+        registrar, "Experts Dispatch Backward Task");
+  }
+  {
+    TaskVariantRegistrar registrar(EXPERTS_LOAD_TASK_ID, "Experts Load");
+    registrar.add_constraint(ProcessorConstraint(Processor::TOC_PROC));
+    registrar.set_leaf();
+    Runtime::preregister_task_variant<ExpertsLoad, Experts::load_task>(
+        registrar, "Experts Load Task");
+  }
+
   // Pool2D task
   {
     TaskVariantRegistrar registrar(POOL2D_INIT_TASK_ID, "pool2d_init_task");
@@ -4423,6 +4945,21 @@ void register_flexflow_internal_tasks() {
     Runtime::preregister_task_variant<Replicate::backward_task>(
         registrar, "Replicate Backward Task");
   }
+  // Pipeline
+  {
+    TaskVariantRegistrar registrar(PIPELINE_FWD_TASK_ID, "Pipeline Forward");
+    registrar.add_constraint(ProcessorConstraint(Processor::TOC_PROC));
+    registrar.set_leaf();
+    Runtime::preregister_task_variant<Pipeline::forward_task>(
+        registrar, "Pipeline Forward Task");
+  }
+  {
+    TaskVariantRegistrar registrar(PIPELINE_BWD_TASK_ID, "Pipeline Backward");
+    registrar.add_constraint(ProcessorConstraint(Processor::TOC_PROC));
+    registrar.set_leaf();
+    Runtime::preregister_task_variant<Pipeline::backward_task>(
+        registrar, "Pipeline Backward Task");
+  }
   // Reduction
   {
     TaskVariantRegistrar registrar(REDUCTION_FWD_TASK_ID, "Reduction Forward");
@@ -4472,6 +5009,14 @@ void register_flexflow_internal_tasks() {
     Runtime::preregister_task_variant<AdamOptimizer::ps_update_task>(
         registrar, "Adam Parameter Server Update Task");
   }
+  {
+    TaskVariantRegistrar registrar(ADAGRAD_UPD_PS_TASK_ID,
+                                   "Adagrad Parameter Server Update");
+    registrar.add_constraint(ProcessorConstraint(Processor::TOC_PROC));
+    registrar.set_leaf();
+    Runtime::preregister_task_variant<AdagradOptimizer::ps_update_task>(
+        registrar, "Adagrad Parameter Server Update Task");
+  }
 #ifdef FF_USE_NCCL
   {
     TaskVariantRegistrar registrar(SGD_UPD_NCCL_TASK_ID, "SGD NCCL Update");
@@ -4487,6 +5032,62 @@ void register_flexflow_internal_tasks() {
     Runtime::preregister_task_variant<AdamOptimizer::nccl_update_task>(
         registrar, "Adam NCCL Update Task");
   }
+  {
+    TaskVariantRegistrar registrar(SGD_UPD_NCCL_BUCKET_TASK_ID,
+                                   "SGD NCCL Bucket Update");
+    registrar.add_constraint(ProcessorConstraint(Processor::TOC_PROC));
+    registrar.set_leaf();
+    Runtime::preregister_task_variant<SGDOptimizer::nccl_bucket_update_task>(
+        registrar, "SGD NCCL Bucket Update Task");
+  }
+  {
+    TaskVariantRegistrar registrar(ADAM_UPD_NCCL_BUCKET_TASK_ID,
+                                   "Adam NCCL Bucket Update");
+    registrar.add_constraint(ProcessorConstraint(Processor::TOC_PROC));
+    registrar.set_leaf();
+    Runtime::preregister_task_variant<AdamOptimizer::nccl_bucket_update_task>(
+        registrar, "Adam NCCL Bucket Update Task");
+  }
+  {
+    TaskVariantRegistrar registrar(ADAGRAD_UPD_NCCL_TASK_ID,
+                                   "Adagrad NCCL Update");
+    registrar.add_constraint(ProcessorConstraint(Processor::TOC_PROC));
+    registrar.set_leaf();
+    Runtime::preregister_task_variant<AdagradOptimizer::nccl_update_task>(
+        registrar, "Adagrad NCCL Update Task");
+  }
+  {
+    TaskVariantRegistrar registrar(ADAGRAD_UPD_NCCL_BUCKET_TASK_ID,
+                                   "Adagrad NCCL Bucket Update");
+    registrar.add_constraint(ProcessorConstraint(Processor::TOC_PROC));
+    registrar.set_leaf();
+    Runtime::preregister_task_variant<
+        AdagradOptimizer::nccl_bucket_update_task>(
+        registrar, "Adagrad NCCL Bucket Update Task");
+  }
+  {
+    TaskVariantRegistrar registrar(SGD_UPD_SPARSE_TASK_ID, "SGD Sparse Update");
+    registrar.add_constraint(ProcessorConstraint(Processor::TOC_PROC));
+    registrar.set_leaf();
+    Runtime::preregister_task_variant<SGDOptimizer::sparse_update_task>(
+        registrar, "SGD Sparse Update Task");
+  }
+  {
+    TaskVariantRegistrar registrar(ADAM_UPD_SPARSE_TASK_ID,
+                                   "Adam Sparse Update");
+    registrar.add_constraint(ProcessorConstraint(Processor::TOC_PROC));
+    registrar.set_leaf();
+    Runtime::preregister_task_variant<AdamOptimizer::sparse_update_task>(
+        registrar, "Adam Sparse Update Task");
+  }
+  {
+    TaskVariantRegistrar registrar(ADAGRAD_UPD_SPARSE_TASK_ID,
+                                   "Adagrad Sparse Update");
+    registrar.add_constraint(ProcessorConstraint(Processor::TOC_PROC));
+    registrar.set_leaf();
+    Runtime::preregister_task_variant<AdagradOptimizer::sparse_update_task>(
+        registrar, "Adagrad Sparse Update Task");
+  }
 #endif
   // Initializer
   {
@@ -4558,6 +5159,13 @@ void register_flexflow_internal_tasks() {
         registrar, "NCCL Init Communicators Task");
   }
 #endif
+  {
+    TaskVariantRegistrar registrar(OP_FREE_METAS_TASK_ID, "Free Op Metas");
+    registrar.add_constraint(ProcessorConstraint(Processor::TOC_PROC));
+    registrar.set_leaf();
+    Runtime::preregister_task_variant<Op::free_metas_task>(
+        registrar, "Free Op Metas Task");
+  }
   // Search
   {
     TaskVariantRegistrar registrar(STRATEGY_SEARCH_TASK_ID, "Stretegy Search");
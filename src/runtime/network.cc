@@ -1,8 +1,10 @@
+#include <algorithm>
 #include <cmath>
 #include <functional>
 #include <limits>
 #include <queue>
 #include <random>
+#include <unordered_map>
 #include <unordered_set>
 #include <utility>
 #include <vector>
@@ -25,7 +27,6 @@ namespace FlexFlow {
 
 static std::random_device rd;
 static std::mt19937 gen = std::mt19937(rd());
-static std::uniform_real_distribution<float> unif(0, 1);
 
 // for summing connections...
 template <typename T>
@@ -44,21 +45,61 @@ static std::vector<T> operator+(std::vector<T> const &a,
   return result;
 }
 
+// Tie-breaking between equal-length paths happens while routes are
+// precomputed from several threads, so each thread draws from its own engine
+static bool coin_flip() {
+  thread_local std::mt19937 tl_gen = std::mt19937(std::random_device()());
+  thread_local std::uniform_real_distribution<float> tl_unif(0, 1);
+  return tl_unif(tl_gen) < 0.5;
+}
+
+// Walks the shortest-path tree prev back from dst_node
+static Route route_from_tree(std::vector<int> const &prev,
+                             int dst_node,
+                             int total_devs,
+                             std::map<size_t, CommDevice *> const &devmap) {
+  Route result = Route();
+  int curr = dst_node;
+  while (prev[curr] != -1) {
+    result.push_back(devmap.at((size_t)prev[curr] * total_devs + curr));
+    curr = prev[curr];
+  }
+  std::reverse(result.begin(), result.end());
+  return result;
+}
+
+// Number of hops and narrowest link multiplicity on the tree path to dst_node
+static void hops_from_tree(std::vector<int> const &prev,
+                           int dst_node,
+                           SparseConnectionMatrix const &conn,
+                           int &hop,
+                           int &narrowest) {
+  hop = 0;
+  narrowest = std::numeric_limits<int>::max();
+  int curr = dst_node;
+  while (prev[curr] != -1) {
+    narrowest = std::min(narrowest, conn.get(prev[curr], curr));
+    hop++;
+    curr = prev[curr];
+  }
+}
+
 WeightedShortestPathRoutingStrategy::WeightedShortestPathRoutingStrategy(
-    ConnectionMatrix const &c,
+    SparseConnectionMatrix const &c,
     std::map<size_t, CommDevice *> const &devmap,
     int total_devs)
-    : conn(c), devmap(devmap), total_devs(total_devs) {}
-
-EcmpRoutes WeightedShortestPathRoutingStrategy::get_routes(int src_node,
-                                                           int dst_node) {
-  int key = src_node * total_devs + dst_node;
+    : conn(c), devmap(devmap), total_devs(total_devs) {
+  assert(conn.num_devs() == total_devs);
+  clear();
+}
 
-  if (conn[key] > 0) {
-    return std::make_pair(std::vector<float>({1}),
-                          std::vector<Route>({Route({devmap.at(key)})}));
-  }
+void WeightedShortestPathRoutingStrategy::clear() {
+  shortest_path_trees.assign(total_devs, std::vector<int>());
+}
 
+std::vector<int>
+    WeightedShortestPathRoutingStrategy::compute_shortest_path_tree(
+        int src_node) const {
   // one-shortest path routing
   std::vector<uint64_t> dist(total_devs, std::numeric_limits<uint64_t>::max());
   std::vector<int> prev(total_devs, -1);
@@ -68,38 +109,56 @@ EcmpRoutes WeightedShortestPathRoutingStrategy::get_routes(int src_node,
                       std::vector<std::pair<uint64_t, uint64_t>>,
                       std::greater<std::pair<uint64_t, uint64_t>>>
       pq;
-  pq.push(std::make_pair(dist[src_node], src_node));
+  pq.push(std::make_pair(0, src_node));
   dist[src_node] = 0;
-
   while (!pq.empty()) {
     int min_node = pq.top().second;
     pq.pop();
-    visited[min_node] = true;
-
-    if (min_node == dst_node) {
-      break;
+    if (visited[min_node]) {
+      continue;
     }
+    visited[min_node] = true;
 
-    for (int i = 0; i < total_devs; i++) {
-      if (visited[i] || conn[min_node * total_devs + i] == 0) {
+    for (size_t k = conn.row_begin(min_node); k < conn.row_end(min_node);
+         k++) {
+      int i = conn.neighbor(k);
+      if (visited[i]) {
         continue;
       }
-      float new_dist = dist[min_node] + 1; // numeric_limits<uint64_t>::max() /
-                                           // get_bandwidth_bps(min_node, i);
-      if (new_dist < dist[i] || (new_dist == dist[i] && unif(gen) < 0.5)) {
+      uint64_t new_dist = dist[min_node] + 1;
+      if (new_dist < dist[i] || (new_dist == dist[i] && coin_flip())) {
         dist[i] = new_dist;
         prev[i] = min_node;
         pq.push(std::make_pair(new_dist, i));
       }
     }
   }
+  return prev;
+}
 
-  Route result = Route();
-  int curr = dst_node;
-  while (prev[curr] != -1) {
-    result.insert(result.begin(), devmap.at(prev[curr] * total_devs + curr));
-    curr = prev[curr];
+std::vector<int> const &
+    WeightedShortestPathRoutingStrategy::get_shortest_path_tree(int src_node) {
+  if (shortest_path_trees[src_node].empty()) {
+    shortest_path_trees[src_node] = compute_shortest_path_tree(src_node);
+  }
+  return shortest_path_trees[src_node];
+}
+
+void WeightedShortestPathRoutingStrategy::precompute_routes(int src_node) {
+  get_shortest_path_tree(src_node);
+}
+
+EcmpRoutes WeightedShortestPathRoutingStrategy::get_routes(int src_node,
+                                                           int dst_node) {
+  size_t key = (size_t)src_node * total_devs + dst_node;
+
+  if (conn.get(src_node, dst_node) > 0) {
+    return std::make_pair(std::vector<float>({1}),
+                          std::vector<Route>({Route({devmap.at(key)})}));
   }
+
+  Route result = route_from_tree(
+      get_shortest_path_tree(src_node), dst_node, total_devs, devmap);
   assert(result.size() || src_node == dst_node);
   return std::make_pair(std::vector<float>{1}, std::vector<Route>{result});
 }
@@ -108,87 +167,20 @@ void WeightedShortestPathRoutingStrategy::hop_count(int src_node,
                                                     int dst_node,
                                                     int &hop,
                                                     int &narrowest) {
-  int key = src_node * total_devs + dst_node;
-
-  if (conn[key] > 0) {
+  int direct = conn.get(src_node, dst_node);
+  if (direct > 0) {
     hop = 0;
-    narrowest = conn[key];
+    narrowest = direct;
     return;
   }
-  // one-shortest path routing
-  std::vector<uint64_t> dist(total_devs, std::numeric_limits<uint64_t>::max());
-  std::vector<int> prev(total_devs, -1);
-  std::vector<bool> visited(total_devs, false);
-
-  std::priority_queue<std::pair<uint64_t, uint64_t>,
-                      std::vector<std::pair<uint64_t, uint64_t>>,
-                      std::greater<std::pair<uint64_t, uint64_t>>>
-      pq;
-  pq.push(std::make_pair(dist[src_node], src_node));
-  dist[src_node] = 0;
-  while (!pq.empty()) {
-    int min_node = pq.top().second;
-    pq.pop();
-    visited[min_node] = true;
-    if (min_node == dst_node) {
-      break;
-    }
-    for (int i = 0; i < total_devs; i++) {
-      if (visited[i] || conn[min_node * total_devs + i] == 0) {
-        continue;
-      }
-      float new_dist = dist[min_node] + 1; // numeric_limits<uint64_t>::max() /
-                                           // get_bandwidth_bps(min_node, i);
-      if (new_dist < dist[i]) {
-        dist[i] = new_dist;
-        prev[i] = min_node;
-        pq.push(std::make_pair(new_dist, i));
-      }
-    }
-  }
-  hop = 0;
-  narrowest = std::numeric_limits<int>::max();
-  int curr = dst_node;
-  while (prev[curr] != -1) {
-    if (narrowest > conn[prev[curr] * total_devs + curr]) {
-      narrowest = conn[prev[curr] * total_devs + curr];
-    }
-    hop++;
-    curr = prev[curr];
-  }
+  hops_from_tree(
+      get_shortest_path_tree(src_node), dst_node, conn, hop, narrowest);
   assert(hop > 0 || src_node == dst_node);
 }
 
 std::vector<EcmpRoutes>
     WeightedShortestPathRoutingStrategy::get_routes_from_src(int src_node) {
-  std::vector<uint64_t> dist(total_devs, std::numeric_limits<uint64_t>::max());
-  std::vector<int> prev(total_devs, -1);
-  std::vector<bool> visited(total_devs, false);
-
-  std::priority_queue<std::pair<uint64_t, uint64_t>,
-                      std::vector<std::pair<uint64_t, uint64_t>>,
-                      std::greater<std::pair<uint64_t, uint64_t>>>
-      pq;
-  pq.push(std::make_pair(dist[src_node], src_node));
-  dist[src_node] = 0;
-  while (!pq.empty()) {
-    int min_node = pq.top().second;
-    pq.pop();
-    visited[min_node] = true;
-
-    for (int i = 0; i < total_devs; i++) {
-      if (visited[i] || conn[min_node * total_devs + i] == 0) {
-        continue;
-      }
-      float new_dist = dist[min_node] + 1; // numeric_limits<uint64_t>::max() /
-                                           // get_bandwidth_bps(min_node, i);
-      if (new_dist < dist[i]) {
-        dist[i] = new_dist;
-        prev[i] = min_node;
-        pq.push(std::make_pair(new_dist, i));
-      }
-    }
-  }
+  std::vector<int> const &prev = get_shortest_path_tree(src_node);
   std::vector<EcmpRoutes> final_result;
   for (int i = 0; i < total_devs; i++) {
     if (i == src_node) {
@@ -196,12 +188,7 @@ std::vector<EcmpRoutes>
           std::make_pair(std::vector<float>{}, std::vector<Route>{}));
       continue;
     }
-    Route result = Route();
-    int curr = i;
-    while (prev[curr] != -1) {
-      result.insert(result.begin(), devmap.at(prev[curr] * total_devs + curr));
-      curr = prev[curr];
-    }
+    Route result = route_from_tree(prev, i, total_devs, devmap);
     assert(result.size() > 0);
     final_result.emplace_back(
         std::make_pair(std::vector<float>{1}, std::vector<Route>{result}));
@@ -211,143 +198,103 @@ std::vector<EcmpRoutes>
 
 std::vector<std::pair<int, int>>
     WeightedShortestPathRoutingStrategy::hop_count(int src_node) {
-  std::vector<uint64_t> dist(total_devs, std::numeric_limits<uint64_t>::max());
-  std::vector<int> prev(total_devs, -1);
-  std::vector<bool> visited(total_devs, false);
-
-  std::priority_queue<std::pair<uint64_t, uint64_t>,
-                      std::vector<std::pair<uint64_t, uint64_t>>,
-                      std::greater<std::pair<uint64_t, uint64_t>>>
-      pq;
-  pq.push(std::make_pair(dist[src_node], src_node));
-  dist[src_node] = 0;
-  while (!pq.empty()) {
-    int min_node = pq.top().second;
-    pq.pop();
-    visited[min_node] = true;
-
-    for (int i = 0; i < total_devs; i++) {
-      if (visited[i] || conn[min_node * total_devs + i] == 0) {
-        continue;
-      }
-      float new_dist = dist[min_node] + 1; // numeric_limits<uint64_t>::max() /
-                                           // get_bandwidth_bps(min_node, i);
-      if (new_dist < dist[i]) {
-        dist[i] = new_dist;
-        prev[i] = min_node;
-        pq.push(std::make_pair(new_dist, i));
-      }
-    }
-  }
-
+  std::vector<int> const &prev = get_shortest_path_tree(src_node);
   std::vector<std::pair<int, int>> result;
   for (int i = 0; i < total_devs; i++) {
     if (i == src_node) {
       result.emplace_back(std::make_pair(-1, 0));
       continue;
     }
-    int hop = -1;
-    int narrowest = 0;
-    int curr = i;
-    while (prev[curr] != -1) {
-      if (!narrowest || (narrowest > conn[prev[curr] * total_devs + curr])) {
-        narrowest = conn[prev[curr] * total_devs + curr];
-      }
-      hop++;
-      curr = prev[curr];
+    int hop, narrowest;
+    hops_from_tree(prev, i, conn, hop, narrowest);
+    if (hop == 0) {
+      narrowest = 0;
     }
-    result.emplace_back(std::make_pair(hop, narrowest));
+    result.emplace_back(std::make_pair(hop - 1, narrowest));
   }
   return result;
 }
 
 ShortestPathNetworkRoutingStrategy::ShortestPathNetworkRoutingStrategy(
-    ConnectionMatrix const &c,
+    SparseConnectionMatrix const &c,
     std::map<size_t, CommDevice *> const &devmap,
     int total_devs)
-    : conn(c), devmap(devmap), total_devs(total_devs) {}
-
-EcmpRoutes ShortestPathNetworkRoutingStrategy::get_routes(int src_node,
-                                                          int dst_node) {
-  int key = src_node * total_devs + dst_node;
-  // std::cerr << "routing " << src_node << ", " << dst_node << std::endl;
+    : conn(c), devmap(devmap), total_devs(total_devs) {
+  assert(conn.num_devs() == total_devs);
+  clear();
+}
 
-  if (conn[key] > 0) {
-    return std::make_pair(std::vector<float>({1}),
-                          std::vector<Route>({Route({devmap.at(key)})}));
-  }
+void ShortestPathNetworkRoutingStrategy::clear() {
+  shortest_path_trees.assign(total_devs, std::vector<int>());
+}
 
+std::vector<int>
+    ShortestPathNetworkRoutingStrategy::compute_shortest_path_tree(
+        int src_node) const {
   // one-shortest path routing
   std::vector<uint64_t> dist(total_devs, std::numeric_limits<uint64_t>::max());
   std::vector<int> prev(total_devs, -1);
-  std::vector<bool> visited(total_devs, false);
 
-  std::queue<uint64_t> q;
+  std::queue<int> q;
   q.push(src_node);
   dist[src_node] = 0;
 
-  // BFS
+  // BFS; among the parents at the same distance one is picked at random so
+  // that routes are spread over parallel paths
   while (!q.empty()) {
     int min_node = q.front();
     q.pop();
-    visited[min_node] = true;
-
-    if (min_node == dst_node) {
-      break;
-    }
 
-    for (int i = 0; i < total_devs; i++) {
-      if (visited[i] || conn[min_node * total_devs + i] == 0) {
+    for (size_t k = conn.row_begin(min_node); k < conn.row_end(min_node);
+         k++) {
+      int i = conn.neighbor(k);
+      if (i == src_node) {
         continue;
       }
-      float new_dist = dist[min_node] + 1;
-      if (new_dist < dist[i] || (new_dist == dist[i] && unif(gen) < 0.5)) {
+      uint64_t new_dist = dist[min_node] + 1;
+      if (new_dist < dist[i]) {
         dist[i] = new_dist;
         prev[i] = min_node;
         q.push(i);
+      } else if (new_dist == dist[i] && coin_flip()) {
+        prev[i] = min_node;
       }
     }
   }
+  return prev;
+}
 
-  Route result = Route();
-  int curr = dst_node;
-  while (prev[curr] != -1) {
-    result.insert(result.begin(), devmap.at(prev[curr] * total_devs + curr));
-    curr = prev[curr];
+std::vector<int> const &
+    ShortestPathNetworkRoutingStrategy::get_shortest_path_tree(int src_node) {
+  if (shortest_path_trees[src_node].empty()) {
+    shortest_path_trees[src_node] = compute_shortest_path_tree(src_node);
   }
-  assert(result.size() || src_node == dst_node);
-  return std::make_pair(std::vector<float>{1}, std::vector<Route>{result});
+  return shortest_path_trees[src_node];
 }
 
-std::vector<EcmpRoutes>
-    ShortestPathNetworkRoutingStrategy::get_routes_from_src(int src_node) {
-  std::vector<uint64_t> dist(total_devs, std::numeric_limits<uint64_t>::max());
-  std::vector<int> prev(total_devs, -1);
-  std::vector<bool> visited(total_devs, false);
-
-  std::queue<uint64_t> q;
-  q.push(src_node);
-  dist[src_node] = 0;
+void ShortestPathNetworkRoutingStrategy::precompute_routes(int src_node) {
+  get_shortest_path_tree(src_node);
+}
 
-  // BFS
-  while (!q.empty()) {
-    int min_node = q.front();
-    q.pop();
-    visited[min_node] = true;
+EcmpRoutes ShortestPathNetworkRoutingStrategy::get_routes(int src_node,
+                                                          int dst_node) {
+  size_t key = (size_t)src_node * total_devs + dst_node;
+  // std::cerr << "routing " << src_node << ", " << dst_node << std::endl;
 
-    for (int i = 0; i < total_devs; i++) {
-      if (visited[i] || conn[min_node * total_devs + i] == 0) {
-        continue;
-      }
-      float new_dist = dist[min_node] + 1;
-      if (new_dist < dist[i] || (new_dist == dist[i] && unif(gen) < 0.5)) {
-        dist[i] = new_dist;
-        prev[i] = min_node;
-        q.push(i);
-      }
-    }
+  if (conn.get(src_node, dst_node) > 0) {
+    return std::make_pair(std::vector<float>({1}),
+                          std::vector<Route>({Route({devmap.at(key)})}));
   }
 
+  Route result = route_from_tree(
+      get_shortest_path_tree(src_node), dst_node, total_devs, devmap);
+  assert(result.size() || src_node == dst_node);
+  return std::make_pair(std::vector<float>{1}, std::vector<Route>{result});
+}
+
+std::vector<EcmpRoutes>
+    ShortestPathNetworkRoutingStrategy::get_routes_from_src(int src_node) {
+  std::vector<int> const &prev = get_shortest_path_tree(src_node);
   std::vector<EcmpRoutes> final_result;
   for (int i = 0; i < total_devs; i++) {
     if (i == src_node) {
@@ -355,12 +302,7 @@ std::vector<EcmpRoutes>
           std::make_pair(std::vector<float>{}, std::vector<Route>{}));
       continue;
     }
-    Route result = Route();
-    int curr = i;
-    while (prev[curr] != -1) {
-      result.insert(result.begin(), devmap.at(prev[curr] * total_devs + curr));
-      curr = prev[curr];
-    }
+    Route result = route_from_tree(prev, i, total_devs, devmap);
     // assert(result.size() > 0);
     final_result.emplace_back(
         std::make_pair(std::vector<float>{1}, std::vector<Route>{result}));
@@ -372,103 +314,32 @@ void ShortestPathNetworkRoutingStrategy::hop_count(int src_node,
                                                    int dst_node,
                                                    int &hop,
                                                    int &narrowest) {
-  int key = src_node * total_devs + dst_node;
-
-  if (conn[key] > 0) {
+  int direct = conn.get(src_node, dst_node);
+  if (direct > 0) {
     hop = 0;
-    narrowest = conn[key];
+    narrowest = direct;
     return;
   }
-  // one-shortest path routing
-  std::vector<uint64_t> dist(total_devs, std::numeric_limits<uint64_t>::max());
-  std::vector<int> prev(total_devs, -1);
-  std::vector<bool> visited(total_devs, false);
-
-  std::queue<uint64_t> q;
-  q.push(src_node);
-  dist[src_node] = 0;
-
-  // BFS
-  while (!q.empty()) {
-    int min_node = q.front();
-    q.pop();
-    visited[min_node] = true;
-
-    if (min_node == dst_node) {
-      break;
-    }
-
-    for (int i = 0; i < total_devs; i++) {
-      if (visited[i] || conn[min_node * total_devs + i] == 0) {
-        continue;
-      }
-      float new_dist = dist[min_node] + 1;
-      if (new_dist < dist[i] || (new_dist == dist[i] && unif(gen) < 0.5)) {
-        dist[i] = new_dist;
-        prev[i] = min_node;
-        q.push(i);
-      }
-    }
-  }
-  hop = 0;
-  narrowest = std::numeric_limits<int>::max();
-  int curr = dst_node;
-  while (prev[curr] != -1) {
-    if (narrowest > conn[prev[curr] * total_devs + curr]) {
-      narrowest = conn[prev[curr] * total_devs + curr];
-    }
-    hop++;
-    curr = prev[curr];
-  }
+  hops_from_tree(
+      get_shortest_path_tree(src_node), dst_node, conn, hop, narrowest);
   assert(hop > 0 || src_node == dst_node);
 }
 
 std::vector<std::pair<int, int>>
     ShortestPathNetworkRoutingStrategy::hop_count(int src_node) {
-  std::vector<uint64_t> dist(total_devs, std::numeric_limits<uint64_t>::max());
-  std::vector<int> prev(total_devs, -1);
-  std::vector<bool> visited(total_devs, false);
-
-  std::queue<uint64_t> q;
-  q.push(src_node);
-  dist[src_node] = 0;
-
-  // BFS
-  while (!q.empty()) {
-    int min_node = q.front();
-    q.pop();
-    visited[min_node] = true;
-
-    for (int i = 0; i < total_devs; i++) {
-      if (visited[i] || conn[min_node * total_devs + i] == 0) {
-        continue;
-      }
-      float new_dist = dist[min_node] + 1;
-      if (new_dist < dist[i] || (new_dist == dist[i] && unif(gen) < 0.5)) {
-        dist[i] = new_dist;
-        prev[i] = min_node;
-        q.push(i);
-      }
-    }
-  }
-
+  std::vector<int> const &prev = get_shortest_path_tree(src_node);
   std::vector<std::pair<int, int>> result;
   for (int i = 0; i < total_devs; i++) {
     if (i == src_node) {
       result.emplace_back(std::make_pair(-1, 0));
       continue;
     }
-    int hop = -1;
-    int narrowest = 0;
-    int curr = i;
-    while (prev[curr] != -1) {
-      if (!narrowest || (narrowest > conn[prev[curr] * total_devs + curr])) {
-        narrowest = conn[prev[curr] * total_devs + curr];
-      }
-      hop++;
-      curr = prev[curr];
+    int hop, narrowest;
+    hops_from_tree(prev, i, conn, hop, narrowest);
+    if (hop == 0) {
+      narrowest = 0;
     }
-    result.emplace_back(std::make_pair(hop, narrowest));
+    result.emplace_back(std::make_pair(hop - 1, narrowest));
   }
   return result;
 }
@@ -477,9 +348,17 @@ FlatDegConstraintNetworkTopologyGenerator::
     FlatDegConstraintNetworkTopologyGenerator(int num_nodes, int degree)
     : num_nodes(num_nodes), degree(degree) {}
 
-ConnectionMatrix
+SparseConnectionMatrix
     FlatDegConstraintNetworkTopologyGenerator::generate_topology() const {
-  ConnectionMatrix conn = std::vector<int>(num_nodes * num_nodes, 0);
+  // number of links between each connected pair of nodes, keyed by get_id
+  std::unordered_map<int, int> links;
+  std::vector<int> if_in_use(num_nodes, 0);
+  auto connect = [&](int a, int b) {
+    links[get_id(a, b)]++;
+    links[get_id(b, a)]++;
+    if_in_use[a]++;
+    if_in_use[b]++;
+  };
 
   int allocated = 0;
   int curr_node = 0;
@@ -495,11 +374,10 @@ ConnectionMatrix
       continue;
     }
     if (visited_node.find(next_step) == visited_node.end()) {
-      if (conn[get_id(curr_node, next_step)] == degree) {
+      if (links[get_id(curr_node, next_step)] == degree) {
         continue;
       }
-      conn[get_id(curr_node, next_step)]++;
-      conn[get_id(next_step, curr_node)]++;
+      connect(curr_node, next_step);
       visited_node.insert(next_step);
       curr_node = next_step;
       allocated += 2;
@@ -510,9 +388,8 @@ ConnectionMatrix
 
   std::vector<std::pair<int, int>> node_with_avail_if;
   for (int i = 0; i < num_nodes; i++) {
-    int if_inuse = get_if_in_use(i, conn);
-    if (if_inuse < degree) {
-      node_with_avail_if.emplace_back(i, degree - if_inuse);
+    if (if_in_use[i] < degree) {
+      node_with_avail_if.emplace_back(i, degree - if_in_use[i]);
     }
   }
 
@@ -525,11 +402,9 @@ ConnectionMatrix
       ;
     }
 
-    assert(
-        conn[get_id(node_with_avail_if[a].first, node_with_avail_if[b].first)] <
-        degree);
-    conn[get_id(node_with_avail_if[a].first, node_with_avail_if[b].first)]++;
-    conn[get_id(node_with_avail_if[b].first, node_with_avail_if[a].first)]++;
+    assert(links[get_id(node_with_avail_if[a].first,
+                        node_with_avail_if[b].first)] < degree);
+    connect(node_with_avail_if[a].first, node_with_avail_if[b].first);
     allocated += 2;
 
     bool changed = false;
@@ -550,6 +425,13 @@ ConnectionMatrix
     }
   }
 
+  std::vector<SparseConnectionMatrix::Edge> edges;
+  edges.reserve(links.size());
+  for (auto const &link : links) {
+    edges.push_back(
+        {link.first / num_nodes, link.first % num_nodes, link.second});
+  }
+  SparseConnectionMatrix conn(num_nodes, edges);
 #ifdef DEBUG_PRINT
   std::cout << "Topology generated: " << std::endl;
   NetworkTopologyGenerator::print_conn_matrix(conn, num_nodes, 0);
@@ -561,27 +443,20 @@ int FlatDegConstraintNetworkTopologyGenerator::get_id(int i, int j) const {
   return i * num_nodes + j;
 }
 
-int FlatDegConstraintNetworkTopologyGenerator::get_if_in_use(
-    int node, ConnectionMatrix const &conn) const {
-  int result = 0;
-  for (int i = 0; i < num_nodes; i++) {
-    result += conn[get_id(node, i)];
-  }
-  return result;
-}
-
 BigSwitchNetworkTopologyGenerator::BigSwitchNetworkTopologyGenerator(
     int num_nodes)
     : num_nodes(num_nodes) {}
 
-ConnectionMatrix BigSwitchNetworkTopologyGenerator::generate_topology() const {
-  ConnectionMatrix conn =
-      std::vector<int>((num_nodes + 1) * (num_nodes + 1), 0);
+SparseConnectionMatrix
+    BigSwitchNetworkTopologyGenerator::generate_topology() const {
+  // every node is linked to the switch, which is device num_nodes
+  std::vector<SparseConnectionMatrix::Edge> edges;
+  edges.reserve(2 * num_nodes);
   for (int i = 0; i < num_nodes; i++) {
-    conn[i * (num_nodes + 1) + num_nodes] = 1;
-    conn[num_nodes * (num_nodes + 1) + i] = 1;
+    edges.push_back({i, num_nodes, 1});
+    edges.push_back({num_nodes, i, 1});
   }
-  return conn;
+  return SparseConnectionMatrix(num_nodes + 1, edges);
 }
 
 }; // namespace FlexFlow
\ No newline at end of file
@@ -12,6 +12,7 @@
 #include "flexflow/ops/element_binary.h"
 #include "flexflow/ops/element_unary.h"
 #include "flexflow/ops/embedding.h"
+#include "flexflow/ops/experts.h"
 #include "flexflow/ops/flat.h"
 #include "flexflow/ops/groupby.h"
 #include "flexflow/ops/layer_norm.h"
@@ -29,8 +30,10 @@
 #include "flexflow/parallel_ops/combine.h"
 #include "flexflow/parallel_ops/fused_parallel_op.h"
 #include "flexflow/parallel_ops/partition.h"
+#include "flexflow/parallel_ops/pipeline.h"
 #include "flexflow/parallel_ops/reduction.h"
 #include "flexflow/parallel_ops/replicate.h"
+#include "flexflow/utils/hash_utils.h"
 
 namespace FlexFlow {
 
@@ -85,6 +88,8 @@ tl::optional<OperatorParameters> get_op_parameters(Op const *op) {
       return ((Repartition *)op)->get_params();
     case OP_REPLICATE:
       return ((Replicate *)op)->get_params();
+    case OP_PIPELINE:
+      return ((Pipeline *)op)->get_params();
     case OP_REDUCTION:
       return ((Reduction *)op)->get_params();
     case OP_COMBINE:
@@ -105,6 +110,8 @@ tl::optional<OperatorParameters> get_op_parameters(Op const *op) {
       return ((Aggregate *)op)->get_params();
     case OP_AGG_SPEC:
       return ((AggregateSpec *)op)->get_params();
+    case OP_EXPERTS:
+      return ((Experts *)op)->get_params();
 
       // TODO: implement the get_params() function for the operators below and
       // uncomment the lines below
@@ -125,4 +132,33 @@ tl::optional<OperatorParameters> get_op_parameters(Op const *op) {
   }
 }
 
+namespace {
+
+struct GuidFreeParamsHash {
+  template <typename T>
+  size_t operator()(T const &params) const {
+    return hash(params, 0);
+  }
+  // preferred for the params that hold a layer_guid
+  template <typename T>
+  static auto hash(T params, int)
+      -> decltype((void)params.layer_guid, size_t()) {
+    params.layer_guid = LayerID();
+    return std::hash<T>()(params);
+  }
+  template <typename T>
+  static size_t hash(T const &params, long) {
+    return std::hash<T>()(params);
+  }
+};
+
+} // namespace
+
+size_t get_guid_free_params_hash(OperatorParameters const &params) {
+  size_t key = 0;
+  hash_combine(key, params.index());
+  hash_combine(key, mp::visit(GuidFreeParamsHash(), params));
+  return key;
+}
+
 }; // namespace FlexFlow
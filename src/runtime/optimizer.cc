@@ -14,6 +14,7 @@
  */
 
 #include "flexflow/optimizer.h"
+#include "flexflow/gradient_buckets.h"
 #include "flexflow/model.h"
 
 namespace FlexFlow {
@@ -22,6 +23,221 @@ using namespace Legion;
 
 Optimizer::Optimizer(FFModel const *_model) : model(_model) {}
 
+void Optimizer::create_gradient_buckets(void) {
+  Context ctx = model->config.lg_ctx;
+  Runtime *runtime = model->config.lg_hlr;
+  gradient_buckets.clear();
+  unbucketed_parameters.clear();
+  if (bucket_buffers != LogicalRegion::NO_REGION) {
+    // Legion destroys them once the updates still using them are done
+    runtime->destroy_logical_region(ctx, bucket_buffers);
+    runtime->destroy_index_space(ctx, bucket_buffers.get_index_space());
+    bucket_buffers = LogicalRegion::NO_REGION;
+  }
+  size_t bucket_bytes = model->config.gradient_bucket_size;
+  std::vector<ParallelTensor> candidates;
+  std::vector<size_t> keys, bytes;
+  for (ParallelTensor p : model->parameters) {
+    if (bucket_bytes == 0 || p->sync_type != ParameterSyncType::NCCL ||
+        sparse_gradients.find(p->region) != sparse_gradients.end()) {
+      unbucketed_parameters.push_back(p);
+      continue;
+    }
+    assert(p->owner_op->op_type != OP_FUSED);
+    assert(p->parallel_is != IndexSpace::NO_SPACE);
+    candidates.push_back(p);
+    keys.push_back(p->machine_view.hash() * 31 + p->parallel_is.get_id());
+    size_t parts = p->get_total_num_parts();
+    bytes.push_back((p->get_volume() + parts - 1) / parts * sizeof(float));
+  }
+  if (candidates.empty()) {
+    return;
+  }
+  // One buffer per GPU, which a bucket of several parameters fills up to
+  // bucket_bytes. It is not the workspace of the GPU, which the backward
+  // kernels running alongside the updates use.
+  int num_devices = model->config.numNodes * model->config.workersPerNode;
+  coord_t buffer_size = (bucket_bytes + sizeof(float) - 1) / sizeof(float);
+  IndexSpace buffer_is = runtime->create_index_space(
+      ctx, Rect<1>(0, num_devices * buffer_size - 1));
+  bucket_buffers =
+      runtime->create_logical_region(ctx, buffer_is, model->config.field_space);
+  runtime->fill_field<float>(
+      ctx, bucket_buffers, bucket_buffers, FID_DATA, 0.0f);
+  for (std::vector<int> const &params : assign_gradient_buckets(
+           keys, bytes, bucket_bytes, MAX_NUM_BUCKET_PARAMETERS)) {
+    GradientBucket bucket;
+    for (int i : params) {
+      bucket.parameters.push_back(candidates[i]);
+    }
+    // The point of the launch that runs on GPU d gets the d-th buffer
+    ParallelTensor p = bucket.parameters[0];
+    MachineView const &view = p->machine_view;
+    Domain domain = runtime->get_index_space_domain(ctx, p->parallel_is);
+    assert(domain.get_dim() == view.ndims);
+    switch (domain.get_dim()) {
+#define DIMFUNC(DIM)                                                           \
+  case DIM: {                                                                  \
+    Transform<1, DIM> transform;                                               \
+    for (int i = 0; i < DIM; i++) {                                            \
+      transform[0][i] = view.stride[i] * buffer_size;                          \
+    }                                                                          \
+    Rect<1> extent(view.start_device_id * buffer_size,                         \
+                   (view.start_device_id + 1) * buffer_size - 1);              \
+    IndexSpaceT<DIM> color_is(p->parallel_is);                                 \
+    IndexPartition ip = runtime->create_partition_by_restriction(              \
+        ctx, IndexSpaceT<1>(buffer_is), color_is, transform, extent);          \
+    bucket.buffer_part =                                                       \
+        runtime->get_logical_partition(ctx, bucket_buffers, ip);               \
+    break;                                                                     \
+  }
+      LEGION_FOREACH_N(DIMFUNC)
+#undef DIMFUNC
+      default:
+        assert(false);
+    }
+    gradient_buckets.push_back(bucket);
+  }
+}
+
+// Passes the OpMeta of the owner of p, which holds the NCCL communicator of
+// its machine view, to each point of the launch
+static void set_nccl_update_argumentmap(FFModel const *model,
+                                        const ParallelTensor p,
+                                        ArgumentMap &argmap) {
+  Context ctx = model->config.lg_ctx;
+  Runtime *runtime = model->config.lg_hlr;
+  Domain domain = runtime->get_index_space_domain(ctx, p->parallel_is);
+  switch (domain.get_dim()) {
+#define DIMFUNC(DIM)                                                           \
+  case DIM: {                                                                  \
+    Rect<DIM> rect = domain;                                                   \
+    int idx = 0;                                                               \
+    for (PointInRectIterator<DIM> it(rect); it(); it++) {                      \
+      OpMeta *mp = p->owner_op->meta[idx++];                                   \
+      argmap.set_point(*it, TaskArgument(&mp, sizeof(OpMeta *)));              \
+    }                                                                          \
+    break;                                                                     \
+  }
+    LEGION_FOREACH_N(DIMFUNC)
+#undef DIMFUNC
+    default:
+      assert(false);
+  }
+}
+
+// Appended to the optimizer in the arguments of a sparse update task
+struct SparseUpdateInfo {
+  DataType ids_type;
+  AggrMode aggr;
+};
+
+// Launches a sparse update of p, whose regions are the ids and the output
+// gradient of the embedding, the weight and then the optimizer states
+static void launch_sparse_update(FFModel const *model,
+                                 TaskID task_id,
+                                 void const *op,
+                                 size_t op_size,
+                                 const ParallelTensor p,
+                                 SparseGradient const &grad,
+                                 std::vector<ParallelTensor> const &states) {
+  Context ctx = model->config.lg_ctx;
+  Runtime *runtime = model->config.lg_hlr;
+  assert(p->sync_type == ParameterSyncType::NCCL);
+  assert(p->owner_op->op_type != OP_FUSED);
+  std::vector<char> args(op_size + sizeof(SparseUpdateInfo));
+  SparseUpdateInfo info = {grad.ids->data_type, grad.aggr};
+  memcpy(args.data(), op, op_size);
+  memcpy(args.data() + op_size, &info, sizeof(SparseUpdateInfo));
+  ArgumentMap argmap;
+  set_nccl_update_argumentmap(model, p, argmap);
+  // The update sorts and gathers the gradient in the workspace of each GPU,
+  // so the backward kernels (and the unfenced bucket updates) using that
+  // workspace must finish first
+  runtime->issue_execution_fence(ctx);
+  IndexLauncher launcher(task_id,
+                         p->parallel_is,
+                         TaskArgument(args.data(), args.size()),
+                         argmap,
+                         Predicate::TRUE_PRED,
+                         false /*must_epoch*/,
+                         0 /*mapper_id*/,
+                         p->machine_view.hash());
+  // regions[0]: ids
+  launcher.add_region_requirement(RegionRequirement(grad.ids->part,
+                                                    0 /*projection id*/,
+                                                    READ_ONLY,
+                                                    EXCLUSIVE,
+                                                    grad.ids->region));
+  launcher.add_field(0, FID_DATA);
+  // regions[1]: output_grad
+  launcher.add_region_requirement(RegionRequirement(grad.grad->part_grad,
+                                                    0 /*projection id*/,
+                                                    READ_ONLY,
+                                                    EXCLUSIVE,
+                                                    grad.grad->region_grad));
+  launcher.add_field(1, FID_DATA);
+  // regions[2]: region
+  launcher.add_region_requirement(RegionRequirement(p->part,
+                                                    0 /*projection id*/,
+                                                    READ_WRITE,
+                                                    EXCLUSIVE,
+                                                    p->region,
+                                                    p->region_tag));
+  launcher.add_field(2, FID_DATA);
+  int rid = 3;
+  for (ParallelTensor v : states) {
+    // regions[rid]: optimizer state
+    launcher.add_region_requirement(RegionRequirement(v->part,
+                                                      0 /*projection id*/,
+                                                      READ_WRITE,
+                                                      EXCLUSIVE,
+                                                      v->region,
+                                                      v->region_tag));
+    launcher.add_field(rid++, FID_DATA);
+  }
+  runtime->execute_index_space(ctx, launcher);
+  // The update issues NCCL collectives, see SGDOptimizer::update(p)
+  runtime->issue_execution_fence(ctx);
+}
+
+#ifdef FF_USE_NCCL
+// Reads the local shard of a sparse gradient from the regions of a task
+// launched by launch_sparse_update
+static SparseGradientShard
+    get_sparse_gradient_shard(Task const *task,
+                              size_t op_size,
+                              std::vector<PhysicalRegion> const &regions,
+                              Context ctx,
+                              Runtime *runtime) {
+  assert(task->arglen == op_size + sizeof(SparseUpdateInfo));
+  SparseUpdateInfo info;
+  memcpy(&info, (char const *)task->args + op_size, sizeof(SparseUpdateInfo));
+  assert(info.ids_type == DT_INT32 || info.ids_type == DT_INT64);
+  GenericTensorAccessorR ids = helperGetGenericTensorAccessorRO(
+      info.ids_type, regions[0], task->regions[0], FID_DATA, ctx, runtime);
+  GenericTensorAccessorR grad = helperGetGenericTensorAccessorRO(
+      DT_FLOAT, regions[1], task->regions[1], FID_DATA, ctx, runtime);
+  Domain w_domain = runtime->get_index_space_domain(
+      ctx, task->regions[2].region.get_index_space());
+  SparseGradientShard shard;
+  shard.ids_type = info.ids_type;
+  shard.ids = ids.ptr;
+  shard.num_ids = ids.domain.get_volume();
+  shard.grad = grad.get_float_ptr();
+  shard.num_channels = grad.domain.hi()[0] - grad.domain.lo()[0] + 1;
+  assert(shard.num_channels == w_domain.hi()[0] - w_domain.lo()[0] + 1);
+  size_t num_bags = grad.domain.get_volume() / shard.num_channels;
+  assert(shard.num_ids % num_bags == 0);
+  shard.bag_size = shard.num_ids / num_bags;
+  assert(info.aggr != AGGR_MODE_NONE || shard.bag_size == 1);
+  shard.scale = info.aggr == AGGR_MODE_AVG ? 1.0f / shard.bag_size : 1.0f;
+  shard.row_lo = w_domain.lo()[1];
+  shard.row_hi = w_domain.hi()[1];
+  return shard;
+}
+#endif
+
 ParallelTensor create_replica_parameter(FFModel const *model,
                                         const ParallelTensor p) {
   Context ctx = model->config.lg_ctx;
@@ -88,6 +304,10 @@ void SGDOptimizer::init(void) {
 void SGDOptimizer::next(void) {}
 
 void SGDOptimizer::update(const ParallelTensor p) {
+  if (sparse_gradients.find(p->region) != sparse_gradients.end()) {
+    sparse_update(p);
+    return;
+  }
   Context ctx = model->config.lg_ctx;
   Runtime *runtime = model->config.lg_hlr;
   assert(p->owner_op != NULL);
@@ -98,12 +318,19 @@ void SGDOptimizer::update(const ParallelTensor p) {
                           0 /*mapper_id*/,
                           p->machine_view.hash());
     // regions[0]: region_grad
-    launcher.add_region_requirement(RegionRequirement(
-        p->region_grad, READ_ONLY, EXCLUSIVE, p->region_grad));
+    launcher.add_region_requirement(RegionRequirement(p->region_grad,
+                                                      READ_ONLY,
+                                                      EXCLUSIVE,
+                                                      p->region_grad,
+                                                      p->region_tag));
     launcher.add_field(0, FID_DATA);
     // regions[1]: region
     launcher.add_region_requirement(
-        RegionRequirement(p->region, READ_WRITE, EXCLUSIVE, p->region));
+        RegionRequirement(p->region,
+                          READ_WRITE,
+                          EXCLUSIVE,
+                          p->region,
+                          p->region_tag));
     launcher.add_field(1, FID_DATA);
     if (momentum > 0.0f) {
       // regions[2]: v_region
@@ -112,7 +339,8 @@ void SGDOptimizer::update(const ParallelTensor p) {
           RegionRequirement(v_values[p->region]->region,
                             READ_WRITE,
                             EXCLUSIVE,
-                            v_values[p->region]->region));
+                            v_values[p->region]->region,
+                            v_values[p->region]->region_tag));
       launcher.add_field(2, FID_DATA);
     }
     runtime->execute_task(ctx, launcher);
@@ -128,8 +356,12 @@ void SGDOptimizer::update(const ParallelTensor p) {
                                  0 /*mapper_id*/,
                                  p->machine_view.hash());
     // regions[0]: region
-    index_launcher.add_region_requirement(RegionRequirement(
-        p->part, 0 /*projection*/, READ_ONLY, EXCLUSIVE, p->region));
+    index_launcher.add_region_requirement(RegionRequirement(p->part,
+                                                            0 /*projection*/,
+                                                            READ_ONLY,
+                                                            EXCLUSIVE,
+                                                            p->region,
+                                                            p->region_tag));
     index_launcher.add_field(0, FID_DATA);
     runtime->execute_index_space(ctx, index_launcher);
   } else if (p->sync_type == ParameterSyncType::NCCL) {
@@ -168,11 +400,16 @@ void SGDOptimizer::update(const ParallelTensor p) {
                                                       0 /*projection id*/,
                                                       READ_ONLY,
                                                       EXCLUSIVE,
-                                                      p->region_grad));
+                                                      p->region_grad,
+                                                      p->region_tag));
     launcher.add_field(0, FID_DATA);
     // regions[1]: region
-    launcher.add_region_requirement(RegionRequirement(
-        p->part, 0 /*projection id*/, READ_WRITE, EXCLUSIVE, p->region));
+    launcher.add_region_requirement(RegionRequirement(p->part,
+                                                      0 /*projection id*/,
+                                                      READ_WRITE,
+                                                      EXCLUSIVE,
+                                                      p->region,
+                                                      p->region_tag));
     launcher.add_field(1, FID_DATA);
     if (momentum > 0.0f) {
       // regions[2]: v_value
@@ -182,7 +419,8 @@ void SGDOptimizer::update(const ParallelTensor p) {
                             0 /*projection id*/,
                             READ_WRITE,
                             EXCLUSIVE,
-                            v_values[p->region]->region));
+                            v_values[p->region]->region,
+                            v_values[p->region]->region_tag));
       launcher.add_field(2, FID_DATA);
     }
     // MustEpochLauncher must_epoch_launcher;
@@ -195,6 +433,82 @@ void SGDOptimizer::update(const ParallelTensor p) {
   }
 }
 
+void SGDOptimizer::update(GradientBucket const &bucket) {
+  Context ctx = model->config.lg_ctx;
+  Runtime *runtime = model->config.lg_hlr;
+  assert(!bucket.parameters.empty());
+  assert(bucket.parameters.size() <= MAX_NUM_BUCKET_PARAMETERS);
+  ParallelTensor first = bucket.parameters[0];
+  ArgumentMap argmap;
+  set_nccl_update_argumentmap(model, first, argmap);
+  IndexLauncher launcher(SGD_UPD_NCCL_BUCKET_TASK_ID,
+                         first->parallel_is,
+                         TaskArgument(this, sizeof(SGDOptimizer)),
+                         argmap,
+                         Predicate::TRUE_PRED,
+                         false /*must_epoch*/,
+                         0 /*mapper_id*/,
+                         first->machine_view.hash());
+  // regions[0]: bucket buffer
+  launcher.add_region_requirement(RegionRequirement(bucket.buffer_part,
+                                                    0 /*projection id*/,
+                                                    READ_WRITE,
+                                                    EXCLUSIVE,
+                                                    bucket_buffers));
+  launcher.add_field(0, FID_DATA);
+  int rid = 1;
+  for (ParallelTensor p : bucket.parameters) {
+    assert(p->parallel_is == first->parallel_is);
+    // regions[rid]: region_grad
+    launcher.add_region_requirement(RegionRequirement(p->part_grad,
+                                                      0 /*projection id*/,
+                                                      READ_ONLY,
+                                                      EXCLUSIVE,
+                                                      p->region_grad,
+                                                      p->region_tag));
+    launcher.add_field(rid++, FID_DATA);
+    // regions[rid]: region
+    launcher.add_region_requirement(RegionRequirement(p->part,
+                                                      0 /*projection id*/,
+                                                      READ_WRITE,
+                                                      EXCLUSIVE,
+                                                      p->region,
+                                                      p->region_tag));
+    launcher.add_field(rid++, FID_DATA);
+    if (momentum > 0.0f) {
+      // regions[rid]: v_value
+      assert(v_values.find(p->region) != v_values.end());
+      launcher.add_region_requirement(
+          RegionRequirement(v_values[p->region]->part,
+                            0 /*projection id*/,
+                            READ_WRITE,
+                            EXCLUSIVE,
+                            v_values[p->region]->region,
+                            v_values[p->region]->region_tag));
+      launcher.add_field(rid++, FID_DATA);
+    }
+  }
+  // The bucket buffer orders the buckets on each GPU, so unlike update(p) this
+  // does not need an execution fence, and a bucket can start as soon as its
+  // gradients are ready
+  runtime->execute_index_space(ctx, launcher);
+}
+
+void SGDOptimizer::sparse_update(const ParallelTensor p) {
+  std::vector<ParallelTensor> states;
+  if (momentum > 0.0f) {
+    assert(v_values.find(p->region) != v_values.end());
+    states.push_back(v_values[p->region]);
+  }
+  launch_sparse_update(model,
+                       SGD_UPD_SPARSE_TASK_ID,
+                       this,
+                       sizeof(SGDOptimizer),
+                       p,
+                       sparse_gradients.at(p->region),
+                       states);
+}
+
 void SGDOptimizer::ps_update_task(Task const *task,
                                   std::vector<PhysicalRegion> const &regions,
                                   Context ctx,
@@ -312,6 +626,66 @@ void SGDOptimizer::nccl_update_task(Task const *task,
 
   nccl_update_task_gpu(op, meta, w_grad_ptr, size, w_ptr, v_ptr);
 }
+
+void SGDOptimizer::nccl_bucket_update_task(
+    Task const *task,
+    std::vector<PhysicalRegion> const &regions,
+    Context ctx,
+    Runtime *runtime) {
+  SGDOptimizer const *op = (SGDOptimizer *)task->args;
+  OpMeta const *meta = *((OpMeta **)task->local_args);
+  // regions[0] is the bucket buffer, followed by the gradients, the weights and
+  // the momentum (if any) of each parameter
+  int regions_per_param = op->momentum > 0.0f ? 3 : 2;
+  assert(regions.size() == task->regions.size());
+  assert((regions.size() - 1) % regions_per_param == 0);
+  MultiTensorTable table;
+  table.num_tensors = (regions.size() - 1) / regions_per_param;
+  assert(table.num_tensors <= MAX_NUM_BUCKET_PARAMETERS);
+  for (int t = 0; t < table.num_tensors; t++) {
+    int rid = 1 + t * regions_per_param;
+    Domain w_grad_domain = runtime->get_index_space_domain(
+        ctx, task->regions[rid].region.get_index_space());
+    Domain w_domain = runtime->get_index_space_domain(
+        ctx, task->regions[rid + 1].region.get_index_space());
+    assert(w_grad_domain.get_volume() == w_domain.get_volume());
+    table.sizes[t] = w_domain.get_volume();
+    table.w_grad[t] = helperGetTensorPointerRO<float>(
+        regions[rid], task->regions[rid], FID_DATA, ctx, runtime);
+    table.w[t] = helperGetTensorPointerRW<float>(
+        regions[rid + 1], task->regions[rid + 1], FID_DATA, ctx, runtime);
+    table.v[t] = NULL;
+    if (op->momentum > 0.0f) {
+      table.v[t] = helperGetTensorPointerRW<float>(
+          regions[rid + 2], task->regions[rid + 2], FID_DATA, ctx, runtime);
+    }
+    table.m[t] = NULL;
+  }
+  float *buffer = helperGetTensorPointerRW<float>(
+      regions[0], task->regions[0], FID_DATA, ctx, runtime);
+  nccl_bucket_update_task_gpu(op, meta, table, buffer);
+}
+
+void SGDOptimizer::sparse_update_task(
+    Task const *task,
+    std::vector<PhysicalRegion> const &regions,
+    Context ctx,
+    Runtime *runtime) {
+  SGDOptimizer const *op = (SGDOptimizer *)task->args;
+  OpMeta const *meta = *((OpMeta **)task->local_args);
+  assert(regions.size() == task->regions.size());
+  assert(regions.size() == (op->momentum > 0.0f ? 4 : 3));
+  SparseGradientShard grad = get_sparse_gradient_shard(
+      task, sizeof(SGDOptimizer), regions, ctx, runtime);
+  float *w_ptr = helperGetTensorPointerRW<float>(
+      regions[2], task->regions[2], FID_DATA, ctx, runtime);
+  float *v_ptr = NULL;
+  if (op->momentum > 0.0f) {
+    v_ptr = helperGetTensorPointerRW<float>(
+        regions[3], task->regions[3], FID_DATA, ctx, runtime);
+  }
+  sparse_update_task_gpu(op, meta, grad, w_ptr, v_ptr);
+}
 #endif
 
 // ------------------------------------------------------------------
@@ -375,6 +749,10 @@ void AdamOptimizer::next(void) {
 }
 
 void AdamOptimizer::update(const ParallelTensor p) {
+  if (sparse_gradients.find(p->region) != sparse_gradients.end()) {
+    sparse_update(p);
+    return;
+  }
   Context ctx = model->config.lg_ctx;
   Runtime *runtime = model->config.lg_hlr;
   assert(v_values.find(p->region) != v_values.end());
@@ -387,26 +765,35 @@ void AdamOptimizer::update(const ParallelTensor p) {
                           0 /*mapper_id*/,
                           p->machine_view.hash());
     // regions[0]: region_grad
-    launcher.add_region_requirement(RegionRequirement(
-        p->region_grad, READ_ONLY, EXCLUSIVE, p->region_grad));
+    launcher.add_region_requirement(RegionRequirement(p->region_grad,
+                                                      READ_ONLY,
+                                                      EXCLUSIVE,
+                                                      p->region_grad,
+                                                      p->region_tag));
     launcher.add_field(0, FID_DATA);
     // regions[1]: region
     launcher.add_region_requirement(
-        RegionRequirement(p->region, READ_WRITE, EXCLUSIVE, p->region));
+        RegionRequirement(p->region,
+                          READ_WRITE,
+                          EXCLUSIVE,
+                          p->region,
+                          p->region_tag));
     launcher.add_field(1, FID_DATA);
     // regions[2]: w_region
     launcher.add_region_requirement(
         RegionRequirement(v_values[p->region]->region,
                           READ_WRITE,
                           EXCLUSIVE,
-                          v_values[p->region]->region));
+                          v_values[p->region]->region,
+                          v_values[p->region]->region_tag));
     launcher.add_field(2, FID_DATA);
     // regions[3]: m_region
     launcher.add_region_requirement(
         RegionRequirement(m_values[p->region]->region,
                           READ_WRITE,
                           EXCLUSIVE,
-                          m_values[p->region]->region));
+                          m_values[p->region]->region,
+                          m_values[p->region]->region_tag));
     launcher.add_field(3, FID_DATA);
     runtime->execute_task(ctx, launcher);
     // Parameter prefetching optimizations to reduce comm. overhead
@@ -421,8 +808,12 @@ void AdamOptimizer::update(const ParallelTensor p) {
                                  0 /*mapper_id*/,
                                  p->machine_view.hash());
     // regions[0]: region
-    index_launcher.add_region_requirement(RegionRequirement(
-        p->part, 0 /*projection*/, READ_ONLY, EXCLUSIVE, p->region));
+    index_launcher.add_region_requirement(RegionRequirement(p->part,
+                                                            0 /*projection*/,
+                                                            READ_ONLY,
+                                                            EXCLUSIVE,
+                                                            p->region,
+                                                            p->region_tag));
     index_launcher.add_field(0, FID_DATA);
     runtime->execute_index_space(ctx, index_launcher);
   } else if (p->sync_type == ParameterSyncType::NCCL) {
@@ -458,11 +849,16 @@ void AdamOptimizer::update(const ParallelTensor p) {
                                                       0 /*projection id*/,
                                                       READ_ONLY,
                                                       EXCLUSIVE,
-                                                      p->region_grad));
+                                                      p->region_grad,
+                                                      p->region_tag));
     launcher.add_field(0, FID_DATA);
     // regions[1]: region
-    launcher.add_region_requirement(RegionRequirement(
-        p->part, 0 /*projection id*/, READ_WRITE, EXCLUSIVE, p->region));
+    launcher.add_region_requirement(RegionRequirement(p->part,
+                                                      0 /*projection id*/,
+                                                      READ_WRITE,
+                                                      EXCLUSIVE,
+                                                      p->region,
+                                                      p->region_tag));
     launcher.add_field(1, FID_DATA);
     // regions[2]: w_region
     launcher.add_region_requirement(
@@ -470,7 +866,8 @@ void AdamOptimizer::update(const ParallelTensor p) {
                           0 /*projection id*/,
                           READ_WRITE,
                           EXCLUSIVE,
-                          v_values[p->region]->region));
+                          v_values[p->region]->region,
+                          v_values[p->region]->region_tag));
     launcher.add_field(2, FID_DATA);
     // regions[3]: m_region
     launcher.add_region_requirement(
@@ -478,7 +875,8 @@ void AdamOptimizer::update(const ParallelTensor p) {
                           0 /*projection id*/,
                           READ_WRITE,
                           EXCLUSIVE,
-                          m_values[p->region]->region));
+                          m_values[p->region]->region,
+                          m_values[p->region]->region_tag));
     launcher.add_field(3, FID_DATA);
     // MustEpochLauncher must_epoch_launcher;
     // must_epoch_launcher.add_index_task(launcher);
@@ -490,6 +888,85 @@ void AdamOptimizer::update(const ParallelTensor p) {
   }
 }
 
+void AdamOptimizer::update(GradientBucket const &bucket) {
+  Context ctx = model->config.lg_ctx;
+  Runtime *runtime = model->config.lg_hlr;
+  assert(!bucket.parameters.empty());
+  assert(bucket.parameters.size() <= MAX_NUM_BUCKET_PARAMETERS);
+  ParallelTensor first = bucket.parameters[0];
+  ArgumentMap argmap;
+  set_nccl_update_argumentmap(model, first, argmap);
+  IndexLauncher launcher(ADAM_UPD_NCCL_BUCKET_TASK_ID,
+                         first->parallel_is,
+                         TaskArgument(this, sizeof(AdamOptimizer)),
+                         argmap,
+                         Predicate::TRUE_PRED,
+                         false /*must_epoch*/,
+                         0 /*mapper_id*/,
+                         first->machine_view.hash());
+  // regions[0]: bucket buffer
+  launcher.add_region_requirement(RegionRequirement(bucket.buffer_part,
+                                                    0 /*projection id*/,
+                                                    READ_WRITE,
+                                                    EXCLUSIVE,
+                                                    bucket_buffers));
+  launcher.add_field(0, FID_DATA);
+  int rid = 1;
+  for (ParallelTensor p : bucket.parameters) {
+    assert(p->parallel_is == first->parallel_is);
+    assert(v_values.find(p->region) != v_values.end());
+    assert(m_values.find(p->region) != m_values.end());
+    // regions[rid]: region_grad
+    launcher.add_region_requirement(RegionRequirement(p->part_grad,
+                                                      0 /*projection id*/,
+                                                      READ_ONLY,
+                                                      EXCLUSIVE,
+                                                      p->region_grad,
+                                                      p->region_tag));
+    launcher.add_field(rid++, FID_DATA);
+    // regions[rid]: region
+    launcher.add_region_requirement(RegionRequirement(p->part,
+                                                      0 /*projection id*/,
+                                                      READ_WRITE,
+                                                      EXCLUSIVE,
+                                                      p->region,
+                                                      p->region_tag));
+    launcher.add_field(rid++, FID_DATA);
+    // regions[rid]: v_region
+    launcher.add_region_requirement(
+        RegionRequirement(v_values[p->region]->part,
+                          0 /*projection id*/,
+                          READ_WRITE,
+                          EXCLUSIVE,
+                          v_values[p->region]->region,
+                          v_values[p->region]->region_tag));
+    launcher.add_field(rid++, FID_DATA);
+    // regions[rid]: m_region
+    launcher.add_region_requirement(
+        RegionRequirement(m_values[p->region]->part,
+                          0 /*projection id*/,
+                          READ_WRITE,
+                          EXCLUSIVE,
+                          m_values[p->region]->region,
+                          m_values[p->region]->region_tag));
+    launcher.add_field(rid++, FID_DATA);
+  }
+  // No execution fence, see SGDOptimizer::update(GradientBucket const &)
+  runtime->execute_index_space(ctx, launcher);
+}
+
+void AdamOptimizer::sparse_update(const ParallelTensor p) {
+  assert(v_values.find(p->region) != v_values.end());
+  assert(m_values.find(p->region) != m_values.end());
+  launch_sparse_update(model,
+                       ADAM_UPD_SPARSE_TASK_ID,
+                       this,
+                       sizeof(AdamOptimizer),
+                       p,
+                       sparse_gradients.at(p->region),
+                       {v_values[p->region], m_values[p->region]});
+}
+
 void AdamOptimizer::ps_update_task(Task const *task,
                                    std::vector<PhysicalRegion> const &regions,
                                    Context ctx,
@@ -603,6 +1080,364 @@ void AdamOptimizer::nccl_update_task(Task const *task,
 
   nccl_update_task_gpu(op, meta, w_grad_ptr, size, w_ptr, v_ptr, m_ptr);
 }
+
+void AdamOptimizer::nccl_bucket_update_task(
+    Task const *task,
+    std::vector<PhysicalRegion> const &regions,
+    Context ctx,
+    Runtime *runtime) {
+  AdamOptimizer const *op = (AdamOptimizer *)task->args;
+  OpMeta const *meta = *((OpMeta **)task->local_args);
+  // regions[0] is the bucket buffer, followed by the gradients, the weights, v
+  // and m of each parameter
+  assert(regions.size() == task->regions.size());
+  assert((regions.size() - 1) % 4 == 0);
+  MultiTensorTable table;
+  table.num_tensors = (regions.size() - 1) / 4;
+  assert(table.num_tensors <= MAX_NUM_BUCKET_PARAMETERS);
+  for (int t = 0; t < table.num_tensors; t++) {
+    int rid = 1 + t * 4;
+    Domain w_grad_domain = runtime->get_index_space_domain(
+        ctx, task->regions[rid].region.get_index_space());
+    Domain w_domain = runtime->get_index_space_domain(
+        ctx, task->regions[rid + 1].region.get_index_space());
+    assert(w_grad_domain.get_volume() == w_domain.get_volume());
+    table.sizes[t] = w_domain.get_volume();
+    table.w_grad[t] = helperGetTensorPointerRO<float>(
+        regions[rid], task->regions[rid], FID_DATA, ctx, runtime);
+    table.w[t] = helperGetTensorPointerRW<float>(
+        regions[rid + 1], task->regions[rid + 1], FID_DATA, ctx, runtime);
+    table.v[t] = helperGetTensorPointerRW<float>(
+        regions[rid + 2], task->regions[rid + 2], FID_DATA, ctx, runtime);
+    table.m[t] = helperGetTensorPointerRW<float>(
+        regions[rid + 3], task->regions[rid + 3], FID_DATA, ctx, runtime);
+  }
+  float *buffer = helperGetTensorPointerRW<float>(
+      regions[0], task->regions[0], FID_DATA, ctx, runtime);
+  nccl_bucket_update_task_gpu(op, meta, table, buffer);
+}
+
+void AdamOptimizer::sparse_update_task(
+    Task const *task,
+    std::vector<PhysicalRegion> const &regions,
+    Context ctx,
+    Runtime *runtime) {
+  assert(regions.size() == 5);
+  assert(task->regions.size() == 5);
+  AdamOptimizer const *op = (AdamOptimizer *)task->args;
+  OpMeta const *meta = *((OpMeta **)task->local_args);
+  SparseGradientShard grad = get_sparse_gradient_shard(
+      task, sizeof(AdamOptimizer), regions, ctx, runtime);
+  float *w_ptr = helperGetTensorPointerRW<float>(
+      regions[2], task->regions[2], FID_DATA, ctx, runtime);
+  float *v_ptr = helperGetTensorPointerRW<float>(
+      regions[3], task->regions[3], FID_DATA, ctx, runtime);
+  float *m_ptr = helperGetTensorPointerRW<float>(
+      regions[4], task->regions[4], FID_DATA, ctx, runtime);
+  sparse_update_task_gpu(op, meta, grad, w_ptr, v_ptr, m_ptr);
+}
+#endif
+
+// ------------------------------------------------------------------
+//                        Adagrad Optimizer
+// ------------------------------------------------------------------
+
+AdagradOptimizer::AdagradOptimizer(FFModel const *_model,
+                                   double _lr,
+                                   double _weight_decay,
+                                   double _epsilon)
+    : Optimizer(_model), lr(_lr), weight_decay(_weight_decay),
+      epsilon(_epsilon) {}
+
+void AdagradOptimizer::init(void) {
+  Initializer *initializer = new ZeroInitializer();
+  for (size_t i = 0; i < model->parameters.size(); i++) {
+    ParallelTensor p = model->parameters[i];
+    v_values[p->region] = create_replica_parameter(model, p);
+    initializer->init(model, v_values[p->region]);
+  }
+  delete initializer;
+}
+
+void AdagradOptimizer::set_weight_decay(double _weight_decay) {
+  weight_decay = _weight_decay;
+}
+
+void AdagradOptimizer::next(void) {}
+
+void AdagradOptimizer::update(const ParallelTensor p) {
+  if (sparse_gradients.find(p->region) != sparse_gradients.end()) {
+    sparse_update(p);
+    return;
+  }
+  Context ctx = model->config.lg_ctx;
+  Runtime *runtime = model->config.lg_hlr;
+  assert(v_values.find(p->region) != v_values.end());
+  assert(p->owner_op != NULL);
+  if (p->sync_type == ParameterSyncType::PS) {
+    TaskLauncher launcher(ADAGRAD_UPD_PS_TASK_ID,
+                          TaskArgument(this, sizeof(AdagradOptimizer)),
+                          Predicate::TRUE_PRED,
+                          0 /*mapper_id*/,
+                          p->machine_view.hash());
+    // regions[0]: region_grad
+    launcher.add_region_requirement(RegionRequirement(p->region_grad,
+                                                      READ_ONLY,
+                                                      EXCLUSIVE,
+                                                      p->region_grad,
+                                                      p->region_tag));
+    launcher.add_field(0, FID_DATA);
+    // regions[1]: region
+    launcher.add_region_requirement(
+        RegionRequirement(p->region,
+                          READ_WRITE,
+                          EXCLUSIVE,
+                          p->region,
+                          p->region_tag));
+    launcher.add_field(1, FID_DATA);
+    // regions[2]: v_region
+    launcher.add_region_requirement(
+        RegionRequirement(v_values[p->region]->region,
+                          READ_WRITE,
+                          EXCLUSIVE,
+                          v_values[p->region]->region,
+                          v_values[p->region]->region_tag));
+    launcher.add_field(2, FID_DATA);
+    runtime->execute_task(ctx, launcher);
+    // Send the parameters back to all worker devices, see
+    // SGDOptimizer::update(p)
+    ArgumentMap argmap;
+    IndexLauncher index_launcher(PS_PREFETCH_TASK_ID,
+                                 p->parallel_is,
+                                 TaskArgument(NULL, 0),
+                                 argmap,
+                                 Predicate::TRUE_PRED,
+                                 false /*must*/,
+                                 0 /*mapper_id*/,
+                                 p->machine_view.hash());
+    // regions[0]: region
+    index_launcher.add_region_requirement(RegionRequirement(p->part,
+                                                            0 /*projection*/,
+                                                            READ_ONLY,
+                                                            EXCLUSIVE,
+                                                            p->region,
+                                                            p->region_tag));
+    index_launcher.add_field(0, FID_DATA);
+    runtime->execute_index_space(ctx, index_launcher);
+  } else if (p->sync_type == ParameterSyncType::NCCL) {
+    assert(p->owner_op->op_type != OP_FUSED);
+    assert(p->parallel_is != IndexSpace::NO_SPACE);
+    ArgumentMap argmap;
+    set_nccl_update_argumentmap(model, p, argmap);
+    IndexLauncher launcher(ADAGRAD_UPD_NCCL_TASK_ID,
+                           p->parallel_is,
+                           TaskArgument(this, sizeof(AdagradOptimizer)),
+                           argmap,
+                           Predicate::TRUE_PRED,
+                           false /*must_epoch*/,
+                           0 /*mapper_id*/,
+                           p->machine_view.hash());
+    // regions[0]: region_grad
+    launcher.add_region_requirement(RegionRequirement(p->part_grad,
+                                                      0 /*projection id*/,
+                                                      READ_ONLY,
+                                                      EXCLUSIVE,
+                                                      p->region_grad,
+                                                      p->region_tag));
+    launcher.add_field(0, FID_DATA);
+    // regions[1]: region
+    launcher.add_region_requirement(RegionRequirement(p->part,
+                                                      0 /*projection id*/,
+                                                      READ_WRITE,
+                                                      EXCLUSIVE,
+                                                      p->region,
+                                                      p->region_tag));
+    launcher.add_field(1, FID_DATA);
+    // regions[2]: v_region
+    launcher.add_region_requirement(
+        RegionRequirement(v_values[p->region]->part,
+                          0 /*projection id*/,
+                          READ_WRITE,
+                          EXCLUSIVE,
+                          v_values[p->region]->region,
+                          v_values[p->region]->region_tag));
+    launcher.add_field(2, FID_DATA);
+    runtime->execute_index_space(ctx, launcher);
+    runtime->issue_execution_fence(ctx);
+  } else {
+    assert(false);
+  }
+}
+
+void AdagradOptimizer::update(GradientBucket const &bucket) {
+  Context ctx = model->config.lg_ctx;
+  Runtime *runtime = model->config.lg_hlr;
+  assert(!bucket.parameters.empty());
+  assert(bucket.parameters.size() <= MAX_NUM_BUCKET_PARAMETERS);
+  ParallelTensor first = bucket.parameters[0];
+  ArgumentMap argmap;
+  set_nccl_update_argumentmap(model, first, argmap);
+  IndexLauncher launcher(ADAGRAD_UPD_NCCL_BUCKET_TASK_ID,
+                         first->parallel_is,
+                         TaskArgument(this, sizeof(AdagradOptimizer)),
+                         argmap,
+                         Predicate::TRUE_PRED,
+                         false /*must_epoch*/,
+                         0 /*mapper_id*/,
+                         first->machine_view.hash());
+  // regions[0]: bucket buffer
+  launcher.add_region_requirement(RegionRequirement(bucket.buffer_part,
+                                                    0 /*projection id*/,
+                                                    READ_WRITE,
+                                                    EXCLUSIVE,
+                                                    bucket_buffers));
+  launcher.add_field(0, FID_DATA);
+  int rid = 1;
+  for (ParallelTensor p : bucket.parameters) {
+    assert(p->parallel_is == first->parallel_is);
+    assert(v_values.find(p->region) != v_values.end());
+    // regions[rid]: region_grad
+    launcher.add_region_requirement(RegionRequirement(p->part_grad,
+                                                      0 /*projection id*/,
+                                                      READ_ONLY,
+                                                      EXCLUSIVE,
+                                                      p->region_grad,
+                                                      p->region_tag));
+    launcher.add_field(rid++, FID_DATA);
+    // regions[rid]: region
+    launcher.add_region_requirement(RegionRequirement(p->part,
+                                                      0 /*projection id*/,
+                                                      READ_WRITE,
+                                                      EXCLUSIVE,
+                                                      p->region,
+                                                      p->region_tag));
+    launcher.add_field(rid++, FID_DATA);
+    // regions[rid]: v_region
+    launcher.add_region_requirement(
+        RegionRequirement(v_values[p->region]->part,
+                          0 /*projection id*/,
+                          READ_WRITE,
+                          EXCLUSIVE,
+                          v_values[p->region]->region,
+                          v_values[p->region]->region_tag));
+    launcher.add_field(rid++, FID_DATA);
+  }
+  // No execution fence, see SGDOptimizer::update(GradientBucket const &)
+  runtime->execute_index_space(ctx, launcher);
+}
+
+void AdagradOptimizer::sparse_update(const ParallelTensor p) {
+  assert(v_values.find(p->region) != v_values.end());
+  launch_sparse_update(model,
+                       ADAGRAD_UPD_SPARSE_TASK_ID,
+                       this,
+                       sizeof(AdagradOptimizer),
+                       p,
+                       sparse_gradients.at(p->region),
+                       {v_values[p->region]});
+}
+
+void AdagradOptimizer::ps_update_task(
+    Task const *task,
+    std::vector<PhysicalRegion> const &regions,
+    Context ctx,
+    Runtime *runtime) {
+  assert(regions.size() == 3);
+  assert(task->regions.size() == 3);
+  AdagradOptimizer const *op = (AdagradOptimizer *)task->args;
+  Domain w_grad_domain = runtime->get_index_space_domain(
+      ctx, task->regions[0].region.get_index_space());
+  Domain w_domain = runtime->get_index_space_domain(
+      ctx, task->regions[1].region.get_index_space());
+  size_t size = w_domain.get_volume();
+  assert(w_grad_domain.get_volume() % size == 0);
+  int num_replicas = w_grad_domain.get_volume() / size;
+  float const *w_grad_ptr = helperGetTensorPointerRO<float>(
+      regions[0], task->regions[0], FID_DATA, ctx, runtime);
+  float *w_ptr = helperGetTensorPointerRW<float>(
+      regions[1], task->regions[1], FID_DATA, ctx, runtime);
+  float *v_ptr = helperGetTensorPointerRW<float>(
+      regions[2], task->regions[2], FID_DATA, ctx, runtime);
+  ps_update_task_gpu(op, w_grad_ptr, size, num_replicas, w_ptr, v_ptr);
+}
+
+#ifdef FF_USE_NCCL
+void AdagradOptimizer::nccl_update_task(
+    Task const *task,
+    std::vector<PhysicalRegion> const &regions,
+    Context ctx,
+    Runtime *runtime) {
+  assert(regions.size() == 3);
+  assert(task->regions.size() == 3);
+  AdagradOptimizer const *op = (AdagradOptimizer *)task->args;
+  OpMeta const *meta = *((OpMeta **)task->local_args);
+  Domain w_grad_domain = runtime->get_index_space_domain(
+      ctx, task->regions[0].region.get_index_space());
+  Domain w_domain = runtime->get_index_space_domain(
+      ctx, task->regions[1].region.get_index_space());
+  assert(w_grad_domain == w_domain);
+  float const *w_grad_ptr = helperGetTensorPointerRO<float>(
+      regions[0], task->regions[0], FID_DATA, ctx, runtime);
+  float *w_ptr = helperGetTensorPointerRW<float>(
+      regions[1], task->regions[1], FID_DATA, ctx, runtime);
+  float *v_ptr = helperGetTensorPointerRW<float>(
+      regions[2], task->regions[2], FID_DATA, ctx, runtime);
+  nccl_update_task_gpu(
+      op, meta, w_grad_ptr, w_domain.get_volume(), w_ptr, v_ptr);
+}
+
+void AdagradOptimizer::nccl_bucket_update_task(
+    Task const *task,
+    std::vector<PhysicalRegion> const &regions,
+    Context ctx,
+    Runtime *runtime) {
+  AdagradOptimizer const *op = (AdagradOptimizer *)task->args;
+  OpMeta const *meta = *((OpMeta **)task->local_args);
+  // regions[0] is the bucket buffer, followed by the gradients, the weights and
+  // the accumulators of each parameter
+  assert(regions.size() == task->regions.size());
+  assert((regions.size() - 1) % 3 == 0);
+  MultiTensorTable table;
+  table.num_tensors = (regions.size() - 1) / 3;
+  assert(table.num_tensors <= MAX_NUM_BUCKET_PARAMETERS);
+  for (int t = 0; t < table.num_tensors; t++) {
+    int rid = 1 + t * 3;
+    Domain w_grad_domain = runtime->get_index_space_domain(
+        ctx, task->regions[rid].region.get_index_space());
+    Domain w_domain = runtime->get_index_space_domain(
+        ctx, task->regions[rid + 1].region.get_index_space());
+    assert(w_grad_domain.get_volume() == w_domain.get_volume());
+    table.sizes[t] = w_domain.get_volume();
+    table.w_grad[t] = helperGetTensorPointerRO<float>(
+        regions[rid], task->regions[rid], FID_DATA, ctx, runtime);
+    table.w[t] = helperGetTensorPointerRW<float>(
+        regions[rid + 1], task->regions[rid + 1], FID_DATA, ctx, runtime);
+    table.v[t] = helperGetTensorPointerRW<float>(
+        regions[rid + 2], task->regions[rid + 2], FID_DATA, ctx, runtime);
+    table.m[t] = NULL;
+  }
+  float *buffer = helperGetTensorPointerRW<float>(
+      regions[0], task->regions[0], FID_DATA, ctx, runtime);
+  nccl_bucket_update_task_gpu(op, meta, table, buffer);
+}
+
+void AdagradOptimizer::sparse_update_task(
+    Task const *task,
+    std::vector<PhysicalRegion> const &regions,
+    Context ctx,
+    Runtime *runtime) {
+  assert(regions.size() == 4);
+  assert(task->regions.size() == 4);
+  AdagradOptimizer const *op = (AdagradOptimizer *)task->args;
+  OpMeta const *meta = *((OpMeta **)task->local_args);
+  SparseGradientShard grad = get_sparse_gradient_shard(
+      task, sizeof(AdagradOptimizer), regions, ctx, runtime);
+  float *w_ptr = helperGetTensorPointerRW<float>(
+      regions[2], task->regions[2], FID_DATA, ctx, runtime);
+  float *v_ptr = helperGetTensorPointerRW<float>(
+      regions[3], task->regions[3], FID_DATA, ctx, runtime);
+  sparse_update_task_gpu(op, meta, grad, w_ptr, v_ptr);
+}
 #endif
 
 }; // namespace FlexFlow
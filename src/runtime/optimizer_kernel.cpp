@@ -16,13 +16,285 @@
 #include "flexflow/accessor.h"
 #include "flexflow/model.h"
 #include "flexflow/optimizer.h"
+#include "flexflow/sparse_update_helpers.h"
 #include "flexflow/utils/hip_helper.h"
 #include <hip/hip_runtime.h>
+#include <thrust/execution_policy.h>
+#include <thrust/fill.h>
+#include <thrust/iterator/counting_iterator.h>
+#include <thrust/sequence.h>
+#include <thrust/sort.h>
+#include <thrust/unique.h>
 
 namespace FlexFlow {
 
 LegionRuntime::Logger::Category log_optimizer("optimizer");
 
+#ifdef FF_USE_NCCL
+// Each row of blocks copies the gradients of one tensor of the table
+__global__ void pack_multi_tensor(MultiTensorTable table, float *flat) {
+  int t = blockIdx.y;
+  size_t offset = 0;
+  for (int i = 0; i < t; i++) {
+    offset += table.sizes[i];
+  }
+  CUDA_KERNEL_LOOP(i, table.sizes[t]) {
+    flat[offset + i] = table.w_grad[t][i];
+  }
+}
+
+static size_t max_tensor_size(MultiTensorTable const &table) {
+  size_t max_size = 0;
+  for (int t = 0; t < table.num_tensors; t++) {
+    max_size = std::max(max_size, table.sizes[t]);
+  }
+  return max_size;
+}
+
+// Synchronizes the gradients of a bucket with a single allreduce. The
+// gradients of several tensors are first packed into the bucket buffer, and
+// the table then points to their reduced copies.
+static void allreduce_bucket(OpMeta const *meta,
+                             MultiTensorTable &table,
+                             float *buffer,
+                             hipStream_t stream) {
+  if (table.num_tensors == 1) {
+    checkNCCL(ncclAllReduce(table.w_grad[0],
+                            (float *)table.w_grad[0],
+                            table.sizes[0],
+                            ncclFloat,
+                            ncclSum,
+                            meta->handle.ncclComm,
+                            stream));
+    return;
+  }
+  size_t total = 0;
+  for (int t = 0; t < table.num_tensors; t++) {
+    total += table.sizes[t];
+  }
+  float *flat = buffer;
+  dim3 grid(GET_BLOCKS(max_tensor_size(table)), table.num_tensors);
+  hipLaunchKernelGGL(
+      pack_multi_tensor, grid, CUDA_NUM_THREADS, 0, stream, table, flat);
+  checkNCCL(ncclAllReduce(
+      flat, flat, total, ncclFloat, ncclSum, meta->handle.ncclComm, stream));
+  for (int t = 0; t < table.num_tensors; t++) {
+    table.w_grad[t] = flat;
+    flat += table.sizes[t];
+  }
+}
+
+template <typename TI>
+__global__ void ids_to_rows(size_t count, TI const *ids, int64_t *rows) {
+  CUDA_KERNEL_LOOP(i, count) {
+    rows[i] = ids[i];
+  }
+}
+
+// Sums the values of each segment of equal rows. The value of the j-th
+// sorted row is the row perm[j] / divisor of src, multiplied by scale.
+__global__ void sum_segments(size_t num_segments,
+                             size_t count,
+                             int num_channels,
+                             int64_t const *segment_starts,
+                             int64_t const *perm,
+                             int divisor,
+                             float scale,
+                             float const *src,
+                             float *dst) {
+  CUDA_KERNEL_LOOP(i, num_segments * num_channels) {
+    dst[i] = SparseUpdate::segment_sum(i,
+                                       num_segments,
+                                       count,
+                                       num_channels,
+                                       segment_starts,
+                                       perm,
+                                       divisor,
+                                       scale,
+                                       src);
+  }
+}
+
+// Bump allocator over the workspace of a GPU
+struct WorkSpaceAllocator {
+  WorkSpaceAllocator(OpMeta const *meta)
+      : ptr((char *)meta->handle.workSpace),
+        remaining(meta->handle.workSpaceSize) {}
+  template <typename T>
+  T *allocate(size_t count) {
+    size_t bytes = (count * sizeof(T) + 255) / 256 * 256;
+    assert(bytes <= remaining && "workspace too small for sparse gradients");
+    T *ret = (T *)ptr;
+    ptr += bytes;
+    remaining -= bytes;
+    return ret;
+  }
+  char *ptr;
+  size_t remaining;
+};
+
+// Sorts the count rows and sums the values of equal rows into the unique
+// rows and their values, see sum_segments
+static size_t coalesce_rows(WorkSpaceAllocator &allocator,
+                            int64_t *rows,
+                            size_t count,
+                            int num_channels,
+                            int divisor,
+                            float scale,
+                            float const *src,
+                            int64_t *unique_rows,
+                            float *values,
+                            hipStream_t stream) {
+  int64_t *perm = allocator.allocate<int64_t>(count);
+  int64_t *segment_starts = allocator.allocate<int64_t>(count);
+  thrust::sequence(thrust::hip::par.on(stream), perm, perm + count);
+  thrust::sort_by_key(thrust::hip::par.on(stream), rows, rows + count, perm);
+  size_t num_unique =
+      thrust::unique_by_key_copy(thrust::hip::par.on(stream),
+                                 rows,
+                                 rows + count,
+                                 thrust::counting_iterator<int64_t>(0),
+                                 unique_rows,
+                                 segment_starts)
+          .first -
+      unique_rows;
+  hipLaunchKernelGGL(sum_segments,
+                     GET_BLOCKS(num_unique * num_channels),
+                     CUDA_NUM_THREADS,
+                     0,
+                     stream,
+                     num_unique,
+                     count,
+                     num_channels,
+                     segment_starts,
+                     perm,
+                     divisor,
+                     scale,
+                     src,
+                     values);
+  return num_unique;
+}
+
+// Synchronizes a sparse gradient across the GPUs holding replicas of the
+// table. Each GPU coalesces its rows, the unique rows and their values are
+// allgathered, padded with row -1 to the largest count, and coalesced again.
+// The result is ordered by row, starts with the padding if any, and lives in
+// the workspace.
+static size_t allgather_sparse_gradient(OpMeta const *meta,
+                                        SparseGradientShard const &grad,
+                                        int64_t const **rows,
+                                        float const **values,
+                                        hipStream_t stream) {
+  WorkSpaceAllocator allocator(meta);
+  size_t count = grad.num_ids;
+  int num_channels = grad.num_channels;
+  int64_t *local_rows = allocator.allocate<int64_t>(count);
+  if (grad.ids_type == DT_INT32) {
+    hipLaunchKernelGGL(HIP_KERNEL_NAME(ids_to_rows<int32_t>),
+                       GET_BLOCKS(count),
+                       CUDA_NUM_THREADS,
+                       0,
+                       stream,
+                       count,
+                       (int32_t const *)grad.ids,
+                       local_rows);
+  } else {
+    assert(grad.ids_type == DT_INT64);
+    checkCUDA(hipMemcpyAsync(local_rows,
+                             grad.ids,
+                             count * sizeof(int64_t),
+                             hipMemcpyDeviceToDevice,
+                             stream));
+  }
+  int64_t *local_unique = allocator.allocate<int64_t>(count);
+  float *local_values = allocator.allocate<float>(count * num_channels);
+  int64_t num_local = coalesce_rows(allocator,
+                                    local_rows,
+                                    count,
+                                    num_channels,
+                                    grad.bag_size,
+                                    grad.scale,
+                                    grad.grad,
+                                    local_unique,
+                                    local_values,
+                                    stream);
+  // Exchange the number of unique rows of each GPU
+  int num_ranks;
+  checkNCCL(ncclCommCount(meta->handle.ncclComm, &num_ranks));
+  int64_t *counts = allocator.allocate<int64_t>(num_ranks + 1);
+  checkCUDA(hipMemcpyAsync(counts + num_ranks,
+                           &num_local,
+                           sizeof(int64_t),
+                           hipMemcpyHostToDevice,
+                           stream));
+  checkNCCL(ncclAllGather(counts + num_ranks,
+                          counts,
+                          1,
+                          ncclInt64,
+                          meta->handle.ncclComm,
+                          stream));
+  std::vector<int64_t> host_counts(num_ranks);
+  checkCUDA(hipMemcpyAsync(host_counts.data(),
+                           counts,
+                           num_ranks * sizeof(int64_t),
+                           hipMemcpyDeviceToHost,
+                           stream));
+  checkCUDA(hipStreamSynchronize(stream));
+  size_t max_count =
+      *std::max_element(host_counts.begin(), host_counts.end());
+  // Pad the local rows and allgather them with their values. The values of
+  // the padding are never read.
+  int64_t *send_rows = allocator.allocate<int64_t>(max_count);
+  float *send_values = allocator.allocate<float>(max_count * num_channels);
+  checkCUDA(hipMemcpyAsync(send_rows,
+                           local_unique,
+                           num_local * sizeof(int64_t),
+                           hipMemcpyDeviceToDevice,
+                           stream));
+  thrust::fill(thrust::hip::par.on(stream),
+               send_rows + num_local,
+               send_rows + max_count,
+               (int64_t)-1);
+  checkCUDA(hipMemcpyAsync(send_values,
+                           local_values,
+                           num_local * num_channels * sizeof(float),
+                           hipMemcpyDeviceToDevice,
+                           stream));
+  size_t total = max_count * num_ranks;
+  int64_t *all_rows = allocator.allocate<int64_t>(total);
+  float *all_values = allocator.allocate<float>(total * num_channels);
+  checkNCCL(ncclGroupStart());
+  checkNCCL(ncclAllGather(send_rows,
+                          all_rows,
+                          max_count,
+                          ncclInt64,
+                          meta->handle.ncclComm,
+                          stream));
+  checkNCCL(ncclAllGather(send_values,
+                          all_values,
+                          max_count * num_channels,
+                          ncclFloat,
+                          meta->handle.ncclComm,
+                          stream));
+  checkNCCL(ncclGroupEnd());
+  int64_t *unique_rows = allocator.allocate<int64_t>(total);
+  float *unique_values = allocator.allocate<float>(total * num_channels);
+  size_t num_rows = coalesce_rows(allocator,
+                                  all_rows,
+                                  total,
+                                  num_channels,
+                                  1 /*divisor*/,
+                                  1.0f /*scale*/,
+                                  all_values,
+                                  unique_rows,
+                                  unique_values,
+                                  stream);
+  *rows = unique_rows;
+  *values = unique_values;
+  return num_rows;
+}
+#endif
+
 __global__ void sgd_update(size_t count,
                            float lr,
                            float weight_decay,
@@ -46,6 +318,30 @@ __global__ void sgd_update(size_t count,
   }
 }
 
+// sgd_update over the tensors of a table, one row of blocks per tensor
+__global__ void sgd_update_multi_tensor(MultiTensorTable table,
+                                        float lr,
+                                        float weight_decay,
+                                        float momentum,
+                                        bool nesterov) {
+  int t = blockIdx.y;
+  float const *WGrad = table.w_grad[t];
+  float *V = table.v[t];
+  float *W = table.w[t];
+  CUDA_KERNEL_LOOP(i, table.sizes[t]) {
+    float gt = WGrad[i] + weight_decay * W[i];
+    if (momentum > 0.0f) {
+      V[i] = V[i] * momentum + gt;
+      if (nesterov) {
+        gt = gt + momentum * V[i];
+      } else {
+        gt = V[i];
+      }
+    }
+    W[i] -= lr * gt;
+  }
+}
+
 __host__ void SGDOptimizer::ps_update_task_gpu(SGDOptimizer const *op,
                                                float const *w_grad_ptr,
                                                size_t size,
@@ -120,6 +416,88 @@ __host__ void SGDOptimizer::nccl_update_task_gpu(SGDOptimizer const *op,
                      w_ptr);
   // checkCUDA(hipDeviceSynchronize());
 }
+
+__host__ void
+    SGDOptimizer::nccl_bucket_update_task_gpu(SGDOptimizer const *op,
+                                              OpMeta const *meta,
+                                              MultiTensorTable table,
+                                              float *buffer) {
+  hipStream_t stream;
+  checkCUDA(get_legion_stream(&stream));
+  allreduce_bucket(meta, table, buffer, stream);
+  dim3 grid(GET_BLOCKS(max_tensor_size(table)), table.num_tensors);
+  hipLaunchKernelGGL(sgd_update_multi_tensor,
+                     grid,
+                     CUDA_NUM_THREADS,
+                     0,
+                     stream,
+                     table,
+                     op->lr,
+                     op->weight_decay,
+                     op->momentum,
+                     op->nesterov);
+}
+
+// sgd_update on the rows of a sparse gradient that belong to the local
+// shard [row_lo, row_hi] of the table; the other rows are left untouched
+__global__ void sgd_sparse_update(size_t num_rows,
+                                  int num_channels,
+                                  int64_t const *rows,
+                                  float const *values,
+                                  Legion::coord_t row_lo,
+                                  Legion::coord_t row_hi,
+                                  float lr,
+                                  float weight_decay,
+                                  float momentum,
+                                  bool nesterov,
+                                  float *V,
+                                  float *W) {
+  CUDA_KERNEL_LOOP(i, num_rows * num_channels) {
+    SparseUpdate::sgd_step(i,
+                           num_channels,
+                           rows,
+                           values,
+                           row_lo,
+                           row_hi,
+                           lr,
+                           weight_decay,
+                           momentum,
+                           nesterov,
+                           V,
+                           W);
+  }
+}
+
+__host__ void
+    SGDOptimizer::sparse_update_task_gpu(SGDOptimizer const *op,
+                                         OpMeta const *meta,
+                                         SparseGradientShard const &grad,
+                                         float *w_ptr,
+                                         float *v_ptr) {
+  hipStream_t stream;
+  checkCUDA(get_legion_stream(&stream));
+  int64_t const *rows;
+  float const *values;
+  size_t num_rows =
+      allgather_sparse_gradient(meta, grad, &rows, &values, stream);
+  hipLaunchKernelGGL(sgd_sparse_update,
+                     GET_BLOCKS(num_rows * grad.num_channels),
+                     CUDA_NUM_THREADS,
+                     0,
+                     stream,
+                     num_rows,
+                     grad.num_channels,
+                     rows,
+                     values,
+                     grad.row_lo,
+                     grad.row_hi,
+                     op->lr,
+                     op->weight_decay,
+                     op->momentum,
+                     op->nesterov,
+                     v_ptr,
+                     w_ptr);
+}
 #endif
 
 // ==================================================================
@@ -162,6 +540,28 @@ __global__ void adam_update(int count,
   }
 }
 
+// adam_update over the tensors of a table, one row of blocks per tensor
+__global__ void adam_update_multi_tensor(MultiTensorTable table,
+                                         float alpha_t,
+                                         float beta1,
+                                         float beta2,
+                                         float weight_decay,
+                                         float epsilon) {
+  int t = blockIdx.y;
+  float const *WGrad = table.w_grad[t];
+  float *M = table.m[t];
+  float *V = table.v[t];
+  float *W = table.w[t];
+  CUDA_KERNEL_LOOP(i, table.sizes[t]) {
+    float gt = WGrad[i] + weight_decay * W[i];
+    float mt = beta1 * M[i] + (1 - beta1) * gt;
+    float vt = beta2 * V[i] + (1 - beta2) * gt * gt;
+    M[i] = mt;
+    V[i] = vt;
+    W[i] -= alpha_t * mt / (sqrt(vt) + epsilon);
+  }
+}
+
 __host__ void AdamOptimizer::ps_update_task_gpu(AdamOptimizer const *op,
                                                 float const *w_grad_ptr,
                                                 size_t size,
@@ -243,6 +643,278 @@ __host__ void AdamOptimizer::nccl_update_task_gpu(AdamOptimizer const *op,
                      w_ptr);
   // checkCUDA(hipDeviceSynchronize());
 }
+
+__host__ void
+    AdamOptimizer::nccl_bucket_update_task_gpu(AdamOptimizer const *op,
+                                               OpMeta const *meta,
+                                               MultiTensorTable table,
+                                               float *buffer) {
+  hipStream_t stream;
+  checkCUDA(get_legion_stream(&stream));
+  allreduce_bucket(meta, table, buffer, stream);
+  dim3 grid(GET_BLOCKS(max_tensor_size(table)), table.num_tensors);
+  hipLaunchKernelGGL(HIP_KERNEL_NAME(adam_update_multi_tensor),
+                     grid,
+                     CUDA_NUM_THREADS,
+                     0,
+                     stream,
+                     table,
+                     op->alpha_t,
+                     op->beta1,
+                     op->beta2,
+                     op->weight_decay,
+                     op->epsilon);
+}
+
+// adam_update on the local rows of a sparse gradient, see sgd_sparse_update
+__global__ void adam_sparse_update(size_t num_rows,
+                                   int num_channels,
+                                   int64_t const *rows,
+                                   float const *values,
+                                   Legion::coord_t row_lo,
+                                   Legion::coord_t row_hi,
+                                   float alpha_t,
+                                   float beta1,
+                                   float beta2,
+                                   float weight_decay,
+                                   float epsilon,
+                                   float *M,
+                                   float *V,
+                                   float *W) {
+  CUDA_KERNEL_LOOP(i, num_rows * num_channels) {
+    SparseUpdate::adam_step(i,
+                            num_channels,
+                            rows,
+                            values,
+                            row_lo,
+                            row_hi,
+                            alpha_t,
+                            beta1,
+                            beta2,
+                            weight_decay,
+                            epsilon,
+                            M,
+                            V,
+                            W);
+  }
+}
+
+__host__ void
+    AdamOptimizer::sparse_update_task_gpu(AdamOptimizer const *op,
+                                          OpMeta const *meta,
+                                          SparseGradientShard const &grad,
+                                          float *w_ptr,
+                                          float *v_ptr,
+                                          float *m_ptr) {
+  hipStream_t stream;
+  checkCUDA(get_legion_stream(&stream));
+  int64_t const *rows;
+  float const *values;
+  size_t num_rows =
+      allgather_sparse_gradient(meta, grad, &rows, &values, stream);
+  hipLaunchKernelGGL(adam_sparse_update,
+                     GET_BLOCKS(num_rows * grad.num_channels),
+                     CUDA_NUM_THREADS,
+                     0,
+                     stream,
+                     num_rows,
+                     grad.num_channels,
+                     rows,
+                     values,
+                     grad.row_lo,
+                     grad.row_hi,
+                     op->alpha_t,
+                     op->beta1,
+                     op->beta2,
+                     op->weight_decay,
+                     op->epsilon,
+                     m_ptr,
+                     v_ptr,
+                     w_ptr);
+}
+#endif
+
+// ==================================================================
+//                        Adagrad Optimizer
+// ==================================================================
+__global__ void adagrad_update(size_t count,
+                               float lr,
+                               float weight_decay,
+                               float epsilon,
+                               float const *WGrad,
+                               float *V,
+                               float *W) {
+  // Reference https://pytorch.org/docs/stable/generated/torch.optim.Adagrad
+  CUDA_KERNEL_LOOP(i, count) {
+    float gt = WGrad[i] + weight_decay * W[i];
+    V[i] += gt * gt;
+    W[i] -= lr * gt / (sqrt(V[i]) + epsilon);
+  }
+}
+
+// adagrad_update over the tensors of a table, one row of blocks per tensor
+__global__ void adagrad_update_multi_tensor(MultiTensorTable table,
+                                            float lr,
+                                            float weight_decay,
+                                            float epsilon) {
+  int t = blockIdx.y;
+  float const *WGrad = table.w_grad[t];
+  float *V = table.v[t];
+  float *W = table.w[t];
+  CUDA_KERNEL_LOOP(i, table.sizes[t]) {
+    float gt = WGrad[i] + weight_decay * W[i];
+    V[i] += gt * gt;
+    W[i] -= lr * gt / (sqrt(V[i]) + epsilon);
+  }
+}
+
+__host__ void
+    AdagradOptimizer::ps_update_task_gpu(AdagradOptimizer const *op,
+                                         float const *w_grad_ptr,
+                                         size_t size,
+                                         int num_replicas,
+                                         float *w_ptr,
+                                         float *v_ptr) {
+  hipStream_t stream;
+  checkCUDA(get_legion_stream(&stream));
+  // Step 1: Gather gradients in the first replica
+  for (int i = 1; i < num_replicas; i++) {
+    float const *src = w_grad_ptr + i * size;
+    hipLaunchKernelGGL(add_kernel,
+                       GET_BLOCKS(size),
+                       CUDA_NUM_THREADS,
+                       0,
+                       stream,
+                       size,
+                       1.0f,
+                       src,
+                       (float *)w_grad_ptr);
+  }
+  // Step 2: Adagrad update
+  hipLaunchKernelGGL(adagrad_update,
+                     GET_BLOCKS(size),
+                     CUDA_NUM_THREADS,
+                     0,
+                     stream,
+                     size,
+                     op->lr,
+                     op->weight_decay,
+                     op->epsilon,
+                     w_grad_ptr,
+                     v_ptr,
+                     w_ptr);
+}
+
+#ifdef FF_USE_NCCL
+__host__ void
+    AdagradOptimizer::nccl_update_task_gpu(AdagradOptimizer const *op,
+                                           OpMeta const *meta,
+                                           float const *w_grad_ptr,
+                                           size_t size,
+                                           float *w_ptr,
+                                           float *v_ptr) {
+  // Use NCCL to sync gradients
+  hipStream_t stream;
+  checkCUDA(get_legion_stream(&stream));
+  checkNCCL(ncclAllReduce(w_grad_ptr,
+                          (float *)w_grad_ptr,
+                          size,
+                          ncclFloat,
+                          ncclSum,
+                          meta->handle.ncclComm,
+                          stream));
+  // Step 2: Adagrad update
+  hipLaunchKernelGGL(adagrad_update,
+                     GET_BLOCKS(size),
+                     CUDA_NUM_THREADS,
+                     0,
+                     stream,
+                     size,
+                     op->lr,
+                     op->weight_decay,
+                     op->epsilon,
+                     w_grad_ptr,
+                     v_ptr,
+                     w_ptr);
+}
+
+__host__ void
+    AdagradOptimizer::nccl_bucket_update_task_gpu(AdagradOptimizer const *op,
+                                                  OpMeta const *meta,
+                                                  MultiTensorTable table,
+                                                  float *buffer) {
+  hipStream_t stream;
+  checkCUDA(get_legion_stream(&stream));
+  allreduce_bucket(meta, table, buffer, stream);
+  dim3 grid(GET_BLOCKS(max_tensor_size(table)), table.num_tensors);
+  hipLaunchKernelGGL(adagrad_update_multi_tensor,
+                     grid,
+                     CUDA_NUM_THREADS,
+                     0,
+                     stream,
+                     table,
+                     op->lr,
+                     op->weight_decay,
+                     op->epsilon);
+}
+
+// adagrad_update on the local rows of a sparse gradient, see
+// sgd_sparse_update
+__global__ void adagrad_sparse_update(size_t num_rows,
+                                      int num_channels,
+                                      int64_t const *rows,
+                                      float const *values,
+                                      Legion::coord_t row_lo,
+                                      Legion::coord_t row_hi,
+                                      float lr,
+                                      float weight_decay,
+                                      float epsilon,
+                                      float *V,
+                                      float *W) {
+  CUDA_KERNEL_LOOP(i, num_rows * num_channels) {
+    SparseUpdate::adagrad_step(i,
+                               num_channels,
+                               rows,
+                               values,
+                               row_lo,
+                               row_hi,
+                               lr,
+                               weight_decay,
+                               epsilon,
+                               V,
+                               W);
+  }
+}
+
+__host__ void
+    AdagradOptimizer::sparse_update_task_gpu(AdagradOptimizer const *op,
+                                             OpMeta const *meta,
+                                             SparseGradientShard const &grad,
+                                             float *w_ptr,
+                                             float *v_ptr) {
+  hipStream_t stream;
+  checkCUDA(get_legion_stream(&stream));
+  int64_t const *rows;
+  float const *values;
+  size_t num_rows =
+      allgather_sparse_gradient(meta, grad, &rows, &values, stream);
+  hipLaunchKernelGGL(adagrad_sparse_update,
+                     GET_BLOCKS(num_rows * grad.num_channels),
+                     CUDA_NUM_THREADS,
+                     0,
+                     stream,
+                     num_rows,
+                     grad.num_channels,
+                     rows,
+                     values,
+                     grad.row_lo,
+                     grad.row_hi,
+                     op->lr,
+                     op->weight_decay,
+                     op->epsilon,
+                     v_ptr,
+                     w_ptr);
+}
 #endif
 
-}; // namespace FlexFlow
\ No newline at end of file
+}; // namespace FlexFlow
@@ -1,6 +1,7 @@
 #include "flexflow/parallel_ops/parallel_op.h"
 #include "flexflow/parallel_ops/combine.h"
 #include "flexflow/parallel_ops/partition.h"
+#include "flexflow/parallel_ops/pipeline.h"
 #include "flexflow/parallel_ops/reduction.h"
 #include "flexflow/parallel_ops/replicate.h"
 
@@ -34,7 +35,16 @@ ParallelOpJoinResult try_join_parallel_ops(ParallelOpInfo const &_first,
     return result;
   }
 
-  if (first.op_type == second.op_type) {
+  if (first.op_type == OP_PIPELINE || second.op_type == OP_PIPELINE) {
+    // back-to-back stage boundaries leave an empty stage between them
+    if (first.op_type == second.op_type) {
+      ParallelOpInfo joined(first);
+      joined.parallel_degree =
+          std::max(first.parallel_degree, second.parallel_degree);
+      result.op = joined;
+      result.join_did_succeed = true;
+    }
+  } else if (first.op_type == second.op_type) {
     ParallelOpInfo joined(first);
     joined.parallel_degree *= second.parallel_degree;
     result.op = joined;
@@ -78,6 +88,9 @@ Node FFModel::get_or_create_parallel_op_node(
     case OP_REDUCTION:
       return this->get_or_create_node<Reduction>(
           input, {parallel_dim, parallel_degree});
+    case OP_PIPELINE:
+      return this->get_or_create_node<Pipeline>(
+          input, {parallel_dim, parallel_degree});
     default:
       assert(false && "Unsupported parallel op");
   }
@@ -32,6 +32,7 @@ TensorBase::TensorBase(TensorBase const &rhs) {
   owner_layer = rhs.owner_layer;
   owner_idx = rhs.owner_idx;
   create_gradients = rhs.create_gradients;
+  region_tag = rhs.region_tag;
 }
 
 size_t TensorBase::get_volume() const {
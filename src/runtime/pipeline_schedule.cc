@@ -0,0 +1,161 @@
+#include "flexflow/pipeline_schedule.h"
+#include <algorithm>
+#include <cassert>
+#include <limits>
+
+namespace FlexFlow {
+
+static std::vector<PipelineStep> one_f_one_b_steps(int num_stages,
+                                                   int num_micro_batches,
+                                                   int stage) {
+  std::vector<PipelineStep> steps;
+  int warmup = std::min(num_stages - stage - 1, num_micro_batches);
+  for (int i = 0; i < warmup; i++) {
+    steps.push_back({0, i, true});
+  }
+  for (int i = 0; i < num_micro_batches - warmup; i++) {
+    steps.push_back({0, warmup + i, true});
+    steps.push_back({0, i, false});
+  }
+  for (int i = num_micro_batches - warmup; i < num_micro_batches; i++) {
+    steps.push_back({0, i, false});
+  }
+  return steps;
+}
+
+// The k-th forward (resp. backward) step of a stage processes the micro-batch
+// k % num_stages of the group k / (num_stages * num_chunks) on the chunks in
+// increasing (resp. decreasing) order
+static std::vector<PipelineStep> interleaved_steps(int num_stages,
+                                                   int num_micro_batches,
+                                                   int num_chunks,
+                                                   int stage) {
+  auto step = [&](int k, bool forward) {
+    int chunk = (k / num_stages) % num_chunks;
+    if (!forward) {
+      chunk = num_chunks - 1 - chunk;
+    }
+    int micro_batch =
+        (k / (num_stages * num_chunks)) * num_stages + k % num_stages;
+    return PipelineStep{chunk, micro_batch, forward};
+  };
+  int total = num_micro_batches * num_chunks;
+  int warmup = std::min((num_stages - stage - 1) * 2 +
+                            (num_chunks - 1) * num_stages,
+                        total);
+  std::vector<PipelineStep> steps;
+  for (int k = 0; k < warmup; k++) {
+    steps.push_back(step(k, true));
+  }
+  for (int k = 0; k < total - warmup; k++) {
+    steps.push_back(step(warmup + k, true));
+    steps.push_back(step(k, false));
+  }
+  for (int k = total - warmup; k < total; k++) {
+    steps.push_back(step(k, false));
+  }
+  return steps;
+}
+
+PipelineSchedule get_pipeline_schedule(PipelineScheduleType type,
+                                       int num_stages,
+                                       int num_micro_batches,
+                                       int num_chunks) {
+  assert(num_stages > 0);
+  assert(num_micro_batches > 0);
+  assert(num_chunks > 0);
+  PipelineSchedule schedule;
+  switch (type) {
+    case PIPELINE_1F1B:
+      if (num_chunks != 1) {
+        return {};
+      }
+      for (int s = 0; s < num_stages; s++) {
+        schedule.push_back(one_f_one_b_steps(num_stages, num_micro_batches, s));
+      }
+      break;
+    case PIPELINE_INTERLEAVED_1F1B:
+      if (num_micro_batches % num_stages != 0) {
+        return {};
+      }
+      for (int s = 0; s < num_stages; s++) {
+        schedule.push_back(
+            interleaved_steps(num_stages, num_micro_batches, num_chunks, s));
+      }
+      break;
+    default:
+      assert(false && "unknown pipeline schedule");
+  }
+  return schedule;
+}
+
+float estimate_pipeline_time(PipelineSchedule const &schedule,
+                             std::vector<float> const &forward_times,
+                             std::vector<float> const &backward_times,
+                             float transfer_time) {
+  int num_stages = schedule.size();
+  int num_virtual_stages = forward_times.size();
+  assert(num_stages > 0);
+  assert(backward_times.size() == forward_times.size());
+  assert(num_virtual_stages % num_stages == 0);
+  int num_micro_batches = 0;
+  size_t remaining = 0;
+  for (std::vector<PipelineStep> const &steps : schedule) {
+    for (PipelineStep const &step : steps) {
+      num_micro_batches = std::max(num_micro_batches, step.micro_batch + 1);
+    }
+    remaining += steps.size();
+  }
+  // completion time of each pass, or a negative value if it has not run yet
+  std::vector<std::vector<float>> forward_end(
+      num_virtual_stages, std::vector<float>(num_micro_batches, -1.0f));
+  std::vector<std::vector<float>> backward_end = forward_end;
+  std::vector<size_t> next(num_stages, 0);
+  std::vector<float> stage_end(num_stages, 0.0f);
+  auto arrival = [&](float end, int from, int to) {
+    return from % num_stages == to % num_stages ? end : end + transfer_time;
+  };
+  while (remaining > 0) {
+    bool progress = false;
+    for (int s = 0; s < num_stages; s++) {
+      for (; next[s] < schedule[s].size(); next[s]++) {
+        PipelineStep const &step = schedule[s][next[s]];
+        int v = step.chunk * num_stages + s;
+        assert(v < num_virtual_stages);
+        int m = step.micro_batch;
+        float ready = 0.0f;
+        if (step.forward && v > 0) {
+          if (forward_end[v - 1][m] < 0.0f) {
+            break;
+          }
+          ready = arrival(forward_end[v - 1][m], v - 1, v);
+        } else if (!step.forward && v == num_virtual_stages - 1) {
+          if (forward_end[v][m] < 0.0f) {
+            break;
+          }
+          ready = forward_end[v][m];
+        } else if (!step.forward) {
+          if (backward_end[v + 1][m] < 0.0f) {
+            break;
+          }
+          ready = arrival(backward_end[v + 1][m], v + 1, v);
+        }
+        float start = std::max(stage_end[s], ready);
+        if (step.forward) {
+          stage_end[s] = forward_end[v][m] = start + forward_times[v];
+        } else {
+          stage_end[s] = backward_end[v][m] = start + backward_times[v];
+        }
+        remaining--;
+        progress = true;
+      }
+    }
+    if (!progress) {
+      assert(false && "deadlocked pipeline schedule");
+      return std::numeric_limits<float>::infinity();
+    }
+  }
+  return *std::max_element(stage_end.begin(), stage_end.end());
+}
+
+}; // namespace FlexFlow
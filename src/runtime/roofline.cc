@@ -0,0 +1,68 @@
+/* Copyright 2023 CMU, Facebook, LANL, MIT, NVIDIA, and Stanford (alphabetical)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "flexflow/roofline.h"
+#include <algorithm>
+#include <cassert>
+
+namespace FlexFlow {
+
+float roofline_time(RooflineSpec const &spec, double flops, double bytes) {
+  assert(spec.peak_tflops > 0);
+  assert(spec.memory_bandwidth_gbps > 0);
+  // 1 TFLOP/s = 1e9 FLOP/ms and 1 GB/s = 1e6 B/ms
+  double compute_time = flops / (spec.peak_tflops * 1e9);
+  double memory_time = bytes / (spec.memory_bandwidth_gbps * 1e6);
+  return std::max(compute_time, memory_time) + spec.kernel_launch_overhead;
+}
+
+void roofline_pass_times(RooflineSpec const &spec,
+                         RooflineWork const &work,
+                         bool training,
+                         float &forward_time,
+                         float &backward_time) {
+  forward_time = roofline_time(spec, work.flops, work.bytes) + work.xfer_time;
+  if (!training) {
+    backward_time = 0.0f;
+  } else if (work.has_weights) {
+    backward_time = roofline_time(spec, 2.0 * work.flops, 2.0 * work.bytes) +
+                    work.xfer_time;
+  } else {
+    backward_time =
+        roofline_time(spec, work.flops, work.bytes) + work.xfer_time;
+  }
+}
+
+double linear_flops(double output_volume, double in_channels) {
+  return 2.0 * output_volume * in_channels;
+}
+
+double conv2d_flops(double output_volume,
+                    double in_channels,
+                    int groups,
+                    int kernel_h,
+                    int kernel_w) {
+  double in_channels_per_group = in_channels / std::max(groups, 1);
+  return 2.0 * output_volume * in_channels_per_group * kernel_h * kernel_w;
+}
+
+double experts_flops(double num_local,
+                     double num_rows,
+                     double data_dim,
+                     double out_dim) {
+  return 2.0 * num_local * num_rows * data_dim * out_dim;
+}
+
+}; // namespace FlexFlow
@@ -0,0 +1,155 @@
+#include "flexflow/search_cache.h"
+#include <cassert>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace FlexFlow::PCG {
+
+// Bump this whenever the hashing of graphs or the layout of the cached
+// entries changes, so that stale caches are ignored rather than misread
+static uint32_t const SEARCH_CACHE_MAGIC = 0x43534646; // "FFSC"
+static uint32_t const SEARCH_CACHE_VERSION = 2;
+
+struct SearchCacheHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t context_key;
+  uint64_t payload_size;
+};
+
+SearchCache::SearchCache(std::string const &_directory, size_t _context_key)
+    : directory(_directory), context_key(_context_key) {
+  assert(!directory.empty());
+  if (mkdir(directory.c_str(), 0755) != 0 && errno != EEXIST) {
+    std::cerr << "search cache: cannot create directory " << directory << ": "
+              << strerror(errno) << std::endl;
+  }
+}
+
+std::string SearchCache::costs_path(std::string const &table) const {
+  std::ostringstream oss;
+  oss << directory << "/" << table << "_" << std::hex << context_key
+      << ".costs";
+  return oss.str();
+}
+
+std::string SearchCache::blob_path(size_t key) const {
+  std::ostringstream oss;
+  oss << directory << "/" << std::hex << key << "_" << context_key << ".pcg";
+  return oss.str();
+}
+
+bool SearchCache::write_file(std::string const &path,
+                             std::vector<char> const &payload) const {
+  std::ostringstream tmp;
+  tmp << path << ".tmp." << getpid();
+  std::string const tmp_path = tmp.str();
+  {
+    std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+    if (!out) {
+      std::cerr << "search cache: cannot write " << tmp_path << std::endl;
+      return false;
+    }
+    SearchCacheHeader header;
+    header.magic = SEARCH_CACHE_MAGIC;
+    header.version = SEARCH_CACHE_VERSION;
+    header.context_key = context_key;
+    header.payload_size = payload.size();
+    out.write(reinterpret_cast<char const *>(&header), sizeof(header));
+    out.write(payload.data(), payload.size());
+    if (!out) {
+      std::cerr << "search cache: cannot write " << tmp_path << std::endl;
+      std::remove(tmp_path.c_str());
+      return false;
+    }
+  }
+  if (std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+    std::cerr << "search cache: cannot rename " << tmp_path << " to " << path
+              << ": " << strerror(errno) << std::endl;
+    std::remove(tmp_path.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool SearchCache::read_file(std::string const &path,
+                            std::vector<char> &payload) const {
+  std::ifstream in(path, std::ios::binary);
+  if (!in) {
+    // a missing entry is an ordinary cache miss
+    return false;
+  }
+  SearchCacheHeader header;
+  in.read(reinterpret_cast<char *>(&header), sizeof(header));
+  if (!in || header.magic != SEARCH_CACHE_MAGIC ||
+      header.version != SEARCH_CACHE_VERSION ||
+      header.context_key != context_key) {
+    std::cerr << "search cache: ignoring incompatible entry " << path
+              << std::endl;
+    return false;
+  }
+  payload.resize(header.payload_size);
+  in.read(payload.data(), header.payload_size);
+  if (!in) {
+    std::cerr << "search cache: ignoring truncated entry " << path
+              << std::endl;
+    payload.clear();
+    return false;
+  }
+  return true;
+}
+
+bool SearchCache::load_costs(std::string const &table,
+                             std::unordered_map<size_t, float> &costs) const {
+  std::vector<char> payload;
+  if (!read_file(costs_path(table), payload)) {
+    return false;
+  }
+  size_t const record_size = sizeof(uint64_t) + sizeof(float);
+  if (payload.size() % record_size != 0) {
+    return false;
+  }
+  for (size_t offset = 0; offset < payload.size(); offset += record_size) {
+    uint64_t key;
+    float value;
+    memcpy(&key, payload.data() + offset, sizeof(key));
+    memcpy(&value, payload.data() + offset + sizeof(key), sizeof(value));
+    // entries computed in this process take precedence
+    costs.emplace((size_t)key, value);
+  }
+  return true;
+}
+
+bool SearchCache::save_costs(
+    std::string const &table,
+    std::unordered_map<size_t, float> const &costs) const {
+  size_t const record_size = sizeof(uint64_t) + sizeof(float);
+  std::vector<char> payload(costs.size() * record_size);
+  size_t offset = 0;
+  for (auto const &kv : costs) {
+    uint64_t key = kv.first;
+    memcpy(payload.data() + offset, &key, sizeof(key));
+    memcpy(payload.data() + offset + sizeof(key), &kv.second, sizeof(float));
+    offset += record_size;
+  }
+  return write_file(costs_path(table), payload);
+}
+
+bool SearchCache::load_blob(size_t key, std::vector<char> &data) const {
+  return read_file(blob_path(key), data);
+}
+
+bool SearchCache::save_blob(size_t key,
+                            char const *data,
+                            size_t num_bytes) const {
+  return write_file(blob_path(key), std::vector<char>(data, data + num_bytes));
+}
+
+}; // namespace FlexFlow::PCG
@@ -0,0 +1,342 @@
+#include "flexflow/sharded_dataset.h"
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace FlexFlow {
+
+static bool ends_with(std::string const &s, std::string const &suffix) {
+  return s.size() >= suffix.size() &&
+         s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+[[noreturn]] static void shard_error(std::string const &path,
+                                     std::string const &what) {
+  std::ostringstream oss;
+  oss << "Cannot load dataset shard " << path << ": " << what;
+  throw std::runtime_error(oss.str());
+}
+
+// Parses the value of key in the header dictionary of a .npy file, e.g.
+// "'descr': '<f4', 'fortran_order': False, 'shape': (100, 13), "
+static std::string npy_header_value(std::string const &path,
+                                    std::string const &header,
+                                    std::string const &key) {
+  size_t pos = header.find("'" + key + "'");
+  if (pos == std::string::npos) {
+    shard_error(path, "no " + key + " in the .npy header");
+  }
+  pos = header.find(':', pos);
+  assert(pos != std::string::npos);
+  pos = header.find_first_not_of(' ', pos + 1);
+  size_t end;
+  if (header[pos] == '(') {
+    end = header.find(')', pos) + 1;
+  } else if (header[pos] == '\'') {
+    end = header.find('\'', pos + 1) + 1;
+  } else {
+    end = header.find_first_of(",}", pos);
+  }
+  return header.substr(pos, end - pos);
+}
+
+static DataType npy_data_type(std::string const &path,
+                              std::string const &descr,
+                              size_t &item_bytes) {
+  // descr is quoted, e.g. '<f4'; only little-endian (or byte) types
+  if (descr == "'<f4'") {
+    item_bytes = 4;
+    return DT_FLOAT;
+  } else if (descr == "'<f8'") {
+    item_bytes = 8;
+    return DT_DOUBLE;
+  } else if (descr == "'<f2'") {
+    item_bytes = 2;
+    return DT_HALF;
+  } else if (descr == "'<i4'") {
+    item_bytes = 4;
+    return DT_INT32;
+  } else if (descr == "'<i8'") {
+    item_bytes = 8;
+    return DT_INT64;
+  } else if (descr == "'|b1'") {
+    item_bytes = 1;
+    return DT_BOOLEAN;
+  }
+  shard_error(path, "unsupported .npy data type " + descr);
+}
+
+ShardedDataset::ShardedDataset(std::vector<std::string> const &paths,
+                               size_t raw_sample_bytes) {
+  assert(!paths.empty());
+  shards.resize(paths.size());
+  first_sample.push_back(0);
+  try {
+    for (size_t i = 0; i < paths.size(); i++) {
+      shards[i].path = paths[i];
+      open_shard(shards[i], raw_sample_bytes);
+      first_sample.push_back(first_sample.back() + shards[i].num_samples);
+    }
+  } catch (...) {
+    for (Shard const &shard : shards) {
+      if (shard.base != nullptr) {
+        munmap((void *)shard.base, shard.map_bytes);
+      }
+    }
+    throw;
+  }
+}
+
+ShardedDataset::~ShardedDataset() {
+  for (Shard const &shard : shards) {
+    if (shard.base != nullptr) {
+      munmap((void *)shard.base, shard.map_bytes);
+    }
+  }
+}
+
+void ShardedDataset::open_shard(Shard &shard, size_t raw_sample_bytes) {
+  int fd = open(shard.path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    shard_error(shard.path, strerror(errno));
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    shard_error(shard.path, strerror(errno));
+  }
+  shard.map_bytes = st.st_size;
+  if (shard.map_bytes > 0) {
+    void *base =
+        mmap(nullptr, shard.map_bytes, PROT_READ, MAP_SHARED, fd, 0 /*offset*/);
+    // The mapping stays valid after the descriptor is closed
+    close(fd);
+    if (base == MAP_FAILED) {
+      shard_error(shard.path, strerror(errno));
+    }
+    shard.base = (char const *)base;
+    madvise(base, shard.map_bytes, MADV_SEQUENTIAL);
+  } else {
+    close(fd);
+  }
+
+  size_t sample_size;
+  DataType shard_dtype = DT_NONE;
+  std::vector<size_t> shard_shape;
+  if (ends_with(shard.path, ".npy")) {
+    if (shard.map_bytes < 10 || memcmp(shard.base, "\x93NUMPY", 6) != 0) {
+      shard_error(shard.path, "not a .npy file");
+    }
+    int major = (unsigned char)shard.base[6];
+    size_t header_bytes;
+    if (major == 1) {
+      header_bytes = (unsigned char)shard.base[8] |
+                     ((unsigned char)shard.base[9] << 8);
+      shard.data_offset = 10 + header_bytes;
+    } else {
+      if (shard.map_bytes < 12) {
+        shard_error(shard.path, "truncated .npy header");
+      }
+      header_bytes = 0;
+      for (int i = 3; i >= 0; i--) {
+        header_bytes = (header_bytes << 8) | (unsigned char)shard.base[8 + i];
+      }
+      shard.data_offset = 12 + header_bytes;
+    }
+    if (shard.data_offset > shard.map_bytes) {
+      shard_error(shard.path, "truncated .npy header");
+    }
+    std::string header(shard.base + shard.data_offset - header_bytes,
+                       header_bytes);
+    if (npy_header_value(shard.path, header, "fortran_order") != "False") {
+      shard_error(shard.path, "only C-order arrays are supported");
+    }
+    size_t item_bytes;
+    shard_dtype = npy_data_type(
+        shard.path, npy_header_value(shard.path, header, "descr"), item_bytes);
+    std::string dims = npy_header_value(shard.path, header, "shape");
+    std::vector<size_t> array_shape;
+    for (size_t pos = 1; pos < dims.size();) {
+      size_t end = dims.find_first_of(",)", pos);
+      std::string dim = dims.substr(pos, end - pos);
+      if (dim.find_first_not_of(' ') != std::string::npos) {
+        array_shape.push_back(std::stoull(dim));
+      }
+      pos = end + 1;
+    }
+    if (array_shape.empty()) {
+      shard_error(shard.path, "the array has no sample dimension");
+    }
+    shard.num_samples = array_shape[0];
+    shard_shape.assign(array_shape.begin() + 1, array_shape.end());
+    sample_size = item_bytes;
+    for (size_t dim : shard_shape) {
+      sample_size *= dim;
+    }
+  } else {
+    if (raw_sample_bytes == 0) {
+      shard_error(shard.path, "the sample size of raw shards is not given");
+    }
+    sample_size = raw_sample_bytes;
+    shard.data_offset = 0;
+    shard.num_samples = shard.map_bytes / sample_size;
+    shard_shape = {sample_size};
+  }
+  if (shard.data_offset + shard.num_samples * sample_size > shard.map_bytes) {
+    shard_error(shard.path, "the file is truncated");
+  }
+  if (first_sample.size() == 1) {
+    bytes_per_sample = sample_size;
+    dtype = shard_dtype;
+    shape = shard_shape;
+  } else if (sample_size != bytes_per_sample || shard_dtype != dtype ||
+             shard_shape != shape) {
+    shard_error(shard.path, "its samples differ from those of " +
+                                shards[0].path);
+  }
+}
+
+std::vector<std::string> ShardedDataset::list_shards(std::string const &path) {
+  std::vector<std::string> paths;
+  struct stat st;
+  if (stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode)) {
+    DIR *dir = opendir(path.c_str());
+    if (dir == nullptr) {
+      shard_error(path, strerror(errno));
+    }
+    while (struct dirent *entry = readdir(dir)) {
+      std::string name = entry->d_name;
+      if (ends_with(name, ".npy") || ends_with(name, ".bin")) {
+        paths.push_back(path + "/" + name);
+      }
+    }
+    closedir(dir);
+    std::sort(paths.begin(), paths.end());
+  } else if (ends_with(path, ".txt")) {
+    std::ifstream in(path);
+    if (!in) {
+      shard_error(path, "cannot read the list of shards");
+    }
+    std::string line;
+    while (std::getline(in, line)) {
+      if (!line.empty()) {
+        paths.push_back(line);
+      }
+    }
+  } else {
+    paths.push_back(path);
+  }
+  if (paths.empty()) {
+    shard_error(path, "no shards found");
+  }
+  return paths;
+}
+
+size_t ShardedDataset::num_samples() const {
+  return first_sample.back();
+}
+
+size_t ShardedDataset::sample_bytes() const {
+  return bytes_per_sample;
+}
+
+DataType ShardedDataset::data_type() const {
+  return dtype;
+}
+
+std::vector<size_t> const &ShardedDataset::sample_shape() const {
+  return shape;
+}
+
+std::pair<ShardedDataset::Shard const *, size_t>
+    ShardedDataset::locate(size_t idx) const {
+  assert(idx < num_samples());
+  size_t i = std::upper_bound(first_sample.begin(), first_sample.end(), idx) -
+             first_sample.begin() - 1;
+  return std::make_pair(&shards[i], idx - first_sample[i]);
+}
+
+void const *ShardedDataset::sample(size_t idx) const {
+  auto const &it = locate(idx);
+  return it.first->base + it.first->data_offset + it.second * bytes_per_sample;
+}
+
+void ShardedDataset::gather(size_t const *idxs, size_t num, void *dst) const {
+  char *out = (char *)dst;
+  for (size_t i = 0; i < num; i++) {
+    memcpy(out + i * bytes_per_sample, sample(idxs[i]), bytes_per_sample);
+  }
+}
+
+void ShardedDataset::will_need(size_t const *idxs, size_t num) const {
+  static size_t const page_bytes = sysconf(_SC_PAGESIZE);
+  for (size_t i = 0; i < num; i++) {
+    uintptr_t addr = (uintptr_t)sample(idxs[i]);
+    uintptr_t page = addr & ~(uintptr_t)(page_bytes - 1);
+    madvise((void *)page, addr + bytes_per_sample - page, MADV_WILLNEED);
+  }
+}
+
+std::pair<size_t, size_t>
+    partition_samples(size_t num_samples, int part, int num_parts) {
+  assert(num_parts > 0 && part >= 0 && part < num_parts);
+  return std::make_pair(num_samples * part / num_parts,
+                        num_samples * (part + 1) / num_parts);
+}
+
+ShuffleBufferSampler::ShuffleBufferSampler(size_t _begin,
+                                           size_t _end,
+                                           size_t _buffer_size,
+                                           uint64_t _seed)
+    : begin(_begin), end(_end), buffer_size(std::max<size_t>(_buffer_size, 1)),
+      seed(_seed) {
+  assert(begin <= end);
+  reset(0 /*epoch*/);
+}
+
+// splitmix64
+uint64_t ShuffleBufferSampler::next_random() {
+  uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+void ShuffleBufferSampler::reset(int epoch) {
+  state = seed ^ ((uint64_t)epoch * 0xd1b54a32d192ed03ULL);
+  next_sample = begin;
+  buffer.clear();
+  while (buffer.size() < buffer_size && next_sample < end) {
+    buffer.push_back(next_sample++);
+  }
+}
+
+size_t ShuffleBufferSampler::next_batch(size_t *idxs, size_t batch_size) {
+  size_t num = 0;
+  while (num < batch_size && !buffer.empty()) {
+    size_t slot = next_random() % buffer.size();
+    idxs[num++] = buffer[slot];
+    if (next_sample < end) {
+      buffer[slot] = next_sample++;
+    } else {
+      buffer[slot] = buffer.back();
+      buffer.pop_back();
+    }
+  }
+  return num;
+}
+
+size_t ShuffleBufferSampler::remaining() const {
+  return buffer.size() + (end - next_sample);
+}
+
+}; // namespace FlexFlow
@@ -17,6 +17,7 @@
 #include "flexflow/model.h"
 #include "flexflow/parallel_ops/combine.h"
 #include "flexflow/parallel_ops/partition.h"
+#include "flexflow/parallel_ops/pipeline.h"
 #include "flexflow/parallel_ops/reduction.h"
 #include "flexflow/parallel_ops/replicate.h"
 #include "flexflow/utils/dot/dot_file.h"
@@ -529,6 +530,116 @@ ParallelConfig Op::view_to_pc(MachineView const &view) const {
   return config;
 }
 
+Simulator::Simulator(FFModel const *model, MachineModel *_machine)
+    : machine(_machine), memory(Memory::NO_MEMORY), base_ptr(NULL),
+      capacity(0), offset(0), warmup_times(0), repeat_times(0),
+      computationMode(model->config.computationMode), device_fingerprint(0),
+      conv2d_meta(NULL), linear_meta(NULL), pool2d_meta(NULL),
+      ele_unary_meta(NULL), ele_binary_meta(NULL), batch_matmul_meta(NULL),
+      concat_meta(NULL), transpose_meta(NULL) {
+  if (!model->config.analytical_cost_model) {
+    fprintf(stderr,
+            "A simulator without a GPU requires --analytical-cost-model.\n");
+    assert(false);
+  }
+  segment_size = model->config.simulator_segment_size;
+  max_num_segments = model->config.simulator_max_num_segments;
+  allreduce_algorithm = model->config.allreduce_algorithm;
+  size_t max_num_tasks = 1024 * 1024;
+  task_manager = new TaskManager(max_num_tasks);
+  create_cost_model(model->config);
+}
+
+void Simulator::open_cost_database(FFConfig const &config) {
+  if (config.cost_db_path.empty() || !cost_model->is_device_dependent()) {
+    return;
+  }
+  cost_db = std::unique_ptr<CostDatabase>(
+      new CostDatabase(config.cost_db_path, config.cost_db_import_only));
+  log_sim.print("Loaded %zu operator costs from %s",
+                cost_db->size(),
+                config.cost_db_path.c_str());
+}
+
+/**
+ * @brief Key of the costs of op under mv in the cost database.
+ *
+ * @details Unlike the keys of the in-memory caches, it does not depend on the
+ * guid of the layer op was created from nor on the first device of mv, so
+ * that the costs are shared by all the operators that compute the same thing
+ * on the same kind of device, in this model or in any other.
+ */
+size_t Simulator::get_cost_database_key(Op const *op,
+                                        OperatorParameters const &params,
+                                        MachineView const &mv) const {
+  size_t key = 0;
+  hash_combine(key, op->op_type);
+  hash_combine(key, get_guid_free_params_hash(params));
+  for (int i = 0; i < op->numInputs; i++) {
+    hash_combine(key, op->inputs[i]->get_shape());
+    hash_combine(key, op->inputs[i]->data_type);
+  }
+  hash_combine(key, mv.device_type);
+  hash_combine(key, mv.ndims);
+  for (int i = 0; i < mv.ndims; i++) {
+    hash_combine(key, mv.dim[i]);
+    hash_combine(key, mv.stride[i]);
+  }
+  hash_combine(key, device_fingerprint);
+  return key;
+}
+
+bool Simulator::find_cost_in_database(size_t key,
+                                      CostMetrics &cost_metrics) const {
+  if (cost_db == nullptr) {
+    return false;
+  }
+  CostDatabase::Entry entry;
+  if (!cost_db->find(key, entry)) {
+    return false;
+  }
+  cost_metrics.forward_time = entry.forward_time;
+  cost_metrics.backward_time = entry.backward_time;
+  cost_metrics.sync_time = entry.sync_time;
+  cost_metrics.inputs_memory = entry.inputs_memory;
+  cost_metrics.outputs_memory = entry.outputs_memory;
+  cost_metrics.weights_memory = entry.weights_memory;
+  return true;
+}
+
+void Simulator::record_cost_in_database(size_t key,
+                                        CostMetrics const &cost_metrics) {
+  if (cost_db == nullptr) {
+    return;
+  }
+  CostDatabase::Entry entry;
+  entry.forward_time = cost_metrics.forward_time;
+  entry.backward_time = cost_metrics.backward_time;
+  entry.sync_time = cost_metrics.sync_time;
+  entry.inputs_memory = cost_metrics.inputs_memory;
+  entry.outputs_memory = cost_metrics.outputs_memory;
+  entry.weights_memory = cost_metrics.weights_memory;
+  cost_db->insert(key, entry);
+}
+
+bool Simulator::estimate_operator_cost(Op const *op,
+                                       MachineView const &mv,
+                                       CostMetrics &cost_metrics) {
+  CostModel const *model = cost_model.get();
+  if (missing_cost_model != nullptr) {
+    // --cost-db-import-only never profiles operators
+    log_sim.warning("No cost recorded for operator %s, estimating it",
+                    op->name);
+    model = missing_cost_model.get();
+  }
+  bool is_implemented =
+      model->measure_operator_cost(this, op, mv, cost_metrics);
+  if (!is_implemented) {
+    handle_measure_operator_cost_unimplemented(op);
+  }
+  return model == cost_model.get();
+}
+
 CostMetrics Simulator::measure_operator_cost(Op const *op,
                                              MachineView const &mv) {
   tl::optional<OperatorParameters> retrieved_params = get_op_parameters(op);
@@ -538,9 +649,12 @@ CostMetrics Simulator::measure_operator_cost(Op const *op,
     if (this->strict_hash_to_operator_cost.find(key) ==
         this->strict_hash_to_operator_cost.end()) {
       CostMetrics cost_metrics;
-      bool is_implemented = op->measure_operator_cost(this, mv, cost_metrics);
-      if (!is_implemented) {
-        handle_measure_operator_cost_unimplemented(op);
+      size_t db_key = this->get_cost_database_key(op, params, mv);
+      if (!this->find_cost_in_database(db_key, cost_metrics) &&
+          this->estimate_operator_cost(op, mv, cost_metrics)) {
+        // sync costs depend on the machine model rather than on the device,
+        // so they are estimated again instead of being persisted
+        this->record_cost_in_database(db_key, cost_metrics);
       }
       op->estimate_sync_cost(this, mv, cost_metrics);
       this->strict_hash_to_operator_cost[key] = cost_metrics;
@@ -558,11 +672,10 @@ CostMetrics Simulator::measure_operator_cost(Op const *op,
       hash_to_operator_cost.find(hash);
 
   if (iter == hash_to_operator_cost.end()) {
+    // the params hash of these operators is tied to their inputs, so their
+    // costs are not persisted
     CostMetrics cost_metrics;
-    bool is_implemented = op->measure_operator_cost(this, mv, cost_metrics);
-    if (!is_implemented) {
-      handle_measure_operator_cost_unimplemented(op);
-    }
+    this->estimate_operator_cost(op, mv, cost_metrics);
     op->estimate_sync_cost(this, mv, cost_metrics);
     hash_to_operator_cost[hash] = cost_metrics;
     return cost_metrics;
@@ -714,42 +827,56 @@ float Simulator::estimate_xfer_cost(Op const *op,
         }
         return 2 * max_xfer_cost;
       }
+      case OP_PIPELINE: {
+        // The micro-batches are moved one at a time, but together they
+        // move the whole tensor. The overlap with the stages is accounted
+        // for by the pipeline schedule in the search.
+        return this->estimate_point_to_point_xfer_cost(
+            input_tensor, source_view, sink_view);
+      }
       default:
         assert(false);
     }
   } else {
-    // No cost if source_view == sink_view
-    if (source_view == sink_view) {
-      return 0.0f;
-    }
-    assert(source_view.ndims == sink_view.ndims);
-    Domain d;
-    d.dim = source_view.ndims;
-    for (int i = 0; i < d.dim; i++) {
-      assert(source_view.dim[i] == sink_view.dim[i]);
-      d.rect_data[i] = 0;
-      d.rect_data[i + d.dim] = source_view.dim[i] - 1;
-    }
-    const ParallelTensor input_tensor = op->inputs[input_idx];
-    size_t total_size = data_type_size(input_tensor->data_type);
-    for (int i = 0; i < input_tensor->num_dims; i++) {
-      total_size *= input_tensor->dims[i].size / input_tensor->dims[i].degree;
-    }
-    float max_xfer_cost = 0.0f;
-    for (Domain::DomainPointIterator it(d); it; it++) {
-      int source_device = source_view.get_device_id(*it);
-      int sink_device = sink_view.get_device_id(*it);
-      float bandwidth = 0.0f;
-      if (machine->get_gpu(source_device)->node_id ==
-          machine->get_gpu(sink_device)->node_id) {
-        bandwidth = machine->get_intra_node_gpu_bandwidth();
-      } else {
-        bandwidth = machine->get_inter_node_gpu_bandwidth();
-      }
-      max_xfer_cost = std::max(max_xfer_cost, 2 * total_size / bandwidth);
+    return this->estimate_point_to_point_xfer_cost(
+        op->inputs[input_idx], source_view, sink_view);
+  }
+}
+
+float Simulator::estimate_point_to_point_xfer_cost(
+    const ParallelTensor tensor,
+    MachineView const &source_view,
+    MachineView const &sink_view) const {
+  // No cost if source_view == sink_view
+  if (source_view == sink_view) {
+    return 0.0f;
+  }
+  assert(source_view.ndims == sink_view.ndims);
+  Domain d;
+  d.dim = source_view.ndims;
+  for (int i = 0; i < d.dim; i++) {
+    assert(source_view.dim[i] == sink_view.dim[i]);
+    d.rect_data[i] = 0;
+    d.rect_data[i + d.dim] = source_view.dim[i] - 1;
+  }
+  size_t total_size = data_type_size(tensor->data_type);
+  for (int i = 0; i < tensor->num_dims; i++) {
+    total_size *= tensor->dims[i].size / tensor->dims[i].degree;
+  }
+  float max_xfer_cost = 0.0f;
+  for (Domain::DomainPointIterator it(d); it; it++) {
+    int source_device = source_view.get_device_id(*it);
+    int sink_device = sink_view.get_device_id(*it);
+    float bandwidth = 0.0f;
+    if (machine->get_gpu(source_device)->node_id ==
+        machine->get_gpu(sink_device)->node_id) {
+      bandwidth = machine->get_intra_node_gpu_bandwidth();
+    } else {
+      bandwidth = machine->get_inter_node_gpu_bandwidth();
     }
-    return max_xfer_cost;
+    max_xfer_cost = std::max(max_xfer_cost, 2 * total_size / bandwidth);
   }
+  return max_xfer_cost;
 }
 
 bool Op::estimate_sync_cost(Simulator *sim,
@@ -760,6 +887,15 @@ bool Op::estimate_sync_cost(Simulator *sim,
   return true;
 }
 
+static AllreduceLinkModel get_link_model(MachineModel *machine) {
+  AllreduceLinkModel links;
+  links.intra_node_bandwidth = machine->get_intra_node_gpu_bandwidth();
+  links.inter_node_bandwidth = machine->get_inter_node_gpu_bandwidth();
+  links.intra_node_latency = machine->get_intra_node_gpu_latency();
+  links.inter_node_latency = machine->get_inter_node_gpu_latency();
+  return links;
+}
+
 float Simulator::default_estimate_sync_cost(
     const ParallelDim tensor_dims[MAX_TENSOR_DIM],
     int tensor_ndims,
@@ -786,25 +922,87 @@ float Simulator::default_estimate_sync_cost(
   if (num_replicas == 1) {
     // No replications
     return 0.0f;
-  } else {
-    bool inter_node_sync = false;
-    tl::optional<int> node = tl::nullopt;
-    for (Domain::DomainPointIterator it(view.get_domain()); it; it++) {
-      int my_device = view.get_device_id(*it);
-      int my_node = machine->get_gpu(my_device)->node_id;
-      if (node == tl::nullopt) {
-        node = my_node;
-      }
-      if (my_node != node.value()) {
-        inter_node_sync = true;
-        break;
+  }
+#ifdef FF_USE_NCCL
+  // Devices that only differ along the replica dims of the view hold copies
+  // of the same shard and form one allreduce group; the groups of different
+  // shards run concurrently
+  bool is_replica_view_dim[MAX_TENSOR_DIM] = {false};
+  bool replica_dims_mapped = false;
+  for (int i = 0; i < tensor_shape.num_dims; i++) {
+    ParallelDim const &dim = tensor_shape.dims[i];
+    if (dim.is_replica_dim && dim.degree > 1 && dim.parallel_idx >= 0 &&
+        dim.parallel_idx < view.ndims) {
+      is_replica_view_dim[dim.parallel_idx] = true;
+      replica_dims_mapped = true;
+    }
+  }
+  std::map<size_t, std::vector<int>> groups;
+  for (Domain::DomainPointIterator it(view.get_domain()); it; it++) {
+    size_t group = 0;
+    if (replica_dims_mapped) {
+      for (int i = 0; i < view.ndims; i++) {
+        if (!is_replica_view_dim[i]) {
+          group = group * view.dim[i] + (*it)[i];
+        }
       }
     }
-    float bandwidth = inter_node_sync
-                          ? this->machine->get_inter_node_gpu_bandwidth()
-                          : this->machine->get_intra_node_gpu_bandwidth();
-    return 2 * tensor_shape.get_piece_size() / bandwidth;
+    int my_device = view.get_device_id(*it);
+    groups[group].push_back(machine->get_gpu(my_device)->node_id);
+  }
+  AllreduceLinkModel links = get_link_model(machine);
+  double message_size = tensor_shape.get_piece_size();
+  float sync_time = 0.0f;
+  for (auto const &g : groups) {
+    std::vector<int> const &node_ids = g.second;
+    if (node_ids.size() <= 1) {
+      continue;
+    }
+    AllreduceAlgorithm algorithm = allreduce_algorithm;
+    if (algorithm == ALLREDUCE_AUTO) {
+      algorithm = select_allreduce_algorithm(node_ids, message_size, links);
+    }
+    std::vector<AllreduceStep> schedule =
+        get_allreduce_schedule(algorithm, node_ids, message_size);
+    if (schedule.empty()) {
+      // the requested algorithm does not apply to this group
+      schedule = get_allreduce_schedule(ALLREDUCE_RING, node_ids, message_size);
+    }
+    sync_time = std::max(sync_time,
+                         estimate_allreduce_time(schedule, node_ids, links));
   }
+  return sync_time;
+#else
+  bool inter_node_sync = false;
+  tl::optional<int> node = tl::nullopt;
+  for (Domain::DomainPointIterator it(view.get_domain()); it; it++) {
+    int my_device = view.get_device_id(*it);
+    int my_node = machine->get_gpu(my_device)->node_id;
+    if (node == tl::nullopt) {
+      node = my_node;
+    }
+    if (my_node != node.value()) {
+      inter_node_sync = true;
+      break;
+    }
+  }
+  float bandwidth = inter_node_sync
+                        ? this->machine->get_inter_node_gpu_bandwidth()
+                        : this->machine->get_intra_node_gpu_bandwidth();
+  return 2 * tensor_shape.get_piece_size() / bandwidth;
+#endif
+}
+
+float Simulator::estimate_all_to_all_xfer_cost(MachineView const &view,
+                                                size_t piece_size) {
+  std::vector<int> node_ids;
+  for (Domain::DomainPointIterator it(view.get_domain()); it; it++) {
+    node_ids.push_back(machine->get_gpu(view.get_device_id(*it))->node_id);
+  }
+  return estimate_allreduce_time(
+      get_all_to_all_schedule(node_ids.size(), piece_size),
+      node_ids,
+      get_link_model(machine));
 }
 
 float Simulator::simulate_runtime(
@@ -1699,43 +1897,78 @@ void LogicalTaskgraphBasedSimulator::expand_allreduce(
   // recall that next_task stores node group in this case
   final_task->device = machine->get_gpu(
       reinterpret_cast<uint64_t>(allreduce_task->next_tasks[0]));
-  MemDevice *src_mem = machine->get_gpu_fb_mem(
-      reinterpret_cast<uint64_t>(allreduce_task->next_tasks[0]));
-  MemDevice *dst_mem;
-  // std::cerr << "expand_ar size: " << allreduce_task->xfer_size << ", " <<
-  // "grp size: " << n_participants << std::endl;
+  std::vector<MemDevice *> mems(n_participants);
+  std::vector<int> node_ids(n_participants);
+  for (int i = 0; i < n_participants; i++) {
+    int gpu_id = reinterpret_cast<uint64_t>(allreduce_task->next_tasks[i]);
+    mems[i] = machine->get_gpu_fb_mem(gpu_id);
+    node_ids[i] = machine->get_gpu(gpu_id)->node_id;
+  }
 
+  AllreduceAlgorithm algorithm = allreduce_algorithm;
+  if (algorithm == ALLREDUCE_AUTO) {
+    AllreduceLinkModel links;
+    links.intra_node_bandwidth = machine->get_intra_node_gpu_bandwidth();
+    links.inter_node_bandwidth = machine->get_inter_node_gpu_bandwidth();
+    links.intra_node_latency = machine->get_intra_node_gpu_latency();
+    links.inter_node_latency = machine->get_inter_node_gpu_latency();
+    algorithm = select_allreduce_algorithm(
+        node_ids, allreduce_task->xfer_size, links);
+  }
   int dir = std_uniform(gen) < 0.5 ? 1 : -1;
-  // std::cerr << "dir: " << dir << std::endl;
-  int round = 0, i = 0;
-  // for (int i = 0; i < n_participants; i++) {
-  while (round != n_participants) {
-    dst_mem = machine->get_gpu_fb_mem(reinterpret_cast<uint64_t>(
-        allreduce_task->next_tasks[MOD(i + dir, n_participants)]));
-    // dst_mem =
-    // machine->get_gpu_fb_mem(reinterpret_cast<uint64_t>(allreduce_task->next_tasks[(i+1)%n_participants]));
-    std::vector<CommDevice *> path = machine->get_comm_path(src_mem, dst_mem);
-    // if (dir)
-    // std::vector<CommDevice *> path = machine->get_comm_path(src_mem,
-    // dst_mem); std::cerr << "\tDevices: ";
-    for (CommDevice *d : path) {
-      SimTask *task = new_comm_task_unrecorded();
-      task->device = d;
-      // std::cerr << "dir: " << dir << ", " << d->name << ", ";
-      task->run_time = 0;
-      task->ready_time = allreduce_task->ready_time;
-      task->xfer_size = (2.0 * (n_participants - 1)) *
-                        allreduce_task->xfer_size / n_participants;
-      task->xfer_left = task->xfer_size;
-      task->add_next_task(final_task);
-      ready_queue.push(task);
+  std::vector<AllreduceStep> schedule = get_allreduce_schedule(
+      algorithm, node_ids, allreduce_task->xfer_size, dir);
+  if (schedule.empty()) {
+    // the requested algorithm does not apply to this group
+    schedule = get_allreduce_schedule(
+        ALLREDUCE_RING, node_ids, allreduce_task->xfer_size, dir);
+  }
+
+  // Every step is followed by a barrier that releases the transfers of the
+  // next step; the barrier of the last step is the final task
+  SimTask *prev_barrier = nullptr;
+  for (size_t s = 0; s < schedule.size(); s++) {
+    SimTask *barrier = final_task;
+    if (s + 1 < schedule.size()) {
+      barrier = new_update_task_unrecorded();
+      barrier->device = final_task->device;
+    }
+    // The comm tasks pay one link latency, the barrier the other sub-steps
+    // of the step
+    bool crosses_nodes = false;
+    for (AllreduceTransfer const &t : schedule[s].transfers) {
+      crosses_nodes |= node_ids[t.src] != node_ids[t.dst];
+    }
+    barrier->run_time = (schedule[s].latency_hops - 1) *
+                        (crosses_nodes ? machine->get_inter_node_gpu_latency()
+                                       : machine->get_intra_node_gpu_latency());
+    for (AllreduceTransfer const &t : schedule[s].transfers) {
+      std::vector<CommDevice *> path =
+          machine->get_comm_path(mems[t.src], mems[t.dst]);
+      for (CommDevice *d : path) {
+        SimTask *task = new_comm_task_unrecorded();
+        task->device = d;
+        task->run_time = 0;
+        task->ready_time = allreduce_task->ready_time;
+        task->xfer_size = t.bytes;
+        task->xfer_left = task->xfer_size;
+        task->add_next_task(barrier);
+        if (prev_barrier == nullptr) {
+          ready_queue.push(task);
+        } else {
+          prev_barrier->add_next_task(task);
+        }
+      }
+    }
+    if (prev_barrier != nullptr) {
+      prev_barrier->add_next_task(barrier);
+    } else if (barrier->counter == 0) {
+      barrier->ready_time = allreduce_task->ready_time;
+      ready_queue.push(barrier);
     }
-    // std::cerr << std::endl;
-    src_mem = dst_mem;
-    round++;
-    i += dir;
+    prev_barrier = barrier;
   }
-  if (final_task->counter == 0) {
+  if (schedule.empty()) {
     final_task->ready_time = allreduce_task->ready_time;
     ready_queue.push(final_task);
   }
@@ -52,6 +52,25 @@ using Legion::TaskLauncher;
 typedef Realm::Point<1, coord_t> Point1;
 typedef Realm::Rect<1, coord_t> Rect1;
 
+size_t Simulator::get_device_fingerprint() {
+  int device;
+  checkCUDA(hipGetDevice(&device));
+  hipDeviceProp_t prop;
+  checkCUDA(hipGetDeviceProperties(&prop, device));
+  int runtime_version;
+  checkCUDA(hipRuntimeGetVersion(&runtime_version));
+  size_t key = 0;
+  hash_combine(key, std::string(prop.name));
+  hash_combine(key, prop.major);
+  hash_combine(key, prop.minor);
+  hash_combine(key, prop.multiProcessorCount);
+  hash_combine(key, prop.clockRate);
+  hash_combine(key, prop.memoryClockRate);
+  hash_combine(key, prop.totalGlobalMem);
+  hash_combine(key, runtime_version);
+  return key;
+}
+
 Simulator::Simulator(FFModel const *model,
                      FFHandler _handler,
                      Memory _memory,
@@ -98,12 +117,19 @@ Simulator::Simulator(FFModel const *model,
   this->machine = machine;
   segment_size = model->config.simulator_segment_size;
   max_num_segments = model->config.simulator_max_num_segments;
+  allreduce_algorithm = model->config.allreduce_algorithm;
   // Initialize task manager
   task_manager = new TaskManager(max_num_tasks);
+  device_fingerprint = get_device_fingerprint();
+  create_cost_model(model->config);
+  open_cost_database(model->config);
 }
 
 Simulator::~Simulator(void) {
-  simulatorInst.destroy();
+  // A simulator without a GPU holds no instance
+  if (simulatorInst.exists()) {
+    simulatorInst.destroy();
+  }
 }
 
 __host__ void
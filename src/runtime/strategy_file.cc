@@ -0,0 +1,222 @@
+#include "flexflow/strategy_file.h"
+#include "flexflow/utils/hash_utils.h"
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <unistd.h>
+
+namespace FlexFlow::PCG {
+
+// Bump the version whenever the serialization of graphs or machine views
+// changes, so that strategies exported by older versions are searched again
+// rather than misread
+static uint32_t const STRATEGY_FILE_MAGIC = 0x54534646; // "FFST"
+static uint32_t const STRATEGY_FILE_VERSION = 2;
+
+struct StrategyFileHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t model_signature;
+  uint64_t binding_signature;
+  int32_t num_nodes, workers_per_node, cpus_per_node;
+  int32_t padding;
+  uint64_t strategy_size;
+};
+
+// PCG files share the serialization of graphs with strategy files, and
+// therefore their version
+static uint32_t const PCG_FILE_MAGIC = 0x47504646; // "FFPG"
+
+struct PCGFileHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t model_signature;
+  uint64_t binding_signature;
+  int32_t cpus_per_node;
+  int32_t computation_mode;
+  uint64_t pcg_size;
+};
+
+bool StrategyFileKey::operator==(StrategyFileKey const &other) const {
+  return model_signature == other.model_signature &&
+         binding_signature == other.binding_signature &&
+         num_nodes == other.num_nodes &&
+         workers_per_node == other.workers_per_node &&
+         cpus_per_node == other.cpus_per_node;
+}
+
+bool StrategyFileKey::operator!=(StrategyFileKey const &other) const {
+  return !(*this == other);
+}
+
+uint64_t binding_signature(std::vector<size_t> const &input_tensor_guids,
+                           std::vector<size_t> const &weight_layer_guids) {
+  size_t key = 0;
+  hash_combine(key, input_tensor_guids);
+  hash_combine(key, weight_layer_guids);
+  return key;
+}
+
+[[noreturn]] static void strategy_error(std::string const &path,
+                                        std::string const &what) {
+  std::ostringstream oss;
+  oss << "Cannot load strategy file " << path << ": " << what;
+  throw std::runtime_error(oss.str());
+}
+
+bool load_strategy_file(std::string const &path,
+                        StrategyFileKey const &key,
+                        std::vector<char> &strategy,
+                        std::string &reason) {
+  std::ifstream in(path, std::ios::binary);
+  if (!in) {
+    reason = "the file does not exist";
+    return false;
+  }
+  StrategyFileHeader header;
+  in.read(reinterpret_cast<char *>(&header), sizeof(header));
+  if (!in || header.magic != STRATEGY_FILE_MAGIC) {
+    strategy_error(path, "not a strategy file");
+  }
+  if (header.version != STRATEGY_FILE_VERSION) {
+    std::ostringstream oss;
+    oss << "the file has version " << header.version << " instead of "
+        << STRATEGY_FILE_VERSION;
+    reason = oss.str();
+    return false;
+  }
+  StrategyFileKey file_key;
+  file_key.model_signature = header.model_signature;
+  file_key.binding_signature = header.binding_signature;
+  file_key.num_nodes = header.num_nodes;
+  file_key.workers_per_node = header.workers_per_node;
+  file_key.cpus_per_node = header.cpus_per_node;
+  if (file_key.model_signature != key.model_signature) {
+    reason = "the strategy was searched for a different model";
+    return false;
+  }
+  if (file_key.binding_signature != key.binding_signature) {
+    reason = "the inputs or weights of the model are numbered differently "
+             "than those the strategy was searched for";
+    return false;
+  }
+  if (file_key != key) {
+    std::ostringstream oss;
+    oss << "the strategy was searched for " << file_key.num_nodes
+        << " nodes with " << file_key.workers_per_node << " GPUs and "
+        << file_key.cpus_per_node << " CPUs each";
+    reason = oss.str();
+    return false;
+  }
+  strategy.resize(header.strategy_size);
+  in.read(strategy.data(), header.strategy_size);
+  if (!in) {
+    strategy.clear();
+    strategy_error(path, "the file is truncated");
+  }
+  return true;
+}
+
+// Writes header and data to a temporary file that is renamed to path
+static void write_file_atomically(std::string const &path,
+                                  void const *header,
+                                  size_t header_bytes,
+                                  char const *data,
+                                  size_t num_bytes,
+                                  char const *kind) {
+  std::ostringstream tmp;
+  tmp << path << ".tmp." << getpid();
+  std::string const tmp_path = tmp.str();
+  {
+    std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+    out.write(reinterpret_cast<char const *>(header), header_bytes);
+    out.write(data, num_bytes);
+    if (!out) {
+      std::remove(tmp_path.c_str());
+      throw std::runtime_error(std::string("Cannot write ") + kind + " file " +
+                               tmp_path);
+    }
+  }
+  if (std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+    std::string what = strerror(errno);
+    std::remove(tmp_path.c_str());
+    throw std::runtime_error(std::string("Cannot write ") + kind + " file " +
+                             path + ": " + what);
+  }
+}
+
+void save_strategy_file(std::string const &path,
+                        StrategyFileKey const &key,
+                        char const *strategy,
+                        size_t num_bytes) {
+  StrategyFileHeader header;
+  memset(&header, 0, sizeof(header));
+  header.magic = STRATEGY_FILE_MAGIC;
+  header.version = STRATEGY_FILE_VERSION;
+  header.model_signature = key.model_signature;
+  header.binding_signature = key.binding_signature;
+  header.num_nodes = key.num_nodes;
+  header.workers_per_node = key.workers_per_node;
+  header.cpus_per_node = key.cpus_per_node;
+  header.strategy_size = num_bytes;
+  write_file_atomically(
+      path, &header, sizeof(header), strategy, num_bytes, "strategy");
+}
+
+[[noreturn]] static void pcg_error(std::string const &path,
+                                   std::string const &what) {
+  std::ostringstream oss;
+  oss << "Cannot load PCG file " << path << ": " << what;
+  throw std::runtime_error(oss.str());
+}
+
+void load_pcg_file(std::string const &path,
+                   PCGFileInfo &info,
+                   std::vector<char> &pcg) {
+  std::ifstream in(path, std::ios::binary);
+  if (!in) {
+    pcg_error(path, "the file does not exist");
+  }
+  PCGFileHeader header;
+  in.read(reinterpret_cast<char *>(&header), sizeof(header));
+  if (!in || header.magic != PCG_FILE_MAGIC) {
+    pcg_error(path, "not a PCG file");
+  }
+  if (header.version != STRATEGY_FILE_VERSION) {
+    std::ostringstream oss;
+    oss << "the file has version " << header.version << " instead of "
+        << STRATEGY_FILE_VERSION << ", export the PCG again";
+    pcg_error(path, oss.str());
+  }
+  info.model_signature = header.model_signature;
+  info.binding_signature = header.binding_signature;
+  info.cpus_per_node = header.cpus_per_node;
+  info.computation_mode = header.computation_mode;
+  pcg.resize(header.pcg_size);
+  in.read(pcg.data(), header.pcg_size);
+  if (!in) {
+    pcg.clear();
+    pcg_error(path, "the file is truncated");
+  }
+}
+
+void save_pcg_file(std::string const &path,
+                   PCGFileInfo const &info,
+                   char const *pcg,
+                   size_t num_bytes) {
+  PCGFileHeader header;
+  memset(&header, 0, sizeof(header));
+  header.magic = PCG_FILE_MAGIC;
+  header.version = STRATEGY_FILE_VERSION;
+  header.model_signature = info.model_signature;
+  header.binding_signature = info.binding_signature;
+  header.cpus_per_node = info.cpus_per_node;
+  header.computation_mode = info.computation_mode;
+  header.pcg_size = num_bytes;
+  write_file_atomically(path, &header, sizeof(header), pcg, num_bytes, "PCG");
+}
+
+}; // namespace FlexFlow::PCG
@@ -26,6 +26,7 @@
 #include "flexflow/ops/element_binary.h"
 #include "flexflow/ops/element_unary.h"
 #include "flexflow/ops/embedding.h"
+#include "flexflow/ops/experts.h"
 #include "flexflow/ops/flat.h"
 #include "flexflow/ops/linear.h"
 #include "flexflow/ops/noop.h"
@@ -35,9 +36,13 @@
 #include "flexflow/parallel_ops/combine.h"
 #include "flexflow/parallel_ops/fused_parallel_op.h"
 #include "flexflow/parallel_ops/partition.h"
+#include "flexflow/parallel_ops/pipeline.h"
 #include "flexflow/parallel_ops/reduction.h"
 #include "flexflow/parallel_ops/replicate.h"
 #include "flexflow/utils/dot/dot_file.h"
+#include "flexflow/utils/parallel_for.h"
+#include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <iomanip>
 
@@ -92,6 +97,8 @@ GraphXfer *create_replicate_attention_reduce(FFModel *model,
                                              int num_heads,
                                              int num_parts);
 
+GraphXfer *create_partition_experts_combine(FFModel *model, int num_parts);
+
 GraphXfer *create_partition_add_combine(FFModel *model,
                                         int parallel_dim,
                                         int num_parts);
@@ -512,10 +519,143 @@ void GraphXfer::find_matches(Graph const *graph,
   this->find_matches(0, graph, matches);
 }
 
+// The value an OpX requires for the key parameter of the node index, if any
+static tl::optional<int> node_index_key(OpX const *opx) {
+  PMParameter para = NodeIndex::key_parameter(opx->type);
+  if (para == PM_INVALID) {
+    return tl::nullopt;
+  }
+  for (PMConstraint const &pmc : opx->pmConstraints) {
+    if (pmc.para == para && pmc.comp == COMPARE_EQ) {
+      return pmc.value;
+    }
+  }
+  return tl::nullopt;
+}
+
+static size_t num_candidate_nodes(OpX const *opx, Graph const *graph) {
+  tl::optional<int> key = node_index_key(opx);
+  if (key.has_value()) {
+    return graph->node_index.count(opx->type, key.value());
+  }
+  return graph->node_index.count(opx->type);
+}
+
+/**
+ * @brief Orders srcOps for matching against graph.
+ *
+ * @details The ops are matched in a topological order of the pattern, so
+ * that the producers of an op are matched before it and only the consumers
+ * of their nodes need to be tried. Among the ops without a producer in the
+ * pattern, the one with the fewest candidate nodes is picked first, and the
+ * nodes of a rarer consumer are used to enumerate its candidates.
+ *
+ * @return false if some op of the pattern has no candidate node in graph,
+ * in which case the xfer cannot match
+ */
+bool GraphXfer::prepare_match_order(Graph const *graph) {
+  this->match_order.clear();
+  std::unordered_map<OpX const *, size_t> counts;
+  for (OpX const *opx : this->srcOps) {
+    size_t count = num_candidate_nodes(opx, graph);
+    if (count == 0) {
+      return false;
+    }
+    counts[opx] = count;
+  }
+  std::unordered_set<OpX const *> placed;
+  while (this->match_order.size() < this->srcOps.size()) {
+    tl::optional<MatchStep> best = tl::nullopt;
+    bool best_connected = false;
+    size_t best_count = 0;
+    for (OpX *opx : this->srcOps) {
+      if (placed.find(opx) != placed.end()) {
+        continue;
+      }
+      bool ready = true, connected = false;
+      for (TensorX const &in : opx->inputs) {
+        if (in.op != NULL) {
+          connected = true;
+          ready &= placed.find(in.op) != placed.end();
+        }
+      }
+      if (!ready) {
+        continue;
+      }
+      MatchStep step;
+      step.op = opx;
+      size_t count = counts.at(opx);
+      if (!connected) {
+        for (OpX *consumer : this->srcOps) {
+          for (size_t i = 0; i < consumer->inputs.size(); i++) {
+            if (consumer->inputs[i].op == opx && counts.at(consumer) < count) {
+              count = counts.at(consumer);
+              step.anchor = consumer;
+              step.anchor_input = i;
+            }
+          }
+        }
+      }
+      if (!best.has_value() || (connected && !best_connected) ||
+          (connected == best_connected && count < best_count)) {
+        best = step;
+        best_connected = connected;
+        best_count = count;
+      }
+    }
+    // the source pattern is acyclic
+    assert(best.has_value());
+    placed.insert(best.value().op);
+    this->match_order.push_back(best.value());
+  }
+  return true;
+}
+
+void GraphXfer::get_candidates(MatchStep const &step,
+                               Graph const *graph,
+                               std::vector<Node> &candidates) const {
+  OpX const *opx = step.op;
+  for (size_t i = 0; i < opx->inputs.size(); i++) {
+    TensorX const &in = opx->inputs[i];
+    if (in.op != NULL) {
+      auto const &outEdges = graph->outEdges.find(in.op->mapOp);
+      if (outEdges == graph->outEdges.end()) {
+        return;
+      }
+      for (Edge const &e : outEdges->second) {
+        if (e.srcIdx == in.idx && e.dstIdx == (int)i) {
+          candidates.push_back(e.dstOp);
+        }
+      }
+      return;
+    }
+  }
+  if (step.anchor != NULL) {
+    std::vector<Node> anchor_nodes;
+    graph->node_index.get(
+        step.anchor->type, node_index_key(step.anchor), anchor_nodes);
+    TensorX const &in = step.anchor->inputs[step.anchor_input];
+    std::unordered_set<Node> visited;
+    for (Node const &node : anchor_nodes) {
+      for (Edge const &e : graph->inEdges.at(node)) {
+        if (e.dstIdx == step.anchor_input && e.srcIdx == in.idx &&
+            visited.insert(e.srcOp).second) {
+          candidates.push_back(e.srcOp);
+        }
+      }
+    }
+    return;
+  }
+  graph->node_index.get(opx->type, node_index_key(opx), candidates);
+}
+
 void GraphXfer::find_matches(int depth,
                              Graph const *graph,
                              std::vector<GraphXferMatch> &matches) {
   log_xfer_matches.spew() << "find_matches at depth: " << depth;
+  if (depth == 0 && !this->prepare_match_order(graph)) {
+    return;
+  }
   if (depth >= (int)srcOps.size()) {
     log_xfer_matches.spew() << "Achieved adequate depth";
     // Create dst operators
@@ -574,13 +714,14 @@ void GraphXfer::find_matches(int depth,
     log_xfer_matches.spew() << "Finished getting match record";
     matches.push_back(match_record);
   } else {
-    OpX *srcOp = srcOps[depth];
-    for (auto const &it : graph->inEdges) {
-      log_xfer_matches.spew() << "Exploring node " << it.first.to_string();
-      // printf("can_match(%d)\n", can_match(srcOp, it->first, graph));
-      if (can_match(srcOp, it.first, graph) &&
-          (mappedOps.find(it.first) == mappedOps.end())) {
-        Node op = it.first;
+    MatchStep const &step = this->match_order[depth];
+    OpX *srcOp = step.op;
+    std::vector<Node> candidates;
+    this->get_candidates(step, graph, candidates);
+    for (Node const &op : candidates) {
+      log_xfer_matches.spew() << "Exploring node " << op.to_string();
+      if (can_match(srcOp, op, graph) &&
+          (mappedOps.find(op) == mappedOps.end())) {
         // Check mapOutput
         this->match(srcOp, op, graph);
         this->find_matches(depth + 1, graph, matches);
@@ -592,19 +733,18 @@ void GraphXfer::find_matches(int depth,
   }
 }
 
-void GraphXfer::run(
-    int depth,
-    Graph *graph,
-    std::priority_queue<Graph *, std::vector<Graph *>, GraphCompare>
-        &candidates,
-    std::unordered_set<size_t> &hashmap,
-    float threshold,
-    int maxNumOps,
-    SimplificationSettings const &simplification_settings,
-    int &num_matches_found,
-    int &num_matches_rejected) {
-  // printf("run: depth(%d) srcOps.size(%zu) graph.size(%zu) candidates(%zu)\n",
-  // depth, srcOps.size(), graph->inEdges.size(), candidates.size());
+void GraphXfer::run(int depth,
+                    Graph const *graph,
+                    std::vector<std::pair<Graph *, float>> &new_graphs,
+                    concurrent_hash_set<size_t> const &hashmap,
+                    float threshold,
+                    int maxNumOps,
+                    SimplificationSettings const &simplification_settings,
+                    int &num_matches_found,
+                    int &num_matches_rejected) {
+  if (depth == 0 && !this->prepare_match_order(graph)) {
+    return;
+  }
   if (depth >= (int)srcOps.size()) {
     // Create dst operators
     bool pass = true;
@@ -618,15 +758,17 @@ void GraphXfer::run(
     }
     // Check that output tensors with external edges are mapped
     for (auto const &opIt : mappedOps) {
-      auto const &list = graph->outEdges[opIt.first];
-      for (auto const &e : list) {
+      auto const &outEdges = graph->outEdges.find(opIt.first);
+      if (outEdges == graph->outEdges.end()) {
+        continue;
+      }
+      for (auto const &e : outEdges->second) {
         if (mappedOps.find(e.dstOp) == mappedOps.end()) {
           // dstOp is external, (srcOp, srcIdx) must be in mappedOutputs
           TensorX srcTen;
           srcTen.op = opIt.second;
           srcTen.idx = e.srcIdx;
           if (mappedOutputs.find(srcTen) == mappedOutputs.end()) {
-            pass = false;
             return;
           }
         }
@@ -635,40 +777,57 @@ void GraphXfer::run(
     // Generate a new graph by applying xfer rule
     log_xfers.spew() << "Found a match for xfer: " << this->get_name();
     num_matches_found++;
-    Graph *newGraph = this->create_new_graph(graph, simplification_settings);
+    // Copy the graph without simplification first, since simplification may
+    // create new parallel op nodes in the model
+    Graph *newGraph = this->create_new_graph(graph, SimplificationSettings());
+    newGraph->simplify(simplification_settings);
+    if ((int)newGraph->inEdges.size() >= maxNumOps) {
+      num_matches_rejected++;
+      delete newGraph;
+      return;
+    }
     // Check that the new graph should not have any loop
     if (newGraph->has_loop()) {
       printf("Found a new graph with LOOP!!!!\n");
-      newGraph->print();
+      delete newGraph;
+      return;
+    }
+    // Graphs already seen in earlier search iterations are dropped without
+    // evaluating their cost; duplicates within this iteration are removed
+    // when the results are merged into the candidate queue
+    if (hashmap.contains(newGraph->hash())) {
+      num_matches_rejected++;
       delete newGraph;
       return;
     }
     // TODO: remove me for better performance
     assert(newGraph->check_correctness());
-    if (newGraph->optimal_cost() < threshold &&
-        (int)newGraph->inEdges.size() < maxNumOps) {
-      if (hashmap.find(newGraph->hash()) == hashmap.end()) {
-        hashmap.insert(newGraph->hash());
-        log_xfers.spew() << "Found new candidate";
-        // newGraph->print_dot();
-        candidates.push(newGraph);
-      }
+    // Only run the DP for graphs that may beat the threshold
+    float cost = newGraph->cost_lower_bound();
+    if (cost < threshold) {
+      cost = newGraph->optimal_cost();
+    } else {
+      log_xfers.spew() << "Lower bound " << cost << " exceeds threshold";
+    }
+    if (cost < threshold) {
+      log_xfers.spew() << "Found new candidate";
+      new_graphs.push_back({newGraph, cost});
     } else {
       num_matches_rejected++;
       delete newGraph;
     }
   } else {
-    OpX *srcOp = srcOps[depth];
-    for (auto const &it : graph->inEdges) {
-      // printf("can_match(%d)\n", can_match(srcOp, it->first, graph));
-      if (can_match(srcOp, it.first, graph) &&
-          (mappedOps.find(it.first) == mappedOps.end())) {
-        Node op = it.first;
-        // Check mapOutput
+    MatchStep const &step = this->match_order[depth];
+    OpX *srcOp = step.op;
+    std::vector<Node> candidates;
+    this->get_candidates(step, graph, candidates);
+    for (Node const &op : candidates) {
+      if (can_match(srcOp, op, graph) &&
+          (mappedOps.find(op) == mappedOps.end())) {
         match(srcOp, op, graph);
         run(depth + 1,
             graph,
-            candidates,
+            new_graphs,
             hashmap,
             threshold,
             maxNumOps,
@@ -941,6 +1100,15 @@ bool GraphXfer::create_new_operator(OpX const *opx, Node &op) {
           {inputs[0], inputs[1], inputs[2]}, params);
       break;
     }
+    case OP_EXPERTS: {
+      assert(opx->matchOpX != NULL);
+      assert(opx->matchOpX->mapOp.ptr != NULL);
+      Experts *experts = (Experts *)opx->matchOpX->mapOp.ptr;
+      ExpertsParams params = experts->get_params();
+      op = model->get_or_create_node<Experts>(
+          {inputs[0], inputs[1], inputs[2], inputs[3]}, params);
+      break;
+    }
     case OP_SOFTMAX: {
       int softmax_dim;
       assert(opx->get_pm_constraint(PM_SOFTMAX_DIM, softmax_dim));
@@ -998,6 +1166,14 @@ bool GraphXfer::create_new_operator(OpX const *opx, Node &op) {
                                               {combine_dim, combine_degree});
       break;
     }
+    case OP_PIPELINE: {
+      int pipeline_dim, pipeline_degree;
+      assert(opx->get_pm_constraint(PM_PIPELINE_DIM, pipeline_dim));
+      assert(opx->get_pm_constraint(PM_PIPELINE_DEGREE, pipeline_degree));
+      op = model->get_or_create_node<Pipeline>(inputs[0],
+                                               {pipeline_dim, pipeline_degree});
+      break;
+    }
     default: {
       std::cout << "opx->type = " << get_operator_type_name(opx->type)
                 << std::endl;
@@ -1129,6 +1305,21 @@ OpX *GraphXfer::create_attention(TensorX const &query,
   return attn;
 }
 
+OpX *GraphXfer::create_experts(TensorX const &input,
+                               TensorX const &indices,
+                               TensorX const &gate_preds,
+                               TensorX const &full_gate_preds,
+                               OpX const *_matchOpX) {
+  OpX *experts = new OpX(
+      OP_EXPERTS, 4, 1, input, indices, gate_preds, full_gate_preds);
+  experts->matchOpX = _matchOpX;
+  experts->add_input_constraint(COMPARE_EQ, INPUT_0, DIM_ND, 3);
+  experts->add_input_constraint(COMPARE_EQ, INPUT_1, DIM_ND, 3);
+  experts->add_input_constraint(COMPARE_EQ, INPUT_2, DIM_ND, 3);
+  experts->add_input_constraint(COMPARE_EQ, INPUT_3, DIM_ND, 3);
+  return experts;
+}
+
 OpX *GraphXfer::create_softmax(TensorX const &input, int softmax_dim) {
   OpX *softmax = new OpX(OP_SOFTMAX, 1, 1, input);
   softmax->add_pm_constraint(COMPARE_EQ, PM_SOFTMAX_DIM, softmax_dim);
@@ -1254,6 +1445,12 @@ void Graph::export_strategy_computation_graph(
                    << std::to_string(r->reduction_degree);
           break;
         }
+        case OP_PIPELINE: {
+          Pipeline *p = (Pipeline *)node.ptr;
+          meta_row << std::to_string(p->pipeline_dim)
+                   << std::to_string(p->pipeline_degree);
+          break;
+        }
         default: {
           if (mv.ndims == 0) {
             meta_row << "N/A";
@@ -1464,7 +1661,11 @@ OpX *create_opx(sl::Operator const &op,
   OpX *opx = new OpX(
       op.op_type, num_inputs, num_outputs, input1, input2, input3, input4);
   for (sl::Parameter const &p : op.para) {
-    if (p.key == PM_PARALLEL_DEGREE) {
+    if (p.key == PM_PARALLEL_DEGREE && op.op_type == OP_PIPELINE) {
+      // The degree of a pipeline op is a number of micro-batches, which does
+      // not scale with the parallel degree
+      opx->add_pm_constraint(COMPARE_EQ, PM_PIPELINE_DEGREE, p.value);
+    } else if (p.key == PM_PARALLEL_DEGREE) {
       tl::optional<PMParameter> degree_key = tl::nullopt;
       switch (op.op_type) {
         case OP_REPARTITION:
@@ -1501,6 +1702,9 @@ OpX *create_opx(sl::Operator const &op,
         case OP_REPLICATE:
           dim_key = PM_REPLICATE_DIM;
           break;
+        case OP_PIPELINE:
+          dim_key = PM_PIPELINE_DIM;
+          break;
       }
 
       if (dim_key.has_value()) {
@@ -1655,11 +1859,25 @@ bool check_opxes_have_same_type_and_constraints(OpX const &src_opx,
   return true;
 }
 
+// Whether r adds pipeline ops to the graph. Only the copy of a pipeline op
+// is micro-batched at runtime, so its stages would not overlap.
+static bool inserts_pipeline(sl::Rule const &r) {
+  auto num_pipelines = [](std::vector<sl::Operator> const &ops) {
+    return std::count_if(ops.begin(), ops.end(), [](sl::Operator const &op) {
+      return op.op_type == OP_PIPELINE;
+    });
+  };
+  return num_pipelines(r.dstOp) > num_pipelines(r.srcOp);
+}
+
 std::vector<GraphXfer *> create_xfers(FFModel *model,
                                       sl::RuleCollection const &rules,
                                       int parallel_degree) {
   std::vector<GraphXfer *> xfers;
   for (sl::Rule const &r : rules.rules) {
+    if (inserts_pipeline(r)) {
+      continue;
+    }
     GraphXfer *xfer = new GraphXfer(model);
     create_xfer(*xfer, r, parallel_degree);
     if (xfer->srcOps.size() == 1 && xfer->dstOps.size() == 1) {
@@ -1762,6 +1980,7 @@ void GraphSearchHelper::generate_all_pcg_xfers() {
   for (auto const &it : all_parallel_degrees) {
     all_pcg_xfers.push_back(
         create_partition_attention_combine(this->model, 16 /*num_heads*/, it));
+    all_pcg_xfers.push_back(create_partition_experts_combine(this->model, it));
   }
 
   if (config.substitution_json_path.has_value()) {
@@ -1881,6 +2100,17 @@ Graph *GraphSearchHelper::construct_graph() {
   return graph;
 }
 
+void GraphSearchHelper::load_cached_costs(SearchCache const &cache) {
+  if (cache.load_costs("optimized_graphs", this->cached_optimized_graphs)) {
+    this->logger->debug() << "Loaded " << this->cached_optimized_graphs.size()
+                          << " cached optimized graph costs";
+  }
+}
+
+void GraphSearchHelper::save_cached_costs(SearchCache const &cache) const {
+  cache.save_costs("optimized_graphs", this->cached_optimized_graphs);
+}
+
 void GraphSearchHelper::graph_optimize(
     size_t budget,
     bool only_data_parallel,
@@ -1889,7 +2119,13 @@ void GraphSearchHelper::graph_optimize(
   // Construct graph structure
   this->logger->debug() << "Starting graph optimization";
 
-  Graph *graph = this->construct_graph();
+  this->graph_optimize(this->construct_graph(), best_graph, optimal_views);
+}
+
+void GraphSearchHelper::graph_optimize(
+    Graph *graph,
+    std::unique_ptr<Graph> &best_graph,
+    std::unordered_map<Node, MachineView> &optimal_views) {
   graph->duplicate_input_nodes();
   std::unordered_map<Node, MachineView> empty_strategy;
   if (!this->config.export_strategy_computation_graph_file.empty()) {
@@ -1914,8 +2150,13 @@ void GraphSearchHelper::graph_optimize(
   settings.simplify_parallel_ops = true;
   best_graph = std::unique_ptr<Graph>(new Graph(optimal.graph.value()));
   best_graph->simplify(settings);
+  std::cout << "Optimal graph hash: " << best_graph->hash() << std::endl;
+  GraphCostResult best_result = best_graph->optimal_cost_result();
+  if (this->config.memory_search) {
+    this->check_device_memory(best_result);
+  }
   std::unordered_map<Node, MachineView> duplicated_optimal_views =
-      best_graph->optimal_views();
+      best_result.views;
   std::unordered_map<Node, Node> deduplication_map =
       best_graph->deduplicate_input_nodes();
   std::unordered_map<Node, MachineView> real_optimal_views;
@@ -1930,6 +2171,21 @@ void GraphSearchHelper::graph_optimize(
   optimal_views = real_optimal_views;
 }
 
+void GraphSearchHelper::check_device_memory(
+    GraphCostResult const &result) const {
+  MachineModel const *machine = this->model->simulator->machine;
+  for (auto const &kv : result.device_memory) {
+    size_t capacity = machine->get_gpu_fb_mem(kv.first)->capacity;
+    if (kv.second > capacity) {
+      log_xfers.warning() << "The best strategy found uses " << kv.second
+                          << " bytes on GPU " << kv.first << ", which only has "
+                          << capacity
+                          << " bytes of memory (use --memory-lambda to trade "
+                             "run time for memory)";
+    }
+  }
+}
+
 void GraphSearchHelper::graph_optimize_no_split(
     size_t budget,
     bool only_data_parallel,
@@ -1953,6 +2209,7 @@ void GraphSearchHelper::graph_optimize_no_split(
   this->logger->debug() << "Total cache size: "
                         << this->cached_optimized_graphs.size();
   std::cout << "Optimal cost: " << best_graph->optimal_cost() << std::endl;
+  std::cout << "Optimal graph hash: " << best_graph->hash() << std::endl;
 }
 
 static void graph_log_representation(Graph const *graph,
@@ -2126,16 +2383,18 @@ std::unique_ptr<Graph> GraphSearchHelper::base_optimize(
   std::vector<GraphXfer *> xfers;
   this->load_graph_substitutions(xfers);
 
-  Graph *graph = new Graph(*r_graph);
-
-  std::priority_queue<Graph *, std::vector<Graph *>, GraphCompare> candidates;
-  std::unordered_set<size_t> hashmap;
-  candidates.push(graph);
-  hashmap.insert(graph->hash());
-  Graph *best_graph = new Graph(*graph);
-  float best_cost = best_graph->optimal_cost();
+  // Candidates are queued as deltas from the graph they were derived from
+  // and only flattened when they are expanded
+  SearchCandidateQueue candidates;
+  concurrent_hash_set<size_t> hashmap;
+  float best_cost = r_graph->optimal_cost();
+  std::shared_ptr<GraphDelta const> best_graph = GraphDelta::snapshot(*r_graph);
+  candidates.push({best_cost, best_graph});
+  hashmap.insert(r_graph->hash());
   int counter = 0;
   float const alpha = this->model->config.search_alpha;
+  std::atomic<int> available_threads(
+      std::max(1, this->model->config.search_num_threads) - 1);
 
   int budget = model->config.search_budget;
   if (budget == 0) {
@@ -2149,56 +2408,111 @@ std::unique_ptr<Graph> GraphSearchHelper::base_optimize(
       break;
     }
 
-    Graph *cur_graph = candidates.top();
+    SearchCandidate cur = candidates.top();
     candidates.pop();
-    if (cur_graph->optimal_cost() < best_graph->optimal_cost()) {
-      delete best_graph;
-      best_graph = cur_graph;
-      best_cost = cur_graph->optimal_cost();
-    } else if (cur_graph->optimal_cost() > best_cost * alpha) {
+    if (cur.cost < best_cost) {
+      best_graph = cur.graph;
+      best_cost = cur.cost;
+    } else if (cur.cost > best_cost * alpha) {
       continue;
     }
 
     log_xfers.info("[%d] cur_cost(%.4lf) best_cost(%.4lf) candidates.size(%zu)",
                    counter,
-                   cur_graph->optimal_cost(),
+                   cur.cost,
                    best_cost,
                    candidates.size());
 
+    std::unique_ptr<Graph> cur_graph = cur.graph->flatten(this->model);
     log_xfers.debug() << "Considering " << xfers.size() << " possible xfers";
-    for (size_t i = 0; i < xfers.size(); i++) {
-      int num_matches_found = 0, num_matches_rejected = 0;
-      log_xfers.debug() << "Considering xfer: " << xfers[i]->get_name();
-      xfers[i]->run(0,
-                    cur_graph,
-                    candidates,
-                    hashmap,
-                    best_cost * alpha,
-                    1000,
-                    simplification_settings,
-                    num_matches_found,
-                    num_matches_rejected);
-      log_xfers.debug() << "Rejected [ " << num_matches_rejected << " / "
-                        << num_matches_found << " ] matches";
-      /* std::cout << "." << std::flush; */
-    }
-    /* std::cout << std::endl; */
-    if (best_graph != cur_graph) {
-      delete cur_graph;
+    this->run_xfers_in_parallel(cur_graph.get(),
+                                cur.graph,
+                                xfers,
+                                candidates,
+                                hashmap,
+                                best_cost * alpha,
+                                simplification_settings,
+                                available_threads);
+  }
+  std::unique_ptr<Graph> result = best_graph->flatten(this->model);
+  this->logger->debug() << "Optimized cost: " << result->optimal_cost();
+  // result->print_dot();
+  return result;
+}
+
+/**
+ * @brief Applies all xfers to a single graph, borrowing threads from
+ * available_threads
+ *
+ * @details Each xfer is run by exactly one thread, so a GraphXfer (which keeps
+ * its matching state in its members) is never shared between threads. The
+ * graphs produced by each xfer are buffered and then merged into the
+ * candidate queue in xfer order, which keeps the search trajectory
+ * independent of the number of threads. Each new graph is queued as its delta
+ * from graph, whose own delta is graph_delta.
+ */
+void GraphSearchHelper::run_xfers_in_parallel(
+    Graph const *graph,
+    std::shared_ptr<GraphDelta const> const &graph_delta,
+    std::vector<GraphXfer *> const &xfers,
+    SearchCandidateQueue &candidates,
+    concurrent_hash_set<size_t> &hashmap,
+    float threshold,
+    SimplificationSettings const &simplification_settings,
+    std::atomic<int> &available_threads) {
+  std::vector<std::vector<std::pair<Graph *, float>>> new_graphs(
+      xfers.size());
+
+  parallel_for(xfers.size(), available_threads, [&](size_t i) {
+    int num_matches_found = 0, num_matches_rejected = 0;
+    xfers[i]->run(0,
+                  graph,
+                  new_graphs[i],
+                  hashmap,
+                  threshold,
+                  1000,
+                  simplification_settings,
+                  num_matches_found,
+                  num_matches_rejected);
+    log_xfers.debug() << "Xfer " << xfers[i]->get_name() << ": rejected [ "
+                      << num_matches_rejected << " / " << num_matches_found
+                      << " ] matches";
+  });
+
+  for (auto &graphs : new_graphs) {
+    // The match order of an xfer follows the node guids, which the threads
+    // hand out in a racy order, so the graphs are queued by cost and hash
+    std::sort(graphs.begin(),
+              graphs.end(),
+              [](std::pair<Graph *, float> const &lhs,
+                 std::pair<Graph *, float> const &rhs) {
+                if (lhs.second != rhs.second) {
+                  return lhs.second < rhs.second;
+                }
+                return lhs.first->hash() < rhs.first->hash();
+              });
+    for (auto const &new_graph : graphs) {
+      if (hashmap.insert(new_graph.first->hash())) {
+        candidates.push(
+            {new_graph.second,
+             GraphDelta::derive(graph_delta, *graph, *new_graph.first)});
+      }
+      delete new_graph.first;
     }
   }
-
-  this->logger->debug() << "Optimized cost: " << best_graph->optimal_cost();
-  // best_graph->print_dot();
-  return std::unique_ptr<Graph>(best_graph);
 }
 
 size_t gs_dp_state_hash(Graph const *graph,
                         Node const &sink_node,
                         tl::optional<ParallelTensorShape> const &output_shape,
                         tl::optional<ParallelTensorShape> const &input_shape) {
+  // The key persists across runs through save_cached_costs, so it identifies
+  // the sink by its parameters and position in the graph, not its address
+  std::unordered_map<Node, size_t> const &node_hashes =
+      graph->canonical_node_hashes();
   size_t key = graph->hash();
-  hash_combine(key, sink_node.ptr);
+  hash_combine(key, sink_node.ptr->get_untyped_params_hash());
+  hash_combine(key, node_hashes.at(sink_node));
   hash_combine(key, output_shape);
   hash_combine(key, input_shape);
   return key;
@@ -2758,6 +3072,45 @@ GraphXfer *create_replicate_attention_reduce(FFModel *model,
   return subst;
 }
 
+// Expert parallelism: each of the num_parts devices dispatches the tokens of
+// its batch shard and evaluates its share of the experts on the rows that all
+// the shards dispatched to them (see Experts)
+GraphXfer *create_partition_experts_combine(FFModel *model, int num_parts) {
+  GraphXfer *subst = new GraphXfer(model);
+  TensorX input = subst->new_tensor();
+  TensorX indices = subst->new_tensor();
+  TensorX gate_preds = subst->new_tensor();
+  TensorX full_gate_preds = subst->new_tensor();
+  OpX *experts1 = subst->create_experts(
+      input, indices, gate_preds, full_gate_preds, NULL /*matchOpX*/);
+  OpX *part_input = subst->create_repartition(input, 1, num_parts);
+  OpX *part_indices = subst->create_repartition(indices, 1, num_parts);
+  OpX *part_gate_preds = subst->create_repartition(gate_preds, 1, num_parts);
+  OpX *part_full_gate_preds =
+      subst->create_repartition(full_gate_preds, 1, num_parts);
+  OpX *experts2 = subst->create_experts(part_input->outputs[0],
+                                        part_indices->outputs[0],
+                                        part_gate_preds->outputs[0],
+                                        part_full_gate_preds->outputs[0],
+                                        experts1 /*matchOpX*/);
+  OpX *combine = subst->create_combine(experts2->outputs[0], 1, num_parts);
+  subst->map_output(experts1->outputs[0], combine->outputs[0]);
+  subst->srcOps.push_back(experts1);
+  subst->dstOps.push_back(part_input);
+  subst->dstOps.push_back(part_indices);
+  subst->dstOps.push_back(part_gate_preds);
+  subst->dstOps.push_back(part_full_gate_preds);
+  subst->dstOps.push_back(experts2);
+  subst->dstOps.push_back(combine);
+
+  std::ostringstream oss;
+  oss << "partition_experts_combine["
+      << "num_parts=" << num_parts << "]";
+  subst->name = oss.str();
+
+  return subst;
+}
+
 GraphXfer *create_replicate_linear_combine(FFModel *model,
                                            int num_dims,
                                            int num_parts,
@@ -3250,6 +3603,15 @@ bool FFModel::convert_graph_to_operators(
                                reduction->reduction_degree);
         break;
       }
+      case OP_PIPELINE: {
+        assert(inList.size() == 1);
+        Pipeline *pipeline = (Pipeline *)node.ptr;
+        new_op = new Pipeline(*this,
+                              inputs[0],
+                              pipeline->pipeline_dim,
+                              pipeline->pipeline_degree);
+        break;
+      }
       case OP_FUSED_PARALLEL: {
         assert(inList.size() == 1);
         FusedParallelOp *fused = (FusedParallelOp *)node.ptr;
@@ -0,0 +1,45 @@
+#! /usr/bin/env bash
+set -e
+
+# Cd into directory holding this script
+cd "${BASH_SOURCE[0]%/*}"
+
+# Checks that the parallel search finds the same best graph as the serial one:
+# FFModel needs a Legion runtime, so the search is run through an example
+# rather than a unit test
+
+if [ -z "$FF_HOME" ]; then echo "FF_HOME variable is not defined, aborting tests"; exit 1; fi
+GPUS=$1
+THREADS=${2:-4}
+BATCHSIZE=$((GPUS * 64))
+FSIZE=14048
+ZSIZE=12192
+BUDGET=20
+
+# Look for the example in the build folder first, and otherwise in the folders
+# in the PATH, plus in the subdirectory of the flexflow Python package
+if [[ -f "$FF_HOME/build/examples/cpp/MLP_Unify/mlp_unify" ]]; then
+	MLP_UNIFY="$FF_HOME/build/examples/cpp/MLP_Unify/mlp_unify"
+else
+	python_packages=$(python -c "from distutils import sysconfig; print(sysconfig.get_python_lib(plat_specific=False,standard_lib=False))")
+	export PATH="${python_packages}/flexflow/bin:${PATH}"
+	export LD_LIBRARY_PATH="${python_packages}/flexflow/lib:${LD_LIBRARY_PATH}"
+	MLP_UNIFY=$(command -v mlp_unify || true)
+	if [ -z "$MLP_UNIFY" ]; then
+		echo "C++ test binaries not found"
+		exit 1
+	fi
+fi
+
+best_graph_hashes() {
+	"$MLP_UNIFY" -ll:gpu "$GPUS" -ll:fsize "$FSIZE" -ll:zsize "$ZSIZE" -b ${BATCHSIZE} --budget ${BUDGET} --analytical-cost-model --search-num-threads "$1" | grep "Optimal graph hash"
+}
+
+serial=$(best_graph_hashes 1)
+parallel=$(best_graph_hashes "$THREADS")
+echo "Serial search: $serial"
+echo "Search with $THREADS threads: $parallel"
+if [ -z "$serial" ] || [ "$serial" != "$parallel" ]; then
+	echo "The searches with 1 and $THREADS threads found different graphs"
+	exit 1
+fi
@@ -0,0 +1,144 @@
+#include "flexflow/allreduce_schedule.h"
+#include "gtest/gtest.h"
+
+using namespace FlexFlow;
+
+static AllreduceLinkModel make_links() {
+  AllreduceLinkModel links;
+  links.intra_node_bandwidth = 100.0f;
+  links.inter_node_bandwidth = 10.0f;
+  links.intra_node_latency = 0.0f;
+  links.inter_node_latency = 1.0f;
+  return links;
+}
+
+// bytes sent by each participant over the whole schedule
+static std::vector<double>
+    bytes_sent(std::vector<AllreduceStep> const &schedule, int n) {
+  std::vector<double> sent(n, 0.0);
+  for (AllreduceStep const &step : schedule) {
+    for (AllreduceTransfer const &t : step.transfers) {
+      EXPECT_NE(t.src, t.dst);
+      sent[t.src] += t.bytes;
+    }
+  }
+  return sent;
+}
+
+TEST(allreduce_schedule, ring) {
+  std::vector<AllreduceStep> schedule =
+      get_allreduce_schedule(ALLREDUCE_RING, {0, 0, 1, 1}, 400.0);
+  ASSERT_EQ(schedule.size(), 1);
+  ASSERT_EQ(schedule[0].transfers.size(), 4);
+  EXPECT_EQ(schedule[0].transfers[3].dst, 0);
+  EXPECT_DOUBLE_EQ(schedule[0].transfers[0].bytes, 600.0);
+  // 3 sub-steps of reduce-scatter and 3 of all-gather
+  EXPECT_EQ(schedule[0].latency_hops, 6);
+}
+
+TEST(allreduce_schedule, halving_doubling) {
+  // 6 participants: 2 fold into the power-of-two group of 4
+  std::vector<AllreduceStep> schedule = get_allreduce_schedule(
+      ALLREDUCE_HALVING_DOUBLING, {0, 1, 2, 3, 4, 5}, 64.0);
+  ASSERT_EQ(schedule.size(), 6);
+  std::vector<double> sent = bytes_sent(schedule, 6);
+  // 32 + 16 while halving, then the same while doubling, plus the unfold
+  EXPECT_DOUBLE_EQ(sent[0], 2 * (32.0 + 16.0) + 64.0);
+  EXPECT_DOUBLE_EQ(sent[3], 2 * (32.0 + 16.0));
+  EXPECT_DOUBLE_EQ(sent[5], 64.0);
+}
+
+TEST(allreduce_schedule, hierarchical_algorithms_need_several_nodes) {
+  std::vector<int> one_node = {0, 0, 0, 0};
+  EXPECT_TRUE(
+      get_allreduce_schedule(ALLREDUCE_HIERARCHICAL_RING, one_node, 1.0)
+          .empty());
+  EXPECT_TRUE(
+      get_allreduce_schedule(ALLREDUCE_2D_TORUS, one_node, 1.0).empty());
+  // the 2D torus needs the same number of participants on every node
+  EXPECT_TRUE(
+      get_allreduce_schedule(ALLREDUCE_2D_TORUS, {0, 0, 1, 1, 1}, 1.0).empty());
+  std::vector<AllreduceStep> torus = get_allreduce_schedule(
+      ALLREDUCE_2D_TORUS, {0, 0, 0, 1, 1, 1, 2, 2, 2}, 1.0);
+  ASSERT_EQ(torus.size(), 3);
+  EXPECT_EQ(torus[0].latency_hops, 2);
+  EXPECT_EQ(torus[1].latency_hops, 4);
+  EXPECT_EQ(torus[2].latency_hops, 2);
+}
+
+TEST(allreduce_schedule, double_binary_tree) {
+  std::vector<AllreduceStep> schedule = get_allreduce_schedule(
+      ALLREDUCE_DOUBLE_BINARY_TREE, {0, 1, 2, 3, 4, 5, 6, 7}, 100.0);
+  ASSERT_EQ(schedule.size(), 2);
+  // two trees of 7 edges each
+  EXPECT_EQ(schedule[0].transfers.size(), 14);
+  EXPECT_EQ(schedule[0].latency_hops, 3);
+}
+
+TEST(allreduce_schedule, all_to_all) {
+  std::vector<int> node_ids = {0, 0, 1, 1};
+  std::vector<AllreduceStep> schedule = get_all_to_all_schedule(4, 400.0);
+  ASSERT_EQ(schedule.size(), 1);
+  EXPECT_EQ(schedule[0].transfers.size(), 12);
+  std::vector<double> sent = bytes_sent(schedule, 4);
+  EXPECT_DOUBLE_EQ(sent[2], 300.0);
+  // each node sends 2 * 200 bytes to the other one, which dominates the 100
+  // bytes that each GPU sends within its node
+  EXPECT_FLOAT_EQ(estimate_allreduce_time(schedule, node_ids, make_links()),
+                  41.0f);
+  EXPECT_TRUE(get_all_to_all_schedule(1, 400.0).empty());
+}
+
+TEST(allreduce_schedule, selection) {
+  AllreduceLinkModel links = make_links();
+  std::vector<int> single_node = {0, 0, 0, 0};
+  EXPECT_EQ(select_allreduce_algorithm(single_node, 1e6, links),
+            ALLREDUCE_RING);
+  // many nodes with several GPUs each: a flat ring pays for every
+  // inter-node hop in one step, while the 2D torus only sends a shard of the
+  // message across nodes
+  std::vector<int> multi_node;
+  for (int node = 0; node < 8; node++) {
+    for (int gpu = 0; gpu < 4; gpu++) {
+      multi_node.push_back(node);
+    }
+  }
+  AllreduceAlgorithm large = select_allreduce_algorithm(multi_node, 1e6, links);
+  EXPECT_NE(large, ALLREDUCE_RING);
+  float ring_time = estimate_allreduce_time(
+      get_allreduce_schedule(ALLREDUCE_RING, multi_node, 1e6),
+      multi_node,
+      links);
+  float best_time = estimate_allreduce_time(
+      get_allreduce_schedule(large, multi_node, 1e6), multi_node, links);
+  EXPECT_LT(best_time, ring_time);
+}
+
+TEST(allreduce_schedule, small_messages_avoid_the_flat_ring) {
+  AllreduceLinkModel links = make_links();
+  links.intra_node_latency = 0.1f;
+  // 16 nodes of 8 GPUs: the flat ring pays 254 latencies, the hierarchical
+  // algorithms 30 inter-node ones, the trees and halving-doubling only a
+  // logarithmic number
+  std::vector<int> node_ids;
+  for (int node = 0; node < 16; node++) {
+    for (int gpu = 0; gpu < 8; gpu++) {
+      node_ids.push_back(node);
+    }
+  }
+  AllreduceAlgorithm small = select_allreduce_algorithm(node_ids, 8.0, links);
+  EXPECT_TRUE(small == ALLREDUCE_DOUBLE_BINARY_TREE ||
+              small == ALLREDUCE_HALVING_DOUBLING);
+  EXPECT_GT(estimate_allreduce_time(
+                get_allreduce_schedule(ALLREDUCE_RING, node_ids, 8.0),
+                node_ids,
+                links),
+            254.0f);
+}
+
+TEST(allreduce_schedule, parse) {
+  AllreduceAlgorithm algorithm;
+  EXPECT_TRUE(parse_allreduce_algorithm("2d-torus", algorithm));
+  EXPECT_EQ(algorithm, ALLREDUCE_2D_TORUS);
+  EXPECT_FALSE(parse_allreduce_algorithm("butterfly", algorithm));
+}
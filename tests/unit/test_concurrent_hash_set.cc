@@ -0,0 +1,42 @@
+#include "flexflow/utils/concurrent_hash_set.h"
+#include "gtest/gtest.h"
+#include <thread>
+
+TEST(concurrent_hash_set, basic) {
+  concurrent_hash_set<size_t> s;
+
+  EXPECT_TRUE(s.insert(1));
+  EXPECT_TRUE(s.insert(2));
+  EXPECT_FALSE(s.insert(1));
+  EXPECT_TRUE(s.contains(1));
+  EXPECT_FALSE(s.contains(3));
+  EXPECT_EQ(s.size(), 2);
+}
+
+TEST(concurrent_hash_set, concurrent_insert) {
+  concurrent_hash_set<size_t> s(8);
+  int const num_threads = 8;
+  size_t const num_elements = 10000;
+
+  std::vector<int> num_inserted(num_threads, 0);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < num_threads; t++) {
+    threads.emplace_back([&, t]() {
+      for (size_t i = 0; i < num_elements; i++) {
+        if (s.insert(i)) {
+          num_inserted[t]++;
+        }
+      }
+    });
+  }
+  for (std::thread &t : threads) {
+    t.join();
+  }
+
+  int total = 0;
+  for (int n : num_inserted) {
+    total += n;
+  }
+  EXPECT_EQ(total, num_elements);
+  EXPECT_EQ(s.size(), num_elements);
+}
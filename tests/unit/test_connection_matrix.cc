@@ -0,0 +1,54 @@
+#include "flexflow/connection_matrix.h"
+#include "gtest/gtest.h"
+#include <cassert>
+#include <cstdlib>
+#include <fstream>
+#include <unistd.h>
+
+using namespace FlexFlow;
+
+TEST(sparse_connection_matrix, merges_and_drops_edges) {
+  SparseConnectionMatrix conn(
+      4, {{2, 1, 1}, {0, 3, 2}, {2, 1, 1}, {0, 1, 1}, {3, 0, 0}});
+  EXPECT_EQ(conn.num_devs(), 4);
+  EXPECT_EQ(conn.num_edges(), 3);
+  EXPECT_EQ(conn.get(2, 1), 2);
+  EXPECT_EQ(conn.get(0, 3), 2);
+  EXPECT_EQ(conn.get(3, 0), 0);
+  EXPECT_EQ(conn.get(1, 2), 0);
+  // neighbors are sorted
+  ASSERT_EQ(conn.row_end(0) - conn.row_begin(0), 2);
+  EXPECT_EQ(conn.neighbor(conn.row_begin(0)), 1);
+  EXPECT_EQ(conn.neighbor(conn.row_begin(0) + 1), 3);
+  EXPECT_EQ(conn.row_begin(1), conn.row_end(1));
+}
+
+TEST(sparse_connection_matrix, dense_round_trip) {
+  std::vector<int> dense = {0, 1, 0, 1, 0, 2, 0, 2, 0};
+  SparseConnectionMatrix conn = SparseConnectionMatrix::from_dense(dense, 3);
+  EXPECT_EQ(conn.num_edges(), 4);
+  EXPECT_EQ(conn.to_dense(), dense);
+}
+
+TEST(sparse_connection_matrix, load) {
+  char tmpl[] = "/tmp/ff_topology_XXXXXX";
+  int fd = mkstemp(tmpl);
+  assert(fd >= 0);
+  close(fd);
+  {
+    std::ofstream out(tmpl);
+    out << "3\n0 2 1\n2 0 1\n1 2 4\n";
+  }
+  SparseConnectionMatrix conn;
+  ASSERT_TRUE(SparseConnectionMatrix::load(tmpl, conn));
+  EXPECT_EQ(conn.num_devs(), 3);
+  EXPECT_EQ(conn.num_edges(), 3);
+  EXPECT_EQ(conn.get(1, 2), 4);
+
+  {
+    std::ofstream out(tmpl);
+    out << "3\n0 3 1\n";
+  }
+  EXPECT_FALSE(SparseConnectionMatrix::load(tmpl, conn));
+  unlink(tmpl);
+}
@@ -0,0 +1,84 @@
+#include "flexflow/cost_database.h"
+#include "gtest/gtest.h"
+#include <cassert>
+#include <cstdlib>
+#include <fstream>
+#include <unistd.h>
+
+using namespace FlexFlow;
+
+static std::string make_temp_path() {
+  char tmpl[] = "/tmp/ff_cost_db_XXXXXX";
+  int fd = mkstemp(tmpl);
+  assert(fd >= 0);
+  close(fd);
+  unlink(tmpl);
+  return tmpl;
+}
+
+static CostDatabase::Entry make_entry(float forward_time) {
+  CostDatabase::Entry entry;
+  entry.forward_time = forward_time;
+  entry.backward_time = 2 * forward_time;
+  entry.sync_time = 0;
+  entry.inputs_memory = 1;
+  entry.outputs_memory = 2;
+  entry.weights_memory = 3;
+  return entry;
+}
+
+TEST(cost_database, persists_across_instances) {
+  std::string path = make_temp_path();
+  {
+    CostDatabase db(path, false);
+    EXPECT_EQ(db.size(), 0);
+    db.insert(1, make_entry(0.5f));
+    db.insert(2, make_entry(1.5f));
+  }
+  CostDatabase db(path, false);
+  EXPECT_EQ(db.size(), 2);
+  CostDatabase::Entry entry;
+  ASSERT_TRUE(db.find(2, entry));
+  EXPECT_EQ(entry.forward_time, 1.5f);
+  EXPECT_EQ(entry.backward_time, 3.0f);
+  EXPECT_EQ(entry.weights_memory, 3);
+  EXPECT_FALSE(db.find(3, entry));
+}
+
+TEST(cost_database, import_only_does_not_write) {
+  std::string path = make_temp_path();
+  {
+    CostDatabase db(path, false);
+    db.insert(1, make_entry(0.5f));
+  }
+  {
+    CostDatabase db(path, true);
+    EXPECT_TRUE(db.is_import_only());
+    db.insert(2, make_entry(1.5f));
+    EXPECT_EQ(db.size(), 2);
+  }
+  CostDatabase db(path, true);
+  EXPECT_EQ(db.size(), 1);
+}
+
+TEST(cost_database, ignores_partial_record) {
+  std::string path = make_temp_path();
+  {
+    CostDatabase db(path, false);
+    db.insert(1, make_entry(0.5f));
+  }
+  {
+    std::ofstream out(path, std::ios::binary | std::ios::app);
+    out << "junk";
+  }
+  {
+    CostDatabase db(path, false);
+    EXPECT_EQ(db.size(), 1);
+    db.insert(2, make_entry(1.5f));
+  }
+  CostDatabase db(path, true);
+  EXPECT_EQ(db.size(), 2);
+  CostDatabase::Entry entry;
+  ASSERT_TRUE(db.find(2, entry));
+  EXPECT_EQ(entry.forward_time, 1.5f);
+}
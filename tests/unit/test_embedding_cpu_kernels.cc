@@ -0,0 +1,119 @@
+#include "flexflow/ops/kernels/embedding_cpu_kernels.h"
+#include "gtest/gtest.h"
+#include <vector>
+
+using namespace FlexFlow;
+using namespace FlexFlow::Kernels::Embedding;
+
+namespace {
+
+// Tables and batches whose rows are not a multiple of the vector width
+int const kNumEntries = 11;
+int const kOutDim = 37;
+int const kBatchSize = 6;
+
+std::vector<float> make_table() {
+  std::vector<float> table(kNumEntries * kOutDim);
+  for (size_t i = 0; i < table.size(); i++) {
+    table[i] = (float)(i % 13) - 6.0f;
+  }
+  return table;
+}
+
+std::vector<int64_t> make_ids(int in_dim) {
+  std::vector<int64_t> ids(kBatchSize * in_dim);
+  for (size_t i = 0; i < ids.size(); i++) {
+    // repeated ids, within and across bags
+    ids[i] = (i * 7) % 5;
+  }
+  return ids;
+}
+
+} // namespace
+
+TEST(embedding_cpu_kernels, forward_pools_rows) {
+  std::vector<float> table = make_table();
+  int in_dim = 3;
+  std::vector<int64_t> ids = make_ids(in_dim);
+  for (AggrMode aggr : {AGGR_MODE_SUM, AGGR_MODE_AVG}) {
+    for (int threads : {1, 4}) {
+      std::vector<float> output(kBatchSize * kOutDim, -1.0f);
+      cpu_forward_kernel(ids.data(),
+                         output.data(),
+                         table.data(),
+                         in_dim,
+                         kOutDim,
+                         kBatchSize,
+                         aggr,
+                         kNumEntries,
+                         threads);
+      for (int b = 0; b < kBatchSize; b++) {
+        for (int c = 0; c < kOutDim; c++) {
+          float expected = 0.0f;
+          for (int j = 0; j < in_dim; j++) {
+            expected += table[ids[b * in_dim + j] * kOutDim + c];
+          }
+          if (aggr == AGGR_MODE_AVG) {
+            expected /= in_dim;
+          }
+          EXPECT_FLOAT_EQ(output[b * kOutDim + c], expected);
+        }
+      }
+    }
+  }
+}
+
+TEST(embedding_cpu_kernels, forward_without_aggregation) {
+  std::vector<float> table = make_table();
+  std::vector<int32_t> ids = {4, 0, 10, 4, 7, 1};
+  std::vector<float> output(ids.size() * kOutDim);
+  cpu_forward_kernel(ids.data(),
+                     output.data(),
+                     table.data(),
+                     1,
+                     kOutDim,
+                     ids.size(),
+                     AGGR_MODE_NONE,
+                     kNumEntries,
+                     3);
+  for (size_t b = 0; b < ids.size(); b++) {
+    for (int c = 0; c < kOutDim; c++) {
+      EXPECT_EQ(output[b * kOutDim + c], table[ids[b] * kOutDim + c]);
+    }
+  }
+}
+
+TEST(embedding_cpu_kernels, backward_accumulates_repeated_ids) {
+  int in_dim = 4;
+  std::vector<int64_t> ids = make_ids(in_dim);
+  std::vector<float> output_grad(kBatchSize * kOutDim);
+  for (size_t i = 0; i < output_grad.size(); i++) {
+    output_grad[i] = (float)(i % 7);
+  }
+  for (AggrMode aggr : {AGGR_MODE_SUM, AGGR_MODE_AVG}) {
+    // the gradient is added to the existing one
+    std::vector<float> expected(kNumEntries * kOutDim, 1.0f);
+    float bag_scale = aggr == AGGR_MODE_AVG ? 1.0f / in_dim : 1.0f;
+    for (size_t i = 0; i < ids.size(); i++) {
+      for (int c = 0; c < kOutDim; c++) {
+        expected[ids[i] * kOutDim + c] +=
+            bag_scale * output_grad[(i / in_dim) * kOutDim + c];
+      }
+    }
+    for (int threads : {1, 3, 8}) {
+      std::vector<float> weight_grad(kNumEntries * kOutDim, 1.0f);
+      cpu_backward_kernel(ids.data(),
+                          output_grad.data(),
+                          weight_grad.data(),
+                          in_dim,
+                          kOutDim,
+                          kBatchSize,
+                          aggr,
+                          kNumEntries,
+                          threads);
+      for (size_t i = 0; i < expected.size(); i++) {
+        EXPECT_FLOAT_EQ(weight_grad[i], expected[i]);
+      }
+    }
+  }
+}
@@ -0,0 +1,38 @@
+#include "flexflow/gradient_buckets.h"
+#include "gtest/gtest.h"
+
+using namespace FlexFlow;
+
+TEST(gradient_buckets, fills_in_backward_order) {
+  std::vector<size_t> keys(5, 0);
+  std::vector<size_t> bytes = {4, 4, 4, 4, 4};
+  std::vector<std::vector<int>> buckets =
+      assign_gradient_buckets(keys, bytes, 8, 32);
+  std::vector<std::vector<int>> expected = {{4, 3}, {2, 1}, {0}};
+  EXPECT_EQ(buckets, expected);
+}
+
+TEST(gradient_buckets, separates_keys) {
+  // parameters on different devices never share a bucket, and the buckets
+  // are ordered by when their last gradient is ready
+  std::vector<size_t> keys = {1, 2, 1, 2};
+  std::vector<size_t> bytes = {4, 4, 4, 4};
+  std::vector<std::vector<int>> buckets =
+      assign_gradient_buckets(keys, bytes, 64, 32);
+  std::vector<std::vector<int>> expected = {{3, 1}, {2, 0}};
+  EXPECT_EQ(buckets, expected);
+}
+
+TEST(gradient_buckets, limits) {
+  // a parameter larger than the bucket size is alone in its bucket
+  std::vector<size_t> keys(4, 0);
+  std::vector<size_t> bytes = {4, 100, 4, 4};
+  std::vector<std::vector<int>> buckets =
+      assign_gradient_buckets(keys, bytes, 16, 32);
+  std::vector<std::vector<int>> expected = {{3, 2}, {1}, {0}};
+  EXPECT_EQ(buckets, expected);
+  // the number of parameters per bucket is bounded as well
+  buckets = assign_gradient_buckets(keys, {1, 1, 1, 1}, 16, 3);
+  expected = {{3, 2, 1}, {0}};
+  EXPECT_EQ(buckets, expected);
+}
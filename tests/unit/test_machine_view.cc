@@ -1,6 +1,7 @@
 #include "flexflow/config.h"
 #include "flexflow/machine_view.h"
 #include "gtest/gtest.h"
+#include <set>
 
 using namespace Legion;
 using namespace FlexFlow;
@@ -31,3 +32,90 @@ TEST(machine_view_get_device_id, basic) {
   EXPECT_EQ(mv.get_device_id({0}), 2);
   EXPECT_EQ(mv.get_device_id({1}), 3);
 }
+
+// The views of ndims dimensions among views, as (dims, strides)
+static std::vector<std::pair<std::vector<int>, std::vector<int>>>
+    views_of_ndims(std::vector<MachineView> const &views, int ndims) {
+  std::vector<std::pair<std::vector<int>, std::vector<int>>> shapes;
+  for (MachineView const &view : views) {
+    if (view.ndims == ndims) {
+      shapes.push_back({std::vector<int>(view.dim, view.dim + ndims),
+                        std::vector<int>(view.stride, view.stride + ndims)});
+    }
+  }
+  return shapes;
+}
+
+TEST(enumerate_machine_views, strides_within_a_node) {
+  std::vector<MachineView> views =
+      enumerate_machine_views(1, 4, MachineView::GPU, 1);
+  using Shapes = std::vector<std::pair<std::vector<int>, std::vector<int>>>;
+  EXPECT_EQ(views_of_ndims(views, 1),
+            Shapes({{{1}, {1}}, {{2}, {1}}, {{2}, {2}}, {{4}, {1}}}));
+}
+
+TEST(enumerate_machine_views, prunes_node_permutations) {
+  // 4 nodes of 2 GPUs: a GPU on each of nodes 0 and 2 is equivalent to one on
+  // each of nodes 0 and 1
+  std::vector<MachineView> views =
+      enumerate_machine_views(4, 2, MachineView::GPU, 1);
+  using Shapes = std::vector<std::pair<std::vector<int>, std::vector<int>>>;
+  EXPECT_EQ(views_of_ndims(views, 1),
+            Shapes({{{1}, {1}},
+                    {{2}, {1}},
+                    {{2}, {2}},
+                    {{4}, {1}},
+                    {{4}, {2}},
+                    {{8}, {1}}}));
+  // With one GPU per node, a 2x2 view and its transpose are equivalent,
+  // whereas within a node they are not
+  EXPECT_EQ(views_of_ndims(enumerate_machine_views(4, 1, MachineView::GPU, 2),
+                           2),
+            Shapes({{{2, 2}, {1, 2}}}));
+  EXPECT_EQ(views_of_ndims(enumerate_machine_views(1, 4, MachineView::GPU, 2),
+                           2),
+            Shapes({{{2, 2}, {1, 2}}, {{2, 2}, {2, 1}}}));
+}
+
+TEST(enumerate_machine_views, node_by_gpu_views) {
+  int num_nodes = 2, gpus_per_node = 4;
+  std::vector<MachineView> views =
+      enumerate_machine_views(num_nodes, gpus_per_node, MachineView::GPU, 3);
+  bool found = false;
+  for (MachineView const &view : views) {
+    EXPECT_EQ(view.start_device_id, 0);
+    std::vector<int> devices = view.device_ids();
+    std::set<int> distinct(devices.begin(), devices.end());
+    EXPECT_EQ(distinct.size(), devices.size());
+    EXPECT_EQ((num_nodes * gpus_per_node) % devices.size(), 0);
+    EXPECT_LT(*distinct.rbegin(), num_nodes * gpus_per_node);
+    found |= (view.ndims == 2 && view.dim[0] == gpus_per_node &&
+              view.stride[0] == 1 && view.dim[1] == num_nodes &&
+              view.stride[1] == gpus_per_node);
+  }
+  EXPECT_TRUE(found);
+}
+
+TEST(get_machine_view_starts, split_resources) {
+  // 2 nodes of 4 GPUs
+  MachineView view;
+  view.device_type = MachineView::GPU;
+  view.start_device_id = 0;
+  view.ndims = 1;
+  view.dim[0] = 2;
+  view.stride[0] = 1;
+  // Two neighboring GPUs never straddle a node boundary
+  EXPECT_EQ(get_machine_view_starts(view, 2, 4),
+            std::vector<int>({0, 1, 2, 4, 5, 6}));
+  // A node of GPUs starts at the first GPU of a node, as do views that span
+  // both nodes
+  view.dim[0] = 4;
+  EXPECT_EQ(get_machine_view_starts(view, 2, 4), std::vector<int>({0, 4}));
+  view.dim[0] = 8;
+  EXPECT_EQ(get_machine_view_starts(view, 2, 4), std::vector<int>({0}));
+  // One GPU on each node, at any offset within the first node
+  view.dim[0] = 2;
+  view.stride[0] = 4;
+  EXPECT_EQ(get_machine_view_starts(view, 2, 4),
+            std::vector<int>({0, 1, 2, 3}));
+}
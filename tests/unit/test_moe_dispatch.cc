@@ -0,0 +1,529 @@
+#include "flexflow/ops/kernels/moe_dispatch_cpu_kernels.h"
+#include "gtest/gtest.h"
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+using namespace FlexFlow::Kernels::MoeDispatch;
+
+namespace {
+
+// Three experts, each token assigned to two of them
+int const kNumExperts = 3;
+int const kK = 2;
+int const kBatchSize = 4;
+int const kDim = 2;
+std::vector<int> const kAssign = {0, 1, 0, 2, 0, 1, 2, 0};
+
+std::vector<float *> expert_ptrs(std::vector<std::vector<float>> &experts) {
+  std::vector<float *> ptrs;
+  for (std::vector<float> &expert : experts) {
+    ptrs.push_back(expert.data());
+  }
+  return ptrs;
+}
+
+} // namespace
+
+TEST(moe_dispatch, slots_keep_token_order_and_drop_overflow) {
+  std::vector<int> slots(kAssign.size()), counts(kNumExperts);
+  cpu_compute_expert_slots(kAssign.data(),
+                           kAssign.size(),
+                           kNumExperts,
+                           3,
+                           slots.data(),
+                           counts.data());
+  EXPECT_EQ(slots, std::vector<int>({0, 0, 1, 0, 2, 1, 1, -1}));
+  EXPECT_EQ(counts, std::vector<int>({4, 2, 2}));
+  EXPECT_EQ(num_dropped(counts.data(), kNumExperts, 3), 1);
+  EXPECT_EQ(num_dropped(counts.data(), kNumExperts, 4), 0);
+
+  EXPECT_EQ(expert_capacity(1.0f, kK, kNumExperts, kBatchSize), 3);
+  EXPECT_EQ(expert_capacity(2.0f, kK, kNumExperts, kBatchSize), 6);
+}
+
+TEST(moe_dispatch, group_by_round_trip) {
+  int capacity = 3;
+  std::vector<float> input(kBatchSize * kDim);
+  for (size_t i = 0; i < input.size(); i++) {
+    input[i] = (float)i + 1.0f;
+  }
+  std::vector<std::vector<float>> experts(
+      kNumExperts, std::vector<float>(capacity * kDim, -1.0f));
+  std::vector<float *> outputs = expert_ptrs(experts);
+  cpu_group_by_forward(input.data(),
+                       kAssign.data(),
+                       outputs.data(),
+                       kNumExperts,
+                       kK,
+                       capacity,
+                       kBatchSize,
+                       kDim);
+  // expert 0 gets tokens 0, 1 and 2; token 3 overflows it
+  EXPECT_EQ(experts[0], std::vector<float>({1, 2, 3, 4, 5, 6}));
+  EXPECT_EQ(experts[1], std::vector<float>({1, 2, 5, 6, -1, -1}));
+  EXPECT_EQ(experts[2], std::vector<float>({3, 4, 7, 8, -1, -1}));
+
+  // the gradient of a token sums those of its expert rows
+  std::vector<float> input_grad(kBatchSize * kDim, -1.0f);
+  cpu_group_by_backward(input_grad.data(),
+                        kAssign.data(),
+                        outputs.data(),
+                        kNumExperts,
+                        kK,
+                        capacity,
+                        kBatchSize,
+                        kDim);
+  EXPECT_EQ(input_grad, std::vector<float>({2, 4, 6, 8, 10, 12, 7, 8}));
+}
+
+TEST(moe_dispatch, aggregate_combines_weighted_expert_rows) {
+  int capacity = 3;
+  std::vector<std::vector<float>> experts = {
+      {1, 1, 2, 2, 3, 3}, {10, 10, 20, 20, 30, 30}, {5, 5, 6, 6, 7, 7}};
+  std::vector<float *> preds = expert_ptrs(experts);
+  std::vector<float> gate_preds = {0.5f, 0.5f, 0.25f, 0.75f,
+                                   1.0f, 0.0f, 0.5f, 0.5f};
+  std::vector<float> output(kBatchSize * kDim, -1.0f);
+  cpu_aggregate_forward(preds.data(),
+                        kAssign.data(),
+                        gate_preds.data(),
+                        output.data(),
+                        kNumExperts,
+                        kK,
+                        capacity,
+                        kBatchSize,
+                        kDim);
+  EXPECT_EQ(output, std::vector<float>({5.5, 5.5, 4.25, 4.25, 3, 3, 3, 3}));
+
+  std::vector<float> spec_output(kAssign.size() * kDim, -1.0f);
+  cpu_aggregate_spec_forward(preds.data(),
+                             kAssign.data(),
+                             spec_output.data(),
+                             kNumExperts,
+                             kK,
+                             capacity,
+                             kBatchSize,
+                             kDim);
+  EXPECT_EQ(spec_output,
+            std::vector<float>(
+                {1, 1, 10, 10, 2, 2, 5, 5, 3, 3, 20, 20, 6, 6, 0, 0}));
+}
+
+TEST(moe_dispatch, aggregate_backward) {
+  int capacity = 3;
+  std::vector<std::vector<float>> experts = {
+      {1, 0, 0, 1, 1, 1}, {2, 0, 0, 2, 0, 0}, {0, 3, 3, 0, 0, 0}};
+  std::vector<float *> preds = expert_ptrs(experts);
+  std::vector<std::vector<float>> exp_grads(
+      kNumExperts, std::vector<float>(capacity * kDim, 0.0f));
+  std::vector<float *> grads = expert_ptrs(exp_grads);
+  std::vector<float> gate_preds(kAssign.size(), 0.5f);
+  std::vector<float> output_grad = {1, 2, 3, 4, 5, 6, 7, 8};
+  // token 1 was assigned to other experts in the forward pass
+  std::vector<int> assign = kAssign;
+  assign[3] = 1;
+  std::vector<float> gate_grads(kBatchSize * kNumExperts, 0.0f);
+  cpu_aggregate_backward(preds.data(),
+                         grads.data(),
+                         assign.data(),
+                         kAssign.data(),
+                         gate_preds.data(),
+                         gate_grads.data(),
+                         output_grad.data(),
+                         kNumExperts,
+                         kK,
+                         capacity,
+                         0.0f,
+                         kBatchSize,
+                         kDim);
+  EXPECT_EQ(exp_grads[0], std::vector<float>({0.5, 1, 1.5, 2, 2.5, 3}));
+  EXPECT_EQ(exp_grads[1], std::vector<float>({0.5, 1, 2.5, 3, 0, 0}));
+  EXPECT_EQ(exp_grads[2], std::vector<float>({1.5, 2, 3.5, 4, 0, 0}));
+  // token 0: <(1, 2), (1, 0)> = 1 and <(1, 2), (2, 0)> = 2, minus the mean
+  EXPECT_FLOAT_EQ(gate_grads[0], 0.0f);
+  EXPECT_FLOAT_EQ(gate_grads[1], 1.0f);
+  EXPECT_FLOAT_EQ(gate_grads[2], -1.0f);
+  // token 1 has no gating gradient
+  for (int e = 0; e < kNumExperts; e++) {
+    EXPECT_FLOAT_EQ(gate_grads[kNumExperts + e], 0.0f);
+  }
+
+  // the balancing term alone has zero mean
+  std::vector<float> balanced(kBatchSize * kNumExperts, 0.0f);
+  std::vector<float> zero_grad(output_grad.size(), 0.0f);
+  cpu_aggregate_backward(preds.data(),
+                         grads.data(),
+                         kAssign.data(),
+                         kAssign.data(),
+                         gate_preds.data(),
+                         balanced.data(),
+                         zero_grad.data(),
+                         kNumExperts,
+                         kK,
+                         capacity,
+                         0.75f,
+                         kBatchSize,
+                         kDim);
+  // counts (4, 2, 2) scaled by 0.75 * 3 / 4
+  for (int b = 0; b < kBatchSize; b++) {
+    EXPECT_FLOAT_EQ(balanced[b * kNumExperts + 0], 0.75f);
+    EXPECT_FLOAT_EQ(balanced[b * kNumExperts + 1], -0.375f);
+    EXPECT_FLOAT_EQ(balanced[b * kNumExperts + 2], -0.375f);
+  }
+}
+
+TEST(moe_dispatch, experts_combine_weighted_expert_rows) {
+  int capacity = 3, out_dim = 2;
+  std::vector<float> input = {1, 2, 3, 4, 5, 6, 7, 8};
+  std::vector<float> gate_preds = {0.5f, 0.5f, 0.25f, 0.75f,
+                                   1.0f, 0.0f, 0.5f, 0.5f};
+  // expert e maps (x0, x1) to (x0 + e * x1, x1 - e * x0), before its bias
+  std::vector<float> kernel;
+  for (int e = 0; e < kNumExperts; e++) {
+    std::vector<float> w = {1, (float)e, -(float)e, 1};
+    kernel.insert(kernel.end(), w.begin(), w.end());
+  }
+  std::vector<float> output(kBatchSize * out_dim, -1.0f);
+  cpu_experts_forward(input.data(),
+                      kAssign.data(),
+                      gate_preds.data(),
+                      kernel.data(),
+                      nullptr,
+                      output.data(),
+                      AC_MODE_NONE,
+                      kNumExperts,
+                      kK,
+                      capacity,
+                      kBatchSize,
+                      kDim,
+                      out_dim);
+  // each expert applies a softmax, so the outputs of a token add up to the
+  // gates of the experts that kept it; token 3 only keeps expert 2
+  std::vector<float> kept = {1.0f, 1.0f, 1.0f, 0.5f};
+  for (int b = 0; b < kBatchSize; b++) {
+    EXPECT_NEAR(output[b * out_dim] + output[b * out_dim + 1], kept[b], 1e-6);
+  }
+  // token 1: 0.25 * softmax(3, 4) + 0.75 * softmax(3 + 2 * 4, 4 - 2 * 3)
+  auto softmax = [](float a0, float a1) {
+    return 1.0f / (1.0f + expf(a1 - a0));
+  };
+  EXPECT_NEAR(output[2],
+              0.25f * softmax(3, 4) + 0.75f * softmax(11, -2),
+              1e-6);
+  EXPECT_NEAR(output[6], 0.5f * softmax(7 + 2 * 8, 8 - 2 * 7), 1e-6);
+}
+
+TEST(moe_dispatch, experts_batch_shards_match_one_device) {
+  int out_dim = 2, num_shards = 2, capacity = 2;
+  int local_batch = kBatchSize / num_shards;
+  int rows = capacity * num_shards;
+  std::vector<float> input = {1, 2, 3, 4, 5, 6, 7, 8};
+  std::vector<float> gate_preds = {0.5f, 0.5f, 0.25f, 0.75f,
+                                   1.0f, 0.0f, 0.5f, 0.5f};
+  std::vector<float> kernel, bias;
+  for (int i = 0; i < kNumExperts * kDim * out_dim; i++) {
+    kernel.push_back(0.25f * (i % 7) - 0.5f);
+  }
+  for (int i = 0; i < kNumExperts * out_dim; i++) {
+    bias.push_back(0.125f * i);
+  }
+  // each shard dispatches its own tokens; the all-to-all gives expert e the
+  // rows of shard s at e * rows + s * capacity
+  std::vector<float> x((size_t)kNumExperts * rows * kDim);
+  std::vector<float> piece((size_t)kNumExperts * capacity * kDim);
+  for (int s = 0; s < num_shards; s++) {
+    cpu_experts_dispatch(input.data() + s * local_batch * kDim,
+                         kAssign.data() + s * local_batch * kK,
+                         piece.data(),
+                         kNumExperts,
+                         kK,
+                         capacity,
+                         local_batch,
+                         kDim);
+    for (int e = 0; e < kNumExperts; e++) {
+      std::copy(piece.begin() + e * capacity * kDim,
+                piece.begin() + (e + 1) * capacity * kDim,
+                x.begin() + (e * rows + s * capacity) * kDim);
+    }
+  }
+  // the experts are split into {0, 1} and {2}
+  std::vector<float> y((size_t)kNumExperts * rows * out_dim);
+  for (int lo = 0; lo < kNumExperts; lo += 2) {
+    int num_local = std::min(2, kNumExperts - lo);
+    cpu_experts_compute(x.data() + lo * rows * kDim,
+                        kernel.data() + lo * kDim * out_dim,
+                        bias.data() + lo * out_dim,
+                        y.data() + lo * rows * out_dim,
+                        AC_MODE_RELU,
+                        num_local,
+                        rows,
+                        kDim,
+                        out_dim);
+  }
+  std::vector<float> output(kBatchSize * out_dim);
+  std::vector<float> y_piece((size_t)kNumExperts * capacity * out_dim);
+  for (int s = 0; s < num_shards; s++) {
+    for (int e = 0; e < kNumExperts; e++) {
+      std::copy(y.begin() + (e * rows + s * capacity) * out_dim,
+                y.begin() + (e * rows + (s + 1) * capacity) * out_dim,
+                y_piece.begin() + e * capacity * out_dim);
+    }
+    cpu_experts_combine(y_piece.data(),
+                        kAssign.data() + s * local_batch * kK,
+                        gate_preds.data() + s * local_batch * kK,
+                        output.data() + s * local_batch * out_dim,
+                        kNumExperts,
+                        kK,
+                        capacity,
+                        local_batch,
+                        out_dim);
+  }
+  // no assignment is dropped by either shard
+  std::vector<float> expected(kBatchSize * out_dim);
+  cpu_experts_forward(input.data(),
+                      kAssign.data(),
+                      gate_preds.data(),
+                      kernel.data(),
+                      bias.data(),
+                      expected.data(),
+                      AC_MODE_RELU,
+                      kNumExperts,
+                      kK,
+                      rows,
+                      kBatchSize,
+                      kDim,
+                      out_dim);
+  EXPECT_EQ(output, expected);
+}
+
+TEST(moe_dispatch, experts_backward_matches_finite_differences) {
+  int capacity = 3, out_dim = 2;
+  std::vector<float> input = {0.5f, -1, 1, 2, -0.5f, 1.5f, 2, -2};
+  std::vector<float> gate_preds = {0.5f, 0.5f, 0.25f, 0.75f,
+                                   0.9f, 0.1f, 0.5f, 0.5f};
+  std::vector<float> kernel, bias;
+  for (int i = 0; i < kNumExperts * kDim * out_dim; i++) {
+    kernel.push_back(0.1f * (i % 5) - 0.2f);
+  }
+  for (int i = 0; i < kNumExperts * out_dim; i++) {
+    bias.push_back(0.05f * i);
+  }
+  std::vector<float> output_grad = {1, -1, 0.5f, 2, -1, 1, 0.25f, 0.5f};
+  // the loss is <output_grad, output>
+  auto loss = [&](std::vector<float> const &x,
+                  std::vector<float> const &g,
+                  std::vector<float> const &w) {
+    std::vector<float> output(kBatchSize * out_dim);
+    cpu_experts_forward(x.data(),
+                        kAssign.data(),
+                        g.data(),
+                        w.data(),
+                        bias.data(),
+                        output.data(),
+                        AC_MODE_SIGMOID,
+                        kNumExperts,
+                        kK,
+                        capacity,
+                        kBatchSize,
+                        kDim,
+                        out_dim);
+    double sum = 0.0;
+    for (size_t i = 0; i < output.size(); i++) {
+      sum += output[i] * output_grad[i];
+    }
+    return sum;
+  };
+  std::vector<float> input_grad(input.size(), 0.0f);
+  std::vector<float> gate_grads(kBatchSize * kNumExperts, 0.0f);
+  std::vector<float> kernel_grad(kernel.size(), 0.0f);
+  std::vector<float> bias_grad(bias.size(), 0.0f);
+  cpu_experts_backward(input.data(),
+                       input_grad.data(),
+                       kAssign.data(),
+                       gate_preds.data(),
+                       gate_grads.data(),
+                       kernel.data(),
+                       kernel_grad.data(),
+                       bias.data(),
+                       bias_grad.data(),
+                       output_grad.data(),
+                       AC_MODE_SIGMOID,
+                       0.0f,
+                       kNumExperts,
+                       kK,
+                       capacity,
+                       kBatchSize,
+                       kDim,
+                       out_dim);
+  float const eps = 1e-2f;
+  for (size_t i = 0; i < input.size(); i++) {
+    std::vector<float> plus = input, minus = input;
+    plus[i] += eps;
+    minus[i] -= eps;
+    double numeric = (loss(plus, gate_preds, kernel) -
+                      loss(minus, gate_preds, kernel)) /
+                     (2 * eps);
+    EXPECT_NEAR(input_grad[i], numeric, 1e-3);
+  }
+  // the gate gradients go to the columns of the chosen experts, and each
+  // row is shifted to zero mean
+  std::vector<double> gate_numeric(kBatchSize * kNumExperts, 0.0);
+  for (size_t i = 0; i < gate_preds.size(); i++) {
+    std::vector<float> plus = gate_preds, minus = gate_preds;
+    plus[i] += eps;
+    minus[i] -= eps;
+    gate_numeric[(i / kK) * kNumExperts + kAssign[i]] +=
+        (loss(input, plus, kernel) - loss(input, minus, kernel)) / (2 * eps);
+  }
+  for (int b = 0; b < kBatchSize; b++) {
+    double *row = gate_numeric.data() + b * kNumExperts;
+    double mean = (row[0] + row[1] + row[2]) / kNumExperts;
+    for (int e = 0; e < kNumExperts; e++) {
+      EXPECT_NEAR(gate_grads[b * kNumExperts + e], row[e] - mean, 1e-3);
+    }
+  }
+  for (size_t i = 0; i < kernel.size(); i++) {
+    std::vector<float> plus = kernel, minus = kernel;
+    plus[i] += eps;
+    minus[i] -= eps;
+    double numeric =
+        (loss(input, gate_preds, plus) - loss(input, gate_preds, minus)) /
+        (2 * eps);
+    EXPECT_NEAR(kernel_grad[i], numeric, 1e-3);
+  }
+}
+
+namespace {
+
+// The gate gradients of Experts, and those of the Group_by, per-expert dense
+// and softmax, and Aggregate that FFModel::moe used to create
+void check_gate_grads_match_aggregate(std::vector<int> const &assign,
+                                      int k,
+                                      float lambda_bal) {
+  int batch_size = assign.size() / k, out_dim = 2, capacity = 2;
+  std::vector<float> input, gate_preds, kernel, bias, output_grad;
+  for (int i = 0; i < batch_size * kDim; i++) {
+    input.push_back(0.3f * (i % 5) - 0.6f);
+  }
+  for (size_t i = 0; i < assign.size(); i++) {
+    gate_preds.push_back(0.1f * (i % 4) + 0.2f);
+  }
+  for (int i = 0; i < kNumExperts * kDim * out_dim; i++) {
+    kernel.push_back(0.15f * (i % 6) - 0.4f);
+  }
+  for (int i = 0; i < kNumExperts * out_dim; i++) {
+    bias.push_back(0.05f * i);
+  }
+  for (int i = 0; i < batch_size * out_dim; i++) {
+    output_grad.push_back(0.5f * (i % 3) - 0.25f);
+  }
+
+  std::vector<float> input_grad(input.size(), 0.0f);
+  std::vector<float> kernel_grad(kernel.size(), 0.0f);
+  std::vector<float> bias_grad(bias.size(), 0.0f);
+  std::vector<float> gate_grads(batch_size * kNumExperts, 0.0f);
+  cpu_experts_backward(input.data(),
+                       input_grad.data(),
+                       assign.data(),
+                       gate_preds.data(),
+                       gate_grads.data(),
+                       kernel.data(),
+                       kernel_grad.data(),
+                       bias.data(),
+                       bias_grad.data(),
+                       output_grad.data(),
+                       AC_MODE_RELU,
+                       lambda_bal,
+                       kNumExperts,
+                       k,
+                       capacity,
+                       batch_size,
+                       kDim,
+                       out_dim);
+
+  std::vector<std::vector<float>> rows(
+      kNumExperts, std::vector<float>(capacity * kDim, 0.0f));
+  std::vector<float *> row_ptrs = expert_ptrs(rows);
+  cpu_group_by_forward(input.data(),
+                       assign.data(),
+                       row_ptrs.data(),
+                       kNumExperts,
+                       k,
+                       capacity,
+                       batch_size,
+                       kDim);
+  std::vector<std::vector<float>> preds(
+      kNumExperts, std::vector<float>(capacity * out_dim));
+  std::vector<std::vector<float>> exp_grads(
+      kNumExperts, std::vector<float>(capacity * out_dim, 0.0f));
+  for (int e = 0; e < kNumExperts; e++) {
+    cpu_experts_compute(rows[e].data(),
+                        kernel.data() + e * kDim * out_dim,
+                        bias.data() + e * out_dim,
+                        preds[e].data(),
+                        AC_MODE_RELU,
+                        1,
+                        capacity,
+                        kDim,
+                        out_dim);
+  }
+  std::vector<float *> pred_ptrs = expert_ptrs(preds);
+  std::vector<float *> grad_ptrs = expert_ptrs(exp_grads);
+  std::vector<float> expected(batch_size * kNumExperts, 0.0f);
+  cpu_aggregate_backward(pred_ptrs.data(),
+                         grad_ptrs.data(),
+                         assign.data(),
+                         assign.data(),
+                         gate_preds.data(),
+                         expected.data(),
+                         output_grad.data(),
+                         kNumExperts,
+                         k,
+                         capacity,
+                         lambda_bal,
+                         batch_size,
+                         out_dim);
+  for (size_t i = 0; i < expected.size(); i++) {
+    EXPECT_NEAR(gate_grads[i], expected[i], 1e-6) << "gate gradient " << i;
+  }
+}
+
+} // namespace
+
+TEST(moe_dispatch, experts_gate_grads_match_aggregate) {
+  check_gate_grads_match_aggregate(kAssign, kK, 0.0f);
+  check_gate_grads_match_aggregate(kAssign, kK, 0.75f);
+}
+
+TEST(moe_dispatch, experts_gate_grads_match_aggregate_top1) {
+  // with a single expert per token the balancing term is all that tells the
+  // gate about the loads (counts (2, 1, 1), one assignment dropped)
+  std::vector<int> assign = {0, 1, 0, 2};
+  check_gate_grads_match_aggregate(assign, 1, 0.0f);
+  check_gate_grads_match_aggregate(assign, 1, 0.75f);
+
+  std::vector<float> gate_grads(assign.size() * kNumExperts, 0.0f);
+  std::vector<float> outputs_grad(kNumExperts * 2 * kDim);
+  std::vector<float> outputs(outputs_grad.size(), 0.0f);
+  std::vector<float> gate_preds(assign.size(), 1.0f);
+  std::vector<float> output_grad(assign.size() * kDim, 0.0f);
+  cpu_experts_combine_backward(outputs.data(),
+                               assign.data(),
+                               gate_preds.data(),
+                               output_grad.data(),
+                               outputs_grad.data(),
+                               gate_grads.data(),
+                               0.75f,
+                               kNumExperts,
+                               1,
+                               2,
+                               assign.size(),
+                               kDim);
+  // counts (2, 1, 1) scaled by 0.75 * 3 / 4, minus their mean
+  for (size_t b = 0; b < assign.size(); b++) {
+    EXPECT_FLOAT_EQ(gate_grads[b * kNumExperts + 0], 0.375f);
+    EXPECT_FLOAT_EQ(gate_grads[b * kNumExperts + 1], -0.1875f);
+    EXPECT_FLOAT_EQ(gate_grads[b * kNumExperts + 2], -0.1875f);
+  }
+}
@@ -0,0 +1,122 @@
+#include "flexflow/simulator.h"
+#include "gtest/gtest.h"
+#include <queue>
+
+using namespace FlexFlow;
+
+namespace {
+
+// Hop distances from src by a BFS over the dense adjacency matrix
+std::vector<int> dense_distances(std::vector<int> const &dense,
+                                 int num_devs,
+                                 int src) {
+  std::vector<int> dist(num_devs, -1);
+  std::queue<int> q;
+  dist[src] = 0;
+  q.push(src);
+  while (!q.empty()) {
+    int u = q.front();
+    q.pop();
+    for (int v = 0; v < num_devs; v++) {
+      if (dense[(size_t)u * num_devs + v] > 0 && dist[v] == -1) {
+        dist[v] = dist[u] + 1;
+        q.push(v);
+      }
+    }
+  }
+  return dist;
+}
+
+// One link device per edge of conn, keyed as in NetworkedMachineModel
+struct Links {
+  Links(SparseConnectionMatrix const &conn) {
+    int n = conn.num_devs();
+    for (int src = 0; src < n; src++) {
+      for (size_t k = conn.row_begin(src); k < conn.row_end(src); k++) {
+        size_t key = (size_t)src * n + conn.neighbor(k);
+        CommDevice *link = new CommDevice(
+            "LINK", CommDevice::NW_COMM, -1, -1, (int)key, 0, 0);
+        devmap[key] = link;
+        keys[link] = key;
+      }
+    }
+  }
+  ~Links() {
+    for (auto const &it : devmap) {
+      delete it.second;
+    }
+  }
+  std::map<size_t, CommDevice *> devmap;
+  std::map<CommDevice const *, size_t> keys;
+};
+
+// Checks that every route found on the CSR matrix is a path of the dense
+// matrix whose length is the dense shortest distance
+template <typename Strategy>
+void check_routes(SparseConnectionMatrix const &conn) {
+  int n = conn.num_devs();
+  std::vector<int> dense = conn.to_dense();
+  Links links(conn);
+  Strategy strategy(conn, links.devmap, n);
+  for (int src = 0; src < n; src++) {
+    std::vector<int> dist = dense_distances(dense, n, src);
+    std::vector<std::pair<int, int>> hops = strategy.hop_count(src);
+    std::vector<EcmpRoutes> routes = strategy.get_routes_from_src(src);
+    for (int dst = 0; dst < n; dst++) {
+      if (dst == src) {
+        continue;
+      }
+      ASSERT_GT(dist[dst], 0);
+      EXPECT_EQ(hops[dst].first, dist[dst] - 1);
+      ASSERT_EQ(routes[dst].second.size(), (size_t)1);
+      Route const &route = routes[dst].second[0];
+      ASSERT_EQ(route.size(), (size_t)dist[dst]);
+      int curr = src;
+      for (CommDevice const *link : route) {
+        size_t key = links.keys.at(link);
+        EXPECT_EQ(key / n, (size_t)curr);
+        EXPECT_GT(dense[key], 0);
+        curr = key % n;
+      }
+      EXPECT_EQ(curr, dst);
+    }
+  }
+}
+
+} // namespace
+
+TEST(network_routing, shortest_path_matches_dense_reference) {
+  check_routes<ShortestPathNetworkRoutingStrategy>(
+      FlatDegConstraintNetworkTopologyGenerator(16, 3).generate_topology());
+  check_routes<ShortestPathNetworkRoutingStrategy>(
+      BigSwitchNetworkTopologyGenerator(8).generate_topology());
+}
+
+TEST(network_routing, weighted_shortest_path_matches_dense_reference) {
+  check_routes<WeightedShortestPathRoutingStrategy>(
+      FlatDegConstraintNetworkTopologyGenerator(16, 3).generate_topology());
+  check_routes<WeightedShortestPathRoutingStrategy>(
+      BigSwitchNetworkTopologyGenerator(8).generate_topology());
+}
+
+TEST(network_routing, generators_emit_sparse_topologies) {
+  SparseConnectionMatrix conn =
+      FlatDegConstraintNetworkTopologyGenerator(32, 4).generate_topology();
+  EXPECT_EQ(conn.num_devs(), 32);
+  for (int i = 0; i < 32; i++) {
+    int links = 0;
+    for (size_t k = conn.row_begin(i); k < conn.row_end(i); k++) {
+      EXPECT_EQ(conn.weight(k), conn.get(conn.neighbor(k), i));
+      links += conn.weight(k);
+    }
+    EXPECT_LE(links, 4);
+  }
+
+  SparseConnectionMatrix big_switch =
+      BigSwitchNetworkTopologyGenerator(8).generate_topology();
+  EXPECT_EQ(big_switch.num_devs(), 9);
+  EXPECT_EQ(big_switch.num_edges(), 16);
+  EXPECT_EQ(FCTopologyGenerator(5).generate_topology().num_edges(), 20);
+  EXPECT_EQ(
+      FlatEmptyNetworkTopologyGenerator(5).generate_topology().num_edges(), 0);
+}
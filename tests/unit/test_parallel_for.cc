@@ -0,0 +1,33 @@
+#include "flexflow/utils/parallel_for.h"
+#include "gtest/gtest.h"
+#include <vector>
+
+using namespace FlexFlow;
+
+TEST(parallel_for, calls_each_index_once) {
+  std::atomic<int> budget(3);
+  std::vector<std::atomic<int>> calls(100);
+  parallel_for(calls.size(), budget, [&](size_t i) { calls[i]++; });
+  for (std::atomic<int> const &c : calls) {
+    EXPECT_EQ(c.load(), 1);
+  }
+  EXPECT_EQ(budget.load(), 3);
+}
+
+TEST(parallel_for, nested_loops_share_budget) {
+  std::atomic<int> budget(2);
+  std::atomic<int> total(0);
+  parallel_for(4, budget, [&](size_t) {
+    EXPECT_GE(budget.load(), 0);
+    parallel_for(8, budget, [&](size_t) { total++; });
+  });
+  EXPECT_EQ(total.load(), 32);
+  EXPECT_EQ(budget.load(), 2);
+}
+
+TEST(parallel_for, runs_inline_without_budget) {
+  std::atomic<int> budget(0);
+  std::vector<size_t> order;
+  parallel_for(5, budget, [&](size_t i) { order.push_back(i); });
+  EXPECT_EQ(order, std::vector<size_t>({0, 1, 2, 3, 4}));
+}
@@ -0,0 +1,72 @@
+#include "flexflow/pipeline_schedule.h"
+#include "gtest/gtest.h"
+
+using namespace FlexFlow;
+
+static size_t count_steps(PipelineSchedule const &schedule, bool forward) {
+  size_t count = 0;
+  for (std::vector<PipelineStep> const &steps : schedule) {
+    for (PipelineStep const &step : steps) {
+      count += step.forward == forward;
+    }
+  }
+  return count;
+}
+
+TEST(pipeline_schedule, one_f_one_b_order) {
+  PipelineSchedule schedule = get_pipeline_schedule(PIPELINE_1F1B, 4, 8);
+  ASSERT_EQ(schedule.size(), 4);
+  EXPECT_EQ(count_steps(schedule, true), 4 * 8);
+  EXPECT_EQ(count_steps(schedule, false), 4 * 8);
+  // the first stage warms up with one forward pass per later stage
+  for (int i = 0; i < 4; i++) {
+    EXPECT_TRUE(schedule[0][i].forward);
+  }
+  EXPECT_FALSE(schedule[0][4].forward);
+  EXPECT_EQ(schedule[0][4].micro_batch, 0);
+  // the last stage alternates from the start
+  EXPECT_TRUE(schedule[3][0].forward);
+  EXPECT_FALSE(schedule[3][1].forward);
+}
+
+TEST(pipeline_schedule, one_f_one_b_time) {
+  // uniform stages take (num_micro_batches + num_stages - 1) steps
+  PipelineSchedule schedule = get_pipeline_schedule(PIPELINE_1F1B, 4, 8);
+  std::vector<float> forward(4, 1.0f), backward(4, 2.0f);
+  EXPECT_FLOAT_EQ(estimate_pipeline_time(schedule, forward, backward, 0.0f),
+                  (8 + 4 - 1) * 3.0f);
+  // a single stage runs the micro-batches back to back
+  schedule = get_pipeline_schedule(PIPELINE_1F1B, 1, 8);
+  EXPECT_FLOAT_EQ(estimate_pipeline_time(schedule, {1.0f}, {2.0f}, 5.0f),
+                  8 * 3.0f);
+}
+
+TEST(pipeline_schedule, slowest_stage_bounds_time) {
+  PipelineSchedule schedule = get_pipeline_schedule(PIPELINE_1F1B, 2, 16);
+  float time = estimate_pipeline_time(
+      schedule, {1.0f, 4.0f}, {2.0f, 8.0f}, 0.5f);
+  EXPECT_GE(time, 16 * 12.0f);
+  EXPECT_LT(time, 17 * 12.0f + 2.0f);
+}
+
+TEST(pipeline_schedule, interleaved) {
+  EXPECT_TRUE(get_pipeline_schedule(PIPELINE_INTERLEAVED_1F1B, 4, 6, 2)
+                  .empty());
+  EXPECT_TRUE(get_pipeline_schedule(PIPELINE_1F1B, 4, 8, 2).empty());
+
+  PipelineSchedule schedule =
+      get_pipeline_schedule(PIPELINE_INTERLEAVED_1F1B, 4, 8, 2);
+  ASSERT_EQ(schedule.size(), 4);
+  EXPECT_EQ(count_steps(schedule, true), 4 * 8 * 2);
+  EXPECT_EQ(count_steps(schedule, false), 4 * 8 * 2);
+  // the same model split into twice as many chunks has a smaller bubble
+  std::vector<float> forward(8, 0.5f), backward(8, 1.0f);
+  float interleaved = estimate_pipeline_time(schedule, forward, backward, 0.0f);
+  float one_f_one_b = estimate_pipeline_time(
+      get_pipeline_schedule(PIPELINE_1F1B, 4, 8),
+      std::vector<float>(4, 1.0f),
+      std::vector<float>(4, 2.0f),
+      0.0f);
+  EXPECT_LT(interleaved, one_f_one_b);
+  EXPECT_GE(interleaved, 8 * 3.0f);
+}
@@ -0,0 +1,106 @@
+#include "flexflow/replan.h"
+#include "gtest/gtest.h"
+#include <algorithm>
+
+using namespace FlexFlow;
+
+TEST(replan, load_imbalance) {
+  EXPECT_DOUBLE_EQ(load_imbalance({}), 1.0);
+  EXPECT_DOUBLE_EQ(load_imbalance({0.0, 0.0}), 1.0);
+  EXPECT_DOUBLE_EQ(load_imbalance({5.0, 5.0, 5.0, 5.0}), 1.0);
+  // the busiest of 4 entries gets 10 of 16
+  EXPECT_DOUBLE_EQ(load_imbalance({10.0, 2.0, 2.0, 2.0}), 2.5);
+}
+
+TEST(replan, expert_alpha_covers_the_most_loaded_expert) {
+  // one of 8 experts gets a quarter of the assignments
+  EXPECT_FLOAT_EQ(replan_expert_alpha(0.25, 8, 1.0f, 4.0f), 2.0f);
+  EXPECT_FLOAT_EQ(replan_expert_alpha(0.25, 8, 1.25f, 4.0f), 2.5f);
+  // never below a balanced assignment, never above the bound
+  EXPECT_FLOAT_EQ(replan_expert_alpha(0.1, 8, 1.0f, 4.0f), 1.0f);
+  EXPECT_FLOAT_EQ(replan_expert_alpha(0.9, 8, 1.0f, 4.0f), 4.0f);
+}
+
+// An operator that runs on one of num_devices devices, currently on current
+static PlacementChoice single_device_op(double time,
+                                        int current,
+                                        int num_devices) {
+  PlacementChoice op;
+  op.time = time;
+  op.current = current;
+  for (int d = 0; d < num_devices; d++) {
+    op.candidates.push_back({d});
+  }
+  return op;
+}
+
+TEST(replan, rebalance_spreads_operators_over_devices) {
+  // Four operators all placed on device 0 of 2
+  std::vector<PlacementChoice> ops = {single_device_op(4.0, 0, 2),
+                                      single_device_op(3.0, 0, 2),
+                                      single_device_op(2.0, 0, 2),
+                                      single_device_op(1.0, 0, 2)};
+  std::vector<int> current = {0, 0, 0, 0};
+  EXPECT_DOUBLE_EQ(load_imbalance(device_loads(ops, current, 2)), 2.0);
+
+  std::vector<int> choice = rebalance_placements(ops, 2, 4 /*budget*/);
+  std::vector<double> loads = device_loads(ops, choice, 2);
+  EXPECT_DOUBLE_EQ(loads[0], 5.0);
+  EXPECT_DOUBLE_EQ(loads[1], 5.0);
+}
+
+TEST(replan, rebalance_moves_at_most_budget_operators) {
+  std::vector<PlacementChoice> ops = {single_device_op(4.0, 0, 2),
+                                      single_device_op(3.0, 0, 2),
+                                      single_device_op(2.0, 0, 2),
+                                      single_device_op(1.0, 0, 2)};
+  std::vector<int> choice = rebalance_placements(ops, 2, 1 /*budget*/);
+  int moved = 0;
+  for (size_t i = 0; i < ops.size(); i++) {
+    moved += (choice[i] != ops[i].current);
+  }
+  EXPECT_EQ(moved, 1);
+  // the longest operator moves, to the idle device
+  EXPECT_EQ(choice[0], 1);
+  EXPECT_EQ(rebalance_placements(ops, 2, 0 /*budget*/),
+            std::vector<int>({0, 0, 0, 0}));
+}
+
+TEST(replan, rebalance_keeps_a_balanced_placement) {
+  // Two-device operators that can start on device 0 or 2 of 4
+  std::vector<PlacementChoice> ops(2);
+  for (int i = 0; i < 2; i++) {
+    ops[i].time = 1.0;
+    ops[i].current = i;
+    ops[i].candidates = {{0, 1}, {2, 3}};
+  }
+  std::vector<int> choice = rebalance_placements(ops, 4, 8 /*budget*/);
+  EXPECT_EQ(choice, std::vector<int>({0, 1}));
+}
+
+TEST(replan, rebalance_never_increases_the_busiest_device) {
+  // Operators spanning different numbers of devices, placed arbitrarily
+  std::vector<PlacementChoice> ops;
+  for (int i = 0; i < 6; i++) {
+    PlacementChoice op;
+    op.time = 1.0 + (i * 7) % 5;
+    int width = 1 + i % 3;
+    for (int start = 0; start + width <= 4; start++) {
+      std::vector<int> devices;
+      for (int d = start; d < start + width; d++) {
+        devices.push_back(d);
+      }
+      op.candidates.push_back(devices);
+    }
+    op.current = 0;
+    ops.push_back(op);
+  }
+  std::vector<int> current(ops.size(), 0);
+  std::vector<double> before = device_loads(ops, current, 4);
+  for (int budget = 0; budget <= 6; budget++) {
+    std::vector<double> after =
+        device_loads(ops, rebalance_placements(ops, 4, budget), 4);
+    EXPECT_LE(*std::max_element(after.begin(), after.end()),
+              *std::max_element(before.begin(), before.end()));
+  }
+}
@@ -0,0 +1,66 @@
+#include "flexflow/roofline.h"
+#include "gtest/gtest.h"
+
+using namespace FlexFlow;
+
+namespace {
+
+// 10 TFLOP/s, 1000 GB/s and 10 us per kernel
+RooflineSpec const kSpec = {10.0f, 1000.0f, 0.01f};
+
+} // namespace
+
+TEST(roofline, linear_is_compute_bound) {
+  // a batch of 64 through a 1024 x 4096 layer with a bias
+  RooflineWork work;
+  work.flops = linear_flops(64 * 4096, 1024);
+  EXPECT_DOUBLE_EQ(work.flops, 2.0 * 64 * 4096 * 1024);
+  work.bytes = 4.0 * (64 * 1024 + 64 * 4096 + 1024 * 4096 + 4096);
+  work.has_weights = true;
+  float forward_time, backward_time;
+  roofline_pass_times(kSpec, work, true, forward_time, backward_time);
+  // 0.054 ms of FLOPs beat 0.018 ms of memory traffic
+  EXPECT_FLOAT_EQ(forward_time, work.flops / 1e10 + 0.01);
+  // the gradients w.r.t. the input and the weights double the work
+  EXPECT_FLOAT_EQ(backward_time, 2.0 * work.flops / 1e10 + 0.01);
+}
+
+TEST(roofline, depthwise_conv2d_is_memory_bound) {
+  // 8 images of 32 channels of 112 x 112, one 3 x 3 filter per channel
+  double volume = 8.0 * 32 * 112 * 112;
+  RooflineWork work;
+  work.flops = conv2d_flops(volume, 32, 32 /*groups*/, 3, 3);
+  EXPECT_DOUBLE_EQ(work.flops, 2.0 * volume * 9);
+  work.bytes = 4.0 * (2 * volume + 32 * 9);
+  work.has_weights = true;
+  float forward_time, backward_time;
+  roofline_pass_times(kSpec, work, true, forward_time, backward_time);
+  EXPECT_FLOAT_EQ(forward_time, work.bytes / 1e9 + 0.01);
+  EXPECT_FLOAT_EQ(backward_time, 2.0 * work.bytes / 1e9 + 0.01);
+}
+
+TEST(roofline, experts_pay_for_empty_rows_and_the_all_to_all) {
+  // 2 local experts over the capacity of 16 rows of each of 4 batch shards
+  RooflineWork work;
+  work.flops = experts_flops(2, 16 * 4, 512, 1024);
+  EXPECT_DOUBLE_EQ(work.flops, 2.0 * 2 * 64 * 512 * 1024);
+  work.bytes = 4.0 * 2 * 64 * (512 + 1024);
+  work.has_weights = true;
+  work.xfer_time = 0.5f;
+  float forward_time, backward_time;
+  roofline_pass_times(kSpec, work, true, forward_time, backward_time);
+  EXPECT_FLOAT_EQ(forward_time, work.flops / 1e10 + 0.01 + 0.5);
+  EXPECT_FLOAT_EQ(backward_time, 2.0 * work.flops / 1e10 + 0.01 + 0.5);
+}
+
+TEST(roofline, no_backward_in_inference) {
+  RooflineWork work;
+  work.flops = linear_flops(64 * 4096, 1024);
+  work.bytes = 4.0 * (64 * 1024 + 64 * 4096 + 1024 * 4096);
+  work.has_weights = true;
+  work.xfer_time = 0.5f;
+  float forward_time, backward_time;
+  roofline_pass_times(kSpec, work, false, forward_time, backward_time);
+  EXPECT_FLOAT_EQ(forward_time, work.flops / 1e10 + 0.01 + 0.5);
+  EXPECT_EQ(backward_time, 0.0f);
+}
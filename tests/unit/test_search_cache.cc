@@ -0,0 +1,50 @@
+#include "flexflow/search_cache.h"
+#include "gtest/gtest.h"
+#include <cassert>
+#include <cstdlib>
+#include <string>
+
+using namespace FlexFlow::PCG;
+
+static std::string make_temp_dir() {
+  char tmpl[] = "/tmp/ff_search_cache_XXXXXX";
+  char *dir = mkdtemp(tmpl);
+  assert(dir != nullptr);
+  return dir;
+}
+
+TEST(search_cache, costs_round_trip) {
+  std::string dir = make_temp_dir();
+  SearchCache cache(dir, 42);
+  std::unordered_map<size_t, float> costs = {{1, 0.5f}, {2, 1.5f}};
+  EXPECT_TRUE(cache.save_costs("graph_costs", costs));
+
+  std::unordered_map<size_t, float> loaded = {{2, 3.0f}};
+  EXPECT_TRUE(cache.load_costs("graph_costs", loaded));
+  EXPECT_EQ(loaded.size(), 2);
+  EXPECT_EQ(loaded.at(1), 0.5f);
+  // entries already in memory are not overwritten
+  EXPECT_EQ(loaded.at(2), 3.0f);
+}
+
+TEST(search_cache, blob_round_trip) {
+  std::string dir = make_temp_dir();
+  SearchCache cache(dir, 42);
+  std::vector<char> data;
+  EXPECT_FALSE(cache.load_blob(7, data));
+
+  std::string const payload = "serialized graph";
+  EXPECT_TRUE(cache.save_blob(7, payload.data(), payload.size()));
+  EXPECT_TRUE(cache.load_blob(7, data));
+  EXPECT_EQ(std::string(data.begin(), data.end()), payload);
+}
+
+TEST(search_cache, context_mismatch) {
+  std::string dir = make_temp_dir();
+  std::unordered_map<size_t, float> costs = {{1, 0.5f}};
+  EXPECT_TRUE(SearchCache(dir, 1).save_costs("graph_costs", costs));
+
+  std::unordered_map<size_t, float> loaded;
+  EXPECT_FALSE(SearchCache(dir, 2).load_costs("graph_costs", loaded));
+  EXPECT_TRUE(loaded.empty());
+}
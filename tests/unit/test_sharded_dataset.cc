@@ -0,0 +1,147 @@
+#include "flexflow/sharded_dataset.h"
+#include "gtest/gtest.h"
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <vector>
+
+using namespace FlexFlow;
+
+static std::string make_temp_dir() {
+  char tmpl[] = "/tmp/ff_sharded_dataset_XXXXXX";
+  char *dir = mkdtemp(tmpl);
+  assert(dir != nullptr);
+  return dir;
+}
+
+// Writes a version 1.0 .npy file of num_samples x 3 int32 values, where value
+// j of sample i is first + i * 3 + j
+static void write_npy(std::string const &path, int first, int num_samples) {
+  std::string header = "{'descr': '<i4', 'fortran_order': False, 'shape': (" +
+                       std::to_string(num_samples) + ", 3), }";
+  // the data starts at a multiple of 64 bytes, and the header ends with \n
+  while ((10 + header.size() + 1) % 64 != 0) {
+    header += ' ';
+  }
+  header += '\n';
+  std::ofstream out(path, std::ios::binary);
+  out.write("\x93NUMPY\x01\x00", 8);
+  uint16_t header_bytes = header.size();
+  out.write((char const *)&header_bytes, 2);
+  out.write(header.data(), header.size());
+  for (int i = 0; i < num_samples * 3; i++) {
+    int32_t value = first + i;
+    out.write((char const *)&value, sizeof(value));
+  }
+}
+
+TEST(sharded_dataset, npy_shards_form_one_array) {
+  std::string dir = make_temp_dir();
+  write_npy(dir + "/part-0.npy", 0, 4);
+  write_npy(dir + "/part-1.npy", 12, 3);
+  write_npy(dir + "/part-2.npy", 21, 5);
+  std::vector<std::string> paths = ShardedDataset::list_shards(dir);
+  ASSERT_EQ(paths.size(), 3);
+  EXPECT_EQ(paths[1], dir + "/part-1.npy");
+
+  ShardedDataset dataset(paths);
+  EXPECT_EQ(dataset.num_samples(), 12);
+  EXPECT_EQ(dataset.sample_bytes(), 3 * sizeof(int32_t));
+  EXPECT_EQ(dataset.data_type(), DT_INT32);
+  EXPECT_EQ(dataset.sample_shape(), std::vector<size_t>({3}));
+  for (size_t i = 0; i < dataset.num_samples(); i++) {
+    int32_t const *sample = (int32_t const *)dataset.sample(i);
+    EXPECT_EQ(sample[0], i * 3);
+    EXPECT_EQ(sample[2], i * 3 + 2);
+  }
+
+  // a batch spanning all the shards
+  std::vector<size_t> idxs = {11, 0, 5, 3, 4};
+  std::vector<int32_t> batch(idxs.size() * 3);
+  dataset.will_need(idxs.data(), idxs.size());
+  dataset.gather(idxs.data(), idxs.size(), batch.data());
+  for (size_t i = 0; i < idxs.size(); i++) {
+    EXPECT_EQ(batch[i * 3 + 1], idxs[i] * 3 + 1);
+  }
+}
+
+TEST(sharded_dataset, raw_shards_and_errors) {
+  std::string dir = make_temp_dir();
+  {
+    std::ofstream out(dir + "/a.bin", std::ios::binary);
+    for (int64_t i = 0; i < 6; i++) {
+      out.write((char const *)&i, sizeof(i));
+    }
+  }
+  {
+    std::ofstream out(dir + "/shards.txt");
+    out << dir + "/a.bin\n" << dir + "/a.bin\n";
+  }
+  ShardedDataset dataset(ShardedDataset::list_shards(dir + "/shards.txt"),
+                         2 * sizeof(int64_t));
+  EXPECT_EQ(dataset.num_samples(), 6);
+  EXPECT_EQ(dataset.data_type(), DT_NONE);
+  EXPECT_EQ(((int64_t const *)dataset.sample(4))[1], 3);
+
+  // raw shards need a sample size, and shards must exist
+  EXPECT_THROW(ShardedDataset({dir + "/a.bin"}), std::runtime_error);
+  EXPECT_THROW(ShardedDataset({dir + "/missing.npy"}), std::runtime_error);
+  // every shard must have the same samples
+  write_npy(dir + "/b.npy", 0, 2);
+  EXPECT_THROW(ShardedDataset({dir + "/b.npy", dir + "/a.bin"}, 8),
+               std::runtime_error);
+}
+
+TEST(sharded_dataset, partitions_cover_the_samples) {
+  size_t covered = 0;
+  for (int part = 0; part < 3; part++) {
+    std::pair<size_t, size_t> range = partition_samples(10, part, 3);
+    EXPECT_EQ(range.first, covered);
+    EXPECT_GE(range.second - range.first, 3);
+    covered = range.second;
+  }
+  EXPECT_EQ(covered, 10);
+}
+
+TEST(sharded_dataset, shuffle_buffer_permutes_each_epoch) {
+  size_t const begin = 100, end = 137, buffer_size = 8;
+  ShuffleBufferSampler sampler(begin, end, buffer_size, 7 /*seed*/);
+  std::vector<std::vector<size_t>> orders;
+  for (int epoch = 0; epoch < 2; epoch++) {
+    sampler.reset(epoch);
+    std::vector<size_t> order;
+    size_t idxs[5];
+    while (size_t num = sampler.next_batch(idxs, 5)) {
+      // only the last batch of the epoch is partial
+      EXPECT_TRUE(num == 5 || sampler.remaining() == 0);
+      order.insert(order.end(), idxs, idxs + num);
+    }
+    ASSERT_EQ(order.size(), end - begin);
+    for (size_t i = 0; i < order.size(); i++) {
+      // a sample is never drawn before it enters the buffer
+      EXPECT_LT(order[i], begin + i + buffer_size);
+    }
+    std::vector<size_t> sorted = order;
+    std::sort(sorted.begin(), sorted.end());
+    for (size_t i = 0; i < sorted.size(); i++) {
+      EXPECT_EQ(sorted[i], begin + i);
+    }
+    orders.push_back(order);
+  }
+  EXPECT_NE(orders[0], orders[1]);
+
+  // the order only depends on the seed and the epoch
+  ShuffleBufferSampler other(begin, end, buffer_size, 7 /*seed*/);
+  other.reset(1);
+  std::vector<size_t> idxs(end - begin);
+  EXPECT_EQ(other.next_batch(idxs.data(), idxs.size()), idxs.size());
+  EXPECT_EQ(idxs, orders[1]);
+
+  // a buffer of one sample keeps the order
+  ShuffleBufferSampler sequential(begin, end, 1, 7 /*seed*/);
+  EXPECT_EQ(sequential.next_batch(idxs.data(), 3), 3);
+  EXPECT_EQ(idxs[2], begin + 2);
+}
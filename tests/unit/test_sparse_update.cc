@@ -0,0 +1,193 @@
+#include "flexflow/sparse_update_helpers.h"
+#include "gtest/gtest.h"
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <vector>
+
+using namespace FlexFlow::SparseUpdate;
+
+namespace {
+
+int const kNumChannels = 2;
+
+// A table of 6 rows of kNumChannels channels, row r holding (r, -r)
+std::vector<float> table() {
+  std::vector<float> w;
+  for (int r = 0; r < 6; r++) {
+    w.push_back(r);
+    w.push_back(-r);
+  }
+  return w;
+}
+
+// Coalesces ids as coalesce_rows of optimizer_kernel.cu does, with the
+// thrust calls replaced by their sequential equivalents
+size_t coalesce(std::vector<int64_t> const &ids,
+                int divisor,
+                float scale,
+                std::vector<float> const &src,
+                std::vector<int64_t> &rows,
+                std::vector<float> &values) {
+  size_t count = ids.size();
+  std::vector<int64_t> perm(count);
+  std::iota(perm.begin(), perm.end(), 0);
+  std::stable_sort(perm.begin(), perm.end(), [&](int64_t a, int64_t b) {
+    return ids[a] < ids[b];
+  });
+  std::vector<int64_t> segment_starts;
+  rows.clear();
+  for (size_t j = 0; j < count; j++) {
+    if (j == 0 || ids[perm[j]] != rows.back()) {
+      rows.push_back(ids[perm[j]]);
+      segment_starts.push_back(j);
+    }
+  }
+  size_t num_unique = rows.size();
+  values.resize(num_unique * kNumChannels);
+  for (size_t i = 0; i < values.size(); i++) {
+    values[i] = segment_sum(i,
+                            num_unique,
+                            count,
+                            kNumChannels,
+                            segment_starts.data(),
+                            perm.data(),
+                            divisor,
+                            scale,
+                            src.data());
+  }
+  return num_unique;
+}
+
+} // namespace
+
+TEST(sparse_update, coalesce_sums_duplicates_and_padding_comes_first) {
+  // Two ids per bag; bag b has the gradient (b + 1, 10 * (b + 1))
+  std::vector<int64_t> ids = {3, 1, 3, -1, 1, 3};
+  std::vector<float> grad = {1, 10, 2, 20, 3, 30};
+  std::vector<int64_t> rows;
+  std::vector<float> values;
+  size_t num_unique =
+      coalesce(ids, 2 /*divisor*/, 0.5f /*scale*/, grad, rows, values);
+  ASSERT_EQ(num_unique, 3);
+  EXPECT_EQ(rows, std::vector<int64_t>({-1, 1, 3}));
+  // row 1 is in bags 0 and 2, row 3 in bags 0, 1 and 2
+  EXPECT_EQ(values, std::vector<float>({1, 10, 2, 20, 3, 30}));
+}
+
+TEST(sparse_update, coalescing_gathered_replicas_sums_them) {
+  // The local unique rows of two replicas, the second one padded with row -1
+  // to the count of the first, as allgather_sparse_gradient gathers them
+  std::vector<int64_t> gathered = {0, 4, 2, -1};
+  std::vector<float> grads = {2, 2, 4, 4, 5, 7, 0, 0};
+  std::vector<int64_t> rows;
+  std::vector<float> values;
+  coalesce(gathered, 1 /*divisor*/, 1.0f /*scale*/, grads, rows, values);
+  EXPECT_EQ(rows, std::vector<int64_t>({-1, 0, 2, 4}));
+  EXPECT_EQ(values, std::vector<float>({0, 0, 2, 2, 5, 7, 4, 4}));
+}
+
+TEST(sparse_update, sgd_updates_touched_rows_of_the_shard_only) {
+  std::vector<int64_t> rows = {-1, 1, 2, 4};
+  std::vector<float> values = {9, 9, 1, 2, 3, 4, 5, 6};
+  // the shard holds rows [1, 3]
+  std::vector<float> w = table(), v(w.size(), 0.5f);
+  std::vector<float> w0 = w, v0 = v;
+  float lr = 0.1f, momentum = 0.9f;
+  for (size_t i = 0; i < rows.size() * kNumChannels; i++) {
+    sgd_step(i,
+             kNumChannels,
+             rows.data(),
+             values.data(),
+             1 /*row_lo*/,
+             3 /*row_hi*/,
+             lr,
+             0.0f /*weight_decay*/,
+             momentum,
+             false /*nesterov*/,
+             v.data(),
+             w.data());
+  }
+  for (int c = 0; c < kNumChannels; c++) {
+    // rows 1 and 2 are at offsets 0 and 1 of the shard
+    for (int r = 0; r < 2; r++) {
+      int k = r * kNumChannels + c;
+      float vt = 0.5f * momentum + values[(r + 1) * kNumChannels + c];
+      EXPECT_FLOAT_EQ(v[k], vt);
+      EXPECT_FLOAT_EQ(w[k], w0[k] - lr * vt);
+    }
+    // row 3 was not looked up: its momentum is not applied
+    int k = 2 * kNumChannels + c;
+    EXPECT_EQ(v[k], v0[k]);
+    EXPECT_EQ(w[k], w0[k]);
+  }
+}
+
+TEST(sparse_update, adam_and_adagrad_are_lazy) {
+  std::vector<int64_t> rows = {0, 5};
+  std::vector<float> values = {1, -2, 3, 4};
+  float alpha_t = 0.01f, beta1 = 0.9f, beta2 = 0.999f, epsilon = 1e-8f;
+  float weight_decay = 0.1f;
+  std::vector<float> w = table(), m(w.size(), 0.25f), v(w.size(), 0.5f);
+  std::vector<float> w0 = w;
+  for (size_t i = 0; i < rows.size() * kNumChannels; i++) {
+    adam_step(i,
+              kNumChannels,
+              rows.data(),
+              values.data(),
+              0 /*row_lo*/,
+              5 /*row_hi*/,
+              alpha_t,
+              beta1,
+              beta2,
+              weight_decay,
+              epsilon,
+              m.data(),
+              v.data(),
+              w.data());
+  }
+  for (int r = 0; r < 6; r++) {
+    for (int c = 0; c < kNumChannels; c++) {
+      int k = r * kNumChannels + c;
+      if (r != 0 && r != 5) {
+        // the moments of rows that were not looked up do not decay
+        EXPECT_EQ(m[k], 0.25f);
+        EXPECT_EQ(v[k], 0.5f);
+        EXPECT_EQ(w[k], w0[k]);
+        continue;
+      }
+      float gt = values[(r == 0 ? 0 : 1) * kNumChannels + c] +
+                 weight_decay * w0[k];
+      float mt = beta1 * 0.25f + (1 - beta1) * gt;
+      float vt = beta2 * 0.5f + (1 - beta2) * gt * gt;
+      EXPECT_FLOAT_EQ(m[k], mt);
+      EXPECT_FLOAT_EQ(v[k], vt);
+      EXPECT_FLOAT_EQ(w[k], w0[k] - alpha_t * mt / (sqrtf(vt) + epsilon));
+    }
+  }
+
+  float lr = 0.1f;
+  w = table();
+  v.assign(w.size(), 0.0f);
+  for (size_t i = 0; i < rows.size() * kNumChannels; i++) {
+    adagrad_step(i,
+                 kNumChannels,
+                 rows.data(),
+                 values.data(),
+                 0 /*row_lo*/,
+                 5 /*row_hi*/,
+                 lr,
+                 0.0f /*weight_decay*/,
+                 0.0f /*epsilon*/,
+                 v.data(),
+                 w.data());
+  }
+  // the first step of Adagrad moves each touched weight by lr * sign(g)
+  EXPECT_FLOAT_EQ(w[0], w0[0] - lr);
+  EXPECT_FLOAT_EQ(w[1], w0[1] + lr);
+  EXPECT_FLOAT_EQ(v[1], 4.0f);
+  EXPECT_EQ(std::vector<float>(v.begin() + 2, v.begin() + 10),
+            std::vector<float>(8, 0.0f));
+  EXPECT_FLOAT_EQ(w[10], w0[10] - lr);
+  EXPECT_FLOAT_EQ(w[11], w0[11] - lr);
+}
@@ -0,0 +1,160 @@
+#include "flexflow/strategy_file.h"
+#include "gtest/gtest.h"
+#include <cassert>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+
+using namespace FlexFlow::PCG;
+
+static std::string make_temp_dir() {
+  char tmpl[] = "/tmp/ff_strategy_file_XXXXXX";
+  char *dir = mkdtemp(tmpl);
+  assert(dir != nullptr);
+  return dir;
+}
+
+static StrategyFileKey make_key() {
+  StrategyFileKey key;
+  key.model_signature = 0x1234abcd5678ef00ULL;
+  key.binding_signature = binding_signature({1, 2}, {3, 5, 8});
+  key.num_nodes = 2;
+  key.workers_per_node = 4;
+  key.cpus_per_node = 8;
+  return key;
+}
+
+TEST(strategy_file, round_trip) {
+  std::string path = make_temp_dir() + "/strategy.ff";
+  std::string strategy = "serialized graph and views";
+  save_strategy_file(path, make_key(), strategy.data(), strategy.size());
+
+  std::vector<char> loaded;
+  std::string reason;
+  EXPECT_TRUE(load_strategy_file(path, make_key(), loaded, reason));
+  EXPECT_EQ(std::string(loaded.begin(), loaded.end()), strategy);
+
+  // exporting again overwrites the strategy
+  save_strategy_file(path, make_key(), strategy.data(), 6);
+  EXPECT_TRUE(load_strategy_file(path, make_key(), loaded, reason));
+  EXPECT_EQ(std::string(loaded.begin(), loaded.end()), "serial");
+}
+
+TEST(strategy_file, other_models_and_machines_are_searched_again) {
+  std::string dir = make_temp_dir();
+  std::string path = dir + "/strategy.ff";
+  std::vector<char> loaded;
+  std::string reason;
+  EXPECT_FALSE(load_strategy_file(path, make_key(), loaded, reason));
+  EXPECT_FALSE(reason.empty());
+
+  std::string strategy = "abc";
+  save_strategy_file(path, make_key(), strategy.data(), strategy.size());
+  StrategyFileKey other_model = make_key();
+  other_model.model_signature++;
+  EXPECT_FALSE(load_strategy_file(path, other_model, loaded, reason));
+  StrategyFileKey other_machine = make_key();
+  other_machine.workers_per_node = 8;
+  reason.clear();
+  EXPECT_FALSE(load_strategy_file(path, other_machine, loaded, reason));
+  EXPECT_NE(reason.find("4 GPUs"), std::string::npos);
+}
+
+TEST(strategy_file, models_numbered_differently_are_searched_again) {
+  std::string path = make_temp_dir() + "/strategy.ff";
+  std::string strategy = "abc";
+  save_strategy_file(path, make_key(), strategy.data(), strategy.size());
+  std::vector<char> loaded;
+  std::string reason;
+  // The same model built after another one, so that its guids are shifted
+  StrategyFileKey shifted = make_key();
+  shifted.binding_signature = binding_signature({11, 12}, {13, 15, 18});
+  EXPECT_FALSE(load_strategy_file(path, shifted, loaded, reason));
+  EXPECT_NE(reason.find("numbered differently"), std::string::npos);
+  // The guids are bound in order
+  StrategyFileKey reordered = make_key();
+  reordered.binding_signature = binding_signature({2, 1}, {3, 5, 8});
+  EXPECT_FALSE(load_strategy_file(path, reordered, loaded, reason));
+  EXPECT_TRUE(load_strategy_file(path, make_key(), loaded, reason));
+}
+
+TEST(strategy_file, corrupt_files_are_errors) {
+  std::string dir = make_temp_dir();
+  std::vector<char> loaded;
+  std::string reason;
+  std::string not_strategy = dir + "/not_strategy.ff";
+  std::ofstream(not_strategy) << "{\"graph\": []}";
+  EXPECT_THROW(load_strategy_file(not_strategy, make_key(), loaded, reason),
+               std::runtime_error);
+
+  std::string path = dir + "/strategy.ff";
+  std::string strategy(100, 'x');
+  save_strategy_file(path, make_key(), strategy.data(), strategy.size());
+  std::string truncated = dir + "/truncated.ff";
+  {
+    std::ifstream in(path, std::ios::binary);
+    std::string contents((std::istreambuf_iterator<char>(in)),
+                         std::istreambuf_iterator<char>());
+    std::ofstream(truncated, std::ios::binary)
+        << contents.substr(0, contents.size() - 10);
+  }
+  EXPECT_THROW(load_strategy_file(truncated, make_key(), loaded, reason),
+               std::runtime_error);
+
+  EXPECT_THROW(save_strategy_file(
+                   dir + "/missing/strategy.ff", make_key(), "x", 1),
+               std::runtime_error);
+}
+
+TEST(pcg_file, round_trip) {
+  std::string path = make_temp_dir() + "/model.pcg";
+  PCGFileInfo info;
+  info.model_signature = 0x1234abcd5678ef00ULL;
+  info.binding_signature = 42;
+  info.cpus_per_node = 8;
+  info.computation_mode = 1;
+  std::string pcg = "serialized graph";
+  save_pcg_file(path, info, pcg.data(), pcg.size());
+
+  PCGFileInfo loaded_info;
+  std::vector<char> loaded;
+  load_pcg_file(path, loaded_info, loaded);
+  EXPECT_EQ(loaded_info.model_signature, info.model_signature);
+  EXPECT_EQ(loaded_info.binding_signature, info.binding_signature);
+  EXPECT_EQ(loaded_info.cpus_per_node, 8);
+  EXPECT_EQ(loaded_info.computation_mode, 1);
+  EXPECT_EQ(std::string(loaded.begin(), loaded.end()), pcg);
+}
+
+TEST(pcg_file, missing_and_corrupt_files_are_errors) {
+  std::string dir = make_temp_dir();
+  PCGFileInfo info;
+  std::vector<char> loaded;
+  EXPECT_THROW(load_pcg_file(dir + "/missing.pcg", info, loaded),
+               std::runtime_error);
+
+  // a strategy is not a PCG
+  std::string strategy_path = dir + "/strategy.ff";
+  save_strategy_file(strategy_path, make_key(), "abc", 3);
+  EXPECT_THROW(load_pcg_file(strategy_path, info, loaded),
+               std::runtime_error);
+
+  std::string path = dir + "/model.pcg";
+  info.model_signature = 1;
+  info.binding_signature = 1;
+  info.cpus_per_node = 1;
+  info.computation_mode = 0;
+  std::string pcg(100, 'x');
+  save_pcg_file(path, info, pcg.data(), pcg.size());
+  std::string truncated = dir + "/truncated.pcg";
+  {
+    std::ifstream in(path, std::ios::binary);
+    std::string contents((std::istreambuf_iterator<char>(in)),
+                         std::istreambuf_iterator<char>());
+    std::ofstream(truncated, std::ios::binary)
+        << contents.substr(0, contents.size() - 10);
+  }
+  EXPECT_THROW(load_pcg_file(truncated, info, loaded), std::runtime_error);
+}
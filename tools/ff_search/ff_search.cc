@@ -0,0 +1,155 @@
+/* Copyright 2023 CMU, Facebook, LANL, MIT, NVIDIA, and Stanford (alphabetical)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Searches the strategy of a PCG exported with --export-pcg without any GPU,
+// estimating the operator costs with the analytical cost model, and writes a
+// strategy file that the training job loads with --import.
+//
+//   ff_search -ll:cpu 1 --pcg model.pcg --output strategy.ff
+//             --search-num-nodes 2 --search-num-workers 8
+//             --search-gpu-memory 32768 [--machine-model-version 1
+//             --machine-model-file machine.conf] [--budget 20 ...]
+
+#include "flexflow/ffconst_utils.h"
+#include "flexflow/model.h"
+#include "flexflow/simulator.h"
+#include "flexflow/strategy_file.h"
+#include "flexflow/substitution.h"
+#include <iostream>
+
+using namespace Legion;
+using namespace FlexFlow;
+using FlexFlow::PCG::Graph;
+using FlexFlow::PCG::Node;
+
+LegionRuntime::Logger::Category log_search("ff_search");
+
+struct SearchArgs {
+  std::string pcg_file;
+  std::string output_file;
+  // The memory of each GPU of the target machine, in MB
+  size_t gpu_memory_mb = 16384;
+};
+
+static void parse_search_args(char **argv, int argc, SearchArgs &args) {
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--pcg")) {
+      args.pcg_file = std::string(argv[++i]);
+      continue;
+    }
+    if (!strcmp(argv[i], "--output") || !strcmp(argv[i], "-o")) {
+      args.output_file = std::string(argv[++i]);
+      continue;
+    }
+    if (!strcmp(argv[i], "--search-gpu-memory")) {
+      args.gpu_memory_mb = atoll(argv[++i]);
+      continue;
+    }
+  }
+}
+
+void FlexFlow::top_level_task(Task const *task,
+                              std::vector<PhysicalRegion> const &regions,
+                              Context ctx,
+                              Runtime *runtime) {
+  FFConfig ffConfig;
+  SearchArgs args;
+  {
+    InputArgs const &command_args = HighLevelRuntime::get_input_args();
+    parse_search_args(command_args.argv, command_args.argc, args);
+  }
+  if (args.pcg_file.empty() || args.output_file.empty() ||
+      !ffConfig.search_num_nodes.has_value() ||
+      !ffConfig.search_num_workers.has_value()) {
+    fprintf(stderr,
+            "Usage: ff_search --pcg <file> --output <file> "
+            "--search-num-nodes <n> --search-num-workers <n> "
+            "[--search-gpu-memory <MB>] [search flags]\n");
+    exit(1);
+  }
+  if (ffConfig.only_data_parallel) {
+    fprintf(stderr, "A data-parallel PCG needs no search.\n");
+    exit(1);
+  }
+  PCG::PCGFileInfo info;
+  std::vector<char> pcg;
+  PCG::load_pcg_file(args.pcg_file, info, pcg);
+
+  // Describe the target machine rather than this one; the search always
+  // estimates costs analytically, since there is no GPU to profile on
+  ffConfig.numNodes = ffConfig.search_num_nodes.value();
+  ffConfig.workersPerNode = ffConfig.search_num_workers.value();
+  ffConfig.cpusPerNode = info.cpus_per_node;
+  ffConfig.computationMode = (CompMode)info.computation_mode;
+  ffConfig.analytical_cost_model = true;
+  FFModel model(ffConfig, true /*cpu_only*/);
+
+  Graph *graph = new Graph(&model);
+  {
+    Deserializer dez(pcg.data(), pcg.size());
+    std::unordered_map<Node, MachineView> no_views;
+    model.deserialize_graph_optimal_view(dez, graph, no_views);
+    assert(no_views.empty());
+  }
+  log_search.print("Loaded a PCG of %zu operators from %s",
+                   graph->inEdges.size(),
+                   args.pcg_file.c_str());
+
+  size_t gpu_mem_capacity = args.gpu_memory_mb * 1024 * 1024;
+  std::unique_ptr<MachineModel> machine;
+  if (ffConfig.machine_model_version == 0) {
+    machine = std::unique_ptr<MachineModel>(new SimpleMachineModel(
+        ffConfig.numNodes, ffConfig.workersPerNode, gpu_mem_capacity));
+  } else if (ffConfig.machine_model_version == 1 and
+             !ffConfig.machine_model_file.empty()) {
+    machine = std::unique_ptr<MachineModel>(new EnhancedMachineModel(
+        ffConfig.machine_model_file, gpu_mem_capacity));
+  } else {
+    fprintf(stderr, "machine-model-version 1 requires a machine-model-file.\n");
+    exit(1);
+  }
+  std::unique_ptr<Simulator> simulator(new Simulator(&model, machine.get()));
+  model.simulator = simulator.get();
+
+  std::unique_ptr<Graph> best_graph;
+  std::unordered_map<Node, MachineView> optimal_views;
+  model.graph_search->graph_optimize(graph, best_graph, optimal_views);
+
+  Serializer sez;
+  model.serialize_graph_optimal_view(sez, best_graph.get(), optimal_views);
+  PCG::StrategyFileKey key;
+  key.model_signature = info.model_signature;
+  key.binding_signature = info.binding_signature;
+  key.num_nodes = ffConfig.numNodes;
+  key.workers_per_node = ffConfig.workersPerNode;
+  key.cpus_per_node = ffConfig.cpusPerNode;
+  PCG::save_strategy_file(args.output_file,
+                          key,
+                          (char const *)sez.get_buffer(),
+                          sez.get_used_bytes());
+
+  for (auto const &it : optimal_views) {
+    std::cout << it.first.guid << " "
+              << get_operator_type_name(it.first.ptr->op_type) << ": "
+              << it.second << std::endl;
+  }
+  log_search.print("Wrote the strategy for %d nodes with %d GPUs each to %s",
+                   key.num_nodes,
+                   key.workers_per_node,
+                   args.output_file.c_str());
+  model.simulator = NULL;
+}
+
+void FlexFlow::register_custom_tasks() {}
@@ -0,0 +1,188 @@
+/* Copyright 2023 CMU, Facebook, LANL, MIT, NVIDIA, and Stanford (alphabetical)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Compares the dispatch of Group_by, Aggregate and AggregateSpec, which
+// assigns each token the row of its experts, with the single-threaded
+// dispatch they used to run and with the CPU reference:
+//
+//   moe_dispatch_bench [-b batch_size] [-n experts] [-k chosen_experts]
+//                      [-a alpha] [-s skew] [-i iterations]
+//
+// A skew above 0 sends that fraction of the tokens to expert 0 first, so
+// that it overflows.
+
+#include "flexflow/ops/kernels/moe_dispatch_kernels.h"
+#include "flexflow/utils/cuda_helper.h"
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+using namespace FlexFlow::Kernels::MoeDispatch;
+
+// The dispatch of the former gb_forward_kernel, on a single thread
+__global__ void serial_slots_kernel(int const *exp_assign,
+                                    int num_assignments,
+                                    int n,
+                                    int capacity,
+                                    int *slots,
+                                    int *expert_counts) {
+  for (int e = 0; e < n; e++) {
+    expert_counts[e] = 0;
+  }
+  for (int i = 0; i < num_assignments; i++) {
+    int expert = exp_assign[i];
+    slots[i] = expert_counts[expert] < capacity ? expert_counts[expert] : -1;
+    expert_counts[expert]++;
+  }
+}
+
+static std::vector<int>
+    make_assignments(int batch_size, int n, int k, float skew) {
+  std::mt19937 gen(0);
+  std::uniform_real_distribution<float> coin(0.0f, 1.0f);
+  std::vector<int> assign(batch_size * k);
+  std::vector<int> experts(n);
+  for (int b = 0; b < batch_size; b++) {
+    // k distinct experts per token, as chosen by top-k
+    for (int e = 0; e < n; e++) {
+      experts[e] = e;
+    }
+    std::shuffle(experts.begin(), experts.end(), gen);
+    if (coin(gen) < skew) {
+      std::swap(experts[0], *std::find(experts.begin(), experts.end(), 0));
+    }
+    for (int j = 0; j < k; j++) {
+      assign[b * k + j] = experts[j];
+    }
+  }
+  return assign;
+}
+
+int main(int argc, char **argv) {
+  int batch_size = 8192, n = 64, k = 2, iterations = 20;
+  float alpha = 1.0f, skew = 0.0f;
+  for (int i = 1; i + 1 < argc; i += 2) {
+    if (!strcmp(argv[i], "-b")) {
+      batch_size = atoi(argv[i + 1]);
+    } else if (!strcmp(argv[i], "-n")) {
+      n = atoi(argv[i + 1]);
+    } else if (!strcmp(argv[i], "-k")) {
+      k = atoi(argv[i + 1]);
+    } else if (!strcmp(argv[i], "-a")) {
+      alpha = atof(argv[i + 1]);
+    } else if (!strcmp(argv[i], "-s")) {
+      skew = atof(argv[i + 1]);
+    } else if (!strcmp(argv[i], "-i")) {
+      iterations = atoi(argv[i + 1]);
+    } else {
+      fprintf(stderr, "Unknown argument %s\n", argv[i]);
+      return 1;
+    }
+  }
+  assert(k <= n);
+  int num_assignments = batch_size * k;
+  int capacity = expert_capacity(alpha, k, n, batch_size);
+  std::vector<int> assign = make_assignments(batch_size, n, k, skew);
+
+  // CPU reference
+  std::vector<int> cpu_slots(num_assignments), cpu_counts(n);
+  auto cpu_start = std::chrono::steady_clock::now();
+  for (int it = 0; it < iterations; it++) {
+    cpu_compute_expert_slots(assign.data(),
+                             num_assignments,
+                             n,
+                             capacity,
+                             cpu_slots.data(),
+                             cpu_counts.data());
+  }
+  std::chrono::duration<double, std::milli> cpu_time =
+      std::chrono::steady_clock::now() - cpu_start;
+
+  cudaStream_t stream;
+  checkCUDA(cudaStreamCreate(&stream));
+  int *exp_assign;
+  void *workspace;
+  checkCUDA(cudaMalloc(&exp_assign, num_assignments * sizeof(int)));
+  checkCUDA(cudaMalloc(&workspace, dispatch_buffers_size(num_assignments, n)));
+  checkCUDA(cudaMemcpy(exp_assign,
+                       assign.data(),
+                       num_assignments * sizeof(int),
+                       cudaMemcpyHostToDevice));
+  DispatchBuffers buffers =
+      get_dispatch_buffers(workspace, num_assignments, n);
+
+  cudaEvent_t t_start, t_end;
+  checkCUDA(cudaEventCreate(&t_start));
+  checkCUDA(cudaEventCreate(&t_end));
+  float serial_time = 0, parallel_time = 0;
+  for (int variant = 0; variant < 2; variant++) {
+    checkCUDA(cudaEventRecord(t_start, stream));
+    for (int it = 0; it < iterations; it++) {
+      if (variant == 0) {
+        serial_slots_kernel<<<1, 1, 0, stream>>>(exp_assign,
+                                                 num_assignments,
+                                                 n,
+                                                 capacity,
+                                                 buffers.slots,
+                                                 buffers.expert_counts);
+      } else {
+        compute_expert_slots(
+            exp_assign, num_assignments, n, capacity, buffers, stream);
+      }
+    }
+    checkCUDA(cudaEventRecord(t_end, stream));
+    checkCUDA(cudaEventSynchronize(t_end));
+    checkCUDA(cudaEventElapsedTime(
+        variant == 0 ? &serial_time : &parallel_time, t_start, t_end));
+
+    std::vector<int> slots(num_assignments), counts(n);
+    checkCUDA(cudaMemcpy(slots.data(),
+                         buffers.slots,
+                         num_assignments * sizeof(int),
+                         cudaMemcpyDeviceToHost));
+    checkCUDA(cudaMemcpy(counts.data(),
+                         buffers.expert_counts,
+                         n * sizeof(int),
+                         cudaMemcpyDeviceToHost));
+    if (slots != cpu_slots || counts != cpu_counts) {
+      fprintf(stderr,
+              "The %s dispatch does not match the CPU reference\n",
+              variant == 0 ? "serial" : "parallel");
+      return 1;
+    }
+  }
+
+  printf("batch_size(%d) n(%d) k(%d) capacity(%d) dropped(%d of %d)\n",
+         batch_size,
+         n,
+         k,
+         capacity,
+         num_dropped(cpu_counts.data(), n, capacity),
+         num_assignments);
+  printf("cpu reference: %.4lfms\n", cpu_time.count() / iterations);
+  printf("gpu serial:    %.4lfms\n", serial_time / iterations);
+  printf("gpu parallel:  %.4lfms\n", parallel_time / iterations);
+
+  checkCUDA(cudaEventDestroy(t_start));
+  checkCUDA(cudaEventDestroy(t_end));
+  checkCUDA(cudaFree(exp_assign));
+  checkCUDA(cudaFree(workspace));
+  checkCUDA(cudaStreamDestroy(stream));
+  return 0;
+}